@@ -346,6 +346,32 @@ SRST
     Show guest USB devices.
 ERST
 
+    {
+        .name       = "teleport-express",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show teleport-express per-device call statistics",
+        .cmd_info_hrt = qmp_x_query_teleport_express,
+    },
+
+SRST
+  ``info teleport-express``
+    Show teleport-express per-device and per-function call statistics.
+ERST
+
+    {
+        .name       = "express-gpu-frames",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show express-gpu per-context frame statistics",
+        .cmd_info_hrt = qmp_x_query_express_gpu_frames,
+    },
+
+SRST
+  ``info express-gpu-frames``
+    Show express-gpu per-context frame timing statistics.
+ERST
+
     {
         .name       = "usbhost",
         .args_type  = "",
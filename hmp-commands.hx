@@ -633,6 +633,19 @@ SRST
   whether profiling is on or off.
 ERST
 
+    {
+        .name       = "teleport_express_reset_stats",
+        .args_type  = "",
+        .params     = "",
+        .help       = "reset teleport-express call statistics",
+        .cmd        = hmp_teleport_express_reset_stats,
+    },
+
+SRST
+``teleport_express_reset_stats``
+  Reset the statistics shown by ``info teleport-express``.
+ERST
+
     {
         .name       = "system_reset",
         .args_type  = "",
@@ -0,0 +1,434 @@
+/**
+ * vSoC camera frame sources
+ *
+ * Besides the host camera, a media file can be played in a loop and a test
+ * pattern can be generated, so the camera pipeline can be used, tested and
+ * benchmarked without capture hardware.
+ */
+
+// #define STD_DEBUG_LOG
+
+#include "hw/teleport-express/express_log.h"
+#include "hw/teleport-express/express_device_common.h"
+#include "hw/express-camera/camera_source.h"
+
+#include "libavutil/imgutils.h"
+
+// how long the device reader waits before asking a device without a new frame again
+#define CAMERA_DEVICE_POLL_US 1000
+
+#define CAMERA_SYNTHETIC_WIDTH 1280
+#define CAMERA_SYNTHETIC_HEIGHT 720
+#define CAMERA_SYNTHETIC_FPS 30
+
+// replaces the host cameras with a test pattern or a media file when set, see camera_source_open
+char *express_camera_source = NULL;
+
+typedef struct DeviceSource {
+    CameraSource source;
+    AVFormatContext *format_context;
+    int stream_index;
+
+    QemuThread reader;
+    GMutex lock;
+    // newest frame nobody has read yet
+    AVPacket *latest;
+    bool has_latest;
+    int error;
+    bool stop;
+} DeviceSource;
+
+typedef struct FileSource {
+    CameraSource source;
+    AVFormatContext *format_context;
+    int stream_index;
+
+    // first pts of the file, and the pts following the last packet handed out
+    int64_t first_pts;
+    int64_t next_pts;
+    // added to the pts of the file so that every loop continues the timeline
+    int64_t loop_offset;
+    int64_t frame_duration;
+} FileSource;
+
+typedef struct SyntheticSource {
+    CameraSource source;
+    int64_t frame_index;
+    int frame_size;
+} SyntheticSource;
+
+// BT.601 limited range white, yellow, cyan, green, magenta, red, blue, black
+static const uint8_t g_bar_yuv[8][3] = {
+    {235, 128, 128}, {210, 16, 146}, {170, 166, 16}, {145, 54, 34},
+    {106, 202, 222}, {81, 90, 240}, {41, 240, 110}, {16, 128, 128},
+};
+
+static int find_video_stream(CameraSource *source, AVFormatContext *format_context)
+{
+    int ret = avformat_find_stream_info(format_context, NULL);
+    if (ret < 0) {
+        LOGE("avformat_find_stream_info failed: %s", av_err2str(ret));
+        return ret;
+    }
+
+    int stream_index = av_find_best_stream(format_context, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (stream_index < 0) {
+        LOGE("no video stream found");
+        return stream_index;
+    }
+
+    AVStream *stream = format_context->streams[stream_index];
+    source->codecpar = stream->codecpar;
+    source->time_base = stream->time_base;
+    source->frame_rate = av_guess_frame_rate(format_context, stream, NULL);
+    if (source->frame_rate.num <= 0 || source->frame_rate.den <= 0) {
+        source->frame_rate = (AVRational){ CAMERA_SYNTHETIC_FPS, 1 };
+    }
+    return stream_index;
+}
+
+static int device_interrupt(void *opaque)
+{
+    DeviceSource *s = opaque;
+    return qatomic_read(&s->stop);
+}
+
+static void *device_reader_thread(void *opaque)
+{
+    DeviceSource *s = opaque;
+    AVPacket *pkt = av_packet_alloc();
+    int ret = 0;
+
+    while (!qatomic_read(&s->stop)) {
+        ret = av_read_frame(s->format_context, pkt);
+        if (ret == AVERROR(EAGAIN)) {
+            // avfoundation returns instead of waiting for the next frame
+            g_usleep(CAMERA_DEVICE_POLL_US);
+            continue;
+        }
+        if (ret < 0) {
+            if (!qatomic_read(&s->stop)) {
+                LOGE("camera device read failed with %d: %s", ret, av_err2str(ret));
+            }
+            break;
+        }
+        if (pkt->stream_index != s->stream_index) {
+            LOGW("camera input packet stream_index %d vs. %d not equal!", pkt->stream_index, s->stream_index);
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        g_mutex_lock(&s->lock);
+        if (s->has_latest) {
+            av_packet_unref(s->latest);
+            s->source.dropped_frames++;
+        }
+        av_packet_move_ref(s->latest, pkt);
+        s->has_latest = true;
+        g_mutex_unlock(&s->lock);
+
+        s->source.notify(s->source.opaque);
+    }
+
+    if (ret < 0 && ret != AVERROR(EAGAIN)) {
+        g_mutex_lock(&s->lock);
+        s->error = ret;
+        g_mutex_unlock(&s->lock);
+        s->source.notify(s->source.opaque);
+    }
+
+    av_packet_free(&pkt);
+    return NULL;
+}
+
+static int device_read_packet(CameraSource *source, AVPacket *pkt)
+{
+    DeviceSource *s = container_of(source, DeviceSource, source);
+    int ret = AVERROR(EAGAIN);
+
+    g_mutex_lock(&s->lock);
+    if (s->has_latest) {
+        av_packet_move_ref(pkt, s->latest);
+        s->has_latest = false;
+        ret = 0;
+    }
+    else if (s->error < 0) {
+        ret = s->error;
+    }
+    g_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+static void device_close(CameraSource *source)
+{
+    DeviceSource *s = container_of(source, DeviceSource, source);
+
+    // a device that blocks in av_read_frame returns with the next frame at the latest
+    qatomic_set(&s->stop, true);
+    qemu_thread_join(&s->reader);
+
+    avformat_close_input(&s->format_context);
+    av_packet_free(&s->latest);
+    g_mutex_clear(&s->lock);
+    g_free(s);
+}
+
+CameraSource *camera_source_from_device(AVFormatContext *format_context, CameraSourceNotify notify, void *opaque)
+{
+    DeviceSource *s = g_new0(DeviceSource, 1);
+
+    s->stream_index = find_video_stream(&s->source, format_context);
+    if (s->stream_index < 0) {
+        avformat_close_input(&format_context);
+        g_free(s);
+        return NULL;
+    }
+
+    s->source.name = "device";
+    s->source.paced = false;
+    s->source.notify = notify;
+    s->source.opaque = opaque;
+    s->source.read_packet = device_read_packet;
+    s->source.close = device_close;
+
+    s->format_context = format_context;
+    s->format_context->interrupt_callback.callback = device_interrupt;
+    s->format_context->interrupt_callback.opaque = s;
+    s->latest = av_packet_alloc();
+    g_mutex_init(&s->lock);
+
+    qemu_thread_create(&s->reader, "camera_device_reader", device_reader_thread, s, QEMU_THREAD_JOINABLE);
+    return &s->source;
+}
+
+static int file_rewind(FileSource *s)
+{
+    int64_t start = s->first_pts != AV_NOPTS_VALUE ? s->first_pts : 0;
+    int ret = av_seek_frame(s->format_context, s->stream_index, start, AVSEEK_FLAG_BACKWARD);
+    if (ret < 0) {
+        LOGE("camera file cannot seek back to %" PRId64 ": %s", start, av_err2str(ret));
+        return ret;
+    }
+    if (s->first_pts != AV_NOPTS_VALUE) {
+        s->loop_offset = s->next_pts - s->first_pts;
+    }
+    LOGD("camera file loops, pts offset %" PRId64, s->loop_offset);
+    return 0;
+}
+
+static int file_read_packet(CameraSource *source, AVPacket *pkt)
+{
+    FileSource *s = container_of(source, FileSource, source);
+    bool rewound = false;
+    int ret;
+
+    for (;;) {
+        ret = av_read_frame(s->format_context, pkt);
+        if (ret == AVERROR_EOF) {
+            // a file without a single video packet would loop forever
+            if (rewound) {
+                return AVERROR_INVALIDDATA;
+            }
+            ret = file_rewind(s);
+            if (ret < 0) {
+                return ret;
+            }
+            rewound = true;
+            continue;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        if (pkt->stream_index != s->stream_index) {
+            av_packet_unref(pkt);
+            continue;
+        }
+        break;
+    }
+
+    int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    if (pts == AV_NOPTS_VALUE) {
+        // raw streams without timestamps play at their frame rate
+        pkt->pts = s->next_pts;
+        pkt->dts = s->next_pts;
+    }
+    else {
+        if (s->first_pts == AV_NOPTS_VALUE) {
+            s->first_pts = pts;
+        }
+        pkt->pts = pts + s->loop_offset;
+        if (pkt->dts != AV_NOPTS_VALUE) {
+            pkt->dts += s->loop_offset;
+        }
+    }
+    s->next_pts = MAX(s->next_pts, pkt->pts + (pkt->duration > 0 ? pkt->duration : s->frame_duration));
+
+    return 0;
+}
+
+static void file_close(CameraSource *source)
+{
+    FileSource *s = container_of(source, FileSource, source);
+
+    avformat_close_input(&s->format_context);
+    g_free(s);
+}
+
+CameraSource *camera_source_open_file(const char *path)
+{
+    AVFormatContext *format_context = NULL;
+    int ret = avformat_open_input(&format_context, path, NULL, NULL);
+    if (ret < 0) {
+        LOGE("cannot open camera file '%s': %s", path, av_err2str(ret));
+        return NULL;
+    }
+
+    FileSource *s = g_new0(FileSource, 1);
+    s->stream_index = find_video_stream(&s->source, format_context);
+    if (s->stream_index < 0) {
+        avformat_close_input(&format_context);
+        g_free(s);
+        return NULL;
+    }
+
+    s->source.name = "file";
+    s->source.paced = true;
+    s->source.read_packet = file_read_packet;
+    s->source.close = file_close;
+
+    s->format_context = format_context;
+    s->first_pts = AV_NOPTS_VALUE;
+    s->frame_duration = MAX(av_rescale_q(1, av_inv_q(s->source.frame_rate), s->source.time_base), 1);
+
+    LOGI("camera file '%s' %dx%d@%d/%dfps codec %s", path, s->source.codecpar->width, s->source.codecpar->height,
+         s->source.frame_rate.num, s->source.frame_rate.den, avcodec_get_name(s->source.codecpar->codec_id));
+    return &s->source;
+}
+
+static void synthetic_draw(SyntheticSource *s, uint8_t *data)
+{
+    int width = s->source.codecpar->width;
+    int height = s->source.codecpar->height;
+    int chroma_width = AV_CEIL_RSHIFT(width, 1);
+    int chroma_height = AV_CEIL_RSHIFT(height, 1);
+    // the bars scroll to the left and a line runs down, so every frame differs
+    int shift = (s->frame_index * 4) % width;
+    int line = (s->frame_index * 2) % height;
+    uint8_t *y_plane = data;
+    uint8_t *u_plane = y_plane + width * height;
+    uint8_t *v_plane = u_plane + chroma_width * chroma_height;
+
+    for (int x = 0; x < width; x++) {
+        y_plane[x] = g_bar_yuv[(x + shift) % width * 8 / width][0];
+    }
+    for (int x = 0; x < chroma_width; x++) {
+        int bar = (x * 2 + shift) % width * 8 / width;
+        u_plane[x] = g_bar_yuv[bar][1];
+        v_plane[x] = g_bar_yuv[bar][2];
+    }
+    for (int y = 1; y < height; y++) {
+        memcpy(y_plane + y * width, y_plane, width);
+    }
+    for (int y = 1; y < chroma_height; y++) {
+        memcpy(u_plane + y * chroma_width, u_plane, chroma_width);
+        memcpy(v_plane + y * chroma_width, v_plane, chroma_width);
+    }
+    memset(y_plane + line * width, 128, width);
+}
+
+static int synthetic_read_packet(CameraSource *source, AVPacket *pkt)
+{
+    SyntheticSource *s = container_of(source, SyntheticSource, source);
+
+    int ret = av_new_packet(pkt, s->frame_size);
+    if (ret < 0) {
+        return ret;
+    }
+    synthetic_draw(s, pkt->data);
+
+    pkt->pts = s->frame_index;
+    pkt->dts = s->frame_index;
+    pkt->duration = 1;
+    pkt->flags |= AV_PKT_FLAG_KEY;
+    s->frame_index++;
+
+    return 0;
+}
+
+static void synthetic_close(CameraSource *source)
+{
+    SyntheticSource *s = container_of(source, SyntheticSource, source);
+
+    avcodec_parameters_free(&s->source.codecpar);
+    g_free(s);
+}
+
+CameraSource *camera_source_open_synthetic(int width, int height, AVRational frame_rate)
+{
+    if (width <= 0 || height <= 0 || frame_rate.num <= 0 || frame_rate.den <= 0) {
+        LOGE("invalid synthetic camera %dx%d@%d/%dfps", width, height, frame_rate.num, frame_rate.den);
+        return NULL;
+    }
+
+    SyntheticSource *s = g_new0(SyntheticSource, 1);
+    s->source.name = "synthetic";
+    s->source.paced = true;
+    s->source.read_packet = synthetic_read_packet;
+    s->source.close = synthetic_close;
+    s->source.frame_rate = frame_rate;
+    s->source.time_base = av_inv_q(frame_rate);
+
+    s->source.codecpar = avcodec_parameters_alloc();
+    s->source.codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    s->source.codecpar->codec_id = AV_CODEC_ID_RAWVIDEO;
+    s->source.codecpar->format = AV_PIX_FMT_YUV420P;
+    s->source.codecpar->width = width;
+    s->source.codecpar->height = height;
+
+    s->frame_size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1);
+
+    LOGI("synthetic camera %dx%d@%d/%dfps", width, height, frame_rate.num, frame_rate.den);
+    return &s->source;
+}
+
+CameraSource *camera_source_open(const char *spec)
+{
+    if (g_str_has_prefix(spec, "synthetic")) {
+        int width = CAMERA_SYNTHETIC_WIDTH;
+        int height = CAMERA_SYNTHETIC_HEIGHT;
+        int fps = CAMERA_SYNTHETIC_FPS;
+        const char *params = spec + strlen("synthetic");
+
+        if (*params == ':' && sscanf(params + 1, "%dx%d@%d", &width, &height, &fps) < 2) {
+            LOGE("cannot parse camera source '%s', expected synthetic:WxH@FPS", spec);
+            return NULL;
+        }
+        if (*params == 0 || *params == ':') {
+            return camera_source_open_synthetic(width, height, (AVRational){ fps, 1 });
+        }
+    }
+    return camera_source_open_file(spec);
+}
+
+int64_t camera_pacer_due(CameraPacer *pacer, int64_t pts, AVRational time_base, int64_t now_ns)
+{
+    if (pts == AV_NOPTS_VALUE) {
+        return now_ns;
+    }
+
+    if (pacer->started) {
+        int64_t due = pacer->start_ns + av_rescale_q(pts - pacer->start_pts, time_base,
+                                                     (AVRational){ 1, NANOSECONDS_PER_SECOND });
+        if (due > now_ns - CAMERA_PACER_MAX_DRIFT_NS && due < now_ns + CAMERA_PACER_MAX_DRIFT_NS) {
+            return due;
+        }
+        // the timestamps jumped, or the guest has not taken frames for a long time
+        LOGD("camera pacing restarts at pts %" PRId64 ", %" PRId64 " ns off", pts, due - now_ns);
+    }
+
+    pacer->started = true;
+    pacer->start_ns = now_ns;
+    pacer->start_pts = pts;
+    return now_ns;
+}
@@ -8,6 +8,7 @@
 // #define STD_DEBUG_LOG
 
 #include "hw/express-camera/express_camera.h"
+#include "hw/express-camera/camera_source.h"
 
 #define CAMERA_FUN_GET_CAMERA_COUNT 1
 #define CAMERA_FUN_START_STREAM 2
@@ -228,6 +229,13 @@ static void camera_codec_notify(DCodecComponent *context, CodecCallbackData ccd)
 
     LOGD("camera codec callback event %x data1 %d data2 %d ptr %" PRIx64 " flags %x extra %u", ccd.event, ccd.data1, ccd.data2, ccd.data, ccd.flags, ccd.extra);
 
+    if (ccd.event == OMX_EventEmptyBufferDone) {
+        // the decoder is done with the packet handed over by camera_deliver_frame
+        AVPacket *pkt = (AVPacket *)(uintptr_t)ccd.data;
+        av_packet_free(&pkt);
+        return;
+    }
+
     if (ccd.event != OMX_EventFillBufferDone) {
         return;
     }
@@ -242,37 +250,104 @@ static void camera_codec_notify(DCodecComponent *context, CodecCallbackData ccd)
     }
 }
 
-static void *camera_capturing_thread(void *opaque)
+static int64_t camera_now_ns(void)
+{
+    return g_get_monotonic_time() * SCALE_US;
+}
+
+/**
+ * wakes up the capturing thread, called when the guest queues a buffer,
+ * when the camera device captured a frame and when the stream stops
+ */
+static void camera_wake(void *opaque)
 {
     Camera_Context *context = (Camera_Context *)opaque;
-    CameraProp * prop = &g_array_index(g_camera_list, CameraProp, context->camera_id);
-    AVFormatContext *format_context = NULL;
-    AVPacket packet;
-    int stream_index = -1;
-    int ret;
 
-    format_context = open_camera(prop);
-    if (format_context == NULL) {
-        LOGE("error: cannot open camera!");
-        return NULL;
+    g_mutex_lock(&context->wake_lock);
+    context->wake_pending = true;
+    g_cond_signal(&context->wake_cond);
+    g_mutex_unlock(&context->wake_lock);
+}
+
+static void camera_wait(Camera_Context *context, int64_t deadline_ns)
+{
+    gint64 end_time = (deadline_ns + SCALE_US - 1) / SCALE_US;
+
+    g_mutex_lock(&context->wake_lock);
+    while (!context->wake_pending && context->status == CAMERA_STATUS_STREAMING) {
+        if (!g_cond_wait_until(&context->wake_cond, &context->wake_lock, end_time)) {
+            break;
+        }
+    }
+    context->wake_pending = false;
+    g_mutex_unlock(&context->wake_lock);
+}
+
+static CameraSource *open_camera_source(Camera_Context *context, CameraProp *prop)
+{
+    if (express_camera_source != NULL) {
+        return camera_source_open(express_camera_source);
     }
 
-    if (avformat_find_stream_info(format_context, NULL) < 0) {
-        LOGE("error: Could not find stream information");
+    AVFormatContext *format_context = open_camera(prop);
+    if (format_context == NULL) {
         return NULL;
     }
+    return camera_source_from_device(format_context, camera_wake, context);
+}
 
-    stream_index = av_find_best_stream(format_context, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+/**
+ * hands a guest buffer and the frame to fill it with to the decoder
+ */
+static void camera_deliver_frame(DCodecComponent *codec, BufferDesc *output, AVPacket *pkt)
+{
+    // the decoder runs on its own worker, the packet is freed when it returns the input buffer
+    AVPacket *input_pkt = av_packet_alloc();
+    av_packet_move_ref(input_pkt, pkt);
+
+    BufferDesc *input = g_malloc0(sizeof(BufferDesc));
+    input->type = CODEC_BUFFER_TYPE_INPUT | CODEC_BUFFER_TYPE_AVPACKET;
+    input->id = (uint64_t)(uintptr_t)input_pkt;
+    input->data = input_pkt;
+    input->nAllocLen = input_pkt->size;
+    input->nFilledLen = input_pkt->size;
+    input->nOffset = 0;
+    input->nTimeStamp = input_pkt->pts;
+    input->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
+
+    LOGD("processing output buffer with desc id %" PRIx64, output->id);
+
+    g_mutex_lock(&codec->lock);
+    dcodec_process_this_buffer(codec, output);
+    dcodec_process_this_buffer(codec, input);
+    g_mutex_unlock(&codec->lock);
+}
+
+static void *camera_capturing_thread(void *opaque)
+{
+    Camera_Context *context = (Camera_Context *)opaque;
+    CameraProp * prop = &g_array_index(g_camera_list, CameraProp, context->camera_id);
+    CameraSource *source = NULL;
+    CameraPacer pacer;
+    AVPacket *pkt = NULL;
+    AVPacket *newer = NULL;
+    bool have_pkt = false;
+    int64_t due = 0;
+    uint64_t delivered = 0;
+    uint64_t skipped = 0;
+    int ret;
 
-    if (stream_index < 0) {
-        LOGE("error: Could not find video stream");
+    source = open_camera_source(context, prop);
+    if (source == NULL) {
+        LOGE("error: cannot open camera!");
         return NULL;
     }
 
-    AVCodecParameters *codecpar = format_context->streams[stream_index]->codecpar;
+    AVCodecParameters *codecpar = source->codecpar;
     DCodecComponent *codec = dcodec_vdec_init_component(OMX_VIDEO_CodingAutoDetect, camera_codec_notify);
     if (!codec) {
         LOGE("error: codec init failed!");
+        source->close(source);
         return NULL;
     }
     codec->mAppPrivate = (uint64_t)context;
@@ -296,62 +371,78 @@ static void *camera_capturing_thread(void *opaque)
     out_def.bLowLatency = OMX_TRUE;
     codec->set_parameter(codec, OMX_IndexParamVideoDcodecDefinition, &out_def);
 
-    codec->mCtx->pkt_timebase = format_context->streams[stream_index]->time_base;
+    codec->mCtx->pkt_timebase = source->time_base;
+
+    // decoding and conversion no longer hold up capturing
+    dcodec_component_start_worker(codec);
+
+    int64_t frame_interval = av_rescale_q(1, av_inv_q(source->frame_rate), (AVRational){ 1, NANOSECONDS_PER_SECOND });
+    camera_pacer_reset(&pacer);
+    pkt = av_packet_alloc();
+    newer = av_packet_alloc();
 
     g_async_queue_ref(context->frame_queue);
 
+    LOGI("camera id %d capturing from %s source, frame interval %" PRId64 " us", context->camera_id, source->name, frame_interval / SCALE_US);
+
     while (context->status == CAMERA_STATUS_STREAMING) {
-        // allocate some time slice to the decoder for faster buffer retrieval
-        dcodec_process_buffers(codec);
-
-        // then read frame
-        ret = av_read_frame(format_context, &packet);
-        if (ret < 0) {
-            if (ret != AVERROR(EAGAIN)) {
-                char error_msg[256] = {0};
-                av_strerror(ret, error_msg, 256);
-                LOGE("av_read_frame failed with %d: %s", ret, error_msg);
+        int64_t now = camera_now_ns();
+
+        if (!have_pkt) {
+            ret = source->read_packet(source, pkt);
+            if (ret == 0) {
+                have_pkt = true;
+                due = source->paced ? camera_pacer_due(&pacer, pkt->pts, source->time_base, now) : now;
+            }
+            else if (ret != AVERROR(EAGAIN)) {
+                LOGE("camera %s source failed with %d: %s", source->name, ret, av_err2str(ret));
+                break;
             }
-            usleep(100);
-            continue;
         }
-        if (packet.stream_index != stream_index) {
-            LOGW("camera input packet stream_index %d vs. %d not equal!", packet.stream_index, stream_index);
+        else if (!source->paced) {
+            // the guest holds all buffers, keep the newest frame of the device only
+            if (source->read_packet(source, newer) == 0) {
+                av_packet_unref(pkt);
+                av_packet_move_ref(pkt, newer);
+                due = now;
+                skipped++;
+            }
         }
-
-        // obtained frame from camera (through ffmpeg) 
-        LOGD("obtained frame from camera!");
-
-        // send output buffer first
-        // there need to be empty buffers in the camera's bufferqueue
-        BufferDesc *desc = (BufferDesc *)g_async_queue_try_pop(context->frame_queue);
-        if (desc == NULL) {
-            av_packet_unref(&packet);
+        else if (now >= due + frame_interval) {
+            // the guest did not give us a buffer before the next frame is due, skip to it
+            av_packet_unref(pkt);
+            have_pkt = false;
+            skipped++;
             continue;
         }
-        LOGD("processing output buffer with desc id %" PRIx64, desc->id);
-        // get a buffer from bufferqueue
-        dcodec_process_this_buffer(codec, desc);
-
-        // send input packet to codec
-        desc = g_malloc(sizeof(BufferDesc));
-        desc->type = CODEC_BUFFER_TYPE_INPUT | CODEC_BUFFER_TYPE_AVPACKET;
-        desc->id = (uint64_t)(uintptr_t)desc;
-        desc->data = &packet;
-        desc->nAllocLen = packet.size;
-        desc->nFilledLen = packet.size;
-        desc->nOffset = 0;
-        desc->nTimeStamp = packet.pts;
-        desc->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
-        
-        //decode and put the result into buffer
-        dcodec_process_this_buffer(codec, desc);
-        av_packet_unref(&packet);
+
+        // fill a buffer as soon as there is one for a frame that is due
+        if (have_pkt && now >= due) {
+            BufferDesc *desc = (BufferDesc *)g_async_queue_try_pop(context->frame_queue);
+            if (desc != NULL) {
+                camera_deliver_frame(codec, desc, pkt);
+                have_pkt = false;
+                delivered++;
+                continue;
+            }
+        }
+
+        // sleep until the frame is due, or until a buffer or a device frame shows up
+        camera_wait(context, (have_pkt && now < due) ? due : now + frame_interval);
     }
 
+    LOGI("camera id %d stopped after %" PRIu64 " frames, %" PRIu64 " skipped, %" PRIu64 " dropped by the source",
+         context->camera_id, delivered, skipped, source->dropped_frames);
+
     // clean up
-    avformat_close_input(&format_context);
-    avformat_free_context(format_context);
+    av_packet_free(&pkt);
+    av_packet_free(&newer);
+    source->close(source);
+
+    // hand the packets still queued in the decoder back so that they are freed
+    g_mutex_lock(&codec->lock);
+    dcodec_send_command(codec, OMX_CommandFlush, CODEC_INPUT_PORT_INDEX, 0);
+    g_mutex_unlock(&codec->lock);
 
     codec->destroy_component(codec);
     g_async_queue_unref(context->frame_queue);
@@ -359,6 +450,43 @@ static void *camera_capturing_thread(void *opaque)
     return NULL;
 }
 
+/*
+* The camera_source option replaces the host cameras with a single camera
+* showing a test pattern or a media file.
+*/
+static int list_virtual_camera(void)
+{
+    CameraProp prop;
+    memset(&prop, 0, sizeof(CameraProp));
+
+    CameraSource *source = camera_source_open(express_camera_source);
+    if (source == NULL) {
+        LOGE("cannot open camera source '%s'", express_camera_source);
+        return 0;
+    }
+
+    snprintf(prop.name, sizeof(prop.name), "%s", express_camera_source);
+    prop.camera_id = 0;
+    prop.width = source->codecpar->width;
+    prop.height = source->codecpar->height;
+    prop.max_width = prop.width;
+    prop.max_height = prop.height;
+    prop.step_width = 2;
+    prop.step_height = 2;
+    prop.line_stride = prop.width * 2;
+    prop.frame_interval_num = source->frame_rate.den;
+    prop.frame_interval_den = source->frame_rate.num;
+    source->close(source);
+
+    LOGI("virtual camera %s: width %u height %u fps %d/%d", prop.name, prop.width, prop.height, prop.frame_interval_den, prop.frame_interval_num);
+
+    g_camera_list = g_array_new(false, true, sizeof(CameraProp));
+    g_array_append_val(g_camera_list, prop);
+    g_camera_count = 1;
+
+    return g_camera_count;
+}
+
 /*
 * list all the cameras.
 */
@@ -373,6 +501,10 @@ int list_cameras(void)
         g_camera_count = 0;
     }
 
+    if (express_camera_source != NULL) {
+        return list_virtual_camera();
+    }
+
     AVDeviceInfoList *device_info_list = av_mallocz(sizeof(AVDeviceInfoList));
     avdevice_register_all();
 
@@ -466,8 +598,9 @@ static void camera_output_call_handle(struct Thread_Context *context, Teleport_E
         else if (camera_context->status == CAMERA_STATUS_IDLE)
         {
             LOGI("camera id %d start stream", camera_id);
-            qemu_thread_create(&camera_context->stream_thread, "camera_capturing_thread", camera_capturing_thread, camera_context, QEMU_THREAD_JOINABLE);
+            // streaming before the thread starts, or it would find the camera idle and quit
             camera_context->status = CAMERA_STATUS_STREAMING;
+            qemu_thread_create(&camera_context->stream_thread, "camera_capturing_thread", camera_capturing_thread, camera_context, QEMU_THREAD_JOINABLE);
         }
         else {
             LOGE("error! cannot start stream when camera is not in idle state (current %d)!", camera_context->status);
@@ -483,6 +616,7 @@ static void camera_output_call_handle(struct Thread_Context *context, Teleport_E
         {
             LOGI("camera id %d stop stream", camera_id);
             camera_context->status = CAMERA_STATUS_IDLE;
+            camera_wake(camera_context);
             qemu_thread_join(&camera_context->stream_thread);
         }
         else {
@@ -490,7 +624,7 @@ static void camera_output_call_handle(struct Thread_Context *context, Teleport_E
         }
 
         while (g_async_queue_length(camera_context->frame_queue) != 0) {
-            g_async_queue_pop(camera_context->frame_queue);
+            dcodec_free_buffer_desc(g_async_queue_pop(camera_context->frame_queue));
         }
         camera_context->guest_pix_fmt = 0;
 
@@ -524,6 +658,7 @@ static void camera_output_call_handle(struct Thread_Context *context, Teleport_E
         desc->nAllocLen = all_para[1].data_len;
 
         g_async_queue_push(camera_context->frame_queue, (gpointer)desc);
+        camera_wake(camera_context);
 
         if (need_free) {
             g_free(params);
@@ -546,6 +681,7 @@ static void camera_output_call_handle(struct Thread_Context *context, Teleport_E
         LOGD("guest dequeue buffer, host camera queue buffer into frame_queue with id %" PRIx64, desc->id);
 
         g_async_queue_push(camera_context->frame_queue, (gpointer)desc);
+        camera_wake(camera_context);
 
         if (need_free) {
             g_free(params);
@@ -583,6 +719,8 @@ static Thread_Context *get_camera_thread_context(uint64_t device_id, uint64_t th
         c_context->ctx.camera_id = (int)unique_id;
         c_context->ctx.status = CAMERA_STATUS_IDLE;
         c_context->ctx.frame_queue = g_async_queue_new_full(dcodec_free_buffer_desc);
+        g_mutex_init(&c_context->ctx.wake_lock);
+        g_cond_init(&c_context->ctx.wake_cond);
 
         g_hash_table_insert(g_camera_thread_contexts_map, GUINT_TO_POINTER(unique_id), (gpointer)context);
     }
@@ -120,14 +120,14 @@ static int getYUVOffsets(int width,
 
 static void getGLTextureFormat(YUVPlane plane, GLint *internalformat, GLenum *format, GLenum *type) {
     switch (plane) {
-    case YUVPlane_Y: {
+    case YUVPlane_Y:
+    case YUVPlane_U:
+    case YUVPlane_V: {
         *internalformat = GL_R8;
         *format = GL_RED;
         *type = GL_UNSIGNED_BYTE;
         return;
     }
-    case YUVPlane_U:
-    case YUVPlane_V:
     case YUVPlane_UV: {
         *internalformat = GL_RG8;
         *format = GL_RG;
@@ -474,16 +474,16 @@ CsConverter *cs_init(const enum AVPixelFormat dst_fmt, const enum AVPixelFormat
  * the converter assumes a current gl context.
 */
 void cs_deinit(CsConverter *conv) {
+    if (conv->mUploadBuffer) glDeleteBuffers(1, &conv->mUploadBuffer);
     if (conv->mQuadIndexBuffer) glDeleteBuffers(1, &conv->mQuadIndexBuffer);
     if (conv->mQuadVertexBuffer) glDeleteBuffers(1, &conv->mQuadVertexBuffer);
     if (conv->mProgram) glDeleteProgram(conv->mProgram);
+    if (conv->mFboY) glDeleteFramebuffers(1, &conv->mFboY);
+    if (conv->mFboUV) glDeleteFramebuffers(1, &conv->mFboUV);
     if (conv->mTextureY) glDeleteTextures(1, &conv->mTextureY);
-    if (isInterleaved(conv->mFormat)) {
-        if (conv->mTextureU) glDeleteTextures(1, &conv->mTextureU);
-    } else {
-        if (conv->mTextureU) glDeleteTextures(1, &conv->mTextureU);
-        if (conv->mTextureV) glDeleteTextures(1, &conv->mTextureV);
-    }
+    // interleaved formats share a single texture for u and v
+    if (conv->mTextureV && conv->mTextureV != conv->mTextureU) glDeleteTextures(1, &conv->mTextureV);
+    if (conv->mTextureU) glDeleteTextures(1, &conv->mTextureU);
     g_free(conv);
 }
 
@@ -556,6 +556,66 @@ static void updateYUVGLTex(GLenum texture_unit,
     glActiveTexture(GL_TEXTURE0);
 }
 
+/**
+ * uploads the planes of a software frame into the tex lines, so that
+ * cs_convert() can run without a cuda device. the planes are packed into a
+ * pixel-unpack buffer first, which lets the texture update run asynchronously.
+ * the frame has to have the size and format of the converter.
+*/
+int cs_upload(CsConverter *conv, const uint8_t *const data[4], const int linesize[4]) {
+    if (conv->mFormat != AV_PIX_FMT_NV12 && conv->mFormat != AV_PIX_FMT_YUV420P) {
+        LOGE("cs_upload: unsupported format %s", av_get_pix_fmt_name(conv->mFormat));
+        return ERR_COLORSPACE_FAILED;
+    }
+
+    bool interleaved = isInterleaved(conv->mFormat);
+    int planes = interleaved ? 2 : 3;
+    int chromaWidth = conv->mWidth / 2;
+    int chromaHeight = conv->mHeight / 2;
+    const int rowBytes[3] = { conv->mWidth, interleaved ? chromaWidth * 2 : chromaWidth, chromaWidth };
+    const int rows[3] = { conv->mHeight, chromaHeight, chromaHeight };
+    size_t offsets[3] = { 0 };
+    size_t size = 0;
+
+    for (int i = 0; i < planes; i++) {
+        offsets[i] = size;
+        size += (size_t)rowBytes[i] * rows[i];
+    }
+
+    if (!conv->mUploadBuffer) {
+        glGenBuffers(1, &conv->mUploadBuffer);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, conv->mUploadBuffer);
+    // orphan the previous frame, its texture update may still be in flight
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    uint8_t *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped == NULL) {
+        LOGE("cs_upload: failed to map the upload buffer, gl error %x", glGetError());
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return ERR_COLORSPACE_FAILED;
+    }
+    for (int i = 0; i < planes; i++) {
+        for (int y = 0; y < rows[i]; y++) {
+            memcpy(mapped + offsets[i] + (size_t)y * rowBytes[i], data[i] + (size_t)y * linesize[i], rowBytes[i]);
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    updateYUVGLTex(GL_TEXTURE0, YUVPlane_Y, conv->mTextureY, conv->mUploadBuffer,
+                   0, 0, conv->mWidth, conv->mHeight, offsets[0]);
+    if (interleaved) {
+        updateYUVGLTex(GL_TEXTURE1, YUVPlane_UV, conv->mTextureU, conv->mUploadBuffer,
+                       0, 0, chromaWidth, chromaHeight, offsets[1]);
+    } else {
+        updateYUVGLTex(GL_TEXTURE1, YUVPlane_U, conv->mTextureU, conv->mUploadBuffer,
+                       0, 0, chromaWidth, chromaHeight, offsets[1]);
+        updateYUVGLTex(GL_TEXTURE2, YUVPlane_V, conv->mTextureV, conv->mUploadBuffer,
+                       0, 0, chromaWidth, chromaHeight, offsets[2]);
+    }
+    return ERR_OK;
+}
+
 /**
  * converts the source tex lines into the destination fbo.
 */
@@ -584,3 +644,192 @@ int cs_convert(const CsConverter *conv, GLuint dst_fbo) {
 
     return ERR_OK;
 }
+
+static void createRGBGLShader(CsConverter *conv) {
+    static const char kVertShader[] =
+        "#version 330\n"
+        "in vec4 aPosition;\n"
+        "void main(void) {\n"
+        "  gl_Position = aPosition;\n"
+        "}\n";
+
+    // limited range 601, the inverse of kFragShaderMain_2_4_3.
+    // the uv pass runs at half resolution and averages the 2x2 block of
+    // source pixels each chroma sample covers.
+    static const char kFragShader[] =
+        "#version 330\n"
+        "precision highp float;\n"
+        "layout (location = 0) out vec4 FragColor;\n"
+        "uniform sampler2D uSamplerRGB;\n"
+        "uniform int uPlane;\n"
+        "const vec3 kY = vec3(0.2567882, 0.5041294, 0.0979059);\n"
+        "const vec3 kU = vec3(-0.1482229, -0.2909928, 0.4392157);\n"
+        "const vec3 kV = vec3(0.4392157, -0.3677883, -0.0714274);\n"
+        "void main(void) {\n"
+        "    ivec2 pos = ivec2(gl_FragCoord.xy);\n"
+        "    if (uPlane == 0) {\n"
+        "        vec3 rgb = texelFetch(uSamplerRGB, pos, 0).rgb;\n"
+        "        FragColor = vec4(dot(rgb, kY) + 0.0625, 0.0, 0.0, 1.0);\n"
+        "    } else {\n"
+        "        ivec2 base = pos * 2;\n"
+        "        vec3 rgb = (texelFetch(uSamplerRGB, base, 0).rgb +\n"
+        "                    texelFetch(uSamplerRGB, base + ivec2(1, 0), 0).rgb +\n"
+        "                    texelFetch(uSamplerRGB, base + ivec2(0, 1), 0).rgb +\n"
+        "                    texelFetch(uSamplerRGB, base + ivec2(1, 1), 0).rgb) * 0.25;\n"
+        "        FragColor = vec4(dot(rgb, kU) + 0.5, dot(rgb, kV) + 0.5, 0.0, 1.0);\n"
+        "    }\n"
+        "}\n";
+
+    const GLchar *vertShaderSource = kVertShader;
+    const GLchar *fragShaderSource = kFragShader;
+
+    GLuint vertShader = glCreateShader(GL_VERTEX_SHADER);
+    GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(vertShader, 1, &vertShaderSource, NULL);
+    glShaderSource(fragShader, 1, &fragShaderSource, NULL);
+    glCompileShader(vertShader);
+    glCompileShader(fragShader);
+
+    for (GLuint shader = vertShader; shader != fragShader;
+         shader = fragShader) {
+        GLint status = GL_FALSE;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+        if (status == GL_FALSE) {
+            GLchar error[1024];
+            glGetShaderInfoLog(shader, sizeof(error), NULL, &error[0]);
+            LOGE("Failed to compile RGB conversion shader: %s", error);
+            glDeleteShader(vertShader);
+            glDeleteShader(fragShader);
+            return;
+        }
+    }
+
+    conv->mProgram = glCreateProgram();
+    glAttachShader(conv->mProgram, vertShader);
+    glAttachShader(conv->mProgram, fragShader);
+    glLinkProgram(conv->mProgram);
+    glDeleteShader(vertShader);
+    glDeleteShader(fragShader);
+
+    GLint status = GL_FALSE;
+    glGetProgramiv(conv->mProgram, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE) {
+        GLchar error[1024];
+        glGetProgramInfoLog(conv->mProgram, sizeof(error), 0, &error[0]);
+        LOGE("Failed to link RGB conversion program: %s", error);
+        glDeleteProgram(conv->mProgram);
+        conv->mProgram = 0;
+        return;
+    }
+
+    conv->mUniformLocSamplerRGB = glGetUniformLocation(conv->mProgram, "uSamplerRGB");
+    conv->mUniformLocPlane = glGetUniformLocation(conv->mProgram, "uPlane");
+    conv->mAttributeLocPos = glGetAttribLocation(conv->mProgram, "aPosition");
+}
+
+static void createPlaneFbo(GLuint texture, GLuint *outFbo) {
+    glGenFramebuffers(1, outFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, *outFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/**
+ * constructs a converter that renders rgb textures into yuv planes, so that
+ * reading a frame back from the gpu only moves 12 bits per pixel.
+ * only nv12 with even dimensions is supported for now.
+ * the converter assumes a current gl context.
+*/
+CsConverter *cs_init_from_rgb(const enum AVPixelFormat dst_fmt, int width, int height) {
+    if (dst_fmt != AV_PIX_FMT_NV12 || (width & 1) || (height & 1)) {
+        LOGW("cs_init_from_rgb: unsupported target %s %dx%d", av_get_pix_fmt_name(dst_fmt), width, height);
+        return NULL;
+    }
+
+    CsConverter *conv = g_malloc0(sizeof(CsConverter));
+    conv->mFormat = AV_PIX_FMT_RGBA;
+    conv->mDstFormat = dst_fmt;
+    conv->mWidth = width;
+    conv->mHeight = height;
+
+    createRGBGLShader(conv);
+    if (!conv->mProgram) {
+        g_free(conv);
+        return NULL;
+    }
+
+    createYUVGLTex(GL_TEXTURE0, width, height, dst_fmt, YUVPlane_Y, &conv->mTextureY);
+    createYUVGLTex(GL_TEXTURE0, width / 2, height / 2, dst_fmt, YUVPlane_UV, &conv->mTextureU);
+    conv->mTextureV = conv->mTextureU;
+    createPlaneFbo(conv->mTextureY, &conv->mFboY);
+    createPlaneFbo(conv->mTextureU, &conv->mFboUV);
+    createYUVGLFullscreenQuad(conv);
+
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        LOGW("cs_init_from_rgb: gl error %x", err);
+    }
+
+    LOGI("created isp with colorspace rgb -> %s width %d height %d",
+         av_get_pix_fmt_name(dst_fmt), width, height);
+    return conv;
+}
+
+static void do_convert_plane_draw(const CsConverter *conv, GLuint dst_fbo, int plane, int width, int height) {
+    const GLsizei kVertexAttribStride = 5 * sizeof(GL_FLOAT);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, dst_fbo);
+    glViewport(0, 0, width, height);
+    glUniform1i(conv->mUniformLocPlane, plane);
+
+    glBindBuffer(GL_ARRAY_BUFFER, conv->mQuadVertexBuffer);
+    glEnableVertexAttribArray(conv->mAttributeLocPos);
+    glVertexAttribPointer(conv->mAttributeLocPos, 3, GL_FLOAT, false, kVertexAttribStride, (GLvoid *)0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, conv->mQuadIndexBuffer);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, 0);
+    glDisableVertexAttribArray(conv->mAttributeLocPos);
+}
+
+/**
+ * converts the rgb texture into the yuv planes of the converter.
+ * src_texture has to be at least as large as the converter.
+*/
+int cs_convert_from_rgb(const CsConverter *conv, GLuint src_texture) {
+    glUseProgram(conv->mProgram);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, src_texture);
+    glUniform1i(conv->mUniformLocSamplerRGB, 0);
+
+    do_convert_plane_draw(conv, conv->mFboY, 0, conv->mWidth, conv->mHeight);
+    do_convert_plane_draw(conv, conv->mFboUV, 1, conv->mWidth / 2, conv->mHeight / 2);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return ERR_OK;
+}
+
+/**
+ * returns the number of bytes cs_read_planes() writes, with the planes packed
+ * without padding one after another, as in an nv12 image with linesize == width.
+*/
+size_t cs_planes_size(const CsConverter *conv) {
+    return (size_t)conv->mWidth * conv->mHeight * 3 / 2;
+}
+
+/**
+ * reads the yuv planes back into the buffer bound to GL_PIXEL_PACK_BUFFER,
+ * the read is asynchronous when a pixel-pack buffer is bound.
+*/
+void cs_read_planes(const CsConverter *conv) {
+    GLint unprevAlignment = 0;
+    glGetIntegerv(GL_PACK_ALIGNMENT, &unprevAlignment);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, conv->mFboY);
+    glReadPixels(0, 0, conv->mWidth, conv->mHeight, GL_RED, GL_UNSIGNED_BYTE, (void *)0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, conv->mFboUV);
+    glReadPixels(0, 0, conv->mWidth / 2, conv->mHeight / 2, GL_RG, GL_UNSIGNED_BYTE,
+                 (void *)(intptr_t)((size_t)conv->mWidth * conv->mHeight));
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, unprevAlignment);
+}
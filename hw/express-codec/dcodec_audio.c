@@ -34,6 +34,7 @@ static int open_codec(DCodecComponent *_context);
 static int empty_one_input_buffer(DCodecComponent *_context);
 static int decode_audio(DCodecAudio *context, BufferDesc *desc);
 static int resample_audio(DCodecAudio *context);
+static void play_silence(DCodecAudio *context);
 static int fill_one_output_buffer(DCodecComponent *_context);
 static void adjust_audio_params(DCodecAudio *context);
 static bool get_omx_channel_mapping(uint32_t numChannels, OMX_AUDIO_CHANNELTYPE map[]);
@@ -105,6 +106,11 @@ OMX_ERRORTYPE dcodec_audio_reset_component(DCodecComponent *_context) {
     context->mReconfiguring = false;
     context->mResampledData = NULL;
     context->mResampledDataSize = 0;
+    context->mSwrPending = false;
+    if (context->mSwrCtx) {
+        // drop the samples of the old position buffered in the resampler
+        swr_init(context->mSwrCtx);
+    }
 
     return dcodec_reset_component(_context);
 }
@@ -112,6 +118,8 @@ OMX_ERRORTYPE dcodec_audio_reset_component(DCodecComponent *_context) {
 OMX_ERRORTYPE dcodec_audio_destroy_component(DCodecComponent *_context) {
     DCodecAudio *context = (DCodecAudio *)_context;
 
+    dcodec_component_stop_worker(_context);
+
 #ifdef STD_DEBUG_LOG
     if (context->raw_fd) {
         fclose(context->raw_fd);
@@ -124,6 +132,7 @@ OMX_ERRORTYPE dcodec_audio_destroy_component(DCodecComponent *_context) {
         swr_free(&context->mSwrCtx);
         context->mSwrCtx = NULL;
     }
+    av_freep(&context->mInputBuffer);
 
     dcodec_deinit_component(_context);
     g_free(context);
@@ -952,8 +961,7 @@ static int empty_one_input_buffer(DCodecComponent *_context) {
     // a negative error code is returned if an error occurred during decoding
     if (ret < 0) {
         LOGW("audio decoder error %d, we skip the frame and play silence instead", ret);
-        context->mResampledData = context->mSilenceBuffer;
-        context->mResampledDataSize = CODEC_AUDIO_OUTPUT_BUFFER_SIZE;
+        play_silence(context);
         if (desc->nTimeStamp != AV_NOPTS_VALUE) {
             context->mAudioClock = desc->nTimeStamp;
         }
@@ -975,7 +983,8 @@ static int empty_one_input_buffer(DCodecComponent *_context) {
             ret = decode_audio(context, NULL);
             CHECK_EQ(ret, ERR_OK);
         }
-        avcodec_flush_buffers(mCtx);
+        // no flush here, the frames still buffered in the decoder are drained
+        // by fill_one_output_buffer
         _context->mStatus = INPUT_EOS_SEEN;
     }
 
@@ -1002,9 +1011,12 @@ static int decode_audio(DCodecAudio *context, BufferDesc *desc) {
     }
     else {
         CHECK(desc->type & CODEC_BUFFER_TYPE_GUEST_MEM);
-        CHECK_LE(desc->nFilledLen, sizeof(context->mAudioBuffer));
-        read_from_guest_mem(desc->data, context->mAudioBuffer, desc->nOffset, desc->nFilledLen); // avoid memcpys caused by EAGAIN
-        mPkt->data = context->mAudioBuffer;
+        av_fast_padded_malloc(&context->mInputBuffer, &context->mInputBufferSize, desc->nFilledLen);
+        if (!context->mInputBuffer) {
+            return ERR_OOM;
+        }
+        read_from_guest_mem(desc->data, context->mInputBuffer, desc->nOffset, desc->nFilledLen); // avoid memcpys caused by EAGAIN
+        mPkt->data = context->mInputBuffer;
         mPkt->size = desc->nFilledLen;
         mPkt->pts = desc->nTimeStamp;
     }
@@ -1023,13 +1035,18 @@ static int decode_audio(DCodecAudio *context, BufferDesc *desc) {
 
 // #ifdef STD_DEBUG_LOG
 //     if (context->raw_fd > 0) {
-//         fwrite(context->mAudioBuffer, 1, desc->nFilledLen, context->raw_fd);
+//         fwrite(context->mInputBuffer, 1, desc->nFilledLen, context->raw_fd);
 //     }
 // #endif
 
     return ERR_OK;
 }
 
+/**
+ * @brief sets up the resampler for the frame just decoded into mFrame, or points
+ * mResampledData at the frame if it is in the target format already
+ * @return ERR_OK on success, or a negative error code.
+*/
 static int resample_audio(DCodecAudio *context) {
     AVFrame *mFrame = context->base.mFrame;
     size_t dataSize = 0;
@@ -1090,34 +1107,14 @@ static int resample_audio(DCodecAudio *context) {
         context->mReconfiguring = false;
     }
 
-    struct SwrContext *mSwrCtx = context->mSwrCtx;
-
-    if (mSwrCtx) {
-        const uint8_t **in = (const uint8_t **)mFrame->extended_data;
-        uint8_t *out[] = {context->mAudioBuffer};
-        int out_count = sizeof(context->mAudioBuffer) / context->mAudioTgtChannels / av_get_bytes_per_sample(context->mAudioTgtFmt);
-        int out_size  = av_samples_get_buffer_size(NULL, context->mAudioTgtChannels, out_count, context->mAudioTgtFmt, 0);
-        int len2 = 0;
-        if (out_size < 0) {
-            LOGE("av_samples_get_buffer_size() failed");
-            return ERR_INVALID_PARAM;
-        }
-
-        len2 = swr_convert(mSwrCtx, out, out_count, in, mFrame->nb_samples);
-        if (len2 < 0) {
-            LOGE("audio_resample() failed");
-            return ERR_RESAMPLE_FAILED;
-        }
-        if (len2 == out_count) {
-            LOGE("warning: audio buffer is probably too small");
-            swr_init(mSwrCtx);
-        }
-        context->mResampledData = context->mAudioBuffer;
-        context->mResampledDataSize = len2 * context->mAudioTgtChannels * av_get_bytes_per_sample(context->mAudioTgtFmt);
+    if (context->mSwrCtx) {
+        // converted by resample_to_guest, straight into the output buffers
+        context->mSwrPending = true;
+        context->mSwrInputFed = false;
 
-        LOGD("audio decoder w/ resample, mFrame->nb_samples:%d, len2:%d, mResampledDataSize:%d, "
+        LOGD("audio decoder w/ resample, mFrame->nb_samples:%d, "
                 "src channel:%u, src fmt:%s, tgt channel:%u, tgt fmt:%s",
-                mFrame->nb_samples, len2, context->mResampledDataSize,
+                mFrame->nb_samples,
                 mFrame->ch_layout.nb_channels,
                 av_get_sample_fmt_name((enum AVSampleFormat)mFrame->format),
                 context->mAudioTgtChannels,
@@ -1134,64 +1131,213 @@ static int resample_audio(DCodecAudio *context) {
     return ERR_OK;
 }
 
-static int fill_one_output_buffer(DCodecComponent *_context) {
-    DCodecAudio *context = (DCodecAudio *)_context;
-    AVCodecContext *mCtx = context->base.mCtx;
+static bool audio_data_pending(DCodecAudio *context) {
+    return context->mResampledDataSize > 0 || context->mSwrPending;
+}
+
+static void play_silence(DCodecAudio *context) {
+    context->mResampledData = context->mSilenceBuffer;
+    context->mResampledDataSize = CODEC_AUDIO_OUTPUT_BUFFER_SIZE;
+    context->mSwrPending = false;
+}
+
+/**
+ * @brief returns the host address of guest memory at loc, and how many bytes are contiguous there
+*/
+static size_t guest_mem_span(Guest_Mem *guest, size_t loc, uint8_t **ptr) {
+    for (int i = 0; i < guest->num; i++) {
+        Scatter_Data *sd = &guest->scatter_data[i];
+        if (loc < sd->len) {
+            *ptr = sd->data + loc;
+            return sd->len - loc;
+        }
+        loc -= sd->len;
+    }
+    return 0;
+}
+
+/**
+ * @brief converts the samples of mFrame into the guest buffer, page by page,
+ * without an intermediate buffer. Whatever does not fit stays in the resampler
+ * for the next output buffer.
+ * @param written set to the number of bytes written at offset
+ * @return ERR_OK on success, or a negative error code.
+*/
+static int resample_to_guest(DCodecAudio *context, Guest_Mem *guest, size_t offset, size_t len, size_t *written) {
     AVFrame *mFrame = context->base.mFrame;
-    int ret = ERR_OK;
+    size_t frame_bytes = context->mAudioTgtChannels * av_get_bytes_per_sample(context->mAudioTgtFmt);
+    uint8_t bounce[AUDIO_MAX_SAMPLE_FRAME_BYTES];
+
+    *written = 0;
+    if (frame_bytes == 0 || frame_bytes > sizeof(bounce)) {
+        LOGE("resample_to_guest: unsupported sample frame size %zu", frame_bytes);
+        return ERR_INVALID_PARAM;
+    }
+
+    while (context->mSwrPending && len - *written >= frame_bytes) {
+        uint8_t *out[1];
+        size_t span = guest_mem_span(guest, offset + *written, &out[0]);
+        if (span == 0) {
+            LOGE("resample_to_guest: buffer at %zu beyond guest memory of %d bytes", offset + *written, guest->all_len);
+            return ERR_INVALID_PARAM;
+        }
+        int out_count = MIN(span, len - *written) / frame_bytes;
+        bool bounced = out_count == 0;
+        if (bounced) {
+            // a sample frame crosses a page boundary
+            out[0] = bounce;
+            out_count = 1;
+        }
+
+        const uint8_t **in = NULL;
+        int in_count = 0;
+        if (!context->mSwrInputFed) {
+            in = (const uint8_t **)mFrame->extended_data;
+            in_count = mFrame->nb_samples;
+            context->mSwrInputFed = true;
+        }
+
+        int converted = swr_convert(context->mSwrCtx, out, out_count, in, in_count);
+        if (converted < 0) {
+            LOGE("audio_resample() failed");
+            context->mSwrPending = false;
+            return ERR_RESAMPLE_FAILED;
+        }
+        if (bounced && converted > 0) {
+            write_to_guest_mem(guest, bounce, offset + *written, frame_bytes);
+        }
+        *written += converted * frame_bytes;
 
-    if (context->mResampledDataSize == 0) {
-        // read a new frame
+        // less than asked for, the resampler has nothing buffered anymore
+        if (converted < out_count) {
+            context->mSwrPending = false;
+        }
+    }
+    return ERR_OK;
+}
+
+/**
+ * @brief gets the next decoded frame ready for the output buffers. If the decoder
+ * has nothing, the input buffers that are already queued are decoded, so that an
+ * output buffer collects as many frames as are available.
+ * @return ERR_OK if there is pcm pending, ERR_NO_FRM if more input is needed,
+ * AVERROR_EOF once the decoder is drained, or a negative error code.
+*/
+static int next_audio_frame(DCodecComponent *_context, bool buffer_empty) {
+    DCodecAudio *context = (DCodecAudio *)_context;
+    AVCodecContext *mCtx = _context->mCtx;
+    AVFrame *mFrame = _context->mFrame;
+    int ret;
+
+    for (;;) {
         ret = avcodec_receive_frame(mCtx, mFrame);
-        if (ret == AVERROR_EOF && _context->mStatus != OUTPUT_EOS_SENT) {
-            _context->fill_eos_output_buffer(_context);
-            _context->mStatus = OUTPUT_EOS_SENT;
-            return ERR_OK;
+        if (ret == AVERROR(EAGAIN)) {
+            if (_context->mStatus != INPUT_DATA_AVAILABLE || g_queue_is_empty(_context->input_buffers)) {
+                return ERR_NO_FRM;
+            }
+            ret = _context->empty_one_input_buffer(_context);
+            if (ret < ERR_OK) {
+                return ret;
+            }
+            else if (ret != ERR_OK) {
+                return ERR_NO_FRM;
+            }
+            if (audio_data_pending(context)) {
+                // the packet could not be decoded
+                return ERR_OK;
+            }
+            continue;
         }
-        else if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-            return ERR_NO_FRM;
+        else if (ret == AVERROR_EOF) {
+            return ret;
         }
         else if (ret < 0) {
             LOGW("avcodec_receive_frame error %d, we skip the frame and play silence instead", ret);
-            context->mResampledData = context->mSilenceBuffer;
-            context->mResampledDataSize = CODEC_AUDIO_OUTPUT_BUFFER_SIZE;
+            play_silence(context);
+            return ERR_OK;
         }
-        if (mFrame->pts != AV_NOPTS_VALUE) {
+
+        // within a buffer, the timestamps follow from the number of samples
+        if (buffer_empty && mFrame->pts != AV_NOPTS_VALUE) {
             context->mAudioClock = mFrame->pts;
         }
         ret = resample_audio(context);
         if (ret < 0) {
             LOGW("resample_audio error %d, we skip the frame and play silence instead", ret);
-            context->mResampledData = context->mSilenceBuffer;
-            context->mResampledDataSize = CODEC_AUDIO_OUTPUT_BUFFER_SIZE;
+            play_silence(context);
         }
+        return ERR_OK;
     }
+}
 
-    if (context->mResampledData == 0) { // in case the audio resampler fails
-        return ERR_NO_FRM;
-    }
+/**
+ * @brief fills the first output buffer with as many decoded frames as fit into it
+*/
+static int fill_one_output_buffer(DCodecComponent *_context) {
+    DCodecAudio *context = (DCodecAudio *)_context;
+    BufferDesc *desc = g_queue_peek_head(_context->output_buffers);
+    size_t frame_bytes = context->mAudioTgtChannels * av_get_bytes_per_sample(context->mAudioTgtFmt);
+    // only whole sample frames go into a buffer
+    size_t capacity = frame_bytes ? desc->nAllocLen - desc->nAllocLen % frame_bytes : 0;
+    size_t filled = 0;
+    OMX_TICKS timestamp = 0;
+    int ret = ERR_OK;
 
-    BufferDesc *desc = g_queue_pop_head(_context->output_buffers);
-    size_t copy = min(context->mResampledDataSize, desc->nAllocLen);
+    while (filled < capacity) {
+        if (!audio_data_pending(context)) {
+            ret = next_audio_frame(_context, filled == 0);
+            if (ret < 0 && ret != AVERROR_EOF) {
+                return ret;
+            }
+            if (ret != ERR_OK) {
+                break;
+            }
+        }
+        if (filled == 0) {
+            timestamp = context->mAudioClock;
+        }
 
-    desc->nOffset = 0;
-    desc->nFilledLen = copy;
-    desc->nTimeStamp = context->mAudioClock;
-    write_to_guest_mem(desc->data, context->mResampledData, 0, copy);
+        size_t copy = 0;
+        if (context->mResampledDataSize > 0) {
+            copy = min((size_t)context->mResampledDataSize, capacity - filled);
+            write_to_guest_mem(desc->data, context->mResampledData, filled, copy);
+            context->mResampledData += copy;
+            context->mResampledDataSize -= copy;
+        }
+        else if (resample_to_guest(context, desc->data, filled, capacity - filled, &copy) < 0) {
+            play_silence(context);
+        }
 
 #ifdef STD_DEBUG_LOG
-    if (context->raw_fd > 0) {
-        fwrite(context->mResampledData, 1, copy, context->raw_fd);
-    }
+        if (context->raw_fd > 0) {
+            uint8_t *span_ptr = NULL;
+            if (guest_mem_span(desc->data, filled, &span_ptr) >= copy) {
+                fwrite(span_ptr, 1, copy, context->raw_fd);
+            }
+        }
 #endif
 
-    //update mResampledSize
-    context->mResampledData += copy;
-    context->mResampledDataSize -= copy;
+        filled += copy;
 
-    //update audio pts
-    size_t samples = copy / av_get_bytes_per_sample(context->mAudioTgtFmt) / context->mAudioTgtChannels;
-    context->mAudioClock = context->mAudioClock + samples * 1000000ll / context->mAudioTgtFreq;
+        //update audio pts
+        size_t samples = copy / frame_bytes;
+        context->mAudioClock = context->mAudioClock + samples * 1000000ll / context->mAudioTgtFreq;
+    }
+
+    if (filled == 0) {
+        if (ret == AVERROR_EOF && _context->mStatus != OUTPUT_EOS_SENT) {
+            _context->fill_eos_output_buffer(_context);
+            _context->mStatus = OUTPUT_EOS_SENT;
+            return ERR_OK;
+        }
+        return ERR_NO_FRM;
+    }
+
+    // the eos buffer follows with the next call
+    g_queue_pop_head(_context->output_buffers);
+    desc->nOffset = 0;
+    desc->nFilledLen = filled;
+    desc->nTimeStamp = timestamp;
 
     LOGD("fill_one_output_buffer() on buffer type %x id %" PRIx64 " nAllocLen %u "
          "nFilledLen %u nOffset %u nTimeStamp %lld nFlags %x",
@@ -22,6 +22,9 @@
 #include "hw/teleport-express/express_log.h"
 #include "hw/express-codec/dcodec_component.h"
 
+// polling interval of the worker while the express-mem pool is saturated, see ERR_MEM_BUSY
+#define DCODEC_WORKER_POLL_US 1000
+
 static void dcodec_av_log_callback(void *ptr, int level, const char *fmt,
                                    va_list vl);
 static void sanitize(uint8_t *line);
@@ -34,6 +37,10 @@ int dcodec_init_component(DCodecComponent *context, NotifyCallbackFunc notify) {
     context->input_buffers = g_queue_new();
     context->output_buffers = g_queue_new();
 
+    g_mutex_init(&context->lock);
+    g_mutex_init(&context->wake_lock);
+    g_cond_init(&context->wake_cond);
+
 #ifdef STD_DEBUG_LOG
     av_log_set_level(AV_LOG_VERBOSE);
 #else
@@ -123,6 +130,94 @@ void dcodec_deinit_component(DCodecComponent *context) {
     if (context->mPkt) {
         av_packet_free(&context->mPkt);
     }
+
+    g_mutex_clear(&context->lock);
+    g_mutex_clear(&context->wake_lock);
+    g_cond_clear(&context->wake_cond);
+}
+
+static void *dcodec_worker_thread(void *opaque) {
+    DCodecComponent *context = opaque;
+
+    g_mutex_lock(&context->wake_lock);
+    while (!context->worker_stop) {
+        if (!context->wake_pending) {
+            if (context->need_poll) {
+                if (!g_cond_wait_until(&context->wake_cond, &context->wake_lock,
+                                       g_get_monotonic_time() + DCODEC_WORKER_POLL_US)) {
+                    // a timed out poll counts as a wake up
+                    context->wake_pending = true;
+                }
+            }
+            else {
+                g_cond_wait(&context->wake_cond, &context->wake_lock);
+            }
+            continue;
+        }
+        context->wake_pending = false;
+        g_mutex_unlock(&context->wake_lock);
+
+        g_mutex_lock(&context->lock);
+        context->need_poll = false;
+        dcodec_process_buffers(context);
+        g_mutex_unlock(&context->lock);
+
+        g_mutex_lock(&context->wake_lock);
+    }
+    g_mutex_unlock(&context->wake_lock);
+
+    if (context->release_thread_resources) {
+        context->release_thread_resources(context);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Moves buffer processing of the component to a dedicated worker.
+ * Without a worker, buffers are processed inline by dcodec_process_this_buffer().
+ */
+void dcodec_component_start_worker(DCodecComponent *context) {
+    if (context->worker_running) {
+        return;
+    }
+    context->worker_stop = false;
+    context->wake_pending = false;
+    context->need_poll = false;
+    context->worker_running = true;
+    qemu_thread_create(&context->worker, "dcodec-worker", dcodec_worker_thread,
+                       context, QEMU_THREAD_JOINABLE);
+}
+
+/**
+ * @brief Stops the worker and releases the thread-bound resources of the component.
+ * Must be called before the component is torn down.
+ */
+void dcodec_component_stop_worker(DCodecComponent *context) {
+    if (!context->worker_running) {
+        if (context->release_thread_resources) {
+            context->release_thread_resources(context);
+        }
+        return;
+    }
+
+    g_mutex_lock(&context->wake_lock);
+    context->worker_stop = true;
+    g_cond_signal(&context->wake_cond);
+    g_mutex_unlock(&context->wake_lock);
+
+    qemu_thread_join(&context->worker);
+    context->worker_running = false;
+}
+
+/**
+ * @brief Schedules another processing pass on the worker. Safe to call from any thread,
+ * including express-mem workers, as it never takes the codec lock.
+ */
+void dcodec_component_wake(DCodecComponent *context) {
+    g_mutex_lock(&context->wake_lock);
+    context->wake_pending = true;
+    g_cond_signal(&context->wake_cond);
+    g_mutex_unlock(&context->wake_lock);
 }
 
 /**
@@ -280,7 +375,12 @@ OMX_ERRORTYPE dcodec_process_this_buffer(DCodecComponent *context, OMX_INOUT Buf
         LOGD("output buffer %" PRIx64 " queued, current queue length: input %d output %d", desc->id, g_queue_get_length(context->input_buffers), g_queue_get_length(context->output_buffers));
     }
 
-    dcodec_process_buffers(context);
+    if (context->worker_running) {
+        dcodec_component_wake(context);
+    }
+    else {
+        dcodec_process_buffers(context);
+    }
     return OMX_ErrorNone;
 }
 
@@ -290,6 +390,10 @@ void dcodec_process_buffers(DCodecComponent *context) {
     bool did_something = true;
     int err = ERR_OK;
 
+    if (context->release_async_outputs) {
+        context->release_async_outputs(context);
+    }
+
     if (context->mStatus == AWAITING_INPUT && !g_queue_is_empty(input_buffers)) {
         BufferDesc *desc = g_queue_peek_tail(input_buffers);
         if (!(desc->nFlags & OMX_BUFFERFLAG_CODECCONFIG)) {
@@ -337,6 +441,12 @@ void dcodec_process_buffers(DCodecComponent *context) {
                 return;
             }
             else if (err > ERR_OK) {
+                // our own transfers wake the worker when they finish, but the pool
+                // may be saturated by those of other components or devices, which
+                // know nothing about us, so the worker polls until the pool drains.
+                if (err == ERR_MEM_BUSY) {
+                    context->need_poll = true;
+                }
                 break;
             }
             did_something = true;
@@ -347,7 +457,11 @@ void dcodec_process_buffers(DCodecComponent *context) {
         // because of the single-threaded nature of the decoder
         // case 1: slow decoder, input/output queue are both full
         // case 2: eos frame has not finished decoding yet
-        if (g_queue_get_length(output_buffers) != 0 && 
+        // a worker skips this and keeps looping only while it makes progress: send and
+        // receive never both return EAGAIN, so with input queued every iteration does
+        // something, and a draining decoder blocks in receive. a pass can then only stall
+        // on its own async outputs, whose done callbacks wake the worker, or on ERR_MEM_BUSY.
+        if (!context->worker_running && g_queue_get_length(output_buffers) != 0 && 
            (g_queue_get_length(input_buffers) != 0 || context->mStatus == INPUT_EOS_SEEN)) {
             g_usleep(1000);
             did_something = true;
@@ -0,0 +1,831 @@
+/**
+ * vSoC codec device colour conversion
+ *
+ * Direct yuv 4:2:0 <-> rgb conversion for frames that are not resized, used
+ * instead of swscale by the decoder output and encoder input paths.
+ * Coefficients are BT.601 limited range, the same matrix swscale defaults to.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "hw/express-codec/dcodec_convert.h"
+
+int dcodec_convert_max_stripes = DCODEC_CONVERT_MAX_STRIPES;
+
+/*
+ * yuv -> rgb in 6-bit fixed point:
+ *   R = 1.164 (Y - 16) + 1.596 (V - 128)
+ *   G = 1.164 (Y - 16) - 0.391 (U - 128) - 0.813 (V - 128)
+ *   B = 1.164 (Y - 16) + 2.018 (U - 128)
+ * every intermediate fits in int16, except for sums that would clamp to 255
+ * anyway, so the simd kernels can use saturating 16-bit arithmetic and still
+ * produce exactly the same output as the c version.
+ */
+#define YUV_SHIFT 6
+#define YUV_Y 74
+#define YUV_V_R 102
+#define YUV_U_G 25
+#define YUV_V_G 52
+#define YUV_U_B 129
+
+/*
+ * rgb -> yuv in 8-bit fixed point, chroma is taken from the average of each 2x2 block:
+ *   Y = ( 66 R + 129 G +  25 B + 128) >> 8 + 16
+ *   U = (-38 R -  74 G + 112 B + 128) >> 8 + 128
+ *   V = (112 R -  94 G -  18 B + 128) >> 8 + 128
+ */
+#define RGB_Y_R 66
+#define RGB_Y_G 129
+#define RGB_Y_B 25
+#define RGB_U_R (-38)
+#define RGB_U_G (-74)
+#define RGB_U_B 112
+#define RGB_V_R 112
+#define RGB_V_G (-94)
+#define RGB_V_B (-18)
+
+typedef void (*YuvToRgbaRowFunc)(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                 uint8_t *dst, int width, bool swap_rb, bool nv12);
+typedef void (*RgbaToYuvRowsFunc)(const uint8_t *src0, const uint8_t *src1,
+                                  uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                                  int width, bool swap_rb, bool nv12);
+
+static inline uint8_t clamp_u8(int value) {
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static inline bool is_yuv_format(enum AVPixelFormat fmt) {
+    return fmt == AV_PIX_FMT_YUV420P || fmt == AV_PIX_FMT_NV12;
+}
+
+static inline bool is_rgb_format(enum AVPixelFormat fmt) {
+    return fmt == AV_PIX_FMT_RGBA || fmt == AV_PIX_FMT_BGRA ||
+           fmt == AV_PIX_FMT_RGB24 || fmt == AV_PIX_FMT_RGB565;
+}
+
+static inline void load_rgb(const uint8_t *src, enum AVPixelFormat fmt, int x, int *r, int *g, int *b) {
+    switch (fmt) {
+        case AV_PIX_FMT_RGBA:
+            *r = src[x * 4];
+            *g = src[x * 4 + 1];
+            *b = src[x * 4 + 2];
+            break;
+        case AV_PIX_FMT_BGRA:
+            *b = src[x * 4];
+            *g = src[x * 4 + 1];
+            *r = src[x * 4 + 2];
+            break;
+        case AV_PIX_FMT_RGB24:
+            *r = src[x * 3];
+            *g = src[x * 3 + 1];
+            *b = src[x * 3 + 2];
+            break;
+        default: {
+            // native endian 5:6:5, bits are replicated to fill 8 bits
+            uint16_t pixel = ((const uint16_t *)src)[x];
+            *r = ((pixel >> 11) << 3) | (pixel >> 13);
+            *g = (((pixel >> 5) & 0x3f) << 2) | ((pixel >> 9) & 0x3);
+            *b = ((pixel & 0x1f) << 3) | ((pixel >> 2) & 0x7);
+            break;
+        }
+    }
+}
+
+static inline void store_rgb(uint8_t *dst, enum AVPixelFormat fmt, int x, uint8_t r, uint8_t g, uint8_t b) {
+    switch (fmt) {
+        case AV_PIX_FMT_RGBA:
+            dst[x * 4] = r;
+            dst[x * 4 + 1] = g;
+            dst[x * 4 + 2] = b;
+            dst[x * 4 + 3] = 0xff;
+            break;
+        case AV_PIX_FMT_BGRA:
+            dst[x * 4] = b;
+            dst[x * 4 + 1] = g;
+            dst[x * 4 + 2] = r;
+            dst[x * 4 + 3] = 0xff;
+            break;
+        case AV_PIX_FMT_RGB24:
+            dst[x * 3] = r;
+            dst[x * 3 + 1] = g;
+            dst[x * 3 + 2] = b;
+            break;
+        default:
+            ((uint16_t *)dst)[x] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+            break;
+    }
+}
+
+/**
+ * @brief converts pixels [x, width) of one yuv row, u/v point to the chroma row.
+ * for nv12, u points to the interleaved chroma and v is unused.
+*/
+static void yuv_to_rgb_row_c(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                             uint8_t *dst, enum AVPixelFormat dst_fmt, int x, int width, bool nv12) {
+    for (; x < width; x++) {
+        int cu = nv12 ? u[(x >> 1) * 2] : u[x >> 1];
+        int cv = nv12 ? u[(x >> 1) * 2 + 1] : v[x >> 1];
+        int ys = (y[x] - 16) * YUV_Y + (1 << (YUV_SHIFT - 1));
+        cu -= 128;
+        cv -= 128;
+        store_rgb(dst, dst_fmt, x,
+                  clamp_u8((ys + YUV_V_R * cv) >> YUV_SHIFT),
+                  clamp_u8((ys - YUV_U_G * cu - YUV_V_G * cv) >> YUV_SHIFT),
+                  clamp_u8((ys + YUV_U_B * cu) >> YUV_SHIFT));
+    }
+}
+
+/**
+ * @brief converts pixels [x, width) of two rgb rows to two luma rows and one chroma row.
+ * x must be even. for nv12, u points to the interleaved chroma and v is unused.
+*/
+static void rgb_to_yuv_rows_c(const uint8_t *src0, const uint8_t *src1, enum AVPixelFormat src_fmt,
+                              uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                              int x, int width, bool nv12) {
+    for (; x < width; x += 2) {
+        int x1 = x + 1 < width ? x + 1 : x;
+        int r[4], g[4], b[4];
+        load_rgb(src0, src_fmt, x, &r[0], &g[0], &b[0]);
+        load_rgb(src0, src_fmt, x1, &r[1], &g[1], &b[1]);
+        load_rgb(src1, src_fmt, x, &r[2], &g[2], &b[2]);
+        load_rgb(src1, src_fmt, x1, &r[3], &g[3], &b[3]);
+
+        y0[x] = ((RGB_Y_R * r[0] + RGB_Y_G * g[0] + RGB_Y_B * b[0] + 128) >> 8) + 16;
+        y0[x1] = ((RGB_Y_R * r[1] + RGB_Y_G * g[1] + RGB_Y_B * b[1] + 128) >> 8) + 16;
+        y1[x] = ((RGB_Y_R * r[2] + RGB_Y_G * g[2] + RGB_Y_B * b[2] + 128) >> 8) + 16;
+        y1[x1] = ((RGB_Y_R * r[3] + RGB_Y_G * g[3] + RGB_Y_B * b[3] + 128) >> 8) + 16;
+
+        int ar = (r[0] + r[1] + r[2] + r[3] + 2) >> 2;
+        int ag = (g[0] + g[1] + g[2] + g[3] + 2) >> 2;
+        int ab = (b[0] + b[1] + b[2] + b[3] + 2) >> 2;
+        uint8_t cu = ((RGB_U_R * ar + RGB_U_G * ag + RGB_U_B * ab + 128) >> 8) + 128;
+        uint8_t cv = ((RGB_V_R * ar + RGB_V_G * ag + RGB_V_B * ab + 128) >> 8) + 128;
+        if (nv12) {
+            u[x] = cu;
+            u[x + 1] = cv;
+        }
+        else {
+            u[x >> 1] = cu;
+            v[x >> 1] = cv;
+        }
+    }
+}
+
+static void yuv_to_rgba_row_c(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                              uint8_t *dst, int width, bool swap_rb, bool nv12) {
+    yuv_to_rgb_row_c(y, u, v, dst, swap_rb ? AV_PIX_FMT_BGRA : AV_PIX_FMT_RGBA, 0, width, nv12);
+}
+
+static void rgba_to_yuv_rows_c(const uint8_t *src0, const uint8_t *src1,
+                               uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                               int width, bool swap_rb, bool nv12) {
+    rgb_to_yuv_rows_c(src0, src1, swap_rb ? AV_PIX_FMT_BGRA : AV_PIX_FMT_RGBA, y0, y1, u, v, 0, width, nv12);
+}
+
+#ifdef CONFIG_AVX2_OPT
+/* Same as in util/bufferiszero.c, the includes have to be within the
+ * corresponding push_options region, ordered with increasing ISA.
+ */
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#include <smmintrin.h>
+
+/**
+ * @brief converts 16 pixels, u16 and v16 hold the chroma already expanded to one value per pixel
+*/
+static inline void yuv_to_rgba16_sse4(__m128i y8, __m128i u_lo, __m128i u_hi, __m128i v_lo, __m128i v_hi,
+                                      uint8_t *dst, bool swap_rb) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c16 = _mm_set1_epi16(16);
+    const __m128i round = _mm_set1_epi16(1 << (YUV_SHIFT - 1));
+    __m128i r[2], g[2], b[2];
+    __m128i y16[2] = { _mm_cvtepu8_epi16(y8), _mm_unpackhi_epi8(y8, zero) };
+    __m128i u16[2] = { u_lo, u_hi };
+    __m128i v16[2] = { v_lo, v_hi };
+
+    for (int i = 0; i < 2; i++) {
+        __m128i ys = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y16[i], c16), _mm_set1_epi16(YUV_Y)), round);
+        __m128i cu = _mm_sub_epi16(u16[i], _mm_set1_epi16(128));
+        __m128i cv = _mm_sub_epi16(v16[i], _mm_set1_epi16(128));
+        r[i] = _mm_srai_epi16(_mm_adds_epi16(ys, _mm_mullo_epi16(cv, _mm_set1_epi16(YUV_V_R))), YUV_SHIFT);
+        g[i] = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(ys, _mm_mullo_epi16(cu, _mm_set1_epi16(YUV_U_G))),
+                                             _mm_mullo_epi16(cv, _mm_set1_epi16(YUV_V_G))), YUV_SHIFT);
+        b[i] = _mm_srai_epi16(_mm_adds_epi16(ys, _mm_mullo_epi16(cu, _mm_set1_epi16(YUV_U_B))), YUV_SHIFT);
+    }
+
+    __m128i r8 = _mm_packus_epi16(r[0], r[1]);
+    __m128i g8 = _mm_packus_epi16(g[0], g[1]);
+    __m128i b8 = _mm_packus_epi16(b[0], b[1]);
+    __m128i a8 = _mm_set1_epi8((char)0xff);
+    if (swap_rb) {
+        __m128i t = r8;
+        r8 = b8;
+        b8 = t;
+    }
+
+    __m128i rg_lo = _mm_unpacklo_epi8(r8, g8);
+    __m128i rg_hi = _mm_unpackhi_epi8(r8, g8);
+    __m128i ba_lo = _mm_unpacklo_epi8(b8, a8);
+    __m128i ba_hi = _mm_unpackhi_epi8(b8, a8);
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi16(rg_hi, ba_hi));
+    _mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi16(rg_hi, ba_hi));
+}
+
+static void yuv_to_rgba_row_sse4(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                 uint8_t *dst, int width, bool swap_rb, bool nv12) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i split_uv = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i y8 = _mm_loadu_si128((const __m128i *)(y + x));
+        __m128i u8, v8;
+        if (nv12) {
+            __m128i uv = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(u + x)), split_uv);
+            u8 = uv;
+            v8 = _mm_srli_si128(uv, 8);
+        }
+        else {
+            u8 = _mm_loadl_epi64((const __m128i *)(u + x / 2));
+            v8 = _mm_loadl_epi64((const __m128i *)(v + x / 2));
+        }
+        // one chroma sample covers two pixels
+        u8 = _mm_unpacklo_epi8(u8, u8);
+        v8 = _mm_unpacklo_epi8(v8, v8);
+        yuv_to_rgba16_sse4(y8, _mm_cvtepu8_epi16(u8), _mm_unpackhi_epi8(u8, zero),
+                           _mm_cvtepu8_epi16(v8), _mm_unpackhi_epi8(v8, zero),
+                           dst + x * 4, swap_rb);
+    }
+
+    yuv_to_rgb_row_c(y, u, v, dst, swap_rb ? AV_PIX_FMT_BGRA : AV_PIX_FMT_RGBA, x, width, nv12);
+}
+
+/**
+ * @brief luma of 4 rgba pixels as int32, without the +16 offset
+*/
+static inline __m128i rgba_to_y4_sse4(__m128i px, __m128i coef) {
+    __m128i lo = _mm_madd_epi16(_mm_cvtepu8_epi16(px), coef);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, _mm_setzero_si128()), coef);
+    __m128i sum = _mm_hadd_epi32(lo, hi);
+    return _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(128)), 8);
+}
+
+/**
+ * @brief averages 2x2 blocks of 4 rgba pixels from two rows, giving two rgba samples as int16
+*/
+static inline __m128i rgba_avg2x2_sse4(__m128i px0, __m128i px1) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_cvtepu8_epi16(px0), _mm_cvtepu8_epi16(px1));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(px0, zero), _mm_unpackhi_epi8(px1, zero));
+    __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+static inline __m128i rgba_to_chroma8_sse4(const __m128i avg[4], __m128i coef) {
+    __m128i c0 = _mm_hadd_epi32(_mm_madd_epi16(avg[0], coef), _mm_madd_epi16(avg[1], coef));
+    __m128i c1 = _mm_hadd_epi32(_mm_madd_epi16(avg[2], coef), _mm_madd_epi16(avg[3], coef));
+    c0 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(c0, _mm_set1_epi32(128)), 8), _mm_set1_epi32(128));
+    c1 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(c1, _mm_set1_epi32(128)), 8), _mm_set1_epi32(128));
+    __m128i c16 = _mm_packs_epi32(c0, c1);
+    return _mm_packus_epi16(c16, c16);
+}
+
+static void rgba_to_yuv_rows_sse4(const uint8_t *src0, const uint8_t *src1,
+                                  uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                                  int width, bool swap_rb, bool nv12) {
+    const __m128i y_coef = swap_rb ? _mm_setr_epi16(RGB_Y_B, RGB_Y_G, RGB_Y_R, 0, RGB_Y_B, RGB_Y_G, RGB_Y_R, 0)
+                                   : _mm_setr_epi16(RGB_Y_R, RGB_Y_G, RGB_Y_B, 0, RGB_Y_R, RGB_Y_G, RGB_Y_B, 0);
+    const __m128i u_coef = swap_rb ? _mm_setr_epi16(RGB_U_B, RGB_U_G, RGB_U_R, 0, RGB_U_B, RGB_U_G, RGB_U_R, 0)
+                                   : _mm_setr_epi16(RGB_U_R, RGB_U_G, RGB_U_B, 0, RGB_U_R, RGB_U_G, RGB_U_B, 0);
+    const __m128i v_coef = swap_rb ? _mm_setr_epi16(RGB_V_B, RGB_V_G, RGB_V_R, 0, RGB_V_B, RGB_V_G, RGB_V_R, 0)
+                                   : _mm_setr_epi16(RGB_V_R, RGB_V_G, RGB_V_B, 0, RGB_V_R, RGB_V_G, RGB_V_B, 0);
+    const __m128i c16 = _mm_set1_epi16(16);
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i px0[4], px1[4], avg[4];
+        for (int i = 0; i < 4; i++) {
+            px0[i] = _mm_loadu_si128((const __m128i *)(src0 + (x + i * 4) * 4));
+            px1[i] = _mm_loadu_si128((const __m128i *)(src1 + (x + i * 4) * 4));
+            avg[i] = rgba_avg2x2_sse4(px0[i], px1[i]);
+        }
+
+        __m128i l0 = _mm_packs_epi32(rgba_to_y4_sse4(px0[0], y_coef), rgba_to_y4_sse4(px0[1], y_coef));
+        __m128i l1 = _mm_packs_epi32(rgba_to_y4_sse4(px0[2], y_coef), rgba_to_y4_sse4(px0[3], y_coef));
+        _mm_storeu_si128((__m128i *)(y0 + x), _mm_packus_epi16(_mm_add_epi16(l0, c16), _mm_add_epi16(l1, c16)));
+        l0 = _mm_packs_epi32(rgba_to_y4_sse4(px1[0], y_coef), rgba_to_y4_sse4(px1[1], y_coef));
+        l1 = _mm_packs_epi32(rgba_to_y4_sse4(px1[2], y_coef), rgba_to_y4_sse4(px1[3], y_coef));
+        _mm_storeu_si128((__m128i *)(y1 + x), _mm_packus_epi16(_mm_add_epi16(l0, c16), _mm_add_epi16(l1, c16)));
+
+        __m128i u8 = rgba_to_chroma8_sse4(avg, u_coef);
+        __m128i v8 = rgba_to_chroma8_sse4(avg, v_coef);
+        if (nv12) {
+            _mm_storeu_si128((__m128i *)(u + x), _mm_unpacklo_epi8(u8, v8));
+        }
+        else {
+            _mm_storel_epi64((__m128i *)(u + x / 2), u8);
+            _mm_storel_epi64((__m128i *)(v + x / 2), v8);
+        }
+    }
+
+    rgb_to_yuv_rows_c(src0, src1, swap_rb ? AV_PIX_FMT_BGRA : AV_PIX_FMT_RGBA, y0, y1, u, v, x, width, nv12);
+}
+
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static inline __m256i mm256_combine_si128(__m128i lo, __m128i hi) {
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+static void yuv_to_rgba_row_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                 uint8_t *dst, int width, bool swap_rb, bool nv12) {
+    const __m256i c16 = _mm256_set1_epi16(16);
+    const __m256i c128 = _mm256_set1_epi16(128);
+    const __m256i round = _mm256_set1_epi16(1 << (YUV_SHIFT - 1));
+    const __m256i split_uv = _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+                                              0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+    int x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+        __m256i y8 = _mm256_loadu_si256((const __m256i *)(y + x));
+        __m128i u8, v8;
+        if (nv12) {
+            // [u0-7 v0-7 | u8-15 v8-15] -> [u0-15 | v0-15]
+            __m256i uv = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(u + x)), split_uv);
+            uv = _mm256_permute4x64_epi64(uv, 0xd8);
+            u8 = _mm256_castsi256_si128(uv);
+            v8 = _mm256_extracti128_si256(uv, 1);
+        }
+        else {
+            u8 = _mm_loadu_si128((const __m128i *)(u + x / 2));
+            v8 = _mm_loadu_si128((const __m128i *)(v + x / 2));
+        }
+
+        // the 16-bit halves hold pixels 0-15 and 16-31
+        __m256i y16[2] = { _mm256_cvtepu8_epi16(_mm256_castsi256_si128(y8)),
+                           _mm256_cvtepu8_epi16(_mm256_extracti128_si256(y8, 1)) };
+        __m256i u16[2] = { _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u8, u8)),
+                           _mm256_cvtepu8_epi16(_mm_unpackhi_epi8(u8, u8)) };
+        __m256i v16[2] = { _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(v8, v8)),
+                           _mm256_cvtepu8_epi16(_mm_unpackhi_epi8(v8, v8)) };
+        __m256i r[2], g[2], b[2];
+
+        for (int i = 0; i < 2; i++) {
+            __m256i ys = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(y16[i], c16), _mm256_set1_epi16(YUV_Y)), round);
+            __m256i cu = _mm256_sub_epi16(u16[i], c128);
+            __m256i cv = _mm256_sub_epi16(v16[i], c128);
+            r[i] = _mm256_srai_epi16(_mm256_adds_epi16(ys, _mm256_mullo_epi16(cv, _mm256_set1_epi16(YUV_V_R))), YUV_SHIFT);
+            g[i] = _mm256_srai_epi16(_mm256_subs_epi16(_mm256_subs_epi16(ys, _mm256_mullo_epi16(cu, _mm256_set1_epi16(YUV_U_G))),
+                                                       _mm256_mullo_epi16(cv, _mm256_set1_epi16(YUV_V_G))), YUV_SHIFT);
+            b[i] = _mm256_srai_epi16(_mm256_adds_epi16(ys, _mm256_mullo_epi16(cu, _mm256_set1_epi16(YUV_U_B))), YUV_SHIFT);
+        }
+
+        // packus works per lane: [0-7 16-23 | 8-15 24-31]
+        __m256i r8 = _mm256_packus_epi16(r[0], r[1]);
+        __m256i g8 = _mm256_packus_epi16(g[0], g[1]);
+        __m256i b8 = _mm256_packus_epi16(b[0], b[1]);
+        __m256i a8 = _mm256_set1_epi8((char)0xff);
+        if (swap_rb) {
+            __m256i t = r8;
+            r8 = b8;
+            b8 = t;
+        }
+
+        // unpacklo gives [0-7 | 8-15], unpackhi [16-23 | 24-31]
+        __m256i rg_lo = _mm256_unpacklo_epi8(r8, g8);
+        __m256i rg_hi = _mm256_unpackhi_epi8(r8, g8);
+        __m256i ba_lo = _mm256_unpacklo_epi8(b8, a8);
+        __m256i ba_hi = _mm256_unpackhi_epi8(b8, a8);
+        __m256i p0 = _mm256_unpacklo_epi16(rg_lo, ba_lo); // [0-3 | 8-11]
+        __m256i p1 = _mm256_unpackhi_epi16(rg_lo, ba_lo); // [4-7 | 12-15]
+        __m256i p2 = _mm256_unpacklo_epi16(rg_hi, ba_hi); // [16-19 | 24-27]
+        __m256i p3 = _mm256_unpackhi_epi16(rg_hi, ba_hi); // [20-23 | 28-31]
+        uint8_t *out = dst + x * 4;
+        _mm256_storeu_si256((__m256i *)out, _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 32), _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256((__m256i *)(out + 64), _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 96), _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+
+    // at most 31 pixels left
+    yuv_to_rgba_row_sse4(y + x, nv12 ? u + x : u + x / 2, nv12 ? NULL : v + x / 2,
+                         dst + x * 4, width - x, swap_rb, nv12);
+}
+
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+#ifdef __aarch64__
+#include <arm_neon.h>
+
+static void yuv_to_rgba_row_neon(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                 uint8_t *dst, int width, bool swap_rb, bool nv12) {
+    const int16x8_t c16 = vdupq_n_s16(16);
+    const int16x8_t c128 = vdupq_n_s16(128);
+    const int16x8_t round = vdupq_n_s16(1 << (YUV_SHIFT - 1));
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t y8 = vld1q_u8(y + x);
+        uint8x8_t u8, v8;
+        if (nv12) {
+            uint8x8x2_t uv = vld2_u8(u + x);
+            u8 = uv.val[0];
+            v8 = uv.val[1];
+        }
+        else {
+            u8 = vld1_u8(u + x / 2);
+            v8 = vld1_u8(v + x / 2);
+        }
+        // one chroma sample covers two pixels
+        uint8x8x2_t uu = vzip_u8(u8, u8);
+        uint8x8x2_t vv = vzip_u8(v8, v8);
+        int16x8_t y16[2] = { vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y8))),
+                             vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y8))) };
+        int16x8_t u16[2] = { vreinterpretq_s16_u16(vmovl_u8(uu.val[0])),
+                             vreinterpretq_s16_u16(vmovl_u8(uu.val[1])) };
+        int16x8_t v16[2] = { vreinterpretq_s16_u16(vmovl_u8(vv.val[0])),
+                             vreinterpretq_s16_u16(vmovl_u8(vv.val[1])) };
+        uint8x8_t r[2], g[2], b[2];
+
+        for (int i = 0; i < 2; i++) {
+            int16x8_t ys = vaddq_s16(vmulq_n_s16(vsubq_s16(y16[i], c16), YUV_Y), round);
+            int16x8_t cu = vsubq_s16(u16[i], c128);
+            int16x8_t cv = vsubq_s16(v16[i], c128);
+            r[i] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(ys, vmulq_n_s16(cv, YUV_V_R)), YUV_SHIFT));
+            g[i] = vqmovun_s16(vshrq_n_s16(vqsubq_s16(vqsubq_s16(ys, vmulq_n_s16(cu, YUV_U_G)),
+                                                      vmulq_n_s16(cv, YUV_V_G)), YUV_SHIFT));
+            b[i] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(ys, vmulq_n_s16(cu, YUV_U_B)), YUV_SHIFT));
+        }
+
+        uint8x16x4_t rgba;
+        rgba.val[swap_rb ? 2 : 0] = vcombine_u8(r[0], r[1]);
+        rgba.val[1] = vcombine_u8(g[0], g[1]);
+        rgba.val[swap_rb ? 0 : 2] = vcombine_u8(b[0], b[1]);
+        rgba.val[3] = vdupq_n_u8(0xff);
+        vst4q_u8(dst + x * 4, rgba);
+    }
+
+    yuv_to_rgb_row_c(y, u, v, dst, swap_rb ? AV_PIX_FMT_BGRA : AV_PIX_FMT_RGBA, x, width, nv12);
+}
+
+static inline uint8x8_t rgb_to_y8_neon(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+    // the largest sum is 220 * 255 + 128, which still fits in uint16
+    uint16x8_t sum = vmull_u8(r, vdup_n_u8(RGB_Y_R));
+    sum = vmlal_u8(sum, g, vdup_n_u8(RGB_Y_G));
+    sum = vmlal_u8(sum, b, vdup_n_u8(RGB_Y_B));
+    sum = vaddq_u16(vshrq_n_u16(vaddq_u16(sum, vdupq_n_u16(128)), 8), vdupq_n_u16(16));
+    return vmovn_u16(sum);
+}
+
+static inline uint8x8_t rgb_to_chroma8_neon(int16x8_t r, int16x8_t g, int16x8_t b, int cr, int cg, int cb) {
+    int16x8_t sum = vmulq_n_s16(r, cr);
+    sum = vmlaq_n_s16(sum, g, cg);
+    sum = vmlaq_n_s16(sum, b, cb);
+    sum = vaddq_s16(vshrq_n_s16(vaddq_s16(sum, vdupq_n_s16(128)), 8), vdupq_n_s16(128));
+    return vqmovun_s16(sum);
+}
+
+static void rgba_to_yuv_rows_neon(const uint8_t *src0, const uint8_t *src1,
+                                  uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                                  int width, bool swap_rb, bool nv12) {
+    const int ri = swap_rb ? 2 : 0;
+    const int bi = swap_rb ? 0 : 2;
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x4_t px0 = vld4q_u8(src0 + x * 4);
+        uint8x16x4_t px1 = vld4q_u8(src1 + x * 4);
+
+        vst1q_u8(y0 + x, vcombine_u8(rgb_to_y8_neon(vget_low_u8(px0.val[ri]), vget_low_u8(px0.val[1]), vget_low_u8(px0.val[bi])),
+                                     rgb_to_y8_neon(vget_high_u8(px0.val[ri]), vget_high_u8(px0.val[1]), vget_high_u8(px0.val[bi]))));
+        vst1q_u8(y1 + x, vcombine_u8(rgb_to_y8_neon(vget_low_u8(px1.val[ri]), vget_low_u8(px1.val[1]), vget_low_u8(px1.val[bi])),
+                                     rgb_to_y8_neon(vget_high_u8(px1.val[ri]), vget_high_u8(px1.val[1]), vget_high_u8(px1.val[bi]))));
+
+        // pairwise sums of both rows, then (sum + 2) >> 2
+        int16x8_t r = vreinterpretq_s16_u16(vrshrq_n_u16(vaddq_u16(vpaddlq_u8(px0.val[ri]), vpaddlq_u8(px1.val[ri])), 2));
+        int16x8_t g = vreinterpretq_s16_u16(vrshrq_n_u16(vaddq_u16(vpaddlq_u8(px0.val[1]), vpaddlq_u8(px1.val[1])), 2));
+        int16x8_t b = vreinterpretq_s16_u16(vrshrq_n_u16(vaddq_u16(vpaddlq_u8(px0.val[bi]), vpaddlq_u8(px1.val[bi])), 2));
+        uint8x8_t u8 = rgb_to_chroma8_neon(r, g, b, RGB_U_R, RGB_U_G, RGB_U_B);
+        uint8x8_t v8 = rgb_to_chroma8_neon(r, g, b, RGB_V_R, RGB_V_G, RGB_V_B);
+        if (nv12) {
+            uint8x8x2_t uv = { { u8, v8 } };
+            vst2_u8(u + x, uv);
+        }
+        else {
+            vst1_u8(u + x / 2, u8);
+            vst1_u8(v + x / 2, v8);
+        }
+    }
+
+    rgb_to_yuv_rows_c(src0, src1, swap_rb ? AV_PIX_FMT_BGRA : AV_PIX_FMT_RGBA, y0, y1, u, v, x, width, nv12);
+}
+#endif /* __aarch64__ */
+
+#define CACHE_SSE4 1
+#define CACHE_AVX2 2
+
+static unsigned cpuid_cache;
+static unsigned cpuid_detected;
+static YuvToRgbaRowFunc yuv_to_rgba_row = yuv_to_rgba_row_c;
+static RgbaToYuvRowsFunc rgba_to_yuv_rows = rgba_to_yuv_rows_c;
+static const char *accel_name = "c";
+
+static void init_accel(unsigned cache) {
+    yuv_to_rgba_row = yuv_to_rgba_row_c;
+    rgba_to_yuv_rows = rgba_to_yuv_rows_c;
+    accel_name = "c";
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_SSE4) {
+        yuv_to_rgba_row = yuv_to_rgba_row_sse4;
+        rgba_to_yuv_rows = rgba_to_yuv_rows_sse4;
+        accel_name = "sse4.1";
+    }
+    if (cache & CACHE_AVX2) {
+        // rgb -> yuv stays on sse4.1, it is bound by the 2x2 chroma averaging
+        yuv_to_rgba_row = yuv_to_rgba_row_avx2;
+        accel_name = "avx2";
+    }
+#endif
+#ifdef __aarch64__
+    if (cache != 0) {
+        yuv_to_rgba_row = yuv_to_rgba_row_neon;
+        rgba_to_yuv_rows = rgba_to_yuv_rows_neon;
+        accel_name = "neon";
+    }
+#endif
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void) {
+    unsigned max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (c & bit_SSE4_1) {
+            cache |= CACHE_SSE4;
+        }
+
+        // AVX has to be usable, not just available
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+        }
+    }
+    cpuid_detected = cache;
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#elif defined(__aarch64__)
+// advanced simd is mandatory on aarch64
+static void __attribute__((constructor)) init_cpuid_cache(void) {
+    cpuid_detected = 1;
+    cpuid_cache = 1;
+    init_accel(cpuid_cache);
+}
+#endif
+
+const char *dcodec_convert_accel_name(void) {
+    return accel_name;
+}
+
+/**
+ * @brief disables the accelerator in use and falls back to the next slower one.
+ * @return false if the c version was already in use.
+*/
+bool dcodec_convert_next_accel(void) {
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    // drop the fastest one first
+    cpuid_cache &= ~(1u << (31 - clz32(cpuid_cache)));
+    init_accel(cpuid_cache);
+    return true;
+}
+
+/**
+ * @brief goes back to the fastest accelerator supported by the host.
+*/
+void dcodec_convert_reset_accel(void) {
+    cpuid_cache = cpuid_detected;
+    init_accel(cpuid_cache);
+}
+
+bool dcodec_convert_supported(enum AVPixelFormat src_fmt, enum AVPixelFormat dst_fmt) {
+    return (is_yuv_format(src_fmt) && (is_yuv_format(dst_fmt) || is_rgb_format(dst_fmt))) ||
+           (is_rgb_format(src_fmt) && is_yuv_format(dst_fmt));
+}
+
+typedef struct ConvertJob {
+    const uint8_t *src[4];
+    int src_linesize[4];
+    enum AVPixelFormat src_fmt;
+    uint8_t *dst[4];
+    int dst_linesize[4];
+    enum AVPixelFormat dst_fmt;
+    int width;
+    int height;
+
+    GMutex lock;
+    GCond cond;
+    int pending;
+} ConvertJob;
+
+typedef struct ConvertStripe {
+    ConvertJob *job;
+    int y_begin;
+    int y_end;
+} ConvertStripe;
+
+static void convert_yuv_to_rgb(ConvertJob *job, int y_begin, int y_end) {
+    bool nv12 = job->src_fmt == AV_PIX_FMT_NV12;
+    bool rgba = job->dst_fmt == AV_PIX_FMT_RGBA || job->dst_fmt == AV_PIX_FMT_BGRA;
+
+    for (int y = y_begin; y < y_end; y++) {
+        const uint8_t *luma = job->src[0] + y * job->src_linesize[0];
+        const uint8_t *u = job->src[1] + (y / 2) * job->src_linesize[1];
+        const uint8_t *v = nv12 ? NULL : job->src[2] + (y / 2) * job->src_linesize[2];
+        uint8_t *dst = job->dst[0] + y * job->dst_linesize[0];
+        if (rgba) {
+            yuv_to_rgba_row(luma, u, v, dst, job->width, job->dst_fmt == AV_PIX_FMT_BGRA, nv12);
+        }
+        else {
+            yuv_to_rgb_row_c(luma, u, v, dst, job->dst_fmt, 0, job->width, nv12);
+        }
+    }
+}
+
+static void convert_rgb_to_yuv(ConvertJob *job, int y_begin, int y_end) {
+    bool nv12 = job->dst_fmt == AV_PIX_FMT_NV12;
+    bool rgba = job->src_fmt == AV_PIX_FMT_RGBA || job->src_fmt == AV_PIX_FMT_BGRA;
+
+    for (int y = y_begin; y < y_end; y += 2) {
+        // the last row of an odd height frame is paired with itself
+        int y_next = y + 1 < job->height ? y + 1 : y;
+        const uint8_t *src0 = job->src[0] + y * job->src_linesize[0];
+        const uint8_t *src1 = job->src[0] + y_next * job->src_linesize[0];
+        uint8_t *y0 = job->dst[0] + y * job->dst_linesize[0];
+        uint8_t *y1 = job->dst[0] + y_next * job->dst_linesize[0];
+        uint8_t *u = job->dst[1] + (y / 2) * job->dst_linesize[1];
+        uint8_t *v = nv12 ? NULL : job->dst[2] + (y / 2) * job->dst_linesize[2];
+        if (rgba) {
+            rgba_to_yuv_rows(src0, src1, y0, y1, u, v, job->width, job->src_fmt == AV_PIX_FMT_BGRA, nv12);
+        }
+        else {
+            rgb_to_yuv_rows_c(src0, src1, job->src_fmt, y0, y1, u, v, 0, job->width, nv12);
+        }
+    }
+}
+
+static void convert_yuv_to_yuv(ConvertJob *job, int y_begin, int y_end) {
+    bool src_nv12 = job->src_fmt == AV_PIX_FMT_NV12;
+    bool dst_nv12 = job->dst_fmt == AV_PIX_FMT_NV12;
+    int chroma_width = (job->width + 1) / 2;
+
+    for (int y = y_begin; y < y_end; y++) {
+        memcpy(job->dst[0] + y * job->dst_linesize[0], job->src[0] + y * job->src_linesize[0], job->width);
+        if (y & 1) {
+            continue;
+        }
+
+        int cy = y / 2;
+        const uint8_t *su = job->src[1] + cy * job->src_linesize[1];
+        const uint8_t *sv = src_nv12 ? NULL : job->src[2] + cy * job->src_linesize[2];
+        uint8_t *du = job->dst[1] + cy * job->dst_linesize[1];
+        uint8_t *dv = dst_nv12 ? NULL : job->dst[2] + cy * job->dst_linesize[2];
+        if (src_nv12 && dst_nv12) {
+            memcpy(du, su, chroma_width * 2);
+        }
+        else if (src_nv12) {
+            for (int x = 0; x < chroma_width; x++) {
+                du[x] = su[x * 2];
+                dv[x] = su[x * 2 + 1];
+            }
+        }
+        else if (dst_nv12) {
+            for (int x = 0; x < chroma_width; x++) {
+                du[x * 2] = su[x];
+                du[x * 2 + 1] = sv[x];
+            }
+        }
+        else {
+            memcpy(du, su, chroma_width);
+            memcpy(dv, sv, chroma_width);
+        }
+    }
+}
+
+static void convert_rows(ConvertJob *job, int y_begin, int y_end) {
+    if (is_rgb_format(job->dst_fmt)) {
+        convert_yuv_to_rgb(job, y_begin, y_end);
+    }
+    else if (is_rgb_format(job->src_fmt)) {
+        convert_rgb_to_yuv(job, y_begin, y_end);
+    }
+    else {
+        convert_yuv_to_yuv(job, y_begin, y_end);
+    }
+}
+
+static void convert_stripe_func(gpointer data, gpointer user_data) {
+    ConvertStripe *stripe = data;
+    ConvertJob *job = stripe->job;
+
+    convert_rows(job, stripe->y_begin, stripe->y_end);
+
+    g_mutex_lock(&job->lock);
+    job->pending--;
+    g_cond_signal(&job->cond);
+    g_mutex_unlock(&job->lock);
+}
+
+static GThreadPool *get_convert_pool(void) {
+    static gsize pool_init = 0;
+    static GThreadPool *pool = NULL;
+
+    if (g_once_init_enter(&pool_init)) {
+        // the calling thread converts one of the stripes itself
+        pool = g_thread_pool_new(convert_stripe_func, NULL, DCODEC_CONVERT_MAX_STRIPES - 1, FALSE, NULL);
+        g_once_init_leave(&pool_init, 1);
+    }
+    return pool;
+}
+
+/**
+ * @brief converts a frame without resizing it.
+ * frames of DCODEC_CONVERT_STRIPE_PIXELS or more are split into stripes of even
+ * height that are converted in parallel.
+ * @return false if the format pair is not supported, the caller should use swscale then.
+*/
+bool dcodec_convert_frame(const uint8_t *const src_data[4], const int src_linesize[4],
+                          enum AVPixelFormat src_fmt,
+                          uint8_t *const dst_data[4], const int dst_linesize[4],
+                          enum AVPixelFormat dst_fmt,
+                          int width, int height) {
+    if (!dcodec_convert_supported(src_fmt, dst_fmt) || width <= 0 || height <= 0) {
+        return false;
+    }
+
+    ConvertJob job;
+    memset(&job, 0, sizeof(job));
+    for (int i = 0; i < 4; i++) {
+        job.src[i] = src_data[i];
+        job.src_linesize[i] = src_linesize[i];
+        job.dst[i] = dst_data[i];
+        job.dst_linesize[i] = dst_linesize[i];
+    }
+    job.src_fmt = src_fmt;
+    job.dst_fmt = dst_fmt;
+    job.width = width;
+    job.height = height;
+
+    int stripes = 1;
+    if ((int64_t)width * height >= DCODEC_CONVERT_STRIPE_PIXELS) {
+        stripes = MIN(MAX(dcodec_convert_max_stripes, 1), DCODEC_CONVERT_MAX_STRIPES);
+    }
+    if (stripes == 1) {
+        convert_rows(&job, 0, height);
+        return true;
+    }
+
+    GThreadPool *pool = get_convert_pool();
+    ConvertStripe stripe[DCODEC_CONVERT_MAX_STRIPES];
+    int stripe_height = ROUND_UP(DIV_ROUND_UP(height, stripes), 2);
+
+    g_mutex_init(&job.lock);
+    g_cond_init(&job.cond);
+    job.pending = stripes - 1;
+    for (int i = 0; i < stripes; i++) {
+        stripe[i].job = &job;
+        stripe[i].y_begin = MIN(i * stripe_height, height);
+        stripe[i].y_end = MIN((i + 1) * stripe_height, height);
+        if (i > 0) {
+            g_thread_pool_push(pool, &stripe[i], NULL);
+        }
+    }
+
+    convert_rows(&job, stripe[0].y_begin, stripe[0].y_end);
+
+    g_mutex_lock(&job.lock);
+    while (job.pending > 0) {
+        g_cond_wait(&job.cond, &job.lock);
+    }
+    g_mutex_unlock(&job.lock);
+
+    g_mutex_clear(&job.lock);
+    g_cond_clear(&job.cond);
+    return true;
+}
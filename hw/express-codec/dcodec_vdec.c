@@ -12,6 +12,7 @@
 
 #include "hw/teleport-express/express_log.h"
 #include "hw/express-codec/dcodec_video.h"
+#include "hw/express-codec/dcodec_convert.h"
 #include "hw/express-gpu/egl_surface.h"
 #include "hw/express-gpu/glv3_context.h"
 #include "hw/express-gpu/glv3_status.h"
@@ -43,15 +44,27 @@ static const struct VideoCodingMapEntry {
 
 static const size_t sCodingMapLen = (sizeof(sCodingMap) / sizeof(sCodingMap[0]));
 
-// async tasks should use their own private sws contexts
-__thread struct SwsContext * g_sws_ctx;
-__thread uint8_t *g_videobuf;
+// threads used by software decoders, 0 lets ffmpeg use one per host core
+int express_codec_decode_threads = 0;
+
+// software frames with a texture destination are converted to rgb on the gpu
+// instead of by swscale, which also moves 1.5 instead of 4 bytes per pixel
+bool express_codec_decode_to_texture = true;
+
+typedef struct ScaleTask {
+    DCodecVideo *context;
+    // order of the guest notification, only used for guest memory output
+    uint64_t seq;
+    BufferDesc *desc;
+    bool scaled;
+} ScaleTask;
 
 static int setup_decoder(DCodecVideo *context);
 static int open_codec(DCodecComponent *_context);
 static int empty_one_input_buffer(DCodecComponent *_context);
 static int decode_video(DCodecVideo *context, BufferDesc *desc);
 static int fill_one_output_buffer(DCodecComponent *_context);
+static void release_async_outputs(DCodecComponent *_context);
 
 static void free_avpacket(gpointer pkt) {
     if (pkt != NULL) {
@@ -87,6 +100,10 @@ DCodecComponent* dcodec_vdec_init_component(enum OMX_VIDEO_CODINGTYPE codingType
     context->base.empty_one_input_buffer = empty_one_input_buffer;
     context->base.fill_one_output_buffer = fill_one_output_buffer;
     context->base.fill_eos_output_buffer = dcodec_fill_eos_output_buffer;
+    context->base.release_async_outputs = release_async_outputs;
+    context->base.release_thread_resources = dcodec_video_release_thread_resources;
+
+    dcodec_video_init_scalers(context);
 
     context->mIsDecoder = true;
     context->mIsAdaptive = false;
@@ -109,6 +126,75 @@ DCodecComponent* dcodec_vdec_init_component(enum OMX_VIDEO_CODINGTYPE codingType
     return (DCodecComponent *)context;
 }
 
+void dcodec_video_init_scalers(DCodecVideo *context) {
+    for (int i = 0; i < DCODEC_SCALER_NUM; i++) {
+        g_mutex_init(&context->mScalers[i].lock);
+    }
+    g_mutex_init(&context->mOutputLock);
+    g_cond_init(&context->mOutputCond);
+    context->mOutputFinished = g_hash_table_new(NULL, NULL);
+}
+
+void dcodec_video_deinit_scalers(DCodecVideo *context) {
+    // in-flight scaling tasks still use the scalers of this component
+    g_mutex_lock(&context->mOutputLock);
+    while (context->mScaleTasks > 0) {
+        g_cond_wait(&context->mOutputCond, &context->mOutputLock);
+    }
+    g_mutex_unlock(&context->mOutputLock);
+
+    // the worker has stopped, outputs it did not release are dropped
+    GHashTableIter iter;
+    ScaleTask *scaleTask;
+    g_hash_table_iter_init(&iter, context->mOutputFinished);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&scaleTask)) {
+        dcodec_free_buffer_desc(scaleTask->desc);
+        g_free(scaleTask);
+    }
+    g_hash_table_destroy(context->mOutputFinished);
+    context->mOutputFinished = NULL;
+
+    for (int i = 0; i < DCODEC_SCALER_NUM; i++) {
+        DCodecScaler *scaler = &context->mScalers[i];
+        if (scaler->sws_ctx) {
+            sws_freeContext(scaler->sws_ctx);
+            scaler->sws_ctx = NULL;
+        }
+        av_freep(&scaler->buf);
+        scaler->buf_size = 0;
+        g_mutex_clear(&scaler->lock);
+    }
+    g_mutex_clear(&context->mOutputLock);
+    g_cond_clear(&context->mOutputCond);
+}
+
+/**
+ * @brief grab a free scaler of this component. blocks on the first one if all
+ * of them are in use.
+*/
+DCodecScaler *dcodec_video_acquire_scaler(DCodecVideo *context) {
+    for (int i = 0; i < DCODEC_SCALER_NUM; i++) {
+        if (g_mutex_trylock(&context->mScalers[i].lock)) {
+            return &context->mScalers[i];
+        }
+    }
+    g_mutex_lock(&context->mScalers[0].lock);
+    return &context->mScalers[0];
+}
+
+void dcodec_video_release_scaler(DCodecScaler *scaler) {
+    g_mutex_unlock(&scaler->lock);
+}
+
+uint8_t *dcodec_scaler_get_buffer(DCodecScaler *scaler, size_t size) {
+    if (scaler->buf_size < size) {
+        av_free(scaler->buf);
+        scaler->buf = av_malloc(size);
+        scaler->buf_size = scaler->buf ? size : 0;
+    }
+    return scaler->buf;
+}
+
 OMX_ERRORTYPE dcodec_vdec_reset_component(DCodecComponent *_context) {
 #ifdef STD_DEBUG_INDEPENDENT_WINDOW
     THREAD_CONTROL_BEGIN
@@ -119,22 +205,20 @@ OMX_ERRORTYPE dcodec_vdec_reset_component(DCodecComponent *_context) {
     return dcodec_reset_component(_context);
 }
 
-OMX_ERRORTYPE dcodec_vdec_destroy_component(DCodecComponent *_context) {
+/**
+ * @brief releases the GL objects created by open_codec(), on the thread that owns the context.
+*/
+void dcodec_video_release_thread_resources(DCodecComponent *_context) {
     DCodecVideo *context = (DCodecVideo *)_context;
 
-    if (g_sws_ctx) {
-        sws_freeContext(g_sws_ctx);
-        g_sws_ctx = NULL;
-    }
-
-    if (g_videobuf) {
-        av_free(g_videobuf);
-        g_videobuf = NULL;
-    }
-
     if (context->mCsConv) {
         cs_deinit_cuda(context->mCsConv);
         cs_deinit(context->mCsConv);
+        context->mCsConv = NULL;
+    }
+    if (context->mUploadConv) {
+        cs_deinit(context->mUploadConv);
+        context->mUploadConv = NULL;
     }
 
     if (context->window) {
@@ -147,7 +231,15 @@ OMX_ERRORTYPE dcodec_vdec_destroy_component(DCodecComponent *_context) {
 #else
         release_native_opengl_context(context->window, 0);
 #endif
+        context->window = NULL;
     }
+}
+
+OMX_ERRORTYPE dcodec_vdec_destroy_component(DCodecComponent *_context) {
+    DCodecVideo *context = (DCodecVideo *)_context;
+
+    dcodec_component_stop_worker(_context);
+    dcodec_video_deinit_scalers(context);
 
     if (context->mInputMap) {
         g_hash_table_destroy(context->mInputMap);
@@ -428,6 +520,14 @@ static int open_codec(DCodecComponent *_context) {
     mCtx->debug = 1;
 #endif
 
+    if (mCtx->hw_device_ctx == NULL) {
+        // frame threading has the best throughput for software decoding, but
+        // holds back thread_count - 1 frames, so low latency streams only use
+        // slice threading. ffmpeg returns frames in presentation order either way.
+        mCtx->thread_count = express_codec_decode_threads;
+        mCtx->thread_type = context->mIsLowLatency ? FF_THREAD_SLICE : (FF_THREAD_FRAME | FF_THREAD_SLICE);
+    }
+
     AVDictionary *options = NULL;
 
     if (context->mIsLowLatency) {
@@ -446,8 +546,8 @@ static int open_codec(DCodecComponent *_context) {
         return ERR_CODEC_OPEN_FAILED;
     }
 
-    LOGI("open ffmpeg video decoder (%s) success, width %d height %d",
-            mCtx->codec->name, mCtx->width, mCtx->height);
+    LOGI("open ffmpeg video decoder (%s) success, width %d height %d threads %d type %x",
+            mCtx->codec->name, mCtx->width, mCtx->height, mCtx->thread_count, mCtx->active_thread_type);
 
     context->mInputMap = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free_avpacket);
 
@@ -556,27 +656,32 @@ static int decode_video(DCodecVideo *context, BufferDesc *desc) {
     }
     else if (desc->type & CODEC_BUFFER_TYPE_GUEST_MEM) {
         mPkt = (AVPacket *)g_hash_table_lookup(context->mInputMap, (gpointer)desc->id);
+        if (mPkt && !av_buffer_is_writable(mPkt->buf)) {
+            // frame threads still hold the packet last read from this buffer,
+            // leave it to them and read into a new one
+            LOGD("av_buffer id %" PRIx64 " is busy, allocating a new packet", desc->id);
+            g_hash_table_remove(context->mInputMap, (gpointer)desc->id);
+            mPkt = NULL;
+        }
         if (!mPkt) {
             mPkt = av_packet_alloc();
-            uint8_t *buf = av_malloc(min(desc->nFilledLen * 2, desc->nAllocLen));
+            size_t bufSize = max(min(desc->nFilledLen * 2, desc->nAllocLen), desc->nFilledLen);
+            uint8_t *buf = av_malloc(bufSize + AV_INPUT_BUFFER_PADDING_SIZE);
             read_from_guest_mem(desc->data, buf, desc->nOffset, desc->nFilledLen);
+            memset(buf + desc->nFilledLen, 0, bufSize - desc->nFilledLen + AV_INPUT_BUFFER_PADDING_SIZE);
             av_packet_from_data(mPkt, buf, desc->nFilledLen);
             g_hash_table_insert(context->mInputMap, (gpointer)desc->id, (gpointer)mPkt);
         }
         else {
-            if (av_buffer_is_writable(mPkt->buf)) {
-                if (mPkt->buf->size < desc->nFilledLen) {
-                    int newSize = min(desc->nFilledLen * 2, desc->nAllocLen) + AV_INPUT_BUFFER_PADDING_SIZE;
-                    LOGD("av_buffer_realloc %d -> %d", mPkt->buf->size, newSize);
-                    av_buffer_realloc(&mPkt->buf, newSize);
-                    mPkt->data = mPkt->buf->data;
-                }
-                read_from_guest_mem(desc->data, mPkt->buf->data, desc->nOffset, desc->nFilledLen);
-                mPkt->size = desc->nFilledLen;
-            }
-            else {
-                LOGE("error! av_buffer id %" PRIx64 " is not writable!", desc->id);
+            if (mPkt->buf->size < desc->nFilledLen + AV_INPUT_BUFFER_PADDING_SIZE) {
+                int newSize = max(min(desc->nFilledLen * 2, desc->nAllocLen), desc->nFilledLen) + AV_INPUT_BUFFER_PADDING_SIZE;
+                LOGD("av_buffer_realloc %d -> %d", mPkt->buf->size, newSize);
+                av_buffer_realloc(&mPkt->buf, newSize);
+                mPkt->data = mPkt->buf->data;
             }
+            read_from_guest_mem(desc->data, mPkt->buf->data, desc->nOffset, desc->nFilledLen);
+            memset(mPkt->buf->data + desc->nFilledLen, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+            mPkt->size = desc->nFilledLen;
         }
         mPkt->pts = desc->nTimeStamp;
         mPkt->dts = desc->nTimeStamp;
@@ -609,12 +714,13 @@ static int decode_video(DCodecVideo *context, BufferDesc *desc) {
 }
 
 static void swscale_task_cb(MemTransferTask *task, void *mapped_addr) {
-    DCodecVideo *context = task->private_data;
-    DCodecComponent *_context = (DCodecComponent *)context;
+    ScaleTask *scaleTask = task->private_data;
+    DCodecVideo *context = scaleTask->context;
     AVFrame *mFrame = task->src_data;
     enum AVPixelFormat avdstfmt = pixel_format_omx_to_av(context->mImageFormat);
     uint8_t *data[4] = { mapped_addr };
     int linesize[4] = { 0 };
+    bool scaled = false;
 
     if (mFrame->format == AV_PIX_FMT_CUDA) {
         AVFrame *swFrame = av_frame_alloc();
@@ -623,9 +729,7 @@ static void swscale_task_cb(MemTransferTask *task, void *mapped_addr) {
         mFrame = swFrame;
     }
 
-    g_sws_ctx = sws_getCachedContext(g_sws_ctx,
-           mFrame->width, mFrame->height, mFrame->format, context->mWidth, context->mHeight,
-           avdstfmt, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    DCodecScaler *scaler = dcodec_video_acquire_scaler(context);
 
     if (task->dst_dev == EXPRESS_MEM_TYPE_GBUFFER_HOST_MEM) {
         Hardware_Buffer *gbuffer = (Hardware_Buffer *)task->dst_data;
@@ -636,25 +740,41 @@ static void swscale_task_cb(MemTransferTask *task, void *mapped_addr) {
         data[0] = (uint8_t *)task->dst_data;
     } 
     else if (task->dst_dev == EXPRESS_MEM_TYPE_GUEST_OPAQUE) {
-        g_videobuf = av_realloc(g_videobuf, task->dst_len);
-        data[0] = g_videobuf;
+        data[0] = dcodec_scaler_get_buffer(scaler, task->dst_len);
     }
 
-    if (pixel_format_to_swscale_param(context->mImageFormat, context->mWidth, context->mHeight, data, linesize) < 0) {
-        return;
+    if (data[0] && pixel_format_to_swscale_param(context->mImageFormat, context->mWidth, context->mHeight, data, linesize) >= 0) {
+        // swscale is only needed when the frame is actually resized
+        if (mFrame->width == context->mWidth && mFrame->height == context->mHeight &&
+            dcodec_convert_frame((const uint8_t * const*)mFrame->data, mFrame->linesize, mFrame->format,
+                                 data, linesize, avdstfmt, mFrame->width, mFrame->height)) {
+            scaled = true;
+        }
+        else {
+            scaler->sws_ctx = sws_getCachedContext(scaler->sws_ctx,
+                   mFrame->width, mFrame->height, mFrame->format, context->mWidth, context->mHeight,
+                   avdstfmt, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+            if (scaler->sws_ctx) {
+                LOGD("sws_scale frame_width=%d frame_height=%d ctx_width=%d ctx_height=%d mIsAdaptive=%d src_format=%s tgt_format=%s",
+                    mFrame->width, mFrame->height, context->mWidth, context->mHeight, context->mIsAdaptive, av_get_pix_fmt_name(mFrame->format), av_get_pix_fmt_name(avdstfmt));
+
+                sws_scale(scaler->sws_ctx, (const uint8_t * const*)mFrame->data, mFrame->linesize, 0, mFrame->height, data, linesize);
+                scaled = true;
+            }
+        }
     }
 
-    LOGD("sws_scale frame_width=%d frame_height=%d ctx_width=%d ctx_height=%d mIsAdaptive=%d src_format=%s tgt_format=%s",
-        mFrame->width, mFrame->height, context->mWidth, context->mHeight, context->mIsAdaptive, av_get_pix_fmt_name(mFrame->format), av_get_pix_fmt_name(avdstfmt));
-
-    sws_scale(g_sws_ctx, (const uint8_t * const*)mFrame->data, mFrame->linesize, 0, mFrame->height, data, linesize);
-
+    BufferDesc *desc = NULL;
     if (task->dst_dev == EXPRESS_MEM_TYPE_GUEST_OPAQUE) {
-        BufferDesc *desc = (BufferDesc *)task->dst_data;
-        write_to_guest_mem((Guest_Mem *)desc->data, g_videobuf, 0, desc->nFilledLen);
-        _context->notify(_context, (CodecCallbackData){ .event = OMX_EventFillBufferDone, .data1 = desc->nFilledLen, .data2 = desc->nTimeStamp, .data = desc->id, .flags = desc->nFlags });
+        desc = (BufferDesc *)task->dst_data;
+        if (scaled) {
+            // each task writes its own guest buffer, only the notifications need ordering
+            write_to_guest_mem((Guest_Mem *)desc->data, data[0], 0, desc->nFilledLen);
+        }
     }
 
+    dcodec_video_release_scaler(scaler);
+
 #ifdef STD_DEBUG_INDEPENDENT_WINDOW
     if (task->dst_dev == EXPRESS_MEM_TYPE_TEXTURE) {
         glFramebufferTexture(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, gbuffer->data_texture, 0);
@@ -670,21 +790,174 @@ static void swscale_task_cb(MemTransferTask *task, void *mapped_addr) {
     THREAD_CONTROL_END
 #endif
     av_frame_free(&mFrame);
+
+    scaleTask->scaled = scaled;
+}
+
+/**
+ * @brief notifies the guest of finished guest memory outputs in submission order.
+ * Only one thread releases at a time, and none of them waits for another: a
+ * thread that finds the next output missing, or someone else releasing, returns.
+*/
+static void release_async_outputs(DCodecComponent *_context) {
+    DCodecVideo *context = (DCodecVideo *)_context;
+
+    g_mutex_lock(&context->mOutputLock);
+    if (context->mOutputReleasing) {
+        g_mutex_unlock(&context->mOutputLock);
+        return;
+    }
+    context->mOutputReleasing = true;
+
+    ScaleTask *scaleTask;
+    while ((scaleTask = g_hash_table_lookup(context->mOutputFinished, (gpointer)context->mOutputDelivered))) {
+        g_hash_table_remove(context->mOutputFinished, (gpointer)context->mOutputDelivered);
+        g_mutex_unlock(&context->mOutputLock);
+
+        // the guest callback ring may be full, never notify under mOutputLock
+        BufferDesc *desc = scaleTask->desc;
+        if (scaleTask->scaled) {
+            _context->notify(_context, (CodecCallbackData){ .event = OMX_EventFillBufferDone, .data1 = desc->nFilledLen, .data2 = desc->nTimeStamp, .data = desc->id, .flags = desc->nFlags });
+        }
+        dcodec_free_buffer_desc(desc);
+        g_free(scaleTask);
+
+        // advanced only now, so the eos buffer cannot overtake this notification
+        g_mutex_lock(&context->mOutputLock);
+        context->mOutputDelivered++;
+    }
+
+    context->mOutputReleasing = false;
+    g_mutex_unlock(&context->mOutputLock);
+}
+
+/**
+ * @brief runs after every scaling task, even if the worker failed before
+ * calling swscale_task_cb, so the ordering and the task count never stall.
+ * Runs on a shared express-mem worker and must not block: guest memory
+ * outputs are only parked here, the component worker releases them in order.
+*/
+static void swscale_task_done_cb(MemTransferTask *task, int retval) {
+    ScaleTask *scaleTask = task->private_data;
+    DCodecVideo *context = scaleTask->context;
+    DCodecComponent *_context = (DCodecComponent *)context;
+    bool release = false;
+
+    if (task->dst_dev == EXPRESS_MEM_TYPE_GUEST_OPAQUE) {
+        g_mutex_lock(&context->mOutputLock);
+        scaleTask->desc = (BufferDesc *)task->dst_data;
+        g_hash_table_insert(context->mOutputFinished, (gpointer)scaleTask->seq, scaleTask);
+        // without a worker nobody else would release it
+        release = !_context->worker_running;
+        scaleTask = NULL;
+        g_mutex_unlock(&context->mOutputLock);
+    }
+    if (release) {
+        release_async_outputs(_context);
+    }
+
+    // the component stays alive until mScaleTasks drops to zero
+    g_mutex_lock(&context->mOutputLock);
+    dcodec_component_wake(_context);
+    context->mScaleTasks--;
+    g_cond_broadcast(&context->mOutputCond);
+    g_mutex_unlock(&context->mOutputLock);
+
+    g_free(scaleTask);
+}
+
+/**
+ * @brief post callback of texture transfers, which only need to wake up the component.
+*/
+static void transfer_task_done_cb(MemTransferTask *task, int retval) {
+    DCodecVideo *context = task->private_data;
+
+    g_mutex_lock(&context->mOutputLock);
+    dcodec_component_wake((DCodecComponent *)context);
+    context->mScaleTasks--;
+    g_cond_broadcast(&context->mOutputCond);
+    g_mutex_unlock(&context->mOutputLock);
+}
+
+/**
+ * @brief uploads the planes of a software frame and converts them into the gbuffer on the GPU.
+ * @return ERR_COLORSPACE_FAILED if the frame cannot take this path, swscale has to be used then
+*/
+static int convert_frame_to_texture(DCodecVideo *context, AVFrame *frame, Hardware_Buffer *gbuffer) {
+    enum AVPixelFormat avDstFmt = pixel_format_omx_to_av(context->mImageFormat);
+    const AVPixFmtDescriptor *dstDesc = av_pix_fmt_desc_get(avDstFmt);
+
+    // the shaders neither scale nor output yuv
+    if (!express_codec_decode_to_texture || context->mUploadConvFailed ||
+        (frame->format != AV_PIX_FMT_YUV420P && frame->format != AV_PIX_FMT_NV12) ||
+        frame->width != context->mWidth || frame->height != context->mHeight ||
+        gbuffer->width != frame->width || gbuffer->height != frame->height ||
+        dstDesc == NULL || !(dstDesc->flags & AV_PIX_FMT_FLAG_RGB)) {
+        return ERR_COLORSPACE_FAILED;
+    }
+
+    CsConverter *conv = context->mUploadConv;
+    if (conv == NULL || conv->mFormat != frame->format ||
+        conv->mWidth != frame->width || conv->mHeight != frame->height) {
+        if (conv) {
+            cs_deinit(conv);
+        }
+        conv = context->mUploadConv = cs_init(avDstFmt, frame->format, frame->width, frame->height);
+        if (conv->mProgram == 0) {
+            LOGW("gpu yuv -> rgb conversion unavailable, using swscale for texture outputs");
+            cs_deinit(conv);
+            context->mUploadConv = NULL;
+            context->mUploadConvFailed = true;
+            return ERR_COLORSPACE_FAILED;
+        }
+    }
+
+    int ret = cs_upload(conv, (const uint8_t * const*)frame->data, frame->linesize);
+    if (ret != ERR_OK) {
+        return ret;
+    }
+    return cs_convert(conv, gbuffer->data_fbo);
+}
+
+/**
+ * @brief submit a frame to the express-mem workers for CPU scaling
+*/
+static void scale_frame_async(DCodecVideo *context, ExpressMemType dst_dev, void *dst_data, AVFrame *frame, int dst_len, int src_len, int sync_id) {
+    ScaleTask *scaleTask = g_new0(ScaleTask, 1);
+    scaleTask->context = context;
+
+    g_mutex_lock(&context->mOutputLock);
+    if (dst_dev == EXPRESS_MEM_TYPE_GUEST_OPAQUE) {
+        scaleTask->seq = context->mOutputSubmitted++;
+    }
+    context->mScaleTasks++;
+    g_mutex_unlock(&context->mOutputLock);
+
+    mem_transfer_async(dst_dev, EXPRESS_MEM_TYPE_HOST_OPAQUE, dst_data, frame, dst_len, src_len, sync_id, swscale_task_cb, swscale_task_done_cb, scaleTask);
 }
 
 static int fill_one_output_buffer(DCodecComponent *_context) {
     DCodecVideo *context = (DCodecVideo *)_context;
     AVCodecContext *mCtx = _context->mCtx;
-    AVFrame *mFrame = av_frame_alloc();
-    BufferDesc *desc = g_queue_peek_head(_context->output_buffers);
-
     if (mem_transfer_is_busy()) {
-        return ERR_OK;
+        return ERR_MEM_BUSY;
     }
 
+    AVFrame *mFrame = av_frame_alloc();
+    BufferDesc *desc = g_queue_peek_head(_context->output_buffers);
+
     // read one frame at a time
     int ret = avcodec_receive_frame(mCtx, mFrame);
     if (ret == AVERROR_EOF && _context->mStatus == INPUT_EOS_SEEN) {
+        // the eos buffer must not overtake frames still being scaled into guest
+        // memory, the last of them wakes us up again
+        g_mutex_lock(&context->mOutputLock);
+        bool pending = context->mOutputDelivered != context->mOutputSubmitted;
+        g_mutex_unlock(&context->mOutputLock);
+        if (pending) {
+            av_frame_free(&mFrame);
+            return ERR_NO_FRM;
+        }
         _context->fill_eos_output_buffer(_context);
         _context->mStatus = OUTPUT_EOS_SENT;
         av_frame_free(&mFrame);
@@ -728,9 +1001,8 @@ static int fill_one_output_buffer(DCodecComponent *_context) {
     desc = g_queue_pop_head(_context->output_buffers);
 
     if (desc->type & CODEC_BUFFER_TYPE_GUEST_MEM) {
-        mem_transfer_async(EXPRESS_MEM_TYPE_GUEST_OPAQUE, EXPRESS_MEM_TYPE_HOST_OPAQUE, desc, mFrame, desc->nAllocLen, outputSize, desc->sync_id, swscale_task_cb, NULL, context);
-        // desc is freed by the async thread
-        // since the async thread needs to send omx fill events
+        scale_frame_async(context, EXPRESS_MEM_TYPE_GUEST_OPAQUE, desc, mFrame, desc->nAllocLen, outputSize, desc->sync_id);
+        // desc is freed once its fill event is released, in submission order
     }
     else if (desc->type & CODEC_BUFFER_TYPE_GBUFFER) {
         int glIntFmt = GL_RGB8;
@@ -761,21 +1033,40 @@ static int fill_one_output_buffer(DCodecComponent *_context) {
 
         uint32_t block_time;
         ExpressMemType pred_phy_dev;
+        bool on_texture = false;
 
         if (mFrame->format == AV_PIX_FMT_CUDA) {
             // hw pix fmt, do in-GPU colorspace conversion
             LOGD("hw frame %p received, data %p size %d", mFrame, mFrame->data[0], mFrame->linesize[0]);
             cs_map_cuda(context->mCsConv, (CUdeviceptr *)mFrame->data, mFrame->linesize);
             cs_convert(context->mCsConv, gbuffer->data_fbo);
+            on_texture = true;
+        }
+        else if (convert_frame_to_texture(context, mFrame, gbuffer) == ERR_OK) {
+            // sw frame, only the yuv planes are uploaded and the GPU does the conversion
+            on_texture = true;
+        }
+
+        if (on_texture) {
             av_frame_free(&mFrame);
             pred_phy_dev = mem_predict_prefetch(gbuffer, EXPRESS_CODEC_DEVICE_ID, EXPRESS_MEM_TYPE_TEXTURE, &block_time);
             if (pred_phy_dev == EXPRESS_MEM_TYPE_UNKNOWN) pred_phy_dev = EXPRESS_MEM_TYPE_TEXTURE; // default to texture
-            mem_transfer_async(pred_phy_dev, EXPRESS_MEM_TYPE_TEXTURE, gbuffer, gbuffer, outputSize, outputSize, desc->sync_id, NULL, NULL, context);
+            if (pred_phy_dev == EXPRESS_MEM_TYPE_TEXTURE) {
+                // the frame is already where it is needed, and mem_transfer_async
+                // would skip the transfer without calling transfer_task_done_cb
+                signal_express_sync(desc->sync_id, true);
+            }
+            else {
+                g_mutex_lock(&context->mOutputLock);
+                context->mScaleTasks++;
+                g_mutex_unlock(&context->mOutputLock);
+                mem_transfer_async(pred_phy_dev, EXPRESS_MEM_TYPE_TEXTURE, gbuffer, gbuffer, outputSize, outputSize, desc->sync_id, NULL, transfer_task_done_cb, context);
+            }
         } else {
             // host mem, need to use swscale by CPU
             pred_phy_dev = mem_predict_prefetch(gbuffer, EXPRESS_CODEC_DEVICE_ID, EXPRESS_MEM_TYPE_GBUFFER_HOST_MEM, &block_time);
             if (pred_phy_dev == EXPRESS_MEM_TYPE_UNKNOWN) pred_phy_dev = EXPRESS_MEM_TYPE_TEXTURE; // default to texture
-            mem_transfer_async(pred_phy_dev, EXPRESS_MEM_TYPE_HOST_OPAQUE, gbuffer, mFrame, outputSize, outputSize, desc->sync_id, swscale_task_cb, NULL, context);
+            scale_frame_async(context, pred_phy_dev, gbuffer, mFrame, outputSize, outputSize, desc->sync_id);
             // mFrame is freed by swscale_task_cb
             // av_frame_free(&mFrame);
         }
@@ -11,6 +11,7 @@
 
 #include "hw/teleport-express/express_log.h"
 #include "hw/express-codec/dcodec_video.h"
+#include "hw/express-codec/dcodec_convert.h"
 #include "hw/express-gpu/egl_surface.h"
 #include "hw/express-gpu/glv3_context.h"
 #include "hw/express-gpu/glv3_status.h"
@@ -21,6 +22,13 @@
 
 #define MAX_SW_VIDEO_DIMENSION 1280
 
+// how long a full readback ring waits for the gpu before the input is retried
+#define READBACK_WAIT_NS (100 * 1000 * 1000)
+
+// gbuffer inputs are converted to nv12 on the gpu when the encoder takes yuv,
+// which halves the bytes read back compared to rgba
+bool express_codec_encode_gpu_yuv = true;
+
 static const struct VideoCodingMapEntry {
     OMX_VIDEO_CODINGTYPE mCodingType;
     enum AVCodecID mCodecID;
@@ -31,15 +39,13 @@ static const struct VideoCodingMapEntry {
 
 static const size_t sCodingMapLen = (sizeof(sCodingMap) / sizeof(sCodingMap[0]));
 
-// async tasks should use their own private sws contexts
-extern __thread struct SwsContext * g_sws_ctx;
-extern __thread uint8_t *g_videobuf;
-
 static int setup_encoder(DCodecVideo *context);
 static int open_encoder(DCodecComponent *_context);
 static int empty_one_input_buffer(DCodecComponent *_context);
 static int encode_video(DCodecVideo *context, BufferDesc *desc);
 static int fill_one_output_buffer(DCodecComponent *_context);
+static OMX_ERRORTYPE reset_encoder(DCodecComponent *_context);
+static void release_thread_resources(DCodecComponent *_context);
 
 static void free_avframe(gpointer frame) {
     if (frame != NULL) {
@@ -67,7 +73,7 @@ DCodecComponent* dcodec_venc_init_component(enum OMX_VIDEO_CODINGTYPE codingType
         return NULL;
     }
 
-    context->base.reset_component = dcodec_vdec_reset_component;
+    context->base.reset_component = reset_encoder;
     context->base.destroy_component = dcodec_vdec_destroy_component;
     context->base.get_parameter = dcodec_venc_get_parameter;
     context->base.set_parameter = dcodec_venc_set_parameter;
@@ -75,6 +81,9 @@ DCodecComponent* dcodec_venc_init_component(enum OMX_VIDEO_CODINGTYPE codingType
     context->base.empty_one_input_buffer = empty_one_input_buffer;
     context->base.fill_one_output_buffer = fill_one_output_buffer;
     context->base.fill_eos_output_buffer = dcodec_fill_eos_output_buffer;
+    context->base.release_thread_resources = release_thread_resources;
+
+    dcodec_video_init_scalers(context);
 
     context->mIsDecoder = false;
     context->mIsAdaptive = false;
@@ -466,6 +475,289 @@ static int open_encoder(DCodecComponent *_context) {
     return ERR_OK;
 }
 
+static OMX_ERRORTYPE reset_encoder(DCodecComponent *_context) {
+    DCodecVideo *context = (DCodecVideo *)_context;
+
+    // the gl context belongs to the worker, so readbacks queued before the
+    // reset are only dropped once they have finished
+    context->mReadbackDropped = context->mReadbackCount;
+    context->mReadbackEosPending = false;
+
+    return dcodec_vdec_reset_component(_context);
+}
+
+static void release_thread_resources(DCodecComponent *_context) {
+    DCodecVideo *context = (DCodecVideo *)_context;
+
+    for (int i = 0; i < DCODEC_READBACK_NUM; i++) {
+        DCodecReadback *rb = &context->mReadbacks[i];
+        if (rb->fence) {
+            glDeleteSync(rb->fence);
+            rb->fence = 0;
+            // the frame is never going to be encoded, but the guest still waits for its gbuffer
+            signal_express_sync(rb->sync_id, true);
+        }
+        if (rb->pbo) {
+            glDeleteBuffers(1, &rb->pbo);
+            rb->pbo = 0;
+            rb->pbo_size = 0;
+        }
+        av_frame_free(&rb->frame);
+    }
+    context->mReadbackCount = 0;
+    context->mReadbackDropped = 0;
+
+    if (context->mReadbackFbo) {
+        glDeleteFramebuffers(1, &context->mReadbackFbo);
+        context->mReadbackFbo = 0;
+    }
+    if (context->mRgbConv) {
+        cs_deinit(context->mRgbConv);
+        context->mRgbConv = NULL;
+    }
+
+    dcodec_video_release_thread_resources(_context);
+}
+
+/**
+ * @brief starts reading the gbuffer back into the next pixel-pack buffer of the ring.
+ * The gbuffer is converted to nv12 on the gpu first when the encoder takes yuv input.
+*/
+static void queue_readback(DCodecVideo *context, Hardware_Buffer *gbuffer, BufferDesc *desc) {
+    AVCodecContext *mCtx = context->base.mCtx;
+    int idx = (context->mReadbackHead + context->mReadbackCount) % DCODEC_READBACK_NUM;
+    DCodecReadback *rb = &context->mReadbacks[idx];
+    int width = gbuffer->width;
+    int height = gbuffer->height;
+
+    bool gpu_yuv = express_codec_encode_gpu_yuv && !context->mRgbConvFailed &&
+                   (mCtx->pix_fmt == AV_PIX_FMT_YUV420P || mCtx->pix_fmt == AV_PIX_FMT_NV12) &&
+                   !(width & 1) && !(height & 1);
+    if (gpu_yuv && (context->mRgbConv == NULL || context->mRgbConv->mWidth != width ||
+                    context->mRgbConv->mHeight != height)) {
+        if (context->mRgbConv) {
+            cs_deinit(context->mRgbConv);
+        }
+        context->mRgbConv = cs_init_from_rgb(AV_PIX_FMT_NV12, width, height);
+        if (context->mRgbConv == NULL) {
+            LOGW("gpu rgb -> nv12 conversion unavailable, reading back rgba");
+            context->mRgbConvFailed = true;
+            gpu_yuv = false;
+        }
+    }
+
+    rb->format = gpu_yuv ? AV_PIX_FMT_NV12 : AV_PIX_FMT_RGBA;
+    rb->width = width;
+    rb->height = height;
+    rb->pts = desc->nTimeStamp;
+    rb->sync_id = desc->sync_id;
+
+    size_t size = av_image_get_buffer_size(rb->format, width, height, 1);
+    if (!rb->pbo) {
+        glGenBuffers(1, &rb->pbo);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+    if (rb->pbo_size < size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        rb->pbo_size = size;
+    }
+
+    if (gpu_yuv) {
+        cs_convert_from_rgb(context->mRgbConv, gbuffer->data_texture);
+        cs_read_planes(context->mRgbConv);
+    }
+    else {
+        if (!context->mReadbackFbo) {
+            glGenFramebuffers(1, &context->mReadbackFbo);
+        }
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, context->mReadbackFbo);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gbuffer->data_texture, 0);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // submit now, so that the gpu works on the readback while the encoder is busy
+    glFlush();
+
+    context->mReadbackCount++;
+}
+
+/**
+ * @brief copies a finished readback into the frame of its slot, in the input format of the encoder.
+*/
+static int copy_readback_to_frame(DCodecVideo *context, DCodecReadback *rb) {
+    AVCodecContext *mCtx = context->base.mCtx;
+    int ret = ERR_OK;
+
+    if (rb->frame == NULL) {
+        rb->frame = av_frame_alloc();
+    }
+    AVFrame *frame = rb->frame;
+    // the encoder may still reference the buffer of the previous frame in this slot
+    if (!av_frame_is_writable(frame) || frame->width != mCtx->width || frame->height != mCtx->height) {
+        av_frame_unref(frame);
+        frame->width = mCtx->width;
+        frame->height = mCtx->height;
+        frame->format = mCtx->pix_fmt;
+        if (av_frame_get_buffer(frame, 0) < 0) {
+            return ERR_OOM;
+        }
+    }
+
+    size_t size = av_image_get_buffer_size(rb->format, rb->width, rb->height, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+    uint8_t *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (pixels == NULL) {
+        LOGE("failed to map readback buffer, gl error %x", glGetError());
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return ERR_CODING_FAILED;
+    }
+
+    uint8_t *data[4] = { 0 };
+    int linesize[4] = { 0 };
+    av_image_fill_arrays(data, linesize, pixels, rb->format, rb->width, rb->height, 1);
+
+    if (rb->width != frame->width || rb->height != frame->height ||
+        !dcodec_convert_frame((const uint8_t * const*)data, linesize, rb->format,
+                              frame->data, frame->linesize, frame->format,
+                              frame->width, frame->height)) {
+        DCodecScaler *scaler = dcodec_video_acquire_scaler(context);
+        scaler->sws_ctx = sws_getCachedContext(scaler->sws_ctx,
+            rb->width, rb->height, rb->format, frame->width, frame->height,
+            frame->format, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+        if (scaler->sws_ctx == NULL) {
+            ret = ERR_SWS_FAILED;
+        }
+        else {
+            sws_scale(scaler->sws_ctx, (const uint8_t * const*)data, linesize, 0, rb->height, frame->data, frame->linesize);
+        }
+        dcodec_video_release_scaler(scaler);
+    }
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    frame->pts = rb->pts;
+    return ret;
+}
+
+static void retire_readback(DCodecVideo *context) {
+    context->mReadbackHead = (context->mReadbackHead + 1) % DCODEC_READBACK_NUM;
+    context->mReadbackCount--;
+}
+
+/**
+ * @brief sends the oldest readback to the encoder once the gpu has finished it.
+ * @return ERR_NO_FRM if there is no readback or it has not finished yet,
+ * ERR_INPUT_QUEUE_FULL if the encoder cannot take the frame right now.
+*/
+static int collect_readback(DCodecVideo *context, bool wait) {
+    AVCodecContext *mCtx = context->base.mCtx;
+    DCodecReadback *rb = &context->mReadbacks[context->mReadbackHead];
+    int ret = ERR_OK;
+
+    if (context->mReadbackCount == 0) {
+        return ERR_NO_FRM;
+    }
+
+    if (rb->fence) {
+        GLenum status = glClientWaitSync(rb->fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                         wait ? READBACK_WAIT_NS : 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            return ERR_NO_FRM;
+        }
+        glDeleteSync(rb->fence);
+        rb->fence = 0;
+        // the pixels are out of the gbuffer, the guest may render into it again
+        signal_express_sync(rb->sync_id, true);
+
+        if (status == GL_WAIT_FAILED) {
+            LOGE("waiting for readback failed, gl error %x", glGetError());
+            ret = ERR_CODING_FAILED;
+        }
+        else if (context->mReadbackDropped == 0) {
+            ret = copy_readback_to_frame(context, rb);
+        }
+        if (ret != ERR_OK) {
+            retire_readback(context);
+            return ret;
+        }
+    }
+
+    if (context->mReadbackDropped > 0) {
+        context->mReadbackDropped--;
+        retire_readback(context);
+        return ERR_OK;
+    }
+
+    LOGD("avcodec_send_frame readback pts %lld", rb->frame->pts);
+
+    ret = avcodec_send_frame(mCtx, rb->frame);
+    if (ret == AVERROR(EAGAIN)) {
+        // the pixels stay in the frame of this slot until the encoder has room
+        return ERR_INPUT_QUEUE_FULL;
+    }
+    retire_readback(context);
+    if (ret != 0 && ret != AVERROR_EOF && ret != AVERROR_INVALIDDATA) {
+        LOGE("avcodec_send_frame error %d", ret);
+        return ERR_CODING_FAILED;
+    }
+    return ERR_OK;
+}
+
+/**
+ * @brief sends all readbacks the gpu has already finished to the encoder, without blocking.
+*/
+static int collect_finished_readbacks(DCodecVideo *context) {
+    int ret;
+    while ((ret = collect_readback(context, false)) == ERR_OK);
+    return ret < 0 ? ret : ERR_OK;
+}
+
+/**
+ * @brief sends every pending readback to the encoder, waiting for the gpu if needed.
+*/
+static int drain_readbacks(DCodecVideo *context) {
+    while (context->mReadbackCount > 0) {
+        int ret = collect_readback(context, true);
+        if (ret < 0) {
+            return ret;
+        }
+        else if (ret != ERR_OK) {
+            return ERR_INPUT_QUEUE_FULL;
+        }
+    }
+    return ERR_OK;
+}
+
+/**
+ * @brief encodes a gbuffer without waiting for the gpu.
+ * Frame N is handed to the encoder while the guest already renders frame N + 1,
+ * the ring only blocks once DCODEC_READBACK_NUM frames are in flight.
+*/
+static int encode_gbuffer_async(DCodecVideo *context, Hardware_Buffer *gbuffer, BufferDesc *desc) {
+    int ret = collect_finished_readbacks(context);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (context->mReadbackCount == DCODEC_READBACK_NUM) {
+        ret = collect_readback(context, true);
+        if (ret < 0) {
+            return ret;
+        }
+        else if (ret != ERR_OK) {
+            // the gpu or the encoder is behind, retry with the same buffer later
+            return ERR_INPUT_QUEUE_FULL;
+        }
+    }
+
+    queue_readback(context, gbuffer, desc);
+    return ERR_OK;
+}
+
 /**
  * @brief decode a video frame using the first buffer in the input queue.
 */
@@ -481,15 +773,19 @@ static int empty_one_input_buffer(DCodecComponent *_context) {
         dcodec_return_buffer(_context, g_queue_pop_head(_context->input_buffers));
         return ERR_OK;
     }
-    ret = encode_video(context, desc);
 
-    // a negative error code is returned if an error occurred during decoding
-    if (ret < 0) {
-        dcodec_return_buffer(_context, g_queue_pop_head(_context->input_buffers));
-        return ret;
-    }
-    else if (ret == ERR_INPUT_QUEUE_FULL) {
-        return ret;
+    // the eos buffer itself has already been read back if its flush was postponed
+    if (!context->mReadbackEosPending) {
+        ret = encode_video(context, desc);
+
+        // a negative error code is returned if an error occurred during decoding
+        if (ret < 0) {
+            dcodec_return_buffer(_context, g_queue_pop_head(_context->input_buffers));
+            return ret;
+        }
+        else if (ret == ERR_INPUT_QUEUE_FULL) {
+            return ret;
+        }
     }
 
     LOGD("empty_one_input_buffer() on buffer type %x id %" PRIx64 " nAllocLen %u "
@@ -500,6 +796,17 @@ static int empty_one_input_buffer(DCodecComponent *_context) {
     if (desc->nFlags & OMX_BUFFERFLAG_EOS) {
         LOGD("input eos seen, flushing buffers");
 
+        // frames still being read back have to reach the encoder before it is flushed
+        ret = drain_readbacks(context);
+        context->mReadbackEosPending = (ret == ERR_INPUT_QUEUE_FULL);
+        if (ret == ERR_INPUT_QUEUE_FULL) {
+            return ret;
+        }
+        else if (ret < 0) {
+            dcodec_return_buffer(_context, g_queue_pop_head(_context->input_buffers));
+            return ret;
+        }
+
         if (mCtx->codec->capabilities & AV_CODEC_CAP_DELAY) {
             LOGD("codec capability AV_CODEC_CAP_DELAY detected, sending EOS packet.");
             ret = encode_video(context, NULL);
@@ -518,6 +825,11 @@ static int encode_video(DCodecVideo *context, BufferDesc *desc) {
     int ret = ERR_OK;
 
     if (desc == NULL) {
+        // frames still being read back would be lost after the flush
+        ret = drain_readbacks(context);
+        if (ret != ERR_OK) {
+            return ret;
+        }
         mFrame->data[0] = NULL;
         mFrame->linesize[0] = 0;
         mFrame->pts = AV_NOPTS_VALUE;
@@ -532,17 +844,16 @@ static int encode_video(DCodecVideo *context, BufferDesc *desc) {
             return ERR_CODING_FAILED;
         }
         update_gbuffer_phy_usage(gbuffer, EXPRESS_MEM_TYPE_TEXTURE, false);
+        if (mCtx->pix_fmt != AV_PIX_FMT_CUDA) {
+            // the frame is sent to the encoder once its readback has finished
+            return encode_gbuffer_async(context, gbuffer, desc);
+        }
         mFrame = (AVFrame *)g_hash_table_lookup(context->mInputMap, (gpointer)desc->id);
         if (!mFrame) {
             mFrame = av_frame_alloc();
             mFrame->width = gbuffer->width;
             mFrame->height = gbuffer->height;
-            if (mCtx->pix_fmt == AV_PIX_FMT_CUDA) {
-                mFrame->format = mCtx->pix_fmt;
-            }
-            else {
-                mFrame->format = pixel_format_omx_to_av(context->mImageFormat);
-            }
+            mFrame->format = mCtx->pix_fmt;
             av_hwframe_get_buffer(mCtx->hw_frames_ctx, mFrame, 0);
             g_hash_table_insert(context->mInputMap, (gpointer)desc->id, (gpointer)mFrame);
         }
@@ -550,12 +861,7 @@ static int encode_video(DCodecVideo *context, BufferDesc *desc) {
             LOGE("error! av_buffer id %" PRIx64 " is not writable!", desc->id);
         }
 
-        if (mCtx->pix_fmt == AV_PIX_FMT_CUDA) {
-            copy_tex_to_cuda((CUdeviceptr)mFrame->data[0], gbuffer->data_texture, mFrame->linesize);
-        }
-        else {
-            glReadPixels(0, 0, gbuffer->width, gbuffer->height, gbuffer->format, gbuffer->pixel_type, mFrame->data[0]);
-        }
+        copy_tex_to_cuda((CUdeviceptr)mFrame->data[0], gbuffer->data_texture, mFrame->linesize);
         signal_express_sync(desc->sync_id, true);
         mFrame->pts = desc->nTimeStamp;
     }
@@ -569,26 +875,44 @@ static int encode_video(DCodecVideo *context, BufferDesc *desc) {
             av_frame_get_buffer(mFrame, 0);
             g_hash_table_insert(context->mInputMap, (gpointer)desc->id, (gpointer)mFrame);
         }
-        if (!av_buffer_is_writable(mFrame->buf[0])) {
+        // the encoder may still hold the frame last sent from this buffer
+        if (av_frame_make_writable(mFrame) < 0) {
             LOGE("error! av_buffer id %" PRIx64 " is not writable!", desc->id);
+            return ERR_OOM;
         }
 
         uint8_t *data[4] = { 0 };
         int linesize[4] = { 0 };
 
-        g_sws_ctx = sws_getCachedContext(g_sws_ctx,
-            mFrame->width, mFrame->height, pixel_format_omx_to_av(context->mImageFormat), context->mWidth, context->mHeight,
-            mFrame->format, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+        DCodecScaler *scaler = dcodec_video_acquire_scaler(context);
+        enum AVPixelFormat avSrcFmt = pixel_format_omx_to_av(context->mImageFormat);
 
-        g_videobuf = av_realloc(g_videobuf, desc->nFilledLen);
-        read_from_guest_mem((Guest_Mem *)desc->data, g_videobuf, 0, desc->nFilledLen);
-        data[0] = g_videobuf;
+        data[0] = dcodec_scaler_get_buffer(scaler, desc->nFilledLen);
+        if (data[0] == NULL) {
+            dcodec_video_release_scaler(scaler);
+            return ERR_SWS_FAILED;
+        }
+        read_from_guest_mem((Guest_Mem *)desc->data, data[0], 0, desc->nFilledLen);
 
         if (pixel_format_to_swscale_param(context->mImageFormat, context->mWidth, context->mHeight, data, linesize) < 0) {
+            dcodec_video_release_scaler(scaler);
             return ERR_SWS_FAILED;
         }
 
-        sws_scale(g_sws_ctx, (const uint8_t * const*)data, linesize, 0, mFrame->height, mFrame->data, mFrame->linesize);
+        // the guest image always has the size of the encoder input
+        if (!dcodec_convert_frame((const uint8_t * const*)data, linesize, avSrcFmt,
+                                  mFrame->data, mFrame->linesize, mFrame->format,
+                                  mFrame->width, mFrame->height)) {
+            scaler->sws_ctx = sws_getCachedContext(scaler->sws_ctx,
+                mFrame->width, mFrame->height, avSrcFmt, context->mWidth, context->mHeight,
+                mFrame->format, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+            if (scaler->sws_ctx == NULL) {
+                dcodec_video_release_scaler(scaler);
+                return ERR_SWS_FAILED;
+            }
+            sws_scale(scaler->sws_ctx, (const uint8_t * const*)data, linesize, 0, mFrame->height, mFrame->data, mFrame->linesize);
+        }
+        dcodec_video_release_scaler(scaler);
 
         mFrame->pts = desc->nTimeStamp;
     }
@@ -663,10 +987,19 @@ static int parse_pps_sps(DCodecComponent *_context, uint8_t *data, int size) {
 }
 
 static int fill_one_output_buffer(DCodecComponent *_context) {
+    DCodecVideo *context = (DCodecVideo *)_context;
     AVCodecContext *mCtx = _context->mCtx;
     AVPacket *mPkt = _context->mPkt;
     static __thread bool _has_sent_config;
 
+    // readbacks finish without any buffer arriving, the worker polls for them
+    if (collect_finished_readbacks(context) < 0) {
+        return ERR_CODING_FAILED;
+    }
+    if (context->mReadbackCount > 0) {
+        _context->need_poll = true;
+    }
+
     // read one packet at a time
     int ret = avcodec_receive_packet(mCtx, mPkt);
     if (ret == AVERROR_EOF && _context->mStatus == INPUT_EOS_SEEN) {
@@ -685,7 +1018,8 @@ static int fill_one_output_buffer(DCodecComponent *_context) {
         return ERR_CODING_FAILED;
     }
 
-    if (_has_sent_config == false) {
+    // sps/pps are only split off h264/hevc streams, other packets may contain the preamble by chance
+    if (_has_sent_config == false && (mCtx->codec_id == AV_CODEC_ID_H264 || mCtx->codec_id == AV_CODEC_ID_HEVC)) {
         CHECK_GE(g_queue_get_length(_context->output_buffers), 2);
         if (parse_pps_sps(_context, mPkt->data, mPkt->size) == ERR_OK) {
             _has_sent_config = true;
@@ -93,11 +93,19 @@ static void dcodec_master_switch(struct Thread_Context *_context,
             LOGE("error! unrecognized codec type %d", isVideo);
         }
 
+        // decoding runs on the component's own worker, so this thread only queues
+        // buffers and never waits for the decoder
+        if (((Codec_Thread_Context *)_context)->component) {
+            dcodec_component_start_worker(((Codec_Thread_Context *)_context)->component);
+        }
+
     } break;
 
     case DCODEC_FUN_ResetComponent: {
 
+        g_mutex_lock(&component->lock);
         error = component->reset_component(component);
+        g_mutex_unlock(&component->lock);
 
     } break;
 
@@ -130,7 +138,9 @@ static void dcodec_master_switch(struct Thread_Context *_context,
         if (need_free)
             g_free(_ptr);
 
+        g_mutex_lock(&component->lock);
         error = dcodec_send_command(component, cmd, param, data);
+        g_mutex_unlock(&component->lock);
     } break;
 
     case DCODEC_FUN_GetParameter: {
@@ -153,7 +163,9 @@ static void dcodec_master_switch(struct Thread_Context *_context,
 
         read_from_guest_mem(all_para[1].data, params, 0, all_para[1].data_len);
 
+        g_mutex_lock(&component->lock);
         error = component->get_parameter(component, index, params);
+        g_mutex_unlock(&component->lock);
 
         if (error == OMX_ErrorNone) {
             write_to_guest_mem(all_para[1].data, params, 0, param_size);
@@ -176,7 +188,9 @@ static void dcodec_master_switch(struct Thread_Context *_context,
         params = _ptr + _idx;
         CHECK_EQ(_idx + get_omx_param_size(index), all_para[0].data_len);
 
+        g_mutex_lock(&component->lock);
         error = component->set_parameter(component, index, params);
+        g_mutex_unlock(&component->lock);
 
         if (need_free)
             g_free(_ptr);
@@ -190,7 +204,9 @@ static void dcodec_master_switch(struct Thread_Context *_context,
             desc->data = copy_guest_mem_from_call(call, 2);
         }
 
+        g_mutex_lock(&component->lock);
         error = dcodec_process_this_buffer(component, desc);
+        g_mutex_unlock(&component->lock);
 
     } break;
 
@@ -288,13 +304,15 @@ static bool remove_codec_context(uint64_t device_id, uint64_t thread_id, uint64_
 {
     Codec_Thread_Context *thread_context = g_hash_table_lookup(g_codec_thread_contexts, GUINT_TO_POINTER(unique_id));
 
-    if (thread_context && thread_context->component && thread_context->component->dma_buf) {
-        free_copied_guest_mem(thread_context->component->dma_buf);
-    }
-
+    // the worker and in-flight mem transfers may still notify through dma_buf,
+    // so it can only be freed after the component is gone
     if (thread_context && thread_context->component) {
+        Guest_Mem *dma_buf = thread_context->component->dma_buf;
         thread_context->component->destroy_component(thread_context->component);
         thread_context->component = NULL;
+        if (dma_buf) {
+            free_copied_guest_mem(dma_buf);
+        }
     }
 
     LOGD("codec uid %" PRId64 " remove context", unique_id);
@@ -44,9 +44,15 @@ void d_eglCreateContext(void *context, EGLDisplay dpy, EGLConfig config, EGLCont
     }
 
     int context_flags = 0;
+    // 没有指定EGL_CONTEXT_CLIENT_VERSION时默认是GLES1
+    int client_version = 1;
 
     for (int i = 0; attrib_list[i] != EGL_NONE; i += 2)
     {
+        if (attrib_list[i] == EGL_CONTEXT_CLIENT_VERSION)
+        {
+            client_version = attrib_list[i + 1];
+        }
         if (attrib_list[i] == DGL_CONTEXT_INDEPENDENT_MODE && attrib_list[i + 1] == EGL_TRUE)
         {
             context_flags |= DGL_CONTEXT_FLAG_INDEPENDENT_MODE_BIT;
@@ -73,6 +79,11 @@ void d_eglCreateContext(void *context, EGLDisplay dpy, EGLConfig config, EGLCont
         context_flags |= DGL_CONTEXT_FLAG_INDEPENDENT_MODE_BIT;
     }
 
+    if (client_version == 1)
+    {
+        context_flags |= DGL_CONTEXT_FLAG_GLES1_BIT;
+    }
+
     Opengl_Context *opengl_context = opengl_context_create(real_share_context, context_flags);
     for (int i = 0; attrib_list[i] != EGL_NONE; i += 2)
     {
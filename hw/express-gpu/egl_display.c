@@ -4,7 +4,7 @@
 
 Egl_Display *default_egl_display;
 
-#ifdef __WIN32
+#if defined(__WIN32) || defined(__linux__)
 /**
  * @brief 初始化Egl_Display
  *
@@ -5,6 +5,7 @@
 #include "hw/express-gpu/egl_context.h"
 #include "hw/express-gpu/glv3_context.h"
 #include "hw/express-gpu/express_gpu_render.h"
+#include "hw/express-gpu/express_gpu_timer.h"
 
 EGLBoolean d_eglMakeCurrent(void *context, EGLDisplay dpy, EGLSurface draw, EGLSurface read, EGLContext ctx, uint64_t gbuffer_id, int width, int height, int hal_format)
 {
@@ -292,6 +293,9 @@ EGLBoolean d_eglSwapBuffers_sync(void *context, EGLDisplay dpy, EGLSurface surfa
         LOGE("error! real_surface != thread_context->render_double_buffer_draw %llx %llx", (uint64_t)real_surface, (uint64_t)thread_context->render_double_buffer_draw);
     }
 
+    // 帧结束的timestamp要在交换之前发出，交换时的拷贝不算在这一帧里
+    gpu_timer_frame_end(real_opengl_context);
+
     egl_surface_swap_buffer(context, real_surface, gbuffer_id, width, height, hal_format);
 
     if (real_surface->sampler_num > 1)
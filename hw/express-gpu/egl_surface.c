@@ -16,10 +16,10 @@
 
 #include "hw/express-gpu/express_gpu_render.h"
 #include "hw/express-gpu/express_gpu.h"
+#include "hw/express-gpu/gbuffer_reaper.h"
 #include "hw/express-gpu/glv3_resource.h"
 #include "hw/teleport-express/express_event.h"
 
-Window_Buffer *render_surface_create(EGLConfig eglconfig, int width, int height, int surface_type);
 
 void egl_surface_swap_buffer(void *render_context, Window_Buffer *surface, uint64_t gbuffer_id, int width, int height, int hal_format)
 {
@@ -79,6 +79,7 @@ Window_Buffer *render_surface_create(EGLConfig eglconfig, int width, int height,
     surface->width = width;
     surface->height = height;
     surface->swap_interval = 1;
+    surface->guest_config = eglconfig;
 
     eglConfig *config = config_to_hints(eglconfig, &surface->window_hints);
     surface->config = config;
@@ -627,13 +628,41 @@ Hardware_Buffer *create_gbuffer(int width, int height, int sampler_num,
 
     glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, (GLint *)&pre_unpack_buffer);
 
-    glGenTextures(1, &(gbuffer->data_texture));
-    glGenRenderbuffers(1, &(gbuffer->rbo_depth));
-    glGenRenderbuffers(1, &(gbuffer->rbo_stencil));
+    static int max_sampler_num = -1;
+    if (max_sampler_num == -1)
+    {
+        glGetInternalformativ(GL_RENDERBUFFER, GL_RGB, GL_SAMPLES, 1, &max_sampler_num);
+    }
+
+    if (max_sampler_num < sampler_num)
+    {
+        express_printf("over large sampler num %d max %d\n", sampler_num, max_sampler_num);
+        sampler_num = max_sampler_num;
+    }
+
+    gbuffer->format = format;
+    gbuffer->pixel_type = pixel_type;
+    gbuffer->internal_format = internal_format;
+    // gbuffer->row_byte_len = row_byte_len;
+    gbuffer->depth_internal_format = depth_internal_format;
+    gbuffer->stencil_internal_format = stencil_internal_format;
 
-    if (sampler_num > 1)
+    gbuffer->width = width;
+    gbuffer->height = height;
+    gbuffer->sampler_num = sampler_num;
+
+    // 池子里有尺寸格式都一致的对象时直接复用，不用重新分配显存
+    bool from_pool = gbuffer_pool_take(gbuffer);
+    if (!from_pool)
     {
-        glGenRenderbuffers(1, &(gbuffer->sampler_rbo));
+        glGenTextures(1, &(gbuffer->data_texture));
+        glGenRenderbuffers(1, &(gbuffer->rbo_depth));
+        glGenRenderbuffers(1, &(gbuffer->rbo_stencil));
+
+        if (sampler_num > 1)
+        {
+            glGenRenderbuffers(1, &(gbuffer->sampler_rbo));
+        }
     }
 
     glBindTexture(GL_TEXTURE_2D, gbuffer->data_texture);
@@ -649,7 +678,10 @@ Hardware_Buffer *create_gbuffer(int width, int height, int sampler_num,
 
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, pixel_type, NULL);
+    if (!from_pool)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, pixel_type, NULL);
+    }
 
     if (express_gpu_gl_debug_enable)
     {
@@ -660,28 +692,17 @@ Hardware_Buffer *create_gbuffer(int width, int height, int sampler_num,
         }
     }
 
+    // 复用的纹理参数可能被之前的使用者改过，因此每次都设置
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    static int max_sampler_num = -1;
-    if (max_sampler_num == -1)
-    {
-        glGetInternalformativ(GL_RENDERBUFFER, GL_RGB, GL_SAMPLES, 1, &max_sampler_num);
-    }
-
-    if (max_sampler_num < sampler_num)
-    {
-        express_printf("over large sampler num %d max %d\n", sampler_num, max_sampler_num);
-        sampler_num = max_sampler_num;
-    }
-
-    if (sampler_num > 1)
+    if (sampler_num > 1 && !from_pool)
     {
         glBindRenderbuffer(GL_RENDERBUFFER, gbuffer->sampler_rbo);
         glRenderbufferStorageMultisample(GL_RENDERBUFFER, sampler_num, internal_format, width, height);
     }
 
-    if (depth_internal_format != 0)
+    if (depth_internal_format != 0 && !from_pool)
     {
         // 这个相当于给与一个深度缓冲区，让这个fbo可以有颜色缓冲区，有深度缓冲区，模板缓冲区
         glBindRenderbuffer(GL_RENDERBUFFER, gbuffer->rbo_depth);
@@ -696,7 +717,7 @@ Hardware_Buffer *create_gbuffer(int width, int height, int sampler_num,
     }
 
     // 之所以当深度24模板8时要合并，是因为这样效率更高
-    if (stencil_internal_format != 0 && depth_internal_format != GL_DEPTH24_STENCIL8)
+    if (stencil_internal_format != 0 && depth_internal_format != GL_DEPTH24_STENCIL8 && !from_pool)
     {
         glBindRenderbuffer(GL_RENDERBUFFER, gbuffer->rbo_stencil);
         if (sampler_num > 1)
@@ -724,17 +745,6 @@ Hardware_Buffer *create_gbuffer(int width, int height, int sampler_num,
 
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pre_unpack_buffer);
 
-    gbuffer->format = format;
-    gbuffer->pixel_type = pixel_type;
-    gbuffer->internal_format = internal_format;
-    // gbuffer->row_byte_len = row_byte_len;
-    gbuffer->depth_internal_format = depth_internal_format;
-    gbuffer->stencil_internal_format = stencil_internal_format;
-
-    gbuffer->width = width;
-    gbuffer->height = height;
-    gbuffer->sampler_num = sampler_num;
-
     gbuffer->pixel_size = pixel_size_calc(format, pixel_type);
     gbuffer->stride = width * gbuffer->pixel_size;
     gbuffer->size = width * height * gbuffer->pixel_size;
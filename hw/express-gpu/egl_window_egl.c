@@ -1,15 +1,31 @@
 #include "hw/express-gpu/egl_window.h"
 #include <glib.h>
 #include <dlfcn.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 PFN_eglMakeCurrent eglMakeCurrent;
 PFN_eglCreateContext eglCreateContext;
 PFN_eglCreatePbufferSurface eglCreatePbufferSurface;
 PFN_eglDestroySurface eglDestroySurface;
-PFN_eglDestroyContext eglDestroyContext; 
+PFN_eglDestroyContext eglDestroyContext;
 PFN_eglChooseConfig eglChooseConfig;
 
+PFN_eglGetProcAddress eglGetProcAddress;
+PFN_eglGetDisplay eglGetDisplay;
+PFN_eglGetPlatformDisplay eglGetPlatformDisplay;
+PFN_eglInitialize eglInitialize;
+PFN_eglTerminate eglTerminate;
+PFN_eglBindAPI eglBindAPI;
+PFN_eglQueryString eglQueryString;
+PFN_eglGetError eglGetError;
+PFN_eglCreateImage eglCreateImage;
+PFN_eglDestroyImage eglDestroyImage;
+PFN_eglExportDMABUFImageQueryMESA eglExportDMABUFImageQueryMESA;
+PFN_eglExportDMABUFImageMESA eglExportDMABUFImageMESA;
+
 
 static void *egl_dll_moudle = NULL;
 
@@ -18,7 +34,14 @@ static EGLContext main_window_context;
 
 static GHashTable *context_pbuffer_map;
 
-static EGLint static_config;
+static EGLConfig static_config;
+
+// the display supports contexts without any surface, no pbuffer is needed then
+static bool surfaceless_context;
+
+// the display and context created by egl_headless_create
+static EGLDisplay headless_display;
+static EGLSurface headless_pbuffer;
 
 
 static int static_context_attribs[]={
@@ -33,23 +56,37 @@ static int static_pbuffer_attribs[]={
     EGL_NONE
 };
 
+// the versions tried for the main context of the headless backend, newest first
+static const int headless_context_versions[][2] = {
+    {4, 6},
+    {4, 5},
+    {4, 3},
+    {4, 1},
+};
+
 EGLproc load_egl_fun(const char *name);
 
 EGLproc load_egl_fun(const char *name)
 {
     if (egl_dll_moudle == NULL)
     {
+#ifdef __APPLE__
         egl_dll_moudle = dlopen("libEGL.dylib", RTLD_LAZY | RTLD_LOCAL);
+#else
+        egl_dll_moudle = dlopen("libEGL.so.1", RTLD_LAZY | RTLD_LOCAL);
+#endif
         if (egl_dll_moudle == NULL)
         {
             printf("error! no opengl dll!\n");
+            return NULL;
         }
     }
 
     EGLproc ret = dlsym(egl_dll_moudle, name);
-    if(ret == NULL)
+    if (ret == NULL && eglGetProcAddress != NULL)
     {
-        printf("load egl fun %s failed!\n",name);
+        // extension functions are not always exported by the library
+        ret = eglGetProcAddress(name);
     }
     return ret;
 }
@@ -61,24 +98,69 @@ EGLproc load_egl_fun(const char *name)
     if (name == NULL)                                 \
         name = (PFN_##name)load_egl_fun(#name "EXT"); \
     if (name == NULL)                                 \
-        printf("cannot find %s", #name);
+        name = (PFN_##name)load_egl_fun(#name "KHR"); \
+    if (name == NULL)                                 \
+        printf("cannot find %s\n", #name);
 
-void egl_init(void *dpy, void *father_context)
+static void egl_load_functions(void)
 {
+    if (eglMakeCurrent != NULL)
+    {
+        return;
+    }
+
+    LOAD_EGL_FUN(eglGetProcAddress);
+    LOAD_EGL_FUN(eglGetDisplay);
+    LOAD_EGL_FUN(eglGetPlatformDisplay);
+    LOAD_EGL_FUN(eglInitialize);
+    LOAD_EGL_FUN(eglTerminate);
+    LOAD_EGL_FUN(eglBindAPI);
+    LOAD_EGL_FUN(eglQueryString);
+    LOAD_EGL_FUN(eglGetError);
+    LOAD_EGL_FUN(eglCreateImage);
+    LOAD_EGL_FUN(eglDestroyImage);
+    LOAD_EGL_FUN(eglExportDMABUFImageQueryMESA);
+    LOAD_EGL_FUN(eglExportDMABUFImageMESA);
+
     LOAD_EGL_FUN(eglMakeCurrent);
     LOAD_EGL_FUN(eglCreateContext);
     LOAD_EGL_FUN(eglCreatePbufferSurface);
     LOAD_EGL_FUN(eglDestroySurface);
     LOAD_EGL_FUN(eglDestroyContext);
     LOAD_EGL_FUN(eglChooseConfig);
+}
+
+static bool egl_has_extension(EGLDisplay dpy, const char *name)
+{
+    const char *extensions = eglQueryString ? eglQueryString(dpy, EGL_EXTENSIONS) : NULL;
+    size_t len = strlen(name);
+
+    while (extensions != NULL && (extensions = strstr(extensions, name)) != NULL)
+    {
+        if (extensions[len] == ' ' || extensions[len] == '\0')
+        {
+            return true;
+        }
+        extensions += len;
+    }
+    return false;
+}
+
+void egl_init(void *dpy, void *father_context)
+{
+    egl_load_functions();
 
-    
     context_pbuffer_map = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, NULL);
 
     main_window_display = (EGLDisplay)dpy;
     main_window_context = (EGLContext)father_context;
 
-    EGLint attrib_list={
+    // the guest contexts are created on this thread and have to be desktop opengl like their parent
+    eglBindAPI(EGL_OPENGL_API);
+
+    EGLint attrib_list[]={
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
         EGL_RED_SIZE, 8,
         EGL_GREEN_SIZE, 8,
         EGL_BLUE_SIZE, 8,
@@ -89,40 +171,54 @@ void egl_init(void *dpy, void *father_context)
     };
 
     EGLint num_configs=0;
-    if(!eglChooseConfig(main_window_display, attrib_list,&static_config,1, &num_configs))
+    if(!eglChooseConfig(main_window_display, attrib_list,&static_config,1, &num_configs) || num_configs == 0)
     {
         printf("choose config error!!!");
     }
+
+    surfaceless_context = egl_has_extension(main_window_display, "EGL_KHR_surfaceless_context");
 }
 
 void *egl_createContext()
 {
     EGLContext context = eglCreateContext(main_window_display, static_config, main_window_context, static_context_attribs);
-    EGLSurface pbuffer = eglCreatePbufferSurface(main_window_display, static_config, static_pbuffer_attribs);
+    EGLSurface pbuffer = EGL_NO_SURFACE;
+
+    if (!surfaceless_context)
+    {
+        pbuffer = eglCreatePbufferSurface(main_window_display, static_config, static_pbuffer_attribs);
+    }
 
-    if (context != EGL_NO_CONTEXT && pbuffer != EGL_NO_SURFACE)
+    if (context != EGL_NO_CONTEXT && (surfaceless_context || pbuffer != EGL_NO_SURFACE))
     {
         g_hash_table_insert(context_pbuffer_map, (gpointer)context, pbuffer);
     }
     else
     {
-        eglDestroyContext(main_window_display, context);
-        eglDestroySurface(main_window_display, pbuffer);
+        if (context != EGL_NO_CONTEXT)
+        {
+            eglDestroyContext(main_window_display, context);
+        }
+        if (pbuffer != EGL_NO_SURFACE)
+        {
+            eglDestroySurface(main_window_display, pbuffer);
+        }
+        context = EGL_NO_CONTEXT;
         printf("error! create context null!\n");
     }
     return context;
 }
 
-void egl_makeCurrent(void *context)
+int egl_makeCurrent(void *context)
 {
     if (context != NULL)
     {
         EGLSurface pbuffer = g_hash_table_lookup(context_pbuffer_map, (gpointer)context);
-        eglMakeCurrent(main_window_display, pbuffer, pbuffer, context);
+        return eglMakeCurrent(main_window_display, pbuffer, pbuffer, context);
     }
     else
     {
-        eglMakeCurrent(main_window_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        return eglMakeCurrent(main_window_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
     }
 }
 
@@ -131,11 +227,155 @@ void egl_destroyContext(void *context)
 
     if (context != NULL)
     {
-        EGLContext pbuffer = g_hash_table_lookup(context_pbuffer_map, (gpointer)context);
+        EGLSurface pbuffer = g_hash_table_lookup(context_pbuffer_map, (gpointer)context);
 
         eglDestroyContext(main_window_display, context);
-        eglDestroySurface(main_window_display, pbuffer);
+        if (pbuffer != EGL_NO_SURFACE)
+        {
+            eglDestroySurface(main_window_display, pbuffer);
+        }
 
         g_hash_table_remove(context_pbuffer_map, (gpointer)context);
     }
-}
\ No newline at end of file
+}
+
+#ifdef __linux__
+int egl_headless_create(void **dpy, void **context)
+{
+    EGLint major = 0, minor = 0;
+
+    egl_load_functions();
+    if (eglInitialize == NULL || eglCreateContext == NULL)
+    {
+        printf("error! no usable libEGL for the headless backend\n");
+        return -1;
+    }
+
+    // the surfaceless platform needs neither a gpu nor a display server
+    headless_display = EGL_NO_DISPLAY;
+    if (eglGetPlatformDisplay != NULL && egl_has_extension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless"))
+    {
+        headless_display = eglGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (headless_display == EGL_NO_DISPLAY)
+    {
+        headless_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    if (headless_display == EGL_NO_DISPLAY || !eglInitialize(headless_display, &major, &minor))
+    {
+        printf("error! cannot initialize headless egl display %x\n", eglGetError ? eglGetError() : 0);
+        return -1;
+    }
+    egl_init(headless_display, EGL_NO_CONTEXT);
+
+    EGLContext main_context = EGL_NO_CONTEXT;
+    for (int i = 0; i < G_N_ELEMENTS(headless_context_versions) && main_context == EGL_NO_CONTEXT; i++)
+    {
+        EGLint attribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, headless_context_versions[i][0],
+            EGL_CONTEXT_MINOR_VERSION, headless_context_versions[i][1],
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        main_context = eglCreateContext(headless_display, static_config, EGL_NO_CONTEXT, attribs);
+    }
+    if (main_context == EGL_NO_CONTEXT)
+    {
+        printf("error! cannot create headless opengl 4 context %x\n", eglGetError());
+        eglTerminate(headless_display);
+        return -1;
+    }
+
+    headless_pbuffer = EGL_NO_SURFACE;
+    if (!surfaceless_context)
+    {
+        headless_pbuffer = eglCreatePbufferSurface(headless_display, static_config, static_pbuffer_attribs);
+    }
+    if (!eglMakeCurrent(headless_display, headless_pbuffer, headless_pbuffer, main_context))
+    {
+        printf("error! cannot make headless context current %x\n", eglGetError());
+        eglDestroyContext(headless_display, main_context);
+        if (headless_pbuffer != EGL_NO_SURFACE)
+        {
+            eglDestroySurface(headless_display, headless_pbuffer);
+        }
+        eglTerminate(headless_display);
+        return -1;
+    }
+
+    // the contexts of the guest share their objects with the main context
+    main_window_context = main_context;
+
+    printf("headless egl %d.%d surfaceless context %d\n", major, minor, surfaceless_context);
+
+    *dpy = headless_display;
+    *context = main_context;
+    return 0;
+}
+
+void egl_headless_destroy(void)
+{
+    if (headless_display == EGL_NO_DISPLAY)
+    {
+        return;
+    }
+
+    eglMakeCurrent(headless_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(headless_display, main_window_context);
+    if (headless_pbuffer != EGL_NO_SURFACE)
+    {
+        eglDestroySurface(headless_display, headless_pbuffer);
+    }
+    eglTerminate(headless_display);
+
+    headless_display = EGL_NO_DISPLAY;
+    headless_pbuffer = EGL_NO_SURFACE;
+    main_window_context = EGL_NO_CONTEXT;
+}
+
+void *egl_get_proc_address(const char *name)
+{
+    return eglGetProcAddress ? (void *)eglGetProcAddress(name) : NULL;
+}
+
+int egl_export_texture_dmabuf(unsigned int texture, int *fd, int *stride, int *fourcc, uint64_t *modifier)
+{
+    int num_planes = 0;
+    EGLint offset = 0;
+    EGLuint64KHR image_modifier = 0;
+
+    if (eglCreateImage == NULL || eglExportDMABUFImageQueryMESA == NULL || eglExportDMABUFImageMESA == NULL ||
+        !egl_has_extension(main_window_display, "EGL_MESA_image_dma_buf_export"))
+    {
+        return -1;
+    }
+
+    EGLImageKHR image = eglCreateImage(main_window_display, main_window_context, EGL_GL_TEXTURE_2D_KHR,
+                                       (EGLClientBuffer)(uintptr_t)texture, NULL);
+    if (image == EGL_NO_IMAGE_KHR)
+    {
+        return -1;
+    }
+
+    int ret = -1;
+    *fd = -1;
+    // single plane rgba only, the consoles cannot import anything else
+    if (eglExportDMABUFImageQueryMESA(main_window_display, image, fourcc, &num_planes, &image_modifier) &&
+        num_planes == 1 &&
+        eglExportDMABUFImageMESA(main_window_display, image, fd, stride, &offset) &&
+        offset == 0)
+    {
+        *modifier = image_modifier;
+        ret = 0;
+    }
+    else if (*fd >= 0)
+    {
+        close(*fd);
+        *fd = -1;
+    }
+
+    // the dmabuf keeps the storage of the texture alive on its own
+    eglDestroyImage(main_window_display, image);
+    return ret;
+}
+#endif
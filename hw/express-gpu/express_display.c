@@ -20,10 +20,12 @@
 #include "hw/express-gpu/express_gpu_render.h"
 
 #include "hw/express-gpu/egl_surface.h"
+#include "hw/express-gpu/express_present.h"
 
 #include "hw/express-mem/express_sync.h"
 
 #include "qemu/atomic.h"
+#include "migration/qemu-file-types.h"
 
 static Thread_Context *static_display_context = NULL;
 
@@ -117,6 +119,7 @@ static void display_decode_invoke(Thread_Context *context, Teleport_Express_Call
         g_free(layers);
 
         display_present();
+        present_commit_frame();
 
         send_message_to_main_window(MAIN_PAINT, display_read_gbuffer);
     }
@@ -262,6 +265,25 @@ static void display_decode_invoke(Thread_Context *context, Teleport_Express_Call
         write_to_guest_mem(all_para[0].data, &now_display_status, 0, sizeof(Display_Status));
     }
     break;
+    case FUNID_Get_Present_Timing:
+    {
+        Present_Timing timing;
+
+        if (unlikely(para_num < PARA_NUM_Get_Present_Timing))
+        {
+            break;
+        }
+
+        temp_len = all_para[0].data_len;
+        if (unlikely(temp_len < sizeof(Present_Timing)))
+        {
+            break;
+        }
+
+        present_get_timing(&timing);
+        write_to_guest_mem(all_para[0].data, &timing, 0, sizeof(Present_Timing));
+    }
+    break;
     default:
     {
         LOGE("error! unknown display invoke id %llx para_num %d", call->id, para_num);
@@ -545,6 +567,29 @@ void display_status_change(Display_Status status)
     }
 }
 
+/**
+ * @brief 快照时保存显示状态，画面由guest在恢复后重新提交
+ */
+static int display_pre_save(QEMUFile *f, Express_Device_Info *info)
+{
+    qemu_put_be32(f, now_display_status.refresh_rate);
+    qemu_put_be32(f, now_display_status.power_status);
+    qemu_put_be32(f, now_display_status.backlight);
+    return 0;
+}
+
+static int display_post_load(QEMUFile *f, Express_Device_Info *info, int version_id)
+{
+    Display_Status status;
+
+    status.refresh_rate = qemu_get_be32(f);
+    status.power_status = qemu_get_be32(f);
+    status.backlight = qemu_get_be32(f);
+
+    display_status_change(status);
+    return 0;
+}
+
 static Express_Device_Info express_gpu_info = {
     .enable_default = true,
     .name = "express-display",
@@ -555,6 +600,9 @@ static Express_Device_Info express_gpu_info = {
     .context_init = display_context_init,
     .context_destroy = display_context_destroy,
     .get_context = get_display_thread_context,
+    .pre_save = display_pre_save,
+    .post_load = display_post_load,
+    .state_version = 1,
 };
 
 EXPRESS_DEVICE_INIT(express_display, &express_gpu_info)
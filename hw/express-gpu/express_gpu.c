@@ -13,6 +13,7 @@
 #include "hw/teleport-express/express_device_common.h"
 
 #include "hw/teleport-express/express_log.h"
+#include "hw/teleport-express/express_snapshot.h"
 
 #include "hw/express-gpu/glv3_context.h"
 #include "hw/express-gpu/express_gpu.h"
@@ -25,6 +26,8 @@
 #include "hw/express-gpu/device_interface_window.h"
 
 #include "hw/express-gpu/express_display.h"
+#include "hw/express-gpu/express_gpu_snapshot.h"
+#include "hw/express-gpu/express_gpu_timer.h"
 
 #include "qemu/atomic.h"
 
@@ -57,6 +60,13 @@ static void decode_invoke(Thread_Context *context, Teleport_Express_Call *call)
 
     express_printf("enter gpu decode invoke id %llu\n", fun_id);
 
+    // 从快照恢复后，线程的第一个调用之前先重建GL对象和当前绑定的context
+    if (unlikely(!render_context->snapshot_checked))
+    {
+        render_context->snapshot_checked = 1;
+        express_gpu_snapshot_restore_thread(render_context);
+    }
+
     if (fun_id >= 200000)
     {
         test_decode_invoke(render_context, call);
@@ -71,7 +81,9 @@ static void decode_invoke(Thread_Context *context, Teleport_Express_Call *call)
     }
     else
     {
+        int64_t start_ns = gpu_timer_call_begin(render_context->opengl_context);
         gl3_decode_invoke(render_context, call);
+        gpu_timer_call_end(render_context->opengl_context, call->id, start_ns);
     }
     if (express_gpu_gl_debug_enable && render_context->opengl_context != NULL && render_context->opengl_context->is_current)
     {
@@ -82,6 +94,13 @@ static void decode_invoke(Thread_Context *context, Teleport_Express_Call *call)
             error_code = glGetError();
         }
     }
+
+    // 快照保存前把已经发出的命令提交掉，主线程才能读到这个context写入的内容
+    if (unlikely(qatomic_read(&express_transport_paused)) && render_context->opengl_context != NULL &&
+        render_context->opengl_context->is_current)
+    {
+        glFlush();
+    }
     return;
 }
 
@@ -116,6 +135,7 @@ static Thread_Context *get_render_thread_context(uint64_t device_id, uint64_t th
 
             process->gbuffer_map = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, gbuffer_map_destroy);
             process->thread_cnt = 0;
+            process->snapshot_restore = express_gpu_snapshot_take_process(process_id);
 
             g_hash_table_insert(render_process_contexts, GUINT_TO_POINTER(process_id), (gpointer)process);
         }
@@ -156,6 +176,22 @@ static bool remove_render_thread_context(uint64_t type_id, uint64_t thread_id, u
     }
 }
 
+void express_gpu_foreach_process(GHFunc func, void *data)
+{
+    if (render_process_contexts != NULL)
+    {
+        g_hash_table_foreach(render_process_contexts, func, data);
+    }
+}
+
+void express_gpu_foreach_thread(GHFunc func, void *data)
+{
+    if (render_thread_contexts != NULL)
+    {
+        g_hash_table_foreach(render_thread_contexts, func, data);
+    }
+}
+
 static void render_context_init(Thread_Context *context)
 {
 
@@ -265,6 +301,7 @@ static void render_context_destroy(Thread_Context *context)
         // image删除，这里主要是为了释放gbuffer映射
         g_hash_table_destroy(process_context->gbuffer_map);
 
+        express_gpu_snapshot_drop_process(process_context->snapshot_restore);
         g_free(process_context);
     }
 }
@@ -281,6 +318,9 @@ static Express_Device_Info express_gpu_info = {
     .call_handle = decode_invoke,
     .get_context = get_render_thread_context,
     .remove_context = remove_render_thread_context,
+    .pre_save = express_gpu_pre_save,
+    .post_load = express_gpu_post_load,
+    .state_version = EXPRESS_GPU_STATE_VERSION,
 };
 
 EXPRESS_DEVICE_INIT(express_gpu, &express_gpu_info)
@@ -0,0 +1,684 @@
+/**
+ * @file express_gpu_capture.c
+ * @brief GL调用流的录制，以及不需要guest的离线回放
+ *
+ * 录制在各个处理线程中进行，写文件时加锁，因此文件中的顺序就是call开始处理的顺序。
+ * 回放时一次只有一个call在处理，计时包含分发到处理线程的时间。
+ */
+// #define STD_DEBUG_LOG
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "qemu/timer.h"
+#include "qemu/thread.h"
+#include "qemu/main-loop.h"
+#include "sysemu/runstate.h"
+#include "sysemu/sysemu.h"
+
+#include "hw/express-gpu/express_gpu_capture.h"
+#include "hw/express-gpu/express_gpu_render.h"
+#include "hw/express-gpu/egl_trans.h"
+#include "hw/express-mem/express_mem.h"
+
+#include "hw/teleport-express/express_log.h"
+#include "hw/teleport-express/express_handle_thread.h"
+#include "hw/teleport-express/teleport_express_call.h"
+
+// 回放时等待一个call处理完成的最长时间，超时后不再等待它，直接推送下一个
+#define REPLAY_CALL_TIMEOUT_US (2 * G_USEC_PER_SEC)
+
+// 单个参数的长度上限，超过时认为文件已经损坏
+#define REPLAY_MAX_PARA_LEN (1024 * 1024 * 1024)
+
+#define CAPTURE_FILE_BUF_SIZE (8 * 1024 * 1024)
+
+int express_gpu_capture_enable = 0;
+
+static GMutex capture_lock;
+static FILE *capture_file;
+static int64_t capture_start_time;
+static uint64_t capture_call_num;
+static Notifier capture_exit_notifier;
+
+typedef struct Replay_Call
+{
+    Teleport_Express_Call call;
+
+    // 第一个elem是flag buf，之后是各个参数
+    Teleport_Express_Queue_Elem *elems;
+    Guest_Mem *mems;
+    Scatter_Data *scatter_data;
+    Teleport_Express_Flag_Buf flag_buf;
+
+    // 处理线程可能在超时之后才完成，回放线程与callback各持有一个引用
+    int refs;
+    int done;
+
+    // 设备会把这个call的guest内存留着以后用，参数内容不能释放
+    int keep_paras;
+
+    int64_t push_time;
+} Replay_Call;
+
+typedef struct Replay_Fun_Stat
+{
+    uint64_t id;
+    uint64_t calls;
+    int64_t total_ns;
+    int64_t max_ns;
+} Replay_Fun_Stat;
+
+typedef struct Replay_State
+{
+    FILE *file;
+    char *path;
+    QemuThread thread;
+
+    GMutex lock;
+    GCond cond;
+
+    // 以下由lock保护
+    GHashTable *fun_stats;
+    GArray *frame_times;
+    int64_t last_frame_time;
+    uint64_t calls;
+    uint64_t timeouts;
+
+    uint64_t gbuffer_records;
+    int64_t capture_duration;
+} Replay_State;
+
+static Replay_State replay_state;
+
+static void capture_write(const void *data, size_t len)
+{
+    if (len != 0 && fwrite(data, 1, len, capture_file) != len)
+    {
+        LOGE("error! gl capture write failed, capture stopped");
+        qatomic_set(&express_gpu_capture_enable, 0);
+    }
+}
+
+static void capture_write_u8(uint8_t val)
+{
+    capture_write(&val, 1);
+}
+
+static void capture_write_u32(uint32_t val)
+{
+    uint8_t buf[4];
+    stl_le_p(buf, val);
+    capture_write(buf, 4);
+}
+
+static void capture_write_u64(uint64_t val)
+{
+    uint8_t buf[8];
+    stq_le_p(buf, val);
+    capture_write(buf, 8);
+}
+
+static void capture_write_guest_mem(Guest_Mem *mem)
+{
+    for (int i = 0; i < mem->num; i++)
+    {
+        capture_write(mem->scatter_data[i].data, mem->scatter_data[i].len);
+    }
+}
+
+/**
+ * @brief 处理线程的录制钩子，只录制express-gpu与express-mem的call
+ *
+ * @param call 即将被处理的call
+ */
+static void capture_call(Teleport_Express_Call *call)
+{
+    uint64_t device_id = GET_DEVICE_ID(call->id);
+    if (device_id != EXPRESS_GPU_DEVICE_ID && device_id != EXPRESS_MEM_DEVICE_ID)
+    {
+        return;
+    }
+
+    g_mutex_lock(&capture_lock);
+    if (capture_file == NULL || !qatomic_read(&express_gpu_capture_enable))
+    {
+        g_mutex_unlock(&capture_lock);
+        return;
+    }
+
+    capture_write_u8(CAPTURE_RECORD_CALL);
+    capture_write_u64(get_clock() - capture_start_time);
+    capture_write_u64(call->id);
+    capture_write_u64(call->thread_id);
+    capture_write_u64(call->process_id);
+    capture_write_u64(call->unique_id);
+    capture_write_u32(call->para_num);
+
+    Teleport_Express_Queue_Elem *elem = call->elem_header->next;
+    for (int i = 0; i < call->para_num && elem != NULL; i++, elem = elem->next)
+    {
+        Guest_Mem *mem = elem->para;
+        if (mem->num == 1 && mem->scatter_data[0].data == NULL)
+        {
+            capture_write_u8(CAPTURE_PARA_NULL);
+            capture_write_u32(0);
+        }
+        else if (elem->elem.in_num != 0)
+        {
+            //host写回guest的参数，内容在处理之后才有，只需要记下长度
+            capture_write_u8(CAPTURE_PARA_OUTPUT);
+            capture_write_u32(mem->all_len);
+        }
+        else
+        {
+            capture_write_u8(CAPTURE_PARA_DATA);
+            capture_write_u32(mem->all_len);
+            capture_write_guest_mem(mem);
+        }
+    }
+    capture_call_num++;
+
+    g_mutex_unlock(&capture_lock);
+}
+
+void express_gpu_capture_gbuffer(struct Hardware_Buffer *gbuffer)
+{
+    if (gbuffer->guest_data == NULL)
+    {
+        return;
+    }
+
+    g_mutex_lock(&capture_lock);
+    if (capture_file != NULL && qatomic_read(&express_gpu_capture_enable))
+    {
+        capture_write_u8(CAPTURE_RECORD_GBUFFER);
+        capture_write_u64(get_clock() - capture_start_time);
+        capture_write_u64(gbuffer->gbuffer_id);
+        capture_write_u32(gbuffer->guest_data->all_len);
+        capture_write_guest_mem(gbuffer->guest_data);
+    }
+    g_mutex_unlock(&capture_lock);
+}
+
+static void capture_stop(Notifier *notifier, void *data)
+{
+    g_mutex_lock(&capture_lock);
+    if (capture_file != NULL)
+    {
+        qatomic_set(&express_gpu_capture_enable, 0);
+        capture_write_u8(CAPTURE_RECORD_END);
+        capture_write_u64(get_clock() - capture_start_time);
+        fclose(capture_file);
+        capture_file = NULL;
+        LOGI("gl capture stopped, %" PRIu64 " calls", capture_call_num);
+    }
+    g_mutex_unlock(&capture_lock);
+}
+
+int express_gpu_capture_start(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        LOGE("error! cannot open gl capture file %s: %s", path, strerror(errno));
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, CAPTURE_FILE_BUF_SIZE);
+
+    g_mutex_lock(&capture_lock);
+    capture_file = file;
+    capture_start_time = get_clock();
+    capture_call_num = 0;
+
+    char magic[8] = {0};
+    memcpy(magic, EXPRESS_GPU_CAPTURE_MAGIC, strlen(EXPRESS_GPU_CAPTURE_MAGIC));
+    capture_write(magic, sizeof(magic));
+    capture_write_u32(EXPRESS_GPU_CAPTURE_VERSION);
+    capture_write_u32(0);
+    g_mutex_unlock(&capture_lock);
+
+    capture_exit_notifier.notify = capture_stop;
+    qemu_add_exit_notifier(&capture_exit_notifier);
+
+    qatomic_set(&express_gpu_capture_enable, 1);
+    express_call_capture_hook = capture_call;
+
+    LOGI("gl capture to %s", path);
+    return 0;
+}
+
+static bool replay_read(void *data, size_t len)
+{
+    return len == 0 || fread(data, 1, len, replay_state.file) == len;
+}
+
+static bool replay_read_u8(uint8_t *val)
+{
+    return replay_read(val, 1);
+}
+
+static bool replay_read_u32(uint32_t *val)
+{
+    uint8_t buf[4];
+    if (!replay_read(buf, 4))
+    {
+        return false;
+    }
+    *val = ldl_le_p(buf);
+    return true;
+}
+
+static bool replay_read_u64(uint64_t *val)
+{
+    uint8_t buf[8];
+    if (!replay_read(buf, 8))
+    {
+        return false;
+    }
+    *val = ldq_le_p(buf);
+    return true;
+}
+
+static void replay_call_unref(Replay_Call *replay)
+{
+    if (qatomic_fetch_dec(&replay->refs) != 1)
+    {
+        return;
+    }
+    if (!replay->keep_paras)
+    {
+        for (int i = 1; i <= replay->call.para_num; i++)
+        {
+            g_free(replay->scatter_data[i].data);
+        }
+    }
+    g_free(replay->elems);
+    g_free(replay->mems);
+    g_free(replay->scatter_data);
+    g_free(replay);
+}
+
+static bool replay_is_frame(uint64_t id)
+{
+    return id == FUNID_eglSwapBuffers || id == FUNID_eglSwapBuffers_sync;
+}
+
+/**
+ * @brief 回放的call处理完成后的回调，在处理线程中执行
+ */
+static void replay_callback(Teleport_Express_Call *call, int notify)
+{
+    Replay_Call *replay = container_of(call, Replay_Call, call);
+    int64_t now = get_clock();
+    int64_t spend = now - replay->push_time;
+    uint64_t key = call->id & ~(0xffull << 24);
+
+    g_mutex_lock(&replay_state.lock);
+
+    Replay_Fun_Stat *stat = g_hash_table_lookup(replay_state.fun_stats, &key);
+    if (stat == NULL)
+    {
+        stat = g_new0(Replay_Fun_Stat, 1);
+        stat->id = key;
+        g_hash_table_insert(replay_state.fun_stats, &stat->id, stat);
+    }
+    stat->calls++;
+    stat->total_ns += spend;
+    stat->max_ns = MAX(stat->max_ns, spend);
+    replay_state.calls++;
+
+    if (replay_is_frame(call->id))
+    {
+        if (replay_state.last_frame_time != 0)
+        {
+            int64_t frame_time = now - replay_state.last_frame_time;
+            g_array_append_val(replay_state.frame_times, frame_time);
+        }
+        replay_state.last_frame_time = now;
+    }
+
+    replay->done = 1;
+    g_cond_broadcast(&replay_state.cond);
+    g_mutex_unlock(&replay_state.lock);
+
+    replay_call_unref(replay);
+}
+
+/**
+ * @brief 从文件中读出一个CALL记录，包装成与guest发来的call结构相同的call
+ *
+ * @return Replay_Call* 文件不完整时返回NULL
+ */
+static Replay_Call *replay_read_call(void)
+{
+    uint64_t time, id, thread_id, process_id, unique_id;
+    uint32_t para_num;
+
+    if (!replay_read_u64(&time) || !replay_read_u64(&id) || !replay_read_u64(&thread_id) ||
+        !replay_read_u64(&process_id) || !replay_read_u64(&unique_id) || !replay_read_u32(&para_num) ||
+        para_num > MAX_PARA_NUM)
+    {
+        return NULL;
+    }
+    replay_state.capture_duration = time;
+
+    Replay_Call *replay = g_new0(Replay_Call, 1);
+    Teleport_Express_Call *call = &replay->call;
+
+    call->id = id;
+    call->thread_id = thread_id;
+    call->process_id = process_id;
+    call->unique_id = unique_id;
+    call->para_num = para_num;
+    call->callback = replay_callback;
+
+    replay->elems = g_new0(Teleport_Express_Queue_Elem, para_num + 1);
+    replay->mems = g_new0(Guest_Mem, para_num + 1);
+    replay->scatter_data = g_new0(Scatter_Data, para_num + 1);
+
+    replay->flag_buf.id = id;
+    replay->flag_buf.para_num = para_num;
+    replay->flag_buf.thread_id = thread_id;
+    replay->flag_buf.process_id = process_id;
+    replay->flag_buf.unique_id = unique_id;
+
+    for (int i = 0; i <= para_num; i++)
+    {
+        uint8_t type = CAPTURE_PARA_DATA;
+        uint32_t len = sizeof(Teleport_Express_Flag_Buf);
+
+        if (i == 0)
+        {
+            replay->scatter_data[0].data = (unsigned char *)&replay->flag_buf;
+        }
+        else
+        {
+            if (!replay_read_u8(&type) || !replay_read_u32(&len) || len > REPLAY_MAX_PARA_LEN)
+            {
+                call->para_num = i - 1;
+                replay->refs = 1;
+                replay_call_unref(replay);
+                return NULL;
+            }
+            if (type != CAPTURE_PARA_NULL)
+            {
+                replay->scatter_data[i].data = g_malloc0(MAX(len, 1));
+            }
+            if (type == CAPTURE_PARA_DATA && !replay_read(replay->scatter_data[i].data, len))
+            {
+                call->para_num = i;
+                replay->refs = 1;
+                replay_call_unref(replay);
+                return NULL;
+            }
+        }
+
+        replay->scatter_data[i].len = type == CAPTURE_PARA_NULL ? 0 : len;
+        replay->mems[i].scatter_data = &replay->scatter_data[i];
+        replay->mems[i].num = 1;
+        replay->mems[i].all_len = replay->scatter_data[i].len;
+
+        replay->elems[i].para = &replay->mems[i];
+        replay->elems[i].len = replay->scatter_data[i].len;
+        if (i > 0)
+        {
+            replay->elems[i - 1].next = &replay->elems[i];
+        }
+    }
+    call->elem_header = &replay->elems[0];
+    call->elem_tail = &replay->elems[para_num];
+
+    //这些call的guest内存会被设备留下来，之后的call还会读写它
+    replay->keep_paras = GET_DEVICE_ID(id) == EXPRESS_MEM_DEVICE_ID ||
+                         id == FUNID_eglCreateDebugMessageBuffer || id == FUNID_eglDestroyDebugMessageBuffer;
+
+    return replay;
+}
+
+/**
+ * @brief 把GBUFFER记录中的内容写到gbuffer的guest内存中，这块内存是回放分配gbuffer的call时留下来的
+ */
+static bool replay_read_gbuffer(void)
+{
+    uint64_t time, gbuffer_id;
+    uint32_t len;
+
+    if (!replay_read_u64(&time) || !replay_read_u64(&gbuffer_id) || !replay_read_u32(&len) || len > REPLAY_MAX_PARA_LEN)
+    {
+        return false;
+    }
+
+    unsigned char *data = g_malloc(MAX(len, 1));
+    if (!replay_read(data, len))
+    {
+        g_free(data);
+        return false;
+    }
+
+    Hardware_Buffer *gbuffer = get_gbuffer_from_global_map(gbuffer_id);
+    if (gbuffer != NULL && gbuffer->guest_data != NULL)
+    {
+        write_to_guest_mem(gbuffer->guest_data, data, 0, MIN((int)len, gbuffer->guest_data->all_len));
+    }
+    else
+    {
+        LOGW("gl replay cannot find gbuffer %" PRIx64 " for its data", gbuffer_id);
+    }
+    replay_state.gbuffer_records++;
+
+    g_free(data);
+    return true;
+}
+
+/**
+ * @brief 推送一个call并等待它处理完成
+ */
+static void replay_push(Replay_Call *replay)
+{
+    // 一个引用给callback，一个留给这里
+    replay->refs = 2;
+    replay->push_time = get_clock();
+
+    push_to_thread(&replay->call);
+
+    g_mutex_lock(&replay_state.lock);
+    int64_t end_time = g_get_monotonic_time() + REPLAY_CALL_TIMEOUT_US;
+    while (!replay->done)
+    {
+        if (!g_cond_wait_until(&replay_state.cond, &replay_state.lock, end_time))
+        {
+            LOGW("gl replay call %" PRIx64 " thread %" PRIx64 " not finished in time", replay->call.id, replay->call.thread_id);
+            replay_state.timeouts++;
+            break;
+        }
+    }
+    g_mutex_unlock(&replay_state.lock);
+
+    replay_call_unref(replay);
+}
+
+static gint replay_stat_compare(gconstpointer a, gconstpointer b)
+{
+    const Replay_Fun_Stat *sa = *(Replay_Fun_Stat *const *)a;
+    const Replay_Fun_Stat *sb = *(Replay_Fun_Stat *const *)b;
+    return sa->total_ns < sb->total_ns ? 1 : (sa->total_ns > sb->total_ns ? -1 : 0);
+}
+
+static gint replay_time_compare(gconstpointer a, gconstpointer b)
+{
+    int64_t ta = *(const int64_t *)a;
+    int64_t tb = *(const int64_t *)b;
+    return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+static void replay_report(int64_t replay_duration)
+{
+    g_mutex_lock(&replay_state.lock);
+
+    GPtrArray *stats = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, replay_state.fun_stats);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        g_ptr_array_add(stats, value);
+    }
+    g_ptr_array_sort(stats, replay_stat_compare);
+
+    printf("gl replay %s: %" PRIu64 " calls, %" PRIu64 " gbuffer updates, %" PRIu64 " timeouts\n",
+           replay_state.path, replay_state.calls, replay_state.gbuffer_records, replay_state.timeouts);
+    printf("captured %.3f s, replayed %.3f s, %.1f calls/s\n",
+           replay_state.capture_duration / 1e9, replay_duration / 1e9,
+           replay_duration > 0 ? replay_state.calls * 1e9 / replay_duration : 0.0);
+
+    printf("%-8s %-10s %10s %14s %12s %12s\n", "device", "fun_id", "calls", "total_us", "avg_us", "max_us");
+    for (int i = 0; i < stats->len; i++)
+    {
+        Replay_Fun_Stat *stat = g_ptr_array_index(stats, i);
+        printf("%-8" PRIu64 " %-10" PRIu64 " %10" PRIu64 " %14.1f %12.2f %12.1f\n",
+               GET_DEVICE_ID(stat->id), GET_FUN_ID(stat->id), stat->calls, stat->total_ns / 1e3,
+               stat->total_ns / 1e3 / stat->calls, stat->max_ns / 1e3);
+    }
+    g_ptr_array_free(stats, TRUE);
+
+    GArray *frames = replay_state.frame_times;
+    if (frames->len > 0)
+    {
+        int64_t sum = 0;
+        for (int i = 0; i < frames->len; i++)
+        {
+            sum += g_array_index(frames, int64_t, i);
+        }
+        g_array_sort(frames, replay_time_compare);
+        printf("frames %u: avg %.2f ms min %.2f ms p95 %.2f ms max %.2f ms, %.1f fps\n",
+               frames->len + 1, sum / 1e6 / frames->len,
+               g_array_index(frames, int64_t, 0) / 1e6,
+               g_array_index(frames, int64_t, (frames->len - 1) * 95 / 100) / 1e6,
+               g_array_index(frames, int64_t, frames->len - 1) / 1e6,
+               sum > 0 ? frames->len * 1e9 / sum : 0.0);
+    }
+    else
+    {
+        printf("no frames\n");
+    }
+    fflush(stdout);
+
+    g_mutex_unlock(&replay_state.lock);
+}
+
+static void *replay_thread(void *opaque)
+{
+    Replay_Call *pending = NULL;
+    bool ok = true;
+    int64_t start_time = get_clock();
+
+    while (ok)
+    {
+        uint8_t type;
+        if (!replay_read_u8(&type))
+        {
+            LOGW("gl replay file %s ends without END record", replay_state.path);
+            break;
+        }
+
+        if (type == CAPTURE_RECORD_GBUFFER)
+        {
+            //gbuffer的内容是在前一个call处理时才录下的，要在推送这个call之前写进去
+            ok = replay_read_gbuffer();
+            continue;
+        }
+
+        if (pending != NULL)
+        {
+            replay_push(pending);
+            pending = NULL;
+        }
+
+        if (type == CAPTURE_RECORD_CALL)
+        {
+            pending = replay_read_call();
+            ok = pending != NULL;
+        }
+        else if (type == CAPTURE_RECORD_END)
+        {
+            uint64_t time;
+            if (replay_read_u64(&time))
+            {
+                replay_state.capture_duration = time;
+            }
+            break;
+        }
+        else
+        {
+            LOGE("error! gl replay unknown record type %d", type);
+            ok = false;
+        }
+    }
+
+    if (pending != NULL)
+    {
+        replay_push(pending);
+    }
+    if (!ok)
+    {
+        LOGE("error! gl replay file %s is truncated or corrupted", replay_state.path);
+    }
+
+    replay_report(get_clock() - start_time);
+    fclose(replay_state.file);
+    replay_state.file = NULL;
+
+    qemu_mutex_lock_iothread();
+    qemu_system_shutdown_request(SHUTDOWN_CAUSE_HOST_QMP_QUIT);
+    qemu_mutex_unlock_iothread();
+    return NULL;
+}
+
+static void replay_vm_state_change(void *opaque, bool running, RunState state)
+{
+    static int started = 0;
+    if (running && !started)
+    {
+        started = 1;
+        qemu_thread_create(&replay_state.thread, "gl-replay", replay_thread, NULL, QEMU_THREAD_DETACHED);
+    }
+}
+
+int express_gpu_replay_start(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        LOGE("error! cannot open gl replay file %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    char magic[8];
+    uint8_t version[4];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || fread(version, 1, sizeof(version), file) != sizeof(version) ||
+        fseek(file, 4, SEEK_CUR) != 0 || strncmp(magic, EXPRESS_GPU_CAPTURE_MAGIC, sizeof(magic)) != 0)
+    {
+        LOGE("error! %s is not a gl capture file", path);
+        fclose(file);
+        return -1;
+    }
+    if (ldl_le_p(version) != EXPRESS_GPU_CAPTURE_VERSION)
+    {
+        LOGE("error! gl capture file %s has version %u, expected %d", path, ldl_le_p(version), EXPRESS_GPU_CAPTURE_VERSION);
+        fclose(file);
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, CAPTURE_FILE_BUF_SIZE);
+
+    replay_state.file = file;
+    replay_state.path = g_strdup(path);
+    g_mutex_init(&replay_state.lock);
+    g_cond_init(&replay_state.cond);
+    replay_state.fun_stats = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    replay_state.frame_times = g_array_new(FALSE, FALSE, sizeof(int64_t));
+
+    qemu_add_vm_change_state_handler(replay_vm_state_change, NULL);
+
+    LOGI("gl replay from %s", path);
+    return 0;
+}
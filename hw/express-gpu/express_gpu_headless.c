@@ -0,0 +1,244 @@
+/**
+ * @file express_gpu_headless.c
+ * @brief 无窗口模式下把合成好的画面交给QEMU的console，这样vnc、dbus等显示后端可以显示它
+ *
+ * 渲染线程只负责画到离屏framebuffer并标记有新的一帧，真正调用dpy_*接口的是主线程的
+ * gfx_update回调（显示后端刷新时调用），因此渲染线程不需要拿BQL。
+ */
+// #define STD_DEBUG_LOG
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "ui/console.h"
+
+#include "hw/express-gpu/express_gpu_headless.h"
+#include "hw/express-gpu/express_gpu_render.h"
+
+#include "hw/teleport-express/express_log.h"
+
+// 超过这么久没有显示后端来取画面，就不再读回或导出画面
+#define HEADLESS_IDLE_US 1000000
+
+typedef struct Headless_Output
+{
+    QemuConsole *con;
+    int width;
+    int height;
+
+    GLuint fbo;
+    GLuint texture;
+
+    // texture导出的dmabuf，fd为-1表示还没有导出
+    QemuDmaBuf dmabuf;
+    bool dmabuf_failed;
+    bool scanout_set;
+
+    // 没有GL显示后端时，渲染线程把画面读回到这里，再由主线程复制到DisplaySurface
+    uint8_t *pixels;
+
+    // 渲染线程画完一帧后置1，主线程交给显示后端后清0，为1时渲染线程不能动texture和pixels
+    int frame_pending;
+
+    // 以下两个由主线程在gfx_update中设置
+    int64_t watched_at;
+    bool want_dmabuf;
+} Headless_Output;
+
+static Headless_Output headless_output = {
+    .dmabuf.fd = -1,
+    .dmabuf.fence_fd = -1,
+};
+
+static void express_headless_gfx_update(void *opaque)
+{
+    Headless_Output *output = opaque;
+    bool has_gl = console_has_gl(output->con);
+
+    qatomic_set(&output->watched_at, g_get_monotonic_time());
+    qatomic_set(&output->want_dmabuf, has_gl);
+
+    if (!qatomic_load_acquire(&output->frame_pending))
+    {
+        return;
+    }
+
+    if (has_gl && output->dmabuf.fd >= 0)
+    {
+        if (!output->scanout_set)
+        {
+            dpy_gl_scanout_dmabuf(output->con, &output->dmabuf);
+            output->scanout_set = true;
+        }
+        dpy_gl_update(output->con, 0, 0, output->width, output->height);
+    }
+    else if (output->pixels != NULL)
+    {
+        DisplaySurface *surface = qemu_console_surface(output->con);
+        int stride = surface_stride(surface);
+        uint8_t *dst = surface_data(surface);
+
+        for (int y = 0; y < output->height; y++)
+        {
+            memcpy(dst + y * stride, output->pixels + y * output->width * 4, output->width * 4);
+        }
+        dpy_gfx_update(output->con, 0, 0, output->width, output->height);
+    }
+
+    qatomic_store_release(&output->frame_pending, 0);
+}
+
+static void express_headless_invalidate(void *opaque)
+{
+    Headless_Output *output = opaque;
+
+    // 显示后端换了，需要重新设置scanout
+    output->scanout_set = false;
+}
+
+static const GraphicHwOps express_headless_ops = {
+    .invalidate = express_headless_invalidate,
+    .gfx_update = express_headless_gfx_update,
+};
+
+void express_headless_console_init(DeviceState *dev, int width, int height)
+{
+    Headless_Output *output = &headless_output;
+
+    if (output->con != NULL)
+    {
+        return;
+    }
+
+    output->width = width;
+    output->height = height;
+    output->con = graphic_console_init(dev, 0, &express_headless_ops, output);
+    dpy_gfx_replace_surface(output->con, qemu_create_displaysurface(width, height));
+
+    LOGI("headless console %d created %dx%d", qemu_console_get_index(output->con), width, height);
+}
+
+bool express_headless_output_init(void)
+{
+    Headless_Output *output = &headless_output;
+
+    if (output->con == NULL)
+    {
+        LOGE("error! headless output without console");
+        return false;
+    }
+
+    glGenTextures(1, &output->texture);
+    glBindTexture(GL_TEXTURE_2D, output->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, output->width, output->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &output->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, output->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, output->texture, 0);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        LOGE("error! headless framebuffer incomplete %x", status);
+        express_headless_output_destroy();
+        return false;
+    }
+
+    output->pixels = g_malloc0(output->width * output->height * 4);
+    return true;
+}
+
+void express_headless_output_bind(void)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, headless_output.fbo);
+}
+
+bool express_headless_output_busy(void)
+{
+    return qatomic_load_acquire(&headless_output.frame_pending) != 0;
+}
+
+#ifdef __linux__
+static bool express_headless_export_dmabuf(Headless_Output *output)
+{
+    int fd = -1, stride = 0, fourcc = 0;
+    uint64_t modifier = 0;
+
+    if (egl_export_texture_dmabuf(output->texture, &fd, &stride, &fourcc, &modifier) != 0)
+    {
+        LOGW("headless framebuffer cannot be exported as dmabuf, reading it back instead");
+        return false;
+    }
+
+    output->dmabuf.fd = fd;
+    output->dmabuf.width = output->width;
+    output->dmabuf.height = output->height;
+    output->dmabuf.stride = stride;
+    output->dmabuf.fourcc = fourcc;
+    output->dmabuf.modifier = modifier;
+    output->dmabuf.scanout_width = output->width;
+    output->dmabuf.scanout_height = output->height;
+    // 合成时已经上下翻转过了，第一行就是画面的顶部
+    output->dmabuf.y0_top = true;
+
+    LOGI("headless framebuffer exported as dmabuf fourcc %x stride %d modifier %" PRIx64, fourcc, stride, modifier);
+    return true;
+}
+#endif
+
+void express_headless_output_present(void)
+{
+    Headless_Output *output = &headless_output;
+
+    if (output->fbo == 0 || express_headless_output_busy())
+    {
+        return;
+    }
+
+    if (g_get_monotonic_time() - qatomic_read(&output->watched_at) > HEADLESS_IDLE_US)
+    {
+        // 没有显示后端在看，画完就行了
+        glFlush();
+        return;
+    }
+
+#ifdef __linux__
+    if (qatomic_read(&output->want_dmabuf) && !output->dmabuf_failed)
+    {
+        if (output->dmabuf.fd < 0 && !express_headless_export_dmabuf(output))
+        {
+            output->dmabuf_failed = true;
+        }
+        if (output->dmabuf.fd >= 0)
+        {
+            // 显示后端导入dmabuf时不会等待我们的fence，因此要等画完
+            glFinish();
+            qatomic_store_release(&output->frame_pending, 1);
+            return;
+        }
+    }
+#endif
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, output->width, output->height, GL_BGRA, GL_UNSIGNED_BYTE, output->pixels);
+    qatomic_store_release(&output->frame_pending, 1);
+}
+
+void express_headless_output_destroy(void)
+{
+    Headless_Output *output = &headless_output;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (output->fbo != 0)
+    {
+        glDeleteFramebuffers(1, &output->fbo);
+        output->fbo = 0;
+    }
+    if (output->texture != 0)
+    {
+        glDeleteTextures(1, &output->texture);
+        output->texture = 0;
+    }
+    // dmabuf和pixels可能还在被主线程使用，程序退出时由系统回收
+}
@@ -12,6 +12,7 @@
 #define TIMER_LOG
 #include "qemu/osdep.h"
 #include "qemu/atomic.h"
+#include "qemu/timer.h"
 
 #include "hw/express-gpu/express_gpu_render.h"
 
@@ -32,6 +33,11 @@
 #include "hw/express-gpu/sdl_control.h"
 
 #include "hw/express-gpu/device_interface_window.h"
+#include "hw/express-gpu/express_gpu_headless.h"
+#include "hw/express-gpu/express_present.h"
+#include "hw/express-gpu/express_gpu_snapshot.h"
+#include "hw/express-gpu/texture_transcode.h"
+#include "hw/express-gpu/gbuffer_reaper.h"
 
 #include "hw/express-input/express_touchscreen.h"
 #include "hw/express-input/express_keyboard.h"
@@ -54,6 +60,9 @@ int VSYNC_enable = 0;
 
 bool express_gpu_keep_window_scale = false;
 
+// 不创建窗口，合成的画面通过QEMU的console交给vnc、dbus等显示后端
+bool express_gpu_headless = false;
+
 bool express_gpu_open_shader_binary = true;
 
 QemuThread native_window_render_thread;
@@ -79,6 +88,12 @@ static QemuThread device_interface_thread;
 
 static GLFWwindow *glfw_window = NULL;
 
+// linux的无窗口模式下没有窗口系统的事件循环，用条件变量代替glfw的事件等待与唤醒
+static bool use_window_system = true;
+static GMutex headless_wake_lock;
+static GCond headless_wake_cond;
+static bool headless_wake_pending = false;
+
 static GLuint programID = 0;
 static GLuint drawVAO = 0;
 
@@ -223,15 +238,15 @@ static const char *SPECIAL_EXTENSIONS[] = {
         "GL_OES_texture_buffer",
         "GL_OES_texture_cube_map_array", // -> GL_ARB_texture_cube_map_array
         "GL_OES_surfaceless_context", // -> EGL_KHR_surfaceless_context
+
+        "GL_EXT_disjoint_timer_query", // -> GL_ARB_timer_query
 };
-static const int SPECIAL_EXTENSIONS_SIZE = 73;
+static const int SPECIAL_EXTENSIONS_SIZE = 74;
 
 static void *native_window_create(int context_flags);
 
 static Notifier shutdown_notifier;
 
-static Dying_List *dying_gbuffer;
-
 static gint64 last_click_time = 0;
 
 void window_size_change_callback(GLFWwindow *window, int width, int height);
@@ -342,42 +357,51 @@ void window_size_change_callback(GLFWwindow *window, int width, int height)
     return;
 }
 
-static int try_destroy_gbuffer(void *data)
+/**
+ * @brief 等待窗口事件或者发给主窗口线程的消息，最多等待timeout_us
+ */
+static void native_wait_events(gint64 timeout_us)
 {
-    Hardware_Buffer *gbuffer = (Hardware_Buffer *)data;
-
-    if (gbuffer == NULL)
+    if (use_window_system)
     {
-        return 1;
+        glfwWaitEventsTimeout(timeout_us / 1000000.0);
+        return;
     }
 
-    if (gbuffer->is_dying == 0)
+    gint64 end_time = g_get_monotonic_time() + timeout_us;
+    g_mutex_lock(&headless_wake_lock);
+    while (!headless_wake_pending && g_cond_wait_until(&headless_wake_cond, &headless_wake_lock, end_time))
     {
-        return 1;
     }
+    headless_wake_pending = false;
+    g_mutex_unlock(&headless_wake_lock);
+}
 
-    if (gbuffer->remain_life_time > 0)
+static void native_post_empty_event(void)
+{
+    if (use_window_system)
     {
-        gbuffer->remain_life_time--;
-        return 0;
+        glfwPostEmptyEvent();
+        return;
     }
 
-    if (main_display_gbuffer == gbuffer)
-    {
-        gbuffer->remain_life_time = MAX_COMPOSER_LIFE_TIME;
-        return 0;
-    }
+    g_mutex_lock(&headless_wake_lock);
+    headless_wake_pending = true;
+    g_cond_signal(&headless_wake_cond);
+    g_mutex_unlock(&headless_wake_lock);
+}
 
-    if (gbuffer->gbuffer_id != 0)
+/**
+ * @brief 合成时使用的变换。无窗口模式下画到framebuffer里的画面要再上下翻转一次，
+ * 这样第一行就是画面顶部，读回和导出时都不用再翻转
+ */
+static GLuint composer_transform(GLuint transform_type)
+{
+    if (!express_gpu_headless)
     {
-        // psurface的gbuffer_id为0
-        remove_gbuffer_from_global_map(gbuffer->gbuffer_id);
+        return transform_type;
     }
-
-    destroy_gbuffer(gbuffer);
-    LOGI("gbuffer %llx is dead", gbuffer->gbuffer_id);
-
-    return 1;
+    return transform_type == ROTATE_NONE ? FLIP_V : ROTATE_NONE;
 }
 
 static void handle_child_window_event(void)
@@ -435,12 +459,12 @@ static void handle_child_window_event(void)
             Hardware_Buffer *gbuffer = (Hardware_Buffer *)child_event->data;
             if (gbuffer->gbuffer_id == 0)
             {
-                destroy_gbuffer(gbuffer);
+                gbuffer_reaper_retire(gbuffer);
             }
             else
             {
                 // LOGI("real destroy gbuffer %llx ptr %llx", gbuffer->gbuffer_id, gbuffer);
-                dying_gbuffer = dying_list_append(dying_gbuffer, gbuffer);
+                gbuffer_reaper_add_dying(gbuffer);
             }
         }
         break;
@@ -450,7 +474,7 @@ static void handle_child_window_event(void)
             if (gbuffer != NULL)
             {
                 // LOGI("real cancel gbuffer delete %llx ptr %llx", gbuffer->gbuffer_id, gbuffer);
-                dying_gbuffer = dying_list_remove(dying_gbuffer, gbuffer);
+                gbuffer_reaper_cancel_dying(gbuffer);
             }
         }
         break;
@@ -495,6 +519,9 @@ static void handle_child_window_event(void)
             glDeleteSync(sync);
         }
         break;
+        case MAIN_SNAPSHOT:
+            express_gpu_snapshot_handle_job(child_event->data);
+            break;
         default:
             // express_printf("child win msg: %d\n", uMsg);
             break;
@@ -548,16 +575,8 @@ static void static_value_prepare(void)
         preload_static_context_value->max_vertex_attrib_bindings = 32;
     }
 
-    preload_static_context_value->num_compressed_texture_formats += 1;
-    if (preload_static_context_value->num_compressed_texture_formats > 128)
-    {
-        preload_static_context_value->compressed_texture_formats[127] = GL_ETC1_RGB8_OES;
-        preload_static_context_value->num_compressed_texture_formats = 128;
-    }
-    else
-    {
-        preload_static_context_value->compressed_texture_formats[preload_static_context_value->num_compressed_texture_formats - 1] = GL_ETC1_RGB8_OES;
-    }
+    // host不支持的ETC1、ETC2/EAC与ASTC格式由CPU解码，也加到格式列表中
+    texture_transcode_prepare_formats(preload_static_context_value);
 
     //@todo 增加换硬件后暂时移除binary的功能
     if (!express_gpu_open_shader_binary)
@@ -770,7 +789,7 @@ static void *native_window_create(int context_flags)
     static int windows_cnt = 0;
     int cnt = windows_cnt++;
 
-    if (context_flags & DGL_CONTEXT_FLAG_INDEPENDENT_MODE_BIT)
+    if ((context_flags & DGL_CONTEXT_FLAG_INDEPENDENT_MODE_BIT) && use_window_system)
     {
         char name[100];
         sprintf(name, "opengl-child-window%d", cnt);
@@ -813,26 +832,19 @@ static void *native_window_create(int context_flags)
 }
 
 /**
- * @brief 覆盖在原来窗口上面用于绘制的窗口的线程主函数，主要包括了窗口的建立和设置
+ * @brief 创建主窗口，主窗口的context是所有context的父context
  *
- * @param opaque 需要传入VirtIODevice
- * @return void*
+ * @return 成功返回true
  */
-void *native_window_thread(void *opaque)
+static bool native_window_open(void)
 {
-    // 通过这个方式获取hwnd要求必须使用SDL接口创建界面
-    QemuConsole *con = NULL;
-    input_receive_con = con;
-
-    main_window_event_queue = g_async_queue_new();
-
     // 初始化glfw
     THREAD_CONTROL_BEGIN
     if (!glfwInit()){
     #ifdef __APPLE__ 
         exit(-1);
     #else
-        return NULL;
+        return false;
     #endif
     }
 
@@ -851,6 +863,10 @@ void *native_window_thread(void *opaque)
     }
     glfwWindowHint(GLFW_CONTEXT_ROBUSTNESS, GLFW_LOSE_CONTEXT_ON_RESET);
 #endif
+#ifdef __linux__
+    // 子context由egl_window_egl.c用EGL创建，主窗口的context也必须是EGL的才能共享
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+#endif
 
     // 创建一个窗口，这个window也是context
     window_width = express_gpu_window_width;
@@ -871,7 +887,7 @@ void *native_window_thread(void *opaque)
     #ifdef __APPLE__    
         exit(-1);
     #else
-        return NULL;
+        return false;
     #endif
 
     }
@@ -935,9 +951,84 @@ void *native_window_thread(void *opaque)
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
     {
         LOGI("load glad error");
+        return false;
+    }
+    return true;
+}
+
+#ifdef __linux__
+/**
+ * @brief 无窗口模式下不依赖窗口系统，直接用EGL创建主context，没有GPU时可以跑在llvmpipe上
+ *
+ * @return 成功返回true
+ */
+static bool native_headless_open(void)
+{
+    void *dpy = NULL;
+    void *gl_context = NULL;
+
+    use_window_system = false;
+
+    if (egl_headless_create(&dpy, &gl_context) != 0)
+    {
+        return false;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc)egl_get_proc_address))
+    {
+        LOGI("load glad error");
+        egl_headless_destroy();
+        return false;
+    }
+    return true;
+}
+#endif
+
+/**
+ * @brief 覆盖在原来窗口上面用于绘制的窗口的线程主函数，主要包括了窗口的建立和设置
+ *
+ * @param opaque 需要传入VirtIODevice
+ * @return void*
+ */
+void *native_window_thread(void *opaque)
+{
+    // 通过这个方式获取hwnd要求必须使用SDL接口创建界面
+    QemuConsole *con = NULL;
+    input_receive_con = con;
+
+    main_window_event_queue = g_async_queue_new();
+
+    bool opened = false;
+#ifdef __linux__
+    if (express_gpu_headless)
+    {
+        opened = native_headless_open();
+    }
+    else
+#endif
+    {
+        // 其他平台的无窗口模式使用不显示的窗口
+        opened = native_window_open();
+    }
+    if (!opened)
+    {
         return NULL;
     }
 
+    if (express_gpu_headless)
+    {
+        // 画面和framebuffer一样大，没有需要保持比例的窗口
+        display_width = *express_display_pixel_width;
+        display_height = *express_display_pixel_height;
+        window_width = display_width;
+        window_height = display_height;
+        main_display_content_x = 0;
+        main_display_content_y = 0;
+        main_display_content_width = display_width;
+        main_display_content_height = display_height;
+        set_touchscreen_window_size(display_width, display_height);
+    }
+
     shutdown_notifier.notify = shutdown_notify_callback;
     qemu_register_shutdown_notifier(&shutdown_notifier);
 
@@ -947,6 +1038,14 @@ void *native_window_thread(void *opaque)
     prepare_draw_texi();
     static_value_prepare();
 
+    if (express_gpu_headless && !express_headless_output_init())
+    {
+        LOGE("error! headless output init failed, frames will not be shown");
+    }
+
+    // 快照在渲染线程启动之前就加载了
+    express_gpu_snapshot_restore_gbuffers();
+
     native_render_run = 2;
 
     main_window_opengl_prepare(&programID, &drawVAO);
@@ -954,7 +1053,7 @@ void *native_window_thread(void *opaque)
 
     program_transform_loc = glGetUniformLocation(programID, "transform_loc");
     now_transform_type = 0;
-    glUniform1i(program_transform_loc, now_transform_type);
+    glUniform1i(program_transform_loc, composer_transform(now_transform_type));
 
     LOGI("native windows create!\n");
 
@@ -978,25 +1077,27 @@ void *native_window_thread(void *opaque)
     #endif
     }
 
-    gint64 frame_start_time = g_get_real_time();
-    gint64 remain_sleep_time = 0;
-    gint64 frame_draw_time = 0;
-    bool has_refresh = false;
+    // 按刷新率的节拍合成，每个节拍最多合成一次，只合成guest最新提交的帧
+    Present_Clock present_clock;
+    if (present_clock_init(&present_clock, express_display_refresh_rate) != 0)
+    {
+        present_clock_init(&present_clock, 60);
+    }
 
-    last_calc_time = frame_start_time;
+    int64_t frame_draw_time = 0;
+    uint64_t last_dropped_frames = 0;
 
-    while (!glfwWindowShouldClose(glfw_window) && native_render_run == 2)
-    {
-        gint64 need_sleep_time = 0;
-        gint64 now_time = 0;
+    last_calc_time = get_clock();
 
-        do
+    while ((glfw_window == NULL || !glfwWindowShouldClose(glfw_window)) && native_render_run == 2)
+    {
+        // 节拍到来之前处理各种输入事件与消息，剩下不到1ms时直接等节拍，避免错过它
+        while (present_clock_until_tick(&present_clock) > SCALE_MS && native_render_run == 2)
         {
-            // 处理各种输入事件、opengl事件
             THREAD_CONTROL_BEGIN
 
             //处理各种输入事件、opengl事件
-            glfwWaitEventsTimeout(0.001);
+            native_wait_events(1000);
 
             THREAD_CONTROL_END
 
@@ -1015,100 +1116,137 @@ void *native_window_thread(void *opaque)
                     // 否则浏览器自己合成视频播放图像时，会显示的倒着，二是为了更高效的复制GraphicBuffer的数据（不用倒着复制了）
                     // 鸿蒙就不翻转了，因为就没有翻转的功能
                     now_transform_type = FLIP_V;
-                    glUniform1i(program_transform_loc, now_transform_type);
+                    glUniform1i(program_transform_loc, composer_transform(now_transform_type));
+                }
+                if (!express_gpu_headless)
+                {
+                    glfwShowWindow(glfw_window);
+                    glfwSwapBuffers(glfw_window);
                 }
-                glfwShowWindow(glfw_window);
-                glfwSwapBuffers(glfw_window);
                 window_is_shown = true;
                 sdl2_no_need = 1;
             }
 
-            // 在窗口上绘制内容
-            if (main_display_gbuffer != NULL && window_need_refresh)
+            if ((main_display_gbuffer == NULL) && window_is_shown == true && force_show_native_render_window == 0)
             {
-                if (!window_is_shown)
+                window_is_shown = false;
+                LOGI("hide window");
+                if (!express_gpu_headless)
                 {
-                    window_is_shown = true;
-                    glfwShowWindow(glfw_window);
-
-                    sdl2_no_need = 1;
+                    glfwHideWindow(glfw_window);
                 }
 
-                window_need_refresh = false;
+                sdl2_no_need = 0;
+            }
+        }
 
-                opengl_paint_composer_gbuffer();
-                // opengl_paint_composer_layers();
+        present_clock_wait(&present_clock);
 
-                calc_screen_hz += 1;
-                has_refresh = true;
+        // 无窗口模式下上一帧还没被显示后端取走时先不画，这时也不取新的帧，等下个节拍取更新的
+        bool can_draw = main_display_gbuffer != NULL && !(express_gpu_headless && express_headless_output_busy());
+        bool new_frame = can_draw && present_latch_frame();
 
-                glfwSwapBuffers(glfw_window);
+        // 在窗口上绘制内容
+        if (can_draw && (new_frame || window_need_refresh))
+        {
+            int64_t draw_start_time = get_clock();
 
-                // 把foreach放到下面，是因为主线程的消息中可能有取消gbuffer销毁流程的消息
-                // 放到绘制函数里，是为了避免过快销毁gbuffer（绘制函数外是最高1000hz的频率
-                dying_list_foreach(dying_gbuffer, try_destroy_gbuffer);
-            }
-            else
+            if (!window_is_shown)
             {
-                if ((main_display_gbuffer == NULL) && window_is_shown == true && force_show_native_render_window == 0)
+                window_is_shown = true;
+                if (!express_gpu_headless)
                 {
-                    window_is_shown = false;
-                    LOGI("hide window");
-                    glfwHideWindow(glfw_window);
-
-                    sdl2_no_need = 0;
+                    glfwShowWindow(glfw_window);
                 }
+
+                sdl2_no_need = 1;
             }
 
-            now_time = g_get_real_time();
+            window_need_refresh = false;
 
-            need_sleep_time = 1000000 / express_display_refresh_rate - (now_time - frame_start_time) + remain_sleep_time;
+            if (express_gpu_headless)
+            {
+                express_headless_output_bind();
+            }
 
-        } while (need_sleep_time > 2000);
+            opengl_paint_composer_gbuffer();
+            // opengl_paint_composer_layers();
 
-        if (has_refresh)
-        {
-            frame_draw_time += now_time - frame_start_time;
-            has_refresh = false;
-        }
+            calc_screen_hz += 1;
 
-        frame_start_time = now_time;
-        remain_sleep_time = need_sleep_time;
+            if (express_gpu_headless)
+            {
+                express_headless_output_present();
+            }
+            else
+            {
+                glfwSwapBuffers(glfw_window);
+            }
 
-        // 丢帧丢了100ms了，就不管少休眠的时间了
-        if (need_sleep_time < -100000)
-        {
-            need_sleep_time = 0;
+            int64_t present_time = get_clock();
+            present_frame_done(&present_clock, present_time);
+            frame_draw_time += present_time - draw_start_time;
         }
-        // LOGI("remain_sleep_time %lld", remain_sleep_time);
 
-        if (now_time - last_calc_time > 1000000)
+        // 放到消息处理的后面，是因为主线程的消息中可能有取消gbuffer销毁流程的消息
+        // 每个节拍回收一次，没有画面显示时dying的gbuffer也会按时释放
+        gbuffer_reaper_run();
+
+        int64_t now_time = get_clock();
+        if (now_time - last_calc_time > NANOSECONDS_PER_SECOND)
         {
+            Present_Timing timing;
+            present_get_timing(&timing);
+
             now_screen_hz = calc_screen_hz;
             calc_screen_hz = 0;
-            float gen_frame_time_avg = 1.0f * frame_draw_time / now_screen_hz;
             if (now_screen_hz == 0)
             {
                 express_printf("screen draw 0 frame this second\n");
             }
             else
             {
-                LOGD("screen draw avg %.2f us %.2f FPS", gen_frame_time_avg, now_screen_hz * 1000000.0f / (now_time - last_calc_time));
+                LOGD("screen draw avg %.2f us %.2f FPS", frame_draw_time / 1000.0f / now_screen_hz,
+                     now_screen_hz * 1e9f / (now_time - last_calc_time));
             }
+            LOGD("present ticks %" PRIu64 " missed %" PRIu64 " jitter avg %.2f us max %.2f us dropped frames %" PRIu64,
+                 present_clock.ticks, present_clock.missed_ticks,
+                 present_clock.ticks == 0 ? 0.0f : present_clock.jitter_sum_ns / 1000.0f / present_clock.ticks,
+                 present_clock.jitter_max_ns / 1000.0f, timing.dropped_frames - last_dropped_frames);
 
+            last_dropped_frames = timing.dropped_frames;
+            present_clock_reset_stats(&present_clock);
             frame_draw_time = 0;
             last_calc_time = now_time;
         }
     }
 
+    present_clock_destroy(&present_clock);
+
+    gbuffer_reaper_destroy();
+
+    if (express_gpu_headless)
+    {
+        express_headless_output_destroy();
+    }
+
     // qemu_system_shutdown_request(SHUTDOWN_CAUSE_HOST_UI);
-    glfwMakeContextCurrent(NULL);
+    if (use_window_system)
+    {
+        glfwMakeContextCurrent(NULL);
 
-    THREAD_CONTROL_BEGIN
+        THREAD_CONTROL_BEGIN
 
-    glfwDestroyWindow(glfw_window);
+        glfwDestroyWindow(glfw_window);
 
-    THREAD_CONTROL_END
+        THREAD_CONTROL_END
+    }
+#ifdef __linux__
+    else
+    {
+        egl_headless_destroy();
+    }
+#endif
 
     LOGI("native windows close!");
 
@@ -1133,6 +1271,13 @@ Hardware_Buffer *get_gbuffer_from_global_map(uint64_t gbuffer_id)
     return gbuffer;
 }
 
+void gbuffer_global_map_foreach(GHFunc func, void *data)
+{
+    ATOMIC_LOCK(gbuffer_global_map_lock);
+    g_hash_table_foreach(gbuffer_global_map, func, data);
+    ATOMIC_UNLOCK(gbuffer_global_map_lock);
+}
+
 void remove_gbuffer_from_global_map(uint64_t gbuffer_id)
 {
     ATOMIC_LOCK(gbuffer_global_map_lock);
@@ -1148,8 +1293,9 @@ void send_message_to_main_window(int message_code, void *data)
     ATOMIC_LOCK(main_window_event_queue_lock);
     g_async_queue_push(main_window_event_queue, (gpointer)event);
     ATOMIC_UNLOCK(main_window_event_queue_lock);
-    if (message_code == MAIN_PAINT || message_code == MAIN_PAINT_LAYERS || message_code == MAIN_CREATE_CHILD_WINDOW)
+    if (message_code == MAIN_PAINT || message_code == MAIN_PAINT_LAYERS || message_code == MAIN_CREATE_CHILD_WINDOW ||
+        message_code == MAIN_SNAPSHOT)
     {
-        glfwPostEmptyEvent();
+        native_post_empty_event();
     }
 }
\ No newline at end of file
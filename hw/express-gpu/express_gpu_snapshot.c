@@ -0,0 +1,3286 @@
+/**
+ * @file express_gpu_snapshot.c
+ * @brief express-gpu的GL对象保存与恢复
+ *
+ * 保存：pre_save把任务交给渲染主线程，主线程一段一段地生成数据放到队列里，pre_save一边取一边写入快照，
+ * 队列最多缓存几段，避免所有纹理的内容同时留在内存里。
+ * 恢复：post_load把数据解析成记录，gbuffer由渲染主线程重建，进程的记录等guest中对应进程的线程第一次调用时再重建。
+ */
+// #define STD_DEBUG_LOG
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "migration/qemu-file-types.h"
+
+#include "hw/express-gpu/express_gpu_snapshot.h"
+#include "hw/express-gpu/express_gpu_render.h"
+#include "hw/express-gpu/glv3_resource.h"
+#include "hw/express-gpu/glv3_program.h"
+#include "hw/express-gpu/glv3_status.h"
+#include "hw/express-gpu/egl_draw.h"
+
+#include "hw/teleport-express/express_log.h"
+
+#define GPU_SNAPSHOT_MAGIC 0x45475055
+
+#define SECTION_END 0
+#define SECTION_GBUFFER 1
+#define SECTION_PROCESS 2
+#define SECTION_OBJECTS 3
+
+// 各段内容的格式版本，读取时跳过比这个新的段
+#define SECTION_VERSION 1
+
+// 段头：tag | 版本 | 内容长度
+#define SECTION_HEADER_SIZE 16
+
+#define OBJECT_TEXTURE 1
+#define OBJECT_BUFFER 2
+#define OBJECT_RENDERBUFFER 3
+#define OBJECT_SAMPLER 4
+#define OBJECT_SHADER 5
+#define OBJECT_PROGRAM 6
+#define OBJECT_SYNC 7
+// 通过EGLImage连接到gbuffer的纹理，只记录gbuffer的id
+#define OBJECT_SHARED_TEXTURE 8
+
+#define PROGRAM_LINKED 1
+#define PROGRAM_SEPARABLE 2
+
+// 暂存PBO的初始大小，一批拷贝填满它之后才等待一次fence
+#define STAGING_SIZE (64 * 1024 * 1024)
+
+// 一段超过这个大小就结束，后面的对象放到新的一段
+#define SECTION_SPLIT_SIZE (64 * 1024 * 1024)
+
+// 主线程最多领先pre_save这么多段
+#define MAX_QUEUED_SECTIONS 4
+
+// 读取时一段的长度上限，防止损坏的快照让恢复申请过大的内存
+#define MAX_SECTION_SIZE (4ULL * 1024 * 1024 * 1024)
+
+#define MAX_TEXTURE_LEVELS 16
+#define MAX_SHARE_GROUPS 4096
+
+// FBO、program pipeline、transform feedback、VAO、query
+#define EXCLUSIVE_TYPE_NUM 5
+
+// 等待渲染主线程的时间，超过这么久没有进展就认为它已经停止了
+#define SNAPSHOT_WAIT_US (30 * G_USEC_PER_SEC)
+
+#define PROCESS_PENDING 0
+#define PROCESS_RESTORING 1
+#define PROCESS_DONE 2
+
+#define PROBE_TARGET_NUM 8
+
+static const GLenum probe_targets[PROBE_TARGET_NUM] = {
+    GL_TEXTURE_2D,
+    GL_TEXTURE_CUBE_MAP,
+    GL_TEXTURE_3D,
+    GL_TEXTURE_2D_ARRAY,
+    GL_TEXTURE_2D_MULTISAMPLE,
+    GL_TEXTURE_2D_MULTISAMPLE_ARRAY,
+    GL_TEXTURE_CUBE_MAP_ARRAY,
+    GL_TEXTURE_BUFFER,
+};
+
+static const GLenum probe_bindings[PROBE_TARGET_NUM] = {
+    GL_TEXTURE_BINDING_2D,
+    GL_TEXTURE_BINDING_CUBE_MAP,
+    GL_TEXTURE_BINDING_3D,
+    GL_TEXTURE_BINDING_2D_ARRAY,
+    GL_TEXTURE_BINDING_2D_MULTISAMPLE,
+    GL_TEXTURE_BINDING_2D_MULTISAMPLE_ARRAY,
+    GL_TEXTURE_BINDING_CUBE_MAP_ARRAY,
+    GL_TEXTURE_BINDING_BUFFER,
+};
+
+static const GLenum pack_params[6] = {
+    GL_PACK_ALIGNMENT,
+    GL_PACK_ROW_LENGTH,
+    GL_PACK_IMAGE_HEIGHT,
+    GL_PACK_SKIP_PIXELS,
+    GL_PACK_SKIP_ROWS,
+    GL_PACK_SKIP_IMAGES,
+};
+
+static const GLenum unpack_params[6] = {
+    GL_UNPACK_ALIGNMENT,
+    GL_UNPACK_ROW_LENGTH,
+    GL_UNPACK_IMAGE_HEIGHT,
+    GL_UNPACK_SKIP_PIXELS,
+    GL_UNPACK_SKIP_ROWS,
+    GL_UNPACK_SKIP_IMAGES,
+};
+
+// 纹理与sampler共有的参数
+static const GLenum sampler_int_params[7] = {
+    GL_TEXTURE_MIN_FILTER,
+    GL_TEXTURE_MAG_FILTER,
+    GL_TEXTURE_WRAP_S,
+    GL_TEXTURE_WRAP_T,
+    GL_TEXTURE_WRAP_R,
+    GL_TEXTURE_COMPARE_MODE,
+    GL_TEXTURE_COMPARE_FUNC,
+};
+
+// 只有纹理有的参数
+static const GLenum texture_int_params[6] = {
+    GL_TEXTURE_BASE_LEVEL,
+    GL_TEXTURE_MAX_LEVEL,
+    GL_TEXTURE_SWIZZLE_R,
+    GL_TEXTURE_SWIZZLE_G,
+    GL_TEXTURE_SWIZZLE_B,
+    GL_TEXTURE_SWIZZLE_A,
+};
+
+static const GLenum float_params[2] = {
+    GL_TEXTURE_MIN_LOD,
+    GL_TEXTURE_MAX_LOD,
+};
+
+// 保存时记录的buffer绑定点，ELEMENT_ARRAY_BUFFER只在使用默认VAO时记录
+static const GLenum buffer_binding_targets[13] = {
+    GL_ARRAY_BUFFER,
+    GL_ELEMENT_ARRAY_BUFFER,
+    GL_COPY_READ_BUFFER,
+    GL_COPY_WRITE_BUFFER,
+    GL_PIXEL_PACK_BUFFER,
+    GL_PIXEL_UNPACK_BUFFER,
+    GL_TRANSFORM_FEEDBACK_BUFFER,
+    GL_UNIFORM_BUFFER,
+    GL_ATOMIC_COUNTER_BUFFER,
+    GL_DISPATCH_INDIRECT_BUFFER,
+    GL_DRAW_INDIRECT_BUFFER,
+    GL_SHADER_STORAGE_BUFFER,
+    GL_TEXTURE_BUFFER,
+};
+
+typedef enum Snapshot_Job_Type
+{
+    SNAPSHOT_JOB_SAVE,
+    SNAPSHOT_JOB_RESTORE,
+} Snapshot_Job_Type;
+
+/**
+ * @brief pre_save/post_load与渲染主线程之间传递的任务，两边各持有一个引用
+ */
+typedef struct Snapshot_Job
+{
+    Snapshot_Job_Type type;
+    int ref;
+
+    GMutex lock;
+    GCond cond;
+
+    // 主线程生成好、还没有写入快照的段
+    GQueue sections;
+
+    bool finished;
+    // pre_save出错或者超时，主线程不用再继续生成
+    bool aborted;
+    int error;
+} Snapshot_Job;
+
+typedef struct Snapshot_Fill
+{
+    guint section_off;
+    GLintptr staging_off;
+    GLsizeiptr len;
+} Snapshot_Fill;
+
+typedef struct Save_State
+{
+    Snapshot_Job *job;
+    GByteArray *section;
+
+    // 当前OBJECTS段的前缀，分段时写到新的段开头
+    uint64_t process_id;
+    uint32_t group;
+
+    GLuint staging;
+    GLsizeiptr staging_size;
+    GLsizeiptr staging_used;
+
+    // 已经发出拷贝、等待映射后写回段中的数据
+    GArray *fills;
+
+    int error;
+} Save_State;
+
+/**
+ * @brief 一个共享组中host id到guest id的反查表，用于保存绑定关系
+ */
+typedef struct Group_Maps
+{
+    Share_Resources *share;
+    GHashTable *textures;
+    GHashTable *buffers;
+    GHashTable *programs;
+    GHashTable *shaders;
+} Group_Maps;
+
+typedef struct Snapshot_GL_State
+{
+    GLint textures[PROBE_TARGET_NUM];
+    GLint pack_buffer;
+    GLint unpack_buffer;
+    GLint copy_read_buffer;
+    GLint copy_write_buffer;
+    GLint renderbuffer;
+    GLint pack[6];
+    GLint unpack[6];
+} Snapshot_GL_State;
+
+typedef struct Snapshot_Reader
+{
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    bool error;
+} Snapshot_Reader;
+
+typedef struct Snapshot_Object
+{
+    uint32_t type;
+    uint32_t guest_id;
+    uint32_t len;
+    uint8_t *data;
+} Snapshot_Object;
+
+typedef struct Snapshot_Gbuffer
+{
+    uint64_t gbuffer_id;
+    int width;
+    int height;
+    int sampler_num;
+    int format;
+    int pixel_type;
+    int internal_format;
+    int depth_internal_format;
+    int stencil_internal_format;
+    uint32_t len;
+    uint8_t *data;
+} Snapshot_Gbuffer;
+
+typedef struct Snapshot_Binding
+{
+    uint32_t unit;
+    uint32_t target;
+    uint32_t guest_id;
+} Snapshot_Binding;
+
+typedef struct Snapshot_Context
+{
+    uint64_t guest_context;
+    uint32_t group;
+    int context_flags;
+
+    GArray *exclusive_ids[EXCLUSIVE_TYPE_NUM];
+
+    uint32_t active_texture;
+    GArray *texture_bindings;
+    uint32_t program;
+    GArray *buffer_bindings;
+
+    Opengl_Context *host;
+} Snapshot_Context;
+
+typedef struct Snapshot_Surface
+{
+    uint64_t guest_surface;
+    uint64_t guest_config;
+    int type;
+    int width;
+    int height;
+} Snapshot_Surface;
+
+typedef struct Snapshot_Image
+{
+    uint64_t gbuffer_id;
+    uint32_t group;
+} Snapshot_Image;
+
+typedef struct Snapshot_Thread
+{
+    uint64_t thread_id;
+    uint64_t guest_context;
+    uint64_t draw;
+    uint64_t read;
+    uint64_t gbuffer_id;
+    int width;
+    int height;
+} Snapshot_Thread;
+
+typedef struct Snapshot_Process
+{
+    uint64_t process_id;
+    int state;
+
+    uint32_t group_num;
+    // 每个共享组一个GPtrArray，元素为Snapshot_Object
+    GPtrArray *groups;
+
+    GPtrArray *contexts;
+    GArray *surfaces;
+    GArray *images;
+
+    // 线程id到Snapshot_Thread，恢复之后只读
+    GHashTable *threads;
+} Snapshot_Process;
+
+typedef struct Snapshot_Process_Entry
+{
+    uint64_t process_id;
+    Process_Context *process;
+} Snapshot_Process_Entry;
+
+// 保护下面的恢复记录以及各个Resource_Map_Status的restore_pending
+static GMutex snapshot_lock;
+
+// post_load解析出来、渲染主线程还没有重建的gbuffer
+static GList *pending_gbuffers = NULL;
+
+// 进程id到Snapshot_Process，进程出现时取走
+static GHashTable *pending_processes = NULL;
+
+static void put_u32(GByteArray *buf, uint32_t value)
+{
+    uint8_t temp[4];
+    stl_be_p(temp, value);
+    g_byte_array_append(buf, temp, sizeof(temp));
+}
+
+static void put_u64(GByteArray *buf, uint64_t value)
+{
+    uint8_t temp[8];
+    stq_be_p(temp, value);
+    g_byte_array_append(buf, temp, sizeof(temp));
+}
+
+static void put_bytes(GByteArray *buf, const void *data, uint32_t len)
+{
+    put_u32(buf, len);
+    if (len > 0)
+    {
+        g_byte_array_append(buf, data, len);
+    }
+}
+
+static void put_string(GByteArray *buf, const char *string)
+{
+    put_bytes(buf, string, strlen(string));
+}
+
+static uint32_t float_as_uint32(GLfloat value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static GLfloat uint32_as_float(uint32_t bits)
+{
+    GLfloat value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static guint put_placeholder(GByteArray *buf)
+{
+    guint off = buf->len;
+    put_u32(buf, 0);
+    return off;
+}
+
+static void patch_u32(GByteArray *buf, guint off, uint32_t value)
+{
+    stl_be_p(buf->data + off, value);
+}
+
+static const uint8_t *get_raw(Snapshot_Reader *r, size_t len)
+{
+    if (r->error || len > r->len - r->pos)
+    {
+        r->error = true;
+        return NULL;
+    }
+    const uint8_t *data = r->data + r->pos;
+    r->pos += len;
+    return data;
+}
+
+static uint32_t get_u32(Snapshot_Reader *r)
+{
+    const uint8_t *data = get_raw(r, 4);
+    return data != NULL ? ldl_be_p(data) : 0;
+}
+
+static uint64_t get_u64(Snapshot_Reader *r)
+{
+    const uint8_t *data = get_raw(r, 8);
+    return data != NULL ? ldq_be_p(data) : 0;
+}
+
+static const uint8_t *get_bytes(Snapshot_Reader *r, uint32_t *len)
+{
+    *len = get_u32(r);
+    const uint8_t *data = get_raw(r, *len);
+    if (data == NULL)
+    {
+        *len = 0;
+    }
+    return data;
+}
+
+static char *get_string(Snapshot_Reader *r)
+{
+    uint32_t len;
+    const uint8_t *data = get_bytes(r, &len);
+    return data != NULL ? g_strndup((const char *)data, len) : g_strdup("");
+}
+
+/**
+ * @brief 读取时数组元素个数的上限，每个元素至少占min_size字节，防止损坏的数据让循环跑很久
+ */
+static bool get_count(Snapshot_Reader *r, uint32_t min_size, uint32_t *count)
+{
+    *count = get_u32(r);
+    if (r->error || (uint64_t)*count * min_size > r->len - r->pos)
+    {
+        r->error = true;
+        *count = 0;
+        return false;
+    }
+    return true;
+}
+
+static void snapshot_object_free(gpointer data)
+{
+    Snapshot_Object *object = (Snapshot_Object *)data;
+    if (object == NULL)
+    {
+        return;
+    }
+    g_free(object->data);
+    g_free(object);
+}
+
+static void snapshot_gbuffer_free(gpointer data)
+{
+    Snapshot_Gbuffer *gbuffer = (Snapshot_Gbuffer *)data;
+    g_free(gbuffer->data);
+    g_free(gbuffer);
+}
+
+static void snapshot_context_free(gpointer data)
+{
+    Snapshot_Context *context = (Snapshot_Context *)data;
+    for (int i = 0; i < EXCLUSIVE_TYPE_NUM; i++)
+    {
+        g_array_free(context->exclusive_ids[i], TRUE);
+    }
+    g_array_free(context->texture_bindings, TRUE);
+    g_array_free(context->buffer_bindings, TRUE);
+    g_free(context);
+}
+
+static void snapshot_process_free(gpointer data)
+{
+    Snapshot_Process *record = (Snapshot_Process *)data;
+    if (record->groups != NULL)
+    {
+        g_ptr_array_unref(record->groups);
+    }
+    g_ptr_array_unref(record->contexts);
+    g_array_free(record->surfaces, TRUE);
+    g_array_free(record->images, TRUE);
+    g_hash_table_destroy(record->threads);
+    g_free(record);
+}
+
+static Snapshot_Job *snapshot_job_new(Snapshot_Job_Type type)
+{
+    Snapshot_Job *job = g_new0(Snapshot_Job, 1);
+    job->type = type;
+    job->ref = 1;
+    g_mutex_init(&job->lock);
+    g_cond_init(&job->cond);
+    g_queue_init(&job->sections);
+    return job;
+}
+
+static void snapshot_job_unref(Snapshot_Job *job)
+{
+    if (qatomic_dec_fetch(&job->ref) != 0)
+    {
+        return;
+    }
+
+    GByteArray *section;
+    while ((section = g_queue_pop_head(&job->sections)) != NULL)
+    {
+        g_byte_array_free(section, TRUE);
+    }
+    g_mutex_clear(&job->lock);
+    g_cond_clear(&job->cond);
+    g_free(job);
+}
+
+static void snapshot_job_finish(Snapshot_Job *job, int error)
+{
+    g_mutex_lock(&job->lock);
+    job->finished = true;
+    job->error = error;
+    g_cond_broadcast(&job->cond);
+    g_mutex_unlock(&job->lock);
+}
+
+/**
+ * @brief 把生成好的段交给pre_save，队列满了就等待，pre_save放弃之后直接丢掉
+ *
+ * @return pre_save是否已经放弃
+ */
+static bool snapshot_job_push(Snapshot_Job *job, GByteArray *section)
+{
+    g_mutex_lock(&job->lock);
+    while (g_queue_get_length(&job->sections) >= MAX_QUEUED_SECTIONS && !job->aborted)
+    {
+        g_cond_wait(&job->cond, &job->lock);
+    }
+
+    bool aborted = job->aborted;
+    if (aborted)
+    {
+        g_byte_array_free(section, TRUE);
+    }
+    else
+    {
+        g_queue_push_tail(&job->sections, section);
+        g_cond_broadcast(&job->cond);
+    }
+    g_mutex_unlock(&job->lock);
+
+    return aborted;
+}
+
+/**
+ * @brief 记录当前线程中会被快照代码改动的GL状态，并设置成读写像素需要的默认值
+ */
+static void snapshot_gl_state_enter(Snapshot_GL_State *state)
+{
+    for (int i = 0; i < PROBE_TARGET_NUM; i++)
+    {
+        glGetIntegerv(probe_bindings[i], &state->textures[i]);
+    }
+    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &state->pack_buffer);
+    glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &state->unpack_buffer);
+    glGetIntegerv(GL_COPY_READ_BUFFER_BINDING, &state->copy_read_buffer);
+    glGetIntegerv(GL_COPY_WRITE_BUFFER_BINDING, &state->copy_write_buffer);
+    glGetIntegerv(GL_RENDERBUFFER_BINDING, &state->renderbuffer);
+
+    for (int i = 0; i < 6; i++)
+    {
+        glGetIntegerv(pack_params[i], &state->pack[i]);
+        glGetIntegerv(unpack_params[i], &state->unpack[i]);
+
+        glPixelStorei(pack_params[i], i == 0 ? 1 : 0);
+        glPixelStorei(unpack_params[i], i == 0 ? 1 : 0);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+static void snapshot_gl_state_leave(Snapshot_GL_State *state)
+{
+    for (int i = 0; i < PROBE_TARGET_NUM; i++)
+    {
+        glBindTexture(probe_targets[i], state->textures[i]);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, state->pack_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, state->unpack_buffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, state->copy_read_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, state->copy_write_buffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, state->renderbuffer);
+
+    for (int i = 0; i < 6; i++)
+    {
+        glPixelStorei(pack_params[i], state->pack[i]);
+        glPixelStorei(unpack_params[i], state->unpack[i]);
+    }
+}
+
+static void snapshot_make_current(Opengl_Context *context)
+{
+    if (context->context_flags & DGL_CONTEXT_FLAG_INDEPENDENT_MODE_BIT)
+    {
+        glfwMakeContextCurrent((GLFWwindow *)context->window);
+    }
+    else
+    {
+        egl_makeCurrent(context->window);
+    }
+}
+
+static void snapshot_release_current(Opengl_Context *context)
+{
+    if (context->context_flags & DGL_CONTEXT_FLAG_INDEPENDENT_MODE_BIT)
+    {
+        glfwMakeContextCurrent(NULL);
+    }
+    else
+    {
+        egl_makeCurrent(NULL);
+    }
+}
+
+/**
+ * @brief 读写像素时每个像素的字节数，pack与unpack的对齐都设置成了1
+ *
+ * @return 不认识的组合返回0，这种数据不保存
+ */
+static int snapshot_pixel_size(GLenum format, GLenum type)
+{
+    int components = 0;
+    switch (format)
+    {
+    case GL_RED:
+    case GL_RED_INTEGER:
+    case GL_GREEN:
+    case GL_BLUE:
+    case GL_ALPHA:
+    case GL_LUMINANCE:
+    case GL_DEPTH_COMPONENT:
+    case GL_STENCIL_INDEX:
+        components = 1;
+        break;
+    case GL_RG:
+    case GL_RG_INTEGER:
+    case GL_LUMINANCE_ALPHA:
+    case GL_DEPTH_STENCIL:
+        components = 2;
+        break;
+    case GL_RGB:
+    case GL_BGR:
+    case GL_RGB_INTEGER:
+    case GL_BGR_INTEGER:
+        components = 3;
+        break;
+    case GL_RGBA:
+    case GL_BGRA:
+    case GL_RGBA_INTEGER:
+    case GL_BGRA_INTEGER:
+        components = 4;
+        break;
+    default:
+        return 0;
+    }
+
+    switch (type)
+    {
+    case GL_UNSIGNED_BYTE:
+    case GL_BYTE:
+        return components;
+    case GL_UNSIGNED_SHORT:
+    case GL_SHORT:
+    case GL_HALF_FLOAT:
+        return components * 2;
+    case GL_UNSIGNED_INT:
+    case GL_INT:
+    case GL_FLOAT:
+        return components * 4;
+    case GL_UNSIGNED_BYTE_3_3_2:
+    case GL_UNSIGNED_BYTE_2_3_3_REV:
+        return 1;
+    case GL_UNSIGNED_SHORT_5_6_5:
+    case GL_UNSIGNED_SHORT_5_6_5_REV:
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_4_4_4_4_REV:
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+    case GL_UNSIGNED_SHORT_1_5_5_5_REV:
+        return 2;
+    case GL_UNSIGNED_INT_8_8_8_8:
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+    case GL_UNSIGNED_INT_10_10_10_2:
+    case GL_UNSIGNED_INT_2_10_10_10_REV:
+    case GL_UNSIGNED_INT_10F_11F_11F_REV:
+    case GL_UNSIGNED_INT_5_9_9_9_REV:
+    case GL_UNSIGNED_INT_24_8:
+        return 4;
+    case GL_FLOAT_32_UNSIGNED_INT_24_8_REV:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static bool texture_target_is_3d(GLenum target)
+{
+    return target == GL_TEXTURE_3D || target == GL_TEXTURE_2D_ARRAY || target == GL_TEXTURE_CUBE_MAP_ARRAY ||
+           target == GL_TEXTURE_2D_MULTISAMPLE_ARRAY;
+}
+
+static bool texture_target_is_multisample(GLenum target)
+{
+    return target == GL_TEXTURE_2D_MULTISAMPLE || target == GL_TEXTURE_2D_MULTISAMPLE_ARRAY;
+}
+
+static GHashTable *build_reverse_map(Resource_Map_Status *status)
+{
+    GHashTable *map = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    for (unsigned int i = 1; status->resource_id_map != NULL && i <= status->max_id; i++)
+    {
+        long long host_id = status->resource_id_map[i];
+        if (host_id != 0)
+        {
+            g_hash_table_insert(map, GUINT_TO_POINTER((GLuint)llabs(host_id)), GUINT_TO_POINTER(i));
+        }
+    }
+    return map;
+}
+
+static GLuint reverse_lookup(GHashTable *map, GLuint host_id)
+{
+    if (host_id == 0)
+    {
+        return 0;
+    }
+    return GPOINTER_TO_UINT(g_hash_table_lookup(map, GUINT_TO_POINTER(host_id)));
+}
+
+static void save_section_begin(Save_State *state, uint32_t tag)
+{
+    state->section = g_byte_array_sized_new(SECTION_HEADER_SIZE + 4096);
+    put_u32(state->section, tag);
+    put_u32(state->section, SECTION_VERSION);
+    put_u64(state->section, 0);
+}
+
+/**
+ * @brief 等待暂存PBO中这一批拷贝完成，映射一次后把数据写回各自的段中
+ */
+static void save_flush(Save_State *state)
+{
+    if (state->fills->len == 0)
+    {
+        return;
+    }
+
+    GLsync sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GLenum ret;
+    do
+    {
+        ret = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 100 * SCALE_MS);
+    } while (ret == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(sync);
+
+    const uint8_t *staging = NULL;
+    if (ret != GL_WAIT_FAILED)
+    {
+        staging = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, state->staging_used, GL_MAP_READ_BIT);
+    }
+
+    if (staging == NULL)
+    {
+        LOGE("error! snapshot staging buffer map failed, wait %x error %x", ret, glGetError());
+        state->error = -1;
+    }
+    else
+    {
+        for (int i = 0; i < state->fills->len; i++)
+        {
+            Snapshot_Fill *fill = &g_array_index(state->fills, Snapshot_Fill, i);
+            memcpy(state->section->data + fill->section_off, staging + fill->staging_off, fill->len);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+
+    g_array_set_size(state->fills, 0);
+    state->staging_used = 0;
+}
+
+static void save_section_end(Save_State *state)
+{
+    save_flush(state);
+
+    stq_be_p(state->section->data + 8, state->section->len - SECTION_HEADER_SIZE);
+    if (snapshot_job_push(state->job, state->section) && state->error == 0)
+    {
+        state->error = -1;
+    }
+    state->section = NULL;
+}
+
+static void save_objects_begin(Save_State *state)
+{
+    save_section_begin(state, SECTION_OBJECTS);
+    put_u64(state->section, state->process_id);
+    put_u32(state->section, state->group);
+}
+
+/**
+ * @brief 在段中预留len字节，数据由GPU拷贝到暂存PBO中，flush时再写回
+ *
+ * @return 数据在暂存PBO中的偏移，作为glGetTexImage等函数的pixels参数
+ */
+static GLintptr save_reserve(Save_State *state, GLsizeiptr len)
+{
+    GLsizeiptr aligned = ROUND_UP(len, 16);
+
+    if (state->staging_used + aligned > state->staging_size)
+    {
+        save_flush(state);
+        if (aligned > state->staging_size)
+        {
+            glBufferData(GL_PIXEL_PACK_BUFFER, aligned, NULL, GL_STREAM_READ);
+            state->staging_size = aligned;
+        }
+    }
+
+    Snapshot_Fill fill = {
+        .section_off = state->section->len,
+        .staging_off = state->staging_used,
+        .len = len,
+    };
+    g_byte_array_set_size(state->section, state->section->len + len);
+    g_array_append_val(state->fills, fill);
+    state->staging_used += aligned;
+
+    return fill.staging_off;
+}
+
+/**
+ * @brief 取得纹理的target，没有DSA时只能依次尝试绑定，绑定成功的就是它的target
+ */
+static GLenum texture_target(GLuint texture)
+{
+    if (host_opengl_version >= 45)
+    {
+        GLint target = 0;
+        glGetTextureParameteriv(texture, GL_TEXTURE_TARGET, &target);
+        return target;
+    }
+
+    while (glGetError() != GL_NO_ERROR)
+    {
+    }
+    for (int i = 0; i < PROBE_TARGET_NUM; i++)
+    {
+        glBindTexture(probe_targets[i], texture);
+        if (glGetError() == GL_NO_ERROR)
+        {
+            return probe_targets[i];
+        }
+    }
+    return 0;
+}
+
+static void texture_readback_format(GLenum target, GLenum face, int level, GLenum internal_format, GLenum *format,
+                                    GLenum *type)
+{
+    if (host_opengl_version >= 43)
+    {
+        GLint value = 0;
+        glGetInternalformativ(target, internal_format, GL_TEXTURE_IMAGE_FORMAT, 1, &value);
+        *format = value;
+        value = 0;
+        glGetInternalformativ(target, internal_format, GL_TEXTURE_IMAGE_TYPE, 1, &value);
+        *type = value;
+        if (snapshot_pixel_size(*format, *type) > 0)
+        {
+            return;
+        }
+    }
+
+    GLint depth_size = 0;
+    GLint stencil_size = 0;
+    GLint depth_type = 0;
+    GLint red_type = 0;
+    GLint sizes[4] = {0};
+
+    glGetTexLevelParameteriv(face, level, GL_TEXTURE_DEPTH_SIZE, &depth_size);
+    glGetTexLevelParameteriv(face, level, GL_TEXTURE_STENCIL_SIZE, &stencil_size);
+    glGetTexLevelParameteriv(face, level, GL_TEXTURE_DEPTH_TYPE, &depth_type);
+    glGetTexLevelParameteriv(face, level, GL_TEXTURE_RED_TYPE, &red_type);
+    glGetTexLevelParameteriv(face, level, GL_TEXTURE_RED_SIZE, &sizes[0]);
+    glGetTexLevelParameteriv(face, level, GL_TEXTURE_GREEN_SIZE, &sizes[1]);
+    glGetTexLevelParameteriv(face, level, GL_TEXTURE_BLUE_SIZE, &sizes[2]);
+    glGetTexLevelParameteriv(face, level, GL_TEXTURE_ALPHA_SIZE, &sizes[3]);
+
+    if (depth_size > 0 && stencil_size > 0)
+    {
+        *format = GL_DEPTH_STENCIL;
+        *type = depth_type == GL_FLOAT ? GL_FLOAT_32_UNSIGNED_INT_24_8_REV : GL_UNSIGNED_INT_24_8;
+    }
+    else if (depth_size > 0)
+    {
+        *format = GL_DEPTH_COMPONENT;
+        *type = GL_FLOAT;
+    }
+    else if (stencil_size > 0)
+    {
+        *format = GL_STENCIL_INDEX;
+        *type = GL_UNSIGNED_BYTE;
+    }
+    else if (red_type == GL_INT || red_type == GL_UNSIGNED_INT)
+    {
+        *format = GL_RGBA_INTEGER;
+        *type = red_type;
+    }
+    else if (red_type == GL_UNSIGNED_NORMALIZED && sizes[0] <= 8 && sizes[1] <= 8 && sizes[2] <= 8 && sizes[3] <= 8)
+    {
+        *format = GL_RGBA;
+        *type = GL_UNSIGNED_BYTE;
+    }
+    else
+    {
+        *format = GL_RGBA;
+        *type = GL_FLOAT;
+    }
+}
+
+/**
+ * @brief 纹理记录：target | 不可变层数 | 采样数 | 固定采样位置 | 参数 | 层数 | 每层的大小、格式与每个面的数据
+ */
+static void save_texture(Save_State *state, GLuint texture, char is_init)
+{
+    GByteArray *buf = state->section;
+
+    // 只生成过名字、还没有绑定过的纹理没有target
+    GLenum target = is_init != 0 ? texture_target(texture) : 0;
+    put_u32(buf, target);
+    if (target == 0 || target == GL_TEXTURE_BUFFER)
+    {
+        return;
+    }
+
+    glBindTexture(target, texture);
+
+    GLint immutable = 0;
+    GLint immutable_levels = 0;
+    GLint samples = 0;
+    GLint fixed_locations = 1;
+    bool multisample = texture_target_is_multisample(target);
+
+    glGetTexParameteriv(target, GL_TEXTURE_IMMUTABLE_FORMAT, &immutable);
+    if (immutable)
+    {
+        glGetTexParameteriv(target, GL_TEXTURE_IMMUTABLE_LEVELS, &immutable_levels);
+    }
+    if (multisample)
+    {
+        glGetTexLevelParameteriv(target, 0, GL_TEXTURE_SAMPLES, &samples);
+        glGetTexLevelParameteriv(target, 0, GL_TEXTURE_FIXED_SAMPLE_LOCATIONS, &fixed_locations);
+    }
+    put_u32(buf, immutable ? MAX(immutable_levels, 1) : 0);
+    put_u32(buf, samples);
+    put_u32(buf, fixed_locations);
+
+    // 多重采样纹理没有采样参数
+    if (!multisample)
+    {
+        for (int i = 0; i < ARRAY_SIZE(sampler_int_params); i++)
+        {
+            GLint value = 0;
+            glGetTexParameteriv(target, sampler_int_params[i], &value);
+            put_u32(buf, value);
+        }
+        for (int i = 0; i < ARRAY_SIZE(texture_int_params); i++)
+        {
+            GLint value = 0;
+            glGetTexParameteriv(target, texture_int_params[i], &value);
+            put_u32(buf, value);
+        }
+        for (int i = 0; i < ARRAY_SIZE(float_params); i++)
+        {
+            GLfloat value = 0;
+            glGetTexParameterfv(target, float_params[i], &value);
+            put_u32(buf, float_as_uint32(value));
+        }
+    }
+
+    guint level_num_off = put_placeholder(buf);
+    int level_num = 0;
+    int face_num = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+    GLenum face0 = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+
+    for (int level = 0; level < (multisample ? 1 : MAX_TEXTURE_LEVELS); level++)
+    {
+        GLint width = 0;
+        GLint height = 0;
+        GLint depth = 0;
+        GLint internal_format = 0;
+        GLint compressed = 0;
+        GLenum format = 0;
+        GLenum type = 0;
+
+        glGetTexLevelParameteriv(face0, level, GL_TEXTURE_WIDTH, &width);
+        if (width <= 0)
+        {
+            continue;
+        }
+        glGetTexLevelParameteriv(face0, level, GL_TEXTURE_HEIGHT, &height);
+        glGetTexLevelParameteriv(face0, level, GL_TEXTURE_DEPTH, &depth);
+        glGetTexLevelParameteriv(face0, level, GL_TEXTURE_INTERNAL_FORMAT, &internal_format);
+        glGetTexLevelParameteriv(face0, level, GL_TEXTURE_COMPRESSED, &compressed);
+
+        if (!compressed && !multisample)
+        {
+            texture_readback_format(target, face0, level, internal_format, &format, &type);
+        }
+
+        // 这里取到的参数都是调用之前的，buf在save_reserve时可能重新分配，因此每次都用state->section
+        buf = state->section;
+        put_u32(buf, level);
+        put_u32(buf, width);
+        put_u32(buf, height);
+        put_u32(buf, MAX(depth, 1));
+        put_u32(buf, internal_format);
+        put_u32(buf, compressed);
+        put_u32(buf, format);
+        put_u32(buf, type);
+
+        for (int face = 0; face < face_num; face++)
+        {
+            GLenum face_target = face_num == 6 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target;
+            GLint size = 0;
+
+            if (multisample)
+            {
+                size = 0;
+            }
+            else if (compressed)
+            {
+                glGetTexLevelParameteriv(face_target, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+            }
+            else
+            {
+                size = width * height * MAX(depth, 1) * snapshot_pixel_size(format, type);
+            }
+
+            put_u32(state->section, MAX(size, 0));
+            if (size <= 0)
+            {
+                continue;
+            }
+
+            GLintptr offset = save_reserve(state, size);
+            if (compressed)
+            {
+                glGetCompressedTexImage(face_target, level, (void *)offset);
+            }
+            else
+            {
+                glGetTexImage(face_target, level, format, type, (void *)offset);
+            }
+        }
+        level_num++;
+    }
+
+    patch_u32(state->section, level_num_off, level_num);
+}
+
+/**
+ * @brief 缓冲区记录：大小 | usage | 是否不可变 | storage flags | 数据
+ */
+static void save_buffer(Save_State *state, GLuint buffer)
+{
+    GLint64 size = 0;
+    GLint usage = GL_STATIC_DRAW;
+    GLint immutable = 0;
+    GLint flags = 0;
+    GLint mapped = 0;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glGetBufferParameteri64v(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+    glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_USAGE, &usage);
+    glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_MAPPED, &mapped);
+    if (host_opengl_version >= 44)
+    {
+        glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_IMMUTABLE_STORAGE, &immutable);
+        glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_STORAGE_FLAGS, &flags);
+    }
+
+    put_u64(state->section, size);
+    put_u32(state->section, usage);
+    put_u32(state->section, immutable);
+    put_u32(state->section, flags);
+
+    // 没有持久映射的缓冲区在映射期间不能拷贝，只保存大小
+    if (size <= 0 || size > UINT32_MAX || (mapped && !(flags & GL_MAP_PERSISTENT_BIT)))
+    {
+        put_u32(state->section, 0);
+        return;
+    }
+
+    put_u32(state->section, size);
+    GLintptr offset = save_reserve(state, size);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_PIXEL_PACK_BUFFER, 0, offset, size);
+}
+
+static void save_renderbuffer(Save_State *state, GLuint renderbuffer)
+{
+    GLint width = 0;
+    GLint height = 0;
+    GLint internal_format = 0;
+    GLint samples = 0;
+
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+    glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_WIDTH, &width);
+    glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_HEIGHT, &height);
+    glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_INTERNAL_FORMAT, &internal_format);
+    glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_SAMPLES, &samples);
+
+    put_u32(state->section, width);
+    put_u32(state->section, height);
+    put_u32(state->section, internal_format);
+    put_u32(state->section, samples);
+}
+
+static void save_sampler(Save_State *state, GLuint sampler)
+{
+    for (int i = 0; i < ARRAY_SIZE(sampler_int_params); i++)
+    {
+        GLint value = 0;
+        glGetSamplerParameteriv(sampler, sampler_int_params[i], &value);
+        put_u32(state->section, value);
+    }
+    for (int i = 0; i < ARRAY_SIZE(float_params); i++)
+    {
+        GLfloat value = 0;
+        glGetSamplerParameterfv(sampler, float_params[i], &value);
+        put_u32(state->section, float_as_uint32(value));
+    }
+}
+
+static void put_shader_source(GByteArray *buf, GLuint shader)
+{
+    GLint len = 0;
+    glGetShaderiv(shader, GL_SHADER_SOURCE_LENGTH, &len);
+
+    char *source = g_malloc0(len + 1);
+    if (len > 0)
+    {
+        glGetShaderSource(shader, len + 1, NULL, source);
+    }
+    put_string(buf, source);
+    g_free(source);
+}
+
+static void save_shader(Save_State *state, GLuint shader)
+{
+    GLint type = 0;
+    GLint compiled = 0;
+
+    glGetShaderiv(shader, GL_SHADER_TYPE, &type);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+
+    put_u32(state->section, type);
+    put_u32(state->section, compiled);
+    put_shader_source(state->section, shader);
+}
+
+static int uniform_components(GLenum type)
+{
+    switch (type)
+    {
+    case GL_FLOAT_VEC2:
+    case GL_INT_VEC2:
+    case GL_UNSIGNED_INT_VEC2:
+    case GL_BOOL_VEC2:
+        return 2;
+    case GL_FLOAT_VEC3:
+    case GL_INT_VEC3:
+    case GL_UNSIGNED_INT_VEC3:
+    case GL_BOOL_VEC3:
+        return 3;
+    case GL_FLOAT_VEC4:
+    case GL_INT_VEC4:
+    case GL_UNSIGNED_INT_VEC4:
+    case GL_BOOL_VEC4:
+    case GL_FLOAT_MAT2:
+        return 4;
+    case GL_FLOAT_MAT2x3:
+    case GL_FLOAT_MAT3x2:
+        return 6;
+    case GL_FLOAT_MAT2x4:
+    case GL_FLOAT_MAT4x2:
+        return 8;
+    case GL_FLOAT_MAT3:
+        return 9;
+    case GL_FLOAT_MAT3x4:
+    case GL_FLOAT_MAT4x3:
+        return 12;
+    case GL_FLOAT_MAT4:
+        return 16;
+    default:
+        return 1;
+    }
+}
+
+static bool uniform_is_float(GLenum type)
+{
+    switch (type)
+    {
+    case GL_FLOAT:
+    case GL_FLOAT_VEC2:
+    case GL_FLOAT_VEC3:
+    case GL_FLOAT_VEC4:
+    case GL_FLOAT_MAT2:
+    case GL_FLOAT_MAT3:
+    case GL_FLOAT_MAT4:
+    case GL_FLOAT_MAT2x3:
+    case GL_FLOAT_MAT2x4:
+    case GL_FLOAT_MAT3x2:
+    case GL_FLOAT_MAT3x4:
+    case GL_FLOAT_MAT4x2:
+    case GL_FLOAT_MAT4x3:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool uniform_is_uint(GLenum type)
+{
+    return type == GL_UNSIGNED_INT || type == GL_UNSIGNED_INT_VEC2 || type == GL_UNSIGNED_INT_VEC3 ||
+           type == GL_UNSIGNED_INT_VEC4;
+}
+
+/**
+ * @brief 恢复uniform的值，采样器与image的uniform按int设置
+ */
+static void set_uniform(GLuint program, GLint location, GLenum type, const uint32_t *values)
+{
+    const GLfloat *f = (const GLfloat *)values;
+    const GLint *i = (const GLint *)values;
+    const GLuint *u = (const GLuint *)values;
+
+    switch (type)
+    {
+    case GL_FLOAT:
+        glProgramUniform1fv(program, location, 1, f);
+        break;
+    case GL_FLOAT_VEC2:
+        glProgramUniform2fv(program, location, 1, f);
+        break;
+    case GL_FLOAT_VEC3:
+        glProgramUniform3fv(program, location, 1, f);
+        break;
+    case GL_FLOAT_VEC4:
+        glProgramUniform4fv(program, location, 1, f);
+        break;
+    case GL_FLOAT_MAT2:
+        glProgramUniformMatrix2fv(program, location, 1, GL_FALSE, f);
+        break;
+    case GL_FLOAT_MAT3:
+        glProgramUniformMatrix3fv(program, location, 1, GL_FALSE, f);
+        break;
+    case GL_FLOAT_MAT4:
+        glProgramUniformMatrix4fv(program, location, 1, GL_FALSE, f);
+        break;
+    case GL_FLOAT_MAT2x3:
+        glProgramUniformMatrix2x3fv(program, location, 1, GL_FALSE, f);
+        break;
+    case GL_FLOAT_MAT2x4:
+        glProgramUniformMatrix2x4fv(program, location, 1, GL_FALSE, f);
+        break;
+    case GL_FLOAT_MAT3x2:
+        glProgramUniformMatrix3x2fv(program, location, 1, GL_FALSE, f);
+        break;
+    case GL_FLOAT_MAT3x4:
+        glProgramUniformMatrix3x4fv(program, location, 1, GL_FALSE, f);
+        break;
+    case GL_FLOAT_MAT4x2:
+        glProgramUniformMatrix4x2fv(program, location, 1, GL_FALSE, f);
+        break;
+    case GL_FLOAT_MAT4x3:
+        glProgramUniformMatrix4x3fv(program, location, 1, GL_FALSE, f);
+        break;
+    case GL_UNSIGNED_INT:
+        glProgramUniform1uiv(program, location, 1, u);
+        break;
+    case GL_UNSIGNED_INT_VEC2:
+        glProgramUniform2uiv(program, location, 1, u);
+        break;
+    case GL_UNSIGNED_INT_VEC3:
+        glProgramUniform3uiv(program, location, 1, u);
+        break;
+    case GL_UNSIGNED_INT_VEC4:
+        glProgramUniform4uiv(program, location, 1, u);
+        break;
+    case GL_INT_VEC2:
+    case GL_BOOL_VEC2:
+        glProgramUniform2iv(program, location, 1, i);
+        break;
+    case GL_INT_VEC3:
+    case GL_BOOL_VEC3:
+        glProgramUniform3iv(program, location, 1, i);
+        break;
+    case GL_INT_VEC4:
+    case GL_BOOL_VEC4:
+        glProgramUniform4iv(program, location, 1, i);
+        break;
+    default:
+        glProgramUniform1iv(program, location, 1, i);
+        break;
+    }
+}
+
+/**
+ * @brief program记录：标志 | 二进制 | 附加的着色器 | attrib位置 | transform feedback变量 | uniform block绑定 | uniform的值
+ * 二进制在恢复的机器上不一定能用，因此同时保存重新链接需要的信息
+ */
+static void save_program(Save_State *state, GLuint program, Group_Maps *maps)
+{
+    GByteArray *buf = state->section;
+    GLint linked = 0;
+    GLint separable = 0;
+    GLint count = 0;
+    GLint max_len = 0;
+    GLint len = 0;
+
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    glGetProgramiv(program, GL_PROGRAM_SEPARABLE, &separable);
+    put_u32(buf, (linked ? PROGRAM_LINKED : 0) | (separable ? PROGRAM_SEPARABLE : 0));
+
+    GLint binary_len = 0;
+    if (linked)
+    {
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binary_len);
+    }
+    if (binary_len > 0)
+    {
+        void *binary = g_malloc(binary_len);
+        GLenum binary_format = 0;
+        GLsizei binary_real_len = 0;
+        glGetProgramBinary(program, binary_len, &binary_real_len, &binary_format, binary);
+        put_u32(buf, binary_format);
+        put_bytes(buf, binary, binary_real_len);
+        g_free(binary);
+    }
+    else
+    {
+        put_u32(buf, 0);
+        put_u32(buf, 0);
+    }
+
+    glGetProgramiv(program, GL_ATTACHED_SHADERS, &count);
+    GLuint *shaders = g_new0(GLuint, count + 1);
+    glGetAttachedShaders(program, count, &count, shaders);
+    put_u32(buf, count);
+    for (int i = 0; i < count; i++)
+    {
+        GLint type = 0;
+        glGetShaderiv(shaders[i], GL_SHADER_TYPE, &type);
+        // guest已经删除、只是还附加在program上的着色器没有guest id，只用来重新链接
+        put_u32(buf, reverse_lookup(maps->shaders, shaders[i]));
+        put_u32(buf, type);
+        put_shader_source(buf, shaders[i]);
+    }
+    g_free(shaders);
+
+    // 名字的缓冲区按各类名字中最长的申请
+    GLint name_len = 256;
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_len);
+    name_len = MAX(name_len, max_len);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_len);
+    name_len = MAX(name_len, max_len);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_len);
+    name_len = MAX(name_len, max_len);
+    glGetProgramiv(program, GL_TRANSFORM_FEEDBACK_VARYING_MAX_LENGTH, &max_len);
+    name_len = MAX(name_len, max_len);
+    char *name = g_malloc0(name_len + 16);
+
+    count = 0;
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+    guint count_off = put_placeholder(buf);
+    int saved = 0;
+    for (int i = 0; i < count; i++)
+    {
+        GLint size;
+        GLenum type;
+        glGetActiveAttrib(program, i, name_len, &len, &size, &type, name);
+        if (strncmp(name, "gl_", 3) == 0)
+        {
+            continue;
+        }
+        put_string(buf, name);
+        put_u32(buf, glGetAttribLocation(program, name));
+        saved++;
+    }
+    patch_u32(buf, count_off, saved);
+
+    count = 0;
+    GLint buffer_mode = GL_INTERLEAVED_ATTRIBS;
+    glGetProgramiv(program, GL_TRANSFORM_FEEDBACK_VARYINGS, &count);
+    glGetProgramiv(program, GL_TRANSFORM_FEEDBACK_BUFFER_MODE, &buffer_mode);
+    put_u32(buf, buffer_mode);
+    put_u32(buf, count);
+    for (int i = 0; i < count; i++)
+    {
+        GLsizei size;
+        GLenum type;
+        glGetTransformFeedbackVarying(program, i, name_len, &len, &size, &type, name);
+        put_string(buf, name);
+    }
+
+    count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    put_u32(buf, count);
+    for (int i = 0; i < count; i++)
+    {
+        GLint binding = 0;
+        glGetActiveUniformBlockName(program, i, name_len, &len, name);
+        glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_BINDING, &binding);
+        put_string(buf, name);
+        put_u32(buf, binding);
+    }
+
+    count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    count_off = put_placeholder(buf);
+    saved = 0;
+    for (int i = 0; i < count; i++)
+    {
+        GLint size = 0;
+        GLenum type = 0;
+        GLint block = -1;
+        GLuint index = i;
+
+        glGetActiveUniform(program, i, name_len, &len, &size, &type, name);
+        glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &block);
+        // block中的uniform在缓冲区里，has_EGL_image_external每次绘制前都会重新设置
+        if (block != -1 || strncmp(name, "gl_", 3) == 0 || strcmp(name, "has_EGL_image_external") == 0)
+        {
+            continue;
+        }
+
+        // 数组的名字以[0]结尾，逐个元素取位置
+        char *bracket = strrchr(name, '[');
+        if (bracket != NULL)
+        {
+            *bracket = 0;
+        }
+
+        for (int element = 0; element < size; element++)
+        {
+            char element_name[name_len + 16];
+            uint32_t values[16] = {0};
+
+            if (bracket != NULL)
+            {
+                snprintf(element_name, sizeof(element_name), "%s[%d]", name, element);
+            }
+            else
+            {
+                snprintf(element_name, sizeof(element_name), "%s", name);
+            }
+
+            GLint location = glGetUniformLocation(program, element_name);
+            if (location < 0)
+            {
+                continue;
+            }
+
+            if (uniform_is_float(type))
+            {
+                glGetUniformfv(program, location, (GLfloat *)values);
+            }
+            else if (uniform_is_uint(type))
+            {
+                glGetUniformuiv(program, location, (GLuint *)values);
+            }
+            else
+            {
+                glGetUniformiv(program, location, (GLint *)values);
+            }
+
+            put_string(buf, element_name);
+            put_u32(buf, type);
+            for (int c = 0; c < uniform_components(type); c++)
+            {
+                put_u32(buf, values[c]);
+            }
+            saved++;
+        }
+    }
+    patch_u32(buf, count_off, saved);
+
+    g_free(name);
+}
+
+/**
+ * @brief 找到共享纹理连接的gbuffer：先看EGLImage绑定时记录的指针，再在进程的EGLImage中按纹理查找
+ *
+ * @return 找不到时返回NULL，这个纹理按普通纹理保存
+ */
+static Hardware_Buffer *find_shared_gbuffer(Resource_Map_Status *status, Process_Context *process, GLuint guest_id,
+                                            GLuint host_id, int *process_image)
+{
+    if (status->gbuffer_ptr_map != NULL && guest_id < status->gbuffer_map_max_size &&
+        status->gbuffer_ptr_map[guest_id] != NULL)
+    {
+        *process_image = 0;
+        return status->gbuffer_ptr_map[guest_id];
+    }
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, process->gbuffer_map);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        Hardware_Buffer *gbuffer = (Hardware_Buffer *)value;
+        if (gbuffer->data_texture == host_id)
+        {
+            *process_image = 1;
+            return gbuffer;
+        }
+    }
+    return NULL;
+}
+
+static void save_group_objects(Save_State *state, Process_Context *process, Group_Maps *maps)
+{
+    Share_Resources *share = maps->share;
+    struct
+    {
+        uint32_t type;
+        Resource_Map_Status *status;
+    } types[] = {
+        {OBJECT_TEXTURE, &share->texture_resource},
+        {OBJECT_BUFFER, &share->buffer_resource},
+        {OBJECT_RENDERBUFFER, &share->render_buffer_resource},
+        {OBJECT_SAMPLER, &share->sample_resource},
+        {OBJECT_SHADER, &share->shader_resource},
+        {OBJECT_PROGRAM, &share->program_resource},
+        {OBJECT_SYNC, &share->sync_resource},
+    };
+
+    save_objects_begin(state);
+
+    for (int t = 0; t < ARRAY_SIZE(types) && state->error == 0; t++)
+    {
+        Resource_Map_Status *status = types[t].status;
+
+        for (unsigned int id = 1; status->resource_id_map != NULL && id <= status->max_id && state->error == 0; id++)
+        {
+            long long host_id = status->resource_id_map[id];
+            if (host_id == 0)
+            {
+                continue;
+            }
+
+            uint32_t type = types[t].type;
+            Hardware_Buffer *gbuffer = NULL;
+            int process_image = 0;
+            if (type == OBJECT_TEXTURE && host_id < 0)
+            {
+                host_id = -host_id;
+                gbuffer = find_shared_gbuffer(status, process, id, host_id, &process_image);
+                if (gbuffer != NULL)
+                {
+                    type = OBJECT_SHARED_TEXTURE;
+                }
+            }
+
+            put_u32(state->section, type);
+            put_u32(state->section, id);
+            guint len_off = put_placeholder(state->section);
+            guint start = state->section->len;
+
+            switch (type)
+            {
+            case OBJECT_TEXTURE:
+                save_texture(state, host_id, status->resource_is_init[id]);
+                break;
+            case OBJECT_SHARED_TEXTURE:
+                put_u64(state->section, gbuffer->gbuffer_id);
+                put_u32(state->section, process_image);
+                break;
+            case OBJECT_BUFFER:
+                save_buffer(state, host_id);
+                break;
+            case OBJECT_RENDERBUFFER:
+                save_renderbuffer(state, host_id);
+                break;
+            case OBJECT_SAMPLER:
+                save_sampler(state, host_id);
+                break;
+            case OBJECT_SHADER:
+                save_shader(state, host_id);
+                break;
+            case OBJECT_PROGRAM:
+                save_program(state, host_id, maps);
+                break;
+            default:
+                // sync对象恢复时重新创建一个fence，不需要内容
+                break;
+            }
+
+            patch_u32(state->section, len_off, state->section->len - start);
+
+            if (state->section->len >= SECTION_SPLIT_SIZE)
+            {
+                save_section_end(state);
+                save_objects_begin(state);
+            }
+        }
+    }
+
+    save_section_end(state);
+}
+
+static void save_context(Save_State *state, uint64_t guest_context, Opengl_Context *context, uint32_t group,
+                         Group_Maps *maps)
+{
+    GByteArray *buf = state->section;
+    Resource_Context *resources = &context->resource_status;
+    Resource_Map_Status *exclusive[EXCLUSIVE_TYPE_NUM] = {
+        resources->frame_buffer_resource,
+        resources->program_pipeline_resource,
+        resources->transform_feedback_resource,
+        resources->vertex_array_resource,
+        resources->query_resource,
+    };
+
+    put_u64(buf, guest_context);
+    put_u32(buf, group);
+    put_u32(buf, context->context_flags);
+
+    // 容器对象只保存guest id，VAO 0是context自己的vao0，不需要保存
+    for (int i = 0; i < EXCLUSIVE_TYPE_NUM; i++)
+    {
+        Resource_Map_Status *status = exclusive[i];
+        guint count_off = put_placeholder(buf);
+        int count = 0;
+        for (unsigned int id = 1; status->resource_id_map != NULL && id <= status->max_id; id++)
+        {
+            if (status->resource_id_map[id] != 0)
+            {
+                put_u32(buf, id);
+                count++;
+            }
+        }
+        patch_u32(buf, count_off, count);
+    }
+
+    Texture_Binding_Status *texture_status = &context->texture_binding_status;
+    GLuint *bound_textures[PROBE_TARGET_NUM] = {
+        texture_status->guest_current_texture_2D,
+        texture_status->guest_current_texture_cube_map,
+        texture_status->guest_current_texture_3D,
+        texture_status->guest_current_texture_2D_array,
+        texture_status->guest_current_texture_2D_multisample,
+        texture_status->guest_current_texture_2D_multisample_array,
+        texture_status->guest_current_texture_cube_map_array,
+        texture_status->guest_current_texture_buffer,
+    };
+
+    put_u32(buf, texture_status->guest_current_active_texture);
+    guint count_off = put_placeholder(buf);
+    int count = 0;
+    for (unsigned int unit = 0; unit <= texture_status->now_max_texture_unit && unit < texture_status->texture_unit_num;
+         unit++)
+    {
+        for (int i = 0; i < PROBE_TARGET_NUM; i++)
+        {
+            GLuint guest_id = reverse_lookup(maps->textures, bound_textures[i][unit]);
+            if (guest_id != 0)
+            {
+                put_u32(buf, unit);
+                put_u32(buf, probe_targets[i]);
+                put_u32(buf, guest_id);
+                count++;
+            }
+        }
+    }
+    patch_u32(buf, count_off, count);
+
+    put_u32(buf, reverse_lookup(maps->programs, context->current_program));
+
+    Buffer_Status *buffer_status = &context->bound_buffer_status.buffer_status;
+    count_off = put_placeholder(buf);
+    count = 0;
+    for (int i = 0; i < ARRAY_SIZE(buffer_binding_targets); i++)
+    {
+        GLenum target = buffer_binding_targets[i];
+        // 其他VAO的EBO属于VAO本身，VAO恢复后是空的
+        if (target == GL_ELEMENT_ARRAY_BUFFER && buffer_status->guest_vao != context->vao0)
+        {
+            continue;
+        }
+        GLuint guest_id = reverse_lookup(maps->buffers, get_guest_binding_buffer(context, target));
+        if (guest_id != 0)
+        {
+            put_u32(buf, target);
+            put_u32(buf, guest_id);
+            count++;
+        }
+    }
+    patch_u32(buf, count_off, count);
+}
+
+typedef struct Thread_Collect
+{
+    Process_Context *process;
+    GPtrArray *threads;
+} Thread_Collect;
+
+static void collect_process_thread(gpointer key, gpointer value, gpointer user_data)
+{
+    Render_Thread_Context *thread_context = (Render_Thread_Context *)value;
+    Thread_Collect *collect = (Thread_Collect *)user_data;
+
+    if (thread_context->process_context == collect->process)
+    {
+        g_ptr_array_add(collect->threads, thread_context);
+    }
+}
+
+static void save_process(Save_State *state, uint64_t process_id, Process_Context *process)
+{
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+
+    GArray *groups = g_array_new(FALSE, TRUE, sizeof(Group_Maps));
+    GPtrArray *context_keys = g_ptr_array_new();
+    GArray *context_groups = g_array_new(FALSE, TRUE, sizeof(uint32_t));
+
+    g_hash_table_iter_init(&iter, process->context_map);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        Share_Resources *share = ((Opengl_Context *)value)->resource_status.share_resources;
+        uint32_t group = 0;
+        while (group < groups->len && g_array_index(groups, Group_Maps, group).share != share)
+        {
+            group++;
+        }
+        if (group == groups->len)
+        {
+            Group_Maps maps = {
+                .share = share,
+                .textures = build_reverse_map(&share->texture_resource),
+                .buffers = build_reverse_map(&share->buffer_resource),
+                .programs = build_reverse_map(&share->program_resource),
+                .shaders = build_reverse_map(&share->shader_resource),
+            };
+            g_array_append_val(groups, maps);
+        }
+        g_ptr_array_add(context_keys, key);
+        g_array_append_val(context_groups, group);
+    }
+
+    save_section_begin(state, SECTION_PROCESS);
+    GByteArray *buf = state->section;
+
+    put_u64(buf, process_id);
+    put_u32(buf, groups->len);
+
+    put_u32(buf, context_keys->len);
+    for (int i = 0; i < context_keys->len; i++)
+    {
+        uint32_t group = g_array_index(context_groups, uint32_t, i);
+        Opengl_Context *context = g_hash_table_lookup(process->context_map, context_keys->pdata[i]);
+        save_context(state, (uint64_t)(uintptr_t)context_keys->pdata[i], context, group,
+                     &g_array_index(groups, Group_Maps, group));
+    }
+
+    guint count_off = put_placeholder(buf);
+    int count = 0;
+    g_hash_table_iter_init(&iter, process->surface_map);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        Window_Buffer *surface = (Window_Buffer *)value;
+        put_u64(buf, (uint64_t)(uintptr_t)key);
+        put_u64(buf, (uint64_t)(uintptr_t)surface->guest_config);
+        put_u32(buf, surface->type);
+        put_u32(buf, surface->width);
+        put_u32(buf, surface->height);
+        count++;
+    }
+    patch_u32(buf, count_off, count);
+
+    // 进程内的EGLImage，记录源纹理所在的共享组
+    count_off = put_placeholder(buf);
+    count = 0;
+    g_hash_table_iter_init(&iter, process->gbuffer_map);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        Hardware_Buffer *gbuffer = (Hardware_Buffer *)value;
+        if (gbuffer->usage_type != GBUFFER_TYPE_TEXTURE)
+        {
+            continue;
+        }
+        for (uint32_t group = 0; group < groups->len; group++)
+        {
+            if (reverse_lookup(g_array_index(groups, Group_Maps, group).textures, gbuffer->data_texture) != 0)
+            {
+                put_u64(buf, gbuffer->gbuffer_id);
+                put_u32(buf, group);
+                count++;
+                break;
+            }
+        }
+    }
+    patch_u32(buf, count_off, count);
+
+    Thread_Collect collect = {
+        .process = process,
+        .threads = g_ptr_array_new(),
+    };
+    express_gpu_foreach_thread(collect_process_thread, &collect);
+
+    put_u32(buf, collect.threads->len);
+    for (int i = 0; i < collect.threads->len; i++)
+    {
+        Render_Thread_Context *thread_context = collect.threads->pdata[i];
+        Window_Buffer *draw = thread_context->render_double_buffer_draw;
+        Window_Buffer *read = thread_context->render_double_buffer_read;
+        Hardware_Buffer *gbuffer = draw != NULL ? draw->gbuffer : NULL;
+
+        put_u64(buf, thread_context->context.thread_id);
+        put_u64(buf, thread_context->opengl_context != NULL
+                         ? (uint64_t)(uintptr_t)thread_context->opengl_context->guest_context
+                         : 0);
+        put_u64(buf, draw != NULL ? (uint64_t)(uintptr_t)draw->guest_surface : 0);
+        put_u64(buf, read != NULL ? (uint64_t)(uintptr_t)read->guest_surface : 0);
+        put_u64(buf, gbuffer != NULL && draw->type == WINDOW_SURFACE ? gbuffer->gbuffer_id : 0);
+        put_u32(buf, gbuffer != NULL ? gbuffer->width : 0);
+        put_u32(buf, gbuffer != NULL ? gbuffer->height : 0);
+    }
+    g_ptr_array_free(collect.threads, TRUE);
+
+    save_section_end(state);
+
+    state->process_id = process_id;
+    for (uint32_t group = 0; group < groups->len; group++)
+    {
+        Group_Maps *maps = &g_array_index(groups, Group_Maps, group);
+        if (state->error == 0)
+        {
+            state->group = group;
+            save_group_objects(state, process, maps);
+        }
+        g_hash_table_destroy(maps->textures);
+        g_hash_table_destroy(maps->buffers);
+        g_hash_table_destroy(maps->programs);
+        g_hash_table_destroy(maps->shaders);
+    }
+
+    g_array_free(groups, TRUE);
+    g_array_free(context_groups, TRUE);
+    g_ptr_array_free(context_keys, TRUE);
+}
+
+static void collect_gbuffer(gpointer key, gpointer value, gpointer user_data)
+{
+    Hardware_Buffer *gbuffer = (Hardware_Buffer *)value;
+
+    // guest内存中的gbuffer由express-mem管理，内容在guest内存里
+    if (gbuffer->usage_type == GBUFFER_TYPE_WINDOW && gbuffer->guest_data == NULL && gbuffer->data_texture != 0)
+    {
+        g_ptr_array_add((GPtrArray *)user_data, gbuffer);
+    }
+}
+
+/**
+ * @brief gbuffer记录：id | 宽高 | 采样数 | 格式 | 第0层的数据
+ */
+static void save_gbuffers(Save_State *state)
+{
+    GPtrArray *gbuffers = g_ptr_array_new();
+    gbuffer_global_map_foreach(collect_gbuffer, gbuffers);
+
+    save_section_begin(state, SECTION_GBUFFER);
+    for (int i = 0; i < gbuffers->len && state->error == 0; i++)
+    {
+        Hardware_Buffer *gbuffer = gbuffers->pdata[i];
+        GByteArray *buf = state->section;
+
+        put_u64(buf, gbuffer->gbuffer_id);
+        put_u32(buf, gbuffer->width);
+        put_u32(buf, gbuffer->height);
+        put_u32(buf, gbuffer->sampler_num);
+        put_u32(buf, gbuffer->format);
+        put_u32(buf, gbuffer->pixel_type);
+        put_u32(buf, gbuffer->internal_format);
+        put_u32(buf, gbuffer->depth_internal_format);
+        put_u32(buf, gbuffer->stencil_internal_format);
+
+        int size = gbuffer->width * gbuffer->height * snapshot_pixel_size(gbuffer->format, gbuffer->pixel_type);
+        put_u32(buf, MAX(size, 0));
+        if (size > 0)
+        {
+            if (gbuffer->data_sync != NULL)
+            {
+                glWaitSync(gbuffer->data_sync, 0, GL_TIMEOUT_IGNORED);
+            }
+            GLintptr offset = save_reserve(state, size);
+            glBindTexture(GL_TEXTURE_2D, gbuffer->data_texture);
+            glGetTexImage(GL_TEXTURE_2D, 0, gbuffer->format, gbuffer->pixel_type, (void *)offset);
+        }
+
+        if (state->section->len >= SECTION_SPLIT_SIZE)
+        {
+            save_section_end(state);
+            save_section_begin(state, SECTION_GBUFFER);
+        }
+    }
+    save_section_end(state);
+
+    LOGI("snapshot saved %u gbuffers", gbuffers->len);
+    g_ptr_array_free(gbuffers, TRUE);
+}
+
+static void collect_process(gpointer key, gpointer value, gpointer user_data)
+{
+    Snapshot_Process_Entry entry = {
+        .process_id = (uint64_t)(uintptr_t)key,
+        .process = (Process_Context *)value,
+    };
+    g_array_append_val((GArray *)user_data, entry);
+}
+
+/**
+ * @brief 在渲染主线程上执行，这时guest的调用都已经处理完，其他渲染线程都是空闲的
+ */
+static void snapshot_save(Snapshot_Job *job)
+{
+    Save_State state = {
+        .job = job,
+        .staging_size = STAGING_SIZE,
+        .fills = g_array_new(FALSE, FALSE, sizeof(Snapshot_Fill)),
+    };
+    Snapshot_GL_State gl_state;
+    int64_t start_time = g_get_real_time();
+
+    snapshot_gl_state_enter(&gl_state);
+
+    glGenBuffers(1, &state.staging);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, state.staging);
+    glBufferData(GL_PIXEL_PACK_BUFFER, state.staging_size, NULL, GL_STREAM_READ);
+
+    save_gbuffers(&state);
+
+    GArray *processes = g_array_new(FALSE, FALSE, sizeof(Snapshot_Process_Entry));
+    express_gpu_foreach_process(collect_process, processes);
+    for (int i = 0; i < processes->len && state.error == 0; i++)
+    {
+        Snapshot_Process_Entry *entry = &g_array_index(processes, Snapshot_Process_Entry, i);
+        save_process(&state, entry->process_id, entry->process);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glDeleteBuffers(1, &state.staging);
+    snapshot_gl_state_leave(&gl_state);
+
+    if (state.section != NULL)
+    {
+        g_byte_array_free(state.section, TRUE);
+    }
+    g_array_free(state.fills, TRUE);
+
+    LOGI("snapshot saved %u processes error %d time %" PRId64 " ms", processes->len, state.error,
+         (g_get_real_time() - start_time) / 1000);
+    g_array_free(processes, TRUE);
+
+    snapshot_job_finish(job, state.error);
+}
+
+int express_gpu_pre_save(QEMUFile *f, Express_Device_Info *info)
+{
+    qemu_put_be32(f, GPU_SNAPSHOT_MAGIC);
+
+    // 渲染线程没有启动过就没有任何GL对象
+    if (native_render_run != 2)
+    {
+        qemu_put_be32(f, SECTION_END);
+        return 0;
+    }
+
+    Snapshot_Job *job = snapshot_job_new(SNAPSHOT_JOB_SAVE);
+    qatomic_inc(&job->ref);
+    send_message_to_main_window(MAIN_SNAPSHOT, job);
+
+    int ret = 0;
+    gint64 deadline = g_get_monotonic_time() + SNAPSHOT_WAIT_US;
+
+    g_mutex_lock(&job->lock);
+    while (true)
+    {
+        GByteArray *section = g_queue_pop_head(&job->sections);
+        if (section != NULL)
+        {
+            g_cond_broadcast(&job->cond);
+            g_mutex_unlock(&job->lock);
+
+            qemu_put_buffer(f, section->data, section->len);
+            g_byte_array_free(section, TRUE);
+            ret = qemu_file_get_error(f);
+
+            g_mutex_lock(&job->lock);
+            if (ret != 0)
+            {
+                break;
+            }
+            deadline = g_get_monotonic_time() + SNAPSHOT_WAIT_US;
+            continue;
+        }
+
+        if (job->finished)
+        {
+            ret = job->error;
+            break;
+        }
+
+        if (!g_cond_wait_until(&job->cond, &job->lock, deadline))
+        {
+            LOGE("error! render thread did not answer the snapshot");
+            ret = -ETIMEDOUT;
+            break;
+        }
+    }
+    if (ret != 0)
+    {
+        job->aborted = true;
+        g_cond_broadcast(&job->cond);
+    }
+    g_mutex_unlock(&job->lock);
+
+    snapshot_job_unref(job);
+
+    qemu_put_be32(f, SECTION_END);
+    return ret < 0 ? ret : 0;
+}
+
+static void load_gbuffers(Snapshot_Reader *r, GList **gbuffers)
+{
+    while (r->pos < r->len && !r->error)
+    {
+        Snapshot_Gbuffer *gbuffer = g_new0(Snapshot_Gbuffer, 1);
+        gbuffer->gbuffer_id = get_u64(r);
+        gbuffer->width = get_u32(r);
+        gbuffer->height = get_u32(r);
+        gbuffer->sampler_num = get_u32(r);
+        gbuffer->format = get_u32(r);
+        gbuffer->pixel_type = get_u32(r);
+        gbuffer->internal_format = get_u32(r);
+        gbuffer->depth_internal_format = get_u32(r);
+        gbuffer->stencil_internal_format = get_u32(r);
+        const uint8_t *data = get_bytes(r, &gbuffer->len);
+
+        if (r->error)
+        {
+            g_free(gbuffer);
+            return;
+        }
+        gbuffer->data = gbuffer->len > 0 ? g_memdup2(data, gbuffer->len) : NULL;
+        *gbuffers = g_list_append(*gbuffers, gbuffer);
+    }
+}
+
+static GArray *load_id_list(Snapshot_Reader *r)
+{
+    uint32_t count;
+    GArray *ids = g_array_new(FALSE, FALSE, sizeof(GLuint));
+
+    get_count(r, 4, &count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        GLuint id = get_u32(r);
+        g_array_append_val(ids, id);
+    }
+    return ids;
+}
+
+static void load_process(Snapshot_Reader *r, GHashTable *processes)
+{
+    uint32_t count;
+    Snapshot_Process *record = g_new0(Snapshot_Process, 1);
+
+    record->process_id = get_u64(r);
+    record->group_num = get_u32(r);
+    record->groups = g_ptr_array_new_with_free_func((GDestroyNotify)g_ptr_array_unref);
+    record->contexts = g_ptr_array_new_with_free_func(snapshot_context_free);
+    record->surfaces = g_array_new(FALSE, TRUE, sizeof(Snapshot_Surface));
+    record->images = g_array_new(FALSE, TRUE, sizeof(Snapshot_Image));
+    record->threads = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+    if (record->group_num > MAX_SHARE_GROUPS)
+    {
+        r->error = true;
+    }
+    for (uint32_t i = 0; i < record->group_num && !r->error; i++)
+    {
+        g_ptr_array_add(record->groups, g_ptr_array_new_with_free_func(snapshot_object_free));
+    }
+
+    get_count(r, 4, &count);
+    for (uint32_t i = 0; i < count && !r->error; i++)
+    {
+        Snapshot_Context *context = g_new0(Snapshot_Context, 1);
+        context->guest_context = get_u64(r);
+        context->group = get_u32(r);
+        context->context_flags = get_u32(r);
+        for (int j = 0; j < EXCLUSIVE_TYPE_NUM; j++)
+        {
+            context->exclusive_ids[j] = load_id_list(r);
+        }
+
+        context->active_texture = get_u32(r);
+        context->texture_bindings = g_array_new(FALSE, TRUE, sizeof(Snapshot_Binding));
+        uint32_t binding_num;
+        get_count(r, 12, &binding_num);
+        for (uint32_t j = 0; j < binding_num; j++)
+        {
+            Snapshot_Binding binding;
+            binding.unit = get_u32(r);
+            binding.target = get_u32(r);
+            binding.guest_id = get_u32(r);
+            g_array_append_val(context->texture_bindings, binding);
+        }
+
+        context->program = get_u32(r);
+        context->buffer_bindings = g_array_new(FALSE, TRUE, sizeof(Snapshot_Binding));
+        get_count(r, 8, &binding_num);
+        for (uint32_t j = 0; j < binding_num; j++)
+        {
+            Snapshot_Binding binding = {0};
+            binding.target = get_u32(r);
+            binding.guest_id = get_u32(r);
+            g_array_append_val(context->buffer_bindings, binding);
+        }
+        g_ptr_array_add(record->contexts, context);
+    }
+
+    get_count(r, 28, &count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Snapshot_Surface surface;
+        surface.guest_surface = get_u64(r);
+        surface.guest_config = get_u64(r);
+        surface.type = get_u32(r);
+        surface.width = get_u32(r);
+        surface.height = get_u32(r);
+        g_array_append_val(record->surfaces, surface);
+    }
+
+    get_count(r, 12, &count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Snapshot_Image image;
+        image.gbuffer_id = get_u64(r);
+        image.group = get_u32(r);
+        g_array_append_val(record->images, image);
+    }
+
+    get_count(r, 48, &count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Snapshot_Thread *thread = g_new0(Snapshot_Thread, 1);
+        thread->thread_id = get_u64(r);
+        thread->guest_context = get_u64(r);
+        thread->draw = get_u64(r);
+        thread->read = get_u64(r);
+        thread->gbuffer_id = get_u64(r);
+        thread->width = get_u32(r);
+        thread->height = get_u32(r);
+        g_hash_table_insert(record->threads, GUINT_TO_POINTER(thread->thread_id), thread);
+    }
+
+    if (r->error)
+    {
+        snapshot_process_free(record);
+        return;
+    }
+    g_hash_table_insert(processes, GUINT_TO_POINTER(record->process_id), record);
+}
+
+static void load_objects(Snapshot_Reader *r, GHashTable *processes)
+{
+    uint64_t process_id = get_u64(r);
+    uint32_t group = get_u32(r);
+
+    Snapshot_Process *record = g_hash_table_lookup(processes, GUINT_TO_POINTER(process_id));
+    if (r->error || record == NULL || group >= record->group_num)
+    {
+        LOGW("snapshot objects of unknown process %" PRIx64 " group %u", process_id, group);
+        return;
+    }
+
+    GPtrArray *objects = record->groups->pdata[group];
+    while (r->pos < r->len && !r->error)
+    {
+        Snapshot_Object *object = g_new0(Snapshot_Object, 1);
+        object->type = get_u32(r);
+        object->guest_id = get_u32(r);
+        const uint8_t *data = get_bytes(r, &object->len);
+        if (r->error)
+        {
+            g_free(object);
+            return;
+        }
+        object->data = object->len > 0 ? g_memdup2(data, object->len) : NULL;
+        g_ptr_array_add(objects, object);
+    }
+}
+
+static void pending_state_clear(void)
+{
+    g_list_free_full(pending_gbuffers, snapshot_gbuffer_free);
+    pending_gbuffers = NULL;
+    if (pending_processes != NULL)
+    {
+        g_hash_table_destroy(pending_processes);
+        pending_processes = NULL;
+    }
+}
+
+int express_gpu_post_load(QEMUFile *f, Express_Device_Info *info, int version_id)
+{
+    // 已有的GL对象与快照中的id会冲突，只支持恢复到刚启动、还没有GL调用的虚拟机
+    if (qatomic_read(&info->live_context_num) > 0)
+    {
+        LOGE("error! cannot load express-gpu state with %d live contexts", qatomic_read(&info->live_context_num));
+        return -EINVAL;
+    }
+
+    if (qemu_get_be32(f) != GPU_SNAPSHOT_MAGIC)
+    {
+        LOGE("error! express-gpu snapshot has wrong magic");
+        return -EINVAL;
+    }
+
+    GList *gbuffers = NULL;
+    GHashTable *processes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, snapshot_process_free);
+    int ret = 0;
+
+    while (true)
+    {
+        uint32_t tag = qemu_get_be32(f);
+        if (tag == SECTION_END || qemu_file_get_error(f))
+        {
+            break;
+        }
+        uint32_t version = qemu_get_be32(f);
+        uint64_t len = qemu_get_be64(f);
+        if (qemu_file_get_error(f) || len > MAX_SECTION_SIZE)
+        {
+            LOGE("error! express-gpu snapshot section %u has bad length %" PRIu64, tag, len);
+            ret = -EINVAL;
+            break;
+        }
+
+        uint8_t *data = g_malloc(len);
+        if (qemu_get_buffer(f, data, len) != len)
+        {
+            g_free(data);
+            ret = -EINVAL;
+            break;
+        }
+
+        Snapshot_Reader r = {
+            .data = data,
+            .len = len,
+        };
+        if (version > SECTION_VERSION)
+        {
+            LOGW("skip express-gpu snapshot section %u with newer version %u", tag, version);
+        }
+        else
+        {
+            switch (tag)
+            {
+            case SECTION_GBUFFER:
+                load_gbuffers(&r, &gbuffers);
+                break;
+            case SECTION_PROCESS:
+                load_process(&r, processes);
+                break;
+            case SECTION_OBJECTS:
+                load_objects(&r, processes);
+                break;
+            default:
+                LOGW("skip unknown express-gpu snapshot section %u", tag);
+                break;
+            }
+        }
+        g_free(data);
+
+        if (r.error)
+        {
+            LOGE("error! express-gpu snapshot section %u is corrupted", tag);
+            ret = -EINVAL;
+            break;
+        }
+    }
+
+    if (ret == 0)
+    {
+        ret = qemu_file_get_error(f);
+    }
+    if (ret < 0)
+    {
+        g_list_free_full(gbuffers, snapshot_gbuffer_free);
+        g_hash_table_destroy(processes);
+        return ret;
+    }
+
+    LOGI("express-gpu snapshot loaded %u gbuffers %u processes", g_list_length(gbuffers),
+         g_hash_table_size(processes));
+
+    g_mutex_lock(&snapshot_lock);
+    pending_state_clear();
+    pending_gbuffers = gbuffers;
+    pending_processes = processes;
+    g_mutex_unlock(&snapshot_lock);
+
+    // 渲染主线程已经在运行时由它重建gbuffer，否则等它启动时再重建
+    if (native_render_run == 2)
+    {
+        Snapshot_Job *job = snapshot_job_new(SNAPSHOT_JOB_RESTORE);
+        qatomic_inc(&job->ref);
+        send_message_to_main_window(MAIN_SNAPSHOT, job);
+
+        gint64 deadline = g_get_monotonic_time() + SNAPSHOT_WAIT_US;
+        g_mutex_lock(&job->lock);
+        while (!job->finished)
+        {
+            if (!g_cond_wait_until(&job->cond, &job->lock, deadline))
+            {
+                LOGE("error! render thread did not restore the snapshot gbuffers");
+                ret = -ETIMEDOUT;
+                break;
+            }
+        }
+        g_mutex_unlock(&job->lock);
+        snapshot_job_unref(job);
+    }
+
+    return ret;
+}
+
+void express_gpu_snapshot_restore_gbuffers(void)
+{
+    g_mutex_lock(&snapshot_lock);
+    GList *gbuffers = pending_gbuffers;
+    pending_gbuffers = NULL;
+    g_mutex_unlock(&snapshot_lock);
+
+    if (gbuffers == NULL)
+    {
+        return;
+    }
+
+    Snapshot_GL_State gl_state;
+    snapshot_gl_state_enter(&gl_state);
+
+    int restored = 0;
+    for (GList *node = gbuffers; node != NULL; node = node->next)
+    {
+        Snapshot_Gbuffer *saved = node->data;
+
+        if (get_gbuffer_from_global_map(saved->gbuffer_id) != NULL)
+        {
+            continue;
+        }
+
+        Hardware_Buffer *gbuffer = create_gbuffer(saved->width, saved->height, saved->sampler_num, saved->format,
+                                                  saved->pixel_type, saved->internal_format,
+                                                  saved->depth_internal_format, saved->stencil_internal_format,
+                                                  saved->gbuffer_id);
+        if (saved->data != NULL &&
+            saved->len == saved->width * saved->height * snapshot_pixel_size(saved->format, saved->pixel_type))
+        {
+            glBindTexture(GL_TEXTURE_2D, gbuffer->data_texture);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, saved->width, saved->height, saved->format, saved->pixel_type,
+                            saved->data);
+        }
+        add_gbuffer_to_global(gbuffer);
+        restored++;
+    }
+
+    snapshot_gl_state_leave(&gl_state);
+    glFlush();
+
+    LOGI("snapshot restored %d gbuffers", restored);
+    g_list_free_full(gbuffers, snapshot_gbuffer_free);
+}
+
+void express_gpu_snapshot_handle_job(void *data)
+{
+    Snapshot_Job *job = (Snapshot_Job *)data;
+
+    if (job->type == SNAPSHOT_JOB_SAVE)
+    {
+        snapshot_save(job);
+    }
+    else
+    {
+        express_gpu_snapshot_restore_gbuffers();
+        snapshot_job_finish(job, 0);
+    }
+    snapshot_job_unref(job);
+}
+
+void *express_gpu_snapshot_take_process(uint64_t process_id)
+{
+    Snapshot_Process *record = NULL;
+
+    g_mutex_lock(&snapshot_lock);
+    if (pending_processes != NULL)
+    {
+        record = g_hash_table_lookup(pending_processes, GUINT_TO_POINTER(process_id));
+        if (record != NULL)
+        {
+            g_hash_table_steal(pending_processes, GUINT_TO_POINTER(process_id));
+        }
+    }
+    g_mutex_unlock(&snapshot_lock);
+
+    return record;
+}
+
+void express_gpu_snapshot_drop_process(void *record)
+{
+    if (record != NULL)
+    {
+        snapshot_process_free(record);
+    }
+}
+
+static void upload_texture(Snapshot_Object *object, GLuint texture)
+{
+    Snapshot_Reader r = {
+        .data = object->data,
+        .len = object->len,
+    };
+
+    GLenum target = get_u32(&r);
+    if (target == 0 || r.error)
+    {
+        return;
+    }
+
+    glBindTexture(target, texture);
+    if (target == GL_TEXTURE_BUFFER)
+    {
+        return;
+    }
+
+    GLint immutable_levels = get_u32(&r);
+    GLint samples = get_u32(&r);
+    GLboolean fixed_locations = get_u32(&r) != 0;
+    bool multisample = texture_target_is_multisample(target);
+    bool is_3d = texture_target_is_3d(target);
+
+    GLint int_values[ARRAY_SIZE(sampler_int_params) + ARRAY_SIZE(texture_int_params)];
+    GLfloat float_values[ARRAY_SIZE(float_params)];
+    if (!multisample)
+    {
+        for (int i = 0; i < ARRAY_SIZE(int_values); i++)
+        {
+            int_values[i] = get_u32(&r);
+        }
+        for (int i = 0; i < ARRAY_SIZE(float_values); i++)
+        {
+            float_values[i] = uint32_as_float(get_u32(&r));
+        }
+    }
+
+    uint32_t level_num = get_u32(&r);
+    bool allocated = false;
+    int face_num = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+
+    for (uint32_t l = 0; l < level_num && !r.error; l++)
+    {
+        GLint level = get_u32(&r);
+        GLsizei width = get_u32(&r);
+        GLsizei height = get_u32(&r);
+        GLsizei depth = get_u32(&r);
+        GLenum internal_format = get_u32(&r);
+        bool compressed = get_u32(&r) != 0;
+        GLenum format = get_u32(&r);
+        GLenum type = get_u32(&r);
+
+        if (r.error || level < 0 || level >= MAX_TEXTURE_LEVELS)
+        {
+            break;
+        }
+
+        if (!allocated && multisample)
+        {
+            if (is_3d)
+            {
+                glTexImage3DMultisample(target, samples, internal_format, width, height, depth, fixed_locations);
+            }
+            else
+            {
+                glTexImage2DMultisample(target, samples, internal_format, width, height, fixed_locations);
+            }
+            allocated = true;
+        }
+        else if (!allocated && immutable_levels > 0)
+        {
+            // 保存的第一层不一定是第0层，按它的大小推算出第0层
+            GLsizei base_width = MAX(width << level, 1);
+            GLsizei base_height = MAX(height << level, 1);
+            if (is_3d)
+            {
+                GLsizei base_depth = target == GL_TEXTURE_3D ? MAX(depth << level, 1) : depth;
+                glTexStorage3D(target, immutable_levels, internal_format, base_width, base_height, base_depth);
+            }
+            else
+            {
+                glTexStorage2D(target, immutable_levels, internal_format, base_width, base_height);
+            }
+            allocated = true;
+        }
+
+        for (int face = 0; face < face_num; face++)
+        {
+            GLenum face_target = face_num == 6 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target;
+            uint32_t len;
+            const uint8_t *data = get_bytes(&r, &len);
+
+            if (r.error || multisample)
+            {
+                continue;
+            }
+
+            if (immutable_levels > 0)
+            {
+                if (len == 0)
+                {
+                    continue;
+                }
+                if (compressed && is_3d)
+                {
+                    glCompressedTexSubImage3D(face_target, level, 0, 0, 0, width, height, depth, internal_format, len,
+                                              data);
+                }
+                else if (compressed)
+                {
+                    glCompressedTexSubImage2D(face_target, level, 0, 0, width, height, internal_format, len, data);
+                }
+                else if (is_3d)
+                {
+                    glTexSubImage3D(face_target, level, 0, 0, 0, width, height, depth, format, type, data);
+                }
+                else
+                {
+                    glTexSubImage2D(face_target, level, 0, 0, width, height, format, type, data);
+                }
+            }
+            else if (compressed)
+            {
+                // 压缩纹理不能只分配不给数据
+                if (len == 0)
+                {
+                    continue;
+                }
+                if (is_3d)
+                {
+                    glCompressedTexImage3D(face_target, level, internal_format, width, height, depth, 0, len, data);
+                }
+                else
+                {
+                    glCompressedTexImage2D(face_target, level, internal_format, width, height, 0, len, data);
+                }
+            }
+            else
+            {
+                if (format == 0 || type == 0)
+                {
+                    continue;
+                }
+                if (is_3d)
+                {
+                    glTexImage3D(face_target, level, internal_format, width, height, depth, 0, format, type,
+                                 len > 0 ? data : NULL);
+                }
+                else
+                {
+                    glTexImage2D(face_target, level, internal_format, width, height, 0, format, type,
+                                 len > 0 ? data : NULL);
+                }
+            }
+        }
+    }
+
+    // 参数放在最后设置，BASE_LEVEL与MAX_LEVEL不会影响上面的上传
+    if (!multisample && !r.error)
+    {
+        for (int i = 0; i < ARRAY_SIZE(sampler_int_params); i++)
+        {
+            glTexParameteri(target, sampler_int_params[i], int_values[i]);
+        }
+        for (int i = 0; i < ARRAY_SIZE(texture_int_params); i++)
+        {
+            glTexParameteri(target, texture_int_params[i], int_values[ARRAY_SIZE(sampler_int_params) + i]);
+        }
+        for (int i = 0; i < ARRAY_SIZE(float_params); i++)
+        {
+            glTexParameterf(target, float_params[i], float_values[i]);
+        }
+    }
+}
+
+static void upload_buffer(Snapshot_Object *object, GLuint buffer)
+{
+    Snapshot_Reader r = {
+        .data = object->data,
+        .len = object->len,
+    };
+
+    GLsizeiptr size = get_u64(&r);
+    GLenum usage = get_u32(&r);
+    bool immutable = get_u32(&r) != 0;
+    GLbitfield flags = get_u32(&r);
+    uint32_t len;
+    const uint8_t *data = get_bytes(&r, &len);
+
+    if (r.error || size <= 0)
+    {
+        return;
+    }
+    if (len != size)
+    {
+        data = NULL;
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if (immutable)
+    {
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, data, flags);
+    }
+    else
+    {
+        glBufferData(GL_COPY_WRITE_BUFFER, size, data, usage);
+    }
+}
+
+void express_gpu_snapshot_restore_object(void *context, Resource_Map_Status *status, unsigned int guest_id)
+{
+    g_mutex_lock(&snapshot_lock);
+
+    GHashTable *pending = status->restore_pending;
+    Snapshot_Object *object = pending != NULL ? g_hash_table_lookup(pending, GUINT_TO_POINTER(guest_id)) : NULL;
+    if (object != NULL)
+    {
+        g_hash_table_steal(pending, GUINT_TO_POINTER(guest_id));
+        if (g_hash_table_size(pending) == 0)
+        {
+            status->restore_pending = NULL;
+            g_hash_table_destroy(pending);
+        }
+
+        // 期间通过EGLImage连接到了共享纹理，原来的内容已经没有用了
+        if (guest_id <= status->max_id && status->resource_id_map[guest_id] > 0)
+        {
+            Snapshot_GL_State gl_state;
+            GLuint host_id = (GLuint)status->resource_id_map[guest_id];
+
+            snapshot_gl_state_enter(&gl_state);
+            if (object->type == OBJECT_BUFFER)
+            {
+                upload_buffer(object, host_id);
+            }
+            else
+            {
+                upload_texture(object, host_id);
+            }
+            snapshot_gl_state_leave(&gl_state);
+
+            LOGD("context %p restore object type %u guest %u host %u len %u", context, object->type, guest_id, host_id,
+                 object->len);
+        }
+        snapshot_object_free(object);
+    }
+
+    g_mutex_unlock(&snapshot_lock);
+}
+
+void express_gpu_snapshot_forget_objects(Resource_Map_Status *status, int n, const unsigned int *guest_ids)
+{
+    g_mutex_lock(&snapshot_lock);
+
+    GHashTable *pending = status->restore_pending;
+    for (int i = 0; i < n && pending != NULL; i++)
+    {
+        g_hash_table_remove(pending, GUINT_TO_POINTER(guest_ids[i]));
+    }
+    if (pending != NULL && g_hash_table_size(pending) == 0)
+    {
+        status->restore_pending = NULL;
+        g_hash_table_destroy(pending);
+    }
+
+    g_mutex_unlock(&snapshot_lock);
+}
+
+/**
+ * @brief 把纹理或者缓冲区放到恢复表中，第一次取host id时才上传内容
+ */
+static void add_restore_pending(Resource_Map_Status *status, Snapshot_Object *object)
+{
+    g_mutex_lock(&snapshot_lock);
+    if (status->restore_pending == NULL)
+    {
+        status->restore_pending = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, snapshot_object_free);
+    }
+    g_hash_table_insert(status->restore_pending, GUINT_TO_POINTER(object->guest_id), object);
+    g_mutex_unlock(&snapshot_lock);
+}
+
+static void restore_renderbuffer(Opengl_Context *root, Snapshot_Object *object)
+{
+    Snapshot_Reader r = {
+        .data = object->data,
+        .len = object->len,
+    };
+    GLsizei width = get_u32(&r);
+    GLsizei height = get_u32(&r);
+    GLenum internal_format = get_u32(&r);
+    GLsizei samples = get_u32(&r);
+
+    d_glGenRenderbuffers(root, 1, &object->guest_id);
+    if (r.error || width <= 0 || height <= 0 || internal_format == 0)
+    {
+        return;
+    }
+
+    GLint pre_rbo = 0;
+    glGetIntegerv(GL_RENDERBUFFER_BINDING, &pre_rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, (GLuint)get_host_renderbuffer_id(root, object->guest_id));
+    if (samples > 0)
+    {
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, internal_format, width, height);
+    }
+    else
+    {
+        glRenderbufferStorage(GL_RENDERBUFFER, internal_format, width, height);
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, pre_rbo);
+}
+
+static void restore_sampler(Opengl_Context *root, Snapshot_Object *object)
+{
+    Snapshot_Reader r = {
+        .data = object->data,
+        .len = object->len,
+    };
+
+    d_glGenSamplers(root, 1, &object->guest_id);
+    GLuint sampler = (GLuint)get_host_sampler_id(root, object->guest_id);
+
+    for (int i = 0; i < ARRAY_SIZE(sampler_int_params); i++)
+    {
+        GLint value = get_u32(&r);
+        if (!r.error)
+        {
+            glSamplerParameteri(sampler, sampler_int_params[i], value);
+        }
+    }
+    for (int i = 0; i < ARRAY_SIZE(float_params); i++)
+    {
+        GLfloat value = uint32_as_float(get_u32(&r));
+        if (!r.error)
+        {
+            glSamplerParameterf(sampler, float_params[i], value);
+        }
+    }
+}
+
+static void restore_shader(Opengl_Context *root, Snapshot_Object *object)
+{
+    Snapshot_Reader r = {
+        .data = object->data,
+        .len = object->len,
+    };
+    GLenum type = get_u32(&r);
+    bool compiled = get_u32(&r) != 0;
+    char *source = get_string(&r);
+
+    if (!r.error)
+    {
+        d_glCreateShader(root, type, object->guest_id);
+        GLuint shader = (GLuint)get_host_shader_id(root, object->guest_id);
+        const GLchar *sources[1] = {source};
+        glShaderSource(shader, 1, sources, NULL);
+        if (compiled)
+        {
+            glCompileShader(shader);
+        }
+    }
+    g_free(source);
+}
+
+typedef struct Program_Shader
+{
+    GLuint guest_id;
+    GLenum type;
+    char *source;
+} Program_Shader;
+
+/**
+ * @brief 程序二进制不能用时，用保存的着色器源码和attrib位置重新链接
+ */
+static bool relink_program(GLuint program, GArray *shaders, GPtrArray *attrib_names, GArray *attrib_locations,
+                           GPtrArray *varyings, GLenum buffer_mode)
+{
+    GLuint temp_shaders[shaders->len + 1];
+
+    for (int i = 0; i < shaders->len; i++)
+    {
+        Program_Shader *shader = &g_array_index(shaders, Program_Shader, i);
+        const GLchar *sources[1] = {shader->source};
+        temp_shaders[i] = glCreateShader(shader->type);
+        glShaderSource(temp_shaders[i], 1, sources, NULL);
+        glCompileShader(temp_shaders[i]);
+        glAttachShader(program, temp_shaders[i]);
+    }
+    for (int i = 0; i < attrib_names->len; i++)
+    {
+        GLint location = g_array_index(attrib_locations, GLint, i);
+        if (location >= 0)
+        {
+            glBindAttribLocation(program, location, attrib_names->pdata[i]);
+        }
+    }
+    if (varyings->len > 0)
+    {
+        glTransformFeedbackVaryings(program, varyings->len, (const GLchar *const *)varyings->pdata, buffer_mode);
+    }
+
+    glLinkProgram(program);
+
+    for (int i = 0; i < shaders->len; i++)
+    {
+        glDetachShader(program, temp_shaders[i]);
+        glDeleteShader(temp_shaders[i]);
+    }
+
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    return linked != 0;
+}
+
+static void restore_program(Opengl_Context *root, Snapshot_Object *object)
+{
+    Snapshot_Reader r = {
+        .data = object->data,
+        .len = object->len,
+    };
+    uint32_t count;
+
+    d_glCreateProgram(root, object->guest_id);
+    GLuint program = (GLuint)get_host_program_id(root, object->guest_id);
+
+    uint32_t flags = get_u32(&r);
+    GLenum binary_format = get_u32(&r);
+    uint32_t binary_len;
+    const uint8_t *binary = get_bytes(&r, &binary_len);
+
+    GArray *shaders = g_array_new(FALSE, TRUE, sizeof(Program_Shader));
+    get_count(&r, 12, &count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Program_Shader shader;
+        shader.guest_id = get_u32(&r);
+        shader.type = get_u32(&r);
+        shader.source = get_string(&r);
+        g_array_append_val(shaders, shader);
+    }
+
+    GPtrArray *attrib_names = g_ptr_array_new_with_free_func(g_free);
+    GArray *attrib_locations = g_array_new(FALSE, TRUE, sizeof(GLint));
+    get_count(&r, 8, &count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        g_ptr_array_add(attrib_names, get_string(&r));
+        GLint location = get_u32(&r);
+        g_array_append_val(attrib_locations, location);
+    }
+
+    GLenum buffer_mode = get_u32(&r);
+    GPtrArray *varyings = g_ptr_array_new_with_free_func(g_free);
+    get_count(&r, 4, &count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        g_ptr_array_add(varyings, get_string(&r));
+    }
+
+    if (flags & PROGRAM_SEPARABLE)
+    {
+        glProgramParameteri(program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+    }
+
+    bool linked = false;
+    if ((flags & PROGRAM_LINKED) && !r.error)
+    {
+        if (binary_len > 0)
+        {
+            GLint status = 0;
+            glProgramBinary(program, binary_format, binary, binary_len);
+            glGetProgramiv(program, GL_LINK_STATUS, &status);
+            linked = status != 0;
+        }
+        if (!linked)
+        {
+            linked = relink_program(program, shaders, attrib_names, attrib_locations, varyings, buffer_mode);
+        }
+        if (!linked)
+        {
+            LOGW("snapshot program guest %u host %u cannot be linked again", object->guest_id, program);
+        }
+    }
+
+    // 重新链接用的临时着色器已经分离，这里再附加guest自己的着色器，guest查询到的附加关系与保存前一致
+    for (int i = 0; i < shaders->len; i++)
+    {
+        Program_Shader *shader = &g_array_index(shaders, Program_Shader, i);
+        GLuint host_shader = shader->guest_id != 0 ? (GLuint)get_host_shader_id(root, shader->guest_id) : 0;
+        if (host_shader != 0)
+        {
+            glAttachShader(program, host_shader);
+        }
+        g_free(shader->source);
+    }
+    g_array_free(shaders, TRUE);
+    g_ptr_array_free(attrib_names, TRUE);
+    g_array_free(attrib_locations, TRUE);
+    g_ptr_array_free(varyings, TRUE);
+
+    if (!linked)
+    {
+        return;
+    }
+
+    get_count(&r, 8, &count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        char *name = get_string(&r);
+        GLuint binding = get_u32(&r);
+        GLuint index = glGetUniformBlockIndex(program, name);
+        if (!r.error && index != GL_INVALID_INDEX)
+        {
+            glUniformBlockBinding(program, index, binding);
+        }
+        g_free(name);
+    }
+
+    get_count(&r, 12, &count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t values[16] = {0};
+        char *name = get_string(&r);
+        GLenum type = get_u32(&r);
+        int components = uniform_components(type);
+        for (int c = 0; c < components; c++)
+        {
+            values[c] = get_u32(&r);
+        }
+
+        GLint location = glGetUniformLocation(program, name);
+        if (!r.error && location >= 0)
+        {
+            set_uniform(program, location, type, values);
+        }
+        g_free(name);
+    }
+
+    // 恢复后的program不会再被guest查询program data，不需要留在program_data_map中
+    init_program_data(program);
+    if (program_data_map != NULL)
+    {
+        g_hash_table_remove(program_data_map, GUINT_TO_POINTER(program));
+    }
+}
+
+static void restore_group_objects(Opengl_Context *root, GPtrArray *objects)
+{
+    Resource_Context *resources = &root->resource_status;
+
+    for (int i = 0; i < objects->len; i++)
+    {
+        Snapshot_Object *object = objects->pdata[i];
+        bool pending = false;
+
+        switch (object->type)
+        {
+        case OBJECT_TEXTURE:
+        case OBJECT_SHARED_TEXTURE:
+            d_glGenTextures(root, 1, &object->guest_id);
+            // 只生成过名字的纹理没有内容，target为0
+            pending = object->type == OBJECT_TEXTURE && object->len > 4;
+            if (pending)
+            {
+                add_restore_pending(resources->texture_resource, object);
+            }
+            break;
+        case OBJECT_BUFFER:
+            d_glGenBuffers(root, 1, &object->guest_id);
+            add_restore_pending(resources->buffer_resource, object);
+            pending = true;
+            break;
+        case OBJECT_RENDERBUFFER:
+            restore_renderbuffer(root, object);
+            break;
+        case OBJECT_SAMPLER:
+            restore_sampler(root, object);
+            break;
+        case OBJECT_SHADER:
+            restore_shader(root, object);
+            break;
+        case OBJECT_PROGRAM:
+            restore_program(root, object);
+            break;
+        case OBJECT_SYNC:
+            d_glFenceSync(root, GL_SYNC_GPU_COMMANDS_COMPLETE, 0, (GLsync)(uintptr_t)object->guest_id);
+            break;
+        default:
+            LOGW("skip snapshot object type %u guest %u", object->type, object->guest_id);
+            break;
+        }
+
+        // 交给恢复表的对象不再由数组释放
+        if (pending)
+        {
+            objects->pdata[i] = NULL;
+        }
+    }
+}
+
+static void restore_images(Opengl_Context *root, Process_Context *process, Snapshot_Process *record, uint32_t group)
+{
+    for (int i = 0; i < record->images->len; i++)
+    {
+        Snapshot_Image *image = &g_array_index(record->images, Snapshot_Image, i);
+        if (image->group != group)
+        {
+            continue;
+        }
+
+        // 与d_eglCreateImage一样，gbuffer_id的低32位就是源纹理的guest id
+        Hardware_Buffer *gbuffer = g_malloc0(sizeof(Hardware_Buffer));
+        gbuffer->usage_type = GBUFFER_TYPE_TEXTURE;
+        gbuffer->data_texture = get_host_texture_id(root, (GLuint)image->gbuffer_id);
+        gbuffer->gbuffer_id = image->gbuffer_id;
+        gbuffer->data_sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        g_hash_table_insert(process->gbuffer_map, (gpointer)(image->gbuffer_id), (gpointer)gbuffer);
+    }
+}
+
+static void link_shared_textures(Opengl_Context *root, Process_Context *process, GPtrArray *objects)
+{
+    for (int i = 0; i < objects->len; i++)
+    {
+        Snapshot_Object *object = objects->pdata[i];
+        if (object == NULL || object->type != OBJECT_SHARED_TEXTURE)
+        {
+            continue;
+        }
+
+        Snapshot_Reader r = {
+            .data = object->data,
+            .len = object->len,
+        };
+        uint64_t gbuffer_id = get_u64(&r);
+        bool process_image = get_u32(&r) != 0;
+
+        Hardware_Buffer *gbuffer = NULL;
+        if (!r.error)
+        {
+            gbuffer = process_image ? g_hash_table_lookup(process->gbuffer_map, (gpointer)(gbuffer_id))
+                                    : get_gbuffer_from_global_map(gbuffer_id);
+        }
+        if (gbuffer == NULL)
+        {
+            LOGW("snapshot texture guest %u lost its gbuffer %" PRIx64, object->guest_id, gbuffer_id);
+            continue;
+        }
+
+        if (gbuffer->usage_type != GBUFFER_TYPE_TEXTURE)
+        {
+            set_texture_gbuffer_ptr(root, object->guest_id, gbuffer);
+        }
+        GLuint origin_texture = (GLuint)set_share_texture(root, object->guest_id, gbuffer->data_texture);
+        if (origin_texture > 0)
+        {
+            glDeleteTextures(1, &origin_texture);
+        }
+    }
+}
+
+static void restore_context_state(Snapshot_Context *saved)
+{
+    Opengl_Context *context = saved->host;
+    void (*gen_functions[EXCLUSIVE_TYPE_NUM])(void *, GLsizei, const GLuint *) = {
+        d_glGenFramebuffers,
+        d_glGenProgramPipelines,
+        d_glGenTransformFeedbacks,
+        d_glGenVertexArrays,
+        d_glGenQueries,
+    };
+
+    for (int i = 0; i < EXCLUSIVE_TYPE_NUM; i++)
+    {
+        GArray *ids = saved->exclusive_ids[i];
+        if (ids->len > 0)
+        {
+            gen_functions[i](context, ids->len, (const GLuint *)ids->data);
+        }
+    }
+
+    for (int i = 0; i < saved->texture_bindings->len; i++)
+    {
+        Snapshot_Binding *binding = &g_array_index(saved->texture_bindings, Snapshot_Binding, i);
+        d_glActiveTexture_special(context, GL_TEXTURE0 + binding->unit);
+        d_glBindTexture_special(context, binding->target, binding->guest_id);
+    }
+    d_glActiveTexture_special(context, GL_TEXTURE0 + saved->active_texture);
+
+    if (saved->program != 0)
+    {
+        d_glUseProgram_special(context, (GLuint)get_host_program_id(context, saved->program));
+    }
+
+    for (int i = 0; i < saved->buffer_bindings->len; i++)
+    {
+        Snapshot_Binding *binding = &g_array_index(saved->buffer_bindings, Snapshot_Binding, i);
+        d_glBindBuffer_special(context, binding->target, binding->guest_id);
+    }
+}
+
+/**
+ * @brief 在进程的第一个线程上重建进程的context、对象、surface与EGLImage
+ */
+static void restore_process(Process_Context *process, Snapshot_Process *record)
+{
+    int64_t start_time = g_get_real_time();
+    Opengl_Context **roots = g_new0(Opengl_Context *, record->group_num + 1);
+    Opengl_Context *last_current = NULL;
+
+    // 每个共享组中第一个context作为其他context的共享对象
+    for (int i = 0; i < record->contexts->len; i++)
+    {
+        Snapshot_Context *saved = record->contexts->pdata[i];
+        if (saved->group >= record->group_num)
+        {
+            continue;
+        }
+
+        saved->host = opengl_context_create(roots[saved->group], saved->context_flags);
+        saved->host->guest_context = (EGLContext)(uintptr_t)saved->guest_context;
+        g_hash_table_insert(process->context_map, GUINT_TO_POINTER(saved->guest_context), (gpointer)saved->host);
+        if (roots[saved->group] == NULL)
+        {
+            roots[saved->group] = saved->host;
+        }
+    }
+
+    for (int i = 0; i < record->surfaces->len; i++)
+    {
+        Snapshot_Surface *saved = &g_array_index(record->surfaces, Snapshot_Surface, i);
+        Window_Buffer *surface = render_surface_create((EGLConfig)(uintptr_t)saved->guest_config, saved->width,
+                                                       saved->height, saved->type);
+        surface->guest_surface = (EGLSurface)(uintptr_t)saved->guest_surface;
+        g_hash_table_insert(process->surface_map, GUINT_TO_POINTER(saved->guest_surface), (gpointer)surface);
+    }
+
+    for (uint32_t group = 0; group < record->group_num; group++)
+    {
+        Opengl_Context *root = roots[group];
+        if (root == NULL || root->window == NULL)
+        {
+            continue;
+        }
+
+        snapshot_make_current(root);
+        opengl_context_init(root);
+        last_current = root;
+
+        GPtrArray *objects = record->groups->pdata[group];
+        restore_group_objects(root, objects);
+        restore_images(root, process, record, group);
+        link_shared_textures(root, process, objects);
+    }
+
+    // 之后的线程只需要threads表，对象数据已经交给各个恢复表了
+    g_ptr_array_unref(record->groups);
+    record->groups = NULL;
+
+    for (int i = 0; i < record->contexts->len; i++)
+    {
+        Snapshot_Context *saved = record->contexts->pdata[i];
+        if (saved->host == NULL || saved->host->window == NULL)
+        {
+            continue;
+        }
+
+        snapshot_make_current(saved->host);
+        opengl_context_init(saved->host);
+        last_current = saved->host;
+
+        restore_context_state(saved);
+    }
+
+    if (last_current != NULL)
+    {
+        glFlush();
+        snapshot_release_current(last_current);
+    }
+    g_free(roots);
+
+    LOGI("snapshot restored process %" PRIx64 " contexts %u surfaces %u time %" PRId64 " ms", record->process_id,
+         record->contexts->len, record->surfaces->len, (g_get_real_time() - start_time) / 1000);
+}
+
+void express_gpu_snapshot_restore_thread(Render_Thread_Context *thread_context)
+{
+    Process_Context *process = thread_context->process_context;
+    Snapshot_Process *record = (Snapshot_Process *)process->snapshot_restore;
+
+    if (record == NULL)
+    {
+        return;
+    }
+
+    if (qatomic_cmpxchg(&record->state, PROCESS_PENDING, PROCESS_RESTORING) == PROCESS_PENDING)
+    {
+        restore_process(process, record);
+        qatomic_set(&record->state, PROCESS_DONE);
+    }
+    else
+    {
+        while (qatomic_read(&record->state) != PROCESS_DONE)
+        {
+            g_usleep(1000);
+        }
+    }
+
+    Snapshot_Thread *thread = g_hash_table_lookup(record->threads, GUINT_TO_POINTER(thread_context->context.thread_id));
+    if (thread == NULL || thread->guest_context == 0)
+    {
+        return;
+    }
+
+    // 保存时正在使用、guest已经销毁的context不会被恢复
+    if (g_hash_table_lookup(process->context_map, GUINT_TO_POINTER(thread->guest_context)) == NULL)
+    {
+        LOGW("snapshot thread %" PRIx64 " current context %" PRIx64 " is gone", thread->thread_id,
+             thread->guest_context);
+        return;
+    }
+
+    d_eglMakeCurrent(thread_context, NULL, (EGLSurface)(uintptr_t)thread->draw, (EGLSurface)(uintptr_t)thread->read,
+                     (EGLContext)(uintptr_t)thread->guest_context, thread->gbuffer_id, thread->width,
+                     thread->height, 0);
+}
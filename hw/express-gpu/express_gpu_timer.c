@@ -0,0 +1,517 @@
+/**
+ * @file express_gpu_timer.c
+ * @brief guest的计时查询与每个context的帧统计
+ *
+ * 查询结果与帧统计只在context所在的渲染线程上更新，帧统计环同时会被QMP读取，
+ * 因此写入环和读取环时加锁，其余的累加都不加锁。
+ */
+// #define STD_DEBUG_LOG
+
+#include "hw/express-gpu/express_gpu_timer.h"
+#include "hw/express-gpu/express_present.h"
+#include "hw/express-gpu/glv3_resource.h"
+#include "hw/express-gpu/glv3_trans.h"
+
+#include "hw/teleport-express/express_log.h"
+
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "qapi/type-helpers.h"
+
+bool express_gpu_frame_stats = true;
+
+typedef struct Timer_Query
+{
+    GLenum target;
+    // 已经结束但结果还没取回
+    bool pending;
+    bool available;
+    GLuint64 value;
+} Timer_Query;
+
+typedef struct Frame_Stats_Slot
+{
+    Express_Frame_Stats stats;
+    // 帧开始与swap时的timestamp查询
+    GLuint query[2];
+    bool gpu_pending;
+} Frame_Stats_Slot;
+
+typedef struct Gpu_Timer_Context
+{
+    Opengl_Context *opengl_context;
+
+    // guest的query id -> Timer_Query，只记录计时类型的查询
+    GHashTable *timer_queries;
+    // guest正在进行的GL_TIME_ELAPSED查询
+    GLuint active_elapsed_id;
+    bool disjoint;
+
+    // 当前帧的累加值
+    bool frame_started;
+    int64_t frame_decode_ns;
+    int64_t frame_readback_ns;
+    uint32_t frame_call_num;
+
+    // 以下由timer_lock保护
+    Frame_Stats_Slot ring[FRAME_STATS_RING_SIZE];
+    uint64_t total_frames;
+} Gpu_Timer_Context;
+
+static GMutex timer_lock;
+
+// 所有的Gpu_Timer_Context，由timer_lock保护，用于QMP
+static GList *timer_contexts = NULL;
+
+static Gpu_Timer_Context *get_gpu_timer(void *context)
+{
+    Opengl_Context *opengl_context = (Opengl_Context *)context;
+    if (opengl_context->gpu_timer == NULL)
+    {
+        Gpu_Timer_Context *timer = g_malloc0(sizeof(Gpu_Timer_Context));
+        timer->opengl_context = opengl_context;
+        timer->timer_queries = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+        g_mutex_lock(&timer_lock);
+        timer_contexts = g_list_prepend(timer_contexts, timer);
+        g_mutex_unlock(&timer_lock);
+
+        opengl_context->gpu_timer = timer;
+    }
+    return (Gpu_Timer_Context *)opengl_context->gpu_timer;
+}
+
+static Timer_Query *get_timer_query(Gpu_Timer_Context *timer, GLuint id, GLenum target)
+{
+    Timer_Query *query = g_hash_table_lookup(timer->timer_queries, GUINT_TO_POINTER(id));
+    if (query == NULL)
+    {
+        query = g_malloc0(sizeof(Timer_Query));
+        g_hash_table_insert(timer->timer_queries, GUINT_TO_POINTER(id), query);
+    }
+    query->target = target;
+    query->pending = true;
+    query->available = false;
+    return query;
+}
+
+/**
+ * @brief 不阻塞地检查查询结果，可用时缓存下来
+ */
+static bool poll_timer_query(Gpu_Timer_Context *timer, GLuint id, Timer_Query *query)
+{
+    if (!query->pending)
+    {
+        return query->available;
+    }
+
+    GLuint host_id = (GLuint)get_host_query_id(timer->opengl_context, id);
+    GLuint available = 0;
+    glGetQueryObjectuiv(host_id, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available)
+    {
+        glGetQueryObjectui64v(host_id, GL_QUERY_RESULT, &(query->value));
+        query->pending = false;
+        query->available = true;
+    }
+    return query->available;
+}
+
+void gpu_timer_begin_query(void *context, GLenum target, GLuint id)
+{
+    if (target != GL_TIME_ELAPSED)
+    {
+        return;
+    }
+
+    Gpu_Timer_Context *timer = get_gpu_timer(context);
+    timer->active_elapsed_id = id;
+
+    // 重新开始的查询之前的结果作废
+    Timer_Query *query = get_timer_query(timer, id, target);
+    query->pending = false;
+}
+
+void gpu_timer_end_query(void *context, GLenum target)
+{
+    if (target != GL_TIME_ELAPSED)
+    {
+        return;
+    }
+
+    Gpu_Timer_Context *timer = get_gpu_timer(context);
+    if (timer->active_elapsed_id == 0)
+    {
+        return;
+    }
+    get_timer_query(timer, timer->active_elapsed_id, target);
+    timer->active_elapsed_id = 0;
+}
+
+void d_glQueryCounterEXT_special(void *context, GLuint id, GLenum target)
+{
+    if (target != GL_TIMESTAMP)
+    {
+        return;
+    }
+
+    Gpu_Timer_Context *timer = get_gpu_timer(context);
+    glQueryCounter((GLuint)get_host_query_id(context, id), GL_TIMESTAMP);
+    get_timer_query(timer, id, target);
+}
+
+bool gpu_timer_get_query_result(void *context, GLuint id, GLenum pname, GLuint64 *value)
+{
+    Opengl_Context *opengl_context = (Opengl_Context *)context;
+    if (opengl_context->gpu_timer == NULL)
+    {
+        return false;
+    }
+
+    Gpu_Timer_Context *timer = (Gpu_Timer_Context *)opengl_context->gpu_timer;
+    Timer_Query *query = g_hash_table_lookup(timer->timer_queries, GUINT_TO_POINTER(id));
+    if (query == NULL || (!query->pending && !query->available))
+    {
+        return false;
+    }
+
+    if (pname == GL_QUERY_RESULT_AVAILABLE)
+    {
+        *value = poll_timer_query(timer, id, query) ? GL_TRUE : GL_FALSE;
+        return true;
+    }
+
+    if (pname == GL_QUERY_RESULT)
+    {
+        if (!poll_timer_query(timer, id, query))
+        {
+            // guest没有等结果可用就查询，只能等GPU
+            glGetQueryObjectui64v((GLuint)get_host_query_id(context, id), GL_QUERY_RESULT, &(query->value));
+            query->pending = false;
+            query->available = true;
+        }
+        *value = query->value;
+        return true;
+    }
+
+    return false;
+}
+
+void d_glGetQueryObjectui64vEXT_special(void *context, GLuint id, GLenum pname, GLuint64 *params)
+{
+    if (gpu_timer_get_query_result(context, id, pname, params))
+    {
+        return;
+    }
+    glGetQueryObjectui64v((GLuint)get_host_query_id(context, id), pname, params);
+}
+
+void gpu_timer_delete_queries(void *context, GLsizei n, const GLuint *ids)
+{
+    Opengl_Context *opengl_context = (Opengl_Context *)context;
+    if (opengl_context->gpu_timer == NULL)
+    {
+        return;
+    }
+
+    Gpu_Timer_Context *timer = (Gpu_Timer_Context *)opengl_context->gpu_timer;
+    for (int i = 0; i < n; i++)
+    {
+        g_hash_table_remove(timer->timer_queries, GUINT_TO_POINTER(ids[i]));
+        if (timer->active_elapsed_id == ids[i])
+        {
+            timer->active_elapsed_id = 0;
+        }
+    }
+}
+
+GLint gpu_timer_get_disjoint(void *context)
+{
+    Gpu_Timer_Context *timer = get_gpu_timer(context);
+    GLint disjoint = timer->disjoint ? 1 : 0;
+    timer->disjoint = false;
+    return disjoint;
+}
+
+int64_t gpu_timer_call_begin(void *context)
+{
+    Opengl_Context *opengl_context = (Opengl_Context *)context;
+    if (!express_gpu_frame_stats || opengl_context == NULL || !opengl_context->is_current)
+    {
+        return 0;
+    }
+
+    Gpu_Timer_Context *timer = get_gpu_timer(context);
+    if (unlikely(!timer->frame_started))
+    {
+        // 这一帧的第一条命令，ring中当前位置的查询在上一轮已经处理过或者放弃了
+        Frame_Stats_Slot *slot = &(timer->ring[timer->total_frames % FRAME_STATS_RING_SIZE]);
+        if (slot->query[0] == 0)
+        {
+            glGenQueries(2, slot->query);
+        }
+        glQueryCounter(slot->query[0], GL_TIMESTAMP);
+        timer->frame_started = true;
+    }
+
+    return get_clock();
+}
+
+void gpu_timer_call_end(void *context, uint64_t call_id, int64_t start_ns)
+{
+    if (start_ns == 0)
+    {
+        return;
+    }
+
+    Gpu_Timer_Context *timer = (Gpu_Timer_Context *)((Opengl_Context *)context)->gpu_timer;
+    int64_t used_ns = get_clock() - start_ns;
+
+    if (call_id == FUNID_glReadPixels_without_bound || call_id == FUNID_glReadPixels_with_bound ||
+        call_id == FUNID_glMapBufferRange_read)
+    {
+        timer->frame_readback_ns += used_ns;
+    }
+    else
+    {
+        timer->frame_decode_ns += used_ns;
+    }
+    timer->frame_call_num++;
+}
+
+/**
+ * @brief 检查之前帧的GPU时间与合成延迟，以及guest计时查询的结果，都不阻塞
+ */
+static void gpu_timer_poll(Gpu_Timer_Context *timer)
+{
+    Present_Timing timing;
+    present_get_timing(&timing);
+
+    for (int i = 0; i < FRAME_STATS_RING_SIZE; i++)
+    {
+        Frame_Stats_Slot *slot = &(timer->ring[i]);
+        int64_t gpu_ns = -1;
+
+        if (slot->gpu_pending)
+        {
+            GLuint available = 0;
+            // 后发出的查询可用时，前一个肯定也可用
+            glGetQueryObjectuiv(slot->query[1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 start_time = 0;
+                GLuint64 end_time = 0;
+                glGetQueryObjectui64v(slot->query[0], GL_QUERY_RESULT, &start_time);
+                glGetQueryObjectui64v(slot->query[1], GL_QUERY_RESULT, &end_time);
+                if (end_time >= start_time)
+                {
+                    gpu_ns = (int64_t)(end_time - start_time);
+                }
+                else
+                {
+                    // GPU的计时器被重置了，这段时间内guest的计时结果都不可信
+                    timer->disjoint = true;
+                    gpu_ns = 0;
+                }
+            }
+        }
+
+        // 只知道最近一次显示的时间，把swap之后第一次看到的显示时间当作这一帧的显示时间，
+        // 被跳过没有显示的帧会得到偏大的延迟
+        bool need_compose = slot->stats.frame_sequence != 0 && slot->stats.compose_latency_ns < 0 &&
+                            timing.present_time_ns >= slot->stats.swap_time_ns;
+
+        if (gpu_ns < 0 && !need_compose)
+        {
+            continue;
+        }
+
+        g_mutex_lock(&timer_lock);
+        if (gpu_ns >= 0)
+        {
+            slot->stats.gpu_ns = gpu_ns;
+            slot->gpu_pending = false;
+        }
+        if (need_compose)
+        {
+            slot->stats.compose_latency_ns = timing.present_time_ns - slot->stats.swap_time_ns;
+        }
+        g_mutex_unlock(&timer_lock);
+    }
+
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    g_hash_table_iter_init(&iter, timer->timer_queries);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        poll_timer_query(timer, GPOINTER_TO_UINT(key), (Timer_Query *)value);
+    }
+}
+
+void gpu_timer_frame_end(void *context)
+{
+    if (!express_gpu_frame_stats)
+    {
+        return;
+    }
+
+    Gpu_Timer_Context *timer = get_gpu_timer(context);
+    Frame_Stats_Slot *slot = &(timer->ring[timer->total_frames % FRAME_STATS_RING_SIZE]);
+
+    if (!timer->frame_started)
+    {
+        // 这一帧没有GL调用
+        if (slot->query[0] == 0)
+        {
+            glGenQueries(2, slot->query);
+        }
+        glQueryCounter(slot->query[0], GL_TIMESTAMP);
+    }
+    glQueryCounter(slot->query[1], GL_TIMESTAMP);
+
+    g_mutex_lock(&timer_lock);
+    timer->total_frames++;
+    slot->stats.frame_sequence = timer->total_frames;
+    slot->stats.swap_time_ns = get_clock();
+    slot->stats.decode_ns = timer->frame_decode_ns;
+    slot->stats.readback_ns = timer->frame_readback_ns;
+    slot->stats.gpu_ns = -1;
+    slot->stats.compose_latency_ns = -1;
+    slot->stats.call_num = timer->frame_call_num;
+    slot->gpu_pending = true;
+    g_mutex_unlock(&timer_lock);
+
+    timer->frame_started = false;
+    timer->frame_decode_ns = 0;
+    timer->frame_readback_ns = 0;
+    timer->frame_call_num = 0;
+
+    gpu_timer_poll(timer);
+}
+
+size_t gpu_timer_read_frame_stats(void *context, void *buf, size_t buf_len)
+{
+    Gpu_Timer_Context *timer = get_gpu_timer(context);
+    Express_Frame_Stats_Header *header = (Express_Frame_Stats_Header *)buf;
+    Express_Frame_Stats *stats = (Express_Frame_Stats *)(header + 1);
+
+    if (buf_len < sizeof(Express_Frame_Stats_Header))
+    {
+        return 0;
+    }
+
+    size_t max_num = (buf_len - sizeof(Express_Frame_Stats_Header)) / sizeof(Express_Frame_Stats);
+
+    g_mutex_lock(&timer_lock);
+    uint64_t frame_num = MIN(timer->total_frames, FRAME_STATS_RING_SIZE);
+    frame_num = MIN(frame_num, max_num);
+    for (uint64_t i = 0; i < frame_num; i++)
+    {
+        uint64_t frame = timer->total_frames - frame_num + i;
+        stats[i] = timer->ring[frame % FRAME_STATS_RING_SIZE].stats;
+    }
+    header->frame_num = (uint32_t)frame_num;
+    header->ring_size = FRAME_STATS_RING_SIZE;
+    header->total_frames = timer->total_frames;
+    g_mutex_unlock(&timer_lock);
+
+    return sizeof(Express_Frame_Stats_Header) + frame_num * sizeof(Express_Frame_Stats);
+}
+
+void gpu_timer_destroy(void *context)
+{
+    Opengl_Context *opengl_context = (Opengl_Context *)context;
+    Gpu_Timer_Context *timer = (Gpu_Timer_Context *)opengl_context->gpu_timer;
+    if (timer == NULL)
+    {
+        return;
+    }
+
+    g_mutex_lock(&timer_lock);
+    timer_contexts = g_list_remove(timer_contexts, timer);
+    g_mutex_unlock(&timer_lock);
+
+    for (int i = 0; i < FRAME_STATS_RING_SIZE; i++)
+    {
+        if (timer->ring[i].query[0] != 0)
+        {
+            glDeleteQueries(2, timer->ring[i].query);
+        }
+    }
+
+    g_hash_table_destroy(timer->timer_queries);
+    g_free(timer);
+    opengl_context->gpu_timer = NULL;
+}
+
+HumanReadableText *qmp_x_query_express_gpu_frames(Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+
+    if (!express_gpu_frame_stats)
+    {
+        error_setg(errp, "express-gpu frame statistics are disabled");
+        return NULL;
+    }
+
+    g_string_append_printf(buf, "%-18s %-18s %10s %10s %10s %10s %10s %10s %8s\n",
+                           "context", "guest_context", "frames", "decode", "readback",
+                           "gpu", "gpu_max", "compose", "calls");
+
+    g_mutex_lock(&timer_lock);
+    for (GList *node = timer_contexts; node != NULL; node = node->next)
+    {
+        Gpu_Timer_Context *timer = (Gpu_Timer_Context *)node->data;
+        uint64_t frame_num = MIN(timer->total_frames, FRAME_STATS_RING_SIZE);
+        if (frame_num == 0)
+        {
+            continue;
+        }
+
+        int64_t decode_sum = 0;
+        int64_t readback_sum = 0;
+        int64_t gpu_sum = 0;
+        int64_t gpu_max = 0;
+        int64_t compose_sum = 0;
+        uint64_t call_sum = 0;
+        int gpu_num = 0;
+        int compose_num = 0;
+
+        for (uint64_t i = 0; i < frame_num; i++)
+        {
+            Express_Frame_Stats *stats = &(timer->ring[i].stats);
+            decode_sum += stats->decode_ns;
+            readback_sum += stats->readback_ns;
+            call_sum += stats->call_num;
+            if (stats->gpu_ns >= 0)
+            {
+                gpu_sum += stats->gpu_ns;
+                gpu_max = MAX(gpu_max, stats->gpu_ns);
+                gpu_num++;
+            }
+            if (stats->compose_latency_ns >= 0)
+            {
+                compose_sum += stats->compose_latency_ns;
+                compose_num++;
+            }
+        }
+
+        // 最近FRAME_STATS_RING_SIZE帧的平均值，耗时都以us为单位输出
+        g_string_append_printf(buf, "%-18" PRIx64 " %-18" PRIx64 " %10" PRIu64 " %10" PRId64 " %10" PRId64
+                               " %10" PRId64 " %10" PRId64 " %10" PRId64 " %8" PRIu64 "\n",
+                               (uint64_t)(uintptr_t)timer->opengl_context,
+                               (uint64_t)(uintptr_t)timer->opengl_context->guest_context,
+                               timer->total_frames,
+                               decode_sum / (int64_t)frame_num / 1000,
+                               readback_sum / (int64_t)frame_num / 1000,
+                               gpu_num > 0 ? gpu_sum / gpu_num / 1000 : -1,
+                               gpu_max / 1000,
+                               compose_num > 0 ? compose_sum / compose_num / 1000 : -1,
+                               call_sum / frame_num);
+    }
+    g_mutex_unlock(&timer_lock);
+
+    return human_readable_text_from_str(buf);
+}
@@ -0,0 +1,227 @@
+/**
+ * @file express_present.c
+ * @brief 合成器的节拍时钟与显示时间记录
+ *
+ * 节拍时钟只在渲染线程上使用。帧序号由display线程在提交时增加，
+ * 渲染线程在节拍到来时取最新的序号，显示之后把时间记录下来给display线程读取。
+ */
+// #define STD_DEBUG_LOG
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/timer.h"
+
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+
+#include "hw/express-gpu/express_present.h"
+
+#include "hw/teleport-express/express_log.h"
+
+static GMutex present_lock;
+
+// guest提交的帧数，display线程增加
+static uint64_t commit_sequence;
+
+// 渲染线程最近一次取到的帧序号，只有渲染线程访问
+static uint64_t latched_sequence;
+
+// 由present_lock保护
+static Present_Timing present_timing;
+
+int present_clock_init(Present_Clock *clock, int hz)
+{
+    memset(clock, 0, sizeof(*clock));
+
+    if (hz <= 0)
+    {
+        LOGE("error! invalid present refresh rate %d", hz);
+        return -1;
+    }
+
+    clock->period_ns = NANOSECONDS_PER_SECOND / hz;
+    clock->next_tick_ns = get_clock() + clock->period_ns;
+
+#ifdef __linux__
+    clock->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (clock->timer_fd >= 0)
+    {
+        struct itimerspec spec = {
+            .it_interval.tv_sec = clock->period_ns / NANOSECONDS_PER_SECOND,
+            .it_interval.tv_nsec = clock->period_ns % NANOSECONDS_PER_SECOND,
+            .it_value.tv_sec = clock->next_tick_ns / NANOSECONDS_PER_SECOND,
+            .it_value.tv_nsec = clock->next_tick_ns % NANOSECONDS_PER_SECOND,
+        };
+
+        if (timerfd_settime(clock->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0)
+        {
+            LOGW("timerfd_settime failed: %s, present clock falls back to sleeping", strerror(errno));
+            close(clock->timer_fd);
+            clock->timer_fd = -1;
+        }
+    }
+    else
+    {
+        LOGW("timerfd_create failed: %s, present clock falls back to sleeping", strerror(errno));
+    }
+#endif
+
+    LOGI("present clock %d Hz, period %" PRId64 " ns", hz, clock->period_ns);
+    return 0;
+}
+
+void present_clock_destroy(Present_Clock *clock)
+{
+#ifdef __linux__
+    if (clock->timer_fd >= 0)
+    {
+        close(clock->timer_fd);
+        clock->timer_fd = -1;
+    }
+#endif
+}
+
+int64_t present_clock_until_tick(Present_Clock *clock)
+{
+    int64_t left = clock->next_tick_ns - get_clock();
+
+    return left > 0 ? left : 0;
+}
+
+/**
+ * @brief 没有timerfd时睡到节拍时间，g_usleep可能提前醒来，因此要循环
+ *
+ * @return 醒来之后经过的节拍数
+ */
+static uint64_t present_clock_sleep(Present_Clock *clock)
+{
+    int64_t now;
+
+    while ((now = get_clock()) < clock->next_tick_ns)
+    {
+        g_usleep((clock->next_tick_ns - now + SCALE_US - 1) / SCALE_US);
+    }
+
+    return (now - clock->next_tick_ns) / clock->period_ns + 1;
+}
+
+uint64_t present_clock_wait(Present_Clock *clock)
+{
+    uint64_t expirations = 0;
+
+#ifdef __linux__
+    if (clock->timer_fd >= 0)
+    {
+        ssize_t ret;
+
+        do
+        {
+            ret = read(clock->timer_fd, &expirations, sizeof(expirations));
+        } while (ret < 0 && errno == EINTR);
+
+        if (ret != sizeof(expirations))
+        {
+            LOGW("present timerfd read failed: %s, present clock falls back to sleeping", strerror(errno));
+            close(clock->timer_fd);
+            clock->timer_fd = -1;
+            expirations = 0;
+        }
+    }
+#endif
+
+    if (expirations == 0)
+    {
+        expirations = present_clock_sleep(clock);
+    }
+
+    // 这次醒来对应的是最后一个到期的节拍
+    int64_t tick_ns = clock->next_tick_ns + (int64_t)(expirations - 1) * clock->period_ns;
+    int64_t jitter = get_clock() - tick_ns;
+
+    if (jitter < 0)
+    {
+        jitter = 0;
+    }
+
+    clock->ticks += expirations;
+    clock->missed_ticks += expirations - 1;
+    clock->jitter_sum_ns += jitter;
+    if (jitter > clock->jitter_max_ns)
+    {
+        clock->jitter_max_ns = jitter;
+    }
+
+    clock->next_tick_ns = tick_ns + clock->period_ns;
+    return expirations;
+}
+
+void present_clock_reset_stats(Present_Clock *clock)
+{
+    clock->ticks = 0;
+    clock->missed_ticks = 0;
+    clock->jitter_sum_ns = 0;
+    clock->jitter_max_ns = 0;
+}
+
+uint64_t present_commit_frame(void)
+{
+    return qatomic_fetch_inc(&commit_sequence) + 1;
+}
+
+bool present_latch_frame(void)
+{
+    uint64_t sequence = qatomic_read(&commit_sequence);
+
+    if (sequence == latched_sequence)
+    {
+        return false;
+    }
+
+    if (sequence - latched_sequence > 1)
+    {
+        g_mutex_lock(&present_lock);
+        present_timing.dropped_frames += sequence - latched_sequence - 1;
+        g_mutex_unlock(&present_lock);
+
+        LOGD("present drops %" PRIu64 " frames", sequence - latched_sequence - 1);
+    }
+
+    latched_sequence = sequence;
+    return true;
+}
+
+void present_frame_done(Present_Clock *clock, int64_t present_ns)
+{
+    g_mutex_lock(&present_lock);
+    present_timing.present_sequence++;
+    present_timing.frame_sequence = latched_sequence;
+    present_timing.present_time_ns = present_ns;
+    present_timing.refresh_period_ns = clock->period_ns;
+    present_timing.next_present_ns = clock->next_tick_ns;
+    g_mutex_unlock(&present_lock);
+}
+
+void present_get_timing(Present_Timing *timing)
+{
+    g_mutex_lock(&present_lock);
+    *timing = present_timing;
+    g_mutex_unlock(&present_lock);
+
+    timing->host_time_ns = get_clock();
+
+    // 画面没有变化时不会合成，记录的下一个节拍可能已经过去了，按周期推到现在之后
+    if (timing->refresh_period_ns > 0 && timing->next_present_ns <= timing->host_time_ns)
+    {
+        timing->next_present_ns += ((timing->host_time_ns - timing->next_present_ns) / timing->refresh_period_ns + 1) *
+                                   timing->refresh_period_ns;
+    }
+}
+
+void present_reset(void)
+{
+    g_mutex_lock(&present_lock);
+    memset(&present_timing, 0, sizeof(present_timing));
+    qatomic_set(&commit_sequence, 0);
+    latched_sequence = 0;
+    g_mutex_unlock(&present_lock);
+}
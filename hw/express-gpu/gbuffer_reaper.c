@@ -0,0 +1,304 @@
+/**
+ * @file gbuffer_reaper.c
+ * @brief gbuffer等它的最后一次使用完成后再释放，释放的纹理与renderbuffer放到池子里给create_gbuffer复用
+ */
+// #define STD_DEBUG_LOG
+
+#include "hw/express-gpu/gbuffer_reaper.h"
+#include "hw/express-gpu/express_gpu_render.h"
+#include "hw/express-gpu/gl_helper.h"
+
+#include "hw/teleport-express/express_log.h"
+
+// 池子里最多保留的gbuffer数目，超过时丢掉最早放进去的
+#define GBUFFER_POOL_MAX_NUM 8
+
+// 池子里的对象超过这个时间没被取走就删掉
+#define GBUFFER_POOL_KEEP_TIME_US (3 * G_USEC_PER_SEC)
+
+// 超过这个像素数的gbuffer不放进池子，避免长时间占着大块显存
+#define GBUFFER_POOL_MAX_PIXELS (4096 * 4096)
+
+typedef struct Gbuffer_Pool_Entry
+{
+    int width;
+    int height;
+    int sampler_num;
+    int format;
+    int pixel_type;
+    int internal_format;
+    int depth_internal_format;
+    int stencil_internal_format;
+
+    GLuint data_texture;
+    GLuint sampler_rbo;
+    GLuint rbo_depth;
+    GLuint rbo_stencil;
+
+    gint64 release_time;
+} Gbuffer_Pool_Entry;
+
+// 只有主窗口线程访问
+static Dying_List *dying_gbuffer;
+
+// 回收队列可能被mem线程与主窗口线程同时访问，池子会被各个渲染线程访问
+static GMutex reaper_lock;
+static GQueue retired_gbuffers = G_QUEUE_INIT;
+static GQueue gbuffer_pool = G_QUEUE_INIT;
+
+static uint64_t reaped_num = 0;
+static uint64_t pool_hit_num = 0;
+
+static int try_retire_gbuffer(void *data)
+{
+    Hardware_Buffer *gbuffer = (Hardware_Buffer *)data;
+
+    if (gbuffer == NULL)
+    {
+        return 1;
+    }
+
+    if (gbuffer->is_dying == 0)
+    {
+        return 1;
+    }
+
+    if (gbuffer->remain_life_time > 0)
+    {
+        gbuffer->remain_life_time--;
+        return 0;
+    }
+
+    if (main_display_gbuffer == gbuffer)
+    {
+        gbuffer->remain_life_time = MAX_COMPOSER_LIFE_TIME;
+        return 0;
+    }
+
+    if (gbuffer->gbuffer_id != 0)
+    {
+        // psurface的gbuffer_id为0
+        remove_gbuffer_from_global_map(gbuffer->gbuffer_id);
+    }
+
+    LOGI("gbuffer %llx is dead", gbuffer->gbuffer_id);
+    gbuffer_reaper_retire(gbuffer);
+
+    return 1;
+}
+
+void gbuffer_reaper_add_dying(Hardware_Buffer *gbuffer)
+{
+    dying_gbuffer = dying_list_append(dying_gbuffer, gbuffer);
+}
+
+void gbuffer_reaper_cancel_dying(Hardware_Buffer *gbuffer)
+{
+    dying_gbuffer = dying_list_remove(dying_gbuffer, gbuffer);
+}
+
+void gbuffer_reaper_retire(Hardware_Buffer *gbuffer)
+{
+    // 其他context中对gbuffer最后的写和读分别由data_sync与delete_sync标记，
+    // 先让当前context等它们，这样reap_sync触发时所有的使用都完成了
+    if (gbuffer->data_sync != NULL)
+    {
+        glWaitSync(gbuffer->data_sync, 0, GL_TIMEOUT_IGNORED);
+    }
+    if (gbuffer->delete_sync != NULL)
+    {
+        glWaitSync(gbuffer->delete_sync, 0, GL_TIMEOUT_IGNORED);
+    }
+    gbuffer->reap_sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // fence要在其他context中查询，必须flush
+    glFlush();
+
+    g_mutex_lock(&reaper_lock);
+    g_queue_push_tail(&retired_gbuffers, gbuffer);
+    g_mutex_unlock(&reaper_lock);
+}
+
+static void pool_entry_destroy(Gbuffer_Pool_Entry *entry)
+{
+    glDeleteTextures(1, &(entry->data_texture));
+    if (entry->sampler_rbo != 0)
+    {
+        glDeleteRenderbuffers(1, &(entry->sampler_rbo));
+    }
+    glDeleteRenderbuffers(1, &(entry->rbo_depth));
+    glDeleteRenderbuffers(1, &(entry->rbo_stencil));
+    g_free(entry);
+}
+
+/**
+ * @brief 把gbuffer的纹理与renderbuffer放进池子，放进去的对象从gbuffer上摘掉，不会被destroy_gbuffer删除
+ */
+static void gbuffer_pool_put(Hardware_Buffer *gbuffer, gint64 now)
+{
+    if (gbuffer->data_texture == 0 || gbuffer->rbo_depth == 0 || gbuffer->rbo_stencil == 0 ||
+        (gbuffer->sampler_num > 1 && gbuffer->sampler_rbo == 0) ||
+        (int64_t)gbuffer->width * gbuffer->height > GBUFFER_POOL_MAX_PIXELS)
+    {
+        return;
+    }
+
+    Gbuffer_Pool_Entry *entry = g_malloc0(sizeof(Gbuffer_Pool_Entry));
+    entry->width = gbuffer->width;
+    entry->height = gbuffer->height;
+    entry->sampler_num = gbuffer->sampler_num;
+    entry->format = gbuffer->format;
+    entry->pixel_type = gbuffer->pixel_type;
+    entry->internal_format = gbuffer->internal_format;
+    entry->depth_internal_format = gbuffer->depth_internal_format;
+    entry->stencil_internal_format = gbuffer->stencil_internal_format;
+
+    entry->data_texture = gbuffer->data_texture;
+    entry->sampler_rbo = gbuffer->sampler_rbo;
+    entry->rbo_depth = gbuffer->rbo_depth;
+    entry->rbo_stencil = gbuffer->rbo_stencil;
+    entry->release_time = now;
+
+    gbuffer->data_texture = 0;
+    gbuffer->sampler_rbo = 0;
+    gbuffer->rbo_depth = 0;
+    gbuffer->rbo_stencil = 0;
+
+    Gbuffer_Pool_Entry *evicted = NULL;
+    g_mutex_lock(&reaper_lock);
+    g_queue_push_tail(&gbuffer_pool, entry);
+    if (g_queue_get_length(&gbuffer_pool) > GBUFFER_POOL_MAX_NUM)
+    {
+        evicted = g_queue_pop_head(&gbuffer_pool);
+    }
+    g_mutex_unlock(&reaper_lock);
+
+    if (evicted != NULL)
+    {
+        pool_entry_destroy(evicted);
+    }
+}
+
+bool gbuffer_pool_take(Hardware_Buffer *gbuffer)
+{
+    Gbuffer_Pool_Entry *entry = NULL;
+
+    g_mutex_lock(&reaper_lock);
+    // 从最近放进去的开始找
+    for (GList *node = gbuffer_pool.tail; node != NULL; node = node->prev)
+    {
+        Gbuffer_Pool_Entry *now_entry = (Gbuffer_Pool_Entry *)node->data;
+        if (now_entry->width == gbuffer->width && now_entry->height == gbuffer->height &&
+            now_entry->sampler_num == gbuffer->sampler_num && now_entry->format == gbuffer->format &&
+            now_entry->pixel_type == gbuffer->pixel_type && now_entry->internal_format == gbuffer->internal_format &&
+            now_entry->depth_internal_format == gbuffer->depth_internal_format &&
+            now_entry->stencil_internal_format == gbuffer->stencil_internal_format)
+        {
+            entry = now_entry;
+            g_queue_delete_link(&gbuffer_pool, node);
+            pool_hit_num++;
+            break;
+        }
+    }
+    g_mutex_unlock(&reaper_lock);
+
+    if (entry == NULL)
+    {
+        return false;
+    }
+
+    gbuffer->data_texture = entry->data_texture;
+    gbuffer->sampler_rbo = entry->sampler_rbo;
+    gbuffer->rbo_depth = entry->rbo_depth;
+    gbuffer->rbo_stencil = entry->rbo_stencil;
+    g_free(entry);
+
+    return true;
+}
+
+static void gbuffer_release(Hardware_Buffer *gbuffer, gint64 now)
+{
+    glDeleteSync(gbuffer->reap_sync);
+    gbuffer->reap_sync = NULL;
+
+    gbuffer_pool_put(gbuffer, now);
+    destroy_gbuffer(gbuffer);
+}
+
+void gbuffer_reaper_run(void)
+{
+    // 寿命到了的gbuffer进入回收队列
+    dying_gbuffer = dying_list_foreach(dying_gbuffer, try_retire_gbuffer);
+
+    gint64 now = g_get_monotonic_time();
+    GQueue signaled = G_QUEUE_INIT;
+
+    // 不同context中的fence之间没有先后关系，因此每个都要查询
+    g_mutex_lock(&reaper_lock);
+    for (GList *node = retired_gbuffers.head; node != NULL;)
+    {
+        GList *next = node->next;
+        Hardware_Buffer *gbuffer = (Hardware_Buffer *)node->data;
+        GLenum ret = glClientWaitSync(gbuffer->reap_sync, 0, 0);
+        if (ret != GL_TIMEOUT_EXPIRED)
+        {
+            if (ret == GL_WAIT_FAILED)
+            {
+                LOGW("wait reap sync of gbuffer %llx failed", gbuffer->gbuffer_id);
+            }
+            g_queue_unlink(&retired_gbuffers, node);
+            g_queue_push_tail_link(&signaled, node);
+        }
+        node = next;
+    }
+
+    GQueue expired = G_QUEUE_INIT;
+    while (!g_queue_is_empty(&gbuffer_pool) &&
+           now - ((Gbuffer_Pool_Entry *)g_queue_peek_head(&gbuffer_pool))->release_time > GBUFFER_POOL_KEEP_TIME_US)
+    {
+        g_queue_push_tail(&expired, g_queue_pop_head(&gbuffer_pool));
+    }
+    g_mutex_unlock(&reaper_lock);
+
+    Hardware_Buffer *gbuffer;
+    while ((gbuffer = g_queue_pop_head(&signaled)) != NULL)
+    {
+        gbuffer_release(gbuffer, now);
+        reaped_num++;
+    }
+
+    Gbuffer_Pool_Entry *entry;
+    while ((entry = g_queue_pop_head(&expired)) != NULL)
+    {
+        pool_entry_destroy(entry);
+    }
+}
+
+void gbuffer_reaper_destroy(void)
+{
+    // 退出时不再等fence，直接等所有命令执行完
+    glFinish();
+
+    g_mutex_lock(&reaper_lock);
+    GQueue retired = retired_gbuffers;
+    GQueue pool = gbuffer_pool;
+    g_queue_init(&retired_gbuffers);
+    g_queue_init(&gbuffer_pool);
+    g_mutex_unlock(&reaper_lock);
+
+    Hardware_Buffer *gbuffer;
+    while ((gbuffer = g_queue_pop_head(&retired)) != NULL)
+    {
+        glDeleteSync(gbuffer->reap_sync);
+        gbuffer->reap_sync = NULL;
+        destroy_gbuffer(gbuffer);
+        reaped_num++;
+    }
+
+    Gbuffer_Pool_Entry *entry;
+    while ((entry = g_queue_pop_head(&pool)) != NULL)
+    {
+        pool_entry_destroy(entry);
+    }
+
+    LOGI("gbuffer reaper released %" PRIu64 " gbuffers, pool hit %" PRIu64, reaped_num, pool_hit_num);
+}
@@ -669,6 +669,9 @@ size_t gl_pname_size(GLenum pname)
     case GL_CURRENT_QUERY:
     case GL_QUERY_RESULT:
     case GL_QUERY_RESULT_AVAILABLE:
+    case GL_QUERY_COUNTER_BITS:
+    case GL_TIMESTAMP:
+    case GL_GPU_DISJOINT_EXT:
     case GL_READ_BUFFER:
     case GL_ACTIVE_ATOMIC_COUNTER_BUFFERS:
     case GL_ACTIVE_ATTRIBUTES:
@@ -12,24 +12,411 @@
 #include "hw/express-gpu/glv1.h"
 #include "hw/express-gpu/glv3_status.h"
 
+#include "hw/express-gpu/gl_helper.h"
+
+#include <math.h>
+
 // static GLuint draw_texi_vao = 0;
 static GLuint draw_texi_program = 0;
 static GLint draw_texi_texture_id_loc = 0;
 
+//数组取地址不是字符串指针的指针，所以这里不要用数组
+#ifdef _WIN32
+#define DRAW_TEXI_SHADER_VERSION "#version 300 es\n"
+#else
+#define DRAW_TEXI_SHADER_VERSION "#version 330\n"
+#endif
+
+static const char *draw_texi_vertex_shader = DRAW_TEXI_SHADER_VERSION
+                                             "layout(location = 0) in vec3 a_pos;\n"
+                                             "layout(location = 1) in vec2 atex_coord;\n"
+                                             "out vec2 tex_coord;\n"
+                                             "void main()\n"
+                                             "{\n"
+                                             "    gl_Position = vec4(a_pos, 1.0);\n"
+                                             "    tex_coord = atex_coord;\n"
+                                             "}\n";
+
+// 生成着色器时用到的固定管线状态，全部是GLenum，没有填充字节，可以直接按字节比较
+typedef struct Fixed_Program_Unit_Key
+{
+    // 为0表示这个纹理单元不采样
+    GLenum mode;
+    GLenum combine_rgb;
+    GLenum combine_alpha;
+    GLenum src_rgb[3];
+    GLenum src_alpha[3];
+    GLenum operand_rgb[3];
+    GLenum operand_alpha[3];
+} Fixed_Program_Unit_Key;
+
+typedef struct Fixed_Program_Key
+{
+    Fixed_Program_Unit_Key units[FIXED_MAX_TEXTURE_UNITS];
+    // 为0表示没开alpha test
+    GLenum alpha_func;
+    GLenum fog;
+} Fixed_Program_Key;
+
+typedef struct Fixed_Program
+{
+    GLuint program;
+    GLint color_loc;
+    GLint alpha_ref_loc;
+    GLint fog_color_loc;
+    GLint fog_factor_loc;
+    GLint texture_loc[FIXED_MAX_TEXTURE_UNITS];
+    GLint env_color_loc[FIXED_MAX_TEXTURE_UNITS];
+    GLint env_scale_loc[FIXED_MAX_TEXTURE_UNITS];
+} Fixed_Program;
+
+static GLfixed float_to_fixed(GLfloat value)
+{
+    if (value >= 32767.0f)
+    {
+        return 0x7fffffff;
+    }
+    if (value <= -32768.0f)
+    {
+        return (GLfixed)0x80000000;
+    }
+    return (GLfixed)(value * 65536.0f);
+}
+
+static void fixed_to_float_array(const GLfixed *src, GLfloat *dst, int num)
+{
+    for (int i = 0; i < num; i++)
+    {
+        dst[i] = FIXED_TO_FLOAT(src[i]);
+    }
+}
+
+static void float_to_fixed_array(const GLfloat *src, GLfixed *dst, int num)
+{
+    for (int i = 0; i < num; i++)
+    {
+        dst[i] = float_to_fixed(src[i]);
+    }
+}
+
+static guint fixed_program_key_hash(gconstpointer key)
+{
+    const unsigned char *data = (const unsigned char *)key;
+    guint hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(Fixed_Program_Key); i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static gboolean fixed_program_key_equal(gconstpointer a, gconstpointer b)
+{
+    return memcmp(a, b, sizeof(Fixed_Program_Key)) == 0;
+}
+
+static void fixed_program_free(gpointer data)
+{
+    Fixed_Program *program = (Fixed_Program *)data;
+    if (program->program != 0)
+    {
+        glDeleteProgram(program->program);
+    }
+    g_free(program);
+}
+
+static void matrix_identity(GLfloat *m)
+{
+    memset(m, 0, sizeof(GLfloat) * 16);
+    m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+static void fixed_texture_env_init(Fixed_Texture_Env *env)
+{
+    env->enabled = GL_FALSE;
+    env->mode = GL_MODULATE;
+    env->combine_rgb = GL_MODULATE;
+    env->combine_alpha = GL_MODULATE;
+    env->src_rgb[0] = GL_TEXTURE;
+    env->src_rgb[1] = GL_PREVIOUS;
+    env->src_rgb[2] = GL_CONSTANT;
+    env->src_alpha[0] = GL_TEXTURE;
+    env->src_alpha[1] = GL_PREVIOUS;
+    env->src_alpha[2] = GL_CONSTANT;
+    env->operand_rgb[0] = GL_SRC_COLOR;
+    env->operand_rgb[1] = GL_SRC_COLOR;
+    env->operand_rgb[2] = GL_SRC_ALPHA;
+    env->operand_alpha[0] = GL_SRC_ALPHA;
+    env->operand_alpha[1] = GL_SRC_ALPHA;
+    env->operand_alpha[2] = GL_SRC_ALPHA;
+    env->rgb_scale = 1.0f;
+    env->alpha_scale = 1.0f;
+    env->tex_gen_mode = GL_REFLECTION_MAP_OES;
+    env->tex_coord[3] = 1.0f;
+}
+
+static void fixed_function_state_init(Fixed_Function_State *state)
+{
+    for (int i = 0; i < FIXED_MAX_TEXTURE_UNITS; i++)
+    {
+        fixed_texture_env_init(&(state->texture_env[i]));
+    }
+
+    state->alpha_func = GL_ALWAYS;
+
+    state->fog_mode = GL_EXP;
+    state->fog_density = 1.0f;
+    state->fog_end = 1.0f;
+
+    state->light_model_ambient[0] = 0.2f;
+    state->light_model_ambient[1] = 0.2f;
+    state->light_model_ambient[2] = 0.2f;
+    state->light_model_ambient[3] = 1.0f;
+
+    for (int i = 0; i < FIXED_MAX_LIGHTS; i++)
+    {
+        Fixed_Light *light = &(state->lights[i]);
+        light->ambient[3] = 1.0f;
+        if (i == 0)
+        {
+            light->diffuse[0] = light->diffuse[1] = light->diffuse[2] = 1.0f;
+            light->specular[0] = light->specular[1] = light->specular[2] = 1.0f;
+        }
+        light->diffuse[3] = 1.0f;
+        light->specular[3] = 1.0f;
+        light->position[2] = 1.0f;
+        light->spot_direction[2] = -1.0f;
+        light->spot_cutoff = 180.0f;
+        light->constant_attenuation = 1.0f;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        Fixed_Material *material = &(state->material[i]);
+        material->ambient[0] = material->ambient[1] = material->ambient[2] = 0.2f;
+        material->ambient[3] = 1.0f;
+        material->diffuse[0] = material->diffuse[1] = material->diffuse[2] = 0.8f;
+        material->diffuse[3] = 1.0f;
+        material->specular[3] = 1.0f;
+        material->emission[3] = 1.0f;
+    }
+
+    state->shade_model = GL_SMOOTH;
+    state->current_color[0] = state->current_color[1] = state->current_color[2] = state->current_color[3] = 1.0f;
+    state->current_normal[2] = 1.0f;
+
+    state->point_size = 1.0f;
+    state->point_size_max = 1.0f;
+    state->point_fade_threshold = 1.0f;
+    state->point_distance_attenuation[0] = 1.0f;
+
+    matrix_identity(state->matrix);
+
+    state->program_cache = g_hash_table_new_full(fixed_program_key_hash, fixed_program_key_equal, g_free, fixed_program_free);
+}
+
+Fixed_Function_State *get_fixed_function_state(void *context)
+{
+    Opengl_Context *opengl_context = (Opengl_Context *)context;
+    if (opengl_context->fixed_function_state == NULL)
+    {
+        Fixed_Function_State *state = g_malloc0(sizeof(Fixed_Function_State));
+        fixed_function_state_init(state);
+        opengl_context->fixed_function_state = state;
+    }
+    return (Fixed_Function_State *)opengl_context->fixed_function_state;
+}
+
+void fixed_function_state_destroy(void *context)
+{
+    Opengl_Context *opengl_context = (Opengl_Context *)context;
+    Fixed_Function_State *state = (Fixed_Function_State *)opengl_context->fixed_function_state;
+    if (state == NULL)
+    {
+        return;
+    }
+    g_hash_table_destroy(state->program_cache);
+    g_free(state);
+    opengl_context->fixed_function_state = NULL;
+}
+
+static Fixed_Texture_Env *get_active_texture_env(void *context)
+{
+    Opengl_Context *opengl_context = (Opengl_Context *)context;
+    GLuint unit = opengl_context->texture_binding_status.guest_current_active_texture;
+    if (unit >= FIXED_MAX_TEXTURE_UNITS)
+    {
+        return NULL;
+    }
+    return &(get_fixed_function_state(context)->texture_env[unit]);
+}
+
+bool fixed_function_enable(void *context, GLenum cap, GLboolean enable)
+{
+    Fixed_Function_State *state;
+
+    // GLES2/3中这些开关都不存在，交给host的core profile报GL_INVALID_ENUM
+    if (!(((Opengl_Context *)context)->context_flags & DGL_CONTEXT_FLAG_GLES1_BIT))
+    {
+        return false;
+    }
+
+    switch (cap)
+    {
+    case GL_TEXTURE_2D:
+    {
+        Fixed_Texture_Env *env = get_active_texture_env(context);
+        if (env != NULL)
+        {
+            env->enabled = enable;
+        }
+        get_fixed_function_state(context)->texture_enable_seen = GL_TRUE;
+        return true;
+    }
+    case GL_ALPHA_TEST:
+        get_fixed_function_state(context)->alpha_test = enable;
+        return true;
+    case GL_FOG:
+        get_fixed_function_state(context)->fog = enable;
+        return true;
+    case GL_LIGHTING:
+        get_fixed_function_state(context)->lighting = enable;
+        return true;
+    case GL_COLOR_MATERIAL:
+        get_fixed_function_state(context)->color_material = enable;
+        return true;
+    case GL_NORMALIZE:
+        get_fixed_function_state(context)->normalize = enable;
+        return true;
+    case GL_RESCALE_NORMAL:
+        get_fixed_function_state(context)->rescale_normal = enable;
+        return true;
+    case GL_POINT_SPRITE_OES:
+        get_fixed_function_state(context)->point_sprite = enable;
+        return true;
+    case GL_POINT_SMOOTH:
+    case GL_TEXTURE_CUBE_MAP:
+    case GL_TEXTURE_GEN_STR_OES:
+        // core profile中没有这些开关
+        return true;
+    default:
+        break;
+    }
+
+    if (cap >= GL_LIGHT0 && cap < GL_LIGHT0 + FIXED_MAX_LIGHTS)
+    {
+        get_fixed_function_state(context)->lights[cap - GL_LIGHT0].enabled = enable;
+        return true;
+    }
+
+    if (cap >= GL_CLIP_PLANE0 && cap < GL_CLIP_PLANE0 + FIXED_MAX_CLIP_PLANES)
+    {
+        // 与GLES3的GL_CLIP_DISTANCE0是同一个值，记录下来之后还要发给host
+        state = get_fixed_function_state(context);
+        state->clip_plane_enabled[cap - GL_CLIP_PLANE0] = enable;
+    }
+
+    return false;
+}
+
+/**
+ * @brief 设置当前纹理单元的纹理环境
+ *
+ * @param enum_value 枚举类型的参数值，定点数版本的函数中枚举值不做转换
+ * @param float_value 数值类型的参数值
+ */
+static void fixed_tex_env(void *context, GLenum target, GLenum pname, GLint enum_value, GLfloat float_value)
+{
+    Fixed_Texture_Env *env = get_active_texture_env(context);
+    if (env == NULL)
+    {
+        return;
+    }
+
+    if (target == GL_POINT_SPRITE_OES)
+    {
+        if (pname == GL_COORD_REPLACE_OES)
+        {
+            env->coord_replace = enum_value != 0;
+        }
+        return;
+    }
+
+    if (target != GL_TEXTURE_ENV)
+    {
+        return;
+    }
+
+    switch (pname)
+    {
+    case GL_TEXTURE_ENV_MODE:
+        env->mode = enum_value;
+        break;
+    case GL_COMBINE_RGB:
+        env->combine_rgb = enum_value;
+        break;
+    case GL_COMBINE_ALPHA:
+        env->combine_alpha = enum_value;
+        break;
+    case GL_SRC0_RGB:
+    case GL_SRC1_RGB:
+    case GL_SRC2_RGB:
+        env->src_rgb[pname - GL_SRC0_RGB] = enum_value;
+        break;
+    case GL_SRC0_ALPHA:
+    case GL_SRC1_ALPHA:
+    case GL_SRC2_ALPHA:
+        env->src_alpha[pname - GL_SRC0_ALPHA] = enum_value;
+        break;
+    case GL_OPERAND0_RGB:
+    case GL_OPERAND1_RGB:
+    case GL_OPERAND2_RGB:
+        env->operand_rgb[pname - GL_OPERAND0_RGB] = enum_value;
+        break;
+    case GL_OPERAND0_ALPHA:
+    case GL_OPERAND1_ALPHA:
+    case GL_OPERAND2_ALPHA:
+        env->operand_alpha[pname - GL_OPERAND0_ALPHA] = enum_value;
+        break;
+    case GL_RGB_SCALE:
+        env->rgb_scale = float_value;
+        break;
+    case GL_ALPHA_SCALE:
+        env->alpha_scale = float_value;
+        break;
+    default:
+        express_printf("unknown tex env pname %x\n", pname);
+        break;
+    }
+}
+
 void d_glTexEnvf_special(void *context, GLenum target, GLenum pname, GLfloat param)
 {
-    glTexEnvf(target, pname, param);
+    fixed_tex_env(context, target, pname, (GLint)param, param);
 }
 
 void d_glTexEnvi_special(void *context, GLenum target, GLenum pname, GLint param)
 {
-    glTexEnvi(target, pname, param);
+    fixed_tex_env(context, target, pname, param, (GLfloat)param);
 }
 
 void d_glTexEnvx_special(void *context, GLenum target, GLenum pname, GLfixed param)
 {
-    express_printf("null glTexEnvxOES %llx %llx %llx pname %x param %x\n", (unsigned long long)glTexEnvxOES, (unsigned long long)glTexEnvi, (unsigned long long)glTexEnvf, pname, param);
-    glTexEnvi(target, pname, param);
+    fixed_tex_env(context, target, pname, param, FIXED_TO_FLOAT(param));
+}
+
+void d_glTexEnvxv_special(void *context, GLenum target, GLenum pname, const GLfixed *params)
+{
+    if (target == GL_TEXTURE_ENV && pname == GL_TEXTURE_ENV_COLOR)
+    {
+        Fixed_Texture_Env *env = get_active_texture_env(context);
+        if (env != NULL)
+        {
+            fixed_to_float_array(params, env->color, 4);
+        }
+        return;
+    }
+    fixed_tex_env(context, target, pname, params[0], FIXED_TO_FLOAT(params[0]));
 }
 
 void d_glTexParameterx_special(void *context, GLenum target, GLenum pname, GLint param)
@@ -52,7 +439,8 @@ void d_glTexParameterx_special(void *context, GLenum target, GLenum pname, GLint
                 glActiveTexture(GL_TEXTURE0);
             }
             glBindTexture(GL_TEXTURE_2D, texture_status->current_texture_external);
-            glTexParameterx(GL_TEXTURE_2D, pname, param);
+            // core profile没有glTexParameterx，纹理参数都是枚举值，直接按整数设置
+            glTexParameteri(GL_TEXTURE_2D, pname, param);
             glBindTexture(GL_TEXTURE_2D, texture_status->host_current_texture_2D[0]);
             if (texture_status->host_current_active_texture != 0)
             {
@@ -68,7 +456,1046 @@ void d_glTexParameterx_special(void *context, GLenum target, GLenum pname, GLint
 
 void d_glShadeModel_special(void *context, GLenum mode)
 {
-    // glShadeModel(mode);
+    // core profile没有glShadeModel，glDrawTexiOES画的矩形颜色是常量，记录下来用于查询即可
+    get_fixed_function_state(context)->shade_model = mode;
+}
+
+void d_glAlphaFuncx_special(void *context, GLenum func, GLfixed ref)
+{
+    Fixed_Function_State *state = get_fixed_function_state(context);
+    GLfloat f_ref = FIXED_TO_FLOAT(ref);
+
+    state->alpha_func = func;
+    state->alpha_ref = f_ref < 0.0f ? 0.0f : (f_ref > 1.0f ? 1.0f : f_ref);
+}
+
+void d_glColor4x_special(void *context, GLfixed red, GLfixed green, GLfixed blue, GLfixed alpha)
+{
+    Fixed_Function_State *state = get_fixed_function_state(context);
+    state->current_color[0] = FIXED_TO_FLOAT(red);
+    state->current_color[1] = FIXED_TO_FLOAT(green);
+    state->current_color[2] = FIXED_TO_FLOAT(blue);
+    state->current_color[3] = FIXED_TO_FLOAT(alpha);
+}
+
+void d_glNormal3x_special(void *context, GLfixed nx, GLfixed ny, GLfixed nz)
+{
+    Fixed_Function_State *state = get_fixed_function_state(context);
+    state->current_normal[0] = FIXED_TO_FLOAT(nx);
+    state->current_normal[1] = FIXED_TO_FLOAT(ny);
+    state->current_normal[2] = FIXED_TO_FLOAT(nz);
+}
+
+void d_glMultiTexCoord4x_special(void *context, GLenum texture, GLfixed s, GLfixed t, GLfixed r, GLfixed q)
+{
+    Fixed_Function_State *state = get_fixed_function_state(context);
+    if (texture < GL_TEXTURE0 || texture >= GL_TEXTURE0 + FIXED_MAX_TEXTURE_UNITS)
+    {
+        return;
+    }
+    GLfloat *tex_coord = state->texture_env[texture - GL_TEXTURE0].tex_coord;
+    tex_coord[0] = FIXED_TO_FLOAT(s);
+    tex_coord[1] = FIXED_TO_FLOAT(t);
+    tex_coord[2] = FIXED_TO_FLOAT(r);
+    tex_coord[3] = FIXED_TO_FLOAT(q);
+}
+
+void d_glFogxv_special(void *context, GLenum pname, const GLfixed *params)
+{
+    Fixed_Function_State *state = get_fixed_function_state(context);
+    switch (pname)
+    {
+    case GL_FOG_MODE:
+        state->fog_mode = params[0];
+        break;
+    case GL_FOG_DENSITY:
+        state->fog_density = FIXED_TO_FLOAT(params[0]);
+        break;
+    case GL_FOG_START:
+        state->fog_start = FIXED_TO_FLOAT(params[0]);
+        break;
+    case GL_FOG_END:
+        state->fog_end = FIXED_TO_FLOAT(params[0]);
+        break;
+    case GL_FOG_COLOR:
+        fixed_to_float_array(params, state->fog_color, 4);
+        break;
+    default:
+        express_printf("unknown fog pname %x\n", pname);
+        break;
+    }
+}
+
+void d_glLightModelxv_special(void *context, GLenum pname, const GLfixed *params)
+{
+    Fixed_Function_State *state = get_fixed_function_state(context);
+    if (pname == GL_LIGHT_MODEL_TWO_SIDE)
+    {
+        state->light_model_two_side = params[0] != 0;
+    }
+    else if (pname == GL_LIGHT_MODEL_AMBIENT)
+    {
+        fixed_to_float_array(params, state->light_model_ambient, 4);
+    }
+}
+
+void d_glLightxv_special(void *context, GLenum light, GLenum pname, const GLfixed *params)
+{
+    if (light < GL_LIGHT0 || light >= GL_LIGHT0 + FIXED_MAX_LIGHTS)
+    {
+        return;
+    }
+
+    // 光源位置与方向本应乘上当前的modelview矩阵，但host看不到矩阵栈，这里按guest给的值记录
+    Fixed_Light *now_light = &(get_fixed_function_state(context)->lights[light - GL_LIGHT0]);
+    switch (pname)
+    {
+    case GL_AMBIENT:
+        fixed_to_float_array(params, now_light->ambient, 4);
+        break;
+    case GL_DIFFUSE:
+        fixed_to_float_array(params, now_light->diffuse, 4);
+        break;
+    case GL_SPECULAR:
+        fixed_to_float_array(params, now_light->specular, 4);
+        break;
+    case GL_POSITION:
+        fixed_to_float_array(params, now_light->position, 4);
+        break;
+    case GL_SPOT_DIRECTION:
+        fixed_to_float_array(params, now_light->spot_direction, 3);
+        break;
+    case GL_SPOT_EXPONENT:
+        now_light->spot_exponent = FIXED_TO_FLOAT(params[0]);
+        break;
+    case GL_SPOT_CUTOFF:
+        now_light->spot_cutoff = FIXED_TO_FLOAT(params[0]);
+        break;
+    case GL_CONSTANT_ATTENUATION:
+        now_light->constant_attenuation = FIXED_TO_FLOAT(params[0]);
+        break;
+    case GL_LINEAR_ATTENUATION:
+        now_light->linear_attenuation = FIXED_TO_FLOAT(params[0]);
+        break;
+    case GL_QUADRATIC_ATTENUATION:
+        now_light->quadratic_attenuation = FIXED_TO_FLOAT(params[0]);
+        break;
+    default:
+        express_printf("unknown light pname %x\n", pname);
+        break;
+    }
+}
+
+static void fixed_material(Fixed_Material *material, GLenum pname, const GLfixed *params)
+{
+    switch (pname)
+    {
+    case GL_AMBIENT:
+        fixed_to_float_array(params, material->ambient, 4);
+        break;
+    case GL_DIFFUSE:
+        fixed_to_float_array(params, material->diffuse, 4);
+        break;
+    case GL_AMBIENT_AND_DIFFUSE:
+        fixed_to_float_array(params, material->ambient, 4);
+        fixed_to_float_array(params, material->diffuse, 4);
+        break;
+    case GL_SPECULAR:
+        fixed_to_float_array(params, material->specular, 4);
+        break;
+    case GL_EMISSION:
+        fixed_to_float_array(params, material->emission, 4);
+        break;
+    case GL_SHININESS:
+        material->shininess = FIXED_TO_FLOAT(params[0]);
+        break;
+    default:
+        express_printf("unknown material pname %x\n", pname);
+        break;
+    }
+}
+
+void d_glMaterialxv_special(void *context, GLenum face, GLenum pname, const GLfixed *params)
+{
+    Fixed_Function_State *state = get_fixed_function_state(context);
+    if (face == GL_FRONT || face == GL_FRONT_AND_BACK)
+    {
+        fixed_material(&(state->material[0]), pname, params);
+    }
+    if (face == GL_BACK || face == GL_FRONT_AND_BACK)
+    {
+        fixed_material(&(state->material[1]), pname, params);
+    }
+}
+
+void d_glPointSizex_special(void *context, GLfixed size)
+{
+    GLfloat f_size = FIXED_TO_FLOAT(size);
+    get_fixed_function_state(context)->point_size = f_size;
+    glPointSize(f_size);
+}
+
+void d_glPointParameterxv_special(void *context, GLenum pname, const GLfixed *params)
+{
+    Fixed_Function_State *state = get_fixed_function_state(context);
+    switch (pname)
+    {
+    case GL_POINT_SIZE_MIN:
+        state->point_size_min = FIXED_TO_FLOAT(params[0]);
+        break;
+    case GL_POINT_SIZE_MAX:
+        state->point_size_max = FIXED_TO_FLOAT(params[0]);
+        break;
+    case GL_POINT_FADE_THRESHOLD_SIZE:
+        state->point_fade_threshold = FIXED_TO_FLOAT(params[0]);
+        break;
+    case GL_POINT_DISTANCE_ATTENUATION:
+        fixed_to_float_array(params, state->point_distance_attenuation, 3);
+        break;
+    default:
+        express_printf("unknown point parameter pname %x\n", pname);
+        break;
+    }
+}
+
+void d_glTexGenxv_special(void *context, GLenum coord, GLenum pname, const GLfixed *params)
+{
+    Fixed_Texture_Env *env = get_active_texture_env(context);
+    if (env == NULL || coord != GL_TEXTURE_GEN_STR_OES || pname != GL_TEXTURE_GEN_MODE_OES)
+    {
+        return;
+    }
+    env->tex_gen_mode = params[0];
+}
+
+void d_glClipPlanef_special(void *context, GLenum plane, const GLfloat *equation)
+{
+    if (plane < GL_CLIP_PLANE0 || plane >= GL_CLIP_PLANE0 + FIXED_MAX_CLIP_PLANES)
+    {
+        return;
+    }
+    memcpy(get_fixed_function_state(context)->clip_planes[plane - GL_CLIP_PLANE0], equation, sizeof(GLfloat) * 4);
+}
+
+void d_glClipPlanex_special(void *context, GLenum plane, const GLfixed *equation)
+{
+    GLfloat f_equation[4];
+    fixed_to_float_array(equation, f_equation, 4);
+    d_glClipPlanef_special(context, plane, f_equation);
+}
+
+/**
+ * @brief 当前矩阵右乘m，矩阵都是列主序
+ */
+static void fixed_mult_matrix(void *context, const GLfloat *m)
+{
+    GLfloat *matrix = get_fixed_function_state(context)->matrix;
+    GLfloat result[16];
+
+    for (int col = 0; col < 4; col++)
+    {
+        for (int row = 0; row < 4; row++)
+        {
+            GLfloat sum = 0.0f;
+            for (int k = 0; k < 4; k++)
+            {
+                sum += matrix[k * 4 + row] * m[col * 4 + k];
+            }
+            result[col * 4 + row] = sum;
+        }
+    }
+    memcpy(matrix, result, sizeof(result));
+}
+
+void d_glLoadMatrixx_special(void *context, const GLfixed *m)
+{
+    fixed_to_float_array(m, get_fixed_function_state(context)->matrix, 16);
+}
+
+void d_glMultMatrixx_special(void *context, const GLfixed *m)
+{
+    GLfloat f_m[16];
+    fixed_to_float_array(m, f_m, 16);
+    fixed_mult_matrix(context, f_m);
+}
+
+void d_glRotatex_special(void *context, GLfixed angle, GLfixed x, GLfixed y, GLfixed z)
+{
+    GLfloat fx = FIXED_TO_FLOAT(x);
+    GLfloat fy = FIXED_TO_FLOAT(y);
+    GLfloat fz = FIXED_TO_FLOAT(z);
+    GLfloat len = sqrtf(fx * fx + fy * fy + fz * fz);
+    if (len == 0.0f)
+    {
+        return;
+    }
+    fx /= len;
+    fy /= len;
+    fz /= len;
+
+    GLfloat radian = FIXED_TO_FLOAT(angle) * (GLfloat)M_PI / 180.0f;
+    GLfloat c = cosf(radian);
+    GLfloat s = sinf(radian);
+    GLfloat nc = 1.0f - c;
+
+    GLfloat m[16] = {
+        fx * fx * nc + c, fy * fx * nc + fz * s, fx * fz * nc - fy * s, 0.0f,
+        fx * fy * nc - fz * s, fy * fy * nc + c, fy * fz * nc + fx * s, 0.0f,
+        fx * fz * nc + fy * s, fy * fz * nc - fx * s, fz * fz * nc + c, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f};
+    fixed_mult_matrix(context, m);
+}
+
+void d_glScalex_special(void *context, GLfixed x, GLfixed y, GLfixed z)
+{
+    GLfloat m[16];
+    matrix_identity(m);
+    m[0] = FIXED_TO_FLOAT(x);
+    m[5] = FIXED_TO_FLOAT(y);
+    m[10] = FIXED_TO_FLOAT(z);
+    fixed_mult_matrix(context, m);
+}
+
+void d_glTranslatex_special(void *context, GLfixed x, GLfixed y, GLfixed z)
+{
+    GLfloat m[16];
+    matrix_identity(m);
+    m[12] = FIXED_TO_FLOAT(x);
+    m[13] = FIXED_TO_FLOAT(y);
+    m[14] = FIXED_TO_FLOAT(z);
+    fixed_mult_matrix(context, m);
+}
+
+void d_glFrustumf_special(void *context, GLfloat l, GLfloat r, GLfloat b, GLfloat t, GLfloat n, GLfloat f)
+{
+    if (l == r || b == t || n == f || n <= 0.0f || f <= 0.0f)
+    {
+        return;
+    }
+
+    GLfloat m[16] = {0};
+    m[0] = 2.0f * n / (r - l);
+    m[5] = 2.0f * n / (t - b);
+    m[8] = (r + l) / (r - l);
+    m[9] = (t + b) / (t - b);
+    m[10] = -(f + n) / (f - n);
+    m[11] = -1.0f;
+    m[14] = -2.0f * f * n / (f - n);
+    fixed_mult_matrix(context, m);
+}
+
+void d_glOrthof_special(void *context, GLfloat l, GLfloat r, GLfloat b, GLfloat t, GLfloat n, GLfloat f)
+{
+    if (l == r || b == t || n == f)
+    {
+        return;
+    }
+
+    GLfloat m[16];
+    matrix_identity(m);
+    m[0] = 2.0f / (r - l);
+    m[5] = 2.0f / (t - b);
+    m[10] = -2.0f / (f - n);
+    m[12] = -(r + l) / (r - l);
+    m[13] = -(t + b) / (t - b);
+    m[14] = -(f + n) / (f - n);
+    fixed_mult_matrix(context, m);
+}
+
+void d_glGetTexEnvxv_special(void *context, GLenum target, GLenum pname, GLfixed *params)
+{
+    Fixed_Texture_Env *env = get_active_texture_env(context);
+    if (env == NULL)
+    {
+        return;
+    }
+
+    if (target == GL_POINT_SPRITE_OES)
+    {
+        params[0] = env->coord_replace;
+        return;
+    }
+
+    switch (pname)
+    {
+    case GL_TEXTURE_ENV_MODE:
+        params[0] = env->mode;
+        break;
+    case GL_COMBINE_RGB:
+        params[0] = env->combine_rgb;
+        break;
+    case GL_COMBINE_ALPHA:
+        params[0] = env->combine_alpha;
+        break;
+    case GL_SRC0_RGB:
+    case GL_SRC1_RGB:
+    case GL_SRC2_RGB:
+        params[0] = env->src_rgb[pname - GL_SRC0_RGB];
+        break;
+    case GL_SRC0_ALPHA:
+    case GL_SRC1_ALPHA:
+    case GL_SRC2_ALPHA:
+        params[0] = env->src_alpha[pname - GL_SRC0_ALPHA];
+        break;
+    case GL_OPERAND0_RGB:
+    case GL_OPERAND1_RGB:
+    case GL_OPERAND2_RGB:
+        params[0] = env->operand_rgb[pname - GL_OPERAND0_RGB];
+        break;
+    case GL_OPERAND0_ALPHA:
+    case GL_OPERAND1_ALPHA:
+    case GL_OPERAND2_ALPHA:
+        params[0] = env->operand_alpha[pname - GL_OPERAND0_ALPHA];
+        break;
+    case GL_RGB_SCALE:
+        params[0] = float_to_fixed(env->rgb_scale);
+        break;
+    case GL_ALPHA_SCALE:
+        params[0] = float_to_fixed(env->alpha_scale);
+        break;
+    case GL_TEXTURE_ENV_COLOR:
+        float_to_fixed_array(env->color, params, 4);
+        break;
+    default:
+        express_printf("unknown get tex env pname %x\n", pname);
+        break;
+    }
+}
+
+void fixed_get_tex_parameterv(GLenum target, GLenum pname, GLfixed *params)
+{
+    switch (pname)
+    {
+    case GL_TEXTURE_MIN_LOD:
+    case GL_TEXTURE_MAX_LOD:
+    case GL_TEXTURE_MAX_ANISOTROPY_EXT:
+    {
+        GLfloat value;
+        glGetTexParameterfv(target, pname, &value);
+        params[0] = float_to_fixed(value);
+        break;
+    }
+    case GL_TEXTURE_BORDER_COLOR:
+    {
+        GLfloat value[4];
+        glGetTexParameterfv(target, pname, value);
+        float_to_fixed_array(value, params, 4);
+        break;
+    }
+    default:
+        // 其余的纹理参数都是枚举或者整数，不需要转换
+        glGetTexParameteriv(target, pname, params);
+        break;
+    }
+}
+
+void d_glGetLightxv_special(void *context, GLenum light, GLenum pname, GLfixed *params)
+{
+    if (light < GL_LIGHT0 || light >= GL_LIGHT0 + FIXED_MAX_LIGHTS)
+    {
+        return;
+    }
+
+    Fixed_Light *now_light = &(get_fixed_function_state(context)->lights[light - GL_LIGHT0]);
+    switch (pname)
+    {
+    case GL_AMBIENT:
+        float_to_fixed_array(now_light->ambient, params, 4);
+        break;
+    case GL_DIFFUSE:
+        float_to_fixed_array(now_light->diffuse, params, 4);
+        break;
+    case GL_SPECULAR:
+        float_to_fixed_array(now_light->specular, params, 4);
+        break;
+    case GL_POSITION:
+        float_to_fixed_array(now_light->position, params, 4);
+        break;
+    case GL_SPOT_DIRECTION:
+        float_to_fixed_array(now_light->spot_direction, params, 3);
+        break;
+    case GL_SPOT_EXPONENT:
+        params[0] = float_to_fixed(now_light->spot_exponent);
+        break;
+    case GL_SPOT_CUTOFF:
+        params[0] = float_to_fixed(now_light->spot_cutoff);
+        break;
+    case GL_CONSTANT_ATTENUATION:
+        params[0] = float_to_fixed(now_light->constant_attenuation);
+        break;
+    case GL_LINEAR_ATTENUATION:
+        params[0] = float_to_fixed(now_light->linear_attenuation);
+        break;
+    case GL_QUADRATIC_ATTENUATION:
+        params[0] = float_to_fixed(now_light->quadratic_attenuation);
+        break;
+    default:
+        express_printf("unknown get light pname %x\n", pname);
+        break;
+    }
+}
+
+void d_glGetMaterialxv_special(void *context, GLenum face, GLenum pname, GLfixed *params)
+{
+    Fixed_Function_State *state = get_fixed_function_state(context);
+    Fixed_Material *material = &(state->material[face == GL_BACK ? 1 : 0]);
+    switch (pname)
+    {
+    case GL_AMBIENT:
+        float_to_fixed_array(material->ambient, params, 4);
+        break;
+    case GL_DIFFUSE:
+        float_to_fixed_array(material->diffuse, params, 4);
+        break;
+    case GL_SPECULAR:
+        float_to_fixed_array(material->specular, params, 4);
+        break;
+    case GL_EMISSION:
+        float_to_fixed_array(material->emission, params, 4);
+        break;
+    case GL_SHININESS:
+        params[0] = float_to_fixed(material->shininess);
+        break;
+    default:
+        express_printf("unknown get material pname %x\n", pname);
+        break;
+    }
+}
+
+void d_glGetTexGenxv_special(void *context, GLenum coord, GLenum pname, GLfixed *params)
+{
+    Fixed_Texture_Env *env = get_active_texture_env(context);
+    if (env == NULL || pname != GL_TEXTURE_GEN_MODE_OES)
+    {
+        return;
+    }
+    params[0] = env->tex_gen_mode;
+}
+
+void d_glGetClipPlanex_special(void *context, GLenum plane, GLfixed *equation)
+{
+    if (plane < GL_CLIP_PLANE0 || plane >= GL_CLIP_PLANE0 + FIXED_MAX_CLIP_PLANES)
+    {
+        return;
+    }
+    float_to_fixed_array(get_fixed_function_state(context)->clip_planes[plane - GL_CLIP_PLANE0], equation, 4);
+}
+
+void d_glGetFixedv_special(void *context, GLenum pname, GLfixed *params)
+{
+    Fixed_Function_State *state = get_fixed_function_state(context);
+    Fixed_Texture_Env *env = get_active_texture_env(context);
+
+    // 布尔值按照GLES1的规定转换为0与1.0
+    GLboolean bool_value;
+
+    switch (pname)
+    {
+    case GL_ALPHA_TEST_FUNC:
+        params[0] = state->alpha_func;
+        return;
+    case GL_ALPHA_TEST_REF:
+        params[0] = float_to_fixed(state->alpha_ref);
+        return;
+    case GL_FOG_MODE:
+        params[0] = state->fog_mode;
+        return;
+    case GL_FOG_DENSITY:
+        params[0] = float_to_fixed(state->fog_density);
+        return;
+    case GL_FOG_START:
+        params[0] = float_to_fixed(state->fog_start);
+        return;
+    case GL_FOG_END:
+        params[0] = float_to_fixed(state->fog_end);
+        return;
+    case GL_FOG_COLOR:
+        float_to_fixed_array(state->fog_color, params, 4);
+        return;
+    case GL_LIGHT_MODEL_AMBIENT:
+        float_to_fixed_array(state->light_model_ambient, params, 4);
+        return;
+    case GL_SHADE_MODEL:
+        params[0] = state->shade_model;
+        return;
+    case GL_CURRENT_COLOR:
+        float_to_fixed_array(state->current_color, params, 4);
+        return;
+    case GL_CURRENT_NORMAL:
+        float_to_fixed_array(state->current_normal, params, 3);
+        return;
+    case GL_CURRENT_TEXTURE_COORDS:
+        if (env != NULL)
+        {
+            float_to_fixed_array(env->tex_coord, params, 4);
+        }
+        return;
+    case GL_POINT_SIZE_MIN:
+        params[0] = float_to_fixed(state->point_size_min);
+        return;
+    case GL_POINT_SIZE_MAX:
+        params[0] = float_to_fixed(state->point_size_max);
+        return;
+    case GL_POINT_FADE_THRESHOLD_SIZE:
+        params[0] = float_to_fixed(state->point_fade_threshold);
+        return;
+    case GL_POINT_DISTANCE_ATTENUATION:
+        float_to_fixed_array(state->point_distance_attenuation, params, 3);
+        return;
+    case GL_LIGHT_MODEL_TWO_SIDE:
+        bool_value = state->light_model_two_side;
+        break;
+    case GL_TEXTURE_2D:
+        bool_value = env != NULL && env->enabled;
+        break;
+    case GL_ALPHA_TEST:
+        bool_value = state->alpha_test;
+        break;
+    case GL_FOG:
+        bool_value = state->fog;
+        break;
+    case GL_LIGHTING:
+        bool_value = state->lighting;
+        break;
+    case GL_COLOR_MATERIAL:
+        bool_value = state->color_material;
+        break;
+    case GL_NORMALIZE:
+        bool_value = state->normalize;
+        break;
+    case GL_RESCALE_NORMAL:
+        bool_value = state->rescale_normal;
+        break;
+    case GL_POINT_SPRITE_OES:
+        bool_value = state->point_sprite;
+        break;
+    default:
+        if (pname >= GL_LIGHT0 && pname < GL_LIGHT0 + FIXED_MAX_LIGHTS)
+        {
+            bool_value = state->lights[pname - GL_LIGHT0].enabled;
+            break;
+        }
+        if (pname >= GL_CLIP_PLANE0 && pname < GL_CLIP_PLANE0 + FIXED_MAX_CLIP_PLANES)
+        {
+            bool_value = state->clip_plane_enabled[pname - GL_CLIP_PLANE0];
+            break;
+        }
+
+        // 其他状态core profile里也有，从host查询后转换
+        {
+            GLfloat value[16];
+            int num = gl_pname_size(pname);
+            if (num <= 0 || num > 16)
+            {
+                num = 1;
+            }
+            glGetFloatv(pname, value);
+            float_to_fixed_array(value, params, num);
+        }
+        return;
+    }
+
+    params[0] = bool_value ? 0x10000 : 0;
+}
+
+GLbitfield d_glQueryMatrixx_special(void *context, GLfixed *mantissa, GLint *exponent)
+{
+    GLfloat *matrix = get_fixed_function_state(context)->matrix;
+    GLbitfield status = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        if (!isfinite(matrix[i]))
+        {
+            // 第i位为1表示这个元素不是有效的数
+            status |= 1u << i;
+            mantissa[i] = 0;
+            exponent[i] = 0;
+            continue;
+        }
+
+        // frexp返回[0.5, 1)之间的尾数，乘上2^16就是定点数
+        int exp;
+        double m = frexp(matrix[i], &exp);
+        mantissa[i] = (GLfixed)(m * 65536.0);
+        exponent[i] = exp;
+    }
+
+    return status;
+}
+
+/**
+ * @brief 某个纹理单元在glDrawTexiOES时是否参与采样
+ */
+static bool fixed_texture_unit_enabled(Fixed_Function_State *state, int unit)
+{
+    if (!state->texture_enable_seen)
+    {
+        // 与之前的行为保持一致，guest没开关过GL_TEXTURE_2D时只采样0号纹理单元
+        return unit == 0;
+    }
+    return state->texture_env[unit].enabled;
+}
+
+static void fixed_program_key_init(Fixed_Function_State *state, Fixed_Program_Key *key)
+{
+    memset(key, 0, sizeof(Fixed_Program_Key));
+
+    for (int i = 0; i < FIXED_MAX_TEXTURE_UNITS; i++)
+    {
+        if (!fixed_texture_unit_enabled(state, i))
+        {
+            continue;
+        }
+
+        Fixed_Texture_Env *env = &(state->texture_env[i]);
+        Fixed_Program_Unit_Key *unit = &(key->units[i]);
+        unit->mode = env->mode;
+        if (env->mode == GL_COMBINE)
+        {
+            unit->combine_rgb = env->combine_rgb;
+            unit->combine_alpha = env->combine_alpha;
+            memcpy(unit->src_rgb, env->src_rgb, sizeof(unit->src_rgb));
+            memcpy(unit->src_alpha, env->src_alpha, sizeof(unit->src_alpha));
+            memcpy(unit->operand_rgb, env->operand_rgb, sizeof(unit->operand_rgb));
+            memcpy(unit->operand_alpha, env->operand_alpha, sizeof(unit->operand_alpha));
+        }
+    }
+
+    if (state->alpha_test && state->alpha_func != GL_ALWAYS)
+    {
+        key->alpha_func = state->alpha_func;
+    }
+    key->fog = state->fog;
+}
+
+/**
+ * @brief 生成GL_COMBINE的一个参数，is_alpha为true时只取alpha分量
+ */
+static void append_combine_arg(GString *code, int unit, GLenum src, GLenum operand, bool is_alpha)
+{
+    char src_name[32];
+    switch (src)
+    {
+    case GL_CONSTANT:
+        snprintf(src_name, sizeof(src_name), "u_env_color%d", unit);
+        break;
+    case GL_PRIMARY_COLOR:
+        snprintf(src_name, sizeof(src_name), "u_color");
+        break;
+    case GL_PREVIOUS:
+        snprintf(src_name, sizeof(src_name), "prev");
+        break;
+    case GL_TEXTURE:
+    default:
+        snprintf(src_name, sizeof(src_name), "tex%d", unit);
+        break;
+    }
+
+    switch (operand)
+    {
+    case GL_ONE_MINUS_SRC_COLOR:
+        g_string_append_printf(code, is_alpha ? "(1.0 - %s.a)" : "(vec3(1.0) - %s.rgb)", src_name);
+        break;
+    case GL_SRC_ALPHA:
+        g_string_append_printf(code, is_alpha ? "%s.a" : "vec3(%s.a)", src_name);
+        break;
+    case GL_ONE_MINUS_SRC_ALPHA:
+        g_string_append_printf(code, is_alpha ? "(1.0 - %s.a)" : "vec3(1.0 - %s.a)", src_name);
+        break;
+    case GL_SRC_COLOR:
+    default:
+        g_string_append_printf(code, is_alpha ? "%s.a" : "%s.rgb", src_name);
+        break;
+    }
+}
+
+/**
+ * @brief 生成GL_COMBINE的一个通道，结果保存在变量name中
+ */
+static void append_combine(GString *code, int unit, GLenum combine, const GLenum *src, const GLenum *operand, bool is_alpha, const char *name)
+{
+    int arg_num = 2;
+    if (combine == GL_REPLACE)
+    {
+        arg_num = 1;
+    }
+    else if (combine == GL_INTERPOLATE)
+    {
+        arg_num = 3;
+    }
+
+    for (int i = 0; i < arg_num; i++)
+    {
+        g_string_append_printf(code, "    %s arg%d_%s = ", is_alpha ? "float" : "vec3", i, name);
+        append_combine_arg(code, unit, src[i], operand[i], is_alpha);
+        g_string_append(code, ";\n");
+    }
+
+    g_string_append_printf(code, "    %s %s = ", is_alpha ? "float" : "vec3", name);
+    switch (combine)
+    {
+    case GL_REPLACE:
+        g_string_append_printf(code, "arg0_%s;\n", name);
+        break;
+    case GL_ADD:
+        g_string_append_printf(code, "arg0_%s + arg1_%s;\n", name, name);
+        break;
+    case GL_ADD_SIGNED:
+        g_string_append_printf(code, "arg0_%s + arg1_%s - 0.5;\n", name, name);
+        break;
+    case GL_INTERPOLATE:
+        g_string_append_printf(code, "mix(arg1_%s, arg0_%s, arg2_%s);\n", name, name, name);
+        break;
+    case GL_SUBTRACT:
+        g_string_append_printf(code, "arg0_%s - arg1_%s;\n", name, name);
+        break;
+    case GL_DOT3_RGB:
+    case GL_DOT3_RGBA:
+        if (is_alpha)
+        {
+            // DOT3_RGBA的alpha在rgb通道中计算，这里不会走到
+            g_string_append_printf(code, "arg0_%s * arg1_%s;\n", name, name);
+        }
+        else
+        {
+            g_string_append_printf(code, "vec3(4.0 * dot(arg0_%s - 0.5, arg1_%s - 0.5));\n", name, name);
+        }
+        break;
+    case GL_MODULATE:
+    default:
+        g_string_append_printf(code, "arg0_%s * arg1_%s;\n", name, name);
+        break;
+    }
+}
+
+static void append_texture_unit(GString *code, const Fixed_Program_Unit_Key *key, int unit)
+{
+    g_string_append_printf(code, "    vec4 tex%d = texture(u_texture%d, tex_coord);\n", unit, unit);
+
+    switch (key->mode)
+    {
+    case GL_REPLACE:
+        g_string_append_printf(code, "    prev = tex%d;\n", unit);
+        break;
+    case GL_DECAL:
+        g_string_append_printf(code, "    prev = vec4(mix(prev.rgb, tex%d.rgb, tex%d.a), prev.a);\n", unit, unit);
+        break;
+    case GL_BLEND:
+        g_string_append_printf(code, "    prev = vec4(mix(prev.rgb, u_env_color%d.rgb, tex%d.rgb), prev.a * tex%d.a);\n", unit, unit, unit);
+        break;
+    case GL_ADD:
+        g_string_append_printf(code, "    prev = vec4(prev.rgb + tex%d.rgb, prev.a * tex%d.a);\n", unit, unit);
+        break;
+    case GL_COMBINE:
+    {
+        char rgb_name[16];
+        char alpha_name[16];
+        snprintf(rgb_name, sizeof(rgb_name), "rgb%d", unit);
+        snprintf(alpha_name, sizeof(alpha_name), "alpha%d", unit);
+
+        g_string_append(code, "    {\n");
+        append_combine(code, unit, key->combine_rgb, key->src_rgb, key->operand_rgb, false, rgb_name);
+        if (key->combine_rgb == GL_DOT3_RGBA)
+        {
+            g_string_append_printf(code, "    float %s = %s.r;\n", alpha_name, rgb_name);
+        }
+        else
+        {
+            append_combine(code, unit, key->combine_alpha, key->src_alpha, key->operand_alpha, true, alpha_name);
+        }
+        g_string_append_printf(code, "    prev = clamp(vec4(%s, %s) * u_env_scale%d, 0.0, 1.0);\n", rgb_name, alpha_name, unit);
+        g_string_append(code, "    }\n");
+        break;
+    }
+    case GL_MODULATE:
+    default:
+        g_string_append_printf(code, "    prev = prev * tex%d;\n", unit);
+        break;
+    }
+    g_string_append(code, "    prev = clamp(prev, 0.0, 1.0);\n");
+}
+
+static const char *alpha_func_condition(GLenum func)
+{
+    // 返回的是丢弃片段的条件
+    switch (func)
+    {
+    case GL_NEVER:
+        return "true";
+    case GL_LESS:
+        return "prev.a >= u_alpha_ref";
+    case GL_EQUAL:
+        return "prev.a != u_alpha_ref";
+    case GL_LEQUAL:
+        return "prev.a > u_alpha_ref";
+    case GL_GREATER:
+        return "prev.a <= u_alpha_ref";
+    case GL_NOTEQUAL:
+        return "prev.a == u_alpha_ref";
+    case GL_GEQUAL:
+        return "prev.a < u_alpha_ref";
+    default:
+        return "false";
+    }
+}
+
+static Fixed_Program *create_fixed_program(const Fixed_Program_Key *key)
+{
+    GString *code = g_string_new(DRAW_TEXI_SHADER_VERSION);
+
+    g_string_append(code, "precision mediump float;\n"
+                          "out vec4 frag_color;\n"
+                          "in vec2 tex_coord;\n"
+                          "uniform vec4 u_color;\n"
+                          "uniform float u_alpha_ref;\n"
+                          "uniform vec4 u_fog_color;\n"
+                          "uniform float u_fog_factor;\n");
+    for (int i = 0; i < FIXED_MAX_TEXTURE_UNITS; i++)
+    {
+        if (key->units[i].mode != 0)
+        {
+            g_string_append_printf(code, "uniform sampler2D u_texture%d;\n"
+                                         "uniform vec4 u_env_color%d;\n"
+                                         "uniform vec4 u_env_scale%d;\n",
+                                   i, i, i);
+        }
+    }
+
+    g_string_append(code, "void main()\n"
+                          "{\n"
+                          "    vec4 prev = u_color;\n");
+    for (int i = 0; i < FIXED_MAX_TEXTURE_UNITS; i++)
+    {
+        if (key->units[i].mode != 0)
+        {
+            append_texture_unit(code, &(key->units[i]), i);
+        }
+    }
+
+    if (key->alpha_func != 0)
+    {
+        g_string_append_printf(code, "    if (%s) discard;\n", alpha_func_condition(key->alpha_func));
+    }
+    if (key->fog)
+    {
+        g_string_append(code, "    prev.rgb = mix(u_fog_color.rgb, prev.rgb, u_fog_factor);\n");
+    }
+    g_string_append(code, "    frag_color = prev;\n"
+                          "}\n");
+
+    GLuint vertex = load_shader(GL_VERTEX_SHADER, draw_texi_vertex_shader);
+    GLuint fragment = load_shader(GL_FRAGMENT_SHADER, code->str);
+    g_string_free(code, TRUE);
+
+    if (vertex == 0 || fragment == 0)
+    {
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        return NULL;
+    }
+
+    GLuint program_id = glCreateProgram();
+    glAttachShader(program_id, vertex);
+    glAttachShader(program_id, fragment);
+    glLinkProgram(program_id);
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+
+    GLint success;
+    glGetProgramiv(program_id, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        char info_log[512];
+        glGetProgramInfoLog(program_id, sizeof(info_log), NULL, info_log);
+        express_printf("fixed function program link error %s\n", info_log);
+        glDeleteProgram(program_id);
+        return NULL;
+    }
+
+    Fixed_Program *program = g_malloc0(sizeof(Fixed_Program));
+    program->program = program_id;
+    program->color_loc = glGetUniformLocation(program_id, "u_color");
+    program->alpha_ref_loc = glGetUniformLocation(program_id, "u_alpha_ref");
+    program->fog_color_loc = glGetUniformLocation(program_id, "u_fog_color");
+    program->fog_factor_loc = glGetUniformLocation(program_id, "u_fog_factor");
+
+    char name[32];
+    for (int i = 0; i < FIXED_MAX_TEXTURE_UNITS; i++)
+    {
+        snprintf(name, sizeof(name), "u_texture%d", i);
+        program->texture_loc[i] = glGetUniformLocation(program_id, name);
+        snprintf(name, sizeof(name), "u_env_color%d", i);
+        program->env_color_loc[i] = glGetUniformLocation(program_id, name);
+        snprintf(name, sizeof(name), "u_env_scale%d", i);
+        program->env_scale_loc[i] = glGetUniformLocation(program_id, name);
+    }
+
+    return program;
+}
+
+/**
+ * @brief glDrawTexiOES的片段在视点处，按照距离0计算雾的系数
+ */
+static GLfloat fixed_fog_factor(Fixed_Function_State *state)
+{
+    if (state->fog_mode == GL_LINEAR)
+    {
+        if (state->fog_end == state->fog_start)
+        {
+            return 1.0f;
+        }
+        GLfloat factor = state->fog_end / (state->fog_end - state->fog_start);
+        return factor < 0.0f ? 0.0f : (factor > 1.0f ? 1.0f : factor);
+    }
+    // GL_EXP与GL_EXP2在距离为0时都是1
+    return 1.0f;
+}
+
+/**
+ * @brief 按照当前的固定管线状态选择着色器并设置uniform，返回false时使用默认的着色器
+ */
+static bool use_fixed_program(void *context)
+{
+    Fixed_Function_State *state = get_fixed_function_state(context);
+    Fixed_Program_Key key;
+    fixed_program_key_init(state, &key);
+
+    Fixed_Program *program = g_hash_table_lookup(state->program_cache, &key);
+    if (program == NULL)
+    {
+        program = create_fixed_program(&key);
+        if (program == NULL)
+        {
+            return false;
+        }
+        g_hash_table_insert(state->program_cache, g_memdup2(&key, sizeof(key)), program);
+    }
+
+    glUseProgram(program->program);
+    glUniform4fv(program->color_loc, 1, state->current_color);
+    glUniform1f(program->alpha_ref_loc, state->alpha_ref);
+    glUniform4fv(program->fog_color_loc, 1, state->fog_color);
+    glUniform1f(program->fog_factor_loc, fixed_fog_factor(state));
+
+    for (int i = 0; i < FIXED_MAX_TEXTURE_UNITS; i++)
+    {
+        if (key.units[i].mode == 0)
+        {
+            continue;
+        }
+        Fixed_Texture_Env *env = &(state->texture_env[i]);
+        glUniform1i(program->texture_loc[i], i);
+        glUniform4fv(program->env_color_loc[i], 1, env->color);
+        glUniform4f(program->env_scale_loc[i], env->rgb_scale, env->rgb_scale, env->rgb_scale, env->alpha_scale);
+
+        if (DSA_LIKELY(host_opengl_version >= 45 && DSA_enable != 0))
+        {
+            texture_unit_status_sync(context, i);
+        }
+    }
+
+    return true;
 }
 
 void d_glDrawTexiOES_special(void *context, GLint x, GLint y, GLint z, GLint width, GLint height, GLfloat left_x, GLfloat right_x, GLfloat bottom_y, GLfloat top_y)
@@ -125,8 +1552,12 @@ void d_glDrawTexiOES_special(void *context, GLint x, GLint y, GLint z, GLint wid
         Bound_Buffer *bound_buffer = &(opengl_context->bound_buffer_status);
         Buffer_Status *status = &(bound_buffer->buffer_status);
 
-        glUseProgram(draw_texi_program);
-        glUniform1i(draw_texi_texture_id_loc, 0);
+        if (!use_fixed_program(context))
+        {
+            glUseProgram(draw_texi_program);
+            glUniform1i(draw_texi_texture_id_loc, 0);
+            texture_unit_status_sync(context, 0);
+        }
         glViewport(x, y, width, height);
 
         if (status->host_vao != opengl_context->draw_texi_vao)
@@ -142,8 +1573,6 @@ void d_glDrawTexiOES_special(void *context, GLint x, GLint y, GLint z, GLint wid
 
         glNamedBufferSubData(opengl_context->draw_texi_vbo, (GLintptr)0, (GLsizeiptr)20 * sizeof(float), positions_tex_coord);
 
-        texture_unit_status_sync(context, 0);
-
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
         glViewport(opengl_context->view_x, opengl_context->view_y, opengl_context->view_w, opengl_context->view_h);
@@ -157,7 +1586,11 @@ void d_glDrawTexiOES_special(void *context, GLint x, GLint y, GLint z, GLint wid
 
         glGetIntegerv(GL_VERTEX_ARRAY_BINDING, (GLint *)&pre_vao);
 
-        glUseProgram(draw_texi_program);
+        bool use_fixed = use_fixed_program(context);
+        if (!use_fixed)
+        {
+            glUseProgram(draw_texi_program);
+        }
 
         if (opengl_context->draw_texi_vao == 0)
         {
@@ -179,13 +1612,16 @@ void d_glDrawTexiOES_special(void *context, GLint x, GLint y, GLint z, GLint wid
 
         // LOGI("glv1 draw texture %d x %d y %d z %d width %d height %d left_x %f right_x %f bottom_y %f top_y %f",opengl_context->current_texture_2D[opengl_context->current_active_texture], x, y, z, width, height, left_x, right_x, bottom_y, top_y);
 
-        GLint now_texture_target;
-        glGetIntegerv(GL_ACTIVE_TEXTURE, &now_texture_target);
+        if (!use_fixed)
+        {
+            GLint now_texture_target;
+            glGetIntegerv(GL_ACTIVE_TEXTURE, &now_texture_target);
 
-        // GLuint now_bind_texture;
-        // glGetIntegerv(GL_TEXTURE_BINDING_2D, &now_bind_texture);
+            // GLuint now_bind_texture;
+            // glGetIntegerv(GL_TEXTURE_BINDING_2D, &now_bind_texture);
 
-        glUniform1i(draw_texi_texture_id_loc, now_texture_target - GL_TEXTURE0);
+            glUniform1i(draw_texi_texture_id_loc, now_texture_target - GL_TEXTURE0);
+        }
         glViewport(x, y, width, height);
 
         glBindVertexArray(opengl_context->draw_texi_vao);
@@ -207,26 +1643,9 @@ void prepare_draw_texi(void)
 {
     if (draw_texi_program == 0)
     {
-        //数组取地址不是字符串指针的指针，所以这里不要用数组
-#ifdef _WIN32
-        const char *vShaderCode = "#version 300 es\n"
-#else
-        const char *vShaderCode = "#version 330\n"
-#endif
-                                  "layout(location = 0) in vec3 a_pos;\n"
-                                  "layout(location = 1) in vec2 atex_coord;\n"
-                                  "out vec2 tex_coord;\n"
-                                  "void main()\n"
-                                  "{\n"
-                                  "    gl_Position = vec4(a_pos, 1.0);\n"
-                                  "    tex_coord = atex_coord;\n"
-                                  "}\n";
+        const char *vShaderCode = draw_texi_vertex_shader;
 
-#ifdef _WIN32
-        const char *fShaderCode = "#version 300 es\n"
-#else
-        const char *fShaderCode = "#version 330\n"
-#endif
+        const char *fShaderCode = DRAW_TEXI_SHADER_VERSION
                                   "precision mediump float;\n"
                                   "out vec4 frag_color;\n"
                                   "in vec2 tex_coord;\n"
@@ -3,6 +3,8 @@
 #include "hw/express-gpu/glv3_context.h"
 #include "hw/express-gpu/glv3_resource.h"
 #include "hw/express-gpu/glv3_program.h"
+#include "hw/express-gpu/glv1.h"
+#include "hw/express-gpu/express_gpu_timer.h"
 
 #include "glad/glad.h"
 #include "hw/express-gpu/egl_window.h"
@@ -124,8 +126,17 @@ void resource_context_destroy(Resource_Context *resources)
         {
             g_free(resources->texture_resource->gbuffer_ptr_map);
         }
+        // 快照恢复后一直没有用到的纹理和缓冲区
+        if (resources->texture_resource->restore_pending != NULL)
+        {
+            g_hash_table_destroy(resources->texture_resource->restore_pending);
+        }
 
         DESTROY_RESOURCES(buffer_resource, glDeleteBuffers);
+        if (resources->buffer_resource->restore_pending != NULL)
+        {
+            g_hash_table_destroy(resources->buffer_resource->restore_pending);
+        }
         DESTROY_RESOURCES(render_buffer_resource, glDeleteRenderbuffers);
         DESTROY_RESOURCES(sampler_resource, glDeleteSamplers);
 
@@ -399,6 +410,10 @@ Opengl_Context *opengl_context_create(Opengl_Context *share_context, int context
     opengl_context->draw_texi_vao = 0;
     opengl_context->draw_texi_ebo = 0;
 
+    opengl_context->fixed_function_state = NULL;
+
+    opengl_context->gpu_timer = NULL;
+
     opengl_context->debug_message_buffer = NULL;
 
     return opengl_context;
@@ -536,6 +551,10 @@ void opengl_context_destroy(Opengl_Context *context)
         glDeleteVertexArrays(1, &(opengl_context->draw_texi_vao));
     }
 
+    fixed_function_state_destroy(opengl_context);
+
+    gpu_timer_destroy(opengl_context);
+
     resource_context_destroy(&(opengl_context->resource_status));
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
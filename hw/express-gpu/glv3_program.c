@@ -245,6 +245,7 @@ void d_glUseProgram_special(void *context, GLuint program)
         opengl_context->is_using_external_program = 0;
     }
 
+    opengl_context->current_program = program;
     glUseProgram(program);
 }
 
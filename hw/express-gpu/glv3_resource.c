@@ -2,6 +2,7 @@
 
 #include "hw/express-gpu/glv3_resource.h"
 #include "hw/express-gpu/glv3_program.h"
+#include "hw/express-gpu/express_gpu_snapshot.h"
 
 /**
  * @brief 创建一个host这端的id映射关系，映射关系为guest id到host id，方便查找真正的host id
@@ -110,6 +111,11 @@ void remove_host_map_ids(Resource_Map_Status *status, int n, const unsigned int
         return;
     }
 
+    if (unlikely(status->restore_pending != NULL))
+    {
+        express_gpu_snapshot_forget_objects(status, n, guest_ids);
+    }
+
     for (int i = 0; i < n; i++)
     {
         if (guest_ids[i] > status->max_id || status->max_id == 0 || guest_ids[i] == 0)
@@ -212,6 +218,12 @@ unsigned long long get_host_texture_id(void *context, unsigned int id)
     Resource_Context *resource_status = &(((Opengl_Context *)context)->resource_status);
     Resource_Map_Status *map_status = resource_status->texture_resource;
 
+    // 快照恢复的纹理第一次使用时才上传内容
+    if (unlikely(map_status->restore_pending != NULL))
+    {
+        express_gpu_snapshot_restore_object(context, map_status, id);
+    }
+
     return get_host_resource_id(map_status, id);
 }
 
@@ -244,6 +256,11 @@ unsigned long long get_host_buffer_id(void *context, unsigned int id)
         return host_id;
     }
 
+    if (unlikely(map_status->restore_pending != NULL))
+    {
+        express_gpu_snapshot_restore_object(context, map_status, id);
+    }
+
     return get_host_resource_id(map_status, id);
 }
 
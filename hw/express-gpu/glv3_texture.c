@@ -3,6 +3,7 @@
 #include "hw/express-gpu/glv3_texture.h"
 #include "hw/express-gpu/glv3_status.h"
 #include "hw/express-gpu/glv3_resource.h"
+#include "hw/express-gpu/texture_transcode.h"
 
 #include "hw/express-gpu/express_gpu.h"
 
@@ -405,6 +406,14 @@ void d_glCompressedTexImage3D_without_bound(void *context, GLenum target, GLint
         return;
     }
 
+    if (texture_transcode_needed(internalformat))
+    {
+        void *pixels = texture_transcode_read_guest(guest_mem, imageSize);
+        texture_transcode_image(context, target, level, internalformat, width, height, depth, true, pixels, imageSize);
+        g_free(pixels);
+        return;
+    }
+
     if (guest_mem->all_len == 0)
     {
         Buffer_Status *buffer_status = &(opengl_context->bound_buffer_status.buffer_status);
@@ -450,6 +459,14 @@ void d_glCompressedTexImage3D_with_bound(void *context, GLenum target, GLint lev
         return;
     }
 
+    if (texture_transcode_needed(internalformat))
+    {
+        void *pixels = texture_transcode_read_unpack_buffer(data, imageSize);
+        texture_transcode_image(context, target, level, internalformat, width, height, depth, true, pixels, imageSize);
+        g_free(pixels);
+        return;
+    }
+
     if (DSA_LIKELY(host_opengl_version >= 45 && DSA_enable != 0))
     {
         glCompressedTextureImage3DEXT(bind_texture, target, level, internalformat, width, height, depth, border, imageSize, (void *)data);
@@ -472,6 +489,14 @@ void d_glCompressedTexSubImage3D_without_bound(void *context, GLenum target, GLi
         return;
     }
 
+    if (texture_transcode_needed(format))
+    {
+        void *pixels = texture_transcode_read_guest(guest_mem, imageSize);
+        texture_transcode_sub_image(context, target, level, xoffset, yoffset, zoffset, width, height, depth, true, format, pixels, imageSize);
+        g_free(pixels);
+        return;
+    }
+
     if (guest_mem->all_len == 0)
     {
         Buffer_Status *buffer_status = &(opengl_context->bound_buffer_status.buffer_status);
@@ -507,6 +532,15 @@ void d_glCompressedTexSubImage3D_with_bound(void *context, GLenum target, GLint
 {
 
     buffer_binding_status_sync(context, GL_PIXEL_UNPACK_BUFFER);
+
+    if (texture_transcode_needed(format))
+    {
+        void *pixels = texture_transcode_read_unpack_buffer(data, imageSize);
+        texture_transcode_sub_image(context, target, level, xoffset, yoffset, zoffset, width, height, depth, true, format, pixels, imageSize);
+        g_free(pixels);
+        return;
+    }
+
     if (DSA_LIKELY(host_opengl_version >= 45 && DSA_enable != 0))
     {
         GLuint bind_texture = get_guest_binding_texture(context, target);
@@ -537,6 +571,14 @@ void d_glCompressedTexImage2D_without_bound(void *context, GLenum target, GLint
         return;
     }
 
+    if (texture_transcode_needed(internalformat))
+    {
+        void *pixels = texture_transcode_read_guest(guest_mem, imageSize);
+        texture_transcode_image(context, target, level, internalformat, width, height, 1, false, pixels, imageSize);
+        g_free(pixels);
+        return;
+    }
+
     if (guest_mem->all_len == 0)
     {
         Buffer_Status *buffer_status = &(opengl_context->bound_buffer_status.buffer_status);
@@ -581,6 +623,14 @@ void d_glCompressedTexImage2D_with_bound(void *context, GLenum target, GLint lev
         return;
     }
 
+    if (texture_transcode_needed(internalformat))
+    {
+        void *pixels = texture_transcode_read_unpack_buffer(data, imageSize);
+        texture_transcode_image(context, target, level, internalformat, width, height, 1, false, pixels, imageSize);
+        g_free(pixels);
+        return;
+    }
+
     if (DSA_LIKELY(host_opengl_version >= 45 && DSA_enable != 0))
     {
         glCompressedTextureImage2DEXT(bind_texture, target, level, internalformat, width, height, border, imageSize, (void *)data);
@@ -603,6 +653,14 @@ void d_glCompressedTexSubImage2D_without_bound(void *context, GLenum target, GLi
         return;
     }
 
+    if (texture_transcode_needed(format))
+    {
+        void *pixels = texture_transcode_read_guest(guest_mem, imageSize);
+        texture_transcode_sub_image(context, target, level, xoffset, yoffset, 0, width, height, 1, false, format, pixels, imageSize);
+        g_free(pixels);
+        return;
+    }
+
     if (guest_mem->all_len == 0)
     {
         Buffer_Status *buffer_status = &(opengl_context->bound_buffer_status.buffer_status);
@@ -650,6 +708,15 @@ void d_glCompressedTexSubImage2D_without_bound(void *context, GLenum target, GLi
 void d_glCompressedTexSubImage2D_with_bound(void *context, GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLsizei imageSize, GLintptr data)
 {
     buffer_binding_status_sync(context, GL_PIXEL_UNPACK_BUFFER);
+
+    if (texture_transcode_needed(format))
+    {
+        void *pixels = texture_transcode_read_unpack_buffer(data, imageSize);
+        texture_transcode_sub_image(context, target, level, xoffset, yoffset, 0, width, height, 1, false, format, pixels, imageSize);
+        g_free(pixels);
+        return;
+    }
+
     if (DSA_LIKELY(host_opengl_version >= 45 && DSA_enable != 0))
     {
         GLuint bind_texture = get_guest_binding_texture(context, target);
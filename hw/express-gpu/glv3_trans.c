@@ -25,6 +25,8 @@
 #include "hw/express-gpu/gl_helper.h"
 
 #include "hw/express-gpu/glv1.h"
+#include "hw/express-gpu/express_gpu_timer.h"
+#include "hw/express-gpu/texture_transcode.h"
 #include "hw/teleport-express/express_event.h"
 
 #ifndef _WIN32
@@ -1791,7 +1793,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        GLbitfield ret = glQueryMatrixxOES(mantissa, exponent);
+        GLbitfield ret = d_glQueryMatrixx_special(opengl_context, mantissa, exponent);
         *ret_ptr = ret;
 
         write_to_guest_mem(all_para[0].data, ret_buf, 0, out_buf_len);
@@ -2757,7 +2759,15 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glGetQueryObjectuiv((GLuint)get_host_query_id(opengl_context, (unsigned int)id), pname, params);
+        GLuint64 timer_value = 0;
+        if (gpu_timer_get_query_result(opengl_context, id, pname, &timer_value))
+        {
+            *params = (GLuint)timer_value;
+        }
+        else
+        {
+            glGetQueryObjectuiv((GLuint)get_host_query_id(opengl_context, (unsigned int)id), pname, params);
+        }
         // LOGI("glGetQueryObjectuiv %llx %d -> %d r_context %llx",(uint64_t)opengl_context, id, (GLuint)get_host_query_id(opengl_context, (unsigned int)id), r_context);
 
         // if(glGetError()!=GL_NO_ERROR)
@@ -3628,7 +3638,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glGetClipPlanexOES(plane, equation);
+        d_glGetClipPlanex_special(opengl_context, plane, equation);
 
         write_to_guest_mem(all_para[1].data, ret_buf, 0, out_buf_len);
 
@@ -3713,7 +3723,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glGetFixedvOES(pname, params);
+        d_glGetFixedv_special(opengl_context, pname, params);
 
         write_to_guest_mem(all_para[1].data, ret_buf, 0, out_buf_len);
 
@@ -3809,7 +3819,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
         // {
         //     texture_binding_status_sync(opengl_context, target);
         // }
-        glGetTexEnvxvOES(target, pname, params);
+        d_glGetTexEnvxv_special(opengl_context, target, pname, params);
 
         write_to_guest_mem(all_para[1].data, ret_buf, 0, out_buf_len);
 
@@ -3913,7 +3923,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
                 glActiveTexture(GL_TEXTURE0);
             }
             glBindTexture(GL_TEXTURE_2D, texture_status->current_texture_external);
-            glGetTexParameterxvOES(GL_TEXTURE_2D, pname, params);
+            fixed_get_tex_parameterv(GL_TEXTURE_2D, pname, params);
             glBindTexture(GL_TEXTURE_2D, texture_status->host_current_texture_2D[0]);
             if (texture_status->host_current_active_texture != 0)
             {
@@ -3922,7 +3932,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
         }
         else
         {
-            glGetTexParameterxvOES(target, pname, params);
+            fixed_get_tex_parameterv(target, pname, params);
         }
         write_to_guest_mem(all_para[1].data, ret_buf, 0, out_buf_len);
 
@@ -4011,7 +4021,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glGetLightxvOES(light, pname, params);
+        d_glGetLightxv_special(opengl_context, light, pname, params);
 
         write_to_guest_mem(all_para[1].data, ret_buf, 0, out_buf_len);
 
@@ -4100,7 +4110,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glGetMaterialxvOES(face, pname, params);
+        d_glGetMaterialxv_special(opengl_context, face, pname, params);
 
         write_to_guest_mem(all_para[1].data, ret_buf, 0, out_buf_len);
 
@@ -4189,7 +4199,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glGetTexGenxvOES(coord, pname, params);
+        d_glGetTexGenxv_special(opengl_context, coord, pname, params);
 
         write_to_guest_mem(all_para[1].data, ret_buf, 0, out_buf_len);
 
@@ -7582,7 +7592,14 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glGetIntegerv(pname, data);
+        if (pname == GL_GPU_DISJOINT_EXT)
+        {
+            *data = gpu_timer_get_disjoint(opengl_context);
+        }
+        else
+        {
+            glGetIntegerv(pname, data);
+        }
 
         write_to_guest_mem(all_para[1].data, ret_buf, 0, out_buf_len);
 
@@ -7761,7 +7778,14 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glGetInteger64v(pname, data);
+        if (pname == GL_GPU_DISJOINT_EXT)
+        {
+            *data = gpu_timer_get_disjoint(opengl_context);
+        }
+        else
+        {
+            glGetInteger64v(pname, data);
+        }
 
         write_to_guest_mem(all_para[1].data, ret_buf, 0, out_buf_len);
 
@@ -8180,6 +8204,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
         }
 
         glBeginQuery(target, (GLuint)get_host_query_id(opengl_context, (unsigned int)id));
+        gpu_timer_begin_query(opengl_context, target, id);
         // LOGI("glBeginQuery %llx %d -> %d target %llx r_context %llx", (uint64_t)opengl_context, id, (GLuint)get_host_query_id(opengl_context, (unsigned int)id), target, r_context);
     }
     break;
@@ -8239,6 +8264,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
         }
 
         glEndQuery(target);
+        gpu_timer_end_query(opengl_context, target);
         // LOGI("glEndQuery target %llx", target);
     }
     break;
@@ -8383,6 +8409,9 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
+        // 需要转码的压缩格式按解码后的格式分配存储
+        internalformat = texture_transcode_storage_format(internalformat);
+
         if (DSA_LIKELY(host_opengl_version >= 45 && DSA_enable != 0))
         {
             GLuint bind_texture = get_guest_binding_texture(opengl_context, target);
@@ -8496,6 +8525,9 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
+        // 需要转码的压缩格式按解码后的格式分配存储
+        internalformat = texture_transcode_storage_format(internalformat);
+
         if (DSA_LIKELY(host_opengl_version >= 45 && DSA_enable != 0))
         {
             GLuint bind_texture = get_guest_binding_texture(opengl_context, target);
@@ -12362,6 +12394,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
+        gpu_timer_delete_queries(opengl_context, n, ids);
         d_glDeleteQueries(opengl_context, n, ids);
     }
     break;
@@ -14973,7 +15006,10 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             // host端不能关闭synchronous模式，否则会出现并发写入debug_message_buffer的情况
             break;
         }
-        glDisable(cap);
+        if (opengl_context == NULL || !fixed_function_enable(opengl_context, cap, GL_FALSE))
+        {
+            glDisable(cap);
+        }
     }
     break;
 
@@ -15036,7 +15072,10 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             opengl_context->enable_scissor = 1;
         }
 
-        glEnable(cap);
+        if (opengl_context == NULL || !fixed_function_enable(opengl_context, cap, GL_TRUE))
+        {
+            glEnable(cap);
+        }
     }
     break;
 
@@ -18363,7 +18402,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glAlphaFuncxOES(func, ref);
+        d_glAlphaFuncx_special(opengl_context, func, ref);
     }
     break;
 
@@ -18433,7 +18472,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glClearColorxOES(red, green, blue, alpha);
+        glClearColor(FIXED_TO_FLOAT(red), FIXED_TO_FLOAT(green), FIXED_TO_FLOAT(blue), FIXED_TO_FLOAT(alpha));
     }
     break;
 
@@ -18491,7 +18530,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glClearDepthxOES(depth);
+        glClearDepthf(FIXED_TO_FLOAT(depth));
     }
     break;
 
@@ -18561,7 +18600,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glColor4xOES(red, green, blue, alpha);
+        d_glColor4x_special(opengl_context, red, green, blue, alpha);
     }
     break;
 
@@ -18623,7 +18662,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glDepthRangexOES(n, f);
+        glDepthRangef(FIXED_TO_FLOAT(n), FIXED_TO_FLOAT(f));
     }
     break;
 
@@ -18685,7 +18724,8 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glFogxOES(pname, param);
+        GLfixed fixed_params[4] = {param, 0, 0, 0};
+        d_glFogxv_special(opengl_context, pname, fixed_params);
     }
     break;
 
@@ -18763,7 +18803,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glFrustumxOES(l, r, b, t, n, f);
+        d_glFrustumf_special(opengl_context, FIXED_TO_FLOAT(l), FIXED_TO_FLOAT(r), FIXED_TO_FLOAT(b), FIXED_TO_FLOAT(t), FIXED_TO_FLOAT(n), FIXED_TO_FLOAT(f));
     }
     break;
 
@@ -18825,7 +18865,8 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glLightModelxOES(pname, param);
+        GLfixed fixed_params[4] = {param, 0, 0, 0};
+        d_glLightModelxv_special(opengl_context, pname, fixed_params);
     }
     break;
 
@@ -18891,7 +18932,8 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glLightxOES(light, pname, param);
+        GLfixed fixed_params[4] = {param, 0, 0, 0};
+        d_glLightxv_special(opengl_context, light, pname, fixed_params);
     }
     break;
 
@@ -18949,7 +18991,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glLineWidthxOES(width);
+        glLineWidth(FIXED_TO_FLOAT(width));
     }
     break;
 
@@ -19015,7 +19057,8 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glMaterialxOES(face, pname, param);
+        GLfixed fixed_params[4] = {param, 0, 0, 0};
+        d_glMaterialxv_special(opengl_context, face, pname, fixed_params);
     }
     break;
 
@@ -19089,7 +19132,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glMultiTexCoord4xOES(texture, s, t, r, q);
+        d_glMultiTexCoord4x_special(opengl_context, texture, s, t, r, q);
     }
     break;
 
@@ -19155,7 +19198,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glNormal3xOES(nx, ny, nz);
+        d_glNormal3x_special(opengl_context, nx, ny, nz);
     }
     break;
 
@@ -19233,7 +19276,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glOrthoxOES(l, r, b, t, n, f);
+        d_glOrthof_special(opengl_context, FIXED_TO_FLOAT(l), FIXED_TO_FLOAT(r), FIXED_TO_FLOAT(b), FIXED_TO_FLOAT(t), FIXED_TO_FLOAT(n), FIXED_TO_FLOAT(f));
     }
     break;
 
@@ -19291,7 +19334,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glPointSizexOES(size);
+        d_glPointSizex_special(opengl_context, size);
     }
     break;
 
@@ -19353,7 +19396,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glPolygonOffsetxOES(factor, units);
+        glPolygonOffset(FIXED_TO_FLOAT(factor), FIXED_TO_FLOAT(units));
     }
     break;
 
@@ -19423,7 +19466,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glRotatexOES(angle, x, y, z);
+        d_glRotatex_special(opengl_context, angle, x, y, z);
     }
     break;
 
@@ -19489,7 +19532,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glScalexOES(x, y, z);
+        d_glScalex_special(opengl_context, x, y, z);
     }
     break;
 
@@ -19555,7 +19598,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glTexEnvxOES(target, pname, param);
+        d_glTexEnvx_special(opengl_context, target, pname, param);
     }
     break;
 
@@ -19621,7 +19664,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glTranslatexOES(x, y, z);
+        d_glTranslatex_special(opengl_context, x, y, z);
     }
     break;
 
@@ -19683,7 +19726,8 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glPointParameterxOES(pname, param);
+        GLfixed fixed_params[4] = {param, 0, 0, 0};
+        d_glPointParameterxv_special(opengl_context, pname, fixed_params);
     }
     break;
 
@@ -19745,7 +19789,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glSampleCoveragexOES(value, invert);
+        glSampleCoverage(FIXED_TO_FLOAT(value), invert);
     }
     break;
 
@@ -19811,7 +19855,8 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glTexGenxOES(coord, pname, param);
+        GLfixed fixed_params[4] = {param, 0, 0, 0};
+        d_glTexGenxv_special(opengl_context, coord, pname, fixed_params);
     }
     break;
 
@@ -19869,7 +19914,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glClearDepthfOES(depth);
+        glClearDepthf(depth);
     }
     break;
 
@@ -19931,7 +19976,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glDepthRangefOES(n, f);
+        glDepthRangef(n, f);
     }
     break;
 
@@ -20009,7 +20054,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glFrustumfOES(l, r, b, t, n, f);
+        d_glFrustumf_special(opengl_context, l, r, b, t, n, f);
     }
     break;
 
@@ -20087,7 +20132,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glOrthofOES(l, r, b, t, n, f);
+        d_glOrthof_special(opengl_context, l, r, b, t, n, f);
     }
     break;
 
@@ -23782,7 +23827,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glClipPlanexOES(plane, equation);
+        d_glClipPlanex_special(opengl_context, plane, equation);
     }
     break;
 
@@ -23843,7 +23888,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glFogxvOES(pname, param);
+        d_glFogxv_special(opengl_context, pname, param);
     }
     break;
 
@@ -23904,7 +23949,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glLightModelxvOES(pname, param);
+        d_glLightModelxv_special(opengl_context, pname, param);
     }
     break;
 
@@ -23969,7 +24014,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glLightxvOES(light, pname, params);
+        d_glLightxv_special(opengl_context, light, pname, params);
     }
     break;
 
@@ -24026,7 +24071,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glLoadMatrixxOES(m);
+        d_glLoadMatrixx_special(opengl_context, m);
     }
     break;
 
@@ -24091,7 +24136,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glMaterialxvOES(face, pname, param);
+        d_glMaterialxv_special(opengl_context, face, pname, param);
     }
     break;
 
@@ -24148,7 +24193,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glMultMatrixxOES(m);
+        d_glMultMatrixx_special(opengl_context, m);
     }
     break;
 
@@ -24209,7 +24254,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glPointParameterxvOES(pname, params);
+        d_glPointParameterxv_special(opengl_context, pname, params);
     }
     break;
 
@@ -24274,7 +24319,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glTexEnvxvOES(target, pname, params);
+        d_glTexEnvxv_special(opengl_context, target, pname, params);
     }
     break;
 
@@ -24335,7 +24380,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glClipPlanefOES(plane, equation);
+        d_glClipPlanef_special(opengl_context, plane, equation);
     }
     break;
 
@@ -24400,7 +24445,7 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
             break;
         }
 
-        glTexGenxvOES(coord, pname, params);
+        d_glTexGenxv_special(opengl_context, coord, pname, params);
     }
     break;
 
@@ -29244,6 +29289,264 @@ void gl3_decode_invoke(Render_Thread_Context *r_context, Teleport_Express_Call *
 
         glBlendEquationSeparatei(buf, modeRGB, modeAlpha);
     }
+    break;
+
+    case FUNID_glQueryCounterEXT:
+
+    {
+
+        GLuint id;
+        GLenum target;
+
+        int para_num = get_para_from_call(call, all_para, MAX_PARA_NUM);
+        if (unlikely(para_num < PARA_NUM_MIN_glQueryCounterEXT))
+        {
+            break;
+        }
+
+        size_t temp_len = 0;
+        unsigned char *temp = NULL;
+
+        temp_len = all_para[0].data_len;
+        if (unlikely(temp_len < 8 * 1))
+        {
+            break;
+        }
+
+        int null_flag = 0;
+        temp = get_direct_ptr(all_para[0].data, &null_flag);
+        if (unlikely(temp == NULL))
+        {
+            if (temp_len != 0 && null_flag == 0)
+            {
+                temp = g_malloc(temp_len);
+                no_ptr_buf = temp;
+                read_from_guest_mem(all_para[0].data, temp, 0, all_para[0].data_len);
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        unsigned int temp_loc = 0;
+
+        id = *(GLuint *)(temp + temp_loc);
+        temp_loc += 4;
+
+        target = *(GLenum *)(temp + temp_loc);
+        temp_loc += 4;
+
+        /* Check length */
+        if (unlikely(temp_len < temp_loc))
+        {
+            break;
+        }
+
+        d_glQueryCounterEXT_special(opengl_context, id, target);
+    }
+    break;
+
+    case FUNID_glGetQueryObjecti64vEXT:
+
+    {
+
+        GLuint id;
+        GLenum pname;
+
+        int para_num = get_para_from_call(call, all_para, MAX_PARA_NUM);
+        if (unlikely(para_num < PARA_NUM_MIN_glGetQueryObjecti64vEXT))
+        {
+            break;
+        }
+
+        size_t temp_len = 0;
+        unsigned char *temp = NULL;
+
+        temp_len = all_para[0].data_len;
+        if (unlikely(temp_len < 8 * 1))
+        {
+            break;
+        }
+
+        int null_flag = 0;
+        temp = get_direct_ptr(all_para[0].data, &null_flag);
+        if (unlikely(temp == NULL))
+        {
+            if (temp_len != 0 && null_flag == 0)
+            {
+                temp = g_malloc(temp_len);
+                no_ptr_buf = temp;
+                read_from_guest_mem(all_para[0].data, temp, 0, all_para[0].data_len);
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        unsigned int temp_loc = 0;
+
+        id = *(GLuint *)(temp + temp_loc);
+        temp_loc += 4;
+
+        pname = *(GLenum *)(temp + temp_loc);
+        temp_loc += 4;
+        int out_buf_len = all_para[1].data_len;
+
+        unsigned char *ret_buf = NULL;
+
+        if (unlikely(out_buf_len > MAX_OUT_BUF_LEN))
+        {
+            ret_buf = g_malloc(out_buf_len);
+        }
+        else
+        {
+            ret_buf = ret_local_buf;
+        }
+        int out_buf_loc = 0;
+
+        GLint64 *params = (GLint64 *)(ret_buf + out_buf_loc);
+        out_buf_loc += gl_pname_size(pname) * sizeof(GLint64);
+
+        if (unlikely(out_buf_loc > out_buf_len))
+        {
+            if (unlikely(out_buf_len > MAX_OUT_BUF_LEN))
+            {
+                g_free(ret_buf);
+            }
+            break;
+        }
+
+        // 计时查询的结果不会超过int64的范围
+        d_glGetQueryObjectui64vEXT_special(opengl_context, id, pname, (GLuint64 *)params);
+
+        write_to_guest_mem(all_para[1].data, ret_buf, 0, out_buf_len);
+
+        if (unlikely(out_buf_len > MAX_OUT_BUF_LEN))
+        {
+            g_free(ret_buf);
+        }
+    }
+    break;
+
+    case FUNID_glGetQueryObjectui64vEXT:
+
+    {
+
+        GLuint id;
+        GLenum pname;
+
+        int para_num = get_para_from_call(call, all_para, MAX_PARA_NUM);
+        if (unlikely(para_num < PARA_NUM_MIN_glGetQueryObjectui64vEXT))
+        {
+            break;
+        }
+
+        size_t temp_len = 0;
+        unsigned char *temp = NULL;
+
+        temp_len = all_para[0].data_len;
+        if (unlikely(temp_len < 8 * 1))
+        {
+            break;
+        }
+
+        int null_flag = 0;
+        temp = get_direct_ptr(all_para[0].data, &null_flag);
+        if (unlikely(temp == NULL))
+        {
+            if (temp_len != 0 && null_flag == 0)
+            {
+                temp = g_malloc(temp_len);
+                no_ptr_buf = temp;
+                read_from_guest_mem(all_para[0].data, temp, 0, all_para[0].data_len);
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        unsigned int temp_loc = 0;
+
+        id = *(GLuint *)(temp + temp_loc);
+        temp_loc += 4;
+
+        pname = *(GLenum *)(temp + temp_loc);
+        temp_loc += 4;
+        int out_buf_len = all_para[1].data_len;
+
+        unsigned char *ret_buf = NULL;
+
+        if (unlikely(out_buf_len > MAX_OUT_BUF_LEN))
+        {
+            ret_buf = g_malloc(out_buf_len);
+        }
+        else
+        {
+            ret_buf = ret_local_buf;
+        }
+        int out_buf_loc = 0;
+
+        GLuint64 *params = (GLuint64 *)(ret_buf + out_buf_loc);
+        out_buf_loc += gl_pname_size(pname) * sizeof(GLuint64);
+
+        if (unlikely(out_buf_loc > out_buf_len))
+        {
+            if (unlikely(out_buf_len > MAX_OUT_BUF_LEN))
+            {
+                g_free(ret_buf);
+            }
+            break;
+        }
+
+        d_glGetQueryObjectui64vEXT_special(opengl_context, id, pname, params);
+
+        write_to_guest_mem(all_para[1].data, ret_buf, 0, out_buf_len);
+
+        if (unlikely(out_buf_len > MAX_OUT_BUF_LEN))
+        {
+            g_free(ret_buf);
+        }
+    }
+    break;
+
+    case FUNID_glGetFrameStats:
+
+    {
+
+        int para_num = get_para_from_call(call, all_para, MAX_PARA_NUM);
+        if (unlikely(para_num < PARA_NUM_MIN_glGetFrameStats))
+        {
+            break;
+        }
+
+        int out_buf_len = all_para[0].data_len;
+
+        unsigned char *ret_buf = NULL;
+
+        if (unlikely(out_buf_len > MAX_OUT_BUF_LEN))
+        {
+            ret_buf = g_malloc(out_buf_len);
+        }
+        else
+        {
+            ret_buf = ret_local_buf;
+        }
+
+        // 只写回有效的部分，不把host上未初始化的内存写给guest
+        size_t stats_len = gpu_timer_read_frame_stats(opengl_context, ret_buf, (size_t)out_buf_len);
+        if (stats_len > 0)
+        {
+            write_to_guest_mem(all_para[0].data, ret_buf, 0, stats_len);
+        }
+
+        if (unlikely(out_buf_len > MAX_OUT_BUF_LEN))
+        {
+            g_free(ret_buf);
+        }
+    }
     break;
 
         // case FUNID_glBindSharedGLImage:
@@ -0,0 +1,1346 @@
+/**
+ * @file texture_decode.c
+ * @brief ETC2/EAC与ASTC LDR压缩纹理的软件解码，按照Khronos Data Format规范实现，结果与规范逐位一致
+ *
+ * 解码按块进行，互不依赖，调用者把图像按块行分给多个线程。
+ * 每个块先解出端点与权重，再在块内对所有像素做同样的整数插值，这一段循环可以被编译器向量化。
+ */
+#include "qemu/osdep.h"
+
+#include "hw/express-gpu/texture_decode.h"
+
+static inline uint8_t clamp_u8(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static inline uint64_t load_be64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/******************************** ETC2 / EAC ********************************/
+
+// 每个码字对应的两个亮度偏移，像素索引0、1、2、3分别取+a、+b、-a、-b
+static const int etc_modifier_table[8][2] = {
+    {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183},
+};
+
+// T与H模式的距离表
+static const int etc_distance_table[8] = {3, 6, 11, 16, 23, 32, 41, 64};
+
+static const int eac_modifier_table[16][8] = {
+    {-3, -6, -9, -15, 2, 5, 8, 14},
+    {-3, -7, -10, -13, 2, 6, 9, 12},
+    {-2, -5, -8, -13, 1, 4, 7, 12},
+    {-2, -4, -6, -13, 1, 3, 5, 12},
+    {-3, -6, -8, -12, 2, 5, 7, 11},
+    {-3, -7, -9, -11, 2, 6, 8, 10},
+    {-4, -7, -8, -11, 3, 6, 7, 10},
+    {-3, -5, -8, -11, 2, 4, 7, 10},
+    {-2, -6, -8, -10, 1, 5, 7, 9},
+    {-2, -5, -8, -10, 1, 4, 7, 9},
+    {-2, -4, -8, -10, 1, 3, 7, 9},
+    {-2, -5, -7, -10, 1, 4, 6, 9},
+    {-3, -4, -7, -10, 2, 3, 6, 9},
+    {-1, -2, -3, -10, 0, 1, 2, 9},
+    {-4, -6, -8, -9, 3, 5, 7, 8},
+    {-3, -5, -7, -9, 2, 4, 6, 8},
+};
+
+static inline int bits_of(uint64_t v, int high, int count)
+{
+    return (int)((v >> (high - count + 1)) & ((1ull << count) - 1));
+}
+
+static inline int extend_4(int v)
+{
+    return v * 17;
+}
+
+static inline int extend_5(int v)
+{
+    return (v << 3) | (v >> 2);
+}
+
+static inline int extend_6(int v)
+{
+    return (v << 2) | (v >> 4);
+}
+
+static inline int extend_7(int v)
+{
+    return (v << 1) | (v >> 6);
+}
+
+static inline int sign_extend_3(int v)
+{
+    return v >= 4 ? v - 8 : v;
+}
+
+// 像素(x, y)的两位索引，像素按列排列，高位在第i+16位，低位在第i位
+static inline int etc_pixel_index(uint64_t bits, int x, int y)
+{
+    int i = x * 4 + y;
+    return (int)(((bits >> (i + 16)) & 1) << 1 | ((bits >> i) & 1));
+}
+
+static inline void put_rgba(uint8_t *p, int r, int g, int b, int a)
+{
+    p[0] = clamp_u8(r);
+    p[1] = clamp_u8(g);
+    p[2] = clamp_u8(b);
+    p[3] = a;
+}
+
+static void etc_decode_paint(uint64_t bits, const int paint[4][3], bool opaque, uint8_t *out, int stride)
+{
+    for (int y = 0; y < 4; y++)
+    {
+        uint8_t *row = out + y * stride;
+        for (int x = 0; x < 4; x++)
+        {
+            int index = etc_pixel_index(bits, x, y);
+            if (!opaque && index == 2)
+            {
+                put_rgba(row + x * 4, 0, 0, 0, 0);
+            }
+            else
+            {
+                put_rgba(row + x * 4, paint[index][0], paint[index][1], paint[index][2], 255);
+            }
+        }
+    }
+}
+
+static void etc_decode_t_mode(uint64_t bits, bool opaque, uint8_t *out, int stride)
+{
+    int c1[3] = {
+        extend_4(bits_of(bits, 60, 2) << 2 | bits_of(bits, 57, 2)),
+        extend_4(bits_of(bits, 55, 4)),
+        extend_4(bits_of(bits, 51, 4)),
+    };
+    int c2[3] = {
+        extend_4(bits_of(bits, 47, 4)),
+        extend_4(bits_of(bits, 43, 4)),
+        extend_4(bits_of(bits, 39, 4)),
+    };
+    int d = etc_distance_table[bits_of(bits, 35, 2) << 1 | bits_of(bits, 32, 1)];
+
+    int paint[4][3];
+    for (int c = 0; c < 3; c++)
+    {
+        paint[0][c] = c1[c];
+        paint[1][c] = c2[c] + d;
+        paint[2][c] = c2[c];
+        paint[3][c] = c2[c] - d;
+    }
+    etc_decode_paint(bits, paint, opaque, out, stride);
+}
+
+static void etc_decode_h_mode(uint64_t bits, bool opaque, uint8_t *out, int stride)
+{
+    int r1 = bits_of(bits, 62, 4);
+    int g1 = bits_of(bits, 58, 3) << 1 | bits_of(bits, 52, 1);
+    int b1 = bits_of(bits, 51, 1) << 3 | bits_of(bits, 49, 3);
+    int r2 = bits_of(bits, 46, 4);
+    int g2 = bits_of(bits, 42, 4);
+    int b2 = bits_of(bits, 38, 4);
+
+    //距离索引的最低位由两个颜色的大小关系决定
+    int order = ((r1 << 8) | (g1 << 4) | b1) >= ((r2 << 8) | (g2 << 4) | b2);
+    int d = etc_distance_table[bits_of(bits, 34, 1) << 2 | bits_of(bits, 32, 1) << 1 | order];
+
+    int c1[3] = {extend_4(r1), extend_4(g1), extend_4(b1)};
+    int c2[3] = {extend_4(r2), extend_4(g2), extend_4(b2)};
+
+    int paint[4][3];
+    for (int c = 0; c < 3; c++)
+    {
+        paint[0][c] = c1[c] + d;
+        paint[1][c] = c1[c] - d;
+        paint[2][c] = c2[c] + d;
+        paint[3][c] = c2[c] - d;
+    }
+    etc_decode_paint(bits, paint, opaque, out, stride);
+}
+
+static void etc_decode_planar_mode(uint64_t bits, uint8_t *out, int stride)
+{
+    int o[3] = {
+        extend_6(bits_of(bits, 62, 6)),
+        extend_7(bits_of(bits, 56, 1) << 6 | bits_of(bits, 54, 6)),
+        extend_6(bits_of(bits, 48, 1) << 5 | bits_of(bits, 44, 2) << 3 | bits_of(bits, 41, 3)),
+    };
+    int h[3] = {
+        extend_6(bits_of(bits, 38, 5) << 1 | bits_of(bits, 32, 1)),
+        extend_7(bits_of(bits, 31, 7)),
+        extend_6(bits_of(bits, 24, 6)),
+    };
+    int v[3] = {
+        extend_6(bits_of(bits, 18, 6)),
+        extend_7(bits_of(bits, 12, 7)),
+        extend_6(bits_of(bits, 5, 6)),
+    };
+
+    for (int y = 0; y < 4; y++)
+    {
+        uint8_t *row = out + y * stride;
+        for (int x = 0; x < 4; x++)
+        {
+            int c[3];
+            for (int i = 0; i < 3; i++)
+            {
+                c[i] = (x * (h[i] - o[i]) + y * (v[i] - o[i]) + 4 * o[i] + 2) >> 2;
+            }
+            put_rgba(row + x * 4, c[0], c[1], c[2], 255);
+        }
+    }
+}
+
+void etc2_decode_color_block(const uint8_t *block, bool punchthrough, uint8_t *out, int stride)
+{
+    uint64_t bits = load_be64(block);
+
+    // punchthrough格式没有单独模式，第33位表示整个块是否不透明
+    bool diff = punchthrough || ((bits >> 33) & 1);
+    bool opaque = !punchthrough || ((bits >> 33) & 1);
+
+    int base[2][3];
+    if (!diff)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            base[0][c] = extend_4(bits_of(bits, 63 - c * 8, 4));
+            base[1][c] = extend_4(bits_of(bits, 59 - c * 8, 4));
+        }
+    }
+    else
+    {
+        int color[3], delta[3];
+        for (int c = 0; c < 3; c++)
+        {
+            color[c] = bits_of(bits, 63 - c * 8, 5);
+            delta[c] = sign_extend_3(bits_of(bits, 58 - c * 8, 3));
+        }
+
+        //第二个颜色超出范围时表示ETC2新增的模式
+        if (color[0] + delta[0] < 0 || color[0] + delta[0] > 31)
+        {
+            etc_decode_t_mode(bits, opaque, out, stride);
+            return;
+        }
+        if (color[1] + delta[1] < 0 || color[1] + delta[1] > 31)
+        {
+            etc_decode_h_mode(bits, opaque, out, stride);
+            return;
+        }
+        if (color[2] + delta[2] < 0 || color[2] + delta[2] > 31)
+        {
+            etc_decode_planar_mode(bits, out, stride);
+            return;
+        }
+
+        for (int c = 0; c < 3; c++)
+        {
+            base[0][c] = extend_5(color[c]);
+            base[1][c] = extend_5(color[c] + delta[c]);
+        }
+    }
+
+    int table[2] = {bits_of(bits, 39, 3), bits_of(bits, 36, 3)};
+    bool flip = (bits >> 32) & 1;
+
+    for (int y = 0; y < 4; y++)
+    {
+        uint8_t *row = out + y * stride;
+        for (int x = 0; x < 4; x++)
+        {
+            int sub = flip ? (y >= 2) : (x >= 2);
+            int index = etc_pixel_index(bits, x, y);
+            if (!opaque && index == 2)
+            {
+                put_rgba(row + x * 4, 0, 0, 0, 0);
+                continue;
+            }
+
+            // 透明块中+a与-a都变成0
+            int a = opaque ? etc_modifier_table[table[sub]][0] : 0;
+            int b = etc_modifier_table[table[sub]][1];
+            int modifier = index == 0 ? a : (index == 1 ? b : (index == 2 ? -a : -b));
+
+            put_rgba(row + x * 4, base[sub][0] + modifier, base[sub][1] + modifier, base[sub][2] + modifier, 255);
+        }
+    }
+}
+
+// 3位索引，像素i在第47-3i到45-3i位
+static inline int eac_pixel_index(uint64_t bits, int x, int y)
+{
+    return (int)((bits >> (45 - 3 * (x * 4 + y))) & 7);
+}
+
+void eac_decode_alpha_block(const uint8_t *block, uint8_t *out, int stride)
+{
+    uint64_t bits = load_be64(block);
+    int base = bits_of(bits, 63, 8);
+    int multiplier = bits_of(bits, 55, 4);
+    const int *modifier = eac_modifier_table[bits_of(bits, 51, 4)];
+
+    for (int y = 0; y < 4; y++)
+    {
+        uint8_t *row = out + y * stride;
+        for (int x = 0; x < 4; x++)
+        {
+            row[x * 4 + 3] = clamp_u8(base + modifier[eac_pixel_index(bits, x, y)] * multiplier);
+        }
+    }
+}
+
+void eac_decode_r11_block(const uint8_t *block, bool is_signed, uint16_t *out, int stride, int pixel_step)
+{
+    uint64_t bits = load_be64(block);
+    int base = bits_of(bits, 63, 8);
+    int multiplier = bits_of(bits, 55, 4);
+    const int *modifier = eac_modifier_table[bits_of(bits, 51, 4)];
+
+    if (is_signed)
+    {
+        base = (int8_t)base;
+        if (base == -128)
+        {
+            base = -127;
+        }
+    }
+
+    for (int y = 0; y < 4; y++)
+    {
+        uint16_t *row = out + y * stride;
+        for (int x = 0; x < 4; x++)
+        {
+            int m = modifier[eac_pixel_index(bits, x, y)];
+            //乘数为0时偏移按1/8使用
+            m = multiplier != 0 ? m * multiplier * 8 : m;
+
+            if (is_signed)
+            {
+                int v = MIN(MAX(base * 8 + m, -1023), 1023);
+                int16_t s = v >= 0 ? (v << 5) | (v >> 5) : -(((-v) << 5) | ((-v) >> 5));
+                row[x * pixel_step] = (uint16_t)s;
+            }
+            else
+            {
+                int v = MIN(MAX(base * 8 + 4 + m, 0), 2047);
+                row[x * pixel_step] = (v << 5) | (v >> 6);
+            }
+        }
+    }
+}
+
+/********************************** ASTC **********************************/
+
+// 整数序列编码的各个范围，依次为2、3、4、5、6、8、10、12、16、20、24、32、40、48、64、80、96、128、160、192、256级
+typedef struct Astc_Range
+{
+    uint8_t bits;
+    uint8_t trits;
+    uint8_t quints;
+} Astc_Range;
+
+static const Astc_Range astc_ranges[21] = {
+    {1, 0, 0}, {0, 1, 0}, {2, 0, 0}, {0, 0, 1}, {1, 1, 0}, {3, 0, 0}, {1, 0, 1},
+    {2, 1, 0}, {4, 0, 0}, {2, 0, 1}, {3, 1, 0}, {5, 0, 0}, {3, 0, 1}, {4, 1, 0},
+    {6, 0, 0}, {4, 0, 1}, {5, 1, 0}, {7, 0, 0}, {5, 0, 1}, {6, 1, 0}, {8, 0, 0},
+};
+
+#define ASTC_RANGE_6 4
+#define ASTC_RANGE_NUM 21
+#define ASTC_WEIGHT_RANGE_NUM 12
+
+#define ASTC_MAX_WEIGHTS 64
+#define ASTC_MAX_COLOR_VALUES 18
+
+static uint8_t astc_color_unquant[ASTC_RANGE_NUM][256];
+static uint8_t astc_weight_unquant[ASTC_WEIGHT_RANGE_NUM][32];
+
+static inline int astc_range_levels(const Astc_Range *r)
+{
+    return (r->trits ? 3 : (r->quints ? 5 : 1)) << r->bits;
+}
+
+static int astc_ise_bit_count(int range, int count)
+{
+    const Astc_Range *r = &astc_ranges[range];
+    return r->bits * count + (r->trits ? (8 * count + 4) / 5 : 0) + (r->quints ? (7 * count + 2) / 3 : 0);
+}
+
+static int astc_replicate(int v, int from, int to)
+{
+    int result = 0;
+    int shift = to;
+    while (shift > 0)
+    {
+        shift -= from;
+        result |= shift >= 0 ? v << shift : v >> -shift;
+    }
+    return result & ((1 << to) - 1);
+}
+
+static int astc_unquant_color_value(const Astc_Range *r, int value)
+{
+    if (r->trits == 0 && r->quints == 0)
+    {
+        return astc_replicate(value, r->bits, 8);
+    }
+
+    int m = value & ((1 << r->bits) - 1);
+    int d = value >> r->bits;
+    int a = (m & 1) ? 0x1ff : 0;
+    int h = m >> 1;
+    int b = 0, c = 0;
+
+    if (r->trits)
+    {
+        switch (r->bits)
+        {
+        case 1: b = 0; c = 204; break;
+        case 2: b = (h << 8) | (h << 4) | (h << 2) | (h << 1); c = 93; break;
+        case 3: b = (h << 7) | (h << 2) | h; c = 44; break;
+        case 4: b = (h << 6) | h; c = 22; break;
+        case 5: b = (h << 5) | (h >> 2); c = 11; break;
+        case 6: b = (h << 4) | (h >> 4); c = 5; break;
+        }
+    }
+    else
+    {
+        switch (r->bits)
+        {
+        case 1: b = 0; c = 113; break;
+        case 2: b = (h << 8) | (h << 3) | (h << 2); c = 54; break;
+        case 3: b = (h << 7) | (h << 1) | (h >> 1); c = 26; break;
+        case 4: b = (h << 6) | (h >> 1); c = 13; break;
+        case 5: b = (h << 5) | (h >> 3); c = 6; break;
+        }
+    }
+
+    int t = (d * c + b) ^ a;
+    return (a & 0x80) | (t >> 2);
+}
+
+static int astc_unquant_weight_value(const Astc_Range *r, int value)
+{
+    int result;
+    if (r->trits == 0 && r->quints == 0)
+    {
+        result = astc_replicate(value, r->bits, 6);
+    }
+    else if (r->bits == 0)
+    {
+        result = value * (r->trits ? 32 : 16);
+    }
+    else
+    {
+        int m = value & ((1 << r->bits) - 1);
+        int d = value >> r->bits;
+        int a = (m & 1) ? 0x7f : 0;
+        int h = m >> 1;
+        int b = 0, c = 0;
+
+        if (r->trits)
+        {
+            switch (r->bits)
+            {
+            case 1: b = 0; c = 50; break;
+            case 2: b = (h << 6) | (h << 2) | h; c = 23; break;
+            case 3: b = (h << 5) | h; c = 11; break;
+            }
+        }
+        else
+        {
+            switch (r->bits)
+            {
+            case 1: b = 0; c = 28; break;
+            case 2: b = (h << 6) | (h << 1); c = 13; break;
+            }
+        }
+
+        int t = (d * c + b) ^ a;
+        result = (a & 0x20) | (t >> 2);
+    }
+    return result > 32 ? result + 1 : result;
+}
+
+static void astc_init_tables(void)
+{
+    static gsize tables_init = 0;
+
+    if (g_once_init_enter(&tables_init))
+    {
+        for (int i = 0; i < ASTC_RANGE_NUM; i++)
+        {
+            int levels = astc_range_levels(&astc_ranges[i]);
+            for (int v = 0; v < levels; v++)
+            {
+                astc_color_unquant[i][v] = astc_unquant_color_value(&astc_ranges[i], v);
+                if (i < ASTC_WEIGHT_RANGE_NUM)
+                {
+                    astc_weight_unquant[i][v] = astc_unquant_weight_value(&astc_ranges[i], v);
+                }
+            }
+        }
+        g_once_init_leave(&tables_init, 1);
+    }
+}
+
+// 从小端的128位数据中读取第pos位开始的count位，超出limit的位按0处理
+static inline uint32_t astc_read_bits(const uint8_t *data, int pos, int count, int limit)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int p = pos + i;
+        if (p < limit)
+        {
+            v |= (uint32_t)((data[p >> 3] >> (p & 7)) & 1) << i;
+        }
+    }
+    return v;
+}
+
+static void astc_decode_trits(uint32_t t, int out[5])
+{
+    int c;
+    if (((t >> 2) & 7) == 7)
+    {
+        c = (((t >> 5) & 7) << 2) | (t & 3);
+        out[4] = 2;
+        out[3] = 2;
+    }
+    else
+    {
+        c = t & 0x1f;
+        if (((t >> 5) & 3) == 3)
+        {
+            out[4] = 2;
+            out[3] = (t >> 7) & 1;
+        }
+        else
+        {
+            out[4] = (t >> 7) & 1;
+            out[3] = (t >> 5) & 3;
+        }
+    }
+
+    if ((c & 3) == 3)
+    {
+        out[2] = 2;
+        out[1] = (c >> 4) & 1;
+        out[0] = (((c >> 3) & 1) << 1) | ((c >> 2) & 1 & ~(c >> 3));
+    }
+    else if (((c >> 2) & 3) == 3)
+    {
+        out[2] = 2;
+        out[1] = 2;
+        out[0] = c & 3;
+    }
+    else
+    {
+        out[2] = (c >> 4) & 1;
+        out[1] = (c >> 2) & 3;
+        out[0] = (c & 2) | (c & 1 & ~(c >> 1));
+    }
+}
+
+static void astc_decode_quints(uint32_t q, int out[3])
+{
+    if (((q >> 1) & 3) == 3 && ((q >> 5) & 3) == 0)
+    {
+        int low = q & 1;
+        out[2] = (low << 2) | ((((q >> 4) & 1) & ~low & 1) << 1) | (((q >> 3) & 1) & ~low & 1);
+        out[1] = 4;
+        out[0] = 4;
+        return;
+    }
+
+    int c;
+    if (((q >> 1) & 3) == 3)
+    {
+        out[2] = 4;
+        c = (((q >> 3) & 3) << 3) | ((~(q >> 5) & 3) << 1) | (q & 1);
+    }
+    else
+    {
+        out[2] = (q >> 5) & 3;
+        c = q & 0x1f;
+    }
+
+    if ((c & 7) == 5)
+    {
+        out[1] = 4;
+        out[0] = (c >> 3) & 3;
+    }
+    else
+    {
+        out[1] = (c >> 3) & 3;
+        out[0] = c & 7;
+    }
+}
+
+/**
+ * @brief 解码整数序列编码的count个值
+ */
+static void astc_decode_ise(int range, int count, const uint8_t *data, int pos, uint8_t *out)
+{
+    const Astc_Range *r = &astc_ranges[range];
+    int limit = pos + astc_ise_bit_count(range, count);
+    int bits = r->bits;
+
+    if (r->trits)
+    {
+        //每5个值共用8位的trit编码，分散在各个值的低位之间
+        static const int trit_bits[5] = {2, 2, 1, 2, 1};
+        for (int i = 0; i < count; i += 5)
+        {
+            int m[5];
+            uint32_t t = 0;
+            int t_pos = 0;
+            for (int j = 0; j < 5; j++)
+            {
+                m[j] = astc_read_bits(data, pos, bits, limit);
+                pos += bits;
+                t |= astc_read_bits(data, pos, trit_bits[j], limit) << t_pos;
+                pos += trit_bits[j];
+                t_pos += trit_bits[j];
+            }
+            int trits[5];
+            astc_decode_trits(t, trits);
+            for (int j = 0; j < 5 && i + j < count; j++)
+            {
+                out[i + j] = (trits[j] << bits) | m[j];
+            }
+        }
+    }
+    else if (r->quints)
+    {
+        static const int quint_bits[3] = {3, 2, 2};
+        for (int i = 0; i < count; i += 3)
+        {
+            int m[3];
+            uint32_t q = 0;
+            int q_pos = 0;
+            for (int j = 0; j < 3; j++)
+            {
+                m[j] = astc_read_bits(data, pos, bits, limit);
+                pos += bits;
+                q |= astc_read_bits(data, pos, quint_bits[j], limit) << q_pos;
+                pos += quint_bits[j];
+                q_pos += quint_bits[j];
+            }
+            int quints[3];
+            astc_decode_quints(q, quints);
+            for (int j = 0; j < 3 && i + j < count; j++)
+            {
+                out[i + j] = (quints[j] << bits) | m[j];
+            }
+        }
+    }
+    else
+    {
+        for (int i = 0; i < count; i++)
+        {
+            out[i] = astc_read_bits(data, pos, bits, limit);
+            pos += bits;
+        }
+    }
+}
+
+typedef struct Astc_Block_Mode
+{
+    int weight_width;
+    int weight_height;
+    int weight_range;
+    bool dual_plane;
+    int weight_bits;
+} Astc_Block_Mode;
+
+static bool astc_decode_block_mode(int mode, Astc_Block_Mode *out)
+{
+    int r = (mode >> 4) & 1;
+    int h = (mode >> 9) & 1;
+    int d = (mode >> 10) & 1;
+    int a = (mode >> 5) & 3;
+    int x = 0, y = 0;
+
+    if ((mode & 3) != 0)
+    {
+        r |= (mode & 3) << 1;
+        int b = (mode >> 7) & 3;
+        switch ((mode >> 2) & 3)
+        {
+        case 0:
+            x = b + 4;
+            y = a + 2;
+            break;
+        case 1:
+            x = b + 8;
+            y = a + 2;
+            break;
+        case 2:
+            x = a + 2;
+            y = b + 8;
+            break;
+        case 3:
+            b &= 1;
+            if (mode & 0x100)
+            {
+                x = b + 2;
+                y = a + 2;
+            }
+            else
+            {
+                x = a + 2;
+                y = b + 6;
+            }
+            break;
+        }
+    }
+    else
+    {
+        r |= ((mode >> 2) & 3) << 1;
+        if (((mode >> 2) & 3) == 0)
+        {
+            return false;
+        }
+
+        int b = (mode >> 9) & 3;
+        switch ((mode >> 7) & 3)
+        {
+        case 0:
+            x = 12;
+            y = a + 2;
+            break;
+        case 1:
+            x = a + 2;
+            y = 12;
+            break;
+        case 2:
+            x = a + 6;
+            y = b + 6;
+            d = 0;
+            h = 0;
+            break;
+        case 3:
+            if (((mode >> 5) & 3) == 0)
+            {
+                x = 6;
+                y = 10;
+            }
+            else if (((mode >> 5) & 3) == 1)
+            {
+                x = 10;
+                y = 6;
+            }
+            else
+            {
+                return false;
+            }
+            break;
+        }
+    }
+
+    int count = x * y * (d + 1);
+    out->weight_width = x;
+    out->weight_height = y;
+    out->weight_range = (r - 2) + 6 * h;
+    out->dual_plane = d != 0;
+    out->weight_bits = astc_ise_bit_count(out->weight_range, count);
+
+    return count <= ASTC_MAX_WEIGHTS && out->weight_bits >= 24 && out->weight_bits <= 96;
+}
+
+static uint32_t astc_hash52(uint32_t p)
+{
+    p ^= p >> 15;
+    p *= 0xEEDE0891;
+    p ^= p >> 5;
+    p += p << 16;
+    p ^= p >> 7;
+    p ^= p >> 3;
+    p ^= p << 6;
+    p ^= p >> 17;
+    return p;
+}
+
+static int astc_select_partition(int seed, int x, int y, int partition_count, bool small_block)
+{
+    if (small_block)
+    {
+        x <<= 1;
+        y <<= 1;
+    }
+
+    seed += (partition_count - 1) * 1024;
+    uint32_t rnum = astc_hash52(seed);
+
+    uint8_t s[12];
+    s[0] = rnum & 0xf;
+    s[1] = (rnum >> 4) & 0xf;
+    s[2] = (rnum >> 8) & 0xf;
+    s[3] = (rnum >> 12) & 0xf;
+    s[4] = (rnum >> 16) & 0xf;
+    s[5] = (rnum >> 20) & 0xf;
+    s[6] = (rnum >> 24) & 0xf;
+    s[7] = (rnum >> 28) & 0xf;
+    s[8] = (rnum >> 18) & 0xf;
+    s[9] = (rnum >> 22) & 0xf;
+    s[10] = (rnum >> 26) & 0xf;
+    s[11] = ((rnum >> 30) | (rnum << 2)) & 0xf;
+
+    for (int i = 0; i < 12; i++)
+    {
+        s[i] *= s[i];
+    }
+
+    int sh1, sh2;
+    if (seed & 1)
+    {
+        sh1 = (seed & 2) ? 4 : 5;
+        sh2 = partition_count == 3 ? 6 : 5;
+    }
+    else
+    {
+        sh1 = partition_count == 3 ? 6 : 5;
+        sh2 = (seed & 2) ? 4 : 5;
+    }
+    int sh3 = (seed & 0x10) ? sh1 : sh2;
+
+    for (int i = 0; i < 8; i++)
+    {
+        s[i] >>= (i & 1) ? sh2 : sh1;
+    }
+    for (int i = 8; i < 12; i++)
+    {
+        s[i] >>= sh3;
+    }
+
+    // 二维纹理的z为0，seed9到seed12不参与计算
+    int a = (s[0] * x + s[1] * y + (rnum >> 14)) & 0x3f;
+    int b = (s[2] * x + s[3] * y + (rnum >> 10)) & 0x3f;
+    int c = (s[4] * x + s[5] * y + (rnum >> 6)) & 0x3f;
+    int d = (s[6] * x + s[7] * y + (rnum >> 2)) & 0x3f;
+
+    if (partition_count < 4)
+    {
+        d = 0;
+    }
+    if (partition_count < 3)
+    {
+        c = 0;
+    }
+
+    if (a >= b && a >= c && a >= d)
+    {
+        return 0;
+    }
+    else if (b >= c && b >= d)
+    {
+        return 1;
+    }
+    else if (c >= d)
+    {
+        return 2;
+    }
+    return 3;
+}
+
+static inline void astc_bit_transfer_signed(int *a, int *b)
+{
+    *b >>= 1;
+    *b |= *a & 0x80;
+    *a >>= 1;
+    *a &= 0x3f;
+    if (*a & 0x20)
+    {
+        *a -= 0x40;
+    }
+}
+
+static inline void astc_blue_contract(int *c)
+{
+    c[0] = (c[0] + c[2]) >> 1;
+    c[1] = (c[1] + c[2]) >> 1;
+}
+
+/**
+ * @brief 由颜色端点模式与解量化后的值得到两个RGBA端点，HDR模式返回false
+ */
+static bool astc_decode_endpoints(int cem, const uint8_t *values, int e0[4], int e1[4])
+{
+    int v[8];
+    for (int i = 0; i < (cem / 4 + 1) * 2; i++)
+    {
+        v[i] = values[i];
+    }
+
+    switch (cem)
+    {
+    case 0:
+        e0[0] = e0[1] = e0[2] = v[0];
+        e1[0] = e1[1] = e1[2] = v[1];
+        e0[3] = e1[3] = 0xff;
+        break;
+    case 1:
+    {
+        int l0 = (v[0] >> 2) | (v[1] & 0xc0);
+        int l1 = MIN(l0 + (v[1] & 0x3f), 0xff);
+        e0[0] = e0[1] = e0[2] = l0;
+        e1[0] = e1[1] = e1[2] = l1;
+        e0[3] = e1[3] = 0xff;
+        break;
+    }
+    case 4:
+        e0[0] = e0[1] = e0[2] = v[0];
+        e1[0] = e1[1] = e1[2] = v[1];
+        e0[3] = v[2];
+        e1[3] = v[3];
+        break;
+    case 5:
+        astc_bit_transfer_signed(&v[1], &v[0]);
+        astc_bit_transfer_signed(&v[3], &v[2]);
+        e0[0] = e0[1] = e0[2] = v[0];
+        e1[0] = e1[1] = e1[2] = v[0] + v[1];
+        e0[3] = v[2];
+        e1[3] = v[2] + v[3];
+        break;
+    case 6:
+        for (int c = 0; c < 3; c++)
+        {
+            e0[c] = (v[c] * v[3]) >> 8;
+            e1[c] = v[c];
+        }
+        e0[3] = e1[3] = 0xff;
+        break;
+    case 8:
+    case 12:
+    {
+        int a0 = cem == 12 ? v[6] : 0xff;
+        int a1 = cem == 12 ? v[7] : 0xff;
+        if (v[1] + v[3] + v[5] >= v[0] + v[2] + v[4])
+        {
+            e0[0] = v[0], e0[1] = v[2], e0[2] = v[4], e0[3] = a0;
+            e1[0] = v[1], e1[1] = v[3], e1[2] = v[5], e1[3] = a1;
+        }
+        else
+        {
+            e0[0] = v[1], e0[1] = v[3], e0[2] = v[5], e0[3] = a1;
+            e1[0] = v[0], e1[1] = v[2], e1[2] = v[4], e1[3] = a0;
+            astc_blue_contract(e0);
+            astc_blue_contract(e1);
+        }
+        break;
+    }
+    case 9:
+    case 13:
+    {
+        astc_bit_transfer_signed(&v[1], &v[0]);
+        astc_bit_transfer_signed(&v[3], &v[2]);
+        astc_bit_transfer_signed(&v[5], &v[4]);
+        if (cem == 13)
+        {
+            astc_bit_transfer_signed(&v[7], &v[6]);
+        }
+        else
+        {
+            v[6] = 0xff;
+            v[7] = 0;
+        }
+
+        if (v[1] + v[3] + v[5] >= 0)
+        {
+            e0[0] = v[0], e0[1] = v[2], e0[2] = v[4], e0[3] = v[6];
+            e1[0] = v[0] + v[1], e1[1] = v[2] + v[3], e1[2] = v[4] + v[5], e1[3] = v[6] + v[7];
+        }
+        else
+        {
+            e0[0] = v[0] + v[1], e0[1] = v[2] + v[3], e0[2] = v[4] + v[5], e0[3] = v[6] + v[7];
+            e1[0] = v[0], e1[1] = v[2], e1[2] = v[4], e1[3] = v[6];
+            astc_blue_contract(e0);
+            astc_blue_contract(e1);
+        }
+        break;
+    }
+    case 10:
+        for (int c = 0; c < 3; c++)
+        {
+            e0[c] = (v[c] * v[3]) >> 8;
+            e1[c] = v[c];
+        }
+        e0[3] = v[4];
+        e1[3] = v[5];
+        break;
+    default:
+        // 2、3、7、11、14、15为HDR模式
+        return false;
+    }
+
+    for (int c = 0; c < 4; c++)
+    {
+        e0[c] = clamp_u8(e0[c]);
+        e1[c] = clamp_u8(e1[c]);
+    }
+    return true;
+}
+
+static void astc_fill(uint8_t *out, int stride, int block_width, int block_height, const uint8_t color[4])
+{
+    for (int y = 0; y < block_height; y++)
+    {
+        for (int x = 0; x < block_width; x++)
+        {
+            memcpy(out + y * stride + x * 4, color, 4);
+        }
+    }
+}
+
+static bool astc_error_block(uint8_t *out, int stride, int block_width, int block_height)
+{
+    static const uint8_t error_color[4] = {0xff, 0x00, 0xff, 0xff};
+    astc_fill(out, stride, block_width, block_height, error_color);
+    return false;
+}
+
+static bool astc_decode_void_extent(const uint8_t *block, int block_width, int block_height, uint8_t *out, int stride)
+{
+    //HDR的单色块在LDR下不合法
+    if (astc_read_bits(block, 9, 1, 128))
+    {
+        return astc_error_block(out, stride, block_width, block_height);
+    }
+
+    uint32_t s_low = astc_read_bits(block, 12, 13, 128);
+    uint32_t s_high = astc_read_bits(block, 25, 13, 128);
+    uint32_t t_low = astc_read_bits(block, 38, 13, 128);
+    uint32_t t_high = astc_read_bits(block, 51, 13, 128);
+    bool all_ones = s_low == 0x1fff && s_high == 0x1fff && t_low == 0x1fff && t_high == 0x1fff;
+    if (!all_ones && (s_low >= s_high || t_low >= t_high))
+    {
+        return astc_error_block(out, stride, block_width, block_height);
+    }
+
+    uint8_t color[4];
+    for (int c = 0; c < 4; c++)
+    {
+        color[c] = astc_read_bits(block, 64 + c * 16, 16, 128) >> 8;
+    }
+    astc_fill(out, stride, block_width, block_height, color);
+    return true;
+}
+
+bool astc_decode_block(const uint8_t *block, int block_width, int block_height, bool srgb, uint8_t *out, int stride)
+{
+    astc_init_tables();
+
+    int mode = astc_read_bits(block, 0, 11, 128);
+    if ((mode & 0x1ff) == 0x1fc)
+    {
+        return astc_decode_void_extent(block, block_width, block_height, out, stride);
+    }
+
+    Astc_Block_Mode block_mode;
+    if (!astc_decode_block_mode(mode, &block_mode) ||
+        block_mode.weight_width > block_width || block_mode.weight_height > block_height)
+    {
+        return astc_error_block(out, stride, block_width, block_height);
+    }
+
+    int partition_count = astc_read_bits(block, 11, 2, 128) + 1;
+    if (partition_count == 4 && block_mode.dual_plane)
+    {
+        return astc_error_block(out, stride, block_width, block_height);
+    }
+
+    //权重从块的最高位开始倒序存放，其下依次为额外的CEM位与双平面的通道选择位
+    int below_weights = 128 - block_mode.weight_bits;
+    int cem[4];
+    int color_start;
+    int partition_seed = 0;
+
+    if (partition_count == 1)
+    {
+        cem[0] = astc_read_bits(block, 13, 4, 128);
+        color_start = 17;
+    }
+    else
+    {
+        partition_seed = astc_read_bits(block, 13, 10, 128);
+        uint32_t encoded = astc_read_bits(block, 23, 6, 128);
+        color_start = 29;
+
+        int base_class = encoded & 3;
+        if (base_class == 0)
+        {
+            for (int i = 0; i < partition_count; i++)
+            {
+                cem[i] = (encoded >> 2) & 0xf;
+            }
+        }
+        else
+        {
+            int extra_bits = 3 * partition_count - 4;
+            below_weights -= extra_bits;
+            encoded |= astc_read_bits(block, below_weights, extra_bits, 128) << 6;
+
+            base_class--;
+            for (int i = 0; i < partition_count; i++)
+            {
+                int c = (encoded >> (2 + i)) & 1;
+                int m = (encoded >> (2 + partition_count + 2 * i)) & 3;
+                cem[i] = ((base_class + c) << 2) | m;
+            }
+        }
+    }
+
+    int ccs = 0;
+    if (block_mode.dual_plane)
+    {
+        below_weights -= 2;
+        ccs = astc_read_bits(block, below_weights, 2, 128);
+    }
+
+    int color_value_num = 0;
+    for (int i = 0; i < partition_count; i++)
+    {
+        color_value_num += (cem[i] / 4 + 1) * 2;
+    }
+    if (color_value_num > ASTC_MAX_COLOR_VALUES || below_weights <= color_start)
+    {
+        return astc_error_block(out, stride, block_width, block_height);
+    }
+
+    //颜色值使用放得下的最大范围
+    int color_bits = below_weights - color_start;
+    int color_range = ASTC_RANGE_NUM - 1;
+    while (color_range >= ASTC_RANGE_6 && astc_ise_bit_count(color_range, color_value_num) > color_bits)
+    {
+        color_range--;
+    }
+    if (color_range < ASTC_RANGE_6)
+    {
+        return astc_error_block(out, stride, block_width, block_height);
+    }
+
+    uint8_t color_values[ASTC_MAX_COLOR_VALUES];
+    astc_decode_ise(color_range, color_value_num, block, color_start, color_values);
+    for (int i = 0; i < color_value_num; i++)
+    {
+        color_values[i] = astc_color_unquant[color_range][color_values[i]];
+    }
+
+    int endpoints[4][2][4];
+    const uint8_t *values = color_values;
+    for (int i = 0; i < partition_count; i++)
+    {
+        if (!astc_decode_endpoints(cem[i], values, endpoints[i][0], endpoints[i][1]))
+        {
+            return astc_error_block(out, stride, block_width, block_height);
+        }
+        values += (cem[i] / 4 + 1) * 2;
+    }
+
+    //把块的128位整体倒序，权重就可以从第0位开始顺序读取
+    uint8_t reversed[16];
+    for (int i = 0; i < 16; i++)
+    {
+        uint8_t b = block[15 - i];
+        b = ((b & 0xf0) >> 4) | ((b & 0x0f) << 4);
+        b = ((b & 0xcc) >> 2) | ((b & 0x33) << 2);
+        b = ((b & 0xaa) >> 1) | ((b & 0x55) << 1);
+        reversed[i] = b;
+    }
+
+    int plane_num = block_mode.dual_plane ? 2 : 1;
+    int grid_width = block_mode.weight_width;
+    int grid_height = block_mode.weight_height;
+    int weight_num = grid_width * grid_height * plane_num;
+
+    uint8_t weights[ASTC_MAX_WEIGHTS];
+    astc_decode_ise(block_mode.weight_range, weight_num, reversed, 0, weights);
+    for (int i = 0; i < weight_num; i++)
+    {
+        weights[i] = astc_weight_unquant[block_mode.weight_range][weights[i]];
+    }
+
+    int ds = (1024 + block_width / 2) / (block_width - 1);
+    int dt = (1024 + block_height / 2) / (block_height - 1);
+    bool small_block = block_width * block_height < 31;
+
+    for (int y = 0; y < block_height; y++)
+    {
+        uint8_t *row = out + y * stride;
+        int gt = (dt * y * (grid_height - 1) + 32) >> 6;
+        int jt = gt >> 4;
+        int ft = gt & 0xf;
+
+        for (int x = 0; x < block_width; x++)
+        {
+            int gs = (ds * x * (grid_width - 1) + 32) >> 6;
+            int js = gs >> 4;
+            int fs = gs & 0xf;
+
+            //双线性插值出这个像素的权重，网格边缘上越界的那些点的系数为0
+            int w11 = (fs * ft + 8) >> 4;
+            int w10 = ft - w11;
+            int w01 = fs - w11;
+            int w00 = 16 - fs - ft + w11;
+            int v0 = js + jt * grid_width;
+
+            int texel_weight[2];
+            for (int p = 0; p < plane_num; p++)
+            {
+                int sum = weights[v0 * plane_num + p] * w00;
+                if (w01 != 0)
+                {
+                    sum += weights[(v0 + 1) * plane_num + p] * w01;
+                }
+                if (w10 != 0)
+                {
+                    sum += weights[(v0 + grid_width) * plane_num + p] * w10;
+                }
+                if (w11 != 0)
+                {
+                    sum += weights[(v0 + grid_width + 1) * plane_num + p] * w11;
+                }
+                texel_weight[p] = (sum + 8) >> 4;
+            }
+
+            int partition = partition_count > 1 ? astc_select_partition(partition_seed, x, y, partition_count, small_block) : 0;
+            const int *e0 = endpoints[partition][0];
+            const int *e1 = endpoints[partition][1];
+
+            for (int c = 0; c < 4; c++)
+            {
+                int w = (block_mode.dual_plane && c == ccs) ? texel_weight[1] : texel_weight[0];
+                int c0, c1;
+                if (srgb && c < 3)
+                {
+                    c0 = (e0[c] << 8) | 0x80;
+                    c1 = (e1[c] << 8) | 0x80;
+                }
+                else
+                {
+                    c0 = e0[c] * 257;
+                    c1 = e1[c] * 257;
+                }
+                row[x * 4 + c] = ((c0 * (64 - w) + c1 * w + 32) >> 6) >> 8;
+            }
+        }
+    }
+    return true;
+}
+
+/******************************** 整个图像 ********************************/
+
+int texture_decode_block_bytes(const Texture_Decode_Format *format)
+{
+    switch (format->kind)
+    {
+    case TEXTURE_DECODE_ETC2_RGB8:
+    case TEXTURE_DECODE_ETC2_RGB8A1:
+    case TEXTURE_DECODE_EAC_R11:
+    case TEXTURE_DECODE_EAC_R11_SIGNED:
+        return 8;
+    default:
+        return 16;
+    }
+}
+
+int texture_decode_pixel_bytes(const Texture_Decode_Format *format)
+{
+    switch (format->kind)
+    {
+    case TEXTURE_DECODE_EAC_R11:
+    case TEXTURE_DECODE_EAC_R11_SIGNED:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+size_t texture_decode_image_size(const Texture_Decode_Format *format, int width, int height)
+{
+    size_t blocks_x = (width + format->block_width - 1) / format->block_width;
+    size_t blocks_y = (height + format->block_height - 1) / format->block_height;
+    return blocks_x * blocks_y * texture_decode_block_bytes(format);
+}
+
+static void texture_decode_one_block(const Texture_Decode_Format *format, const uint8_t *block, uint8_t *tile, int tile_stride)
+{
+    switch (format->kind)
+    {
+    case TEXTURE_DECODE_ETC2_RGB8:
+        etc2_decode_color_block(block, false, tile, tile_stride);
+        break;
+    case TEXTURE_DECODE_ETC2_RGB8A1:
+        etc2_decode_color_block(block, true, tile, tile_stride);
+        break;
+    case TEXTURE_DECODE_ETC2_RGBA8:
+        etc2_decode_color_block(block + 8, false, tile, tile_stride);
+        eac_decode_alpha_block(block, tile, tile_stride);
+        break;
+    case TEXTURE_DECODE_EAC_R11:
+    case TEXTURE_DECODE_EAC_R11_SIGNED:
+        eac_decode_r11_block(block, format->kind == TEXTURE_DECODE_EAC_R11_SIGNED, (uint16_t *)tile, tile_stride / 2, 1);
+        break;
+    case TEXTURE_DECODE_EAC_RG11:
+    case TEXTURE_DECODE_EAC_RG11_SIGNED:
+    {
+        bool is_signed = format->kind == TEXTURE_DECODE_EAC_RG11_SIGNED;
+        eac_decode_r11_block(block, is_signed, (uint16_t *)tile, tile_stride / 2, 2);
+        eac_decode_r11_block(block + 8, is_signed, (uint16_t *)tile + 1, tile_stride / 2, 2);
+        break;
+    }
+    case TEXTURE_DECODE_ASTC:
+    case TEXTURE_DECODE_ASTC_SRGB:
+        astc_decode_block(block, format->block_width, format->block_height,
+                          format->kind == TEXTURE_DECODE_ASTC_SRGB, tile, tile_stride);
+        break;
+    }
+}
+
+void texture_decode_rows(const Texture_Decode_Format *format, const uint8_t *src, int width, int height,
+                         int block_row_begin, int block_row_end, uint8_t *dst)
+{
+    int block_bytes = texture_decode_block_bytes(format);
+    int pixel_bytes = texture_decode_pixel_bytes(format);
+    int bw = format->block_width;
+    int bh = format->block_height;
+    int blocks_x = (width + bw - 1) / bw;
+    size_t dst_stride = (size_t)width * pixel_bytes;
+
+    //块先解到一个小的tile里，再拷贝到图像中，边缘上不完整的块只拷贝图像范围内的部分
+    int tile_stride = ASTC_MAX_BLOCK_DIM * 4;
+    QEMU_ALIGNED(16) uint8_t tile[ASTC_MAX_BLOCK_DIM * ASTC_MAX_BLOCK_DIM * 4];
+
+    for (int by = block_row_begin; by < block_row_end; by++)
+    {
+        const uint8_t *block = src + (size_t)by * blocks_x * block_bytes;
+        int rows = MIN(bh, height - by * bh);
+
+        for (int bx = 0; bx < blocks_x; bx++, block += block_bytes)
+        {
+            texture_decode_one_block(format, block, tile, tile_stride);
+
+            int columns = MIN(bw, width - bx * bw);
+            uint8_t *out = dst + (size_t)by * bh * dst_stride + (size_t)bx * bw * pixel_bytes;
+            for (int y = 0; y < rows; y++)
+            {
+                memcpy(out + y * dst_stride, tile + y * tile_stride, columns * pixel_bytes);
+            }
+        }
+    }
+}
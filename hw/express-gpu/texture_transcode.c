@@ -0,0 +1,740 @@
+/**
+ * @file texture_transcode.c
+ * @brief 把host不支持的ETC1/ETC2/EAC/ASTC纹理解码后上传，并在磁盘上缓存解码结果
+ *
+ * 缓存目录超过express_gpu_texture_cache_mb时，按修改时间从旧到新删除缓存文件，命中缓存时会更新文件的修改时间。
+ */
+// #define STD_DEBUG_LOG
+
+#include "hw/express-gpu/texture_transcode.h"
+#include "hw/express-gpu/texture_decode.h"
+#include "hw/express-gpu/glv3_status.h"
+
+#include "hw/express-gpu/express_gpu.h"
+
+#include "hw/teleport-express/express_log.h"
+
+#include <glib/gstdio.h>
+
+bool express_gpu_texture_transcode = true;
+char *express_gpu_texture_cache = NULL;
+int express_gpu_texture_cache_mb = 1024;
+
+// 超过这个像素数的纹理才分给线程池并行解码
+#define TRANSCODE_STRIPE_PIXELS (256 * 256)
+#define TRANSCODE_MAX_STRIPES 8
+
+// 解码结果小于这个大小时不缓存，解码比读文件还快
+#define TRANSCODE_CACHE_MIN_BYTES (256 * 1024)
+
+#define TRANSCODE_CACHE_MAGIC "EXTEXC01"
+#define TRANSCODE_CACHE_SUFFIX ".tex"
+
+typedef struct Texture_Cache_Header
+{
+    char magic[8];
+    uint32_t decoded_size;
+    uint32_t reserved;
+} Texture_Cache_Header;
+
+typedef struct Transcode_Format
+{
+    GLenum compressed_format;
+    Texture_Decode_Format decode;
+    GLenum internal_format;
+    GLenum format;
+    GLenum type;
+} Transcode_Format;
+
+#define ASTC_FORMAT(offset, w, h)                                                                                           \
+    {GL_COMPRESSED_RGBA_ASTC_4x4_KHR + (offset), {TEXTURE_DECODE_ASTC, w, h}, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE}, \
+    {GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR + (offset), {TEXTURE_DECODE_ASTC_SRGB, w, h}, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE}
+
+// RGB格式也按RGBA上传，由驱动丢掉alpha，省去一次重新排列
+static const Transcode_Format transcode_formats[] = {
+    {GL_ETC1_RGB8_OES, {TEXTURE_DECODE_ETC2_RGB8, 4, 4}, GL_RGB8, GL_RGBA, GL_UNSIGNED_BYTE},
+    {GL_COMPRESSED_R11_EAC, {TEXTURE_DECODE_EAC_R11, 4, 4}, GL_R16, GL_RED, GL_UNSIGNED_SHORT},
+    {GL_COMPRESSED_SIGNED_R11_EAC, {TEXTURE_DECODE_EAC_R11_SIGNED, 4, 4}, GL_R16_SNORM, GL_RED, GL_SHORT},
+    {GL_COMPRESSED_RG11_EAC, {TEXTURE_DECODE_EAC_RG11, 4, 4}, GL_RG16, GL_RG, GL_UNSIGNED_SHORT},
+    {GL_COMPRESSED_SIGNED_RG11_EAC, {TEXTURE_DECODE_EAC_RG11_SIGNED, 4, 4}, GL_RG16_SNORM, GL_RG, GL_SHORT},
+    {GL_COMPRESSED_RGB8_ETC2, {TEXTURE_DECODE_ETC2_RGB8, 4, 4}, GL_RGB8, GL_RGBA, GL_UNSIGNED_BYTE},
+    {GL_COMPRESSED_SRGB8_ETC2, {TEXTURE_DECODE_ETC2_RGB8, 4, 4}, GL_SRGB8, GL_RGBA, GL_UNSIGNED_BYTE},
+    {GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2, {TEXTURE_DECODE_ETC2_RGB8A1, 4, 4}, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE},
+    {GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2, {TEXTURE_DECODE_ETC2_RGB8A1, 4, 4}, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE},
+    {GL_COMPRESSED_RGBA8_ETC2_EAC, {TEXTURE_DECODE_ETC2_RGBA8, 4, 4}, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE},
+    {GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC, {TEXTURE_DECODE_ETC2_RGBA8, 4, 4}, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE},
+    ASTC_FORMAT(0, 4, 4),
+    ASTC_FORMAT(1, 5, 4),
+    ASTC_FORMAT(2, 5, 5),
+    ASTC_FORMAT(3, 6, 5),
+    ASTC_FORMAT(4, 6, 6),
+    ASTC_FORMAT(5, 8, 5),
+    ASTC_FORMAT(6, 8, 6),
+    ASTC_FORMAT(7, 8, 8),
+    ASTC_FORMAT(8, 10, 5),
+    ASTC_FORMAT(9, 10, 6),
+    ASTC_FORMAT(10, 10, 8),
+    ASTC_FORMAT(11, 10, 10),
+    ASTC_FORMAT(12, 12, 10),
+    ASTC_FORMAT(13, 12, 12),
+};
+
+#define TRANSCODE_FORMAT_NUM ARRAY_SIZE(transcode_formats)
+
+// 在static_value_prepare中确定，之后只读
+static bool format_needs_transcode[TRANSCODE_FORMAT_NUM];
+
+static const GLenum unpack_params[6] = {
+    GL_UNPACK_ALIGNMENT,
+    GL_UNPACK_ROW_LENGTH,
+    GL_UNPACK_IMAGE_HEIGHT,
+    GL_UNPACK_SKIP_PIXELS,
+    GL_UNPACK_SKIP_ROWS,
+    GL_UNPACK_SKIP_IMAGES,
+};
+
+typedef struct Transcode_Job
+{
+    const Transcode_Format *format;
+    const uint8_t *src;
+    uint8_t *dst;
+    int width;
+    int height;
+
+    int blocks_y;
+    size_t src_slice_size;
+    size_t dst_slice_size;
+
+    GMutex lock;
+    GCond cond;
+    int pending;
+} Transcode_Job;
+
+typedef struct Transcode_Stripe
+{
+    Transcode_Job *job;
+    int row_begin;
+    int row_end;
+} Transcode_Stripe;
+
+typedef struct Cache_Write
+{
+    char *path;
+    void *data;
+    size_t len;
+} Cache_Write;
+
+typedef struct Cache_Entry
+{
+    char *path;
+    int64_t mtime;
+    int64_t size;
+} Cache_Entry;
+
+// 缓存目录中文件的总大小，小于0表示还没有扫描过，只在写缓存的线程中访问
+static int64_t cache_total_bytes = -1;
+
+static const Transcode_Format *find_transcode_format(GLenum internalformat)
+{
+    for (int i = 0; i < TRANSCODE_FORMAT_NUM; i++)
+    {
+        if (transcode_formats[i].compressed_format == internalformat)
+        {
+            return format_needs_transcode[i] ? &transcode_formats[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+void texture_transcode_prepare_formats(Static_Context_Values *values)
+{
+    if (!express_gpu_texture_transcode)
+    {
+        // 与之前一样只声明ETC1，由host驱动自己处理
+        if (values->num_compressed_texture_formats < 128)
+        {
+            values->num_compressed_texture_formats++;
+        }
+        values->compressed_texture_formats[values->num_compressed_texture_formats - 1] = GL_ETC1_RGB8_OES;
+        return;
+    }
+
+    int native_num = MIN(values->num_compressed_texture_formats, 128);
+    int transcode_num = 0;
+
+    for (int i = 0; i < TRANSCODE_FORMAT_NUM; i++)
+    {
+        bool native = false;
+        for (int j = 0; j < native_num; j++)
+        {
+            if (values->compressed_texture_formats[j] == transcode_formats[i].compressed_format)
+            {
+                native = true;
+                break;
+            }
+        }
+        if (native)
+        {
+            continue;
+        }
+
+        // 列表满了也要转码，guest可能不看列表直接使用GLES 3.x必须支持的格式
+        format_needs_transcode[i] = true;
+        transcode_num++;
+        if (values->num_compressed_texture_formats < 128)
+        {
+            values->compressed_texture_formats[values->num_compressed_texture_formats++] = transcode_formats[i].compressed_format;
+        }
+    }
+
+    LOGI("texture transcode: host supports %d compressed formats, %d formats are decoded on cpu", native_num, transcode_num);
+}
+
+bool texture_transcode_needed(GLenum internalformat)
+{
+    return find_transcode_format(internalformat) != NULL;
+}
+
+GLenum texture_transcode_storage_format(GLenum internalformat)
+{
+    const Transcode_Format *format = find_transcode_format(internalformat);
+    return format != NULL ? format->internal_format : internalformat;
+}
+
+void *texture_transcode_read_guest(Guest_Mem *guest_mem, GLsizei image_size)
+{
+    if (guest_mem->all_len == 0 || image_size <= 0)
+    {
+        return NULL;
+    }
+    if (guest_mem->all_len < image_size)
+    {
+        LOGE("error! compressed texture data %d smaller than imageSize %d", guest_mem->all_len, image_size);
+        return NULL;
+    }
+
+    void *data = g_malloc(image_size);
+    read_from_guest_mem(guest_mem, data, 0, image_size);
+    return data;
+}
+
+void *texture_transcode_read_unpack_buffer(GLintptr offset, GLsizei image_size)
+{
+    if (image_size <= 0)
+    {
+        return NULL;
+    }
+
+    void *data = g_malloc(image_size);
+    glGetBufferSubData(GL_PIXEL_UNPACK_BUFFER, offset, image_size, data);
+    return data;
+}
+
+static void transcode_rows(Transcode_Job *job, int row_begin, int row_end)
+{
+    // 数组纹理的每一层是独立的2D图像，这里的行号是所有层的块行连在一起的编号
+    while (row_begin < row_end)
+    {
+        int slice = row_begin / job->blocks_y;
+        int begin = row_begin % job->blocks_y;
+        int end = MIN(job->blocks_y, begin + (row_end - row_begin));
+
+        texture_decode_rows(&job->format->decode, job->src + slice * job->src_slice_size, job->width, job->height,
+                            begin, end, job->dst + slice * job->dst_slice_size);
+        row_begin += end - begin;
+    }
+}
+
+static void transcode_stripe_func(gpointer data, gpointer user_data)
+{
+    Transcode_Stripe *stripe = data;
+    Transcode_Job *job = stripe->job;
+
+    transcode_rows(job, stripe->row_begin, stripe->row_end);
+
+    g_mutex_lock(&job->lock);
+    job->pending--;
+    g_cond_signal(&job->cond);
+    g_mutex_unlock(&job->lock);
+}
+
+static GThreadPool *get_transcode_pool(void)
+{
+    static gsize pool_init = 0;
+    static GThreadPool *pool = NULL;
+
+    if (g_once_init_enter(&pool_init))
+    {
+        // 调用的线程自己也解码一段
+        pool = g_thread_pool_new(transcode_stripe_func, NULL, TRANSCODE_MAX_STRIPES - 1, FALSE, NULL);
+        g_once_init_leave(&pool_init, 1);
+    }
+    return pool;
+}
+
+static void transcode_decode(const Transcode_Format *format, const uint8_t *src, int width, int height, int depth, uint8_t *dst)
+{
+    Transcode_Job job;
+    memset(&job, 0, sizeof(job));
+    job.format = format;
+    job.src = src;
+    job.dst = dst;
+    job.width = width;
+    job.height = height;
+    job.blocks_y = (height + format->decode.block_height - 1) / format->decode.block_height;
+    job.src_slice_size = texture_decode_image_size(&format->decode, width, height);
+    job.dst_slice_size = (size_t)width * height * texture_decode_pixel_bytes(&format->decode);
+
+    int rows = job.blocks_y * depth;
+    int stripes = 1;
+    if ((int64_t)width * height * depth >= TRANSCODE_STRIPE_PIXELS)
+    {
+        stripes = MIN(MIN((int)g_get_num_processors(), TRANSCODE_MAX_STRIPES), rows);
+    }
+    if (stripes <= 1)
+    {
+        transcode_rows(&job, 0, rows);
+        return;
+    }
+
+    GThreadPool *pool = get_transcode_pool();
+    Transcode_Stripe stripe[TRANSCODE_MAX_STRIPES];
+    int stripe_rows = (rows + stripes - 1) / stripes;
+
+    g_mutex_init(&job.lock);
+    g_cond_init(&job.cond);
+    job.pending = stripes - 1;
+    for (int i = 0; i < stripes; i++)
+    {
+        stripe[i].job = &job;
+        stripe[i].row_begin = MIN(i * stripe_rows, rows);
+        stripe[i].row_end = MIN((i + 1) * stripe_rows, rows);
+        if (i > 0)
+        {
+            g_thread_pool_push(pool, &stripe[i], NULL);
+        }
+    }
+
+    transcode_rows(&job, stripe[0].row_begin, stripe[0].row_end);
+
+    g_mutex_lock(&job.lock);
+    while (job.pending > 0)
+    {
+        g_cond_wait(&job.cond, &job.lock);
+    }
+    g_mutex_unlock(&job.lock);
+
+    g_mutex_clear(&job.lock);
+    g_cond_clear(&job.cond);
+}
+
+static const char *get_cache_dir(void)
+{
+    static gsize dir_init = 0;
+    static char *cache_dir = NULL;
+
+    if (g_once_init_enter(&dir_init))
+    {
+        if (express_gpu_texture_cache == NULL)
+        {
+            cache_dir = g_build_filename(g_get_user_cache_dir(), "teleport-express", "textures", NULL);
+        }
+        else if (express_gpu_texture_cache[0] != 0)
+        {
+            cache_dir = g_strdup(express_gpu_texture_cache);
+        }
+
+        if (cache_dir != NULL && g_mkdir_with_parents(cache_dir, 0755) != 0)
+        {
+            LOGW("texture cache dir %s cannot be created, cache disabled", cache_dir);
+            g_free(cache_dir);
+            cache_dir = NULL;
+        }
+        g_once_init_leave(&dir_init, 1);
+    }
+    return cache_dir;
+}
+
+static char *get_cache_path(const Transcode_Format *format, int width, int height, int depth, const void *data, size_t len)
+{
+    const char *cache_dir = get_cache_dir();
+    if (cache_dir == NULL)
+    {
+        return NULL;
+    }
+
+    // 同样的数据按不同格式解释时结果不同，格式与大小也要算进key里
+    int32_t key[4] = {format->compressed_format, width, height, depth};
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(checksum, (const guchar *)key, sizeof(key));
+    g_checksum_update(checksum, data, len);
+
+    char *name = g_strdup_printf("%s" TRANSCODE_CACHE_SUFFIX, g_checksum_get_string(checksum));
+    char *path = g_build_filename(cache_dir, name, NULL);
+
+    g_free(name);
+    g_checksum_free(checksum);
+    return path;
+}
+
+static bool cache_read(const char *path, uint8_t *buf, size_t decoded_size)
+{
+    char *contents = NULL;
+    gsize len = 0;
+
+    if (!g_file_get_contents(path, &contents, &len, NULL))
+    {
+        return false;
+    }
+
+    Texture_Cache_Header *header = (Texture_Cache_Header *)contents;
+    bool valid = len == sizeof(Texture_Cache_Header) + decoded_size &&
+                 memcmp(header->magic, TRANSCODE_CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+                 header->decoded_size == decoded_size;
+    if (valid)
+    {
+        memcpy(buf + sizeof(Texture_Cache_Header), contents + sizeof(Texture_Cache_Header), decoded_size);
+        // 更新修改时间，淘汰时最近用过的文件留到最后
+        g_utime(path, NULL);
+    }
+
+    g_free(contents);
+    return valid;
+}
+
+/**
+ * @brief 统计缓存目录中缓存文件的总大小，entries不为NULL时顺便记下每个文件
+ */
+static int64_t cache_scan(const char *cache_dir, GArray *entries)
+{
+    GDir *dir = g_dir_open(cache_dir, 0, NULL);
+    if (dir == NULL)
+    {
+        return 0;
+    }
+
+    int64_t total = 0;
+    const char *name;
+    while ((name = g_dir_read_name(dir)) != NULL)
+    {
+        if (!g_str_has_suffix(name, TRANSCODE_CACHE_SUFFIX))
+        {
+            continue;
+        }
+
+        char *path = g_build_filename(cache_dir, name, NULL);
+        GStatBuf st;
+        if (g_stat(path, &st) != 0)
+        {
+            g_free(path);
+            continue;
+        }
+
+        total += st.st_size;
+        if (entries != NULL)
+        {
+            Cache_Entry entry = {path, st.st_mtime, st.st_size};
+            g_array_append_val(entries, entry);
+        }
+        else
+        {
+            g_free(path);
+        }
+    }
+
+    g_dir_close(dir);
+    return total;
+}
+
+static gint cache_entry_compare(gconstpointer a, gconstpointer b)
+{
+    const Cache_Entry *x = a;
+    const Cache_Entry *y = b;
+    return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+/**
+ * @brief 从最久没用过的文件开始删除，直到总大小降到上限的90%，留出余量避免每写一个文件就扫描一次目录
+ */
+static void cache_evict(const char *cache_dir, int64_t limit)
+{
+    GArray *entries = g_array_new(FALSE, FALSE, sizeof(Cache_Entry));
+    int64_t total = cache_scan(cache_dir, entries);
+    int64_t target = limit / 10 * 9;
+    int removed = 0;
+
+    g_array_sort(entries, cache_entry_compare);
+    for (guint i = 0; i < entries->len; i++)
+    {
+        Cache_Entry *entry = &g_array_index(entries, Cache_Entry, i);
+        if (total > target && g_unlink(entry->path) == 0)
+        {
+            total -= entry->size;
+            removed++;
+        }
+        g_free(entry->path);
+    }
+    g_array_free(entries, TRUE);
+
+    LOGI("texture cache evicted %d files, %lld bytes left", removed, (long long)total);
+    cache_total_bytes = total;
+}
+
+static void cache_write_func(gpointer data, gpointer user_data)
+{
+    Cache_Write *request = data;
+
+    GError *error = NULL;
+    if (!g_file_set_contents(request->path, request->data, request->len, &error))
+    {
+        LOGW("texture cache write %s failed: %s", request->path, error->message);
+        g_error_free(error);
+    }
+    else if (express_gpu_texture_cache_mb > 0)
+    {
+        int64_t limit = (int64_t)express_gpu_texture_cache_mb * 1024 * 1024;
+        const char *cache_dir = get_cache_dir();
+
+        // 第一次写的时候扫描一次目录，之后只累加写入的大小，超过上限时再重新扫描
+        if (cache_total_bytes < 0)
+        {
+            cache_total_bytes = cache_scan(cache_dir, NULL);
+        }
+        else
+        {
+            cache_total_bytes += request->len;
+        }
+        if (cache_total_bytes > limit)
+        {
+            cache_evict(cache_dir, limit);
+        }
+    }
+
+    g_free(request->path);
+    g_free(request->data);
+    g_free(request);
+}
+
+/**
+ * @brief 写文件交给单独的线程，不阻塞渲染线程，buf的所有权也一起交出去
+ */
+static void cache_write_async(char *path, uint8_t *buf, size_t decoded_size)
+{
+    static gsize pool_init = 0;
+    static GThreadPool *pool = NULL;
+
+    if (g_once_init_enter(&pool_init))
+    {
+        pool = g_thread_pool_new(cache_write_func, NULL, 1, FALSE, NULL);
+        g_once_init_leave(&pool_init, 1);
+    }
+
+    Texture_Cache_Header *header = (Texture_Cache_Header *)buf;
+    memcpy(header->magic, TRANSCODE_CACHE_MAGIC, sizeof(header->magic));
+    header->decoded_size = decoded_size;
+    header->reserved = 0;
+
+    Cache_Write *request = g_malloc(sizeof(Cache_Write));
+    request->path = path;
+    request->data = buf;
+    request->len = sizeof(Texture_Cache_Header) + decoded_size;
+    g_thread_pool_push(pool, request, NULL);
+}
+
+/**
+ * @brief 得到解码后的数据，返回的缓冲区前面留有缓存文件头的位置，像素从sizeof(Texture_Cache_Header)开始
+ */
+static uint8_t *transcode_get_pixels(const Transcode_Format *format, int width, int height, int depth,
+                                     const void *data, GLsizei image_size, char **cache_path)
+{
+    size_t slice_size = texture_decode_image_size(&format->decode, width, height);
+    if ((size_t)image_size < slice_size * depth)
+    {
+        LOGE("error! compressed texture %x %dx%dx%d needs %zu bytes but imageSize is %d",
+             format->compressed_format, width, height, depth, slice_size * depth, image_size);
+        return NULL;
+    }
+
+    size_t decoded_size = (size_t)width * height * depth * texture_decode_pixel_bytes(&format->decode);
+    uint8_t *buf = g_malloc(sizeof(Texture_Cache_Header) + decoded_size);
+
+    *cache_path = NULL;
+    if (decoded_size >= TRANSCODE_CACHE_MIN_BYTES)
+    {
+        *cache_path = get_cache_path(format, width, height, depth, data, slice_size * depth);
+        if (*cache_path != NULL && cache_read(*cache_path, buf, decoded_size))
+        {
+            express_printf("texture cache hit %s\n", *cache_path);
+            g_free(*cache_path);
+            *cache_path = NULL;
+            return buf;
+        }
+    }
+
+    int64_t start_time = g_get_real_time();
+    transcode_decode(format, data, width, height, depth, buf + sizeof(Texture_Cache_Header));
+    express_printf("texture transcode %x %dx%dx%d spend %lld us\n", format->compressed_format, width, height, depth,
+                   (long long)(g_get_real_time() - start_time));
+    return buf;
+}
+
+/**
+ * @brief 上传前解绑PIXEL_UNPACK_BUFFER，并把guest设置的解包参数换成紧密排列，返回原来的解包参数
+ */
+static void transcode_unpack_enter(Opengl_Context *opengl_context, GLint saved[6])
+{
+    Buffer_Status *buffer_status = &(opengl_context->bound_buffer_status.buffer_status);
+    if (buffer_status->host_pixel_unpack_buffer != 0)
+    {
+        buffer_status->host_pixel_unpack_buffer = 0;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    for (int i = 0; i < 6; i++)
+    {
+        glGetIntegerv(unpack_params[i], &saved[i]);
+        GLint value = i == 0 ? 1 : 0;
+        if (saved[i] != value)
+        {
+            glPixelStorei(unpack_params[i], value);
+        }
+    }
+}
+
+static void transcode_unpack_leave(const GLint saved[6])
+{
+    for (int i = 0; i < 6; i++)
+    {
+        if (saved[i] != (i == 0 ? 1 : 0))
+        {
+            glPixelStorei(unpack_params[i], saved[i]);
+        }
+    }
+}
+
+static void transcode_finish(uint8_t *buf, char *cache_path, const Transcode_Format *format, int width, int height, int depth)
+{
+    if (buf != NULL && cache_path != NULL)
+    {
+        cache_write_async(cache_path, buf, (size_t)width * height * depth * texture_decode_pixel_bytes(&format->decode));
+        return;
+    }
+    g_free(cache_path);
+    g_free(buf);
+}
+
+void texture_transcode_image(void *context, GLenum target, GLint level, GLenum internalformat,
+                             GLsizei width, GLsizei height, GLsizei depth, bool is_3d,
+                             const void *data, GLsizei image_size)
+{
+    Opengl_Context *opengl_context = (Opengl_Context *)context;
+    const Transcode_Format *format = find_transcode_format(internalformat);
+
+    GLuint bind_texture = get_guest_binding_texture(context, target);
+    if (bind_texture == 0 || format == NULL)
+    {
+        LOGE("error! %s with texture %u target %x format %x", __FUNCTION__, bind_texture, target, internalformat);
+        return;
+    }
+
+    uint8_t *buf = NULL;
+    char *cache_path = NULL;
+    if (data != NULL && width > 0 && height > 0 && depth > 0)
+    {
+        buf = transcode_get_pixels(format, width, height, depth, data, image_size, &cache_path);
+        if (buf == NULL)
+        {
+            return;
+        }
+    }
+    const void *pixels = buf != NULL ? buf + sizeof(Texture_Cache_Header) : NULL;
+
+    GLint saved_unpack[6];
+    transcode_unpack_enter(opengl_context, saved_unpack);
+
+    if (DSA_LIKELY(host_opengl_version >= 45 && DSA_enable != 0))
+    {
+        if (is_3d)
+        {
+            glTextureImage3DEXT(bind_texture, target, level, format->internal_format, width, height, depth, 0, format->format, format->type, pixels);
+        }
+        else
+        {
+            glTextureImage2DEXT(bind_texture, target, level, format->internal_format, width, height, 0, format->format, format->type, pixels);
+        }
+    }
+    else
+    {
+        if (is_3d)
+        {
+            glTexImage3D(target, level, format->internal_format, width, height, depth, 0, format->format, format->type, pixels);
+        }
+        else
+        {
+            glTexImage2D(target, level, format->internal_format, width, height, 0, format->format, format->type, pixels);
+        }
+    }
+
+    transcode_unpack_leave(saved_unpack);
+    transcode_finish(buf, cache_path, format, width, height, depth);
+}
+
+void texture_transcode_sub_image(void *context, GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset,
+                                 GLsizei width, GLsizei height, GLsizei depth, bool is_3d, GLenum format,
+                                 const void *data, GLsizei image_size)
+{
+    Opengl_Context *opengl_context = (Opengl_Context *)context;
+    const Transcode_Format *transcode_format = find_transcode_format(format);
+
+    GLuint bind_texture = get_guest_binding_texture(context, target);
+    if (bind_texture == 0 || transcode_format == NULL)
+    {
+        LOGE("error! %s with texture %u target %x format %x", __FUNCTION__, bind_texture, target, format);
+        return;
+    }
+    if (data == NULL || width <= 0 || height <= 0 || depth <= 0)
+    {
+        return;
+    }
+
+    char *cache_path = NULL;
+    uint8_t *buf = transcode_get_pixels(transcode_format, width, height, depth, data, image_size, &cache_path);
+    if (buf == NULL)
+    {
+        return;
+    }
+    const void *pixels = buf + sizeof(Texture_Cache_Header);
+
+    GLint saved_unpack[6];
+    transcode_unpack_enter(opengl_context, saved_unpack);
+
+    if (DSA_LIKELY(host_opengl_version >= 45 && DSA_enable != 0))
+    {
+        if (is_3d)
+        {
+            glTextureSubImage3DEXT(bind_texture, target, level, xoffset, yoffset, zoffset, width, height, depth,
+                                   transcode_format->format, transcode_format->type, pixels);
+        }
+        else
+        {
+            glTextureSubImage2DEXT(bind_texture, target, level, xoffset, yoffset, width, height,
+                                   transcode_format->format, transcode_format->type, pixels);
+        }
+    }
+    else
+    {
+        if (is_3d)
+        {
+            glTexSubImage3D(target, level, xoffset, yoffset, zoffset, width, height, depth,
+                            transcode_format->format, transcode_format->type, pixels);
+        }
+        else
+        {
+            glTexSubImage2D(target, level, xoffset, yoffset, width, height,
+                            transcode_format->format, transcode_format->type, pixels);
+        }
+    }
+
+    transcode_unpack_leave(saved_unpack);
+    transcode_finish(buf, cache_path, transcode_format, width, height, depth);
+}
@@ -191,6 +191,7 @@ static Express_Device_Info express_keyboard_info = {
     .driver_name = "express_keyboard",
     .device_id = EXPRESS_KEYBOARD_DEVICE_ID,
     .device_type = INPUT_DEVICE_TYPE,
+    .irq_latency_budget_us = EXPRESS_IRQ_LATENCY_IMMEDIATE,
 
     .get_device_context = get_keyboard_context,
     .buffer_register = keyboard_buffer_register,
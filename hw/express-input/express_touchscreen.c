@@ -639,6 +639,7 @@ static Express_Device_Info express_touchscreen_info = {
     .driver_name = "express_touchscreen",
     .device_id = EXPRESS_TOUCHSCREEN_DEVICE_ID,
     .device_type = INPUT_DEVICE_TYPE,
+    .irq_latency_budget_us = EXPRESS_IRQ_LATENCY_IMMEDIATE,
 
     .get_device_context = get_touchscreen_context,
     .buffer_register = touchscreen_buffer_register,
@@ -13,6 +13,8 @@
 #include "hw/express-mem/express_sync.h"
 #include "hw/express-gpu/express_gpu_render.h"
 #include "hw/express-gpu/glv3_context.h"
+#include "hw/express-gpu/express_gpu_capture.h"
+#include "hw/express-gpu/gbuffer_reaper.h"
 
 #include "qemu/atomic.h"
 
@@ -595,6 +597,11 @@ void gbuffer_data_guest_to_host(Gralloc_Gbuffer_Info info, int sync_id)
         return;
     }
 
+    if (unlikely(express_gpu_capture_enable))
+    {
+        express_gpu_capture_gbuffer(gbuffer);
+    }
+
     mem_transfer_async(EXPRESS_MEM_TYPE_TEXTURE, EXPRESS_MEM_TYPE_GUEST_OPAQUE, gbuffer, gbuffer->guest_data, gbuffer->size, gbuffer->guest_data->all_len, sync_id, guest_to_host_dma_task, NULL, NULL);
 }
 
@@ -776,7 +783,8 @@ static void mem_master_switch(Thread_Context *context, Teleport_Express_Call *ca
             {
                 LOGI("terminate gbuffer id %llx", info.gbuffer_id);
                 remove_gbuffer_from_global_map(info.gbuffer_id);
-                destroy_gbuffer(gbuffer);
+                // 渲染线程可能还在使用，由主窗口线程等使用完后再释放
+                gbuffer_reaper_retire(gbuffer);
             }
         }
     }
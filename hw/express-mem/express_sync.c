@@ -186,6 +186,8 @@ static Express_Device_Info express_sync_info = {
     .driver_name = "express_sync",
     .device_id = EXPRESS_SYNC_DEVICE_ID,
     .device_type = INPUT_DEVICE_TYPE,
+    // guest端的fence等待直接依赖这个中断
+    .irq_latency_budget_us = EXPRESS_IRQ_LATENCY_IMMEDIATE,
 
     .get_device_context = get_sync_context,
     .buffer_register = sync_buffer_register,
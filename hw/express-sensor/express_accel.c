@@ -12,6 +12,7 @@
 // #define STD_DEBUG_LOG
 
 #include "hw/express-sensor/express_accel.h"
+#include "hw/express-sensor/express_sensor_fifo.h"
 
 typedef struct Express_Accel_Data
 {
@@ -73,6 +74,17 @@ void express_accel_status_changed(int status_type, int value)
 
 void sync_express_accel_status(void)
 {
+    // 共享FIFO启用时，事件经由FIFO批量上报，不再单独发送中断
+    if (static_accel_context.need_sync)
+    {
+        int values[3] = {static_accel_context.data.x, static_accel_context.data.y, static_accel_context.data.z};
+        if (express_sensor_fifo_push(EXPRESS_SENSOR_TYPE_ACCEL, values, 3))
+        {
+            static_accel_context.need_sync = false;
+            return;
+        }
+    }
+
     if (!static_accel_context.device_context.irq_enabled)
     {
         return;
@@ -188,6 +188,8 @@ static Express_Device_Info express_battery_info = {
     .driver_name = "express_battery",
     .device_id = EXPRESS_BATTERY_DEVICE_ID,
     .device_type = INPUT_DEVICE_TYPE,
+    // 电池状态对延迟不敏感
+    .irq_latency_budget_us = 100000,
 
     .get_device_context = get_battery_context,
     .buffer_register = battery_buffer_register,
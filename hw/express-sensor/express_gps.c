@@ -12,6 +12,7 @@
 // #define STD_DEBUG_LOG
 
 #include "hw/express-sensor/express_gps.h"
+#include "hw/express-sensor/express_sensor_fifo.h"
 
 typedef struct
 {
@@ -176,6 +177,23 @@ void express_gps_status_changed(int status_type, int value)
 
 void sync_express_gps_status(void)
 {
+    // 共享FIFO启用时，事件经由FIFO批量上报，不再单独发送中断
+    if (static_gps_context.need_sync)
+    {
+        int values[6] = {
+            static_gps_context.data.location.lat,
+            static_gps_context.data.location.lon,
+            static_gps_context.data.detail.altitude,
+            static_gps_context.data.detail.ground_speed,
+            static_gps_context.data.detail.speed_dir,
+            static_gps_context.data.status.numsats};
+        if (express_sensor_fifo_push(EXPRESS_SENSOR_TYPE_GPS, values, 6))
+        {
+            static_gps_context.need_sync = false;
+            return;
+        }
+    }
+
     if (!static_gps_context.device_context.irq_enabled)
     {
         return;
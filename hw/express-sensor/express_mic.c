@@ -19,9 +19,30 @@
 #define MA_NO_ENGINE
 #define MA_NO_GENERATION
 #include "hw/express-sensor/miniaudio.h"
+#include "hw/teleport-express/express_event.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
 #include <sys/time.h>
 
 #define MAX_AUDIO_BUFFER_SIZE 32768
+
+#define MIC_CHANNELS 2
+#define MIC_FRAME_SIZE (MIC_CHANNELS * sizeof(int16_t))
+
+// 采集回调和设备线程之间的单生产者单消费者环形缓冲区，大小必须是2的幂
+#define MIC_RING_FRAMES 16384
+
+int express_mic_period_ms = 10;
+int express_mic_sample_rate = 44100;
+
+typedef struct Mic_Ring
+{
+    int16_t buf[MIC_RING_FRAMES * MIC_CHANNELS];
+    // 读写位置都是不断递增的计数，write只由采集回调修改，read只由设备线程修改
+    uint32_t write_pos;
+    uint32_t read_pos;
+    uint32_t overrun_frames;
+} Mic_Ring;
 typedef struct Express_Mic_Data
 {
     char buf[MAX_AUDIO_BUFFER_SIZE];
@@ -41,6 +62,21 @@ typedef struct Mic_Context
     ma_device_config dev_config;
     bool from_file;
     bool need_sync;
+
+    Mic_Ring ring;
+    // 采集设备实际的采样率，以及每个周期需要从环形缓冲区取出的帧数
+    uint32_t capture_rate;
+    uint32_t period_frames;
+    ma_resampler resampler;
+    bool resampler_init;
+
+    QemuThread consumer_thread;
+    bool consumer_run;
+#ifdef _WIN32
+    HANDLE consumer_event;
+#else
+    void *consumer_event;
+#endif
 } Mic_Context;
 
 static Mic_Context static_mic_context = {
@@ -51,19 +87,191 @@ static Mic_Context static_mic_context = {
     .last_send_time.tv_usec = 0,
     .last_send_time.tv_sec = 0};
 
+/**
+ * @brief 在miniaudio的实时音频线程中调用，只做内存复制，不加锁、不访问guest内存、不注入中断
+ */
+static void mic_ring_write(const void *frames, uint32_t frame_count)
+{
+    Mic_Ring *ring = &static_mic_context.ring;
+    uint32_t write_pos = ring->write_pos;
+    uint32_t read_pos = qatomic_load_acquire(&ring->read_pos);
+    uint32_t space = MIC_RING_FRAMES - (write_pos - read_pos);
+
+    if (frame_count > space)
+    {
+        // 设备线程来不及消费，丢弃放不下的部分
+        qatomic_add(&ring->overrun_frames, frame_count - space);
+        frame_count = space;
+    }
+
+    uint32_t start = write_pos & (MIC_RING_FRAMES - 1);
+    uint32_t first = MIN(frame_count, MIC_RING_FRAMES - start);
+    memcpy(ring->buf + start * MIC_CHANNELS, frames, first * MIC_FRAME_SIZE);
+    memcpy(ring->buf, (const int16_t *)frames + first * MIC_CHANNELS, (frame_count - first) * MIC_FRAME_SIZE);
+
+    qatomic_store_release(&ring->write_pos, write_pos + frame_count);
+
+    if (write_pos + frame_count - read_pos >= static_mic_context.period_frames)
+    {
+#ifdef _WIN32
+        SetEvent(static_mic_context.consumer_event);
+#else
+        set_event(static_mic_context.consumer_event);
+#endif
+    }
+}
+
+static uint32_t mic_ring_read(void *frames, uint32_t frame_count)
+{
+    Mic_Ring *ring = &static_mic_context.ring;
+    uint32_t read_pos = ring->read_pos;
+    uint32_t write_pos = qatomic_load_acquire(&ring->write_pos);
+
+    frame_count = MIN(frame_count, write_pos - read_pos);
+
+    uint32_t start = read_pos & (MIC_RING_FRAMES - 1);
+    uint32_t first = MIN(frame_count, MIC_RING_FRAMES - start);
+    memcpy(frames, ring->buf + start * MIC_CHANNELS, first * MIC_FRAME_SIZE);
+    memcpy((int16_t *)frames + first * MIC_CHANNELS, ring->buf, (frame_count - first) * MIC_FRAME_SIZE);
+
+    qatomic_store_release(&ring->read_pos, read_pos + frame_count);
+    return frame_count;
+}
+
+static uint32_t mic_ring_available(void)
+{
+    return qatomic_load_acquire(&static_mic_context.ring.write_pos) - static_mic_context.ring.read_pos;
+}
+
+/**
+ * @brief 设备线程，从环形缓冲区按周期取出数据，转换到guest端的采样率后写入guest内存并注入中断
+ */
+static void *mic_consumer_thread(void *opaque)
+{
+    Mic_Context *context = opaque;
+    int16_t in_buf[MAX_AUDIO_BUFFER_SIZE / sizeof(int16_t)];
+    int16_t out_buf[MAX_AUDIO_BUFFER_SIZE / sizeof(int16_t)];
+    uint32_t max_out_frames = MAX_AUDIO_BUFFER_SIZE / MIC_FRAME_SIZE;
+
+    while (qatomic_read(&context->consumer_run) && !teleport_express_should_stop)
+    {
+#ifdef _WIN32
+        WaitForSingleObject(context->consumer_event, express_mic_period_ms * 2);
+#else
+        wait_event(context->consumer_event, express_mic_period_ms * 2);
+#endif
+        while (mic_ring_available() >= context->period_frames)
+        {
+            uint32_t in_frames = mic_ring_read(in_buf, context->period_frames);
+            uint32_t out_frames = in_frames;
+            const void *out_data = in_buf;
+
+            if (context->resampler_init)
+            {
+                ma_uint64 frame_count_in = in_frames;
+                ma_uint64 frame_count_out = max_out_frames;
+                ma_resampler_process_pcm_frames(&context->resampler, in_buf, &frame_count_in, out_buf, &frame_count_out);
+                out_frames = (uint32_t)frame_count_out;
+                out_data = out_buf;
+            }
+
+            if (out_frames == 0)
+            {
+                continue;
+            }
+            express_mic_status_changed(out_data, out_frames * MIC_FRAME_SIZE);
+            sync_express_mic_status();
+        }
+    }
+
+    if (context->ring.overrun_frames != 0)
+    {
+        LOGW("mic ring overrun %u frames", context->ring.overrun_frames);
+    }
+    return NULL;
+}
+
+/**
+ * @brief 在采集设备初始化完成、知道实际采样率后启动设备线程
+ */
+static int mic_consumer_start(uint32_t capture_rate)
+{
+    Mic_Context *context = &static_mic_context;
+    uint32_t out_rate = express_mic_sample_rate > 0 ? express_mic_sample_rate : capture_rate;
+
+    context->capture_rate = capture_rate;
+    context->period_frames = capture_rate * MAX(express_mic_period_ms, 1) / 1000;
+    // 一个周期的输入要能放进设备线程的输入缓冲区，转换后的数据要能放进输出缓冲区，两者都按输入帧数计算
+    uint32_t max_in_period = MAX_AUDIO_BUFFER_SIZE / MIC_FRAME_SIZE;
+    uint32_t max_out_period = (uint32_t)((uint64_t)(MAX_AUDIO_BUFFER_SIZE / MIC_FRAME_SIZE) * capture_rate / out_rate) - 1;
+    uint32_t max_period = MIN(max_in_period, max_out_period);
+    context->period_frames = MAX(MIN(context->period_frames, max_period), 1);
+
+    context->ring.write_pos = 0;
+    context->ring.read_pos = 0;
+    context->ring.overrun_frames = 0;
+
+    context->resampler_init = false;
+    if (capture_rate != out_rate)
+    {
+        ma_resampler_config config = ma_resampler_config_init(ma_format_s16, MIC_CHANNELS, capture_rate, out_rate, ma_resample_algorithm_linear);
+        if (ma_resampler_init(&config, NULL, &context->resampler) != MA_SUCCESS)
+        {
+            LOGE("Failed to initialize mic resampler %u -> %u.", capture_rate, out_rate);
+            return -1;
+        }
+        context->resampler_init = true;
+    }
+
+    if (context->consumer_event == NULL)
+    {
+#ifdef _WIN32
+        context->consumer_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+#else
+        context->consumer_event = create_event(0, 0);
+#endif
+    }
+
+    LOGI("mic capture rate %u guest rate %u period %u frames", capture_rate, out_rate, context->period_frames);
+
+    qatomic_set(&context->consumer_run, true);
+    qemu_thread_create(&context->consumer_thread, "express-mic", mic_consumer_thread, context, QEMU_THREAD_JOINABLE);
+    return 0;
+}
+
+static void mic_consumer_stop(void)
+{
+    Mic_Context *context = &static_mic_context;
+
+    if (!qatomic_read(&context->consumer_run))
+    {
+        return;
+    }
+    qatomic_set(&context->consumer_run, false);
+#ifdef _WIN32
+    SetEvent(context->consumer_event);
+#else
+    set_event(context->consumer_event);
+#endif
+    qemu_thread_join(&context->consumer_thread);
+
+    if (context->resampler_init)
+    {
+        ma_resampler_uninit(&context->resampler, NULL);
+        context->resampler_init = false;
+    }
+}
+
 static void data_callback_from_file(ma_device *pDevice, void *pOutput, const void *pInput, ma_uint32 frameCount)
 {
     ma_decoder_read_pcm_frames(&static_mic_context.decoder, pOutput, frameCount, NULL);
-    express_mic_status_changed(pOutput, frameCount * 2 * 2);
-    sync_express_mic_status();
-    (void)pOutput;
+    mic_ring_write(pOutput, frameCount);
     (void)pInput;
 }
 
 static void data_callback(ma_device *pDevice, void *pOutput, const void *pInput, ma_uint32 frameCount)
 {
-    express_mic_status_changed(pInput, frameCount * 2 * 2);
-    sync_express_mic_status();
+    mic_ring_write(pInput, frameCount);
     (void)pOutput;
 }
 
@@ -92,10 +300,18 @@ int start_capture_from_file(char *path)
         return -2;
     }
 
+    if (mic_consumer_start(static_mic_context.dev.sampleRate) != 0)
+    {
+        ma_device_uninit(&static_mic_context.dev);
+        ma_decoder_uninit(&static_mic_context.decoder);
+        return -2;
+    }
+
     result = ma_device_start(&static_mic_context.dev);
     if (result != MA_SUCCESS)
     {
         ma_device_uninit(&static_mic_context.dev);
+        mic_consumer_stop();
         ma_decoder_uninit(&static_mic_context.decoder);
         LOGE("Failed to start device.");
         return -3;
@@ -109,8 +325,9 @@ int start_capture(void)
     ma_result result;
     static_mic_context.dev_config = ma_device_config_init(ma_device_type_capture);
     static_mic_context.dev_config.capture.format = ma_format_s16;
-    static_mic_context.dev_config.capture.channels = 2;
-    static_mic_context.dev_config.sampleRate = 44100;
+    static_mic_context.dev_config.capture.channels = MIC_CHANNELS;
+    // 使用设备原生采样率，避免在实时音频线程中做重采样，重采样放到设备线程中进行
+    static_mic_context.dev_config.sampleRate = 0;
     static_mic_context.dev_config.dataCallback = data_callback;
 
     result = ma_device_init(NULL, &static_mic_context.dev_config, &static_mic_context.dev);
@@ -120,10 +337,17 @@ int start_capture(void)
         return -2;
     }
 
+    if (mic_consumer_start(static_mic_context.dev.sampleRate) != 0)
+    {
+        ma_device_uninit(&static_mic_context.dev);
+        return -2;
+    }
+
     result = ma_device_start(&static_mic_context.dev);
     if (result != MA_SUCCESS)
     {
         ma_device_uninit(&static_mic_context.dev);
+        mic_consumer_stop();
         LOGE("Failed to start device.");
         return -3;
     }
@@ -133,7 +357,9 @@ int start_capture(void)
 
 void stop_capture(void)
 {
+    // 先停止采集回调，再停止设备线程
     ma_device_uninit(&static_mic_context.dev);
+    mic_consumer_stop();
     if (static_mic_context.from_file)
     {
         ma_decoder_uninit(&static_mic_context.decoder);
@@ -0,0 +1,327 @@
+/**
+ * @file express_sensor_fifo.c
+ * @brief accel/gyro/gps共用的传感器事件FIFO，支持Android sensor HAL的batch语义，一批事件只发送一次中断
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+// #define STD_DEBUG_LOG
+
+#include "hw/express-sensor/express_sensor_fifo.h"
+#include "hw/teleport-express/express_event.h"
+#include "qemu/timer.h"
+#include "qemu/thread.h"
+
+// FIFO中待上报事件超过容量的一半时，不再等待max_report_latency，直接上报
+#define SENSOR_FIFO_WATERMARK_DIV 2
+
+#define SENSOR_FIFO_NO_DEADLINE INT64_MAX
+
+typedef struct Sensor_Fifo_Context
+{
+    Device_Context device_context;
+    Guest_Mem *guest_buffer;
+
+    QemuMutex lock;
+    bool lock_init;
+
+    uint32_t capacity;
+    // host端维护的写位置，以及上一次中断发出时的写位置
+    uint32_t write_index;
+    uint32_t flushed_index;
+    uint32_t dropped;
+
+    // 待上报事件中最早需要上报的时间点
+    int64_t flush_deadline_ns;
+
+    // 每个传感器最近一次写入的事件，用于在采样周期内合并事件
+    bool last_event_valid[EXPRESS_SENSOR_TYPE_NUM];
+    uint32_t last_event_index[EXPRESS_SENSOR_TYPE_NUM];
+    int64_t last_event_ns[EXPRESS_SENSOR_TYPE_NUM];
+
+    QemuThread flush_thread;
+    bool flush_thread_run;
+#ifdef _WIN32
+    HANDLE flush_event;
+#else
+    void *flush_event;
+#endif
+} Sensor_Fifo_Context;
+
+static Sensor_Fifo_Context static_sensor_fifo_context = {
+    .flush_deadline_ns = SENSOR_FIFO_NO_DEADLINE,
+};
+
+static void sensor_fifo_write_header_u32(size_t offset, uint32_t value)
+{
+    write_to_guest_mem(static_sensor_fifo_context.guest_buffer, &value, offset, sizeof(uint32_t));
+}
+
+/**
+ * @brief 把write_index到flushed_index之间的事件通知给guest，需要持有锁
+ */
+static void sensor_fifo_flush_locked(void)
+{
+    Sensor_Fifo_Context *context = &static_sensor_fifo_context;
+
+    if (context->guest_buffer == NULL || context->write_index == context->flushed_index)
+    {
+        context->flush_deadline_ns = SENSOR_FIFO_NO_DEADLINE;
+        return;
+    }
+
+    int64_t now = get_clock();
+    write_to_guest_mem(context->guest_buffer, &now, offsetof(Express_Sensor_Fifo_Header, flush_timestamp_ns), sizeof(int64_t));
+
+    uint32_t count = context->write_index - context->flushed_index;
+    int ret = set_express_device_irq((Device_Context *)context, context->flushed_index % context->capacity, count);
+    if (ret == IRQ_SET_OK)
+    {
+        express_printf("sensor fifo flush %u events\n", count);
+        context->flushed_index = context->write_index;
+    }
+    // 中断尚未被guest重新注册时保留待上报事件，在irq_register回调中再次flush，flush线程不需要反复重试
+    context->flush_deadline_ns = SENSOR_FIFO_NO_DEADLINE;
+}
+
+void express_sensor_fifo_flush(void)
+{
+    if (!static_sensor_fifo_context.lock_init)
+    {
+        return;
+    }
+    qemu_mutex_lock(&static_sensor_fifo_context.lock);
+    sensor_fifo_flush_locked();
+    qemu_mutex_unlock(&static_sensor_fifo_context.lock);
+}
+
+bool express_sensor_fifo_push(int sensor_type, const int *values, int value_num)
+{
+    Sensor_Fifo_Context *context = &static_sensor_fifo_context;
+
+    if (!context->device_context.irq_enabled || context->guest_buffer == NULL || !context->lock_init)
+    {
+        return false;
+    }
+
+    if (sensor_type < 0 || sensor_type >= EXPRESS_SENSOR_TYPE_NUM)
+    {
+        return false;
+    }
+
+    if (value_num > EXPRESS_SENSOR_EVENT_MAX_VALUES)
+    {
+        value_num = EXPRESS_SENSOR_EVENT_MAX_VALUES;
+    }
+
+    qemu_mutex_lock(&context->lock);
+
+    if (context->guest_buffer == NULL)
+    {
+        qemu_mutex_unlock(&context->lock);
+        return false;
+    }
+
+    Express_Sensor_Batch_Config config;
+    read_from_guest_mem(context->guest_buffer, &config, offsetof(Express_Sensor_Fifo_Header, config) + sensor_type * sizeof(Express_Sensor_Batch_Config), sizeof(Express_Sensor_Batch_Config));
+
+    if (!config.enable)
+    {
+        // guest端的HAL关闭了这个传感器，事件直接丢弃
+        qemu_mutex_unlock(&context->lock);
+        return true;
+    }
+
+    Express_Sensor_Event event;
+    memset(&event, 0, sizeof(Express_Sensor_Event));
+    event.sensor_type = sensor_type;
+    event.value_num = value_num;
+    event.timestamp_ns = get_clock();
+    memcpy(event.values, values, sizeof(int) * value_num);
+
+    uint32_t event_index;
+    if (context->last_event_valid[sensor_type] &&
+        (int32_t)(context->last_event_index[sensor_type] - context->flushed_index) >= 0 &&
+        event.timestamp_ns - context->last_event_ns[sensor_type] < config.sampling_period_ns)
+    {
+        // 还在同一个采样周期内，且上一个事件还没有上报，直接用最新的值覆盖
+        event_index = context->last_event_index[sensor_type];
+        event.timestamp_ns = context->last_event_ns[sensor_type];
+    }
+    else
+    {
+        uint32_t read_index = 0;
+        read_from_guest_mem(context->guest_buffer, &read_index, offsetof(Express_Sensor_Fifo_Header, read_index), sizeof(uint32_t));
+        if (context->write_index - read_index >= context->capacity)
+        {
+            // guest端来不及读取，FIFO已满，丢弃新事件并尽快通知guest
+            context->dropped++;
+            sensor_fifo_write_header_u32(offsetof(Express_Sensor_Fifo_Header, dropped), context->dropped);
+            sensor_fifo_flush_locked();
+            qemu_mutex_unlock(&context->lock);
+            return true;
+        }
+
+        event_index = context->write_index;
+        context->write_index++;
+        context->last_event_valid[sensor_type] = true;
+        context->last_event_index[sensor_type] = event_index;
+        context->last_event_ns[sensor_type] = event.timestamp_ns;
+    }
+
+    write_to_guest_mem(context->guest_buffer, &event,
+                       sizeof(Express_Sensor_Fifo_Header) + (event_index % context->capacity) * sizeof(Express_Sensor_Event),
+                       sizeof(Express_Sensor_Event));
+    sensor_fifo_write_header_u32(offsetof(Express_Sensor_Fifo_Header, write_index), context->write_index);
+
+    int64_t deadline = event.timestamp_ns + MAX(config.max_report_latency_ns, 0);
+    if (deadline < context->flush_deadline_ns)
+    {
+        context->flush_deadline_ns = deadline;
+    }
+
+    if (config.max_report_latency_ns <= 0 ||
+        context->write_index - context->flushed_index >= context->capacity / SENSOR_FIFO_WATERMARK_DIV)
+    {
+        sensor_fifo_flush_locked();
+        qemu_mutex_unlock(&context->lock);
+        return true;
+    }
+
+    qemu_mutex_unlock(&context->lock);
+
+    // 让flush线程按照新的deadline重新计算休眠时间
+#ifdef _WIN32
+    SetEvent(context->flush_event);
+#else
+    set_event(context->flush_event);
+#endif
+
+    return true;
+}
+
+/**
+ * @brief flush线程，负责在max_report_latency到期时上报积攒的事件
+ */
+static void *sensor_fifo_flush_thread(void *opaque)
+{
+    Sensor_Fifo_Context *context = opaque;
+
+    while (!teleport_express_should_stop)
+    {
+        qemu_mutex_lock(&context->lock);
+        int64_t deadline = context->flush_deadline_ns;
+        qemu_mutex_unlock(&context->lock);
+
+        long wait_ms = 0xffffffff;
+        if (deadline != SENSOR_FIFO_NO_DEADLINE)
+        {
+            int64_t remain_ns = deadline - get_clock();
+            if (remain_ns <= 0)
+            {
+                express_sensor_fifo_flush();
+                continue;
+            }
+            wait_ms = (long)((remain_ns + 999999) / 1000000);
+        }
+
+#ifdef _WIN32
+        WaitForSingleObject(context->flush_event, (DWORD)wait_ms);
+#else
+        wait_event(context->flush_event, wait_ms);
+#endif
+    }
+
+    return NULL;
+}
+
+static void sensor_fifo_buffer_register(Guest_Mem *data, uint64_t thread_id, uint64_t process_id, uint64_t unique_id)
+{
+    Sensor_Fifo_Context *context = &static_sensor_fifo_context;
+
+    if (data == NULL || data->all_len < sizeof(Express_Sensor_Fifo_Header) + sizeof(Express_Sensor_Event))
+    {
+        LOGE("sensor fifo register buffer too small %d", data == NULL ? 0 : data->all_len);
+        free_copied_guest_mem(data);
+        return;
+    }
+
+    if (!context->lock_init)
+    {
+        qemu_mutex_init(&context->lock);
+        context->lock_init = true;
+    }
+
+    qemu_mutex_lock(&context->lock);
+
+    if (context->guest_buffer != NULL)
+    {
+        free_copied_guest_mem(context->guest_buffer);
+    }
+    context->guest_buffer = data;
+    context->capacity = (data->all_len - sizeof(Express_Sensor_Fifo_Header)) / sizeof(Express_Sensor_Event);
+    context->write_index = 0;
+    context->flushed_index = 0;
+    context->dropped = 0;
+    context->flush_deadline_ns = SENSOR_FIFO_NO_DEADLINE;
+    memset(context->last_event_valid, 0, sizeof(context->last_event_valid));
+
+    // config部分由guest端写入，这里只初始化host负责的部分
+    Express_Sensor_Fifo_Header header;
+    read_from_guest_mem(data, &header, 0, sizeof(Express_Sensor_Fifo_Header));
+    header.magic = EXPRESS_SENSOR_FIFO_MAGIC;
+    header.version = EXPRESS_SENSOR_FIFO_VERSION;
+    header.capacity = context->capacity;
+    header.event_size = sizeof(Express_Sensor_Event);
+    header.write_index = 0;
+    header.read_index = 0;
+    header.dropped = 0;
+    header.flush_timestamp_ns = get_clock();
+    write_to_guest_mem(data, &header, 0, offsetof(Express_Sensor_Fifo_Header, config));
+
+    qemu_mutex_unlock(&context->lock);
+
+    LOGI("sensor fifo register buffer capacity %u", context->capacity);
+
+    if (!context->flush_thread_run)
+    {
+#ifdef _WIN32
+        context->flush_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+#else
+        context->flush_event = create_event(0, 0);
+#endif
+        context->flush_thread_run = true;
+        qemu_thread_create(&context->flush_thread, "express-sensor-fifo", sensor_fifo_flush_thread,
+                           context, QEMU_THREAD_DETACHED);
+    }
+}
+
+static void sensor_fifo_irq_register(Device_Context *context)
+{
+    // guest处理完上一批事件后重新注册中断，这时把期间积攒的事件继续发出去
+    express_sensor_fifo_flush();
+}
+
+static Device_Context *get_sensor_fifo_context(uint64_t device_id, uint64_t thread_id, uint64_t process_id, uint64_t unique_id, struct Express_Device_Info *info)
+{
+    return (Device_Context *)&static_sensor_fifo_context;
+}
+
+static Express_Device_Info express_sensor_fifo_info = {
+    .enable_default = false,
+    .name = "express-sensor-fifo",
+    .option_name = "sensor_fifo",
+    .driver_name = "express_sensor_fifo",
+    .device_id = EXPRESS_SENSOR_FIFO_DEVICE_ID,
+    .device_type = INPUT_DEVICE_TYPE,
+
+    .get_device_context = get_sensor_fifo_context,
+    .buffer_register = sensor_fifo_buffer_register,
+    .irq_register = sensor_fifo_irq_register,
+
+};
+
+EXPRESS_DEVICE_INIT(express_sensor_fifo, &express_sensor_fifo_info)
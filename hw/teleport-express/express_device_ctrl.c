@@ -256,6 +256,7 @@ int create_call_from_cluster(uint64_t *send_buf, unsigned char *save_buf, Telepo
         pre_guest_mem[i].scatter_data = &(pre_scatter_data[i]);
         pre_guest_mem[i].num = 1;
         pre_guest_mem[i].all_len = pre_scatter_data[i].len;
+        pre_guest_mem[i].metrics = NULL;
 
         pre_elem[i + 1].para = &(pre_guest_mem[i]);
         pre_elem[i + 1].len = send_buf[i * 2 + 2];
@@ -1,5 +1,4 @@
-#define STD_DEBUG_LOG
-#define STD_DEBUG_LOG_GLOBAL_ON
+// #define STD_DEBUG_LOG
 
 #include "hw/teleport-express/express_log.h"
 #include "hw/teleport-express/express_event.h"
@@ -13,6 +12,43 @@
 #include <errno.h>  
 #endif
 
+#ifdef CONFIG_LINUX
+#include "qemu/atomic.h"
+#include "qemu/futex.h"
+
+/**
+ * @brief 以不会随realtime时钟跳变的CLOCK_MONOTONIC计算超时的绝对时间
+ *
+ * @param milliseconds 超时时长
+ * @param deadline 输出的绝对时间
+ */
+static void event_deadline_monotonic(long milliseconds, struct timespec *deadline)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += milliseconds / 1000;
+    deadline->tv_nsec += (milliseconds % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000)
+    {
+        deadline->tv_sec += 1;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+/**
+ * @brief 不进入内核尝试获取信号，自动重置的事件获取成功时同时重置信号
+ *
+ * @return int 1表示获取到了信号
+ */
+static int event_try_acquire(POSIX_HANDLE pevent)
+{
+    if (pevent->manual_reset)
+    {
+        return qatomic_load_acquire(&pevent->signal_state) == 1;
+    }
+    return qatomic_cmpxchg(&pevent->signal_state, 1, 0) == 1;
+}
+#endif
+
 /**
  * @brief 创建一个事件
  * 
@@ -29,7 +65,8 @@ void *create_event(int manual_reset, int initial_state) {
     if (event == NULL) return NULL;
     memset(event, 0, HANDLE_SIZE);
     event->manual_reset = manual_reset;
-    event->signal_state = initial_state;
+    event->signal_state = initial_state ? 1 : 0;
+#ifndef CONFIG_LINUX
     if (pthread_mutex_init(&event->event_lock, NULL)) {
         free(event);
         return NULL;
@@ -38,6 +75,7 @@ void *create_event(int manual_reset, int initial_state) {
         free(event);
         return NULL;
     }
+#endif
 #endif
     return event;
 }
@@ -46,7 +84,7 @@ void *create_event(int manual_reset, int initial_state) {
  * @brief 阻塞等待事件
  * 
  * @param event 事件句柄
- * @param milliseconds 超时时长
+ * @param milliseconds 超时时长，EXPRESS_EVENT_INFINITE表示一直等待
  * @return int 0成功等待，1超时，-1出错
  */
 int wait_event(void *event, long milliseconds) {
@@ -57,6 +95,43 @@ int wait_event(void *event, long milliseconds) {
     else if (ret == WAIT_TIMEOUT) 
         return 1;
     return -1;
+#elif defined(CONFIG_LINUX)
+    POSIX_HANDLE pevent = (POSIX_HANDLE) event;
+    struct timespec deadline;
+
+    // 已经有信号时完全不进入内核
+    if (event_try_acquire(pevent)) {
+        return 0;
+    }
+    if (milliseconds == 0) {
+        return 1;
+    }
+
+    bool infinite = (unsigned long)milliseconds >= EXPRESS_EVENT_INFINITE;
+    if (!infinite) {
+        event_deadline_monotonic(milliseconds, &deadline);
+    }
+
+    while (1) {
+        qatomic_inc(&pevent->waiters);
+        // FUTEX_WAIT_BITSET的超时是CLOCK_MONOTONIC的绝对时间，被提前唤醒后重新等待也不会延长总的超时
+        long ret = qemu_futex(&pevent->signal_state, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, 0,
+                              infinite ? NULL : &deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+        int err = errno;
+        qatomic_dec(&pevent->waiters);
+
+        if (event_try_acquire(pevent)) {
+            return 0;
+        }
+        if (ret != 0) {
+            if (err == ETIMEDOUT) {
+                return 1;
+            }
+            if (err != EAGAIN && err != EINTR) {
+                return -1;
+            }
+        }
+    }
 #else
     POSIX_HANDLE pevent = (POSIX_HANDLE) event;
     struct timespec target_time;
@@ -65,6 +140,10 @@ int wait_event(void *event, long milliseconds) {
     gettimeofday(&current_time, NULL);
     target_time.tv_sec = current_time.tv_sec + milliseconds / 1000;
     target_time.tv_nsec = current_time.tv_usec * 1000 + (milliseconds % 1000) * 1000000;
+    if (target_time.tv_nsec >= 1000000000) {
+        target_time.tv_sec += 1;
+        target_time.tv_nsec -= 1000000000;
+    }
 
     if (pthread_mutex_lock(&pevent->event_lock)) {
         //printf("lock failed\n");
@@ -91,7 +170,7 @@ int wait_event(void *event, long milliseconds) {
         return -1;
     }
         
-    return 0;
+    return timeout == ETIMEDOUT ? 1 : 0;
 #endif
 }
 
@@ -105,6 +184,15 @@ int set_event(void *event) {
     //express_printf("Set Event\n");
 #ifdef _WIN32
     return SetEvent(event) ? 0 : -1;
+#elif defined(CONFIG_LINUX)
+    POSIX_HANDLE pevent = (POSIX_HANDLE) event;
+    // 已经处于有信号状态，或者没有线程在等待时，只需要一次原子操作
+    if (qatomic_xchg(&pevent->signal_state, 1) == 0 && qatomic_read(&pevent->waiters) != 0) {
+        // 等待方用的是私有futex，唤醒也必须带FUTEX_PRIVATE_FLAG，否则内核按共享futex查找，唤醒不到等待者
+        qemu_futex(&pevent->signal_state, FUTEX_WAKE_BITSET | FUTEX_PRIVATE_FLAG,
+                   pevent->manual_reset ? INT_MAX : 1, NULL, NULL, FUTEX_BITSET_MATCH_ANY);
+    }
+    return 0;
 #else
     POSIX_HANDLE pevent = (POSIX_HANDLE) event;
     if (pthread_mutex_lock(&pevent->event_lock)) {
@@ -142,6 +230,9 @@ int reset_event(void *event) {
     //express_printf("Set Event\n");
 #ifdef _WIN32
     return ResetEvent(event) ? 0 : -1;
+#elif defined(CONFIG_LINUX)
+    qatomic_set(&((POSIX_HANDLE) event)->signal_state, 0);
+    return 0;
 #else
     POSIX_HANDLE pevent = (POSIX_HANDLE) event;
     if (pthread_mutex_lock(&pevent->event_lock)) {
@@ -180,8 +271,10 @@ void delete_event(void *event) {
     CloseHandle(event);
 #else
     POSIX_HANDLE pevent = (POSIX_HANDLE) event;
+#ifndef CONFIG_LINUX
     pthread_mutex_destroy(&pevent->event_lock);
     pthread_cond_destroy(&pevent->event_cond);
+#endif
     free(pevent);
 #endif
 }
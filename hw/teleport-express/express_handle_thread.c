@@ -15,6 +15,11 @@
 #include "hw/teleport-express/express_handle_thread.h"
 #include "hw/teleport-express/teleport_express_call.h"
 #include "hw/teleport-express/express_event.h"
+#include "hw/teleport-express/express_metrics.h"
+#include "qemu/timer.h"
+#include "qemu/atomic.h"
+
+void (*express_call_capture_hook)(Teleport_Express_Call *call) = NULL;
 
 /**
  * @brief 从context的环形缓冲区中pop出一个call，若没有call，则会阻塞直到下一个call到达，这个只在thread运行函数中使用
@@ -79,6 +84,10 @@ Teleport_Express_Call *call_pop(Thread_Context *context)
  */
 void call_push(Thread_Context *context, Teleport_Express_Call *call)
 {
+    if ((context->write_loc + 1) % CALL_BUF_SIZE == context->read_loc)
+    {
+        express_metrics_ring_full(call);
+    }
     while ((context->write_loc + 1) % CALL_BUF_SIZE == context->read_loc)
     {
 //缓冲区为满
@@ -101,6 +110,7 @@ void call_push(Thread_Context *context, Teleport_Express_Call *call)
         printf("error push find not null\n");
     }
     //LOGI("pushing call event id %d",call->id);
+    call->queue_time = get_clock();
     context->call_buf[context->write_loc] = call;
 
     context->write_loc = (context->write_loc + 1) % CALL_BUF_SIZE;
@@ -152,6 +162,11 @@ void *handle_thread_run(void *opaque)
             continue;
         }
 
+        if (unlikely(express_call_capture_hook != NULL))
+        {
+            express_call_capture_hook(call);
+        }
+
         if (call->is_end)
         {
             express_printf("thread context %llx call end thread_id %lld process_id %lld\n", (uint64_t)context, call->thread_id, call->process_id);
@@ -164,7 +179,14 @@ void *handle_thread_run(void *opaque)
         if (context->call_handle != NULL)
         {
             express_printf("handle thread call handle\n");
+            //call_handle中可能已经回收了call，所以需要提前取出统计用到的信息
+            Express_Call_Metrics *metrics = express_metrics_get(call->id);
+            int64_t start_time = get_clock();
+            int64_t queue_wait = start_time - call->queue_time;
+
             context->call_handle(context, call);
+
+            express_metrics_call_handled(metrics, queue_wait, get_clock() - start_time);
         }
     }
 
@@ -182,6 +204,12 @@ void *handle_thread_run(void *opaque)
         context->context_destroy(context);
     }
 
+    Express_Device_Info *info = get_express_device_info(context->device_id);
+    if (info != NULL)
+    {
+        qatomic_dec(&info->live_context_num);
+    }
+
     express_printf("handle thread exit %llu\n", context->thread_id);
     g_free(context);
     return NULL;
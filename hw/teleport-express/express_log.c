@@ -289,6 +289,8 @@ static Express_Device_Info express_log_info = {
     .context_init = log_init,
     .call_handle = call_printf,
     .get_context = get_log_thread_context,
+    // 日志context在下次调用时重新创建即可
+    .context_stateless = true,
 };
 
 EXPRESS_DEVICE_INIT(express_log, &express_log_info)
@@ -0,0 +1,279 @@
+/**
+ * @file express_metrics.c
+ * @brief 按device_id和fun_id统计transport的调用次数、传输量、排队与处理耗时，通过QMP/HMP查询与重置
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+// #define STD_DEBUG_LOG
+
+#include "hw/teleport-express/express_log.h"
+#include "hw/teleport-express/express_metrics.h"
+#include "hw/teleport-express/teleport_express_register.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "qapi/type-helpers.h"
+#include "monitor/hmp.h"
+#include "monitor/monitor.h"
+
+bool express_call_metrics_enable = true;
+
+// 每个设备的统计表在第一次用到时才分配，之后不再释放
+static Express_Call_Metrics *metrics_table[EXPRESS_METRICS_DEVICE_NUM];
+
+static Express_Call_Metrics *metrics_device_table(uint32_t device_id)
+{
+    if (device_id >= EXPRESS_METRICS_DEVICE_NUM)
+    {
+        return NULL;
+    }
+
+    Express_Call_Metrics *table = qatomic_load_acquire(&metrics_table[device_id]);
+    if (likely(table != NULL))
+    {
+        return table;
+    }
+
+    // 多出来的一个槽位固定给EXPRESS_METRICS_OTHER_FUN_ID用
+    table = g_new0(Express_Call_Metrics, EXPRESS_METRICS_FUN_SLOTS + 1);
+    table[EXPRESS_METRICS_FUN_SLOTS].key = EXPRESS_METRICS_OTHER_FUN_ID;
+    Express_Call_Metrics *old = qatomic_cmpxchg(&metrics_table[device_id], NULL, table);
+    if (old != NULL)
+    {
+        g_free(table);
+        return old;
+    }
+    return table;
+}
+
+/**
+ * @brief 获取call id对应的统计项，fun_id在表中以开放寻址的方式无锁插入
+ *
+ * @param call_id 包含device_id和fun_id的调用id
+ * @return Express_Call_Metrics* 统计未开启或device_id超出范围时返回NULL
+ */
+Express_Call_Metrics *express_metrics_get(uint64_t call_id)
+{
+    if (!express_call_metrics_enable)
+    {
+        return NULL;
+    }
+
+    Express_Call_Metrics *table = metrics_device_table(GET_DEVICE_ID(call_id));
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    uint32_t key = GET_FUN_ID(call_id) + 1;
+    uint32_t index = (key * 2654435761u) % EXPRESS_METRICS_FUN_SLOTS;
+    for (int i = 0; i < EXPRESS_METRICS_FUN_SLOTS; i++)
+    {
+        Express_Call_Metrics *metrics = &table[(index + i) % EXPRESS_METRICS_FUN_SLOTS];
+        uint32_t now_key = qatomic_read(&metrics->key);
+        if (now_key == 0)
+        {
+            now_key = qatomic_cmpxchg(&metrics->key, 0, key);
+            if (now_key == 0)
+            {
+                return metrics;
+            }
+        }
+        if (now_key == key)
+        {
+            return metrics;
+        }
+    }
+    return &table[EXPRESS_METRICS_FUN_SLOTS];
+}
+
+/**
+ * @brief 分发线程从virtqueue中取出一个call时调用，记录调用次数和guest传入的参数长度，
+ * 并把统计项挂到每个参数的Guest_Mem上，用于统计之后回写给guest的长度
+ */
+void express_metrics_call_received(Teleport_Express_Call *call)
+{
+    Express_Call_Metrics *metrics = express_metrics_get(call->id);
+    if (metrics == NULL)
+    {
+        return;
+    }
+
+    // 第一个elem是Teleport_Express_Flag_Buf，不算在参数里，guest可写的elem是回传用的，也不算
+    uint64_t len = 0;
+    for (Teleport_Express_Queue_Elem *elem = call->elem_header->next; elem != NULL; elem = elem->next)
+    {
+        if (elem->elem.out_num != 0)
+        {
+            len += elem->len;
+        }
+        ((Guest_Mem *)elem->para)->metrics = metrics;
+    }
+
+    stat64_add(&metrics->calls, 1);
+    stat64_add(&metrics->bytes_to_host, len);
+}
+
+void express_metrics_call_handled(Express_Call_Metrics *metrics, int64_t queue_wait_ns, int64_t handle_ns)
+{
+    if (metrics == NULL)
+    {
+        return;
+    }
+    if (queue_wait_ns >= 0)
+    {
+        stat64_add(&metrics->queue_wait_ns, queue_wait_ns);
+        stat64_max(&metrics->queue_wait_max_ns, queue_wait_ns);
+    }
+    stat64_add(&metrics->handle_ns, handle_ns);
+    stat64_max(&metrics->handle_max_ns, handle_ns);
+}
+
+void express_metrics_ring_full(Teleport_Express_Call *call)
+{
+    Express_Call_Metrics *metrics = express_metrics_get(call->id);
+    if (metrics != NULL)
+    {
+        stat64_add(&metrics->ring_full, 1);
+    }
+}
+
+void express_metrics_recycle_full(Teleport_Express_Call *call)
+{
+    Express_Call_Metrics *metrics = express_metrics_get(call->id);
+    if (metrics != NULL)
+    {
+        stat64_add(&metrics->recycle_full, 1);
+    }
+}
+
+/**
+ * @brief write_to_guest_mem时调用，metrics来自被写的Guest_Mem，所以在express-mem、输入设备等线程中回写也能记到对应的call上
+ */
+void express_metrics_guest_write(Express_Call_Metrics *metrics, size_t length)
+{
+    if (metrics != NULL)
+    {
+        stat64_add(&metrics->bytes_to_guest, length);
+    }
+}
+
+void express_metrics_reset(void)
+{
+    for (int i = 0; i < EXPRESS_METRICS_DEVICE_NUM; i++)
+    {
+        Express_Call_Metrics *table = qatomic_load_acquire(&metrics_table[i]);
+        if (table == NULL)
+        {
+            continue;
+        }
+        // 只清零计数，fun_id的槽位保留，这样并发的累加者不会写到已经被重新分配的槽位上
+        for (int j = 0; j <= EXPRESS_METRICS_FUN_SLOTS; j++)
+        {
+            Express_Call_Metrics *metrics = &table[j];
+            stat64_init(&metrics->calls, 0);
+            stat64_init(&metrics->bytes_to_host, 0);
+            stat64_init(&metrics->bytes_to_guest, 0);
+            stat64_init(&metrics->queue_wait_ns, 0);
+            stat64_init(&metrics->queue_wait_max_ns, 0);
+            stat64_init(&metrics->handle_ns, 0);
+            stat64_init(&metrics->handle_max_ns, 0);
+            stat64_init(&metrics->ring_full, 0);
+            stat64_init(&metrics->recycle_full, 0);
+        }
+    }
+
+    Express_Input_Irq_Stats stats;
+    express_input_irq_stats_get(&stats, true);
+}
+
+static const char *metrics_device_name(uint32_t device_id)
+{
+    if (device_id == EXPRESS_CTRL_DEVICE_ID)
+    {
+        return "express-ctrl";
+    }
+    Express_Device_Info *info = get_express_device_info(device_id);
+    return info != NULL ? info->name : "unknown";
+}
+
+HumanReadableText *qmp_x_query_teleport_express(Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+
+    if (!express_call_metrics_enable)
+    {
+        error_setg(errp, "teleport-express call metrics are disabled");
+        return NULL;
+    }
+
+    g_string_append_printf(buf, "%-22s %8s %10s %12s %12s %10s %10s %10s %10s %9s %9s\n",
+                           "device", "fun_id", "calls", "to_host", "to_guest",
+                           "wait_avg", "wait_max", "handle_avg", "handle_max",
+                           "ring_full", "recy_full");
+
+    for (uint32_t i = 0; i < EXPRESS_METRICS_DEVICE_NUM; i++)
+    {
+        Express_Call_Metrics *table = qatomic_load_acquire(&metrics_table[i]);
+        if (table == NULL)
+        {
+            continue;
+        }
+        for (int j = 0; j <= EXPRESS_METRICS_FUN_SLOTS; j++)
+        {
+            Express_Call_Metrics *metrics = &table[j];
+            uint32_t key = qatomic_read(&metrics->key);
+            uint64_t calls = stat64_get(&metrics->calls);
+            if (key == 0 || calls == 0)
+            {
+                continue;
+            }
+
+            char fun_id[16];
+            if (key == EXPRESS_METRICS_OTHER_FUN_ID)
+            {
+                snprintf(fun_id, sizeof(fun_id), "other");
+            }
+            else
+            {
+                snprintf(fun_id, sizeof(fun_id), "%u", key - 1);
+            }
+
+            // 耗时都以us为单位输出
+            g_string_append_printf(buf, "%-18s(%2u) %8s %10" PRIu64 " %12" PRIu64 " %12" PRIu64
+                                   " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+                                   " %9" PRIu64 " %9" PRIu64 "\n",
+                                   metrics_device_name(i), i, fun_id, calls,
+                                   stat64_get(&metrics->bytes_to_host),
+                                   stat64_get(&metrics->bytes_to_guest),
+                                   stat64_get(&metrics->queue_wait_ns) / calls / 1000,
+                                   stat64_get(&metrics->queue_wait_max_ns) / 1000,
+                                   stat64_get(&metrics->handle_ns) / calls / 1000,
+                                   stat64_get(&metrics->handle_max_ns) / 1000,
+                                   stat64_get(&metrics->ring_full),
+                                   stat64_get(&metrics->recycle_full));
+        }
+    }
+
+    Express_Input_Irq_Stats stats;
+    express_input_irq_stats_get(&stats, false);
+    g_string_append_printf(buf, "input irq: %.1f/s suppressed %" PRIu64 " calls %" PRIu64
+                           " batch latency avg %" PRId64 " us max %" PRId64 " us\n",
+                           stats.irq_per_second, stats.irq_suppressed, stats.call_count,
+                           stats.batch_latency_avg_ns / 1000, stats.batch_latency_max_ns / 1000);
+
+    return human_readable_text_from_str(buf);
+}
+
+void qmp_x_teleport_express_reset_stats(Error **errp)
+{
+    express_metrics_reset();
+}
+
+void hmp_teleport_express_reset_stats(Monitor *mon, const QDict *qdict)
+{
+    express_metrics_reset();
+}
@@ -0,0 +1,688 @@
+/**
+ * @file express_snapshot.c
+ * @brief teleport-express传输层的快照保存与恢复
+ *
+ * 快照流程：
+ *   1. 虚拟机停止时（vm change state回调，在保存内存之前）暂停传输层，等输出队列取出的call都还给guest，
+ *      把只取了一部分的call放回队列，再拿住输入队列的锁，把已经处理完的输入call都还给guest
+ *   2. 保存设备状态时，只剩下guest空指针、输入设备注册的缓冲区、设备持有的中断call以及设备自己的状态需要保存
+ *   3. 恢复后虚拟机开始运行时，按保存时的顺序重新注册缓冲区与中断call，然后重新开始处理队列
+ */
+// #define STD_DEBUG_LOG
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "exec/cpu-common.h"
+#include "exec/memory.h"
+#include "migration/qemu-file-types.h"
+#include "migration/vmstate.h"
+#include "sysemu/runstate.h"
+
+#include "hw/teleport-express/express_snapshot.h"
+#include "hw/teleport-express/teleport_express_call.h"
+#include "hw/teleport-express/teleport_express_distribute.h"
+#include "hw/teleport-express/teleport_express_register.h"
+
+#include "hw/teleport-express/express_log.h"
+
+// 等待已经取出的call处理完的最长时间
+#define EXPRESS_SNAPSHOT_DRAIN_TIMEOUT_US (3 * 1000 * 1000)
+
+// 设备状态列表的结束标记
+#define EXPRESS_SNAPSHOT_DEVICE_END UINT32_MAX
+
+int express_transport_paused = 0;
+
+typedef struct Snapshot_Buffer
+{
+    uint64_t device_id;
+    uint64_t thread_id;
+    uint64_t process_id;
+    uint64_t unique_id;
+    Guest_Mem *mem;
+} Snapshot_Buffer;
+
+typedef struct Snapshot_Irq_Call
+{
+    int num;
+    Teleport_Express_Queue_Elem **elems;
+} Snapshot_Irq_Call;
+
+static Teleport_Express *snapshot_device = NULL;
+
+// 以下三个只在主线程上访问
+static bool snapshot_quiesced = false;
+static bool snapshot_quiesce_failed = false;
+static bool snapshot_loaded = false;
+
+// 保护下面两个记录，注册缓冲区与中断的call可能在输入线程上，也可能在主线程上处理
+static GMutex snapshot_track_lock;
+
+// 纯输入设备注册的缓冲区，同一个设备context重复注册时只保留最后一次，元素为Snapshot_Buffer
+static GList *tracked_buffers = NULL;
+
+// 开启了中断的纯输入设备context集合
+static GHashTable *tracked_irq_contexts = NULL;
+
+// 从快照中读出来、等待虚拟机运行时重新注册的内容
+static GList *restored_buffers = NULL;
+static GList *restored_irq_calls = NULL;
+
+static bool device_is_pure_input(Express_Device_Info *info)
+{
+    return info != NULL && info->device_type == INPUT_DEVICE_TYPE;
+}
+
+static void snapshot_buffer_free(void *data)
+{
+    Snapshot_Buffer *buffer = data;
+
+    free_copied_guest_mem(buffer->mem);
+    g_free(buffer);
+}
+
+void express_snapshot_track_buffer(Teleport_Express_Call *call)
+{
+    uint64_t device_id = GET_DEVICE_ID(call->id);
+
+    if (!device_is_pure_input(get_express_device_info(device_id)))
+    {
+        // 有输出部分的设备的缓冲区由设备自己的pre_save保存
+        return;
+    }
+
+    Guest_Mem *mem = copy_guest_mem_from_call(call, 1);
+    if (mem == NULL)
+    {
+        return;
+    }
+
+    g_mutex_lock(&snapshot_track_lock);
+    GList *node = tracked_buffers;
+    for (; node != NULL; node = node->next)
+    {
+        Snapshot_Buffer *buffer = node->data;
+        if (buffer->device_id == device_id && buffer->thread_id == call->thread_id &&
+            buffer->process_id == call->process_id && buffer->unique_id == call->unique_id)
+        {
+            break;
+        }
+    }
+    if (node == NULL)
+    {
+        Snapshot_Buffer *buffer = g_new0(Snapshot_Buffer, 1);
+        buffer->device_id = device_id;
+        buffer->thread_id = call->thread_id;
+        buffer->process_id = call->process_id;
+        buffer->unique_id = call->unique_id;
+        buffer->mem = mem;
+        tracked_buffers = g_list_append(tracked_buffers, buffer);
+    }
+    else
+    {
+        Snapshot_Buffer *buffer = node->data;
+        free_copied_guest_mem(buffer->mem);
+        buffer->mem = mem;
+    }
+    g_mutex_unlock(&snapshot_track_lock);
+}
+
+void express_snapshot_track_irq(Device_Context *device_context)
+{
+    Express_Device_Info *info = device_context->device_info;
+
+    if (!device_is_pure_input(info))
+    {
+        // 没有办法替这类设备重建context，只能由设备自己保存，因此计入存活的context
+        qatomic_inc(&info->live_context_num);
+        return;
+    }
+
+    g_mutex_lock(&snapshot_track_lock);
+    if (tracked_irq_contexts == NULL)
+    {
+        tracked_irq_contexts = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+    g_hash_table_add(tracked_irq_contexts, device_context);
+    g_mutex_unlock(&snapshot_track_lock);
+}
+
+void express_snapshot_untrack_irq(Device_Context *device_context)
+{
+    Express_Device_Info *info = device_context->device_info;
+
+    if (!device_is_pure_input(info))
+    {
+        qatomic_dec(&info->live_context_num);
+        return;
+    }
+
+    g_mutex_lock(&snapshot_track_lock);
+    if (tracked_irq_contexts != NULL)
+    {
+        g_hash_table_remove(tracked_irq_contexts, device_context);
+    }
+    g_mutex_unlock(&snapshot_track_lock);
+}
+
+void express_snapshot_put_host_ptr(QEMUFile *f, void *ptr)
+{
+    ram_addr_t offset = 0;
+    RAMBlock *rb = NULL;
+
+    if (ptr != NULL)
+    {
+        rb = qemu_ram_block_from_host(ptr, false, &offset);
+    }
+
+    if (rb == NULL)
+    {
+        qemu_put_byte(f, 0);
+        return;
+    }
+
+    const char *idstr = qemu_ram_get_idstr(rb);
+    size_t len = strlen(idstr);
+
+    qemu_put_byte(f, len);
+    qemu_put_buffer(f, (const uint8_t *)idstr, len);
+    qemu_put_be64(f, offset);
+}
+
+void *express_snapshot_get_host_ptr(QEMUFile *f)
+{
+    char idstr[256];
+    int len = qemu_get_byte(f);
+
+    if (len == 0)
+    {
+        return NULL;
+    }
+
+    qemu_get_buffer(f, (uint8_t *)idstr, len);
+    idstr[len] = '\0';
+    uint64_t offset = qemu_get_be64(f);
+
+    RAMBlock *rb = qemu_ram_block_by_name(idstr);
+    if (rb == NULL || offset >= qemu_ram_get_used_length(rb))
+    {
+        LOGE("error! snapshot refers to unknown guest memory %s offset %" PRIx64, idstr, offset);
+        return NULL;
+    }
+
+    return qemu_map_ram_ptr(rb, offset);
+}
+
+void express_snapshot_put_guest_mem(QEMUFile *f, Guest_Mem *mem)
+{
+    qemu_put_be32(f, mem->num);
+    for (int i = 0; i < mem->num; i++)
+    {
+        express_snapshot_put_host_ptr(f, mem->scatter_data[i].data);
+        qemu_put_be64(f, mem->scatter_data[i].len);
+    }
+}
+
+Guest_Mem *express_snapshot_get_guest_mem(QEMUFile *f)
+{
+    int num = qemu_get_be32(f);
+    bool broken = false;
+
+    if (num < 0 || num > VIRTQUEUE_MAX_SIZE)
+    {
+        LOGE("error! snapshot guest mem has %d pieces", num);
+        return NULL;
+    }
+
+    Guest_Mem *mem = g_new0(Guest_Mem, 1);
+    mem->num = num;
+    mem->scatter_data = g_new0(Scatter_Data, num);
+
+    // 出错时也要把这一段读完，后面的内容才能接着读
+    for (int i = 0; i < num; i++)
+    {
+        mem->scatter_data[i].data = express_snapshot_get_host_ptr(f);
+        mem->scatter_data[i].len = qemu_get_be64(f);
+        mem->all_len += mem->scatter_data[i].len;
+        broken |= mem->scatter_data[i].data == NULL;
+    }
+
+    if (broken)
+    {
+        free_copied_guest_mem(mem);
+        return NULL;
+    }
+    return mem;
+}
+
+/**
+ * @brief 暂停传输层，等guest的请求都处理完，使virtqueue中只剩设备持有的中断call
+ *
+ * @param e
+ * @param drain 为false时不等待，还有没处理完的call就失败
+ * @return bool 是否成功
+ */
+static bool express_snapshot_quiesce(Teleport_Express *e, bool drain)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(e);
+    int64_t deadline = g_get_monotonic_time() + (drain ? EXPRESS_SNAPSHOT_DRAIN_TIMEOUT_US : 0);
+
+    qatomic_set(&express_distribute_paused, 0);
+    qatomic_set(&express_transport_paused, 1);
+
+    if (e->distribute_thread_run == 2)
+    {
+        // 等分发线程看到暂停标志，之后它只回收不再取call
+        while (!qatomic_read(&express_distribute_paused))
+        {
+            if (g_get_monotonic_time() >= deadline)
+            {
+                LOGE("error! distribute thread does not stop for snapshot");
+                return false;
+            }
+            wake_up_distribute();
+            g_usleep(1000);
+        }
+    }
+
+    while (qatomic_read(&express_output_calls_in_flight) != 0)
+    {
+        if (g_get_monotonic_time() >= deadline)
+        {
+            LOGE("error! %d calls are still being handled, cannot snapshot", qatomic_read(&express_output_calls_in_flight));
+            return false;
+        }
+        wake_up_distribute();
+        g_usleep(1000);
+    }
+
+    rewind_packaging_call(virtio_get_queue(vdev, 0), 0);
+
+    // 锁一直拿到虚拟机重新运行，期间输入线程不会再取call
+    while (qatomic_cmpxchg(&e->register_input_vq_locker, 0, 1) != 0)
+    {
+        if (g_get_monotonic_time() >= deadline + EXPRESS_SNAPSHOT_DRAIN_TIMEOUT_US)
+        {
+            LOGE("error! input queue is busy, cannot snapshot");
+            return false;
+        }
+        g_usleep(1000);
+    }
+
+    if (e->input_thread_run)
+    {
+        express_input_device_flush();
+    }
+    if (express_input_recycle_pending())
+    {
+        LOGE("error! input calls are still being recycled, cannot snapshot");
+        qatomic_set(&e->register_input_vq_locker, 0);
+        return false;
+    }
+
+    rewind_packaging_call(virtio_get_queue(vdev, 1), 1);
+
+    snapshot_quiesced = true;
+    return true;
+}
+
+/**
+ * @brief 重新注册快照中恢复出来的缓冲区与中断call，调用时持有register_input_vq_locker
+ */
+static void express_snapshot_replay(Teleport_Express *e)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(e);
+    VirtQueue *vq = virtio_get_queue(vdev, 1);
+
+    for (GList *node = restored_buffers; node != NULL; node = node->next)
+    {
+        Snapshot_Buffer *buffer = node->data;
+        Express_Device_Info *info = get_express_device_info(buffer->device_id);
+
+        if (info == NULL || info->buffer_register == NULL)
+        {
+            LOGW("restored buffer of device %" PRIu64 " is dropped", buffer->device_id);
+            free_copied_guest_mem(buffer->mem);
+            g_free(buffer);
+            continue;
+        }
+
+        // 缓冲区的所有权交给设备，另外复制一份继续记录
+        Guest_Mem *mem = buffer->mem;
+        buffer->mem = g_new(Guest_Mem, 1);
+        *buffer->mem = *mem;
+        buffer->mem->scatter_data = g_memdup2(mem->scatter_data, mem->num * sizeof(Scatter_Data));
+
+        info->buffer_register(mem, buffer->thread_id, buffer->process_id, buffer->unique_id);
+
+        g_mutex_lock(&snapshot_track_lock);
+        tracked_buffers = g_list_append(tracked_buffers, buffer);
+        g_mutex_unlock(&snapshot_track_lock);
+    }
+    g_list_free(restored_buffers);
+    restored_buffers = NULL;
+
+    for (GList *node = restored_irq_calls; node != NULL; node = node->next)
+    {
+        Snapshot_Irq_Call *irq_call = node->data;
+        Teleport_Express_Call *call = pack_call_from_elems(vq, irq_call->elems, irq_call->num);
+
+        if (call != NULL)
+        {
+            express_input_restore_call(vdev, call);
+        }
+        g_free(irq_call->elems);
+        g_free(irq_call);
+    }
+    g_list_free(restored_irq_calls);
+    restored_irq_calls = NULL;
+
+    LOGI("teleport-express transport state restored");
+}
+
+static void express_snapshot_vm_state_change(void *opaque, bool running, RunState state)
+{
+    Teleport_Express *e = opaque;
+
+    if (running)
+    {
+        if (snapshot_loaded)
+        {
+            express_snapshot_replay(e);
+        }
+
+        if (snapshot_quiesced)
+        {
+            qatomic_set(&e->register_input_vq_locker, 0);
+        }
+
+        qatomic_set(&express_transport_paused, 0);
+        snapshot_quiesced = false;
+        snapshot_quiesce_failed = false;
+
+        wake_up_distribute();
+        express_input_device_kick();
+
+        if (snapshot_loaded)
+        {
+            // 新启动的虚拟机中两个线程还没有创建，由这里启动它们并取走恢复前guest放进来的call
+            snapshot_loaded = false;
+            virtio_queue_notify(VIRTIO_DEVICE(e), 0);
+            virtio_queue_notify(VIRTIO_DEVICE(e), 1);
+        }
+        return;
+    }
+
+    // 只有保存和恢复虚拟机状态时才需要排空传输，普通的stop不能把设备的线程都停下来
+    if (state != RUN_STATE_SAVE_VM && state != RUN_STATE_FINISH_MIGRATE && state != RUN_STATE_RESTORE_VM)
+    {
+        return;
+    }
+
+    if (!snapshot_quiesced && !express_snapshot_quiesce(e, true))
+    {
+        // 保持暂停，pre_save时会再检查一次并让快照失败
+        snapshot_quiesce_failed = true;
+    }
+}
+
+typedef struct Snapshot_Check
+{
+    int error;
+} Snapshot_Check;
+
+static void check_device_can_save(void *key, void *value, void *user_data)
+{
+    Express_Device_Info *info = value;
+    Snapshot_Check *check = user_data;
+
+    if (qatomic_read(&info->live_context_num) > 0 && info->pre_save == NULL && !info->context_stateless)
+    {
+        LOGE("error! device %s has %d live contexts and cannot be saved", info->name,
+             qatomic_read(&info->live_context_num));
+        check->error = -1;
+    }
+}
+
+static int teleport_express_pre_save(void *opaque)
+{
+    Teleport_Express *e = opaque;
+    Snapshot_Check check = {0};
+
+    // 没有经过停止虚拟机的流程（例如后台快照），这时候不能等待，还有没处理完的call就失败
+    if (!snapshot_quiesced && !express_snapshot_quiesce(e, false))
+    {
+        snapshot_quiesce_failed = true;
+    }
+    if (snapshot_quiesce_failed)
+    {
+        LOGE("error! teleport-express transport is not quiescent");
+        return -1;
+    }
+
+    express_device_info_foreach(check_device_can_save, &check);
+    return check.error;
+}
+
+typedef struct Snapshot_Save
+{
+    QEMUFile *f;
+    int error;
+} Snapshot_Save;
+
+static void save_device_state(void *key, void *value, void *user_data)
+{
+    Express_Device_Info *info = value;
+    Snapshot_Save *save = user_data;
+
+    if (info->pre_save == NULL || save->error != 0)
+    {
+        return;
+    }
+
+    qemu_put_be32(save->f, info->device_id);
+    qemu_put_be32(save->f, info->state_version);
+    if (info->pre_save(save->f, info) < 0)
+    {
+        LOGE("error! device %s cannot save its state", info->name);
+        save->error = -1;
+    }
+}
+
+static int put_transport_state(QEMUFile *f, void *pv, size_t size, const VMStateField *field, JSONWriter *vmdesc)
+{
+    VirtIODevice *vdev = pv;
+    Snapshot_Save save = {.f = f};
+
+    express_snapshot_put_host_ptr(f, guest_null_ptr_get());
+
+    g_mutex_lock(&snapshot_track_lock);
+
+    qemu_put_be32(f, g_list_length(tracked_buffers));
+    for (GList *node = tracked_buffers; node != NULL; node = node->next)
+    {
+        Snapshot_Buffer *buffer = node->data;
+        qemu_put_be64(f, buffer->device_id);
+        qemu_put_be64(f, buffer->thread_id);
+        qemu_put_be64(f, buffer->process_id);
+        qemu_put_be64(f, buffer->unique_id);
+        express_snapshot_put_guest_mem(f, buffer->mem);
+    }
+
+    // 中断已经开启但是call还在guest那边（刚发送过中断）的context不需要保存，guest会重新注册
+    GList *contexts = tracked_irq_contexts != NULL ? g_hash_table_get_keys(tracked_irq_contexts) : NULL;
+    int irq_num = 0;
+    for (GList *node = contexts; node != NULL; node = node->next)
+    {
+        Teleport_Express_Call *call = ((Device_Context *)node->data)->irq_call;
+        irq_num += call != NULL && call != (void *)1;
+    }
+    qemu_put_be32(f, irq_num);
+    for (GList *node = contexts; node != NULL; node = node->next)
+    {
+        Teleport_Express_Call *call = ((Device_Context *)node->data)->irq_call;
+        if (call == NULL || call == (void *)1)
+        {
+            continue;
+        }
+
+        int num = 0;
+        for (Teleport_Express_Queue_Elem *a = call->elem_header; a != NULL; a = a->next)
+        {
+            num++;
+        }
+        qemu_put_be32(f, num);
+        for (Teleport_Express_Queue_Elem *a = call->elem_header; a != NULL; a = a->next)
+        {
+            qemu_put_virtqueue_element(vdev, f, &a->elem);
+        }
+    }
+    g_list_free(contexts);
+
+    g_mutex_unlock(&snapshot_track_lock);
+
+    express_device_info_foreach(save_device_state, &save);
+    qemu_put_be32(f, EXPRESS_SNAPSHOT_DEVICE_END);
+
+    LOGI("teleport-express transport saved, %d irq calls", irq_num);
+    return save.error;
+}
+
+/**
+ * @brief 丢掉恢复之前持有的中断call与记录，这些call属于被覆盖掉的virtqueue
+ */
+static void drop_tracked_state(void)
+{
+    g_mutex_lock(&snapshot_track_lock);
+    if (tracked_irq_contexts != NULL)
+    {
+        GHashTableIter iter;
+        void *key;
+
+        g_hash_table_iter_init(&iter, tracked_irq_contexts);
+        while (g_hash_table_iter_next(&iter, &key, NULL))
+        {
+            Device_Context *device_context = key;
+            Teleport_Express_Call *call = qatomic_xchg(&device_context->irq_call, NULL);
+
+            if (call != NULL && call != (void *)1)
+            {
+                drop_one_call(call);
+            }
+            device_context->irq_enabled = false;
+        }
+        g_hash_table_remove_all(tracked_irq_contexts);
+    }
+    g_list_free_full(tracked_buffers, snapshot_buffer_free);
+    tracked_buffers = NULL;
+    g_mutex_unlock(&snapshot_track_lock);
+}
+
+static int get_transport_state(QEMUFile *f, void *pv, size_t size, const VMStateField *field)
+{
+    VirtIODevice *vdev = pv;
+
+    drop_tracked_state();
+
+    guest_null_ptr_set(express_snapshot_get_host_ptr(f));
+
+    int buffer_num = qemu_get_be32(f);
+    for (int i = 0; i < buffer_num; i++)
+    {
+        Snapshot_Buffer *buffer = g_new0(Snapshot_Buffer, 1);
+        buffer->device_id = qemu_get_be64(f);
+        buffer->thread_id = qemu_get_be64(f);
+        buffer->process_id = qemu_get_be64(f);
+        buffer->unique_id = qemu_get_be64(f);
+        buffer->mem = express_snapshot_get_guest_mem(f);
+        if (buffer->mem == NULL)
+        {
+            g_free(buffer);
+            return -EINVAL;
+        }
+        restored_buffers = g_list_append(restored_buffers, buffer);
+    }
+
+    int irq_num = qemu_get_be32(f);
+    for (int i = 0; i < irq_num; i++)
+    {
+        Snapshot_Irq_Call *irq_call = g_new0(Snapshot_Irq_Call, 1);
+        irq_call->num = qemu_get_be32(f);
+        if (irq_call->num <= 0 || irq_call->num > MAX_PARA_NUM + 1)
+        {
+            LOGE("error! restored irq call has %d elems", irq_call->num);
+            g_free(irq_call);
+            return -EINVAL;
+        }
+
+        irq_call->elems = g_new0(Teleport_Express_Queue_Elem *, irq_call->num);
+        for (int j = 0; j < irq_call->num; j++)
+        {
+            irq_call->elems[j] = qemu_get_virtqueue_element(vdev, f, sizeof(Teleport_Express_Queue_Elem));
+        }
+        restored_irq_calls = g_list_append(restored_irq_calls, irq_call);
+    }
+
+    uint32_t device_id;
+    while ((device_id = qemu_get_be32(f)) != EXPRESS_SNAPSHOT_DEVICE_END)
+    {
+        int version_id = qemu_get_be32(f);
+        Express_Device_Info *info = get_express_device_info(device_id);
+
+        // 设备的数据没有长度信息，不认识的设备只能让恢复失败
+        if (info == NULL || info->post_load == NULL)
+        {
+            LOGE("error! snapshot has state of unknown device %u", device_id);
+            return -EINVAL;
+        }
+        if (version_id > info->state_version)
+        {
+            LOGE("error! device %s state version %d is newer than %d", info->name, version_id, info->state_version);
+            return -EINVAL;
+        }
+        if (info->post_load(f, info, version_id) < 0)
+        {
+            LOGE("error! device %s cannot load its state", info->name);
+            return -EINVAL;
+        }
+    }
+
+    snapshot_loaded = true;
+    LOGI("teleport-express transport loaded, %d buffers %d irq calls", buffer_num, irq_num);
+    return qemu_file_get_error(f);
+}
+
+static const VMStateInfo vmstate_info_transport_state = {
+    .name = "teleport_express_transport",
+    .get = get_transport_state,
+    .put = put_transport_state,
+};
+
+const VMStateDescription vmstate_teleport_express_device = {
+    .name = "teleport-express-device",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .pre_save = teleport_express_pre_save,
+    .fields = (VMStateField[]) {
+        {
+            .name = "transport",
+            .version_id = 0,
+            .field_exists = NULL,
+            .size = 0,
+            .info = &vmstate_info_transport_state,
+            .flags = VMS_SINGLE,
+            .offset = 0,
+        },
+        VMSTATE_END_OF_LIST()
+    },
+};
+
+void express_snapshot_init(Teleport_Express *e)
+{
+    if (snapshot_device != NULL)
+    {
+        return;
+    }
+
+    snapshot_device = e;
+    qemu_add_vm_change_state_handler(express_snapshot_vm_state_change, e);
+}
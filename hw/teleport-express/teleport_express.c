@@ -14,6 +14,7 @@
 #include "hw/teleport-express/teleport_express_call.h"
 #include "hw/teleport-express/teleport_express_distribute.h"
 #include "hw/teleport-express/teleport_express_register.h"
+#include "hw/teleport-express/express_snapshot.h"
 
 #include "hw/teleport-express/express_log.h"
 
@@ -33,7 +34,11 @@ static void teleport_express_output_handle(VirtIODevice *vdev, VirtQueue *vq)
     Teleport_Express *g = TELEPORT_EXPRESS(vdev);
     if (g->distribute_thread_run == 0)
     {
-        guest_null_ptr_init(vq);
+        // 从快照恢复时空指针已经恢复了，guest不会再发一次
+        if (guest_null_ptr_get() == NULL)
+        {
+            guest_null_ptr_init(vq);
+        }
         express_printf("start handle thread\n");
         g->distribute_thread_run = 1;
         qemu_thread_create(&g->distribute_thread, "teleport-express-distribute", call_distribute_thread,
@@ -126,6 +131,11 @@ static void teleport_express_input_handle_cb(VirtIODevice *vdev, VirtQueue *vq)
         register_input_buffer_call(vdev, vq);
         qatomic_set(&(g->register_input_vq_locker), 0);
     }
+    else
+    {
+        // 输入线程正在处理，让它处理完后再取一次，防止新加入的buffer被漏掉
+        express_input_device_kick();
+    }
 
     return;
 }
@@ -179,6 +189,10 @@ static void teleport_express_realize(DeviceState *qdev, Error **errp)
     // g->data_bh = qemu_bh_new(teleport_express_output_handle_bh, g);
 
     virtio_add_feature(&vdev->host_features, VIRTIO_RING_F_INDIRECT_DESC);
+    //让guest可以通过used_event控制中断，输入队列的中断合并依赖于此
+    virtio_add_feature(&vdev->host_features, VIRTIO_RING_F_EVENT_IDX);
+
+    express_snapshot_init(g);
 
     express_printf("express gpu realized\n");
 }
@@ -213,6 +227,16 @@ teleport_express_get_features(VirtIODevice *vdev, uint64_t features,
 //     return;
 // }
 
+static const VMStateDescription vmstate_teleport_express = {
+    .name = "teleport-express",
+    .minimum_version_id = 1,
+    .version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_VIRTIO_DEVICE,
+        VMSTATE_END_OF_LIST()
+    },
+};
+
 static void teleport_express_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
@@ -224,6 +248,8 @@ static void teleport_express_class_init(ObjectClass *klass, void *data)
 
     set_bit(DEVICE_CATEGORY_DISPLAY, dc->categories);
     dc->hotpluggable = false;
+    dc->vmsd = &vmstate_teleport_express;
+    vdc->vmsd = &vmstate_teleport_express_device;
 
     vdc->realize = teleport_express_realize;
 }
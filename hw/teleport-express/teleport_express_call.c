@@ -12,6 +12,7 @@
 #include "hw/teleport-express/express_device_common.h"
 
 #include "hw/teleport-express/teleport_express_call.h"
+#include "hw/teleport-express/express_metrics.h"
 
 // static Teleport_Express_Call pre_alloc_call[CALL_BUF_SIZE * 2];
 // static bool pre_alloc_call_flag[CALL_BUF_SIZE * 2];
@@ -25,6 +26,9 @@
 
 #define INIT_CACHE_SIZE 128
 
+// 每次从virtqueue中批量取出的最大元素数目
+#define QUEUE_POP_BATCH_SIZE 64
+
 typedef struct Fast_Alloc_Date_Cache
 {
     char **data;
@@ -40,6 +44,16 @@ typedef struct Fast_Alloc_Date_Cache
 static Teleport_Express_Call *volatile packaging_call[2] = {NULL, NULL};
 static int remain_elem_num[2] = {0, 0};
 
+// 批量取出但还没有打包进call的元素，只有打包线程自己会访问
+typedef struct Queue_Pop_Batch
+{
+    Teleport_Express_Queue_Elem *elems[QUEUE_POP_BATCH_SIZE];
+    unsigned int num;
+    unsigned int pos;
+} Queue_Pop_Batch;
+
+static Queue_Pop_Batch pop_batch[2];
+
 static void *guest_null_ptr = NULL;
 
 static Fast_Alloc_Date_Cache *call_cache = NULL;
@@ -254,6 +268,7 @@ void write_to_guest_mem(Guest_Mem *guest, void *host, size_t start_loc, size_t l
         LOGE("write_to_guest_mem error host %llx len %d %lld", (uint64_t)host, guest->all_len, length);
         return;
     }
+    express_metrics_guest_write(guest->metrics, length);
     host_guest_buffer_exchange(guest_data, (unsigned char *)host, start_loc, length, 0);
 }
 
@@ -371,6 +386,7 @@ int fill_teleport_express_queue_elem(Teleport_Express_Queue_Elem *elem, unsigned
         LOGE("error! guest_mem alloc return NULL!");
         return 0;
     }
+    guest_mem->metrics = NULL;
 
     if (v_elem->out_num != 0)
     {
@@ -443,6 +459,30 @@ int fill_teleport_express_queue_elem(Teleport_Express_Queue_Elem *elem, unsigned
     return 1;
 }
 
+/**
+ * @brief 从queue中取出一个元素，本地缓存的取完了再用virtqueue_pop_batch批量取一次
+ *
+ * 批量取只需要读一次avail index、查一次region cache，比逐个virtqueue_pop的开销小
+ *
+ * @return Teleport_Express_Queue_Elem* queue中没有数据时返回NULL
+ */
+static Teleport_Express_Queue_Elem *pop_queue_elem(VirtQueue *vq, int index)
+{
+    Queue_Pop_Batch *batch = &pop_batch[index];
+
+    if (batch->pos == batch->num)
+    {
+        batch->pos = 0;
+        batch->num = virtqueue_pop_batch(vq, sizeof(Teleport_Express_Queue_Elem), (void **)batch->elems,
+                                         QUEUE_POP_BATCH_SIZE);
+        if (batch->num == 0)
+        {
+            return NULL;
+        }
+    }
+    return batch->elems[batch->pos++];
+}
+
 /**
  * @brief 从queue中打包出一个draw调用
  *
@@ -463,7 +503,7 @@ Teleport_Express_Call *pack_call_from_queue(VirtQueue *vq, int index)
     unsigned long long process_id;
     unsigned long long unique_id;
 
-    elem = virtqueue_pop(vq, sizeof(Teleport_Express_Queue_Elem));
+    elem = pop_queue_elem(vq, index);
     while (elem)
     {
 
@@ -528,7 +568,7 @@ Teleport_Express_Call *pack_call_from_queue(VirtQueue *vq, int index)
             //--更新：现在不循环取了，而是记下来，等下一次的时候取
             int cnt_timeout = 0;
 
-            elem = virtqueue_pop(vq, sizeof(Teleport_Express_Queue_Elem));
+            elem = pop_queue_elem(vq, index);
 
             if (unlikely(elem == NULL))
             {
@@ -586,6 +626,163 @@ Teleport_Express_Call *pack_call_from_queue(VirtQueue *vq, int index)
     return NULL;
 }
 
+/**
+ * @brief 用恢复出来的virtqueue元素重新打包出call，元素的数目必须与当初的call一致
+ *
+ * @param vq 元素所在的queue
+ * @param elems 元素数组，第一个为guest的flag缓冲区
+ * @param num 元素数目
+ * @return Teleport_Express_Call* 失败返回NULL，此时元素已经被丢弃
+ */
+Teleport_Express_Call *pack_call_from_elems(VirtQueue *vq, Teleport_Express_Queue_Elem **elems, int num)
+{
+    unsigned long long para_num;
+    unsigned long long fun_id;
+    unsigned long long thread_id;
+    unsigned long long process_id;
+    unsigned long long unique_id;
+
+    Teleport_Express_Call *call = alloc_one_call();
+    call->elem_header = NULL;
+    call->elem_tail = NULL;
+    call->vq = vq;
+    call->spend_time = 0;
+    call->next = NULL;
+
+    // 元素都先挂到call上，出错时可以直接一起丢掉
+    for (int i = 0; i < num; i++)
+    {
+        elems[i]->para = NULL;
+        elems[i]->next = NULL;
+        if (call->elem_tail == NULL)
+        {
+            call->elem_header = elems[i];
+        }
+        else
+        {
+            call->elem_tail->next = elems[i];
+        }
+        call->elem_tail = elems[i];
+    }
+
+    for (int i = 0; i < num; i++)
+    {
+        Teleport_Express_Queue_Elem *next = elems[i]->next;
+        int ok;
+
+        if (i == 0)
+        {
+            ok = fill_teleport_express_queue_elem(elems[i], &fun_id, &thread_id, &process_id, &unique_id, &para_num);
+        }
+        else
+        {
+            ok = fill_teleport_express_queue_elem(elems[i], NULL, NULL, NULL, NULL, NULL);
+        }
+        // fill会清空next
+        elems[i]->next = next;
+
+        if (ok == 0 || (i == 0 && para_num + 1 != num))
+        {
+            LOGE("error! restored call elem %d of %d is broken", i, num);
+            drop_one_call(call);
+            return NULL;
+        }
+    }
+
+    call->para_num = para_num;
+    call->id = fun_id;
+    call->thread_id = thread_id;
+    call->process_id = process_id;
+    call->unique_id = unique_id;
+
+    return call;
+}
+
+/**
+ * @brief 不把call还给guest，直接丢掉，用于恢复快照时丢弃恢复之前持有的call
+ *
+ * @param call
+ */
+void drop_one_call(Teleport_Express_Call *call)
+{
+    for (Teleport_Express_Queue_Elem *a = call->elem_header; a != NULL; a = a->next)
+    {
+        virtqueue_detach_element(call->vq, &a->elem, 0);
+    }
+    TELEPORT_EXPRESS_QUEUE_ELEMS_FREE(call->elem_header);
+    release_one_cache(call_cache, call);
+}
+
+/**
+ * @brief 把批量取出还没用到的元素和只取出了一部分参数的call放回queue中，恢复后重新取，调用时不能有其他线程在取这个queue
+ *
+ * @param vq
+ * @param index 与pack_call_from_queue的index一致
+ * @return int 放回的元素数目
+ */
+int rewind_packaging_call(VirtQueue *vq, int index)
+{
+    Queue_Pop_Batch *batch = &pop_batch[index];
+    Teleport_Express_Call *call = packaging_call[index];
+    int batch_num = batch->num - batch->pos;
+    int num = 0;
+
+    // 批量缓存里的元素比partial call的元素取出得晚，要先放回
+    while (batch->num > batch->pos)
+    {
+        Teleport_Express_Queue_Elem *elem = batch->elems[--batch->num];
+        virtqueue_unpop(vq, &elem->elem, 0);
+        g_free(elem);
+    }
+    batch->num = 0;
+    batch->pos = 0;
+
+    if (call == NULL)
+    {
+        if (batch_num != 0)
+        {
+            LOGI("rewind %d prefetched elems on queue %d", batch_num, index);
+        }
+        return batch_num;
+    }
+    packaging_call[index] = NULL;
+    remain_elem_num[index] = 0;
+
+    for (Teleport_Express_Queue_Elem *a = call->elem_header; a != NULL; a = a->next)
+    {
+        num++;
+    }
+
+    // 必须按取出的相反顺序放回
+    Teleport_Express_Queue_Elem **elems = g_new(Teleport_Express_Queue_Elem *, num);
+    int i = 0;
+    for (Teleport_Express_Queue_Elem *a = call->elem_header; a != NULL; a = a->next)
+    {
+        elems[i++] = a;
+    }
+    for (i = num - 1; i >= 0; i--)
+    {
+        virtqueue_unpop(vq, &elems[i]->elem, 0);
+    }
+    g_free(elems);
+
+    TELEPORT_EXPRESS_QUEUE_ELEMS_FREE(call->elem_header);
+    release_one_cache(call_cache, call);
+
+    LOGI("rewind %d elems of a partial call and %d prefetched elems on queue %d", num, batch_num, index);
+    return num + batch_num;
+}
+
+void *guest_null_ptr_get(void)
+{
+    return guest_null_ptr;
+}
+
+void guest_null_ptr_set(void *ptr)
+{
+    guest_null_ptr = ptr;
+}
+
 /**
  * @brief 从call中获得其保存的参数，并返回参数数目，假如返回的是0，则说明获取失败
  *
@@ -631,6 +828,7 @@ Guest_Mem *copy_guest_mem_from_call(Teleport_Express_Call *call, int index)
 
         save_mem->num = old_mem->num;
         save_mem->all_len = old_mem->all_len;
+        save_mem->metrics = old_mem->metrics;
         save_mem->scatter_data = g_malloc(save_mem->num * sizeof(Scatter_Data));
         memcpy(save_mem->scatter_data, old_mem->scatter_data, save_mem->num * sizeof(Scatter_Data));
 
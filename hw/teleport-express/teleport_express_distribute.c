@@ -17,6 +17,9 @@
 #include "hw/teleport-express/express_log.h"
 #include "hw/teleport-express/express_device_ctrl.h"
 #include "hw/teleport-express/express_event.h"
+#include "hw/teleport-express/express_metrics.h"
+#include "hw/teleport-express/express_snapshot.h"
+#include "qemu/timer.h"
 
 //这是VirtQueueElement里面的实际东西
 // typedef struct VirtQueueElement
@@ -43,8 +46,12 @@ static volatile int call_recycle_queue_tail;
 
 int atomic_distribute_thread_running = 0;
 
+int express_output_calls_in_flight = 0;
+
+// 分发线程看到传输层暂停后置1，之后不会再从队列中取call
+int express_distribute_paused = 0;
+
 static void push_free_callback(Teleport_Express_Call *call, int notify);
-void push_to_thread(Teleport_Express_Call *call);
 void init_distribute_event(void);
 void distribute_wait(void);
 
@@ -104,6 +111,8 @@ Thread_Context *thread_context_create(unsigned long long thread_id, unsigned lon
 
     context->teleport_express_device = teleport_express_device;
 
+    qatomic_inc(&info->live_context_num);
+
 //线程缓冲区事件初始化
 // qemu_event_init(&(context->data_event), false);
 #ifdef _WIN32
@@ -135,7 +144,11 @@ void push_to_thread(Teleport_Express_Call *call)
 
     if (device_id == EXPRESS_CTRL_DEVICE_ID)
     {
+        //ctrl设备的call直接在分发线程中处理，没有排队时间
+        Express_Call_Metrics *metrics = express_metrics_get(call->id);
+        int64_t start_time = get_clock();
         express_device_ctrl_invoke(call);
+        express_metrics_call_handled(metrics, -1, get_clock() - start_time);
         return;
     }
 
@@ -279,6 +292,9 @@ void *call_distribute_thread(void *opaque)
         int pop_flag = 1;
         int recycle_flag = 1;
         int need_irq = 0;
+
+        //传输层暂停时只回收，不再取新的call，这里置位表示之前取出的call都已经交给了处理线程
+        qatomic_set(&express_distribute_paused, qatomic_read(&express_transport_paused));
         virtqueue_data_distribute_and_recycle(vq, &pop_flag, &recycle_flag, &need_irq);
 
         if (pop_flag != 0)
@@ -376,7 +392,7 @@ void virtqueue_data_distribute_and_recycle(VirtQueue *vq, int *pop_flag, int *re
     int origin_recycle_flag = *recycle_flag;
     *pop_flag = 0;
     *recycle_flag = 0;
-    if (origin_pop_flag == 1 && (call = pack_call_from_queue(vq, 0)) != NULL)
+    if (origin_pop_flag == 1 && !qatomic_read(&express_transport_paused) && (call = pack_call_from_queue(vq, 0)) != NULL)
     {
         //从queue中打包调用，假如打包失败的话，失败的部分也还是会还给guest
         express_printf("virtio has data push\n");
@@ -384,6 +400,8 @@ void virtqueue_data_distribute_and_recycle(VirtQueue *vq, int *pop_flag, int *re
         call->vdev = teleport_express_device;
         call->callback = push_free_callback;
         call->is_end = 0;
+        qatomic_inc(&express_output_calls_in_flight);
+        express_metrics_call_received(call);
         push_to_thread(call);
         if (GET_DEVICE_ID(call->id) == EXPRESS_CTRL_DEVICE_ID && FUN_NEED_SYNC(call->id))
         {
@@ -408,6 +426,7 @@ void virtqueue_data_distribute_and_recycle(VirtQueue *vq, int *pop_flag, int *re
             *need_irq = 1;
         }
         release_one_call(out_call, false);
+        qatomic_dec(&express_output_calls_in_flight);
         *recycle_flag = 1;
     }
 
@@ -427,6 +446,11 @@ void push_free_callback(Teleport_Express_Call *call, int notify)
 
     //无锁入队
     int origin_tail = call_recycle_queue_tail;
+    if ((origin_tail - call_recycle_queue_header + CALL_BUF_SIZE + 2) % (CALL_BUF_SIZE + 2) >= CALL_BUF_SIZE)
+    {
+        //分发线程来不及回收，下面的入队可能需要自旋等待
+        express_metrics_recycle_full(call);
+    }
     int t = origin_tail;
     do
     {
@@ -13,6 +13,12 @@
 #include "hw/teleport-express/teleport_express_pci.h"
 //#include "hw/teleport-express/express_log.h"
 #include "hw/teleport-express/express_device_common.h"
+#include "hw/teleport-express/teleport_express_register.h"
+#include "hw/teleport-express/express_metrics.h"
+#include "hw/express-gpu/express_gpu_headless.h"
+#include "hw/express-gpu/express_gpu_capture.h"
+#include "hw/express-gpu/texture_transcode.h"
+#include "hw/express-gpu/express_gpu_timer.h"
 #include "qapi/error.h"
 
 char *kernel_load_express_driver_names = NULL;
@@ -30,6 +36,8 @@ static Property teleport_express_base_properties[] = {
     DEFINE_PROP_BOOL("keep_window_scale", Teleport_Express_PCI, keep_window_scale, true),
     DEFINE_PROP_INT32("window_width", Teleport_Express_PCI, window_width, 1280),
     DEFINE_PROP_INT32("window_height", Teleport_Express_PCI, window_height, 720),
+    // 不创建窗口，画面通过QEMU的console交给vnc、dbus等显示后端
+    DEFINE_PROP_BOOL("headless", Teleport_Express_PCI, headless, false),
 
     DEFINE_PROP_BOOL("device_input_window", Teleport_Express_PCI, show_device_input_window, false),
 
@@ -58,6 +66,30 @@ static Property teleport_express_base_properties[] = {
 
     DEFINE_PROP_STRING("ruim_file", Teleport_Express_PCI, ruim_file),
 
+    DEFINE_PROP_INT32("mic_period_ms", Teleport_Express_PCI, mic_period_ms, 10),
+    DEFINE_PROP_INT32("mic_sample_rate", Teleport_Express_PCI, mic_sample_rate, 44100),
+
+    DEFINE_PROP_INT32("codec_decode_threads", Teleport_Express_PCI, codec_decode_threads, 0),
+    DEFINE_PROP_BOOL("codec_encode_gpu_yuv", Teleport_Express_PCI, codec_encode_gpu_yuv, true),
+    DEFINE_PROP_BOOL("codec_decode_to_texture", Teleport_Express_PCI, codec_decode_to_texture, true),
+
+    DEFINE_PROP_STRING("camera_source", Teleport_Express_PCI, camera_source),
+
+    DEFINE_PROP_INT32("input_irq_latency_us", Teleport_Express_PCI, input_irq_latency_us, 1000),
+
+    DEFINE_PROP_BOOL("call_metrics", Teleport_Express_PCI, call_metrics, true),
+
+    // 录制GL调用流到文件，或者不启动guest，回放录制的文件并打印耗时统计
+    DEFINE_PROP_STRING("gl_capture", Teleport_Express_PCI, gl_capture),
+    DEFINE_PROP_STRING("gl_replay", Teleport_Express_PCI, gl_replay),
+
+    // host不支持的压缩纹理在CPU上解码，解码结果缓存的目录，设为空字符串时不缓存
+    // 缓存目录的大小上限，单位MB，设为0时不限制
+    DEFINE_PROP_BOOL("texture_transcode", Teleport_Express_PCI, texture_transcode, true),
+    DEFINE_PROP_STRING("texture_cache", Teleport_Express_PCI, texture_cache),
+    DEFINE_PROP_INT32("texture_cache_mb", Teleport_Express_PCI, texture_cache_mb, 1024),
+    DEFINE_PROP_BOOL("frame_stats", Teleport_Express_PCI, frame_stats, true),
+
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -88,6 +120,22 @@ Express_Device_Info *get_express_device_info(unsigned int device_id)
     return (Express_Device_Info *)g_hash_table_lookup(all_register_device_info, GUINT_TO_POINTER(device_id));
 }
 
+/**
+ * @brief 遍历所有注册过的设备，func的value参数为Express_Device_Info
+ *
+ * @param func
+ * @param user_data
+ */
+void express_device_info_foreach(GHFunc func, void *user_data)
+{
+    if (all_register_device_info == NULL)
+    {
+        return;
+    }
+
+    g_hash_table_foreach(all_register_device_info, func, user_data);
+}
+
 /**
  * @brief 根据Express_Device_Info里的内容产生给qemu命令行用的Property
  *
@@ -279,6 +327,13 @@ static void teleport_express_pci_realize(VirtIOPCIProxy *vpci_dev, Error **errp)
     *express_display_pixel_height = express_pci->display_height;
     express_display_refresh_rate = express_pci->refresh_rate;
 
+    // console要在显示后端初始化之前创建，vnc等才能显示它
+    express_gpu_headless = express_pci->headless;
+    if (express_gpu_headless)
+    {
+        express_headless_console_init(DEVICE(vpci_dev), express_pci->display_width, express_pci->display_height);
+    }
+
     *express_display_phy_width = express_pci->phy_width;
     *express_display_phy_height = express_pci->phy_height;
 
@@ -299,12 +354,43 @@ static void teleport_express_pci_realize(VirtIOPCIProxy *vpci_dev, Error **errp)
 
     express_ruim_file = express_pci->ruim_file;
 
+    express_mic_period_ms = express_pci->mic_period_ms;
+    express_mic_sample_rate = express_pci->mic_sample_rate;
+
+    express_codec_decode_threads = express_pci->codec_decode_threads;
+    express_codec_encode_gpu_yuv = express_pci->codec_encode_gpu_yuv;
+    express_codec_decode_to_texture = express_pci->codec_decode_to_texture;
+
+    express_camera_source = express_pci->camera_source;
+
+    express_input_irq_latency_us = express_pci->input_irq_latency_us;
+
+    express_call_metrics_enable = express_pci->call_metrics;
+
+    express_gpu_texture_transcode = express_pci->texture_transcode;
+    express_gpu_texture_cache = express_pci->texture_cache;
+    express_gpu_texture_cache_mb = express_pci->texture_cache_mb;
+    express_gpu_frame_stats = express_pci->frame_stats;
+
     if (local_error)
     {
         error_propagate(errp, local_error);
         return;
     }
 
+    if (express_pci->gl_capture != NULL && express_pci->gl_replay != NULL)
+    {
+        error_setg(errp, "gl_capture and gl_replay cannot be used together");
+    }
+    else if (express_pci->gl_capture != NULL && express_gpu_capture_start(express_pci->gl_capture) != 0)
+    {
+        error_setg(errp, "cannot start gl capture to %s", express_pci->gl_capture);
+    }
+    else if (express_pci->gl_replay != NULL && express_gpu_replay_start(express_pci->gl_replay) != 0)
+    {
+        error_setg(errp, "cannot replay gl capture %s", express_pci->gl_replay);
+    }
+
     // for (i = 0; i < g->conf.max_outputs; i++) {
     //     object_property_set_link(OBJECT(g->scanout[i].con),
     //                             OBJECT(vpci_dev),
@@ -3,9 +3,17 @@
 #include "hw/teleport-express/teleport_express_register.h"
 
 #include "qemu/atomic.h"
+#include "qemu/stats64.h"
 
 #include "hw/teleport-express/express_log.h"
 #include "hw/teleport-express/express_event.h"
+#include "hw/teleport-express/express_snapshot.h"
+#include "qemu/timer.h"
+
+#define INPUT_IRQ_NO_DEADLINE INT64_MAX
+
+// 统计信息的输出周期
+#define INPUT_IRQ_STATS_PERIOD_NS (10 * NANOSECONDS_PER_SECOND)
 
 static VirtIODevice *in_teleport_express = NULL;
 
@@ -15,7 +23,33 @@ static volatile int call_recycle_queue_tail = 0;
 
 static bool need_send_irq = false;
 
-bool now_can_set_event = true;
+// 未设置irq_latency_budget_us的设备使用的默认延迟预算
+int express_input_irq_latency_us = 1000;
+
+// 中断调节的状态：最近一次注入中断的时间，待发送中断的最晚发送时间，以及最早一个待发送call的回收时间
+static int64_t input_irq_last_notify_ns = 0;
+static int64_t input_irq_deadline_ns = INPUT_IRQ_NO_DEADLINE;
+static int64_t input_irq_pending_since_ns = 0;
+
+// 统计信息由输入线程修改，查询和清零可能在主线程，所以都用Stat64
+static struct
+{
+    Stat64 irq_count;
+    Stat64 irq_suppressed;
+    Stat64 call_count;
+    Stat64 batch_count;
+    Stat64 batch_latency_sum_ns;
+    Stat64 batch_latency_max_ns;
+} input_irq_stats;
+static int64_t input_irq_stats_start_ns = 0;
+// 每次清零统计时加一，用来判断上一次打印之后统计有没有被清零
+static uint64_t input_irq_stats_generation = 0;
+
+// 上一次打印时的统计，日志里打印的是两次之间的增量
+static Express_Input_Irq_Stats input_irq_stats_last_report;
+static int64_t input_irq_stats_last_report_ns = 0;
+static uint64_t input_irq_stats_last_report_generation = 0;
+
 #ifdef _WIN32
 HANDLE input_event = NULL;
 #else
@@ -82,6 +116,7 @@ static void push_to_device(Teleport_Express_Call *call)
     {
         Guest_Mem *data = copy_guest_mem_from_call(call, 1);
         device_info->buffer_register(data, thread_id, process_id, unique_id);
+        express_snapshot_track_buffer(call);
         call->callback(call, 0);
     }
     else if (fun_id == EXPRESS_IRQ_FUN_ID)
@@ -106,6 +141,59 @@ static void push_to_device(Teleport_Express_Call *call)
     return;
 }
 
+/**
+ * @brief 获取call所属设备允许的中断延迟预算，非IRQ的控制类call（注册buffer、获取属性等）guest端在同步等待，所以总是立即发送
+ *
+ * @param call
+ * @return int64_t 延迟预算，单位ns
+ */
+static int64_t input_call_latency_budget_ns(Teleport_Express_Call *call)
+{
+    if (GET_FUN_ID(call->id) != EXPRESS_IRQ_FUN_ID)
+    {
+        return 0;
+    }
+
+    Express_Device_Info *device_info = get_express_device_info(GET_DEVICE_ID(call->id));
+    int budget_us = express_input_irq_latency_us;
+    if (device_info != NULL && device_info->irq_latency_budget_us != 0)
+    {
+        budget_us = device_info->irq_latency_budget_us;
+    }
+
+    if (budget_us < 0)
+    {
+        return 0;
+    }
+    return (int64_t)budget_us * 1000;
+}
+
+/**
+ * @brief 根据新回收的call更新中断的最晚发送时间，距上一次中断超过预算时立即发送，否则等到预算用完时与其他call合并发送
+ *
+ * @param call
+ * @return bool 最晚发送时间是否被提前，提前了就需要唤醒输入线程重新计算休眠时间
+ */
+static bool input_irq_schedule(Teleport_Express_Call *call)
+{
+    int64_t now = get_clock();
+    qatomic_cmpxchg(&input_irq_pending_since_ns, 0, now);
+
+    int64_t deadline = MAX(now, qatomic_read(&input_irq_last_notify_ns) + input_call_latency_budget_ns(call));
+
+    int64_t origin_deadline = qatomic_read(&input_irq_deadline_ns);
+    while (deadline < origin_deadline)
+    {
+        int64_t t = qatomic_cmpxchg(&input_irq_deadline_ns, origin_deadline, deadline);
+        if (t == origin_deadline)
+        {
+            return true;
+        }
+        origin_deadline = t;
+    }
+    return false;
+}
+
 /**
  * @brief 在处理线程使用完数据后的回调函数，将调用完成的call送给回收线程，使用无锁队列实现入队，同时，在传回之前，会将相关数据复制回去，同时设置好guest会读取的flag
  *
@@ -132,24 +220,36 @@ static void input_call_release(Teleport_Express_Call *call, int notify)
 
     // release_one_call(call, (bool)notify);
 
-    // need_send_irq = true;
-    if (input_event != NULL && now_can_set_event)
+    // 只有最晚发送时间提前了才需要唤醒输入线程，其他情况下输入线程会在预算用完时自己醒来
+    if (input_irq_schedule(call) && input_event != NULL)
     {
 #ifdef _WIN32
         SetEvent(input_event);
 #else
         set_event(input_event);
 #endif
-        express_printf("slow input_event!\n");
-    }
-    else
-    {
-        express_printf("qucik input_event!\n");
+        express_printf("input_event set!\n");
     }
 
     return;
 }
 
+/**
+ * @brief guest端向输入队列添加buffer时调用，唤醒输入线程去取buffer
+ *
+ */
+void express_input_device_kick(void)
+{
+    if (input_event != NULL)
+    {
+#ifdef _WIN32
+        SetEvent(input_event);
+#else
+        set_event(input_event);
+#endif
+    }
+}
+
 void register_input_buffer_call(VirtIODevice *vdev, VirtQueue *vq)
 {
     // Teleport_Express_Call *call = get_one_call_from_input_queue(vq);
@@ -191,49 +291,87 @@ void send_express_device_irq(Teleport_Express_Call *irq_call, int buf_index, int
     irq_call->callback(irq_call, 0);
 }
 
+/**
+ * @brief 定期打印这段时间内的中断统计，只和上一次打印时的快照做差，不清零累计的统计
+ */
+static void input_irq_stats_report(int64_t now)
+{
+    qatomic_cmpxchg(&input_irq_stats_start_ns, 0, now);
+    if (input_irq_stats_last_report_ns == 0)
+    {
+        input_irq_stats_last_report_ns = now;
+        return;
+    }
+    if (now - input_irq_stats_last_report_ns < INPUT_IRQ_STATS_PERIOD_NS)
+    {
+        return;
+    }
+
+    Express_Input_Irq_Stats stats;
+    Express_Input_Irq_Stats *last = &input_irq_stats_last_report;
+    express_input_irq_stats_get(&stats, false);
+
+    // 统计在这段时间内被清零过，就从0开始算增量
+    uint64_t generation = qatomic_read(&input_irq_stats_generation);
+    if (generation != input_irq_stats_last_report_generation)
+    {
+        memset(last, 0, sizeof(Express_Input_Irq_Stats));
+        input_irq_stats_last_report_generation = generation;
+    }
+
+    uint64_t irq_count = stats.irq_count - last->irq_count;
+    uint64_t batch_count = stats.batch_count - last->batch_count;
+    int64_t batch_latency_sum_ns = stats.batch_latency_sum_ns - last->batch_latency_sum_ns;
+    LOGD("input irq %.1f/s suppressed %llu calls %llu batch latency avg %lld us (max since reset %lld us)",
+         (double)irq_count * NANOSECONDS_PER_SECOND / (now - input_irq_stats_last_report_ns),
+         (unsigned long long)(stats.irq_suppressed - last->irq_suppressed),
+         (unsigned long long)(stats.call_count - last->call_count),
+         (long long)(batch_count != 0 ? batch_latency_sum_ns / (int64_t)batch_count / 1000 : 0),
+         (long long)(stats.batch_latency_max_ns / 1000));
+
+    *last = stats;
+    input_irq_stats_last_report_ns = now;
+}
+
 void *input_sync_thread(void *opaque)
 {
 
 #ifdef _WIN32
     input_event = CreateEvent(NULL, FALSE, FALSE, NULL);
 #else
-    input_event = create_event(0,0);
+    input_event = create_event(0, 0);
 #endif
     while (!teleport_express_should_stop)
     {
-        #ifdef _WIN32
-        // 有一个中断时，之后的1ms超时内的中断都不再使能中断的打断，以防止中断过于频繁
-        DWORD ret = WaitForSingleObject(input_event, 1);
-        if (ret == WAIT_TIMEOUT)
+        // 没有待发送的中断时一直休眠，直到有call被回收或者guest添加了新的buffer
+        int64_t deadline = qatomic_read(&input_irq_deadline_ns);
+        long wait_ms = 0xffffffff;
+        if (deadline != INPUT_IRQ_NO_DEADLINE)
         {
-            now_can_set_event = true;
+            int64_t remain_ns = deadline - get_clock();
+            wait_ms = remain_ns <= 0 ? 0 : (long)((remain_ns + 999999) / 1000000);
         }
-        else
+
+        if (wait_ms != 0)
         {
-            express_printf("intrupted by event\n");
-            now_can_set_event = false;
-        }
-    #else    
-        int ret=wait_event(input_event,1);
-        if(ret == 0){
-            now_can_set_event = true;
+#ifdef _WIN32
+            WaitForSingleObject(input_event, (DWORD)wait_ms);
+#else
+            wait_event(input_event, wait_ms);
+#endif
         }
-        else{
-            now_can_set_event = false;
+
+        if (in_teleport_express == NULL)
+        {
+            continue;
         }
-    #endif
+
         Teleport_Express *g = TELEPORT_EXPRESS(in_teleport_express);
         if (qatomic_cmpxchg(&(g->register_input_vq_locker), 0, 1) == 0)
         {
-            // Teleport_Express *g = TELEPORT_EXPRESS(in_teleport_express);
-            // if (qatomic_cmpxchg(&(g->register_input_vq_locker), 0, 1) == 0)
-            // {
-            //     register_input_buffer_call(in_teleport_express, g->in_data_queue);
-            //     qatomic_set(&(g->register_input_vq_locker), 0);
-            // }
             register_input_buffer_call(in_teleport_express, g->in_data_queue);
+            input_irq_stats_report(get_clock());
             qatomic_set(&(g->register_input_vq_locker), 0);
-
         }
     }
 #ifdef _WIN32
@@ -246,6 +384,17 @@ void *input_sync_thread(void *opaque)
 
 void express_input_device_sync(void)
 {
+    int64_t now = get_clock();
+    int64_t pending_since = 0;
+    bool deadline_reached = qatomic_read(&input_irq_deadline_ns) <= now;
+
+    if (deadline_reached)
+    {
+        // 先清空调度状态再回收，之后回收的call会重新设置最晚发送时间
+        qatomic_set(&input_irq_deadline_ns, INPUT_IRQ_NO_DEADLINE);
+        pending_since = qatomic_xchg(&input_irq_pending_since_ns, 0);
+    }
+
     while (call_recycle_queue[(call_recycle_queue_header + 1) % (CALL_BUF_SIZE + 2)] != NULL)
     {
         Teleport_Express_Call *out_call = call_recycle_queue[(call_recycle_queue_header + 1) % (CALL_BUF_SIZE + 2)];
@@ -255,17 +404,98 @@ void express_input_device_sync(void)
 
         release_one_call(out_call, false);
 
+        stat64_add(&input_irq_stats.call_count, 1);
         need_send_irq = true;
     }
 
-    if (need_send_irq)
+    // 没到最晚发送时间的call先还给guest，但是不注入中断，等待与之后的call合并
+    if (need_send_irq && deadline_reached)
     {
-        virtio_notify(VIRTIO_DEVICE(in_teleport_express), TELEPORT_EXPRESS(in_teleport_express)->in_data_queue);
+        // 协商了VIRTIO_RING_F_EVENT_IDX时，guest可以通过used_event抑制中断
+        if (virtio_try_notify(VIRTIO_DEVICE(in_teleport_express), TELEPORT_EXPRESS(in_teleport_express)->in_data_queue))
+        {
+            stat64_add(&input_irq_stats.irq_count, 1);
+        }
+        else
+        {
+            stat64_add(&input_irq_stats.irq_suppressed, 1);
+        }
+        qatomic_set(&input_irq_last_notify_ns, now);
+
+        if (pending_since != 0 && now > pending_since)
+        {
+            int64_t latency = now - pending_since;
+            stat64_add(&input_irq_stats.batch_latency_sum_ns, latency);
+            stat64_add(&input_irq_stats.batch_count, 1);
+            stat64_max(&input_irq_stats.batch_latency_max_ns, latency);
+        }
         need_send_irq = false;
         // printf("input sync\n");
     }
 }
 
+/**
+ * @brief 立即把回收队列中的call都还给guest并注入中断，调用时需要持有register_input_vq_locker
+ */
+void express_input_device_flush(void)
+{
+    qatomic_set(&input_irq_deadline_ns, get_clock());
+    express_input_device_sync();
+}
+
+bool express_input_recycle_pending(void)
+{
+    return call_recycle_queue[(call_recycle_queue_header + 1) % (CALL_BUF_SIZE + 2)] != NULL;
+}
+
+/**
+ * @brief 把恢复快照后重新打包出来的call按guest刚发过来的流程再处理一次，调用时需要持有register_input_vq_locker
+ */
+void express_input_restore_call(VirtIODevice *vdev, Teleport_Express_Call *call)
+{
+    in_teleport_express = vdev;
+
+    call->callback = input_call_release;
+    call->is_end = 0;
+    call->vdev = vdev;
+    push_to_device(call);
+}
+
+void express_input_irq_stats_get(Express_Input_Irq_Stats *stats, bool reset)
+{
+    int64_t now = get_clock();
+    int64_t start_ns = qatomic_read(&input_irq_stats_start_ns);
+
+    memset(stats, 0, sizeof(Express_Input_Irq_Stats));
+    stats->irq_count = stat64_get(&input_irq_stats.irq_count);
+    stats->irq_suppressed = stat64_get(&input_irq_stats.irq_suppressed);
+    stats->call_count = stat64_get(&input_irq_stats.call_count);
+    stats->batch_count = stat64_get(&input_irq_stats.batch_count);
+    stats->batch_latency_sum_ns = stat64_get(&input_irq_stats.batch_latency_sum_ns);
+    stats->batch_latency_max_ns = stat64_get(&input_irq_stats.batch_latency_max_ns);
+    if (start_ns != 0 && now > start_ns)
+    {
+        stats->irq_per_second = (double)stats->irq_count * NANOSECONDS_PER_SECOND / (now - start_ns);
+    }
+    if (stats->batch_count != 0)
+    {
+        stats->batch_latency_avg_ns = stats->batch_latency_sum_ns / stats->batch_count;
+    }
+
+    if (reset)
+    {
+        // 清零和输入线程的累加之间没有锁，和其他指标一样，清零瞬间的少量计数可能丢失
+        stat64_init(&input_irq_stats.irq_count, 0);
+        stat64_init(&input_irq_stats.irq_suppressed, 0);
+        stat64_init(&input_irq_stats.call_count, 0);
+        stat64_init(&input_irq_stats.batch_count, 0);
+        stat64_init(&input_irq_stats.batch_latency_sum_ns, 0);
+        stat64_init(&input_irq_stats.batch_latency_max_ns, 0);
+        qatomic_set(&input_irq_stats_start_ns, now);
+        qatomic_inc(&input_irq_stats_generation);
+    }
+}
+
 void common_device_irq_register(Device_Context *device_context, Teleport_Express_Call *irq_call)
 {
     express_printf("irq register %s\n", device_context->device_info->name);
@@ -291,6 +521,10 @@ void common_device_irq_register(Device_Context *device_context, Teleport_Express
             }
         }
     }
+    if (!device_context->irq_enabled)
+    {
+        express_snapshot_track_irq(device_context);
+    }
     device_context->irq_enabled = true;
     if(device_context->device_info->irq_register != NULL)
     {
@@ -300,6 +534,10 @@ void common_device_irq_register(Device_Context *device_context, Teleport_Express
 
 void common_device_irq_release(Device_Context *device_context)
 {
+    if (device_context->irq_enabled)
+    {
+        express_snapshot_untrack_irq(device_context);
+    }
     device_context->irq_enabled = false;
 
     LOGI("irq release %s", device_context->device_info->name);
@@ -337,6 +575,12 @@ int set_express_device_irq(Device_Context *device_context, int buf_index, int le
         return IRQ_NOT_ENABLE;
     }
 
+    // 为快照暂停期间不能再往guest写数据，call留在context里，恢复后重新注册
+    if (qatomic_read(&express_transport_paused))
+    {
+        return IRQ_NOT_READY;
+    }
+
     Teleport_Express_Call *origin_call = NULL;
     if ((origin_call = qatomic_xchg(&device_context->irq_call, NULL)) == NULL)
     {
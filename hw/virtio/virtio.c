@@ -1448,10 +1448,15 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * Map the chain at vq->last_avail_idx and advance past it.  The caller
+ * holds rcu_read_lock(), has checked that a head is available and is
+ * responsible for updating the avail event.
+ */
+static void *virtqueue_split_pop_desc(VirtQueue *vq, size_t sz,
+                                      VRingMemoryRegionCaches *caches)
 {
     unsigned int i, head, max = 0;
-    VRingMemoryRegionCaches *caches;
     MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1466,14 +1471,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1488,18 +1485,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
     if (caches->desc.len < max * sizeof(VRingDesc)) {
         virtio_error(vdev, "Cannot map descriptor ring");
         goto done;
@@ -1600,6 +1587,33 @@ err_undo_map:
     goto done;
 }
 
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    VRingMemoryRegionCaches *caches;
+    VirtQueueElement *elem;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /* Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads(). */
+    smp_rmb();
+
+    caches = vring_get_region_caches(vq);
+    if (!caches) {
+        virtio_error(vq->vdev, "Region caches not initialized");
+        return NULL;
+    }
+
+    elem = virtqueue_split_pop_desc(vq, sz, caches);
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return elem;
+}
+
 static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 {
     unsigned int i, max = 0;
@@ -1764,6 +1778,72 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 }
 
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems,
+                                              unsigned int max_elems)
+{
+    VRingMemoryRegionCaches *caches;
+    unsigned int num = 0;
+    int avail;
+
+    RCU_READ_LOCK_GUARD();
+    if (unlikely(!vq->vring.avail)) {
+        return 0;
+    }
+
+    caches = vring_get_region_caches(vq);
+    if (!caches) {
+        virtio_error(vq->vdev, "Region caches not initialized");
+        return 0;
+    }
+
+    /*
+     * Read the avail index once; virtqueue_num_heads() orders the
+     * descriptor reads below after it.
+     */
+    avail = virtqueue_num_heads(vq, vq->last_avail_idx);
+    if (avail <= 0) {
+        return 0;
+    }
+
+    while (num < max_elems && num < (unsigned int)avail) {
+        void *elem = virtqueue_split_pop_desc(vq, sz, caches);
+
+        if (!elem) {
+            break;
+        }
+        elems[num++] = elem;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return num;
+}
+
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max_elems)
+{
+    unsigned int num = 0;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        while (num < max_elems) {
+            void *elem = virtqueue_packed_pop(vq, sz);
+
+            if (!elem) {
+                break;
+            }
+            elems[num++] = elem;
+        }
+        return num;
+    }
+    return virtqueue_split_pop_batch(vq, sz, elems, max_elems);
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -2610,15 +2690,26 @@ static void virtio_irq(VirtQueue *vq)
 }
 
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    virtio_try_notify(vdev, vq);
+}
+
+/*
+ * Like virtio_notify(), but tell the caller whether an interrupt was
+ * actually injected or suppressed by the driver (e.g. via the used event
+ * index), so devices that moderate interrupts can account for it.
+ */
+bool virtio_try_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
         if (!virtio_should_notify(vdev, vq)) {
-            return;
+            return false;
         }
     }
 
     trace_virtio_notify(vdev, vq);
     virtio_irq(vq);
+    return true;
 }
 
 void virtio_notify_config(VirtIODevice *vdev)
@@ -71,6 +71,21 @@ struct RAMBlock {
      * could not have been valid on the source.
      */
     ram_addr_t postcopy_length;
+
+    /*
+     * Location of this block's dirty bitmap and page array in a
+     * mapped-ram migration file, and the bitmap of pages that are
+     * present in the file.  Only used with the mapped-ram capability.
+     */
+    off_t bitmap_offset;
+    off_t pages_offset;
+    unsigned long *file_bmap;
+    /*
+     * Pages picked by the migration thread that still have to be
+     * written to the file, see mapped_ram_write_pages().  On a lazy
+     * restore, the pages of the file not yet placed in guest memory.
+     */
+    unsigned long *mapped_ram_pending;
 };
 #endif
 #endif
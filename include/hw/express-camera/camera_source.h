@@ -0,0 +1,92 @@
+#ifndef EXPRESS_CAMERA_SOURCE_H
+#define EXPRESS_CAMERA_SOURCE_H
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+
+// a frame that is this far off its schedule restarts pacing instead of being waited for or caught up on
+#define CAMERA_PACER_MAX_DRIFT_NS NANOSECONDS_PER_SECOND
+
+typedef struct CameraSource CameraSource;
+
+// called by sources that capture on their own thread whenever a new packet can be read
+typedef void (*CameraSourceNotify)(void *opaque);
+
+/**
+ * @brief where the capturing thread gets its packets from
+ *
+ * read_packet never blocks. It returns 0 with a packet, AVERROR(EAGAIN) if there is
+ * no packet yet, or another negative error if the source is dead.
+ * Packets of a paced source are available immediately and carry the timestamps they
+ * have to be shown at, the capturing thread holds them back until then.
+ * Other sources (the host camera) deliver frames in real time and call notify
+ * when one arrives.
+ */
+struct CameraSource {
+    const char *name;
+
+    // stream description for the decoder, owned by the source
+    AVCodecParameters *codecpar;
+    AVRational time_base;
+    AVRational frame_rate;
+    bool paced;
+
+    // frames the source had to throw away because nobody read them in time
+    uint64_t dropped_frames;
+
+    CameraSourceNotify notify;
+    void *opaque;
+
+    int (*read_packet)(CameraSource *source, AVPacket *pkt);
+    void (*close)(CameraSource *source);
+};
+
+/**
+ * @brief releases frames of the host camera as they are captured
+ *
+ * Takes ownership of format_context, which has to be opened already.
+ * Frames are read on a separate thread, only the newest one is kept.
+ */
+CameraSource *camera_source_from_device(AVFormatContext *format_context, CameraSourceNotify notify, void *opaque);
+
+/**
+ * @brief plays the first video stream of a media file in a loop
+ */
+CameraSource *camera_source_open_file(const char *path);
+
+/**
+ * @brief generates moving yuv420p colour bars
+ */
+CameraSource *camera_source_open_synthetic(int width, int height, AVRational frame_rate);
+
+/**
+ * @brief opens the source described by the camera_source option
+ *
+ * "synthetic[:WxH[@FPS]]" selects the test pattern, anything else is a file path.
+ */
+CameraSource *camera_source_open(const char *spec);
+
+typedef struct CameraPacer {
+    bool started;
+    int64_t start_ns;
+    int64_t start_pts;
+} CameraPacer;
+
+static inline void camera_pacer_reset(CameraPacer *pacer)
+{
+    pacer->started = false;
+}
+
+/**
+ * @brief returns the time (in the clock of now_ns) a packet with pts is due
+ *
+ * The first packet is due immediately and anchors the schedule, a packet too far
+ * off the schedule re-anchors it.
+ */
+int64_t camera_pacer_due(CameraPacer *pacer, int64_t pts, AVRational time_base, int64_t now_ns);
+
+#endif
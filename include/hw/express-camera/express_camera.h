@@ -43,6 +43,10 @@ typedef struct Camera_Context
     QemuThread stream_thread;
     GAsyncQueue *frame_queue;
     OMX_COLOR_FORMATTYPE guest_pix_fmt; // omx pixel format
+    // wakes the capturing thread when a buffer is queued or a frame is captured
+    GMutex wake_lock;
+    GCond wake_cond;
+    bool wake_pending;
 } Camera_Context;
 
 typedef struct Camera_Thread_Context
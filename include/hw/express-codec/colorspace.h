@@ -33,9 +33,24 @@ typedef struct CsConverter {
     GLint mAttributeLocPos;
     GLint mAttributeLocTexCoord;
     void *private; // private pointer for cuda devices
+    // staging buffer of cs_upload()
+    GLuint mUploadBuffer;
+    // rgb -> yuv converters render each plane into its own framebuffer,
+    // mTextureY and mTextureU (interleaved uv) are the render targets
+    enum AVPixelFormat mDstFormat;
+    GLuint mFboY;
+    GLuint mFboUV;
+    GLint mUniformLocSamplerRGB;
+    GLint mUniformLocPlane;
 } CsConverter;
 
 CsConverter *cs_init(const enum AVPixelFormat dst_fmt,
                      const enum AVPixelFormat src_fmt, int width, int height);
 void cs_deinit(CsConverter *conv);
+int cs_upload(CsConverter *conv, const uint8_t *const data[4], const int linesize[4]);
 int cs_convert(const CsConverter *conv, GLuint dst_fbo);
+
+CsConverter *cs_init_from_rgb(const enum AVPixelFormat dst_fmt, int width, int height);
+int cs_convert_from_rgb(const CsConverter *conv, GLuint src_texture);
+size_t cs_planes_size(const CsConverter *conv);
+void cs_read_planes(const CsConverter *conv);
@@ -2,7 +2,8 @@
 
 #include "dcodec_component.h"
 
-#define AVCODEC_MAX_AUDIO_FRAME_SIZE 192000 // Deprecated in ffmpeg
+// the largest sample frame (all channels of one sample) of a packed pcm format
+#define AUDIO_MAX_SAMPLE_FRAME_BYTES (64 * 8)
 
 typedef struct DCodecAudio {
     DCodecComponent base;
@@ -10,13 +11,18 @@ typedef struct DCodecAudio {
     // if the omx client requests a format change mid-stream
     bool mReconfiguring;
 
-    // "Fatal signal 7 (SIGBUS)"!!! SIGBUS is because of an alignment exception
-    // Don't malloc mAudioBuffer", because "NEON optimised stereo fltp to s16
-    // conversion" require 16 byte alignment.
-    uint8_t mAudioBuffer[AVCODEC_MAX_AUDIO_FRAME_SIZE * 4];
+    // input packets are read from the guest into this buffer, grown to the largest packet
+    // seen. av_malloc keeps it aligned for the simd code in the decoders.
+    uint8_t *mInputBuffer;
+    unsigned int mInputBufferSize;
     uint8_t mSilenceBuffer[CODEC_AUDIO_OUTPUT_BUFFER_SIZE];
+    // pcm that is copied to the guest as is: a decoded frame in the target format, or silence
     uint8_t *mResampledData;
     int32_t mResampledDataSize;
+    // mFrame still has samples to be converted by mSwrCtx into the guest buffers,
+    // either not handed to the resampler yet or buffered inside it
+    bool mSwrPending;
+    bool mSwrInputFed;
 
     // c.f. OMX specification: A buffer timestamp associates a presentation time in microseconds 
     // with the data in the buffer used to time the rendering of that data.
@@ -61,6 +61,7 @@ typedef enum CodecStatus {
 } CodecStatus;
 
 enum {
+    ERR_MEM_BUSY            = 4,
     ERR_HWACCEL_FAILED      = 3,
     ERR_INPUT_QUEUE_FULL    = 2,
     ERR_NO_FRM              = 1,
@@ -113,9 +114,31 @@ struct DCodecComponent {
     int (*empty_one_input_buffer)(DCodecComponent *_context);
     int (*fill_one_output_buffer)(DCodecComponent *_context);
     void (*fill_eos_output_buffer)(DCodecComponent *_context);
+    // optional, hands outputs finished asynchronously back to the client,
+    // called at the start of every processing pass
+    void (*release_async_outputs)(DCodecComponent *_context);
 
     // the notify function should be thread-safe
     NotifyCallbackFunc notify;
+
+    // serializes the codec between the worker and the thread handling guest calls
+    GMutex lock;
+
+    // optional per-component worker that runs dcodec_process_buffers whenever
+    // it is woken up by new buffers or by finished mem transfers
+    QemuThread worker;
+    GMutex wake_lock;
+    GCond wake_cond;
+    bool worker_running;
+    bool worker_stop;
+    bool wake_pending;
+    // the last pass stopped on a condition nobody will wake us up for,
+    // i.e. ERR_MEM_BUSY or encoder readbacks still in flight
+    bool need_poll;
+
+    // releases resources bound to the thread that ran the codec (e.g. the GL context),
+    // called on the worker before it exits, or inline if there is no worker
+    void (*release_thread_resources)(DCodecComponent *_context);
 };
 
 int dcodec_init_component(DCodecComponent *context, NotifyCallbackFunc notify);
@@ -130,6 +153,9 @@ void dcodec_notify_null(DCodecComponent *context, CodecCallbackData ccd);
 void dcodec_notify_guest(DCodecComponent *context, CodecCallbackData ccd);
 OMX_ERRORTYPE dcodec_process_this_buffer(DCodecComponent *context, OMX_INOUT BufferDesc *desc);
 void dcodec_process_buffers(DCodecComponent *context);
+void dcodec_component_start_worker(DCodecComponent *context);
+void dcodec_component_stop_worker(DCodecComponent *context);
+void dcodec_component_wake(DCodecComponent *context);
 int dcodec_handle_extradata(DCodecComponent *context);
 void dcodec_fill_eos_output_buffer(DCodecComponent *_context);
 OMX_COLOR_FORMATTYPE pixel_format_av_to_omx(enum AVPixelFormat format);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "libavutil/pixfmt.h"
+
+// frames at least this large are split into stripes converted in parallel
+#define DCODEC_CONVERT_STRIPE_PIXELS (2560 * 1440)
+#define DCODEC_CONVERT_MAX_STRIPES 4
+
+// upper bound of stripes per frame, 1 disables the parallel conversion
+extern int dcodec_convert_max_stripes;
+
+bool dcodec_convert_supported(enum AVPixelFormat src_fmt, enum AVPixelFormat dst_fmt);
+bool dcodec_convert_frame(const uint8_t *const src_data[4], const int src_linesize[4],
+                          enum AVPixelFormat src_fmt,
+                          uint8_t *const dst_data[4], const int dst_linesize[4],
+                          enum AVPixelFormat dst_fmt,
+                          int width, int height);
+const char *dcodec_convert_accel_name(void);
+bool dcodec_convert_next_accel(void);
+void dcodec_convert_reset_accel(void);
@@ -17,6 +17,36 @@ enum CropSettingsMode {
     kCropChanged,
 };
 
+// one scaler per express-mem worker, so that consecutive frames of the same
+// component can be converted in parallel without sharing swscale state
+#define DCODEC_SCALER_NUM 4
+
+typedef struct DCodecScaler {
+    GMutex lock;
+    struct SwsContext *sws_ctx;
+    // staging buffer for guest memory that cannot be mapped directly
+    uint8_t *buf;
+    size_t buf_size;
+} DCodecScaler;
+
+// gbuffer inputs of the encoder are read back through a ring of pixel-pack
+// buffers, so that encoding one frame overlaps the rendering of the next
+#define DCODEC_READBACK_NUM 3
+
+typedef struct DCodecReadback {
+    GLuint pbo;
+    size_t pbo_size;
+    // signaled once the gpu has written the frame into pbo, 0 after the
+    // pixels have been copied into frame
+    GLsync fence;
+    // format of the pixels in pbo, nv12 when converted on the gpu
+    enum AVPixelFormat format;
+    int width, height;
+    int64_t pts;
+    int sync_id;
+    AVFrame *frame;
+} DCodecReadback;
+
 typedef struct DCodecVideo {
     DCodecComponent base;
 
@@ -32,6 +62,36 @@ typedef struct DCodecVideo {
     GHashTable *mInputMap;
 
     CsConverter *mCsConv;
+    // converts software frames into gbuffers on the gpu
+    CsConverter *mUploadConv;
+    bool mUploadConvFailed;
+
+    DCodecScaler mScalers[DCODEC_SCALER_NUM];
+
+    // async scaling tasks that deliver into guest memory are numbered when
+    // they are submitted, and notify the guest strictly in that order
+    GMutex mOutputLock;
+    GCond mOutputCond;
+    uint64_t mOutputSubmitted;
+    uint64_t mOutputDelivered;
+    // finished tasks by number, waiting for the earlier ones to be released
+    GHashTable *mOutputFinished;
+    // a thread is releasing finished tasks, others leave the new ones to it
+    bool mOutputReleasing;
+    // scaling and texture transfer tasks still referencing this component
+    int mScaleTasks;
+
+    DCodecReadback mReadbacks[DCODEC_READBACK_NUM];
+    // mReadbackHead is the oldest readback still to be sent to the encoder
+    int mReadbackHead;
+    int mReadbackCount;
+    // readbacks queued before a reset, they are not sent to the encoder
+    int mReadbackDropped;
+    // the eos buffer has been read back, but earlier frames still wait for the encoder
+    bool mReadbackEosPending;
+    GLuint mReadbackFbo;
+    CsConverter *mRgbConv;
+    bool mRgbConvFailed;
 
     GLFWwindow* window;
     GLuint mDebugTexture;
@@ -44,6 +104,13 @@ OMX_ERRORTYPE dcodec_vdec_destroy_component(DCodecComponent *_context);
 OMX_ERRORTYPE dcodec_vdec_get_parameter(DCodecComponent *_context, OMX_IN OMX_INDEXTYPE index, OMX_PTR params);
 OMX_ERRORTYPE dcodec_vdec_set_parameter(DCodecComponent *_context, OMX_IN OMX_INDEXTYPE index, OMX_PTR params);
 
+void dcodec_video_release_thread_resources(DCodecComponent *_context);
+void dcodec_video_init_scalers(DCodecVideo *context);
+void dcodec_video_deinit_scalers(DCodecVideo *context);
+DCodecScaler *dcodec_video_acquire_scaler(DCodecVideo *context);
+void dcodec_video_release_scaler(DCodecScaler *scaler);
+uint8_t *dcodec_scaler_get_buffer(DCodecScaler *scaler, size_t size);
+
 DCodecComponent* dcodec_venc_init_component(enum OMX_VIDEO_CODINGTYPE codingType, NotifyCallbackFunc notify);
 OMX_ERRORTYPE dcodec_venc_get_parameter(DCodecComponent *_context, OMX_IN OMX_INDEXTYPE index, OMX_PTR params);
 OMX_ERRORTYPE dcodec_venc_set_parameter(DCodecComponent *_context, OMX_IN OMX_INDEXTYPE index, OMX_PTR params);
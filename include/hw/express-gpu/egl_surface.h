@@ -92,6 +92,8 @@ typedef struct Hardware_Buffer{
 
      GLsync data_sync;
      GLsync delete_sync;
+     // 进入回收队列时插入的fence，触发后gbuffer才真正释放
+     GLsync reap_sync;
      uint64_t gbuffer_id;
 
      int remain_life_time;
@@ -141,6 +143,8 @@ typedef struct Window_Buffer
      eglConfig *config;
 
      EGLSurface guest_surface;
+     // 创建时guest传入的config，快照恢复时用它重新创建surface
+     EGLConfig guest_config;
 
      Hardware_Buffer *gbuffer;
      uint64_t gbuffer_id;
@@ -193,6 +197,8 @@ Hardware_Buffer *create_gbuffer(int width, int height, int sampler_num,
 
 Hardware_Buffer *create_gbuffer_from_surface(Window_Buffer *surface);
 
+Window_Buffer *render_surface_create(EGLConfig eglconfig, int width, int height, int surface_type);
+
 void connect_gbuffer_to_surface(Hardware_Buffer *gbuffer, Window_Buffer *surface);
 
 void reverse_gbuffer(Hardware_Buffer *gbuffer);
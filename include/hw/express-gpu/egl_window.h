@@ -7,6 +7,8 @@
 #endif
 
 #ifdef __linux__
+#include <stdint.h>
+
 typedef void (*EGLproc)(void);
 
 typedef int EGLint;
@@ -42,6 +44,27 @@ typedef void *EGLSurface;
 #define EGL_NO_DISPLAY EGL_CAST(EGLDisplay, 0)
 #define EGL_NO_SURFACE EGL_CAST(EGLSurface, 0)
 
+// used by the headless backend, which runs without a window system
+typedef void *EGLImageKHR;
+typedef void *EGLClientBuffer;
+typedef uint64_t EGLuint64KHR;
+
+#define EGL_FALSE 0
+#define EGL_TRUE 1
+#define EGL_DEFAULT_DISPLAY EGL_CAST(void *, 0)
+#define EGL_NO_IMAGE_KHR EGL_CAST(EGLImageKHR, 0)
+
+#define EGL_EXTENSIONS 0x3055
+#define EGL_SURFACE_TYPE 0x3033
+#define EGL_PBUFFER_BIT 0x0001
+#define EGL_RENDERABLE_TYPE 0x3040
+#define EGL_OPENGL_BIT 0x0008
+#define EGL_OPENGL_API 0x30A2
+#define EGL_CONTEXT_OPENGL_PROFILE_MASK 0x30FD
+#define EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT 0x00000001
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#define EGL_GL_TEXTURE_2D_KHR 0x30B1
+
 // EGL function pointer typedefs
 typedef EGLBoolean (*PFN_eglGetConfigAttrib)(EGLDisplay, EGLConfig, EGLint, EGLint *);
 typedef EGLBoolean (*PFN_eglGetConfigs)(EGLDisplay, EGLConfig *, EGLint, EGLint *);
@@ -59,6 +82,15 @@ typedef EGLBoolean (*PFN_eglDestroyContext)(EGLDisplay, EGLContext);
 typedef EGLBoolean (*PFN_eglMakeCurrent)(EGLDisplay, EGLSurface, EGLSurface, EGLContext);
 typedef EGLBoolean (*PFN_eglSwapInterval)(EGLDisplay, EGLint);
 
+typedef EGLproc (*PFN_eglGetProcAddress)(const char *);
+typedef EGLDisplay (*PFN_eglGetDisplay)(void *);
+typedef EGLDisplay (*PFN_eglGetPlatformDisplay)(EGLenum, void *, const EGLint *);
+typedef const char *(*PFN_eglQueryString)(EGLDisplay, EGLint);
+typedef EGLImageKHR (*PFN_eglCreateImage)(EGLDisplay, EGLContext, EGLenum, EGLClientBuffer, const EGLint *);
+typedef EGLBoolean (*PFN_eglDestroyImage)(EGLDisplay, EGLImageKHR);
+typedef EGLBoolean (*PFN_eglExportDMABUFImageQueryMESA)(EGLDisplay, EGLImageKHR, int *, int *, EGLuint64KHR *);
+typedef EGLBoolean (*PFN_eglExportDMABUFImageMESA)(EGLDisplay, EGLImageKHR, int *, EGLint *, EGLint *);
+
 #endif
 
 #ifdef _WIN32
@@ -113,4 +145,22 @@ void *egl_createContext();
 int egl_makeCurrent(void *context);
 void egl_destroyContext(void *context);
 
+#ifdef __linux__
+/**
+ * Create the display and the main context of the render thread without a window system,
+ * on the surfaceless platform of Mesa if available, so that llvmpipe works without a gpu or X server.
+ * The main context is made current on success.
+ * return 0 on success, or -1 on error.
+*/
+int egl_headless_create(void **dpy, void **context);
+void egl_headless_destroy(void);
+void *egl_get_proc_address(const char *name);
+
+/**
+ * Export a texture of the main context as a dmabuf, which is owned by the caller.
+ * return 0 on success, or -1 if the driver cannot export it.
+*/
+int egl_export_texture_dmabuf(unsigned int texture, int *fd, int *stride, int *fourcc, uint64_t *modifier);
+#endif
+
 #endif
\ No newline at end of file
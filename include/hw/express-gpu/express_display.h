@@ -41,6 +41,8 @@ typedef struct Display_Status
 
 #define FUNID_Show_Window_FLIP_V (DEVICE_FUN_ID(EXPRESS_DISPLAY_DEVICE_ID, 15))
 
+#define FUNID_Get_Present_Timing (DEVICE_FUN_ID(EXPRESS_DISPLAY_DEVICE_ID, SYNC_FUN_ID(16)))
+
 
 #define PARA_NUM_Commit_Composer_Layer 1
 #define PARA_NUM_Set_Sync_Flag 1
@@ -48,6 +50,7 @@ typedef struct Display_Status
 #define PARA_NUM_Get_Display_Mods 1
 #define PARA_NUM_Set_Display_Status 1
 #define PARA_NUM_Get_Display_Status 1
+#define PARA_NUM_Get_Present_Timing 1
 
 
 extern int display_is_open;
@@ -16,6 +16,9 @@ typedef struct Process_Context{
     GHashTable *gbuffer_map;
 
     int thread_cnt;
+
+    // 快照中这个进程的记录，第一个调用的线程用它重建GL对象
+    void *snapshot_restore;
 } Process_Context;
 
 typedef struct
@@ -30,8 +33,21 @@ typedef struct
 
     Opengl_Context *opengl_context;
     Egl_Display *egl_display;
+
+    // 是否已经检查过快照恢复
+    int snapshot_checked;
 } Render_Thread_Context;
 
+/**
+ * @brief 遍历所有进程，key为进程id，value为Process_Context，只能在guest调用都处理完时使用
+ */
+void express_gpu_foreach_process(GHFunc func, void *data);
+
+/**
+ * @brief 遍历所有渲染线程，value为Render_Thread_Context，只能在guest调用都处理完时使用
+ */
+void express_gpu_foreach_thread(GHFunc func, void *data);
+
 
 #define FUNID_GPU_Gbuffer_Host_To_Guest ((EXPRESS_GPU_DEVICE_ID << 32u) + 5001)
 
@@ -0,0 +1,58 @@
+#ifndef QEMU_EXPRESS_GPU_CAPTURE_H
+#define QEMU_EXPRESS_GPU_CAPTURE_H
+
+#include "qemu/osdep.h"
+#include "hw/teleport-express/express_device_common.h"
+
+/**
+ * @brief GL调用流的录制与回放
+ *
+ * 录制时处理线程在处理每个express-gpu与express-mem的call之前，把call的各个id与参数内容原样写入文件，
+ * guest写给host的gbuffer内容在传输时另外记录。host写回guest的参数只记录长度。
+ * 文件由一个文件头和一串记录组成，所有整数都是小端：
+ *   文件头 magic(8) | 版本(4) | 保留(4)
+ *   CALL    类型(1) | 时间(8) | id(8) | thread_id(8) | process_id(8) | unique_id(8) | 参数数目(4) | 参数...
+ *           每个参数为 类型(1) | 长度(4) | 内容（只有数据参数才有）
+ *   GBUFFER 类型(1) | 时间(8) | gbuffer_id(8) | 长度(4) | 内容
+ *   END     类型(1) | 时间(8)
+ *
+ * 回放不需要guest，回放线程按文件中的顺序把call重新包装好，交给与guest发来的call相同的分发与解码函数，
+ * 每次等上一个call处理完再推送下一个，最后打印每个fun_id的耗时、每秒调用数与帧时间，然后关闭虚拟机。
+ */
+
+#define EXPRESS_GPU_CAPTURE_MAGIC "EXGLCAP"
+#define EXPRESS_GPU_CAPTURE_VERSION 1
+
+#define CAPTURE_RECORD_CALL 1
+#define CAPTURE_RECORD_GBUFFER 2
+#define CAPTURE_RECORD_END 3
+
+#define CAPTURE_PARA_DATA 0
+#define CAPTURE_PARA_NULL 1
+#define CAPTURE_PARA_OUTPUT 2
+
+// 正在录制时为1，用于在调用频繁的地方提前判断
+extern int express_gpu_capture_enable;
+
+/**
+ * @brief 开始录制，设备realize时调用
+ *
+ * @param path 输出文件的路径
+ * @return 成功返回0
+ */
+int express_gpu_capture_start(const char *path);
+
+/**
+ * @brief 记录gbuffer当前的guest端内容，在guest写给host的传输开始前调用
+ */
+void express_gpu_capture_gbuffer(struct Hardware_Buffer *gbuffer);
+
+/**
+ * @brief 虚拟机开始运行后回放文件中的调用，设备realize时调用
+ *
+ * @param path 录制得到的文件
+ * @return 文件无法打开或格式不对时返回非0
+ */
+int express_gpu_replay_start(const char *path);
+
+#endif
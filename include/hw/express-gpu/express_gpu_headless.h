@@ -0,0 +1,47 @@
+#ifndef QEMU_EXPRESS_GPU_HEADLESS_H
+#define QEMU_EXPRESS_GPU_HEADLESS_H
+
+#include "qemu/osdep.h"
+
+/**
+ * @brief 无窗口模式下的显示输出
+ *
+ * 合成器把画面合成到一个离屏的framebuffer里，再通过QEMU的console交给vnc、dbus等显示后端。
+ * 有支持dmabuf的GL显示后端（例如egl-headless）时，直接把纹理导出为dmabuf交给它，
+ * 否则把画面读回到console的DisplaySurface里。没有显示后端在看的时候什么都不做。
+ */
+
+/**
+ * @brief 创建无窗口模式的console，必须在显示后端初始化之前（设备realize时）调用
+ *
+ * @param dev 所属的设备
+ * @param width 画面宽度
+ * @param height 画面高度
+ */
+void express_headless_console_init(DeviceState *dev, int width, int height);
+
+/**
+ * @brief 在渲染线程上创建离屏的framebuffer，调用时需要合成器的context是current的
+ *
+ * @return 成功返回true
+ */
+bool express_headless_output_init(void);
+
+/**
+ * @brief 绑定离屏framebuffer，之后的合成都画到它里面
+ */
+void express_headless_output_bind(void);
+
+/**
+ * @brief 上一帧还没有被显示后端取走，此时不能往framebuffer里画
+ */
+bool express_headless_output_busy(void);
+
+/**
+ * @brief 合成完一帧后调用，把这一帧交给显示后端
+ */
+void express_headless_output_present(void);
+
+void express_headless_output_destroy(void);
+
+#endif
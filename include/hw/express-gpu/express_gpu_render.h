@@ -9,6 +9,8 @@
 #ifdef _WIN32
 #define GLFW_EXPOSE_NATIVE_WIN32
 #define GLFW_EXPOSE_NATIVE_WGL
+#elif defined(__linux__)
+#define GLFW_EXPOSE_NATIVE_EGL
 #else
 #define GLFW_EXPOSE_NATIVE_COCOA
 #define GLFW_EXPOSE_NATIVE_NSGL
@@ -19,6 +21,8 @@
 #ifdef _WIN32
 #define GLFW_EXPOSE_NATIVE_WIN32
 #define GLFW_EXPOSE_NATIVE_WGL
+#elif defined(__linux__)
+#define GLFW_EXPOSE_NATIVE_EGL
 #else
 #define GLFW_EXPOSE_NATIVE_COCOA
 #define GLFW_EXPOSE_NATIVE_NSGL
@@ -55,6 +59,7 @@
 #define MAIN_DESTROY_GBUFFER 9
 #define MAIN_CANCEL_GBUFFER 10
 #define MAIN_PAINT_LAYERS 11
+#define MAIN_SNAPSHOT 12
 
 #define GBUFFER_TYPE_WINDOW 1
 #define GBUFFER_TYPE_TEXTURE 2
@@ -146,6 +151,8 @@ void add_gbuffer_to_global(Hardware_Buffer *global_gbuffer);
 
 Hardware_Buffer *get_gbuffer_from_global_map(uint64_t gbuffer_id);
 
+void gbuffer_global_map_foreach(GHFunc func, void *data);
+
 void opengl_paint_gbuffer(Hardware_Buffer *gbuffer);
 
 void send_message_to_main_window(int message_code, void *data);
@@ -0,0 +1,65 @@
+#ifndef EXPRESS_GPU_SNAPSHOT_H
+#define EXPRESS_GPU_SNAPSHOT_H
+
+#include "hw/teleport-express/express_device_common.h"
+#include "hw/express-gpu/express_gpu.h"
+
+/**
+ * @brief express-gpu的快照保存与恢复
+ *
+ * 保存在渲染主线程上进行，主线程的context与所有子context共享对象，因此可以读到所有纹理、缓冲区、
+ * 着色器与program。数据按段写入快照，每段为 tag | 版本 | 长度 | 内容，读取时跳过不认识的段：
+ *   GBUFFER 全局表中纹理类型的gbuffer
+ *   PROCESS 一个guest进程的context、surface、EGLImage以及每个线程当前绑定的context
+ *   OBJECTS 一个共享组中的对象，一个组的对象可能分成多段
+ * 纹理与缓冲区的内容先全部拷贝到同一个暂存PBO中，一批只等待一次fence再统一映射读取，
+ * 避免逐个对象同步读取时GPU流水线被反复排空。
+ *
+ * 恢复时gbuffer在渲染主线程上立即重建；进程的context在该进程第一次调用时重建，
+ * 纹理和缓冲区只生成新的名字，内容在第一次取host id时才上传。
+ * FBO、VAO等容器对象属于各自的context，主线程读不到，恢复后是空对象，需要guest重新设置。
+ */
+
+// post_load中使用的格式版本，pre_save写入的版本与此相同
+#define EXPRESS_GPU_STATE_VERSION 1
+
+int express_gpu_pre_save(QEMUFile *f, Express_Device_Info *info);
+
+int express_gpu_post_load(QEMUFile *f, Express_Device_Info *info, int version_id);
+
+/**
+ * @brief 渲染主线程收到MAIN_SNAPSHOT消息时调用
+ */
+void express_gpu_snapshot_handle_job(void *data);
+
+/**
+ * @brief 渲染主线程启动时调用，重建快照中的gbuffer
+ */
+void express_gpu_snapshot_restore_gbuffers(void);
+
+/**
+ * @brief 新建Process_Context时取出快照中对应进程的记录，没有则返回NULL
+ */
+void *express_gpu_snapshot_take_process(uint64_t process_id);
+
+/**
+ * @brief 线程的第一个调用之前执行，重建进程的GL对象（只有第一个线程会做）并恢复该线程当前绑定的context
+ */
+void express_gpu_snapshot_restore_thread(Render_Thread_Context *thread_context);
+
+/**
+ * @brief 进程退出时释放还没有用完的恢复记录
+ */
+void express_gpu_snapshot_drop_process(void *record);
+
+/**
+ * @brief 对象第一次被使用时上传快照中的内容，调用时context必须是current的
+ */
+void express_gpu_snapshot_restore_object(void *context, Resource_Map_Status *status, unsigned int guest_id);
+
+/**
+ * @brief 对象被guest删除时丢弃还没有上传的内容
+ */
+void express_gpu_snapshot_forget_objects(Resource_Map_Status *status, int n, const unsigned int *guest_ids);
+
+#endif
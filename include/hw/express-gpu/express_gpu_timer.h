@@ -0,0 +1,118 @@
+#ifndef QEMU_EXPRESS_GPU_TIMER_H
+#define QEMU_EXPRESS_GPU_TIMER_H
+
+#include "hw/teleport-express/teleport_express_call.h"
+#include "hw/express-gpu/glv3_context.h"
+
+/**
+ * @brief GL_EXT_disjoint_timer_query与每个context的帧统计
+ *
+ * guest的GL_TIME_ELAPSED与GL_TIMESTAMP查询直接对应host的同名查询。计时查询结束后记下来，
+ * 每次swap时不阻塞地检查哪些结果已经可用并缓存，guest查询GL_QUERY_RESULT_AVAILABLE与GL_QUERY_RESULT时优先用缓存的结果，
+ * 只有guest在结果可用之前就要GL_QUERY_RESULT时才会等待GPU。
+ *
+ * 每个context还有一个帧统计环，每次swap记录一帧：这一帧的GL调用解码耗时、回读耗时、
+ * GPU上从这一帧第一条命令到swap的时间（两个timestamp查询之差，结果可用后补上）、
+ * 以及swap到之后第一次合成显示的延迟。guest通过FUNID_glGetFrameStats读取当前context的记录，
+ * host上通过QMP的x-query-express-gpu-frames（HMP: info express-gpu-frames）查看所有context的汇总。
+ */
+
+// 每个context保留的帧数
+#define FRAME_STATS_RING_SIZE 64
+
+/**
+ * @brief 一帧的统计信息，guest通过FUNID_glGetFrameStats读取，时间都是host单调时钟的ns
+ */
+typedef struct Express_Frame_Stats
+{
+    // 这个context的第几次swap，从1开始
+    uint64_t frame_sequence;
+    // swap的时间
+    int64_t swap_time_ns;
+    // 这一帧所有GL调用在host上的解码与执行时间，不含回读
+    int64_t decode_ns;
+    // glReadPixels与glMapBufferRange读取的耗时
+    int64_t readback_ns;
+    // GPU上从这一帧的第一条命令到swap的时间，还没有结果时为-1
+    int64_t gpu_ns;
+    // swap之后到合成显示的延迟，还没有显示时为-1
+    int64_t compose_latency_ns;
+    // 这一帧的GL调用次数
+    uint32_t call_num;
+    uint32_t reserved;
+} __attribute__((packed, aligned(4))) Express_Frame_Stats;
+
+/**
+ * @brief FUNID_glGetFrameStats返回的头部，后面紧跟frame_num个Express_Frame_Stats，从旧到新排列
+ */
+typedef struct Express_Frame_Stats_Header
+{
+    uint32_t frame_num;
+    uint32_t ring_size;
+    // 这个context一共swap的次数
+    uint64_t total_frames;
+} __attribute__((packed, aligned(4))) Express_Frame_Stats_Header;
+
+// 是否记录帧统计，为false时只处理guest的计时查询
+extern bool express_gpu_frame_stats;
+
+/**
+ * @brief glBeginQuery时调用，记录guest正在进行的GL_TIME_ELAPSED查询
+ */
+void gpu_timer_begin_query(void *context, GLenum target, GLuint id);
+
+/**
+ * @brief glEndQuery时调用，GL_TIME_ELAPSED查询结束后等待结果
+ */
+void gpu_timer_end_query(void *context, GLenum target);
+
+void d_glQueryCounterEXT_special(void *context, GLuint id, GLenum target);
+
+/**
+ * @brief 代替host的glGetQueryObject*，只处理计时查询
+ *
+ * @return id是计时查询时返回true并写入value，否则返回false，由调用者查询host
+ */
+bool gpu_timer_get_query_result(void *context, GLuint id, GLenum pname, GLuint64 *value);
+
+void d_glGetQueryObjectui64vEXT_special(void *context, GLuint id, GLenum pname, GLuint64 *params);
+
+/**
+ * @brief glDeleteQueries时调用，删掉缓存的结果
+ */
+void gpu_timer_delete_queries(void *context, GLsizei n, const GLuint *ids);
+
+/**
+ * @brief 查询GL_GPU_DISJOINT_EXT，读取后清除
+ */
+GLint gpu_timer_get_disjoint(void *context);
+
+/**
+ * @brief 每个GL调用解码前调用，返回开始时间，不需要统计时返回0
+ */
+int64_t gpu_timer_call_begin(void *context);
+
+/**
+ * @brief 每个GL调用解码后调用
+ *
+ * @param call_id 调用的id，用来区分回读类的调用
+ * @param start_ns gpu_timer_call_begin的返回值
+ */
+void gpu_timer_call_end(void *context, uint64_t call_id, int64_t start_ns);
+
+/**
+ * @brief eglSwapBuffers时调用，结束当前帧的统计并检查之前的查询结果，调用时context必须是current的
+ */
+void gpu_timer_frame_end(void *context);
+
+/**
+ * @brief FUNID_glGetFrameStats使用，写入头部与最近的帧统计，返回写入的长度
+ */
+size_t gpu_timer_read_frame_stats(void *context, void *buf, size_t buf_len);
+
+/**
+ * @brief context销毁时调用，调用时context必须是current的
+ */
+void gpu_timer_destroy(void *context);
+
+#endif
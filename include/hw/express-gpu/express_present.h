@@ -0,0 +1,114 @@
+#ifndef QEMU_EXPRESS_PRESENT_H
+#define QEMU_EXPRESS_PRESENT_H
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+
+/**
+ * @brief 按固定刷新率合成与显示
+ *
+ * 渲染线程按一个单调时钟（linux上为timerfd）的节拍醒来，每个节拍最多合成一次，
+ * 合成时只取guest最新提交的一帧，两个节拍之间被覆盖的帧计为丢帧。
+ * 每次显示后记录显示时间与序号，guest通过FUNID_Get_Present_Timing获取，
+ * 用来让guest的Choreographer对齐host的合成节拍，而不是一直过量绘制。
+ */
+
+/**
+ * @brief guest通过FUNID_Get_Present_Timing读取到的显示时间信息，时间都是host的单调时钟
+ */
+typedef struct Present_Timing
+{
+    // 已经显示的帧数
+    uint64_t present_sequence;
+    // 最近一次显示出去的是guest第几次提交的帧（从1开始，与Commit_Composer_Layer的次数对应）
+    uint64_t frame_sequence;
+    // 最近一次显示的时间
+    int64_t present_time_ns;
+    // 节拍间隔
+    int64_t refresh_period_ns;
+    // 下一个节拍的时间
+    int64_t next_present_ns;
+    // guest调用时host的时间，guest用它把上面的时间换算到自己的时钟
+    int64_t host_time_ns;
+    // guest提交了但是被更新的帧覆盖、没有显示出去的帧数
+    uint64_t dropped_frames;
+} __attribute__((packed, aligned(4))) Present_Timing;
+
+typedef struct Present_Clock
+{
+    int64_t period_ns;
+    // 下一个节拍的时间
+    int64_t next_tick_ns;
+#ifdef __linux__
+    int timer_fd;
+#endif
+
+    // 统计信息
+    uint64_t ticks;
+    // 醒来时已经错过的节拍数
+    uint64_t missed_ticks;
+    // 醒来时间相对节拍时间的延迟
+    int64_t jitter_sum_ns;
+    int64_t jitter_max_ns;
+} Present_Clock;
+
+/**
+ * @brief 初始化节拍时钟，第一个节拍在一个周期之后
+ *
+ * @param hz 刷新率
+ * @return 成功返回0
+ */
+int present_clock_init(Present_Clock *clock, int hz);
+
+void present_clock_destroy(Present_Clock *clock);
+
+/**
+ * @brief 距离下一个节拍还有多久，已经过了则返回0
+ */
+int64_t present_clock_until_tick(Present_Clock *clock);
+
+/**
+ * @brief 阻塞直到下一个节拍
+ *
+ * @return 从上次返回到现在经过的节拍数，正常为1，大于1表示有节拍被错过了
+ */
+uint64_t present_clock_wait(Present_Clock *clock);
+
+/**
+ * @brief 重置抖动与错过节拍的统计
+ */
+void present_clock_reset_stats(Present_Clock *clock);
+
+/**
+ * @brief 显示线程每提交一帧调用一次（display线程）
+ *
+ * @return 这一帧的序号
+ */
+uint64_t present_commit_frame(void);
+
+/**
+ * @brief 节拍到了准备合成时调用（渲染线程），取guest最新提交的帧
+ *
+ * @return 有新的帧返回true，中间被覆盖的帧计入丢帧
+ */
+bool present_latch_frame(void);
+
+/**
+ * @brief 合成并交给窗口或显示后端之后调用（渲染线程）
+ *
+ * @param clock 渲染线程的节拍时钟
+ * @param present_ns 显示的时间
+ */
+void present_frame_done(Present_Clock *clock, int64_t present_ns);
+
+/**
+ * @brief 获取最近一次显示的时间信息（display线程）
+ */
+void present_get_timing(Present_Timing *timing);
+
+/**
+ * @brief 清空记录，只在没有帧提交时调用（例如测试中）
+ */
+void present_reset(void);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef QEMU_EXPRESS_GPU_GBUFFER_REAPER_H
+#define QEMU_EXPRESS_GPU_GBUFFER_REAPER_H
+
+#include "hw/express-gpu/egl_surface.h"
+
+/**
+ * @brief gbuffer的延迟销毁与纹理复用
+ *
+ * surface销毁后的gbuffer先进入dying阶段，remain_life_time按主窗口的刷新节拍递减，期间guest还可以继续使用它。
+ * 寿命到了之后进入回收队列，此时插入一个fence，等它之前所有对gbuffer的读写都完成后才真正释放。
+ * 释放时常用尺寸与格式的纹理和renderbuffer放到一个小池子里，create_gbuffer时优先从池子里取，池子里的对象过一段时间没用就删掉。
+ */
+
+/**
+ * @brief 主窗口线程使用，surface已销毁的gbuffer进入dying阶段
+ */
+void gbuffer_reaper_add_dying(Hardware_Buffer *gbuffer);
+
+/**
+ * @brief 主窗口线程使用，取消gbuffer的销毁流程
+ */
+void gbuffer_reaper_cancel_dying(Hardware_Buffer *gbuffer);
+
+/**
+ * @brief 不再使用的gbuffer放入回收队列，调用线程必须有current的context，调用之后gbuffer不能再被使用
+ */
+void gbuffer_reaper_retire(Hardware_Buffer *gbuffer);
+
+/**
+ * @brief 主窗口线程每个刷新节拍调用一次，不管有没有画面显示
+ */
+void gbuffer_reaper_run(void);
+
+/**
+ * @brief 主窗口线程退出时调用，释放所有还在等待的gbuffer与池子里的对象
+ */
+void gbuffer_reaper_destroy(void);
+
+/**
+ * @brief create_gbuffer使用，从池子里取出与gbuffer的尺寸和格式一致的纹理与renderbuffer
+ *
+ * @return bool 取到时返回true，此时gbuffer的data_texture等对象已经设置好
+ */
+bool gbuffer_pool_take(Hardware_Buffer *gbuffer);
+
+#endif
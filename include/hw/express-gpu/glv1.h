@@ -4,16 +4,196 @@
 #include "hw/teleport-express/express_device_common.h"
 #include "hw/express-gpu/glv3_context.h"
 
+/**
+ * host使用的是core profile，没有固定管线，guest发过来的GLES1固定管线状态都记录在这里，
+ * 查询时从这里返回，glDrawTexiOES绘制时按照这些状态生成对应的core profile着色器
+ */
+
+#define FIXED_MAX_TEXTURE_UNITS 4
+#define FIXED_MAX_LIGHTS 8
+#define FIXED_MAX_CLIP_PLANES 6
+
+#define FIXED_TO_FLOAT(x) ((GLfloat)(x) / 65536.0f)
+
+typedef struct Fixed_Texture_Env
+{
+    // GL_TEXTURE_2D是否开启
+    GLboolean enabled;
+
+    GLenum mode;
+    GLenum combine_rgb;
+    GLenum combine_alpha;
+    GLenum src_rgb[3];
+    GLenum src_alpha[3];
+    GLenum operand_rgb[3];
+    GLenum operand_alpha[3];
+    GLfloat rgb_scale;
+    GLfloat alpha_scale;
+    GLfloat color[4];
+
+    GLboolean coord_replace;
+    GLint tex_gen_mode;
+    GLfloat tex_coord[4];
+} Fixed_Texture_Env;
+
+typedef struct Fixed_Light
+{
+    GLboolean enabled;
+    GLfloat ambient[4];
+    GLfloat diffuse[4];
+    GLfloat specular[4];
+    GLfloat position[4];
+    GLfloat spot_direction[3];
+    GLfloat spot_exponent;
+    GLfloat spot_cutoff;
+    GLfloat constant_attenuation;
+    GLfloat linear_attenuation;
+    GLfloat quadratic_attenuation;
+} Fixed_Light;
+
+typedef struct Fixed_Material
+{
+    GLfloat ambient[4];
+    GLfloat diffuse[4];
+    GLfloat specular[4];
+    GLfloat emission[4];
+    GLfloat shininess;
+} Fixed_Material;
+
+typedef struct Fixed_Function_State
+{
+    Fixed_Texture_Env texture_env[FIXED_MAX_TEXTURE_UNITS];
+    // guest开关过GL_TEXTURE_2D之后才按照enabled决定是否采样，否则与之前一样0号纹理单元总是采样
+    GLboolean texture_enable_seen;
+
+    GLboolean alpha_test;
+    GLenum alpha_func;
+    GLfloat alpha_ref;
+
+    GLboolean fog;
+    GLenum fog_mode;
+    GLfloat fog_density;
+    GLfloat fog_start;
+    GLfloat fog_end;
+    GLfloat fog_color[4];
+
+    GLboolean lighting;
+    GLboolean color_material;
+    GLboolean normalize;
+    GLboolean rescale_normal;
+    GLboolean light_model_two_side;
+    GLfloat light_model_ambient[4];
+    Fixed_Light lights[FIXED_MAX_LIGHTS];
+    // 0为正面，1为背面
+    Fixed_Material material[2];
+
+    GLenum shade_model;
+    GLfloat current_color[4];
+    GLfloat current_normal[3];
+
+    GLboolean point_sprite;
+    GLfloat point_size;
+    GLfloat point_size_min;
+    GLfloat point_size_max;
+    GLfloat point_fade_threshold;
+    GLfloat point_distance_attenuation[3];
+
+    GLboolean clip_plane_enabled[FIXED_MAX_CLIP_PLANES];
+    GLfloat clip_planes[FIXED_MAX_CLIP_PLANES][4];
+
+    // glMatrixMode不会发到host，这里只记录guest最后设置的矩阵，用于glQueryMatrixxOES
+    GLfloat matrix[16];
+
+    // 按照纹理环境、alpha test、fog生成的着色器，program的uniform是共享的，所以每个context单独一份
+    GHashTable *program_cache;
+} Fixed_Function_State;
+
+/**
+ * @brief 获取context的固定管线状态，第一次使用时按照GLES1的默认值初始化
+ */
+Fixed_Function_State *get_fixed_function_state(void *context);
+
+/**
+ * @brief glEnable/glDisable时调用，GLES1 context中cap为固定管线的开关时记录下来并返回true，此时不能再发给host
+ */
+bool fixed_function_enable(void *context, GLenum cap, GLboolean enable);
+
+/**
+ * @brief context销毁时调用，释放生成的着色器，调用时context必须是current的
+ */
+void fixed_function_state_destroy(void *context);
+
 void d_glTexEnvf_special(void *context, GLenum target, GLenum pname, GLfloat param);
 
 void d_glTexEnvi_special(void *context, GLenum target, GLenum pname, GLint param);
 
 void d_glTexEnvx_special(void *context, GLenum target, GLenum pname, GLfixed param);
 
+void d_glTexEnvxv_special(void *context, GLenum target, GLenum pname, const GLfixed *params);
+
 void d_glTexParameterx_special(void *context, GLenum target, GLenum pname, GLint param);
 
 void d_glShadeModel_special(void *context, GLenum mode);
 
+void d_glAlphaFuncx_special(void *context, GLenum func, GLfixed ref);
+
+void d_glColor4x_special(void *context, GLfixed red, GLfixed green, GLfixed blue, GLfixed alpha);
+
+void d_glNormal3x_special(void *context, GLfixed nx, GLfixed ny, GLfixed nz);
+
+void d_glMultiTexCoord4x_special(void *context, GLenum texture, GLfixed s, GLfixed t, GLfixed r, GLfixed q);
+
+void d_glFogxv_special(void *context, GLenum pname, const GLfixed *params);
+
+void d_glLightModelxv_special(void *context, GLenum pname, const GLfixed *params);
+
+void d_glLightxv_special(void *context, GLenum light, GLenum pname, const GLfixed *params);
+
+void d_glMaterialxv_special(void *context, GLenum face, GLenum pname, const GLfixed *params);
+
+void d_glPointSizex_special(void *context, GLfixed size);
+
+void d_glPointParameterxv_special(void *context, GLenum pname, const GLfixed *params);
+
+void d_glTexGenxv_special(void *context, GLenum coord, GLenum pname, const GLfixed *params);
+
+void d_glClipPlanef_special(void *context, GLenum plane, const GLfloat *equation);
+
+void d_glClipPlanex_special(void *context, GLenum plane, const GLfixed *equation);
+
+void d_glLoadMatrixx_special(void *context, const GLfixed *m);
+
+void d_glMultMatrixx_special(void *context, const GLfixed *m);
+
+void d_glRotatex_special(void *context, GLfixed angle, GLfixed x, GLfixed y, GLfixed z);
+
+void d_glScalex_special(void *context, GLfixed x, GLfixed y, GLfixed z);
+
+void d_glTranslatex_special(void *context, GLfixed x, GLfixed y, GLfixed z);
+
+void d_glFrustumf_special(void *context, GLfloat l, GLfloat r, GLfloat b, GLfloat t, GLfloat n, GLfloat f);
+
+void d_glOrthof_special(void *context, GLfloat l, GLfloat r, GLfloat b, GLfloat t, GLfloat n, GLfloat f);
+
+void d_glGetTexEnvxv_special(void *context, GLenum target, GLenum pname, GLfixed *params);
+
+/**
+ * @brief 代替glGetTexParameterxvOES，查询当前绑定到target上的纹理
+ */
+void fixed_get_tex_parameterv(GLenum target, GLenum pname, GLfixed *params);
+
+void d_glGetLightxv_special(void *context, GLenum light, GLenum pname, GLfixed *params);
+
+void d_glGetMaterialxv_special(void *context, GLenum face, GLenum pname, GLfixed *params);
+
+void d_glGetTexGenxv_special(void *context, GLenum coord, GLenum pname, GLfixed *params);
+
+void d_glGetClipPlanex_special(void *context, GLenum plane, GLfixed *equation);
+
+void d_glGetFixedv_special(void *context, GLenum pname, GLfixed *params);
+
+GLbitfield d_glQueryMatrixx_special(void *context, GLfixed *mantissa, GLint *exponent);
+
 void d_glDrawTexiOES_special(void *context, GLint x, GLint y, GLint z, GLint width, GLint height, GLfloat left_x, GLfloat right_x, GLfloat bottom_y, GLfloat top_y);
 
 void prepare_draw_texi(void);
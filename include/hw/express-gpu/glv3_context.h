@@ -56,6 +56,9 @@ typedef struct Resource_Map_Status
     
     unsigned int gbuffer_map_max_size;
     Hardware_Buffer **gbuffer_ptr_map;
+
+    // 快照恢复后还没有上传内容的对象，guest id到快照记录，全部上传后为NULL
+    GHashTable *restore_pending;
     
 } Resource_Map_Status;
 
@@ -153,6 +156,8 @@ typedef struct Opengl_Context
 
 
     Texture_Binding_Status texture_binding_status;
+    // 当前使用的host program，保存快照时用
+    GLuint current_program;
     // external_texture不受到当前激活的纹理影响，只要绑定了就能用
     GLuint is_using_external_program;
 
@@ -164,6 +169,12 @@ typedef struct Opengl_Context
     GLuint draw_texi_vbo;
     GLuint draw_texi_ebo;
 
+    // GLES1固定管线状态，类型为Fixed_Function_State，在glv1.c中第一次使用时创建
+    void *fixed_function_state;
+
+    // 计时查询与帧统计，类型为Gpu_Timer_Context，在express_gpu_timer.c中第一次使用时创建
+    void *gpu_timer;
+
     void *debug_message_buffer;
 } Opengl_Context;
 
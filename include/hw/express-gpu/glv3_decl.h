@@ -420,6 +420,8 @@ typedef struct Debug_Status {
 // FIXME: potential collision with future GL context flags
 #define DGL_CONTEXT_INDEPENDENT_MODE 0x00ffffff
 #define DGL_CONTEXT_FLAG_INDEPENDENT_MODE_BIT 0x10000000
+// guest创建的是GLES1 context，只有这种context才模拟固定管线
+#define DGL_CONTEXT_FLAG_GLES1_BIT 0x20000000
 
 DebugMessageDesc *get_next_debug_message(RingBufferDesc *buffer);
 void process_debug_message(void *context);
@@ -1660,6 +1660,22 @@
 
 #define PARA_NUM_MIN_glBlendEquationSeparatei (1)
 
+#define FUNID_glQueryCounterEXT ((EXPRESS_GPU_DEVICE_ID << 32u) + 412)
+
+#define PARA_NUM_MIN_glQueryCounterEXT (1)
+
+#define FUNID_glGetQueryObjecti64vEXT ((EXPRESS_GPU_DEVICE_ID << 32u) + (((unsigned long long)0x1) << 24u) + 413)
+
+#define PARA_NUM_MIN_glGetQueryObjecti64vEXT (2)
+
+#define FUNID_glGetQueryObjectui64vEXT ((EXPRESS_GPU_DEVICE_ID << 32u) + (((unsigned long long)0x1) << 24u) + 414)
+
+#define PARA_NUM_MIN_glGetQueryObjectui64vEXT (2)
+
+#define FUNID_glGetFrameStats ((EXPRESS_GPU_DEVICE_ID << 32u) + (((unsigned long long)0x1) << 24u) + 415)
+
+#define PARA_NUM_MIN_glGetFrameStats (1)
+
 
 // #define FUNID_glBindSharedGLImage ((EXPRESS_GPU_DEVICE_ID << 32u) + 406)
 
@@ -0,0 +1,88 @@
+#ifndef QEMU_EXPRESS_GPU_TEXTURE_DECODE_H
+#define QEMU_EXPRESS_GPU_TEXTURE_DECODE_H
+
+#include "qemu/osdep.h"
+
+/**
+ * @brief ETC2/EAC与ASTC LDR压缩纹理的软件解码
+ *
+ * 只依赖CPU，不需要GL。输出为紧密排列的行：
+ *   ETC1/ETC2/ASTC 每像素RGBA8，ETC2 RGB的alpha为255
+ *   EAC R11        每像素一个16位值，有符号格式为int16
+ *   EAC RG11       每像素两个16位值
+ * ASTC的输出与decode_unorm8模式一致，即取16位插值结果的高8位，sRGB格式输出的仍是sRGB编码的值。
+ */
+
+typedef enum Texture_Decode_Kind
+{
+    TEXTURE_DECODE_ETC2_RGB8,
+    TEXTURE_DECODE_ETC2_RGB8A1,
+    TEXTURE_DECODE_ETC2_RGBA8,
+    TEXTURE_DECODE_EAC_R11,
+    TEXTURE_DECODE_EAC_R11_SIGNED,
+    TEXTURE_DECODE_EAC_RG11,
+    TEXTURE_DECODE_EAC_RG11_SIGNED,
+    TEXTURE_DECODE_ASTC,
+    TEXTURE_DECODE_ASTC_SRGB,
+} Texture_Decode_Kind;
+
+typedef struct Texture_Decode_Format
+{
+    Texture_Decode_Kind kind;
+    int block_width;
+    int block_height;
+} Texture_Decode_Format;
+
+// ASTC块的最大边长
+#define ASTC_MAX_BLOCK_DIM 12
+
+/**
+ * @brief 一个压缩块的字节数
+ */
+int texture_decode_block_bytes(const Texture_Decode_Format *format);
+
+/**
+ * @brief 解码结果中一个像素的字节数
+ */
+int texture_decode_pixel_bytes(const Texture_Decode_Format *format);
+
+/**
+ * @brief 一个width*height的图像压缩后的字节数
+ */
+size_t texture_decode_image_size(const Texture_Decode_Format *format, int width, int height);
+
+/**
+ * @brief 解码图像中[block_row_begin, block_row_end)这几行块，不同的行可以在不同线程中同时解码
+ *
+ * @param src 整个图像的压缩数据
+ * @param dst 整个图像的解码结果，行宽为width*texture_decode_pixel_bytes
+ */
+void texture_decode_rows(const Texture_Decode_Format *format, const uint8_t *src, int width, int height,
+                         int block_row_begin, int block_row_end, uint8_t *dst);
+
+/**
+ * @brief 解码一个ETC2 RGB块（ETC1块也可以），输出4x4个RGBA8像素
+ *
+ * @param punchthrough 是否为RGB8_PUNCHTHROUGH_ALPHA1格式
+ * @param stride 输出一行的字节数
+ */
+void etc2_decode_color_block(const uint8_t *block, bool punchthrough, uint8_t *out, int stride);
+
+/**
+ * @brief 解码一个EAC块中的alpha，写到4x4个RGBA8像素的alpha上
+ */
+void eac_decode_alpha_block(const uint8_t *block, uint8_t *out, int stride);
+
+/**
+ * @brief 解码一个EAC R11块，输出4x4个16位值，pixel_step为相邻两个像素间隔的16位值个数
+ */
+void eac_decode_r11_block(const uint8_t *block, bool is_signed, uint16_t *out, int stride, int pixel_step);
+
+/**
+ * @brief 解码一个ASTC LDR块，输出block_width*block_height个RGBA8像素
+ *
+ * @return 块不合法时返回false，此时输出为错误色（品红）
+ */
+bool astc_decode_block(const uint8_t *block, int block_width, int block_height, bool srgb, uint8_t *out, int stride);
+
+#endif
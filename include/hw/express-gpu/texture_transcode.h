@@ -0,0 +1,70 @@
+#ifndef QEMU_EXPRESS_GPU_TEXTURE_TRANSCODE_H
+#define QEMU_EXPRESS_GPU_TEXTURE_TRANSCODE_H
+
+#include "hw/teleport-express/teleport_express_call.h"
+#include "hw/express-gpu/glv3_context.h"
+#include "hw/express-gpu/gl_helper.h"
+
+/**
+ * @brief host不支持的GLES压缩纹理格式的转码
+ *
+ * GLES 3.x必须支持ETC2/EAC，很多应用还会使用ASTC，而桌面GL的驱动一般不支持ASTC，ETC1更是没有。
+ * 对于host的GL_COMPRESSED_TEXTURE_FORMATS中没有的格式，上传时在CPU上解码成未压缩的格式再上传：
+ *   ETC1/ETC2 RGB            -> GL_RGB8/GL_SRGB8
+ *   ETC2 带alpha/ASTC        -> GL_RGBA8/GL_SRGB8_ALPHA8
+ *   EAC R11/RG11             -> GL_R16/GL_RG16，有符号格式为GL_R16_SNORM/GL_RG16_SNORM
+ * 大纹理按块行分给线程池并行解码。解码结果以压缩数据的SHA256为key缓存在磁盘上，同样的纹理再次上传时直接读取，
+ * 缓存超过大小上限时按LRU淘汰。
+ */
+
+// 是否转码，为false时与之前一样只在格式列表里加上ETC1
+extern bool express_gpu_texture_transcode;
+
+// 解码结果的缓存目录，为NULL时使用用户缓存目录下的teleport-express/textures，为空字符串时不缓存
+extern char *express_gpu_texture_cache;
+
+// 缓存目录的大小上限，单位MB，超过时删除最久没用过的文件，为0时不限制
+extern int express_gpu_texture_cache_mb;
+
+/**
+ * @brief static_value_prepare时调用，记录host原生支持的压缩格式，再把需要转码的格式加到guest看到的格式列表中
+ */
+void texture_transcode_prepare_formats(Static_Context_Values *values);
+
+/**
+ * @brief 这个压缩格式是否需要转码
+ */
+bool texture_transcode_needed(GLenum internalformat);
+
+/**
+ * @brief glTexStorage使用，需要转码的格式返回解码后的内部格式，其他格式原样返回
+ */
+GLenum texture_transcode_storage_format(GLenum internalformat);
+
+/**
+ * @brief 把guest内存中的压缩数据复制出来，数据为空时返回NULL
+ */
+void *texture_transcode_read_guest(Guest_Mem *guest_mem, GLsizei image_size);
+
+/**
+ * @brief 把当前绑定的GL_PIXEL_UNPACK_BUFFER中offset处的压缩数据读出来
+ */
+void *texture_transcode_read_unpack_buffer(GLintptr offset, GLsizei image_size);
+
+/**
+ * @brief 解码后代替glCompressedTexImage2D/3D上传，data为NULL时只分配存储
+ *
+ * @param depth 2D纹理为1
+ */
+void texture_transcode_image(void *context, GLenum target, GLint level, GLenum internalformat,
+                             GLsizei width, GLsizei height, GLsizei depth, bool is_3d,
+                             const void *data, GLsizei image_size);
+
+/**
+ * @brief 解码后代替glCompressedTexSubImage2D/3D上传
+ */
+void texture_transcode_sub_image(void *context, GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset,
+                                 GLsizei width, GLsizei height, GLsizei depth, bool is_3d, GLenum format,
+                                 const void *data, GLsizei image_size);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef EXPRESS_SENSOR_FIFO_H
+#define EXPRESS_SENSOR_FIFO_H
+
+#include "hw/teleport-express/express_log.h"
+
+#include "hw/teleport-express/express_device_common.h"
+#include "hw/teleport-express/teleport_express_register.h"
+
+// 与guest端驱动保持一致的FIFO魔数与版本
+#define EXPRESS_SENSOR_FIFO_MAGIC 0x46534e53
+#define EXPRESS_SENSOR_FIFO_VERSION 1
+
+#define EXPRESS_SENSOR_EVENT_MAX_VALUES 6
+
+enum {
+    EXPRESS_SENSOR_TYPE_ACCEL = 0,
+    EXPRESS_SENSOR_TYPE_GYRO,
+    EXPRESS_SENSOR_TYPE_GPS,
+    EXPRESS_SENSOR_TYPE_NUM
+};
+
+/**
+ * @brief guest端的sensor HAL通过batch()写入的配置，host只读
+ */
+typedef struct Express_Sensor_Batch_Config
+{
+    int enable;
+    int reserved;
+    // 采样周期，同一传感器在该周期内的多次更新会被合并为一个事件
+    int64_t sampling_period_ns;
+    // 最大上报延迟，为0时每个事件都会立即上报
+    int64_t max_report_latency_ns;
+} __attribute__((packed, aligned(4))) Express_Sensor_Batch_Config;
+
+typedef struct Express_Sensor_Event
+{
+    int sensor_type;
+    int value_num;
+    // host端的单调时钟时间戳，guest端需要结合header中的flush_timestamp_ns换算
+    int64_t timestamp_ns;
+    int values[EXPRESS_SENSOR_EVENT_MAX_VALUES];
+} __attribute__((packed, aligned(4))) Express_Sensor_Event;
+
+/**
+ * @brief 位于guest共享内存开头的FIFO头部，事件数组紧随其后
+ *
+ * write_index由host写入，read_index由guest写入，两者都是不断递增的计数，取模capacity得到槽位
+ */
+typedef struct Express_Sensor_Fifo_Header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t event_size;
+    volatile uint32_t write_index;
+    volatile uint32_t read_index;
+    volatile uint32_t dropped;
+    uint32_t reserved;
+    // 最近一次flush时的host单调时钟时间戳
+    volatile int64_t flush_timestamp_ns;
+    Express_Sensor_Batch_Config config[EXPRESS_SENSOR_TYPE_NUM];
+} __attribute__((packed, aligned(4))) Express_Sensor_Fifo_Header;
+
+/**
+ * @brief 把一个传感器事件放入共享FIFO，按照guest端设置的batch参数决定何时发送中断
+ *
+ * @return true 事件已经由FIFO接管；false FIFO未启用，调用者应该走原来的单设备中断路径
+ */
+bool express_sensor_fifo_push(int sensor_type, const int *values, int value_num);
+
+/**
+ * @brief 立即把FIFO中的所有待上报事件通知给guest
+ */
+void express_sensor_fifo_flush(void);
+
+#endif
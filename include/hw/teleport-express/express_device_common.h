@@ -19,6 +19,7 @@
 #define EXPRESS_CAMERA_DEVICE_ID ((uint64_t)11)
 #define EXPRESS_MODEM_DEVICE_ID ((uint64_t)12)
 #define EXPRESS_CODEC_DEVICE_ID ((uint64_t)13)
+#define EXPRESS_SENSOR_FIFO_DEVICE_ID ((uint64_t)14)
 
 #define EXPRESS_WIFI_DEVICE_ID ((u64)20)
 
@@ -45,6 +46,9 @@
 #define INPUT_DEVICE_TYPE 1
 #define OUTPUT_DEVICE_TYPE 2
 
+// irq_latency_budget_us的取值，表示该设备的中断不参与合并
+#define EXPRESS_IRQ_LATENCY_IMMEDIATE (-1)
+
 
 // device设备的id在高4字节，需要调用的函数id在低3字节，设备id决定到底哪个线程去处理，函数id决定怎么处理，中间一个字节的每个位决定函数处理是异步同步等信息
 //设备id（4字节）|标志位（1字节）|函数id（3字节）
@@ -96,6 +100,8 @@ typedef struct Guest_Mem
     Scatter_Data *scatter_data;
     int num;
     int all_len;
+    // 传入这块内存的call的统计项，之后无论在哪个线程回写guest都记到这个call上，可以为NULL
+    struct Express_Call_Metrics *metrics;
 } Guest_Mem;
 
 typedef struct Call_Para
@@ -140,6 +146,9 @@ typedef struct Teleport_Express_Call
 
     gint64 spend_time;
 
+    //放入处理线程call_buf的时间，用于统计排队时间
+    int64_t queue_time;
+
     //参数数目
     uint64_t para_num;
 
@@ -262,10 +271,26 @@ typedef struct Express_Device_Info
     // 虚拟中断释放时的回调
     void (*irq_release)(Device_Context *context);
 
+    // input设备的中断延迟预算（us），回收的call最多等待这么久以便与其他call合并为一次中断
+    // 为0时使用全局默认值express_input_irq_latency_us，为负数时每次都立即发送中断
+    int irq_latency_budget_us;
+
     // 给外设提供的静态属性参数值，可以在内核内通过调用get_teleport_input_device_prop来获得
     void *static_prop;
     int static_prop_size;
 
+    // 快照时保存host端状态，在主线程上、所有call都处理完之后调用，返回负数表示当前状态无法保存，快照会失败
+    int (*pre_save)(QEMUFile *f, struct Express_Device_Info *info);
+    // 恢复pre_save保存的状态，version_id为保存时的state_version，返回负数表示恢复失败
+    int (*post_load)(QEMUFile *f, struct Express_Device_Info *info, int version_id);
+    // pre_save写入的数据格式版本
+    int state_version;
+    // 设备的context都可以在guest下次调用时重新创建，没有pre_save也可以做快照
+    bool context_stateless;
+
+    //留作内部使用，当前存活的Thread_Context以及注册了中断的非纯输入设备context的数目
+    int live_context_num;
+
 } Express_Device_Info;
 
 
@@ -280,6 +305,8 @@ extern bool express_gpu_keep_window_scale;
 extern int express_gpu_window_width;
 extern int express_gpu_window_height;
 
+extern bool express_gpu_headless;
+
 extern int *express_touchscreen_size;
 
 extern bool express_touchscreen_scroll_is_zoom;
@@ -303,10 +330,21 @@ extern bool express_gpu_open_shader_binary;
 
 extern char *express_ruim_file;
 
+extern int express_mic_period_ms;
+extern int express_mic_sample_rate;
+
+extern int express_codec_decode_threads;
+extern bool express_codec_encode_gpu_yuv;
+extern bool express_codec_decode_to_texture;
+
+extern char *express_camera_source;
+
 void express_device_init_common(Express_Device_Info *info);
 
 Express_Device_Info *get_express_device_info(unsigned int device_id);
 
+void express_device_info_foreach(GHFunc func, void *user_data);
+
 void cluster_decode_invoke(Teleport_Express_Call *call, void *context, EXPRESS_DECODE_FUN decode_fun);
 
 
@@ -1,14 +1,22 @@
 #ifndef EXPRESS_EVENT_H
 #define EXPRESS_EVENT_H
 
+// 与Win32的INFINITE一致，表示wait_event一直等待
+#define EXPRESS_EVENT_INFINITE 0xffffffffUL
+
 #ifndef _WIN32
 #include <pthread.h>
 typedef struct
 {
     int signal_state; // 0代表事件未触发，1代表触发
     int manual_reset;   // 0代表每次wait后自动重置，1代表需要手动重置
+#ifdef CONFIG_LINUX
+    // Linux下直接在signal_state上使用futex，waiters为在内核中等待的线程数，为0时set_event不需要进入内核
+    int waiters;
+#else
     pthread_mutex_t event_lock;
     pthread_cond_t event_cond;
+#endif
 } POSIX_Event;
 #define POSIX_HANDLE POSIX_Event *
 #define HANDLE_SIZE sizeof(POSIX_Event)
@@ -11,5 +11,8 @@ Teleport_Express_Call *call_pop(Thread_Context *context);
 
 void *handle_thread_run(void *opaque);
 
+//不为NULL时，处理线程在处理每个call之前先调用它，用于录制调用流
+extern void (*express_call_capture_hook)(Teleport_Express_Call *call);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef QEMU_EXPRESS_METRICS_H
+#define QEMU_EXPRESS_METRICS_H
+#include "hw/teleport-express/express_device_common.h"
+#include "qemu/stats64.h"
+
+// device_id的上限，目前最大的设备id是EXPRESS_MEM_DEVICE_ID
+#define EXPRESS_METRICS_DEVICE_NUM 64
+
+// 每个设备最多统计的fun_id数目，超出的fun_id统一记在EXPRESS_METRICS_OTHER_FUN_ID下
+#define EXPRESS_METRICS_FUN_SLOTS 256
+#define EXPRESS_METRICS_OTHER_FUN_ID 0xffffffff
+
+/**
+ * @brief 每个(device_id, fun_id)的传输统计，所有计数都可以被多个线程无锁地累加
+ *
+ */
+typedef struct Express_Call_Metrics
+{
+    // fun_id + 1，为0表示该槽位还没有被使用
+    uint32_t key;
+
+    Stat64 calls;
+
+    // guest传给host的参数长度，以及通过write_to_guest_mem回写到这个call传入的内存中的长度
+    Stat64 bytes_to_host;
+    Stat64 bytes_to_guest;
+
+    // 在处理线程的call_buf中排队的时间
+    Stat64 queue_wait_ns;
+    Stat64 queue_wait_max_ns;
+
+    // call_handle的执行时间
+    Stat64 handle_ns;
+    Stat64 handle_max_ns;
+
+    // call_push时call_buf已满的次数，以及回收时recycle队列已满的次数
+    Stat64 ring_full;
+    Stat64 recycle_full;
+} Express_Call_Metrics;
+
+extern bool express_call_metrics_enable;
+
+Express_Call_Metrics *express_metrics_get(uint64_t call_id);
+
+void express_metrics_call_received(Teleport_Express_Call *call);
+
+void express_metrics_call_handled(Express_Call_Metrics *metrics, int64_t queue_wait_ns, int64_t handle_ns);
+
+void express_metrics_ring_full(Teleport_Express_Call *call);
+
+void express_metrics_recycle_full(Teleport_Express_Call *call);
+
+void express_metrics_guest_write(Express_Call_Metrics *metrics, size_t length);
+
+void express_metrics_reset(void);
+
+#endif
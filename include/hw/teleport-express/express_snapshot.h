@@ -0,0 +1,59 @@
+#ifndef QEMU_EXPRESS_SNAPSHOT_H
+#define QEMU_EXPRESS_SNAPSHOT_H
+
+#include "hw/teleport-express/teleport_express.h"
+#include "hw/teleport-express/express_device_common.h"
+#include "migration/vmstate.h"
+
+/**
+ * @brief teleport-express的快照与迁移
+ *
+ * 虚拟机为了保存快照而停止时（此时guest内存还没有保存），传输层先停止从输出队列取新的call，
+ * 等已经取出的call都处理完还给guest，再停止输入线程，这样保存下来的virtqueue里就只剩下
+ * 设备为了注入中断而一直持有的call。保存的内容有：
+ *   1. guest用来表示空指针的那块内存的位置
+ *   2. 纯输入设备注册的DMA缓冲区
+ *   3. 设备持有的中断call的virtqueue元素
+ *   4. 实现了pre_save的设备自己的host端状态
+ * 恢复后虚拟机开始运行时，再按顺序重新注册缓冲区与中断call，然后重新开始处理两个队列。
+ *
+ * 有存活的context、又没有实现pre_save的设备会让快照失败；express-gpu的GL状态由它自己的pre_save保存。
+ */
+
+// 传输层暂停时不再从队列中取call，设备也不能再注入中断
+extern int express_transport_paused;
+
+// 输出队列中已经取出、还没有还给guest的call数目
+extern int express_output_calls_in_flight;
+
+extern const VMStateDescription vmstate_teleport_express_device;
+
+/**
+ * @brief 设备realize时调用，注册虚拟机运行状态变化的回调
+ */
+void express_snapshot_init(Teleport_Express *e);
+
+/**
+ * @brief 纯输入设备注册DMA缓冲区时调用，记录下来以便恢复后重新注册
+ */
+void express_snapshot_track_buffer(Teleport_Express_Call *call);
+
+/**
+ * @brief 设备注册与释放中断时调用，记录持有中断call的context
+ */
+void express_snapshot_track_irq(Device_Context *device_context);
+void express_snapshot_untrack_irq(Device_Context *device_context);
+
+/**
+ * @brief 把host端指向guest内存的指针保存为RAMBlock中的位置，设备的pre_save与post_load可以使用
+ */
+void express_snapshot_put_host_ptr(QEMUFile *f, void *ptr);
+void *express_snapshot_get_host_ptr(QEMUFile *f);
+
+/**
+ * @brief 保存与恢复copy_guest_mem_from_call得到的Guest_Mem，恢复得到的用free_copied_guest_mem释放
+ */
+void express_snapshot_put_guest_mem(QEMUFile *f, Guest_Mem *mem);
+Guest_Mem *express_snapshot_get_guest_mem(QEMUFile *f);
+
+#endif
@@ -102,6 +102,9 @@ void host_guest_buffer_exchange(Scatter_Data *guest_data, unsigned char *host_da
 
 int fill_teleport_express_queue_elem(Teleport_Express_Queue_Elem *elem, unsigned long long *id, unsigned long long *thread_id, unsigned long long *process_id, unsigned long long *unique_id, unsigned long long *num);
 Teleport_Express_Call *pack_call_from_queue(VirtQueue *vq, int index);
+Teleport_Express_Call *pack_call_from_elems(VirtQueue *vq, Teleport_Express_Queue_Elem **elems, int num);
+void drop_one_call(Teleport_Express_Call *call);
+int rewind_packaging_call(VirtQueue *vq, int index);
 
 
 
@@ -114,6 +117,8 @@ void free_copied_guest_mem(Guest_Mem *mem);
 
 
 void guest_null_ptr_init(VirtQueue *vq);
+void *guest_null_ptr_get(void);
+void guest_null_ptr_set(void *ptr);
 
 void common_call_callback(Teleport_Express_Call *call);
 
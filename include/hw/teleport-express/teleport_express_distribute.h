@@ -18,9 +18,13 @@
 
 extern int atomic_distribute_thread_running;
 
+extern int express_distribute_paused;
+
 
 void *call_distribute_thread(void *opaque);
 
+void push_to_thread(Teleport_Express_Call *call);
+
 
 void virtqueue_data_distribute_and_recycle(VirtQueue *vq, int *pop_flag, int *recycle_flag, int *need_irq);
 
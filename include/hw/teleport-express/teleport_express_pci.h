@@ -26,6 +26,7 @@ typedef struct Teleport_Express_PCI{
     bool keep_window_scale;
     int window_width;
     int window_height;
+    bool headless;
 
     int display_width;
     int display_height;
@@ -51,6 +52,27 @@ typedef struct Teleport_Express_PCI{
     
     char *ruim_file;
 
+    int mic_period_ms;
+    int mic_sample_rate;
+
+    int codec_decode_threads;
+    bool codec_encode_gpu_yuv;
+    bool codec_decode_to_texture;
+
+    char *camera_source;
+
+    int input_irq_latency_us;
+
+    bool call_metrics;
+
+    char *gl_capture;
+    char *gl_replay;
+
+    bool texture_transcode;
+    char *texture_cache;
+    int texture_cache_mb;
+    bool frame_stats;
+
 } Teleport_Express_PCI;
 
 
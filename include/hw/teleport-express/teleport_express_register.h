@@ -13,6 +13,27 @@
 
 
 
+typedef struct Express_Input_Irq_Stats
+{
+    // 实际注入的中断数目，以及被guest通过used_event抑制的数目
+    uint64_t irq_count;
+    uint64_t irq_suppressed;
+    // 还给guest的call数目
+    uint64_t call_count;
+
+    // 因合并中断而增加的延迟，即最早一个call回收到中断注入之间的时间
+    uint64_t batch_count;
+    int64_t batch_latency_sum_ns;
+    int64_t batch_latency_max_ns;
+
+    // 以下由express_input_irq_stats_get计算
+    int64_t batch_latency_avg_ns;
+    double irq_per_second;
+} Express_Input_Irq_Stats;
+
+// 设备不指定延迟预算时使用的默认值，单位us，由input_irq_latency_us属性设置
+extern int express_input_irq_latency_us;
+
 void register_input_buffer_call(VirtIODevice *vdev, VirtQueue *vq);
 
 // void send_express_device_irq(Teleport_Express_Call *irq_call, int buf_index, int len);
@@ -23,4 +44,14 @@ void *input_sync_thread(void *opaque);
 
 void express_input_device_sync(void);
 
+void express_input_device_kick(void);
+
+void express_input_device_flush(void);
+
+bool express_input_recycle_pending(void);
+
+void express_input_restore_call(VirtIODevice *vdev, Teleport_Express_Call *call);
+
+void express_input_irq_stats_get(Express_Input_Irq_Stats *stats, bool reset);
+
 #endif
\ No newline at end of file
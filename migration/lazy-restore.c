@@ -0,0 +1,351 @@
+/*
+ * Lazy restore of RAM from a mapped-ram migration file
+ *
+ * Instead of reading all of RAM before the guest starts, guest memory is
+ * emptied and registered with userfaultfd like for postcopy.  Faulting
+ * pages are read from their fixed place in the file by the postcopy
+ * fault thread, while a background thread reads all remaining pages in
+ * file order.  Pages that are not present in the file are left to the
+ * kernel to fill with zeroes.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/madvise.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "exec/ram_addr.h"
+#include "migration.h"
+#include "qemu-file.h"
+#include "savevm.h"
+#include "postcopy-ram.h"
+#include "mapped-ram.h"
+#include "lazy-restore.h"
+#include "ram.h"
+#include "trace.h"
+
+/* Largest run of pages the background thread reads at once */
+#define LAZY_RESTORE_PREFETCH_SIZE (1 * MiB)
+
+typedef struct LazyRestoreState {
+    QIOChannel *ioc;
+    QemuThread prefetch_thread;
+    /* Bounce buffers for UFFDIO_COPY, one per thread placing pages */
+    uint8_t *fault_buf;
+    uint8_t *prefetch_buf;
+    size_t prefetch_buf_size;
+    /* Both are set in the main thread, the restore ends when both are */
+    bool loadvm_done;
+    bool prefetch_done;
+    /* A page could not be placed, RAM stays registered with userfaultfd */
+    bool failed;
+    int64_t start_time;
+    /* Host pages placed by the fault thread and the background thread */
+    uint64_t fault_pages;
+    uint64_t prefetch_pages;
+} LazyRestoreState;
+
+/*
+ * Fail the incoming migration.  The page at @start is left missing, so
+ * whatever waits for it stays blocked instead of seeing wrong contents
+ * until management, which sees the failed state, gives up on the guest.
+ */
+static void lazy_restore_fail(MigrationIncomingState *mis, RAMBlock *rb,
+                              ram_addr_t start, Error *err)
+{
+    error_prepend(&err, "Lazy restore of %s at 0x" RAM_ADDR_FMT " failed: ",
+                  rb->idstr, start);
+    migrate_set_error(migrate_get_current(), err);
+    qatomic_set(&mis->lazy_restore->failed, true);
+    migrate_set_state(&mis->state, MIGRATION_STATUS_ACTIVE,
+                      MIGRATION_STATUS_FAILED);
+    error_report_err(err);
+}
+
+/*
+ * Claim the host page at @start for placing.  Only one thread gets it;
+ * a fault on a page claimed by the other thread is resolved when that
+ * thread places it.
+ */
+static bool lazy_restore_claim(RAMBlock *rb, ram_addr_t start)
+{
+    return bitmap_test_and_clear_atomic(rb->mapped_ram_pending,
+                                        start >> TARGET_PAGE_BITS,
+                                        qemu_ram_pagesize(rb) >>
+                                        TARGET_PAGE_BITS);
+}
+
+/*
+ * Read and place the claimed host pages [start, start + len)
+ *
+ * Returns zero on success and negative on error
+ */
+static int lazy_restore_place(MigrationIncomingState *mis, RAMBlock *rb,
+                              ram_addr_t start, size_t len, uint8_t *buf)
+{
+    LazyRestoreState *lr = mis->lazy_restore;
+    size_t pagesize = qemu_ram_pagesize(rb);
+    Error *local_err = NULL;
+    size_t done;
+    int ret;
+
+    if (mapped_ram_read_pages(lr->ioc, rb, start, len, buf, &local_err)) {
+        lazy_restore_fail(mis, rb, start, local_err);
+        return -EIO;
+    }
+
+    for (done = 0; done < len; done += pagesize) {
+        ret = postcopy_place_page(mis, rb->host + start + done, buf + done, rb);
+        if (ret) {
+            error_setg_errno(&local_err, -ret, "Failed to place page");
+            lazy_restore_fail(mis, rb, start + done, local_err);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+int lazy_restore_request_page(MigrationIncomingState *mis, RAMBlock *rb,
+                              ram_addr_t start)
+{
+    LazyRestoreState *lr = mis->lazy_restore;
+    size_t pagesize = qemu_ram_pagesize(rb);
+    unsigned long first = start >> TARGET_PAGE_BITS;
+    unsigned long last = first + (pagesize >> TARGET_PAGE_BITS);
+    Error *local_err = NULL;
+    int ret;
+
+    if (rb->mapped_ram_pending && lazy_restore_claim(rb, start)) {
+        trace_lazy_restore_request_page(rb->idstr, start);
+        if (!lazy_restore_place(mis, rb, start, pagesize, lr->fault_buf)) {
+            qatomic_inc(&lr->fault_pages);
+        }
+        return 0;
+    }
+
+    /* Being placed by the background thread, or already in place */
+    if ((rb->file_bmap && find_next_bit(rb->file_bmap, last, first) < last) ||
+        ramblock_recv_bitmap_test_byte_offset(rb, start)) {
+        return 0;
+    }
+
+    /* Not in the file at all */
+    trace_lazy_restore_request_zero_page(rb->idstr, start);
+    ret = postcopy_place_page_zero(mis, rb->host + start, rb);
+    if (ret) {
+        error_setg_errno(&local_err, -ret, "Failed to place zero page");
+        lazy_restore_fail(mis, rb, start, local_err);
+    }
+    return 0;
+}
+
+/*
+ * Read and place the next run of pending pages of block @idstr, starting
+ * the search at *@page.  The RCU read lock is only held for one run, so
+ * the block is looked up again every time.
+ *
+ * Returns false when the block has no pending pages left
+ */
+static bool lazy_restore_prefetch_run(MigrationIncomingState *mis,
+                                      const char *idstr, unsigned long *page)
+{
+    LazyRestoreState *lr = mis->lazy_restore;
+    RAMBlock *rb;
+    size_t pagesize, max_len;
+    unsigned long host_pages, num_pages;
+    ram_addr_t start;
+    size_t len = 0;
+
+    RCU_READ_LOCK_GUARD();
+
+    rb = qemu_ram_block_by_name(idstr);
+    if (!rb || !rb->mapped_ram_pending) {
+        return false;
+    }
+
+    pagesize = qemu_ram_pagesize(rb);
+    host_pages = pagesize >> TARGET_PAGE_BITS;
+    num_pages = rb->postcopy_length >> TARGET_PAGE_BITS;
+    max_len = QEMU_ALIGN_DOWN(lr->prefetch_buf_size, pagesize);
+
+    *page = find_next_bit(rb->mapped_ram_pending, num_pages, *page);
+    if (*page >= num_pages) {
+        return false;
+    }
+
+    *page = QEMU_ALIGN_DOWN(*page, host_pages);
+    start = (ram_addr_t)*page << TARGET_PAGE_BITS;
+
+    /* Claim consecutive host pages so they are read in one go */
+    while (len < max_len && *page < num_pages &&
+           lazy_restore_claim(rb, start + len)) {
+        len += pagesize;
+        *page += host_pages;
+    }
+
+    if (!len) {
+        /* Taken by the fault thread in the meantime */
+        *page += host_pages;
+        return true;
+    }
+
+    if (!lazy_restore_place(mis, rb, start, len, lr->prefetch_buf)) {
+        qatomic_add(&lr->prefetch_pages, len / pagesize);
+    }
+    return true;
+}
+
+/*
+ * Copy the name of the first block that still has pending pages into
+ * @idstr.  Returns false when all of RAM has been claimed.
+ */
+static bool lazy_restore_next_block(char *idstr, size_t len)
+{
+    RAMBlock *rb;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
+        unsigned long num_pages = rb->postcopy_length >> TARGET_PAGE_BITS;
+
+        if (rb->mapped_ram_pending &&
+            find_first_bit(rb->mapped_ram_pending, num_pages) < num_pages) {
+            pstrcpy(idstr, len, rb->idstr);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void lazy_restore_finish(MigrationIncomingState *mis)
+{
+    LazyRestoreState *lr = mis->lazy_restore;
+    RAMBlock *rb;
+
+    qemu_thread_join(&lr->prefetch_thread);
+
+    if (qatomic_read(&lr->failed)) {
+        /*
+         * Unregistering RAM would let the guest read zeroes where pages
+         * are missing; keep the fault thread and userfaultfd in place.
+         */
+        return;
+    }
+
+    /* Stops the fault thread and unregisters RAM from userfaultfd */
+    postcopy_ram_incoming_cleanup(mis);
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_MIGRATABLE(rb) {
+            mapped_ram_cleanup_ramblock(rb);
+        }
+    }
+
+    trace_lazy_restore_finish(lr->fault_pages, lr->prefetch_pages,
+                              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                              lr->start_time);
+
+    qemu_vfree(lr->fault_buf);
+    qemu_vfree(lr->prefetch_buf);
+    g_free(lr);
+    mis->lazy_restore = NULL;
+
+    qemu_loadvm_state_cleanup();
+    migrate_set_state(&mis->state, MIGRATION_STATUS_ACTIVE,
+                      MIGRATION_STATUS_COMPLETED);
+    migration_incoming_state_destroy();
+}
+
+static void lazy_restore_prefetch_done_bh(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+
+    mis->lazy_restore->prefetch_done = true;
+    if (mis->lazy_restore->loadvm_done) {
+        lazy_restore_finish(mis);
+    }
+}
+
+static void *lazy_restore_prefetch_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    LazyRestoreState *lr = mis->lazy_restore;
+    char idstr[sizeof(((RAMBlock *)NULL)->idstr)];
+
+    rcu_register_thread();
+
+    while (!qatomic_read(&lr->failed) &&
+           lazy_restore_next_block(idstr, sizeof(idstr))) {
+        unsigned long page = 0;
+
+        while (!qatomic_read(&lr->failed) &&
+               lazy_restore_prefetch_run(mis, idstr, &page)) {
+        }
+    }
+
+    rcu_unregister_thread();
+
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            lazy_restore_prefetch_done_bh, mis);
+    return NULL;
+}
+
+void lazy_restore_loadvm_done(MigrationIncomingState *mis)
+{
+    mis->lazy_restore->loadvm_done = true;
+    if (mis->lazy_restore->prefetch_done) {
+        lazy_restore_finish(mis);
+    }
+}
+
+int lazy_restore_setup(MigrationIncomingState *mis, Error **errp)
+{
+    LazyRestoreState *lr;
+    size_t align = qemu_real_host_page_size();
+    RAMBlock *rb;
+
+    lr = g_new0(LazyRestoreState, 1);
+    lr->ioc = qemu_file_get_ioc(mis->from_src_file);
+    lr->start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    lr->prefetch_buf_size = MAX(LAZY_RESTORE_PREFETCH_SIZE,
+                                mis->largest_page_size);
+    lr->fault_buf = qemu_memalign(align, mis->largest_page_size);
+    lr->prefetch_buf = qemu_memalign(align, lr->prefetch_buf_size);
+    mis->lazy_restore = lr;
+
+    /*
+     * Like for postcopy, make sure the discard really empties RAM and
+     * THP doesn't fill in whole huge pages on first access.
+     */
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
+            qemu_madvise(rb->host, rb->used_length, QEMU_MADV_NOHUGEPAGE);
+        }
+    }
+
+    if (postcopy_ram_incoming_init(mis)) {
+        error_setg(errp, "Failed to discard RAM for lazy restore");
+        return -EINVAL;
+    }
+
+    if (postcopy_ram_incoming_setup(mis)) {
+        error_setg(errp, "Failed to set up userfaultfd for lazy restore");
+        return -EINVAL;
+    }
+
+    trace_lazy_restore_setup(mis->largest_page_size, lr->prefetch_buf_size);
+
+    qemu_thread_create(&lr->prefetch_thread, "lazy-restore",
+                       lazy_restore_prefetch_thread, mis,
+                       QEMU_THREAD_JOINABLE);
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Lazy restore of RAM from a mapped-ram migration file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_LAZY_RESTORE_H
+#define QEMU_MIGRATION_LAZY_RESTORE_H
+
+#include "migration.h"
+
+/**
+ * lazy_restore_setup: start restoring RAM on demand
+ *
+ * Called once the headers of all RAM blocks have been loaded with
+ * mapped_ram_load_ramblock().  Empties guest RAM, registers it with
+ * userfaultfd and starts the thread that reads the pages in file order.
+ * From then on the postcopy fault thread serves guest accesses from the
+ * file through lazy_restore_request_page().
+ *
+ * Returns zero on success and negative on error
+ *
+ * @mis: current migration incoming state
+ * @errp: pointer to a NULL-initialized error object
+ */
+int lazy_restore_setup(MigrationIncomingState *mis, Error **errp);
+
+/**
+ * lazy_restore_request_page: place a page the guest is waiting for
+ *
+ * Called from the postcopy fault thread.  If the page cannot be read
+ * from the file the incoming migration fails and the page is left
+ * missing, since the guest cannot get it from anywhere else.
+ *
+ * Returns zero
+ *
+ * @mis: current migration incoming state
+ * @rb: block that contains the page
+ * @start: offset of the host page inside the block
+ */
+int lazy_restore_request_page(MigrationIncomingState *mis, RAMBlock *rb,
+                              ram_addr_t start);
+
+/**
+ * lazy_restore_loadvm_done: the device state has been loaded
+ *
+ * Called from the main thread once the VM has been started.  The
+ * incoming migration completes when both this and the background
+ * read are done.
+ *
+ * @mis: current migration incoming state
+ */
+void lazy_restore_loadvm_done(MigrationIncomingState *mis);
+
+#endif
@@ -0,0 +1,450 @@
+/*
+ * Fixed-offset RAM layout for file migration
+ *
+ * Every RAM block owns a region of the migration file made of a page
+ * bitmap followed by an array with one slot per page, so pages can be
+ * written and read at their final place by several threads at once.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "exec/ram_addr.h"
+#include "mapped-ram.h"
+#include "qemu-file.h"
+#include "trace.h"
+
+/* Upper bound of the threads used to write or read a block */
+#define MAPPED_RAM_MAX_THREADS 8
+
+/* Threads pick the pages to process in chunks of this size */
+#define MAPPED_RAM_CHUNK_SIZE (64 * MiB)
+
+/* Largest single pwrite/pread */
+#define MAPPED_RAM_MAX_IO_SIZE (8 * MiB)
+
+/* version, page size, bitmap offset, pages offset */
+#define MAPPED_RAM_HDR_SIZE (4 + 8 + 8 + 8)
+
+typedef struct MappedRamJob {
+    QIOChannel *ioc;
+    RAMBlock *block;
+    /* pages to write, or pages present in the file when reading */
+    unsigned long *bitmap;
+    unsigned long num_pages;
+    unsigned long chunk_pages;
+    unsigned long num_chunks;
+    bool write;
+    /* next chunk to hand out, atomic */
+    unsigned long next_chunk;
+    /* set by the first thread that fails, atomic */
+    bool failed;
+} MappedRamJob;
+
+typedef struct MappedRamWorker {
+    QemuThread thread;
+    MappedRamJob *job;
+    MappedRamStats stats;
+    Error *err;
+} MappedRamWorker;
+
+static size_t mapped_ram_bitmap_size(unsigned long num_pages)
+{
+    return BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+}
+
+static bool mapped_ram_pwrite_all(QIOChannel *ioc, const uint8_t *buf,
+                                  size_t len, off_t offset, Error **errp)
+{
+    while (len) {
+        ssize_t ret = qio_channel_pwrite(ioc, (const char *)buf, len, offset,
+                                         errp);
+        if (ret < 0) {
+            if (ret == QIO_CHANNEL_ERR_BLOCK) {
+                error_setg(errp, "Migration file would block on write");
+            }
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+static bool mapped_ram_pread_all(QIOChannel *ioc, uint8_t *buf, size_t len,
+                                 off_t offset, Error **errp)
+{
+    while (len) {
+        ssize_t ret = qio_channel_pread(ioc, (char *)buf, len, offset, errp);
+        if (ret <= 0) {
+            if (ret == 0) {
+                error_setg(errp, "Unexpected end of migration file at "
+                           "offset %" PRId64, (int64_t)offset);
+            } else if (ret == QIO_CHANNEL_ERR_BLOCK) {
+                error_setg(errp, "Migration file would block on read");
+            }
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+/*
+ * Write the pending pages of [start, end).  Consecutive non-zero pages
+ * go out in a single pwrite; zero pages are dropped from the file bitmap
+ * in case an earlier iteration wrote them.  @start is a multiple of
+ * BITS_PER_LONG, so no other thread touches the same bitmap words.
+ */
+static bool mapped_ram_write_chunk(MappedRamWorker *w, unsigned long start,
+                                   unsigned long end)
+{
+    MappedRamJob *job = w->job;
+    RAMBlock *block = job->block;
+    unsigned long max_run = MAPPED_RAM_MAX_IO_SIZE >> TARGET_PAGE_BITS;
+    unsigned long run_start = 0, run_len = 0;
+    unsigned long page;
+
+    for (page = find_next_bit(job->bitmap, end, start); page < end;
+         page = find_next_bit(job->bitmap, end, page + 1)) {
+        uint8_t *host = block->host + ((ram_addr_t)page << TARGET_PAGE_BITS);
+
+        if (buffer_is_zero(host, TARGET_PAGE_SIZE)) {
+            clear_bit(page, block->file_bmap);
+            w->stats.zero_pages++;
+            continue;
+        }
+
+        if (run_len && (run_start + run_len != page || run_len == max_run)) {
+            if (!mapped_ram_pwrite_all(job->ioc,
+                    block->host + ((ram_addr_t)run_start << TARGET_PAGE_BITS),
+                    run_len << TARGET_PAGE_BITS,
+                    block->pages_offset +
+                    ((off_t)run_start << TARGET_PAGE_BITS), &w->err)) {
+                return false;
+            }
+            run_len = 0;
+        }
+        if (!run_len) {
+            run_start = page;
+        }
+        run_len++;
+
+        set_bit(page, block->file_bmap);
+        w->stats.normal_pages++;
+    }
+
+    if (run_len && !mapped_ram_pwrite_all(job->ioc,
+            block->host + ((ram_addr_t)run_start << TARGET_PAGE_BITS),
+            run_len << TARGET_PAGE_BITS,
+            block->pages_offset + ((off_t)run_start << TARGET_PAGE_BITS),
+            &w->err)) {
+        return false;
+    }
+
+    bitmap_clear(job->bitmap, start, end - start);
+    return true;
+}
+
+/* Read the pages of [start, end) that are present in the file */
+static bool mapped_ram_read_chunk(MappedRamWorker *w, unsigned long start,
+                                  unsigned long end)
+{
+    MappedRamJob *job = w->job;
+    RAMBlock *block = job->block;
+    unsigned long max_run = MAPPED_RAM_MAX_IO_SIZE >> TARGET_PAGE_BITS;
+    unsigned long page, run_end;
+
+    for (page = find_next_bit(job->bitmap, end, start); page < end;
+         page = find_next_bit(job->bitmap, end, run_end)) {
+        run_end = find_next_zero_bit(job->bitmap, end, page);
+        run_end = MIN(run_end, page + max_run);
+
+        if (!mapped_ram_pread_all(job->ioc,
+                block->host + ((ram_addr_t)page << TARGET_PAGE_BITS),
+                (run_end - page) << TARGET_PAGE_BITS,
+                block->pages_offset + ((off_t)page << TARGET_PAGE_BITS),
+                &w->err)) {
+            return false;
+        }
+        w->stats.normal_pages += run_end - page;
+    }
+    return true;
+}
+
+static void *mapped_ram_worker(void *opaque)
+{
+    MappedRamWorker *w = opaque;
+    MappedRamJob *job = w->job;
+
+    while (!qatomic_read(&job->failed)) {
+        unsigned long chunk = qatomic_fetch_inc(&job->next_chunk);
+        unsigned long start, end;
+        bool ok;
+
+        if (chunk >= job->num_chunks) {
+            break;
+        }
+
+        start = chunk * job->chunk_pages;
+        end = MIN(start + job->chunk_pages, job->num_pages);
+        if (job->write) {
+            ok = mapped_ram_write_chunk(w, start, end);
+        } else {
+            ok = mapped_ram_read_chunk(w, start, end);
+        }
+        if (!ok) {
+            qatomic_set(&job->failed, true);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int mapped_ram_run(QIOChannel *ioc, RAMBlock *block,
+                          unsigned long *bitmap, unsigned long num_pages,
+                          bool write, MappedRamStats *stats, Error **errp)
+{
+    MappedRamJob job = {
+        .ioc = ioc,
+        .block = block,
+        .bitmap = bitmap,
+        .num_pages = num_pages,
+        .chunk_pages = MAPPED_RAM_CHUNK_SIZE >> TARGET_PAGE_BITS,
+        .write = write,
+    };
+    g_autofree MappedRamWorker *workers = NULL;
+    int nthreads, i;
+    int ret = 0;
+
+    if (find_first_bit(bitmap, num_pages) >= num_pages) {
+        return 0;
+    }
+
+    /* Chunks must not share bitmap words between threads */
+    job.chunk_pages = ROUND_UP(job.chunk_pages, BITS_PER_LONG);
+    job.num_chunks = DIV_ROUND_UP(num_pages, job.chunk_pages);
+
+    nthreads = MIN(MAPPED_RAM_MAX_THREADS, g_get_num_processors());
+    nthreads = MIN(nthreads, job.num_chunks);
+    nthreads = MAX(nthreads, 1);
+
+    trace_mapped_ram_run(block->idstr, write, num_pages, nthreads);
+
+    workers = g_new0(MappedRamWorker, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        workers[i].job = &job;
+    }
+
+    /* The calling thread takes a share of the work as well */
+    for (i = 1; i < nthreads; i++) {
+        qemu_thread_create(&workers[i].thread, "mapped-ram",
+                           mapped_ram_worker, &workers[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    mapped_ram_worker(&workers[0]);
+    for (i = 1; i < nthreads; i++) {
+        qemu_thread_join(&workers[i].thread);
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        stats->normal_pages += workers[i].stats.normal_pages;
+        stats->zero_pages += workers[i].stats.zero_pages;
+        if (workers[i].err) {
+            if (!ret) {
+                error_propagate(errp, workers[i].err);
+                ret = -EIO;
+            } else {
+                error_free(workers[i].err);
+            }
+        }
+    }
+
+    return ret;
+}
+
+int mapped_ram_setup_ramblock(QEMUFile *f, RAMBlock *block)
+{
+    unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    off_t offset;
+
+    if (!qio_channel_has_feature(qemu_file_get_ioc(f),
+                                 QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_report("mapped-ram requires a seekable migration channel");
+        return -EINVAL;
+    }
+
+    offset = qemu_get_offset(f);
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    block->bitmap_offset = offset + MAPPED_RAM_HDR_SIZE;
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   mapped_ram_bitmap_size(num_pages),
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+    block->file_bmap = bitmap_new(num_pages);
+    block->mapped_ram_pending = bitmap_new(num_pages);
+
+    qemu_put_be32(f, MAPPED_RAM_HDR_VERSION);
+    qemu_put_be64(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+
+    trace_mapped_ram_setup_ramblock(block->idstr, block->bitmap_offset,
+                                    block->pages_offset);
+
+    /* The rest of the stream continues after the page array */
+    qemu_set_offset(f, block->pages_offset + block->used_length, SEEK_SET);
+
+    return qemu_file_get_error(f);
+}
+
+void mapped_ram_cleanup_ramblock(RAMBlock *block)
+{
+    g_free(block->file_bmap);
+    block->file_bmap = NULL;
+    g_free(block->mapped_ram_pending);
+    block->mapped_ram_pending = NULL;
+}
+
+int mapped_ram_write_pages(QIOChannel *ioc, RAMBlock *block,
+                           MappedRamStats *stats, Error **errp)
+{
+    return mapped_ram_run(ioc, block, block->mapped_ram_pending,
+                          block->used_length >> TARGET_PAGE_BITS, true,
+                          stats, errp);
+}
+
+int mapped_ram_write_bitmap(QIOChannel *ioc, RAMBlock *block, Error **errp)
+{
+    unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t size = mapped_ram_bitmap_size(num_pages);
+    g_autofree unsigned long *le_bitmap = g_malloc0(size);
+
+    bitmap_to_le(le_bitmap, block->file_bmap, num_pages);
+    if (!mapped_ram_pwrite_all(ioc, (uint8_t *)le_bitmap, size,
+                               block->bitmap_offset, errp)) {
+        return -EIO;
+    }
+    return 0;
+}
+
+int mapped_ram_load_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length,
+                             bool lazy, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    unsigned long num_pages = length >> TARGET_PAGE_BITS;
+    size_t size = mapped_ram_bitmap_size(num_pages);
+    g_autofree unsigned long *le_bitmap = NULL;
+    unsigned long *bitmap;
+    MappedRamStats stats = { 0 };
+    uint32_t version;
+    uint64_t page_size;
+    int ret;
+
+    if (!qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg(errp, "mapped-ram requires a seekable migration channel");
+        return -EINVAL;
+    }
+
+    version = qemu_get_be32(f);
+    page_size = qemu_get_be64(f);
+    block->bitmap_offset = qemu_get_be64(f);
+    block->pages_offset = qemu_get_be64(f);
+
+    ret = qemu_file_get_error(f);
+    if (ret < 0) {
+        error_setg(errp, "Failed to read mapped-ram header of %s",
+                   block->idstr);
+        return ret;
+    }
+    if (version != MAPPED_RAM_HDR_VERSION) {
+        error_setg(errp, "Unsupported mapped-ram header version %u of %s",
+                   version, block->idstr);
+        return -EINVAL;
+    }
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_setg(errp, "Mismatched mapped-ram page size of %s: "
+                   "%" PRIu64 " != %d", block->idstr, page_size,
+                   TARGET_PAGE_SIZE);
+        return -EINVAL;
+    }
+    if (!QEMU_IS_ALIGNED(block->pages_offset,
+                         MAPPED_RAM_FILE_OFFSET_ALIGNMENT)) {
+        error_setg(errp, "Misaligned mapped-ram page array of %s at "
+                   "offset %" PRId64, block->idstr,
+                   (int64_t)block->pages_offset);
+        return -EINVAL;
+    }
+
+    trace_mapped_ram_load_ramblock(block->idstr, block->bitmap_offset,
+                                   block->pages_offset);
+
+    le_bitmap = g_malloc0(size);
+    if (!mapped_ram_pread_all(ioc, (uint8_t *)le_bitmap, size,
+                              block->bitmap_offset, errp)) {
+        return -EIO;
+    }
+    mapped_ram_cleanup_ramblock(block);
+    bitmap = block->file_bmap = bitmap_new(num_pages);
+    bitmap_from_le(bitmap, le_bitmap, num_pages);
+
+    if (lazy) {
+        /* Every page in the file is still to be placed */
+        block->mapped_ram_pending = bitmap_new(num_pages);
+        bitmap_copy(block->mapped_ram_pending, bitmap, num_pages);
+    } else {
+        ret = mapped_ram_run(ioc, block, bitmap, num_pages, false, &stats,
+                             errp);
+        mapped_ram_cleanup_ramblock(block);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    qemu_set_offset(f, block->pages_offset + length, SEEK_SET);
+    ret = qemu_file_get_error(f);
+    if (ret < 0) {
+        error_setg(errp, "Failed to skip mapped-ram pages of %s",
+                   block->idstr);
+    }
+    return ret;
+}
+
+int mapped_ram_read_pages(QIOChannel *ioc, RAMBlock *block, ram_addr_t offset,
+                          size_t len, uint8_t *buf, Error **errp)
+{
+    unsigned long start = offset >> TARGET_PAGE_BITS;
+    unsigned long end = start + (len >> TARGET_PAGE_BITS);
+    unsigned long page, run_end;
+
+    for (page = start; page < end; page = run_end) {
+        uint8_t *dst = buf + ((ram_addr_t)(page - start) << TARGET_PAGE_BITS);
+
+        if (test_bit(page, block->file_bmap)) {
+            run_end = find_next_zero_bit(block->file_bmap, end, page);
+            if (!mapped_ram_pread_all(ioc, dst,
+                    (run_end - page) << TARGET_PAGE_BITS,
+                    block->pages_offset + ((off_t)page << TARGET_PAGE_BITS),
+                    errp)) {
+                return -EIO;
+            }
+        } else {
+            run_end = find_next_bit(block->file_bmap, end, page);
+            memset(dst, 0, (run_end - page) << TARGET_PAGE_BITS);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Fixed-offset RAM layout for file migration
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_MAPPED_RAM_H
+#define QEMU_MIGRATION_MAPPED_RAM_H
+
+#include "exec/ramblock.h"
+#include "io/channel.h"
+
+#define MAPPED_RAM_HDR_VERSION 1
+
+/* Page arrays start on this boundary in the file */
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+
+typedef struct MappedRamStats {
+    /* pages with contents written to or read from the file */
+    uint64_t normal_pages;
+    /* pages found to be zero and left out of the file */
+    uint64_t zero_pages;
+} MappedRamStats;
+
+/**
+ * mapped_ram_setup_ramblock: write the mapped-ram header of a RAM block
+ *
+ * Reserves the block's bitmap and page array right after the header,
+ * moves the stream past them and allocates the block's file and
+ * pending bitmaps.
+ *
+ * Returns zero on success and negative on error
+ *
+ * @f: QEMUFile of the migration stream, must be seekable
+ * @block: block being set up
+ */
+int mapped_ram_setup_ramblock(QEMUFile *f, RAMBlock *block);
+
+/**
+ * mapped_ram_cleanup_ramblock: free the bitmaps of a RAM block
+ *
+ * @block: block set up by mapped_ram_setup_ramblock()
+ */
+void mapped_ram_cleanup_ramblock(RAMBlock *block);
+
+/**
+ * mapped_ram_write_pages: write out the pending pages of a RAM block
+ *
+ * Pages set in the block's pending bitmap are written to their slots
+ * by several threads and their bits in the file bitmap updated;
+ * zero pages are skipped.  The pending bitmap is empty afterwards.
+ *
+ * Returns zero on success and negative on error
+ *
+ * @ioc: channel of the migration file
+ * @block: block to write
+ * @stats: incremented with the pages written and skipped
+ * @errp: pointer to a NULL-initialized error object
+ */
+int mapped_ram_write_pages(QIOChannel *ioc, RAMBlock *block,
+                           MappedRamStats *stats, Error **errp);
+
+/**
+ * mapped_ram_write_bitmap: write the file bitmap of a RAM block
+ *
+ * Returns zero on success and negative on error
+ *
+ * @ioc: channel of the migration file
+ * @block: block to write
+ * @errp: pointer to a NULL-initialized error object
+ */
+int mapped_ram_write_bitmap(QIOChannel *ioc, RAMBlock *block, Error **errp);
+
+/**
+ * mapped_ram_load_ramblock: load a RAM block from a mapped-ram file
+ *
+ * Reads the block header from the stream, reads every page that is
+ * present in the file straight into guest memory using several
+ * threads and moves the stream past the block's page array.
+ *
+ * With @lazy the pages are left in the file; the block keeps its file
+ * bitmap and gets a pending bitmap with the same pages set, for
+ * lazy_restore_setup() to place them later.
+ *
+ * Returns zero on success and negative on error
+ *
+ * @f: QEMUFile of the migration stream, must be seekable
+ * @block: block being loaded
+ * @length: length of the block in the stream
+ * @lazy: only read the header and bitmap of the block
+ * @errp: pointer to a NULL-initialized error object
+ */
+int mapped_ram_load_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length,
+                             bool lazy, Error **errp);
+
+/**
+ * mapped_ram_read_pages: read part of a RAM block from the file
+ *
+ * Pages that are not present in the file are filled with zeroes.
+ *
+ * Returns zero on success and negative on error
+ *
+ * @ioc: channel of the migration file
+ * @block: block loaded with mapped_ram_load_ramblock()
+ * @offset: offset inside the block, target page aligned
+ * @len: length to read, a multiple of the target page size
+ * @buf: where to put the pages
+ * @errp: pointer to a NULL-initialized error object
+ */
+int mapped_ram_read_pages(QIOChannel *ioc, RAMBlock *block, ram_addr_t offset,
+                          size_t len, uint8_t *buf, Error **errp);
+
+#endif
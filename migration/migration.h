@@ -186,6 +186,13 @@ struct MigrationIncomingState {
      * contains valid information.
      */
     QemuMutex page_request_mutex;
+
+    /*
+     * Set while RAM is being restored lazily from a mapped-ram file.
+     * Faults are then served from the file instead of being requested
+     * from the source.
+     */
+    struct LazyRestoreState *lazy_restore;
 };
 
 MigrationIncomingState *migration_incoming_get_current(void);
@@ -441,6 +448,8 @@ int migrate_decompress_threads(void);
 bool migrate_use_events(void);
 bool migrate_postcopy_blocktime(void);
 bool migrate_background_snapshot(void);
+bool migrate_mapped_ram(void);
+bool migrate_lazy_restore(void);
 bool migrate_postcopy_preempt(void);
 
 /* Sending on the return path - generic and then for each message type */
@@ -24,6 +24,7 @@
 #include "qemu-file.h"
 #include "savevm.h"
 #include "postcopy-ram.h"
+#include "lazy-restore.h"
 #include "ram.h"
 #include "qapi/error.h"
 #include "qemu/notify.h"
@@ -729,6 +730,10 @@ static int postcopy_request_page(MigrationIncomingState *mis, RAMBlock *rb,
         return received ? 0 : postcopy_place_page_zero(mis, aligned, rb);
     }
 
+    if (mis->lazy_restore) {
+        return lazy_restore_request_page(mis, rb, start);
+    }
+
     return migrate_send_rp_req_pages(mis, rb, start, haddr);
 }
 
@@ -958,11 +963,12 @@ static void *postcopy_ram_fault_thread(void *opaque)
             break;
         }
 
-        if (!mis->to_src_file) {
+        if (!mis->to_src_file && !mis->lazy_restore) {
             /*
              * Possibly someone tells us that the return path is
              * broken already using the event. We should hold until
-             * the channel is rebuilt.
+             * the channel is rebuilt.  A lazy restore has no return
+             * path, pages come from the migration file.
              */
             postcopy_pause_fault_thread(mis);
         }
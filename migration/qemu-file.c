@@ -919,3 +919,51 @@ QIOChannel *qemu_file_get_ioc(QEMUFile *file)
 {
     return file->ioc;
 }
+
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *local_error = NULL;
+    off_t pos;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+        if (qemu_file_get_error(f)) {
+            return -1;
+        }
+    }
+
+    pos = qio_channel_io_seek(f->ioc, 0, SEEK_CUR, &local_error);
+    if (pos < 0) {
+        qemu_file_set_error_obj(f, -EINVAL, local_error);
+        return -1;
+    }
+
+    if (!qemu_file_is_writable(f)) {
+        pos -= f->buf_size - f->buf_index;
+    }
+
+    return pos;
+}
+
+void qemu_set_offset(QEMUFile *f, off_t offset, int whence)
+{
+    Error *local_error = NULL;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+        if (qemu_file_get_error(f)) {
+            return;
+        }
+    } else {
+        /* The channel position is ahead of the stream by the read-ahead */
+        if (whence == SEEK_CUR) {
+            offset -= f->buf_size - f->buf_index;
+        }
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    if (qio_channel_io_seek(f->ioc, offset, whence, &local_error) < 0) {
+        qemu_file_set_error_obj(f, -EINVAL, local_error);
+    }
+}
@@ -168,4 +168,26 @@ size_t ram_control_save_page(QEMUFile *f, ram_addr_t block_offset,
                              uint64_t *bytes_sent);
 QIOChannel *qemu_file_get_ioc(QEMUFile *file);
 
+/*
+ * qemu_get_offset:
+ *
+ * Report the position of the stream in the underlying channel,
+ * which must be seekable.  For writable files any pending buffers
+ * are flushed first; for readable files data that was read ahead
+ * but not consumed yet is not counted.
+ *
+ * Returns: the offset, or -1 on error (also set on the file)
+ */
+off_t qemu_get_offset(QEMUFile *f);
+
+/*
+ * qemu_set_offset:
+ *
+ * Move the stream to @offset in the underlying channel, which must
+ * be seekable, interpreting @whence as lseek() does.  Pending
+ * buffers are flushed and read-ahead data is discarded.  Errors are
+ * set on the file.
+ */
+void qemu_set_offset(QEMUFile *f, off_t offset, int whence);
+
 #endif
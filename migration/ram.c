@@ -56,6 +56,8 @@
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "mapped-ram.h"
+#include "lazy-restore.h"
 #include "sysemu/runstate.h"
 
 #include "hw/boards.h" /* for machine_dump_guest_core() */
@@ -2269,6 +2271,63 @@ static bool save_compress_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
     return false;
 }
 
+/**
+ * ram_save_mapped_ram_page: queue a page for a mapped-ram file
+ *
+ * The page is only marked here; it is checked for zero and written to
+ * its slot in the file, together with the other pages queued in this
+ * iteration, by ram_flush_mapped_ram().
+ *
+ * Returns the number of pages queued (always 1)
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_mapped_ram_page(RAMState *rs, RAMBlock *block,
+                                    ram_addr_t offset)
+{
+    set_bit(offset >> TARGET_PAGE_BITS, block->mapped_ram_pending);
+    qemu_file_acct_rate_limit(rs->f, TARGET_PAGE_SIZE);
+    return 1;
+}
+
+/**
+ * ram_flush_mapped_ram: write the pages queued by ram_save_mapped_ram_page()
+ *
+ * Returns zero on success and negative on error, the error is also
+ * set on the migration file
+ *
+ * Called with the RCU read lock held
+ *
+ * @rs: current RAM state
+ */
+static int ram_flush_mapped_ram(RAMState *rs)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(rs->f);
+    MappedRamStats stats = { 0 };
+    Error *local_err = NULL;
+    RAMBlock *block;
+    int ret = 0;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ret = mapped_ram_write_pages(ioc, block, &stats, &local_err);
+        if (ret < 0) {
+            break;
+        }
+    }
+
+    ram_counters.normal += stats.normal_pages;
+    ram_counters.duplicate += stats.zero_pages;
+    ram_transferred_add(stats.normal_pages * TARGET_PAGE_SIZE);
+    qemu_file_credit_transfer(rs->f, stats.normal_pages * TARGET_PAGE_SIZE);
+
+    if (ret < 0) {
+        qemu_file_set_error_obj(rs->f, ret, local_err);
+    }
+    return ret;
+}
+
 /**
  * ram_save_target_page: save one target page
  *
@@ -2283,6 +2342,10 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss)
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
     int res;
 
+    if (migrate_mapped_ram()) {
+        return ram_save_mapped_ram_page(rs, block, offset);
+    }
+
     if (control_save_page(rs, block, offset, &res)) {
         return res;
     }
@@ -2685,6 +2748,10 @@ static void ram_save_cleanup(void *opaque)
         block->bmap = NULL;
     }
 
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        mapped_ram_cleanup_ramblock(block);
+    }
+
     xbzrle_cleanup();
     compress_threads_save_cleanup();
     ram_state_cleanup(rsp);
@@ -3232,6 +3299,12 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                ret = mapped_ram_setup_ramblock(f, block);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
         }
     }
 
@@ -3339,6 +3412,14 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
             }
             i++;
         }
+
+        if (migrate_mapped_ram()) {
+            int flush_ret = ram_flush_mapped_ram(rs);
+
+            if (flush_ret < 0) {
+                ret = flush_ret;
+            }
+        }
     }
     qemu_mutex_unlock(&rs->bitmap_mutex);
 
@@ -3371,6 +3452,33 @@ out:
     return done;
 }
 
+/**
+ * ram_write_mapped_ram_bitmaps: write which pages a mapped-ram file holds
+ *
+ * Returns zero on success and negative on error, the error is also
+ * set on the migration file
+ *
+ * Called with the RCU read lock held
+ *
+ * @rs: current RAM state
+ */
+static int ram_write_mapped_ram_bitmaps(RAMState *rs)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(rs->f);
+    Error *local_err = NULL;
+    RAMBlock *block;
+    int ret;
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        ret = mapped_ram_write_bitmap(ioc, block, &local_err);
+        if (ret < 0) {
+            qemu_file_set_error_obj(rs->f, ret, local_err);
+            return ret;
+        }
+    }
+    return 0;
+}
+
 /**
  * ram_save_complete: function called to send the remaining amount of ram
  *
@@ -3414,6 +3522,14 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         }
 
         flush_compressed_data(rs);
+
+        if (!ret && migrate_mapped_ram()) {
+            ret = ram_flush_mapped_ram(rs);
+            if (!ret) {
+                ret = ram_write_mapped_ram_bitmaps(rs);
+            }
+        }
+
         ram_control_after_iterate(f, RAM_CONTROL_FINISH);
     }
 
@@ -4337,6 +4453,16 @@ static int ram_load_precopy(QEMUFile *f)
                     }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
+                    if (!ret && migrate_mapped_ram()) {
+                        Error *local_err = NULL;
+
+                        ret = mapped_ram_load_ramblock(f, block, length,
+                                                       migrate_lazy_restore(),
+                                                       &local_err);
+                        if (ret < 0) {
+                            error_report_err(local_err);
+                        }
+                    }
                 } else {
                     error_report("Unknown ramblock \"%s\", cannot "
                                  "accept migration", id);
@@ -4345,6 +4471,16 @@ static int ram_load_precopy(QEMUFile *f)
 
                 total_ram_bytes -= length;
             }
+
+            if (!ret && migrate_lazy_restore()) {
+                Error *local_err = NULL;
+
+                ret = lazy_restore_setup(migration_incoming_get_current(),
+                                         &local_err);
+                if (ret < 0) {
+                    error_report_err(local_err);
+                }
+            }
             break;
 
         case RAM_SAVE_FLAG_ZERO:
@@ -2758,7 +2758,10 @@ int qemu_loadvm_state(QEMUFile *f)
         }
     }
 
-    qemu_loadvm_state_cleanup();
+    if (!mis->lazy_restore) {
+        /* Otherwise RAM load state is still in use until the restore ends */
+        qemu_loadvm_state_cleanup();
+    }
     cpu_synchronize_all_post_init();
 
     return ret;
@@ -0,0 +1,33 @@
+/*
+ * teleport-express statistics stubs
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "monitor/hmp.h"
+#include "monitor/monitor.h"
+
+HumanReadableText *qmp_x_query_teleport_express(Error **errp)
+{
+    error_setg(errp, "Support for teleport-express not built-in");
+    return NULL;
+}
+
+HumanReadableText *qmp_x_query_express_gpu_frames(Error **errp)
+{
+    error_setg(errp, "Support for express-gpu not built-in");
+    return NULL;
+}
+
+void qmp_x_teleport_express_reset_stats(Error **errp)
+{
+    error_setg(errp, "Support for teleport-express not built-in");
+}
+
+void hmp_teleport_express_reset_stats(Monitor *mon, const QDict *qdict)
+{
+    monitor_printf(mon, "Support for teleport-express not built-in\n");
+}
@@ -0,0 +1,189 @@
+/*
+ * express-camera pacing benchmark
+ *
+ * Releases the frames of a camera source on the schedule the capturing
+ * thread uses, sleeping on a condition variable until each frame is due,
+ * while other threads keep the host cpus busy. Reports the achieved frame
+ * rate and how late frames were released, which is what the guest sees as
+ * camera jitter.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+
+#include "hw/express-camera/camera_source.h"
+
+static const char *spec = "synthetic:1280x720@30";
+static unsigned int duration = 5;
+static unsigned int load_threads;
+
+static bool stop_load;
+
+static const char commands_string[] =
+    " -s = camera source, synthetic[:WxH[@FPS]] or a media file\n"
+    " -d = duration in seconds\n"
+    " -l = number of threads loading the cpus";
+
+char *get_now_time(void)
+{
+    return (char *)"";
+}
+
+int null_printf(const char *a, ...)
+{
+    return 0;
+}
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" source:            %s\n", spec);
+    printf(" duration:          %u s\n", duration);
+    printf(" load threads:      %u\n", load_threads);
+}
+
+static void *load_thread(void *opaque)
+{
+    volatile uint64_t x = 0;
+
+    while (!qatomic_read(&stop_load)) {
+        for (int i = 0; i < 100000; i++) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        }
+    }
+    return NULL;
+}
+
+static int64_t now_ns(void)
+{
+    return g_get_monotonic_time() * SCALE_US;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int run(void)
+{
+    CameraSource *source = camera_source_open(spec);
+    AVPacket *pkt = av_packet_alloc();
+    GArray *lateness = g_array_new(false, false, sizeof(int64_t));
+    QemuThread *threads = g_new0(QemuThread, load_threads);
+    GMutex lock;
+    GCond cond;
+    CameraPacer pacer;
+    int64_t start, end, late_sum = 0;
+    unsigned int frames = 0;
+
+    if (source == NULL) {
+        fprintf(stderr, "cannot open camera source %s\n", spec);
+        return 1;
+    }
+
+    g_mutex_init(&lock);
+    g_cond_init(&cond);
+    for (unsigned int i = 0; i < load_threads; i++) {
+        qemu_thread_create(&threads[i], "load", load_thread, NULL, QEMU_THREAD_JOINABLE);
+    }
+
+    camera_pacer_reset(&pacer);
+    start = now_ns();
+    end = start + duration * NANOSECONDS_PER_SECOND;
+
+    while (now_ns() < end) {
+        if (source->read_packet(source, pkt) < 0) {
+            fprintf(stderr, "camera source failed\n");
+            break;
+        }
+        int64_t due = camera_pacer_due(&pacer, pkt->pts, source->time_base, now_ns());
+
+        g_mutex_lock(&lock);
+        while (g_cond_wait_until(&cond, &lock, (due + SCALE_US - 1) / SCALE_US)) {
+            /* nobody signals, only a spurious wakeup gets here */
+        }
+        g_mutex_unlock(&lock);
+
+        int64_t late = now_ns() - due;
+        g_array_append_val(lateness, late);
+        late_sum += late;
+        frames++;
+        av_packet_unref(pkt);
+    }
+    end = now_ns();
+
+    qatomic_set(&stop_load, true);
+    for (unsigned int i = 0; i < load_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    printf("Results:\n");
+    if (frames > 0) {
+        g_array_sort(lateness, cmp_int64);
+        printf(" frames:            %u (%.2f fps, source %.2f fps)\n", frames,
+               (double)frames * NANOSECONDS_PER_SECOND / (end - start),
+               av_q2d(source->frame_rate));
+        printf(" late by:           mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+               (double)late_sum / frames / SCALE_MS,
+               (double)g_array_index(lateness, int64_t, frames / 2) / SCALE_MS,
+               (double)g_array_index(lateness, int64_t, frames * 99 / 100) / SCALE_MS,
+               (double)g_array_index(lateness, int64_t, frames - 1) / SCALE_MS);
+    }
+
+    g_free(threads);
+    g_array_free(lateness, true);
+    g_cond_clear(&cond);
+    g_mutex_clear(&lock);
+    av_packet_free(&pkt);
+    source->close(source);
+    return frames > 0 ? 0 : 1;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hs:d:l:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 's':
+            spec = optarg;
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'l':
+            load_threads = atoi(optarg);
+            break;
+        }
+    }
+    if (duration == 0) {
+        usage_complete(argv);
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    pr_params();
+    return run();
+}
@@ -0,0 +1,197 @@
+/*
+ * dcodec colour conversion benchmark
+ *
+ * Compares the direct yuv <-> rgb conversion used by dcodec for frames that
+ * are not resized against sws_scale with SWS_FAST_BILINEAR, which is what
+ * the decoder and encoder used before. Every accelerated implementation
+ * available on the host is measured, down to the plain c version, and the
+ * largest per-byte difference to the swscale output is reported.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+#include "libswscale/swscale.h"
+
+#include "hw/express-codec/dcodec_convert.h"
+
+static int width = 1920;
+static int height = 1080;
+static unsigned int iterations = 100;
+static int stripes = DCODEC_CONVERT_MAX_STRIPES;
+
+static const struct {
+    enum AVPixelFormat src;
+    enum AVPixelFormat dst;
+} conversions[] = {
+    { AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGBA },
+    { AV_PIX_FMT_NV12, AV_PIX_FMT_RGBA },
+    { AV_PIX_FMT_YUV420P, AV_PIX_FMT_BGRA },
+    { AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGB565 },
+    { AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P },
+    { AV_PIX_FMT_RGBA, AV_PIX_FMT_YUV420P },
+    { AV_PIX_FMT_RGBA, AV_PIX_FMT_NV12 },
+    { AV_PIX_FMT_RGB24, AV_PIX_FMT_YUV420P },
+};
+
+static const char commands_string[] =
+    " -s = frame size as WxH\n"
+    " -n = number of conversions per measurement\n"
+    " -j = maximum number of stripes per frame (1 = single threaded)";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" frame size:        %dx%d\n", width, height);
+    printf(" iterations:        %u\n", iterations);
+    printf(" stripes:           %d%s\n", stripes,
+           (int64_t)width * height >= DCODEC_CONVERT_STRIPE_PIXELS ?
+           "" : " (frame below the stripe threshold)");
+}
+
+static void fill_random(uint8_t *data[4], const int linesize[4],
+                        enum AVPixelFormat fmt)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(fmt);
+    int planes = av_pix_fmt_count_planes(fmt);
+
+    for (int i = 0; i < planes; i++) {
+        int h = (i == 0) ? height : AV_CEIL_RSHIFT(height, desc->log2_chroma_h);
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < linesize[i]; x++) {
+                data[i][y * linesize[i] + x] = g_random_int();
+            }
+        }
+    }
+}
+
+static int max_difference(uint8_t *a[4], uint8_t *b[4], const int linesize[4],
+                          enum AVPixelFormat fmt)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(fmt);
+    int planes = av_pix_fmt_count_planes(fmt);
+    int diff = 0;
+
+    for (int i = 0; i < planes; i++) {
+        int h = (i == 0) ? height : AV_CEIL_RSHIFT(height, desc->log2_chroma_h);
+        int bytes = av_image_get_linesize(fmt, width, i);
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < bytes; x++) {
+                int d = abs(a[i][y * linesize[i] + x] - b[i][y * linesize[i] + x]);
+                diff = MAX(diff, d);
+            }
+        }
+    }
+    return diff;
+}
+
+static double ms_per_frame(int64_t start)
+{
+    return (double)(get_clock() - start) / iterations / SCALE_MS;
+}
+
+static int run_conversion(enum AVPixelFormat src_fmt, enum AVPixelFormat dst_fmt)
+{
+    uint8_t *src[4], *ref[4], *dst[4];
+    int src_linesize[4], dst_linesize[4];
+    struct SwsContext *sws_ctx;
+    int64_t start;
+
+    if (av_image_alloc(src, src_linesize, width, height, src_fmt, 32) < 0 ||
+        av_image_alloc(ref, dst_linesize, width, height, dst_fmt, 32) < 0 ||
+        av_image_alloc(dst, dst_linesize, width, height, dst_fmt, 32) < 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    fill_random(src, src_linesize, src_fmt);
+
+    printf(" %s -> %s\n", av_get_pix_fmt_name(src_fmt),
+           av_get_pix_fmt_name(dst_fmt));
+
+    sws_ctx = sws_getContext(width, height, src_fmt, width, height, dst_fmt,
+                             SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    start = get_clock();
+    for (unsigned int i = 0; i < iterations; i++) {
+        sws_scale(sws_ctx, (const uint8_t * const *)src, src_linesize, 0,
+                  height, ref, dst_linesize);
+    }
+    printf("  %-8s %8.3f ms/frame\n", "swscale", ms_per_frame(start));
+    sws_freeContext(sws_ctx);
+
+    do {
+        start = get_clock();
+        for (unsigned int i = 0; i < iterations; i++) {
+            dcodec_convert_frame((const uint8_t * const *)src, src_linesize,
+                                 src_fmt, dst, dst_linesize, dst_fmt,
+                                 width, height);
+        }
+        printf("  %-8s %8.3f ms/frame, max diff to swscale %d\n",
+               dcodec_convert_accel_name(), ms_per_frame(start),
+               max_difference(ref, dst, dst_linesize, dst_fmt));
+    } while (dcodec_convert_next_accel());
+
+    av_freep(&src[0]);
+    av_freep(&ref[0]);
+    av_freep(&dst[0]);
+    return 0;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hs:n:j:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 's':
+            if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+                usage_complete(argv);
+                exit(1);
+            }
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'j':
+            stripes = atoi(optarg);
+            break;
+        }
+    }
+    if (width <= 0 || height <= 0 || iterations == 0 || stripes <= 0) {
+        usage_complete(argv);
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int failed = 0;
+
+    parse_args(argc, argv);
+    pr_params();
+    dcodec_convert_max_stripes = stripes;
+
+    printf("Results:\n");
+    for (unsigned int i = 0; i < ARRAY_SIZE(conversions); i++) {
+        failed |= run_conversion(conversions[i].src, conversions[i].dst);
+        /* start over with the fastest implementation for the next pair */
+        dcodec_convert_reset_accel();
+    }
+    return failed;
+}
@@ -0,0 +1,393 @@
+/*
+ * Multi-stream video decode benchmark
+ *
+ * Decodes the same file in several threads at once, the way several guest
+ * players drive separate dcodec components. Every stream creates its own
+ * dcodec video decoder and feeds it through the BufferDesc/notify contract
+ * used by the guest driver, with RGBA output into guest memory, so the
+ * decoder threading and the per-component scalers are the ones the device
+ * uses. The parts of the device the components call into come from the
+ * stubs of the dcodec unit test.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+
+#include "hw/express-codec/dcodec_video.h"
+#include "hw/teleport-express/express_device_common.h"
+
+#include "libavformat/avformat.h"
+#include "libavutil/imgutils.h"
+
+#define BENCH_BUFFERS 4
+#define BENCH_OUTPUT_ID 0x100
+/* no buffer came back for this long, the component is stuck */
+#define BENCH_STALL_US (10 * G_USEC_PER_SEC)
+
+struct stream_info {
+    QemuThread thread;
+    unsigned long long frames;
+    bool failed;
+} QEMU_ALIGNED(64);
+
+typedef struct BenchStream {
+    struct stream_info *info;
+    AVFormatContext *fmt_ctx;
+    int video_index;
+    AVPacket *pkt;
+    int64_t next_ts;
+
+    DCodecComponent *component;
+    GAsyncQueue *events;
+    size_t input_size;
+    size_t output_size;
+    uint8_t *input_mem[BENCH_BUFFERS];
+    uint8_t *output_mem[BENCH_BUFFERS];
+} BenchStream;
+
+static struct stream_info *streams;
+static unsigned int n_streams = 1;
+static unsigned int n_ready_streams;
+static unsigned int duration = 5;
+static int decode_threads;
+static bool low_latency;
+static const char *input_file;
+static bool test_start;
+static bool test_stop;
+
+static const char commands_string[] =
+    " -f = input video file (required)\n"
+    " -n = number of simultaneous streams\n"
+    " -t = decoder threads per stream (0 = one per core)\n"
+    " -l = configure the streams as low latency\n"
+    " -d = duration in seconds";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static void bench_notify(DCodecComponent *component, CodecCallbackData ccd)
+{
+    BenchStream *s = (BenchStream *)(uintptr_t)component->mAppPrivate;
+
+    g_async_queue_push(s->events, g_memdup2(&ccd, sizeof(ccd)));
+}
+
+static bool bench_set_parameter(BenchStream *s, OMX_INDEXTYPE index,
+                                OMX_PTR params)
+{
+    OMX_ERRORTYPE err;
+
+    g_mutex_lock(&s->component->lock);
+    err = s->component->set_parameter(s->component, index, params);
+    g_mutex_unlock(&s->component->lock);
+    return err == OMX_ErrorNone;
+}
+
+static void bench_queue_buffer(BenchStream *s, uint32_t type, uint64_t id,
+                               uint8_t *data, size_t alloc_len,
+                               size_t filled_len, int64_t ts, uint32_t flags)
+{
+    BufferDesc *desc = g_new0(BufferDesc, 1);
+    Guest_Mem *mem = g_new0(Guest_Mem, 1);
+
+    /* guest memory is a single scatter entry over memory owned by the bench */
+    mem->num = 1;
+    mem->scatter_data = g_new0(Scatter_Data, 1);
+    mem->scatter_data[0].data = data;
+    mem->scatter_data[0].len = alloc_len;
+    mem->all_len = alloc_len;
+
+    desc->type = type | CODEC_BUFFER_TYPE_GUEST_MEM;
+    desc->id = id;
+    desc->nAllocLen = alloc_len;
+    desc->nFilledLen = filled_len;
+    desc->nTimeStamp = ts;
+    desc->nFlags = flags;
+    desc->data = mem;
+
+    g_mutex_lock(&s->component->lock);
+    dcodec_process_this_buffer(s->component, desc);
+    g_mutex_unlock(&s->component->lock);
+}
+
+static void bench_queue_output(BenchStream *s, int slot)
+{
+    bench_queue_buffer(s, CODEC_BUFFER_TYPE_OUTPUT, BENCH_OUTPUT_ID + slot,
+                       s->output_mem[slot], s->output_size, 0, 0, 0);
+}
+
+/* queues the next packet of the file, looping at the end */
+static bool bench_queue_input(BenchStream *s, int slot)
+{
+    AVPacket *pkt = s->pkt;
+    size_t len;
+
+    for (;;) {
+        if (av_read_frame(s->fmt_ctx, pkt) < 0) {
+            if (av_seek_frame(s->fmt_ctx, s->video_index, 0,
+                              AVSEEK_FLAG_BACKWARD) < 0) {
+                return false;
+            }
+            continue;
+        }
+        if (pkt->stream_index == s->video_index) {
+            break;
+        }
+        av_packet_unref(pkt);
+    }
+
+    len = pkt->size;
+    if (len > s->input_size) {
+        av_packet_unref(pkt);
+        return false;
+    }
+    memcpy(s->input_mem[slot], pkt->data, len);
+    av_packet_unref(pkt);
+
+    /* the timestamps only have to be distinct */
+    bench_queue_buffer(s, CODEC_BUFFER_TYPE_INPUT, slot, s->input_mem[slot],
+                       s->input_size, len, s->next_ts++, 0);
+    return true;
+}
+
+static bool bench_open(BenchStream *s)
+{
+    AVCodecParameters *par;
+    const AVCodec *codec = NULL;
+
+    if (avformat_open_input(&s->fmt_ctx, input_file, NULL, NULL) < 0 ||
+        avformat_find_stream_info(s->fmt_ctx, NULL) < 0) {
+        return false;
+    }
+    s->video_index = av_find_best_stream(s->fmt_ctx, AVMEDIA_TYPE_VIDEO,
+                                         -1, -1, &codec, 0);
+    if (s->video_index < 0) {
+        return false;
+    }
+    par = s->fmt_ctx->streams[s->video_index]->codecpar;
+
+    s->component = dcodec_vdec_init_component(OMX_VIDEO_CodingAutoDetect,
+                                              bench_notify);
+    if (s->component == NULL) {
+        return false;
+    }
+    s->component->mAppPrivate = (uintptr_t)s;
+
+    if (!bench_set_parameter(s, (OMX_INDEXTYPE)OMX_IndexParamVideoFFmpeg,
+                             &(OMX_VIDEO_PARAM_FFMPEGTYPE) {
+                                 .nSize = sizeof(OMX_VIDEO_PARAM_FFMPEGTYPE),
+                                 .nPortIndex = CODEC_INPUT_PORT_INDEX,
+                                 .eCodecId = par->codec_id,
+                                 .nWidth = par->width,
+                                 .nHeight = par->height,
+                             }) ||
+        !bench_set_parameter(s, OMX_IndexParamVideoDcodecDefinition,
+                             &(OMX_VIDEO_DCODECDEFINITIONTYPE) {
+                                 .nPortIndex = CODEC_OUTPUT_PORT_INDEX,
+                                 .nFrameWidth = par->width,
+                                 .nFrameHeight = par->height,
+                                 .eColorFormat = OMX_COLOR_Format32BitRGBA8888,
+                                 .bLowLatency = low_latency,
+                             })) {
+        return false;
+    }
+
+    /* compressed frames are smaller than raw yuv420p ones in practice */
+    s->input_size = MAX(av_image_get_buffer_size(AV_PIX_FMT_YUV420P,
+                                                 par->width, par->height, 1),
+                        par->extradata_size);
+    s->output_size = av_image_get_buffer_size(AV_PIX_FMT_RGBA, par->width,
+                                              par->height, 1);
+    for (int i = 0; i < BENCH_BUFFERS; i++) {
+        s->input_mem[i] = g_malloc0(s->input_size);
+        s->output_mem[i] = g_malloc0(s->output_size);
+    }
+    return true;
+}
+
+/* gives the component its buffers, config buffers are held until the first data buffer */
+static bool bench_prime(BenchStream *s)
+{
+    AVCodecParameters *par = s->fmt_ctx->streams[s->video_index]->codecpar;
+
+    dcodec_component_start_worker(s->component);
+
+    for (int i = 0; i < BENCH_BUFFERS; i++) {
+        bench_queue_output(s, i);
+    }
+    for (int i = 0; i < BENCH_BUFFERS; i++) {
+        if (i == 0 && par->extradata_size > 0) {
+            memcpy(s->input_mem[0], par->extradata, par->extradata_size);
+            bench_queue_buffer(s, CODEC_BUFFER_TYPE_INPUT, 0, s->input_mem[0],
+                               s->input_size, par->extradata_size, 0,
+                               OMX_BUFFERFLAG_CODECCONFIG);
+            continue;
+        }
+        if (!bench_queue_input(s, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool bench_handle_event(BenchStream *s, CodecCallbackData *ccd)
+{
+    if (ccd->event == OMX_EventEmptyBufferDone) {
+        return bench_queue_input(s, ccd->data);
+    } else if (ccd->event == OMX_EventFillBufferDone) {
+        if (ccd->data1 > 0 && !(ccd->flags & OMX_BUFFERFLAG_CODECCONFIG)) {
+            s->info->frames++;
+        }
+        bench_queue_output(s, ccd->data - BENCH_OUTPUT_ID);
+        return true;
+    }
+    return ccd->event != OMX_EventError;
+}
+
+static void *stream_func(void *arg)
+{
+    BenchStream s = {
+        .info = arg,
+        .pkt = av_packet_alloc(),
+        .events = g_async_queue_new_full(g_free),
+    };
+    CodecCallbackData *ccd;
+    bool ok = bench_open(&s);
+
+    qatomic_inc(&n_ready_streams);
+    while (!qatomic_read(&test_start)) {
+        g_usleep(100);
+    }
+
+    ok = ok && bench_prime(&s);
+    while (ok && !qatomic_read(&test_stop)) {
+        ccd = g_async_queue_timeout_pop(s.events, BENCH_STALL_US);
+        ok = ccd && bench_handle_event(&s, ccd);
+        g_free(ccd);
+    }
+    s.info->failed = !ok;
+
+    /* stops the worker and waits for the conversions still in flight */
+    if (s.component) {
+        s.component->destroy_component(s.component);
+    }
+    g_async_queue_unref(s.events);
+    for (int i = 0; i < BENCH_BUFFERS; i++) {
+        g_free(s.input_mem[i]);
+        g_free(s.output_mem[i]);
+    }
+    av_packet_free(&s.pkt);
+    avformat_close_input(&s.fmt_ctx);
+    return NULL;
+}
+
+static void run_test(void)
+{
+    unsigned int i;
+
+    while (qatomic_read(&n_ready_streams) != n_streams) {
+        g_usleep(1000);
+    }
+
+    qatomic_set(&test_start, true);
+    g_usleep(duration * G_USEC_PER_SEC);
+    qatomic_set(&test_stop, true);
+
+    for (i = 0; i < n_streams; i++) {
+        qemu_thread_join(&streams[i].thread);
+    }
+}
+
+static void create_threads(void)
+{
+    unsigned int i;
+
+    express_codec_decode_threads = decode_threads;
+    streams = g_new0(struct stream_info, n_streams);
+    for (i = 0; i < n_streams; i++) {
+        qemu_thread_create(&streams[i].thread, "stream", stream_func,
+                           &streams[i], QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" input:             %s\n", input_file);
+    printf(" # of streams:      %u\n", n_streams);
+    printf(" decoder threads:   %d%s\n", decode_threads,
+           low_latency ? " (low latency)" : "");
+    printf(" duration:          %u\n", duration);
+}
+
+static int pr_stats(void)
+{
+    unsigned long long total = 0;
+    unsigned int i;
+    int failed = 0;
+
+    printf("Results:\n");
+    for (i = 0; i < n_streams; i++) {
+        if (streams[i].failed) {
+            printf(" stream %u:          failed to decode %s\n", i, input_file);
+            failed = 1;
+            continue;
+        }
+        printf(" stream %u:          %.2f fps\n", i,
+               (double)streams[i].frames / duration);
+        total += streams[i].frames;
+    }
+    printf(" Aggregate:         %.2f fps\n", (double)total / duration);
+    return failed;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hf:n:t:ld:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'f':
+            input_file = optarg;
+            break;
+        case 'n':
+            n_streams = atoi(optarg);
+            break;
+        case 't':
+            decode_threads = atoi(optarg);
+            break;
+        case 'l':
+            low_latency = true;
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        }
+    }
+    if (input_file == NULL || n_streams == 0) {
+        usage_complete(argv);
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    pr_params();
+    create_threads();
+    run_test();
+    return pr_stats();
+}
@@ -0,0 +1,178 @@
+/*
+ * Wake/wait latency benchmark for the teleport-express event primitive
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "hw/teleport-express/express_event.h"
+
+static void *ping_event;
+static void *pong_event;
+static QemuThread pong_thread;
+static unsigned int duration = 1;
+static unsigned int timeout_ms = 2;
+static unsigned int timeout_rounds = 100;
+static bool test_stop;
+static unsigned long long round_trips;
+static unsigned long long fast_path_ops;
+static int64_t timeout_overshoot_sum;
+static int64_t timeout_overshoot_max;
+static unsigned int timeout_errors;
+
+static const char commands_string[] =
+    " -d = duration in seconds of the ping-pong and fast path tests\n"
+    " -t = timeout in ms for the timeout accuracy test\n"
+    " -r = rounds of the timeout accuracy test";
+
+/*
+ * express_event.c logs through express_printf, which only resolves to
+ * null_printf when STD_DEBUG_LOG is not defined.
+ */
+int null_printf(const char *a, ...)
+{
+    return 0;
+}
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static void *pong_func(void *arg)
+{
+    while (1) {
+        wait_event(ping_event, EXPRESS_EVENT_INFINITE);
+        if (qatomic_read(&test_stop)) {
+            break;
+        }
+        set_event(pong_event);
+    }
+    return NULL;
+}
+
+/* Two threads bouncing an auto-reset event: every hop is a wake + wait */
+static void run_ping_pong(void)
+{
+    int64_t end;
+
+    ping_event = create_event(0, 0);
+    pong_event = create_event(0, 0);
+    qemu_thread_create(&pong_thread, "pong", pong_func, NULL,
+                       QEMU_THREAD_JOINABLE);
+
+    end = get_clock() + duration * NANOSECONDS_PER_SECOND;
+    while (get_clock() < end) {
+        set_event(ping_event);
+        wait_event(pong_event, EXPRESS_EVENT_INFINITE);
+        round_trips++;
+    }
+
+    qatomic_set(&test_stop, true);
+    set_event(ping_event);
+    qemu_thread_join(&pong_thread);
+    delete_event(ping_event);
+    delete_event(pong_event);
+}
+
+/* set/wait on the same thread never has to sleep */
+static void run_fast_path(void)
+{
+    void *event = create_event(0, 0);
+    int64_t end = get_clock() + duration * NANOSECONDS_PER_SECOND;
+
+    while (get_clock() < end) {
+        unsigned int i;
+
+        for (i = 0; i < 1024; i++) {
+            set_event(event);
+            wait_event(event, 0);
+        }
+        fast_path_ops += 1024;
+    }
+    delete_event(event);
+}
+
+/* Nobody signals the event: the wait must return 1 after ~timeout_ms */
+static void run_timeout(void)
+{
+    void *event = create_event(0, 0);
+    unsigned int i;
+
+    for (i = 0; i < timeout_rounds; i++) {
+        int64_t start = get_clock();
+        int ret = wait_event(event, timeout_ms);
+        int64_t overshoot = get_clock() - start - timeout_ms * SCALE_MS;
+
+        if (ret != 1 || overshoot < 0) {
+            timeout_errors++;
+        }
+        timeout_overshoot_sum += overshoot;
+        timeout_overshoot_max = MAX(timeout_overshoot_max, overshoot);
+    }
+    delete_event(event);
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" duration:          %u\n", duration);
+    printf(" timeout:           %u ms\n", timeout_ms);
+    printf(" timeout rounds:    %u\n", timeout_rounds);
+}
+
+static void pr_stats(void)
+{
+    double rtt = (double)duration * NANOSECONDS_PER_SECOND / round_trips;
+
+    printf("Results:\n");
+    printf(" Round trips:        %llu\n", round_trips);
+    printf(" Round trip latency: %.2f us\n", rtt / 1e3);
+    printf(" Wake+wait latency:  %.2f us\n", rtt / 2 / 1e3);
+    printf(" Fast path:          %.2f Mops/s\n",
+           fast_path_ops / duration / 1e6);
+    printf(" Timeout overshoot:  avg %.2f us, max %.2f us\n",
+           (double)timeout_overshoot_sum / timeout_rounds / 1e3,
+           timeout_overshoot_max / 1e3);
+    printf(" Timeout errors:     %u\n", timeout_errors);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hd:t:r:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 't':
+            timeout_ms = atoi(optarg);
+            break;
+        case 'r':
+            timeout_rounds = atoi(optarg);
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    pr_params();
+    run_ping_pong();
+    run_fast_path();
+    run_timeout();
+    pr_stats();
+    return timeout_errors ? 1 : 0;
+}
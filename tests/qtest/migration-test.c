@@ -1495,6 +1495,78 @@ static void test_precopy_unix_xbzrle(void)
     test_precopy_common(&args);
 }
 
+static void *test_migrate_mapped_ram_start(QTestState *from,
+                                           QTestState *to)
+{
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(to, "mapped-ram", true);
+
+    return NULL;
+}
+
+/*
+ * The destination can only read the file once the source is done
+ * writing it, so unlike test_precopy_common() the incoming side is
+ * started after the source has completed.
+ */
+static void test_file_mapped_ram_common(bool lazy_restore)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    g_autofree char *path = g_strdup_printf("%s/migfile", tmpfs);
+    MigrateStart args = {};
+    QTestState *from, *to;
+    QDict *rsp;
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    test_migrate_mapped_ram_start(from, to);
+    if (lazy_restore) {
+        migrate_set_capability(to, "lazy-restore", true);
+    }
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    /* Let dirty pages be rewritten in place a few times before completing */
+    migrate_ensure_non_converge(from);
+    migrate_qmp(from, uri, "{}");
+    wait_for_migration_pass(from);
+    migrate_ensure_converge(from);
+    wait_for_migration_complete(from);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", uri);
+    qobject_unref(rsp);
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+
+    if (lazy_restore) {
+        /* Completes once all of RAM has been read in the background */
+        wait_for_migration_complete(to);
+    }
+
+    test_migrate_end(from, to, true);
+    unlink(path);
+}
+
+static void test_precopy_file_mapped_ram(void)
+{
+    test_file_mapped_ram_common(false);
+}
+
+static void test_precopy_file_lazy_restore(void)
+{
+    test_file_mapped_ram_common(true);
+}
+
 static void test_precopy_tcp_plain(void)
 {
     MigrateCommon args = {
@@ -2472,6 +2544,12 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix/plain", test_precopy_unix_plain);
     qtest_add_func("/migration/precopy/unix/xbzrle", test_precopy_unix_xbzrle);
+    qtest_add_func("/migration/precopy/file/mapped-ram",
+                   test_precopy_file_mapped_ram);
+    if (has_uffd) {
+        qtest_add_func("/migration/precopy/file/lazy-restore",
+                       test_precopy_file_lazy_restore);
+    }
 #ifdef CONFIG_GNUTLS
     qtest_add_func("/migration/precopy/unix/tls/psk",
                    test_precopy_unix_tls_psk);
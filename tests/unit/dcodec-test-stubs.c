@@ -0,0 +1,195 @@
+/*
+ * Stubs for the dcodec test
+ *
+ * Stand in for the parts of teleport-express, express-mem and express-gpu
+ * that the dcodec components call into. Guest memory is plain host memory
+ * described by a single scatter list, mem transfers run on a thread pool
+ * like the express-mem workers, and there is no GL context, so only guest
+ * memory buffers can be used.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "hw/teleport-express/express_log.h"
+#include "hw/teleport-express/teleport_express_call.h"
+#include "hw/teleport-express/teleport_express_register.h"
+#include "hw/express-mem/express_sync.h"
+#include "hw/express-mem/express_mem.h"
+#include "hw/express-gpu/egl_surface.h"
+#include "hw/express-gpu/egl_window.h"
+#include "hw/express-gpu/glv3_context.h"
+
+/* same as the express-mem device */
+#define MEM_WORKER_THREADS 4
+
+static GThreadPool *mem_pool;
+
+char *get_now_time(void)
+{
+    /* the components log to stdout, keep their lines TAP comments */
+    return (char *)"#";
+}
+
+int null_printf(const char *a, ...)
+{
+    return 0;
+}
+
+static void guest_mem_exchange(Guest_Mem *guest, unsigned char *host,
+                               size_t start_loc, size_t length, bool to_host)
+{
+    g_assert_cmpuint(start_loc + length, <=, guest->all_len);
+
+    for (int i = 0; i < guest->num && length > 0; i++) {
+        Scatter_Data *sd = &guest->scatter_data[i];
+        if (start_loc >= sd->len) {
+            start_loc -= sd->len;
+            continue;
+        }
+        size_t len = MIN(sd->len - start_loc, length);
+        if (to_host) {
+            memcpy(host, sd->data + start_loc, len);
+        } else {
+            memcpy(sd->data + start_loc, host, len);
+        }
+        host += len;
+        length -= len;
+        start_loc = 0;
+    }
+}
+
+void read_from_guest_mem(Guest_Mem *guest, void *host, size_t start_loc, size_t length)
+{
+    if (guest == NULL || length == 0) {
+        return;
+    }
+    guest_mem_exchange(guest, host, start_loc, length, true);
+}
+
+void write_to_guest_mem(Guest_Mem *guest, void *host, size_t start_loc, size_t length)
+{
+    g_assert_nonnull(guest);
+    guest_mem_exchange(guest, host, start_loc, length, false);
+}
+
+void free_copied_guest_mem(Guest_Mem *mem)
+{
+    /* the scatter list is owned by the component, the memory by the test */
+    if (mem != NULL) {
+        g_free(mem->scatter_data);
+        g_free(mem);
+    }
+}
+
+int set_express_device_irq(Device_Context *device_context, int buf_index, int len)
+{
+    return 0;
+}
+
+void signal_express_sync(int sync_id, bool need_gpu_sync)
+{
+}
+
+static void mem_worker(gpointer data, gpointer user_data)
+{
+    MemTransferTask *task = data;
+
+    /* without gbuffers, every transfer is opaque and done by pre_cb */
+    g_assert_nonnull(task->pre_cb);
+    task->pre_cb(task, NULL);
+    if (task->post_cb) {
+        task->post_cb(task, 0);
+    }
+    g_free(task);
+}
+
+void mem_transfer_async(ExpressMemType dst_dev, ExpressMemType src_dev,
+                        void *dst_data, void *src_data, int dst_len,
+                        int src_len, int sync_id, PreprocessCbType pre_cb,
+                        PostprocessCbType post_cb, void *private_data)
+{
+    MemTransferTask *task;
+
+    if (dst_dev == src_dev) {
+        return;
+    }
+
+    if (g_once_init_enter(&mem_pool)) {
+        g_once_init_leave(&mem_pool, g_thread_pool_new(mem_worker, NULL,
+                                                       MEM_WORKER_THREADS,
+                                                       true, NULL));
+    }
+
+    task = g_new0(MemTransferTask, 1);
+    task->dst_dev = dst_dev;
+    task->src_dev = src_dev;
+    task->dst_data = dst_data;
+    task->src_data = src_data;
+    task->dst_len = dst_len;
+    task->src_len = src_len;
+    task->sync_id = sync_id;
+    task->pre_cb = pre_cb;
+    task->post_cb = post_cb;
+    task->private_data = private_data;
+    g_thread_pool_push(mem_pool, task, NULL);
+}
+
+bool mem_transfer_is_busy(void)
+{
+    return mem_pool && g_thread_pool_unprocessed(mem_pool) > MEM_WORKER_THREADS;
+}
+
+ExpressMemType mem_predict_prefetch(Hardware_Buffer *gbuffer, int virt_dev,
+                                    ExpressMemType phy_dev, uint32_t *pred_block)
+{
+    *pred_block = 0;
+    return EXPRESS_MEM_TYPE_UNKNOWN;
+}
+
+void update_gbuffer_phy_usage(Hardware_Buffer *gbuffer, ExpressMemType phy_dev, int write)
+{
+}
+
+Hardware_Buffer *get_gbuffer_from_global_map(uint64_t gbuffer_id)
+{
+    return NULL;
+}
+
+void add_gbuffer_to_global(Hardware_Buffer *global_gbuffer)
+{
+    g_assert_not_reached();
+}
+
+Hardware_Buffer *create_gbuffer(int width, int height, int sampler_num,
+                                int format, int pixel_type, int internal_format,
+                                int depth_internal_format,
+                                int stencil_internal_format, uint64_t gbuffer_id)
+{
+    g_assert_not_reached();
+}
+
+static void APIENTRY stub_gl_delete(GLsizei n, const GLuint *names)
+{
+}
+
+void *get_native_opengl_context(int context_flags)
+{
+    static int context;
+
+    /* the components only delete their own objects when they release it */
+    glad_glDeleteFramebuffers = stub_gl_delete;
+    glad_glDeleteTextures = stub_gl_delete;
+    return &context;
+}
+
+void release_native_opengl_context(void *native_context, int context_flags)
+{
+}
+
+int egl_makeCurrent(void *context)
+{
+    return 1;
+}
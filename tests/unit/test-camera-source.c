@@ -0,0 +1,166 @@
+/*
+ * express-camera frame source test
+ *
+ * Checks the synthetic test pattern, looping over a media file with
+ * continuous timestamps, and the schedule the capturing thread releases
+ * frames on.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+
+#include "libavutil/imgutils.h"
+
+#include "hw/express-camera/camera_source.h"
+
+#define TEST_FILE_WIDTH 16
+#define TEST_FILE_HEIGHT 16
+#define TEST_FILE_FRAMES 3
+
+char *get_now_time(void)
+{
+    /* camera_source.c logs to stdout, keep its lines TAP comments */
+    return (char *)"#";
+}
+
+int null_printf(const char *a, ...)
+{
+    return 0;
+}
+
+static void test_synthetic(void)
+{
+    CameraSource *source = camera_source_open("synthetic:64x48@15");
+    int frame_size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, 64, 48, 1);
+    AVPacket *pkt[3];
+
+    g_assert_nonnull(source);
+    g_assert_true(source->paced);
+    g_assert_cmpint(source->codecpar->codec_id, ==, AV_CODEC_ID_RAWVIDEO);
+    g_assert_cmpint(source->codecpar->format, ==, AV_PIX_FMT_YUV420P);
+    g_assert_cmpint(source->codecpar->width, ==, 64);
+    g_assert_cmpint(source->codecpar->height, ==, 48);
+    g_assert_cmpint(av_cmp_q(source->frame_rate, (AVRational){ 15, 1 }), ==, 0);
+
+    for (int i = 0; i < 3; i++) {
+        pkt[i] = av_packet_alloc();
+        g_assert_cmpint(source->read_packet(source, pkt[i]), ==, 0);
+        g_assert_cmpint(pkt[i]->size, ==, frame_size);
+        g_assert_cmpint(pkt[i]->pts, ==, i);
+    }
+
+    /* the first frame starts with the white bar, its moving line is on row 0 */
+    g_assert_cmpint(pkt[0]->data[0], ==, 128);
+    g_assert_cmpint(pkt[0]->data[64], ==, 235);
+    g_assert_cmpint(pkt[0]->data[64 * 48 - 1], ==, 16);
+    g_assert_cmpint(memcmp(pkt[0]->data, pkt[1]->data, frame_size), !=, 0);
+    g_assert_cmpint(memcmp(pkt[1]->data, pkt[2]->data, frame_size), !=, 0);
+
+    for (int i = 0; i < 3; i++) {
+        av_packet_free(&pkt[i]);
+    }
+    source->close(source);
+
+    source = camera_source_open("synthetic");
+    g_assert_nonnull(source);
+    g_assert_cmpint(source->codecpar->width, ==, 1280);
+    g_assert_cmpint(source->codecpar->height, ==, 720);
+    source->close(source);
+
+    g_assert_null(camera_source_open("synthetic:large"));
+}
+
+static char *write_test_file(void)
+{
+    int frame_size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, TEST_FILE_WIDTH,
+                                              TEST_FILE_HEIGHT, 1);
+    g_autofree uint8_t *frame = g_malloc(frame_size);
+    g_autoptr(GError) err = NULL;
+    char *path = NULL;
+    FILE *f;
+    int fd;
+
+    fd = g_file_open_tmp("camera-source-XXXXXX.y4m", &path, &err);
+    g_assert_no_error(err);
+    f = fdopen(fd, "wb");
+    g_assert_nonnull(f);
+
+    fprintf(f, "YUV4MPEG2 W%d H%d F30:1 Ip A1:1 C420jpeg\n",
+            TEST_FILE_WIDTH, TEST_FILE_HEIGHT);
+    for (int i = 0; i < TEST_FILE_FRAMES; i++) {
+        memset(frame, 10 * (i + 1), frame_size);
+        fprintf(f, "FRAME\n");
+        g_assert_cmpint(fwrite(frame, 1, frame_size, f), ==, frame_size);
+    }
+    fclose(f);
+    return path;
+}
+
+static void test_file_loop(void)
+{
+    g_autofree char *path = write_test_file();
+    CameraSource *source = camera_source_open(path);
+    AVPacket *pkt = av_packet_alloc();
+    int64_t frame_duration;
+
+    g_assert_nonnull(source);
+    g_assert_true(source->paced);
+    g_assert_cmpint(source->codecpar->codec_id, ==, AV_CODEC_ID_RAWVIDEO);
+    g_assert_cmpint(source->codecpar->width, ==, TEST_FILE_WIDTH);
+    g_assert_cmpint(source->codecpar->height, ==, TEST_FILE_HEIGHT);
+    frame_duration = av_rescale_q(1, av_inv_q(source->frame_rate), source->time_base);
+
+    /* the timeline goes on across loops, the content repeats */
+    for (int i = 0; i < TEST_FILE_FRAMES * 2 + 1; i++) {
+        g_assert_cmpint(source->read_packet(source, pkt), ==, 0);
+        g_assert_cmpint(pkt->pts, ==, i * frame_duration);
+        g_assert_cmpint(pkt->data[0], ==, 10 * (i % TEST_FILE_FRAMES + 1));
+        av_packet_unref(pkt);
+    }
+
+    av_packet_free(&pkt);
+    source->close(source);
+    unlink(path);
+
+    g_assert_null(camera_source_open("/nonexistent/camera.y4m"));
+}
+
+static void test_pacer(void)
+{
+    AVRational time_base = { 1, 30 };
+    int64_t start = 5000;
+    CameraPacer pacer;
+
+    camera_pacer_reset(&pacer);
+
+    /* the first frame anchors the schedule */
+    g_assert_cmpint(camera_pacer_due(&pacer, 100, time_base, start), ==, start);
+    g_assert_cmpint(camera_pacer_due(&pacer, 103, time_base, start + 1000), ==,
+                    start + 100 * SCALE_MS);
+    /* being late does not move the schedule */
+    g_assert_cmpint(camera_pacer_due(&pacer, 106, time_base, start + 300 * SCALE_MS), ==,
+                    start + 200 * SCALE_MS);
+
+    /* far behind, the schedule starts over from the current frame */
+    int64_t now = start + 4 * NANOSECONDS_PER_SECOND;
+    g_assert_cmpint(camera_pacer_due(&pacer, 107, time_base, now), ==, now);
+    g_assert_cmpint(camera_pacer_due(&pacer, 108, time_base, now), ==,
+                    now + av_rescale_q(1, time_base, (AVRational){ 1, NANOSECONDS_PER_SECOND }));
+
+    /* and so does a jump of the timestamps */
+    g_assert_cmpint(camera_pacer_due(&pacer, 100000, time_base, now), ==, now);
+
+    g_assert_cmpint(camera_pacer_due(&pacer, AV_NOPTS_VALUE, time_base, now + 7), ==, now + 7);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/camera-source/synthetic", test_synthetic);
+    g_test_add_func("/camera-source/file-loop", test_file_loop);
+    g_test_add_func("/camera-source/pacer", test_pacer);
+
+    return g_test_run();
+}
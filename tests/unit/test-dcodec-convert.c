@@ -0,0 +1,175 @@
+/*
+ * dcodec colour conversion kernel test
+ *
+ * Every accelerated row kernel of the direct yuv <-> rgba conversion must
+ * produce exactly the output of the plain c version. Each one available on
+ * the host converts random pictures with odd widths and heights, whose rows
+ * are padded to odd strides and start at unaligned addresses, and the whole
+ * destination, padding included, is compared with the c output.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+
+#include "libavutil/pixdesc.h"
+
+#include "hw/express-codec/dcodec_convert.h"
+
+/* the simd kernels work on 16 or 32 pixels, widths cover both plus a tail */
+static const int widths[] = { 1, 3, 15, 17, 31, 33, 47, 63, 65, 97 };
+static const int heights[] = { 1, 3, 9 };
+
+typedef struct TestConversion {
+    enum AVPixelFormat src;
+    enum AVPixelFormat dst;
+} TestConversion;
+
+/* the formats that have accelerated kernels */
+static const TestConversion conversions[] = {
+    { AV_PIX_FMT_YUV420P, AV_PIX_FMT_RGBA },
+    { AV_PIX_FMT_YUV420P, AV_PIX_FMT_BGRA },
+    { AV_PIX_FMT_NV12, AV_PIX_FMT_RGBA },
+    { AV_PIX_FMT_NV12, AV_PIX_FMT_BGRA },
+    { AV_PIX_FMT_RGBA, AV_PIX_FMT_YUV420P },
+    { AV_PIX_FMT_RGBA, AV_PIX_FMT_NV12 },
+    { AV_PIX_FMT_BGRA, AV_PIX_FMT_YUV420P },
+    { AV_PIX_FMT_BGRA, AV_PIX_FMT_NV12 },
+};
+
+/* planes of one picture in a single allocation, offset from its start */
+typedef struct TestPicture {
+    uint8_t *buf;
+    size_t size;
+    uint8_t *data[4];
+    int linesize[4];
+} TestPicture;
+
+/* bytes per row of each plane, and number of rows */
+static int test_plane_layout(enum AVPixelFormat fmt, int width, int height,
+                             int row_bytes[4], int rows[4])
+{
+    int chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+
+    switch (fmt) {
+    case AV_PIX_FMT_YUV420P:
+        row_bytes[0] = width;
+        rows[0] = height;
+        row_bytes[1] = row_bytes[2] = chroma_width;
+        rows[1] = rows[2] = chroma_height;
+        return 3;
+    case AV_PIX_FMT_NV12:
+        row_bytes[0] = width;
+        rows[0] = height;
+        row_bytes[1] = chroma_width * 2;
+        rows[1] = chroma_height;
+        return 2;
+    default:
+        row_bytes[0] = width * 4;
+        rows[0] = height;
+        return 1;
+    }
+}
+
+static void test_picture_alloc(TestPicture *pic, enum AVPixelFormat fmt,
+                               int width, int height)
+{
+    int row_bytes[4], rows[4];
+    int planes = test_plane_layout(fmt, width, height, row_bytes, rows);
+    size_t offsets[4];
+
+    /* every plane starts one byte past a boundary and is padded to an odd stride */
+    pic->size = 1;
+    for (int i = 0; i < planes; i++) {
+        pic->linesize[i] = row_bytes[i] + 7 + 2 * i;
+        offsets[i] = pic->size;
+        pic->size += (size_t)pic->linesize[i] * rows[i] + 1;
+    }
+    pic->buf = g_malloc(pic->size);
+    memset(pic->data, 0, sizeof(pic->data));
+    for (int i = 0; i < planes; i++) {
+        pic->data[i] = pic->buf + offsets[i];
+    }
+}
+
+static void test_picture_fill(TestPicture *pic, GRand *rand)
+{
+    for (size_t i = 0; i < pic->size; i++) {
+        pic->buf[i] = g_rand_int_range(rand, 0, 256);
+    }
+}
+
+static void test_convert(const TestConversion *conv, const TestPicture *src,
+                         TestPicture *dst, int width, int height)
+{
+    /* the destination padding has to come out untouched as well */
+    memset(dst->buf, 0xa5, dst->size);
+    g_assert_true(dcodec_convert_frame((const uint8_t * const *)src->data,
+                                       src->linesize, conv->src, dst->data,
+                                       dst->linesize, conv->dst, width, height));
+}
+
+static void test_kernels(const void *opaque)
+{
+    const TestConversion *conv = opaque;
+    g_autoptr(GRand) rand = g_rand_new_with_seed(conv->src * 64 + conv->dst);
+    int tested = 0;
+
+    for (int w = 0; w < ARRAY_SIZE(widths); w++) {
+        for (int h = 0; h < ARRAY_SIZE(heights); h++) {
+            int width = widths[w], height = heights[h];
+            TestPicture src, ref, out;
+
+            test_picture_alloc(&src, conv->src, width, height);
+            test_picture_alloc(&ref, conv->dst, width, height);
+            test_picture_alloc(&out, conv->dst, width, height);
+            test_picture_fill(&src, rand);
+
+            /* the c version is the last one */
+            dcodec_convert_reset_accel();
+            while (dcodec_convert_next_accel()) {
+            }
+            g_assert_cmpstr(dcodec_convert_accel_name(), ==, "c");
+            test_convert(conv, &src, &ref, width, height);
+
+            dcodec_convert_reset_accel();
+            while (strcmp(dcodec_convert_accel_name(), "c") != 0) {
+                test_convert(conv, &src, &out, width, height);
+                if (memcmp(ref.buf, out.buf, ref.size) != 0) {
+                    g_test_message("%s differs from c at %dx%d",
+                                   dcodec_convert_accel_name(), width, height);
+                    g_test_fail();
+                }
+                if (w == 0 && h == 0) {
+                    g_test_message("testing %s", dcodec_convert_accel_name());
+                }
+                tested++;
+                dcodec_convert_next_accel();
+            }
+
+            g_free(src.buf);
+            g_free(ref.buf);
+            g_free(out.buf);
+        }
+    }
+
+    dcodec_convert_reset_accel();
+    if (tested == 0) {
+        g_test_skip("no accelerated kernel on this host");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    for (int i = 0; i < ARRAY_SIZE(conversions); i++) {
+        g_autofree char *path =
+            g_strdup_printf("/dcodec/convert/%s/%s",
+                            av_get_pix_fmt_name(conversions[i].src),
+                            av_get_pix_fmt_name(conversions[i].dst));
+        g_test_add_data_func(path, &conversions[i], test_kernels);
+    }
+
+    return g_test_run();
+}
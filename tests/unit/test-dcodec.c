@@ -0,0 +1,819 @@
+/*
+ * dcodec conformance and benchmark test
+ *
+ * Drives the dcodec video decoder, video encoder and audio decoder through
+ * the BufferDesc/notify contract used by the guest driver, with streams that
+ * are generated in-process by the libavcodec software codecs. The output of
+ * each component is compared with a plain libavcodec run, and the number of
+ * buffers per second, the latency from queueing an input buffer to getting
+ * the matching output back and the CPU time spent outside the test thread
+ * are reported for every codec and output memory type. Run with -m perf for
+ * 720p streams.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/crc32c.h"
+#include "qemu/timer.h"
+
+#include "hw/express-codec/dcodec_audio.h"
+#include "hw/express-codec/dcodec_video.h"
+
+#define TEST_BUFFERS 4
+#define TEST_OUTPUT_ID 0x100
+#define TEST_FRAMERATE 30
+/* no buffer came back for this long, the component is stuck */
+#define TEST_STALL_US (10 * G_USEC_PER_SEC)
+
+static int width = 320;
+static int height = 240;
+static int frames = 60;
+
+typedef struct DCodecTestEvent {
+    CodecCallbackData ccd;
+    int64_t time;
+} DCodecTestEvent;
+
+typedef struct DCodecTest DCodecTest;
+
+struct DCodecTest {
+    /* codec and output memory type, for the report */
+    const char *name;
+    DCodecComponent *component;
+    GAsyncQueue *events;
+
+    /* writes data buffer @index, returns its length */
+    size_t (*fill_input)(DCodecTest *t, int index, uint8_t *buf, int64_t *ts);
+    /* called for every output buffer that carries data */
+    void (*check)(DCodecTest *t, const uint8_t *data, size_t len, int64_t ts);
+    int inputs;
+    GBytes *config;
+
+    size_t input_size;
+    size_t output_size;
+    /* if set, guest memory is split into scatter entries of this size */
+    size_t page_size;
+    uint8_t *input_mem[TEST_BUFFERS];
+    uint8_t *output_mem[TEST_BUFFERS];
+    int next_input;
+    bool input_eos_done;
+
+    /* int64_t queue time of the input buffers, by truncated timestamp */
+    GHashTable *queued_at;
+    GArray *latency;
+
+    int outputs;
+    /* number of data outputs after which the test is done, or 0 if check decides */
+    int expected_outputs;
+    bool done;
+    bool output_eos;
+
+    /* codec extradata, copied before the component is destroyed */
+    GBytes *extradata;
+    void *opaque;
+};
+
+static void test_notify(DCodecComponent *component, CodecCallbackData ccd)
+{
+    DCodecTest *t = (DCodecTest *)(uintptr_t)component->mAppPrivate;
+    DCodecTestEvent *ev = g_new(DCodecTestEvent, 1);
+
+    ev->ccd = ccd;
+    ev->time = get_clock();
+    g_async_queue_push(t->events, ev);
+}
+
+static int64_t cpu_time(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * NANOSECONDS_PER_SECOND + ts.tv_nsec;
+}
+
+static void test_set_parameter(DCodecTest *t, OMX_INDEXTYPE index, OMX_PTR params)
+{
+    OMX_ERRORTYPE err;
+
+    g_mutex_lock(&t->component->lock);
+    err = t->component->set_parameter(t->component, index, params);
+    g_mutex_unlock(&t->component->lock);
+    g_assert_cmpint(err, ==, OMX_ErrorNone);
+}
+
+/*
+ * guest memory is a scatter list over host memory owned by the test, one entry
+ * or one per page
+ */
+static Guest_Mem *test_guest_mem(uint8_t *data, size_t len, size_t page_size)
+{
+    Guest_Mem *mem = g_new0(Guest_Mem, 1);
+    size_t entry = page_size ? page_size : len;
+
+    mem->num = len ? DIV_ROUND_UP(len, entry) : 1;
+    mem->scatter_data = g_new0(Scatter_Data, mem->num);
+    for (int i = 0; i < mem->num; i++) {
+        mem->scatter_data[i].data = data + i * entry;
+        mem->scatter_data[i].len = MIN(entry, len - i * entry);
+    }
+    mem->all_len = len;
+    return mem;
+}
+
+static void test_queue_buffer(DCodecTest *t, uint32_t type, uint64_t id,
+                              uint8_t *data, size_t alloc_len,
+                              size_t filled_len, int64_t ts, uint32_t flags)
+{
+    BufferDesc *desc = g_new0(BufferDesc, 1);
+
+    desc->type = type | CODEC_BUFFER_TYPE_GUEST_MEM;
+    desc->id = id;
+    desc->nAllocLen = alloc_len;
+    desc->nFilledLen = filled_len;
+    desc->nTimeStamp = ts;
+    desc->nFlags = flags;
+    desc->data = test_guest_mem(data, alloc_len, t->page_size);
+
+    g_mutex_lock(&t->component->lock);
+    dcodec_process_this_buffer(t->component, desc);
+    g_mutex_unlock(&t->component->lock);
+}
+
+static void test_queue_output(DCodecTest *t, int slot)
+{
+    test_queue_buffer(t, CODEC_BUFFER_TYPE_OUTPUT, TEST_OUTPUT_ID + slot,
+                      t->output_mem[slot], t->output_size, 0, 0, 0);
+}
+
+static void test_queue_input(DCodecTest *t, int slot)
+{
+    int64_t ts = 0, now;
+    uint32_t flags = 0;
+    size_t len;
+
+    if (t->next_input == t->inputs) {
+        return;
+    }
+
+    len = t->fill_input(t, t->next_input, t->input_mem[slot], &ts);
+    g_assert_cmpuint(len, <=, t->input_size);
+    /* the guest driver marks the last data buffer */
+    if (++t->next_input == t->inputs) {
+        flags |= OMX_BUFFERFLAG_EOS;
+    }
+
+    now = get_clock();
+    g_hash_table_insert(t->queued_at, GUINT_TO_POINTER((uint32_t)ts),
+                        g_memdup2(&now, sizeof(now)));
+    test_queue_buffer(t, CODEC_BUFFER_TYPE_INPUT, slot, t->input_mem[slot],
+                      t->input_size, len, ts, flags);
+}
+
+static void test_handle_event(DCodecTest *t, DCodecTestEvent *ev)
+{
+    CodecCallbackData *ccd = &ev->ccd;
+
+    if (ccd->event == OMX_EventEmptyBufferDone) {
+        g_assert_cmpuint(ccd->data, <, TEST_BUFFERS);
+        if (ccd->flags & OMX_BUFFERFLAG_EOS) {
+            t->input_eos_done = true;
+        }
+        test_queue_input(t, ccd->data);
+    } else if (ccd->event == OMX_EventFillBufferDone) {
+        int slot = ccd->data - TEST_OUTPUT_ID;
+        int64_t *queued;
+
+        g_assert_cmpint(slot, >=, 0);
+        g_assert_cmpint(slot, <, TEST_BUFFERS);
+        g_assert_cmpuint(ccd->data1, <=, t->output_size);
+
+        if (ccd->flags & OMX_BUFFERFLAG_EOS) {
+            t->output_eos = true;
+        }
+        if (ccd->data1 > 0 && !(ccd->flags & OMX_BUFFERFLAG_CODECCONFIG)) {
+            queued = g_hash_table_lookup(t->queued_at, GUINT_TO_POINTER(ccd->data2));
+            if (queued) {
+                int64_t latency = ev->time - *queued;
+                g_array_append_val(t->latency, latency);
+                g_hash_table_remove(t->queued_at, GUINT_TO_POINTER(ccd->data2));
+            }
+            if (t->check) {
+                t->check(t, t->output_mem[slot], ccd->data1, (uint32_t)ccd->data2);
+            }
+            t->outputs++;
+            if (t->expected_outputs && t->outputs == t->expected_outputs) {
+                t->done = true;
+            }
+        }
+        if (!t->output_eos) {
+            test_queue_output(t, slot);
+        }
+    } else {
+        g_assert_cmpint(ccd->event, !=, OMX_EventError);
+    }
+}
+
+static double test_percentile_ms(GArray *latency, int percentile)
+{
+    if (latency->len == 0) {
+        return 0;
+    }
+    return (double)g_array_index(latency, int64_t, (latency->len - 1) * percentile / 100) / SCALE_MS;
+}
+
+static gint test_compare_latency(gconstpointer a, gconstpointer b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Feeds all inputs to the component, which must have been created with
+ * test_notify and configured, and waits until the last output has been
+ * checked. The output EOS buffer is not waited for, codecs without
+ * AV_CODEC_CAP_DELAY never send it.
+ */
+static void test_run(DCodecTest *t)
+{
+    int64_t start, elapsed, process_cpu, thread_cpu;
+    DCodecTestEvent *ev;
+
+    t->events = g_async_queue_new_full(g_free);
+    t->queued_at = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    t->latency = g_array_new(false, false, sizeof(int64_t));
+    for (int i = 0; i < TEST_BUFFERS; i++) {
+        t->input_mem[i] = g_malloc0(t->input_size);
+        t->output_mem[i] = g_malloc0(t->output_size);
+    }
+
+    t->component->mAppPrivate = (uintptr_t)t;
+    dcodec_component_start_worker(t->component);
+
+    start = get_clock();
+    process_cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+    thread_cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID);
+
+    for (int i = 0; i < TEST_BUFFERS; i++) {
+        test_queue_output(t, i);
+    }
+    for (int i = 0; i < TEST_BUFFERS; i++) {
+        if (i == 0 && t->config) {
+            /* config buffers are held until the first data buffer arrives */
+            memcpy(t->input_mem[0], g_bytes_get_data(t->config, NULL),
+                   g_bytes_get_size(t->config));
+            test_queue_buffer(t, CODEC_BUFFER_TYPE_INPUT, 0, t->input_mem[0],
+                              t->input_size, g_bytes_get_size(t->config), 0,
+                              OMX_BUFFERFLAG_CODECCONFIG);
+            continue;
+        }
+        test_queue_input(t, i);
+    }
+
+    while (!t->input_eos_done || !t->done) {
+        ev = g_async_queue_timeout_pop(t->events, TEST_STALL_US);
+        if (!ev) {
+            g_test_message("%s: stalled after %d of %d inputs and %d outputs",
+                           t->name, t->next_input, t->inputs, t->outputs);
+        }
+        g_assert_nonnull(ev);
+        test_handle_event(t, ev);
+        g_free(ev);
+    }
+
+    elapsed = get_clock() - start;
+    /* the test thread only queues buffers and checks outputs */
+    process_cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID) - process_cpu;
+    thread_cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID) - thread_cpu;
+
+    if (t->component->mCtx->extradata_size > 0) {
+        t->extradata = g_bytes_new(t->component->mCtx->extradata,
+                                   t->component->mCtx->extradata_size);
+    }
+    /* stops the worker and waits for the conversions still in flight */
+    t->component->destroy_component(t->component);
+    t->component = NULL;
+
+    g_array_sort(t->latency, test_compare_latency);
+    g_test_message("%s: %d outputs in %.1f ms (%.1f/s), codec cpu %.1f ms "
+                   "(%.3f ms/output), latency p50 %.2f p90 %.2f p99 %.2f "
+                   "max %.2f ms%s",
+                   t->name, t->outputs, (double)elapsed / SCALE_MS,
+                   t->outputs * (double)NANOSECONDS_PER_SECOND / elapsed,
+                   (double)(process_cpu - thread_cpu) / SCALE_MS,
+                   (double)(process_cpu - thread_cpu) / SCALE_MS / MAX(t->outputs, 1),
+                   test_percentile_ms(t->latency, 50),
+                   test_percentile_ms(t->latency, 90),
+                   test_percentile_ms(t->latency, 99),
+                   test_percentile_ms(t->latency, 100),
+                   t->output_eos ? "" : ", no output eos");
+
+    g_async_queue_unref(t->events);
+    g_hash_table_destroy(t->queued_at);
+    g_array_free(t->latency, true);
+    for (int i = 0; i < TEST_BUFFERS; i++) {
+        g_free(t->input_mem[i]);
+        g_free(t->output_mem[i]);
+    }
+    if (t->config) {
+        g_bytes_unref(t->config);
+    }
+}
+
+/* a moving gradient, so that the codecs see both detail and motion */
+static void test_picture(AVFrame *frame, int index)
+{
+    for (int y = 0; y < frame->height; y++) {
+        for (int x = 0; x < frame->width; x++) {
+            frame->data[0][y * frame->linesize[0] + x] = x + y + index * 3;
+        }
+    }
+    for (int y = 0; y < frame->height / 2; y++) {
+        for (int x = 0; x < frame->width / 2; x++) {
+            frame->data[1][y * frame->linesize[1] + x] = 128 + y + index * 2;
+            frame->data[2][y * frame->linesize[2] + x] = 64 + x + index * 5;
+        }
+    }
+}
+
+static int64_t test_frame_ts(int index)
+{
+    return av_rescale_q(index, (AVRational){ 1, TEST_FRAMERATE }, AV_TIME_BASE_Q);
+}
+
+static uint32_t test_image_crc(AVFrame *frame)
+{
+    int size = av_image_get_buffer_size(frame->format, frame->width, frame->height, 1);
+    g_autofree uint8_t *buf = g_malloc(size);
+
+    av_image_copy_to_buffer(buf, size, (const uint8_t * const *)frame->data,
+                            frame->linesize, frame->format, frame->width,
+                            frame->height, 1);
+    return crc32c(0xffffffff, buf, size);
+}
+
+/* the encoded stream and the crc of every frame of a plain decode of it */
+typedef struct TestStream {
+    GPtrArray *packets;
+    GArray *ts;
+    GArray *crc;
+    size_t max_packet;
+} TestStream;
+
+static void test_stream_free(TestStream *s)
+{
+    g_ptr_array_unref(s->packets);
+    g_array_free(s->ts, true);
+    if (s->crc) {
+        g_array_free(s->crc, true);
+    }
+}
+
+static void test_receive_packets(AVCodecContext *enc, TestStream *s)
+{
+    AVPacket *pkt = av_packet_alloc();
+
+    while (avcodec_receive_packet(enc, pkt) == 0) {
+        int64_t ts = av_rescale_q(pkt->pts, enc->time_base, AV_TIME_BASE_Q);
+
+        /* the flac encoder ends with an empty packet carrying the final streaminfo */
+        if (pkt->size == 0) {
+            av_packet_unref(pkt);
+            continue;
+        }
+        g_ptr_array_add(s->packets, g_bytes_new(pkt->data, pkt->size));
+        g_array_append_val(s->ts, ts);
+        s->max_packet = MAX(s->max_packet, pkt->size);
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+}
+
+/* decodes @packets with libavcodec and appends the crc of every frame */
+static void test_reference_decode(enum AVCodecID id, GBytes *extradata,
+                                  GPtrArray *packets, GArray *crc)
+{
+    AVCodecContext *dec = avcodec_alloc_context3(avcodec_find_decoder(id));
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+
+    dec->thread_count = 1;
+    if (extradata) {
+        dec->extradata_size = g_bytes_get_size(extradata);
+        dec->extradata = av_mallocz(dec->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        memcpy(dec->extradata, g_bytes_get_data(extradata, NULL), dec->extradata_size);
+    }
+    g_assert_cmpint(avcodec_open2(dec, dec->codec, NULL), ==, 0);
+
+    for (guint i = 0; i <= packets->len; i++) {
+        if (i < packets->len) {
+            GBytes *data = g_ptr_array_index(packets, i);
+            g_assert_cmpint(av_new_packet(pkt, g_bytes_get_size(data)), ==, 0);
+            memcpy(pkt->data, g_bytes_get_data(data, NULL), pkt->size);
+            g_assert_cmpint(avcodec_send_packet(dec, pkt), ==, 0);
+            av_packet_unref(pkt);
+        } else {
+            avcodec_send_packet(dec, NULL);
+        }
+        while (avcodec_receive_frame(dec, frame) == 0) {
+            uint32_t c = test_image_crc(frame);
+            g_array_append_val(crc, c);
+            av_frame_unref(frame);
+        }
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&dec);
+}
+
+static void test_mpeg4_stream(TestStream *s)
+{
+    AVCodecContext *enc = avcodec_alloc_context3(avcodec_find_encoder(AV_CODEC_ID_MPEG4));
+    AVFrame *frame = av_frame_alloc();
+
+    s->packets = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+    s->ts = g_array_new(false, false, sizeof(int64_t));
+    s->crc = g_array_new(false, false, sizeof(uint32_t));
+    s->max_packet = 0;
+
+    enc->width = width;
+    enc->height = height;
+    enc->pix_fmt = AV_PIX_FMT_YUV420P;
+    enc->time_base = (AVRational){ 1, TEST_FRAMERATE };
+    enc->framerate = (AVRational){ TEST_FRAMERATE, 1 };
+    enc->gop_size = TEST_FRAMERATE;
+    enc->max_b_frames = 0;
+    enc->bit_rate = (int64_t)width * height * 4;
+    enc->thread_count = 1;
+    g_assert_cmpint(avcodec_open2(enc, enc->codec, NULL), ==, 0);
+
+    frame->width = width;
+    frame->height = height;
+    frame->format = AV_PIX_FMT_YUV420P;
+    g_assert_cmpint(av_frame_get_buffer(frame, 0), ==, 0);
+
+    for (int i = 0; i < frames; i++) {
+        g_assert_cmpint(av_frame_make_writable(frame), ==, 0);
+        test_picture(frame, i);
+        frame->pts = i;
+        g_assert_cmpint(avcodec_send_frame(enc, frame), ==, 0);
+        test_receive_packets(enc, s);
+    }
+    avcodec_send_frame(enc, NULL);
+    test_receive_packets(enc, s);
+    g_assert_cmpint(s->packets->len, ==, frames);
+
+    test_reference_decode(AV_CODEC_ID_MPEG4, NULL, s->packets, s->crc);
+    g_assert_cmpint(s->crc->len, ==, frames);
+
+    av_frame_free(&frame);
+    avcodec_free_context(&enc);
+}
+
+static size_t vdec_fill_input(DCodecTest *t, int index, uint8_t *buf, int64_t *ts)
+{
+    TestStream *s = t->opaque;
+    GBytes *data = g_ptr_array_index(s->packets, index);
+
+    memcpy(buf, g_bytes_get_data(data, NULL), g_bytes_get_size(data));
+    *ts = g_array_index(s->ts, int64_t, index);
+    return g_bytes_get_size(data);
+}
+
+static void vdec_check(DCodecTest *t, const uint8_t *data, size_t len, int64_t ts)
+{
+    TestStream *s = t->opaque;
+
+    /* no b-frames, so frames come out in input order */
+    g_assert_cmpint(ts, ==, (uint32_t)g_array_index(s->ts, int64_t, t->outputs));
+    g_assert_cmpuint(len, ==, t->output_size);
+    if (s->crc == NULL) {
+        return;
+    }
+    g_assert_cmphex(crc32c(0xffffffff, data, len), ==,
+                    g_array_index(s->crc, uint32_t, t->outputs));
+}
+
+static void test_vdec(const void *opaque)
+{
+    OMX_COLOR_FORMATTYPE format = GPOINTER_TO_INT(opaque);
+    enum AVPixelFormat av_format = pixel_format_omx_to_av(format);
+    g_autofree char *name = g_strdup_printf("mpeg4 decoder, guest memory %s",
+                                            av_get_pix_fmt_name(av_format));
+    DCodecTest t = { 0 };
+    TestStream s;
+
+    test_mpeg4_stream(&s);
+    /* the reference decode is yuv420p, other formats are only counted */
+    if (av_format != AV_PIX_FMT_YUV420P) {
+        g_array_free(s.crc, true);
+        s.crc = NULL;
+    }
+
+    t.name = name;
+    t.fill_input = vdec_fill_input;
+    t.check = vdec_check;
+    t.opaque = &s;
+    t.inputs = frames;
+    t.expected_outputs = frames;
+    t.input_size = s.max_packet + 1024;
+    t.output_size = av_image_get_buffer_size(av_format, width, height, 1);
+
+    t.component = dcodec_vdec_init_component(OMX_VIDEO_CodingMPEG4, test_notify);
+    g_assert_nonnull(t.component);
+    test_set_parameter(&t, OMX_IndexParamVideoDcodecDefinition,
+                       &(OMX_VIDEO_DCODECDEFINITIONTYPE) {
+                           .nPortIndex = CODEC_INPUT_PORT_INDEX,
+                           .nFrameWidth = width,
+                           .nFrameHeight = height,
+                       });
+    test_set_parameter(&t, OMX_IndexParamVideoDcodecDefinition,
+                       &(OMX_VIDEO_DCODECDEFINITIONTYPE) {
+                           .nPortIndex = CODEC_OUTPUT_PORT_INDEX,
+                           .nFrameWidth = width,
+                           .nFrameHeight = height,
+                           .eColorFormat = format,
+                           .xFramerate = TEST_FRAMERATE << 16,
+                       });
+
+    test_run(&t);
+    g_assert_cmpint(t.outputs, ==, frames);
+
+    test_stream_free(&s);
+}
+
+typedef struct TestEncode {
+    enum AVPixelFormat format;
+    AVFrame *frame;
+    /* crc of every source picture, as yuv420p */
+    GArray *crc;
+    GPtrArray *packets;
+} TestEncode;
+
+static size_t venc_fill_input(DCodecTest *t, int index, uint8_t *buf, int64_t *ts)
+{
+    TestEncode *e = t->opaque;
+    AVFrame *frame = e->frame;
+    uint32_t crc;
+
+    test_picture(frame, index);
+    crc = test_image_crc(frame);
+    g_array_append_val(e->crc, crc);
+
+    *ts = test_frame_ts(index);
+    if (e->format == AV_PIX_FMT_YUV420P) {
+        return av_image_copy_to_buffer(buf, t->input_size,
+                                       (const uint8_t * const *)frame->data,
+                                       frame->linesize, AV_PIX_FMT_YUV420P,
+                                       width, height, 1);
+    } else {
+        struct SwsContext *sws = sws_getContext(width, height, AV_PIX_FMT_YUV420P,
+                                                width, height, e->format,
+                                                SWS_POINT, NULL, NULL, NULL);
+        uint8_t *data[4];
+        int linesize[4];
+
+        av_image_fill_arrays(data, linesize, buf, e->format, width, height, 1);
+        sws_scale(sws, (const uint8_t * const *)frame->data, frame->linesize,
+                  0, height, data, linesize);
+        sws_freeContext(sws);
+        return av_image_get_buffer_size(e->format, width, height, 1);
+    }
+}
+
+static void venc_check(DCodecTest *t, const uint8_t *data, size_t len, int64_t ts)
+{
+    TestEncode *e = t->opaque;
+
+    /* ffv1 has no reordering */
+    g_assert_cmpint(ts, ==, (uint32_t)test_frame_ts(t->outputs));
+    g_ptr_array_add(e->packets, g_bytes_new(data, len));
+}
+
+static void test_venc(const void *opaque)
+{
+    OMX_COLOR_FORMATTYPE format = GPOINTER_TO_INT(opaque);
+    enum AVPixelFormat av_format = pixel_format_omx_to_av(format);
+    g_autofree char *name = g_strdup_printf("ffv1 encoder, guest memory %s",
+                                            av_get_pix_fmt_name(av_format));
+    g_autoptr(GArray) crc = g_array_new(false, false, sizeof(uint32_t));
+    DCodecTest t = { 0 };
+    TestEncode e = { 0 };
+
+    e.format = av_format;
+    e.crc = g_array_new(false, false, sizeof(uint32_t));
+    e.packets = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+    e.frame = av_frame_alloc();
+    e.frame->width = width;
+    e.frame->height = height;
+    e.frame->format = AV_PIX_FMT_YUV420P;
+    g_assert_cmpint(av_frame_get_buffer(e.frame, 0), ==, 0);
+
+    t.name = name;
+    t.fill_input = venc_fill_input;
+    t.check = venc_check;
+    t.opaque = &e;
+    t.inputs = frames;
+    t.expected_outputs = frames;
+    t.input_size = av_image_get_buffer_size(av_format, width, height, 1);
+    /* lossless frames of noisy content can be larger than the raw picture */
+    t.output_size = (size_t)width * height * 4 + 4096;
+
+    t.component = dcodec_venc_init_component(OMX_VIDEO_CodingUnused, test_notify);
+    g_assert_nonnull(t.component);
+    test_set_parameter(&t, (OMX_INDEXTYPE)OMX_IndexParamVideoFFmpeg,
+                       &(OMX_VIDEO_PARAM_FFMPEGTYPE) {
+                           .nSize = sizeof(OMX_VIDEO_PARAM_FFMPEGTYPE),
+                           .nPortIndex = CODEC_OUTPUT_PORT_INDEX,
+                           .eCodecId = AV_CODEC_ID_FFV1,
+                           .nWidth = width,
+                           .nHeight = height,
+                       });
+    test_set_parameter(&t, OMX_IndexParamVideoDcodecDefinition,
+                       &(OMX_VIDEO_DCODECDEFINITIONTYPE) {
+                           .nPortIndex = CODEC_INPUT_PORT_INDEX,
+                           .nFrameWidth = width,
+                           .nFrameHeight = height,
+                           .eColorFormat = format,
+                           .xFramerate = TEST_FRAMERATE << 16,
+                       });
+
+    test_run(&t);
+    g_assert_cmpint(t.outputs, ==, frames);
+
+    /* every packet has to decode, and yuv420p input has to survive exactly */
+    test_reference_decode(AV_CODEC_ID_FFV1, t.extradata, e.packets, crc);
+    g_assert_cmpint(crc->len, ==, frames);
+    if (av_format == AV_PIX_FMT_YUV420P) {
+        for (int i = 0; i < frames; i++) {
+            g_assert_cmphex(g_array_index(crc, uint32_t, i), ==,
+                            g_array_index(e.crc, uint32_t, i));
+        }
+    }
+
+    if (t.extradata) {
+        g_bytes_unref(t.extradata);
+    }
+    g_ptr_array_unref(e.packets);
+    g_array_free(e.crc, true);
+    av_frame_free(&e.frame);
+}
+
+#define TEST_SAMPLE_RATE 44100
+#define TEST_CHANNELS 2
+
+typedef struct TestAudio {
+    TestStream stream;
+    /* interleaved samples that were encoded, in the output format */
+    GByteArray *pcm;
+    size_t received;
+} TestAudio;
+
+static size_t audio_fill_input(DCodecTest *t, int index, uint8_t *buf, int64_t *ts)
+{
+    TestAudio *a = t->opaque;
+    GBytes *data = g_ptr_array_index(a->stream.packets, index);
+
+    memcpy(buf, g_bytes_get_data(data, NULL), g_bytes_get_size(data));
+    *ts = g_array_index(a->stream.ts, int64_t, index);
+    return g_bytes_get_size(data);
+}
+
+static void audio_check(DCodecTest *t, const uint8_t *data, size_t len, int64_t ts)
+{
+    TestAudio *a = t->opaque;
+
+    g_assert_cmpuint(a->received + len, <=, a->pcm->len);
+    g_assert(memcmp(a->pcm->data + a->received, data, len) == 0);
+    a->received += len;
+    t->done = a->received == a->pcm->len;
+}
+
+static void test_audio_flac(const void *opaque)
+{
+    int bits = GPOINTER_TO_INT(opaque);
+    AVCodecContext *enc = avcodec_alloc_context3(avcodec_find_encoder(AV_CODEC_ID_FLAC));
+    AVFrame *frame = av_frame_alloc();
+    DCodecTest t = { 0 };
+    TestAudio a = { 0 };
+    TestStream *s = &a.stream;
+    int64_t sample = 0;
+    int blocks;
+
+    enc->sample_fmt = AV_SAMPLE_FMT_S16;
+    enc->sample_rate = TEST_SAMPLE_RATE;
+    av_channel_layout_default(&enc->ch_layout, TEST_CHANNELS);
+    enc->time_base = (AVRational){ 1, TEST_SAMPLE_RATE };
+    g_assert_cmpint(avcodec_open2(enc, enc->codec, NULL), ==, 0);
+    g_assert_cmpint(enc->extradata_size, >, 0);
+
+    s->packets = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+    s->ts = g_array_new(false, false, sizeof(int64_t));
+    a.pcm = g_byte_array_new();
+
+    frame->nb_samples = enc->frame_size;
+    frame->format = enc->sample_fmt;
+    av_channel_layout_copy(&frame->ch_layout, &enc->ch_layout);
+    g_assert_cmpint(av_frame_get_buffer(frame, 0), ==, 0);
+
+    /* as many seconds of audio as there are seconds of video */
+    blocks = (int64_t)frames * TEST_SAMPLE_RATE / TEST_FRAMERATE / enc->frame_size;
+    for (int i = 0; i < blocks; i++) {
+        int16_t *samples;
+
+        g_assert_cmpint(av_frame_make_writable(frame), ==, 0);
+        samples = (int16_t *)frame->data[0];
+        for (int j = 0; j < frame->nb_samples; j++, sample++) {
+            samples[j * 2] = 8000 * sin(sample * 2 * M_PI * 440 / TEST_SAMPLE_RATE);
+            samples[j * 2 + 1] = 6000 * sin(sample * 2 * M_PI * 660 / TEST_SAMPLE_RATE);
+        }
+        if (bits == 32) {
+            /* what the resampler makes of s16 */
+            for (int j = 0; j < frame->nb_samples * TEST_CHANNELS; j++) {
+                int32_t s32 = (int32_t)samples[j] * (1 << 16);
+                g_byte_array_append(a.pcm, (uint8_t *)&s32, sizeof(s32));
+            }
+        } else {
+            g_byte_array_append(a.pcm, frame->data[0], frame->nb_samples * TEST_CHANNELS * 2);
+        }
+        frame->pts = sample - frame->nb_samples;
+        g_assert_cmpint(avcodec_send_frame(enc, frame), ==, 0);
+        test_receive_packets(enc, s);
+    }
+    avcodec_send_frame(enc, NULL);
+    test_receive_packets(enc, s);
+    g_assert_cmpint(s->packets->len, ==, blocks);
+
+    t.name = bits == 32 ? "flac decoder, paged guest memory s32" : "flac decoder, guest memory s16";
+    t.fill_input = audio_fill_input;
+    t.check = audio_check;
+    t.opaque = &a;
+    t.inputs = blocks;
+    t.config = g_bytes_new(enc->extradata, enc->extradata_size);
+    t.input_size = CODEC_AUDIO_INPUT_BUFFER_SIZE;
+    t.output_size = CODEC_AUDIO_OUTPUT_BUFFER_SIZE;
+    if (bits == 32) {
+        /* not a multiple of the sample size, so samples straddle pages */
+        t.page_size = 4094;
+    }
+    g_assert_cmpuint(s->max_packet, <=, t.input_size);
+
+    t.component = dcodec_audio_init_component(OMX_AUDIO_CodingFLAC, test_notify);
+    g_assert_nonnull(t.component);
+    test_set_parameter(&t, OMX_IndexParamAudioFlac,
+                       &(OMX_AUDIO_PARAM_FLACTYPE) {
+                           .nSize = sizeof(OMX_AUDIO_PARAM_FLACTYPE),
+                           .nPortIndex = CODEC_INPUT_PORT_INDEX,
+                           .nChannels = TEST_CHANNELS,
+                           .nSampleRate = TEST_SAMPLE_RATE,
+                       });
+    test_set_parameter(&t, OMX_IndexParamAudioPcm,
+                       &(OMX_AUDIO_PARAM_PCMMODETYPE) {
+                           .nSize = sizeof(OMX_AUDIO_PARAM_PCMMODETYPE),
+                           .nPortIndex = CODEC_OUTPUT_PORT_INDEX,
+                           .nChannels = TEST_CHANNELS,
+                           .eNumData = OMX_NumericalDataSigned,
+                           .eEndian = OMX_EndianLittle,
+                           .bInterleaved = OMX_TRUE,
+                           .nBitPerSample = bits,
+                           .nSamplingRate = TEST_SAMPLE_RATE,
+                           .ePCMMode = OMX_AUDIO_PCMModeLinear,
+                       });
+
+    test_run(&t);
+    g_assert_cmpuint(a.received, ==, a.pcm->len);
+
+    if (t.extradata) {
+        g_bytes_unref(t.extradata);
+    }
+    test_stream_free(s);
+    g_byte_array_unref(a.pcm);
+    av_frame_free(&frame);
+    avcodec_free_context(&enc);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    if (g_test_perf()) {
+        width = 1280;
+        height = 720;
+        frames = 300;
+    }
+
+    g_test_add_data_func("/dcodec/vdec/mpeg4/yuv420p",
+                         GINT_TO_POINTER(OMX_COLOR_FormatYUV420Planar), test_vdec);
+    g_test_add_data_func("/dcodec/vdec/mpeg4/rgba",
+                         GINT_TO_POINTER(OMX_COLOR_Format32BitRGBA8888), test_vdec);
+    g_test_add_data_func("/dcodec/venc/ffv1/yuv420p",
+                         GINT_TO_POINTER(OMX_COLOR_FormatYUV420Planar), test_venc);
+    g_test_add_data_func("/dcodec/venc/ffv1/rgba",
+                         GINT_TO_POINTER(OMX_COLOR_Format32BitRGBA8888), test_venc);
+    g_test_add_data_func("/dcodec/audio/flac/s16", GINT_TO_POINTER(16), test_audio_flac);
+    g_test_add_data_func("/dcodec/audio/flac/s32", GINT_TO_POINTER(32), test_audio_flac);
+
+    return g_test_run();
+}
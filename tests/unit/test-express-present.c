@@ -0,0 +1,135 @@
+/*
+ * express-gpu present scheduler test
+ *
+ * Runs the compositor's refresh clock without a window or GL context and
+ * checks tick pacing and jitter, then the frame latching that counts the
+ * guest frames overwritten between two ticks.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+#include "hw/express-gpu/express_present.h"
+
+#define TEST_TICKS 30
+
+char *get_now_time(void)
+{
+    /* express_present.c logs to stdout, keep its lines TAP comments */
+    return (char *)"#";
+}
+
+int null_printf(const char *a, ...)
+{
+    return 0;
+}
+
+static void test_clock_ticks(void)
+{
+    Present_Clock clock;
+    uint64_t ticks = 0;
+
+    g_assert_cmpint(present_clock_init(&clock, 120), ==, 0);
+    g_assert_cmpint(clock.period_ns, ==, NANOSECONDS_PER_SECOND / 120);
+    g_assert_cmpint(present_clock_until_tick(&clock), <=, clock.period_ns);
+
+    int64_t start = get_clock();
+    int64_t first_tick = clock.next_tick_ns;
+
+    while (ticks < TEST_TICKS) {
+        ticks += present_clock_wait(&clock);
+        /* the clock never wakes before the tick it reports */
+        g_assert_cmpint(get_clock(), >=, first_tick + (int64_t)(ticks - 1) * clock.period_ns);
+    }
+    int64_t elapsed = get_clock() - start;
+
+    g_assert_cmpuint(clock.ticks, ==, ticks);
+    g_assert_cmpint(clock.next_tick_ns, ==, first_tick + (int64_t)ticks * clock.period_ns);
+    g_assert_cmpint(elapsed, >=, (TEST_TICKS - 1) * clock.period_ns);
+
+    /* loose bounds, a loaded CI host may miss a tick now and then */
+    g_assert_cmpuint(clock.missed_ticks, <, TEST_TICKS / 2);
+    g_assert_cmpint(clock.jitter_sum_ns / (int64_t)clock.ticks, <, clock.period_ns);
+
+    printf("# %" PRIu64 " ticks, missed %" PRIu64 ", jitter avg %" PRId64 " ns max %" PRId64 " ns\n",
+           clock.ticks, clock.missed_ticks, clock.jitter_sum_ns / (int64_t)clock.ticks, clock.jitter_max_ns);
+
+    present_clock_reset_stats(&clock);
+    g_assert_cmpuint(clock.ticks, ==, 0);
+    g_assert_cmpint(clock.jitter_max_ns, ==, 0);
+
+    present_clock_destroy(&clock);
+}
+
+static void test_clock_missed(void)
+{
+    Present_Clock clock;
+
+    g_assert_cmpint(present_clock_init(&clock, 240), ==, 0);
+
+    /* sleeping through several ticks reports them all in one wakeup */
+    g_usleep(5 * clock.period_ns / SCALE_US);
+    uint64_t expirations = present_clock_wait(&clock);
+
+    g_assert_cmpuint(expirations, >=, 4);
+    g_assert_cmpuint(clock.missed_ticks, ==, expirations - 1);
+    g_assert_cmpint(clock.next_tick_ns, >, get_clock() - clock.period_ns);
+
+    present_clock_destroy(&clock);
+
+    g_assert_cmpint(present_clock_init(&clock, 0), !=, 0);
+}
+
+static void test_latch(void)
+{
+    Present_Clock clock;
+    Present_Timing timing;
+
+    present_reset();
+    g_assert_cmpint(present_clock_init(&clock, 60), ==, 0);
+
+    /* nothing committed, nothing to compose */
+    g_assert_false(present_latch_frame());
+
+    g_assert_cmpuint(present_commit_frame(), ==, 1);
+    g_assert_true(present_latch_frame());
+    g_assert_false(present_latch_frame());
+    present_frame_done(&clock, 1000);
+
+    present_get_timing(&timing);
+    g_assert_cmpuint(timing.present_sequence, ==, 1);
+    g_assert_cmpuint(timing.frame_sequence, ==, 1);
+    g_assert_cmpint(timing.present_time_ns, ==, 1000);
+    g_assert_cmpint(timing.refresh_period_ns, ==, clock.period_ns);
+    g_assert_cmpuint(timing.dropped_frames, ==, 0);
+    g_assert_cmpint(timing.next_present_ns, >, timing.host_time_ns);
+    g_assert_cmpint(timing.next_present_ns, <=, timing.host_time_ns + clock.period_ns);
+
+    /* three frames within one tick, only the newest is shown */
+    present_commit_frame();
+    present_commit_frame();
+    g_assert_cmpuint(present_commit_frame(), ==, 4);
+    g_assert_true(present_latch_frame());
+    present_frame_done(&clock, 2000);
+
+    present_get_timing(&timing);
+    g_assert_cmpuint(timing.present_sequence, ==, 2);
+    g_assert_cmpuint(timing.frame_sequence, ==, 4);
+    g_assert_cmpuint(timing.dropped_frames, ==, 2);
+
+    present_clock_destroy(&clock);
+    present_reset();
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/express-present/clock-ticks", test_clock_ticks);
+    g_test_add_func("/express-present/clock-missed", test_clock_missed);
+    g_test_add_func("/express-present/latch", test_latch);
+
+    return g_test_run();
+}
@@ -101,6 +101,51 @@ static void test_io_channel_fd(void)
     object_unref(OBJECT(ioc));
 }
 
+#ifdef CONFIG_PREADV
+static void test_io_channel_file_pwrite_pread(void)
+{
+    QIOChannel *ioc;
+    char wbuf[512], rbuf[512];
+    struct stat st;
+
+    unlink(TEST_FILE);
+    ioc = QIO_CHANNEL(qio_channel_file_new_path(
+                          TEST_FILE,
+                          O_RDWR | O_CREAT | O_TRUNC | O_BINARY, TEST_MASK,
+                          &error_abort));
+    g_assert(qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE));
+
+    memset(wbuf, 'a', sizeof(wbuf));
+    g_assert_cmpint(qio_channel_pwrite(ioc, wbuf, sizeof(wbuf), 0,
+                                       &error_abort), ==, sizeof(wbuf));
+    memset(wbuf, 'b', sizeof(wbuf));
+    g_assert_cmpint(qio_channel_pwrite(ioc, wbuf, sizeof(wbuf), 8192,
+                                       &error_abort), ==, sizeof(wbuf));
+
+    /* Positioned I/O must not move the stream position */
+    g_assert_cmpint(qio_channel_io_seek(ioc, 0, SEEK_CUR, &error_abort),
+                    ==, 0);
+    g_assert_cmpint(stat(TEST_FILE, &st), ==, 0);
+    g_assert_cmpint(st.st_size, ==, 8192 + sizeof(wbuf));
+
+    g_assert_cmpint(qio_channel_pread(ioc, rbuf, sizeof(rbuf), 8192,
+                                      &error_abort), ==, sizeof(rbuf));
+    g_assert(memcmp(rbuf, wbuf, sizeof(rbuf)) == 0);
+
+    /* The gap between the two writes reads back as zeroes */
+    g_assert_cmpint(qio_channel_pread(ioc, rbuf, sizeof(rbuf), 4096,
+                                      &error_abort), ==, sizeof(rbuf));
+    memset(wbuf, 0, sizeof(wbuf));
+    g_assert(memcmp(rbuf, wbuf, sizeof(rbuf)) == 0);
+
+    g_assert_cmpint(qio_channel_pread(ioc, rbuf, sizeof(rbuf), 65536,
+                                      &error_abort), ==, 0);
+
+    unlink(TEST_FILE);
+    object_unref(OBJECT(ioc));
+}
+#endif /* CONFIG_PREADV */
+
 
 #ifndef _WIN32
 static void test_io_channel_pipe(bool async)
@@ -135,6 +180,30 @@ static void test_io_channel_pipe_sync(void)
 {
     test_io_channel_pipe(false);
 }
+
+#ifdef CONFIG_PREADV
+static void test_io_channel_pipe_pwrite(void)
+{
+    QIOChannel *ioc;
+    char buf[16] = { 0 };
+    Error *local_err = NULL;
+    int fd[2];
+
+    if (!g_unix_open_pipe(fd, FD_CLOEXEC, NULL)) {
+        perror("pipe");
+        abort();
+    }
+
+    ioc = QIO_CHANNEL(qio_channel_file_new_fd(fd[1]));
+    g_assert(!qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE));
+    g_assert_cmpint(qio_channel_pwrite(ioc, buf, sizeof(buf), 0,
+                                       &local_err), ==, -1);
+    error_free_or_abort(&local_err);
+
+    object_unref(OBJECT(ioc));
+    close(fd[0]);
+}
+#endif /* CONFIG_PREADV */
 #endif /* ! _WIN32 */
 
 
@@ -147,9 +216,16 @@ int main(int argc, char **argv)
     g_test_add_func("/io/channel/file", test_io_channel_file);
     g_test_add_func("/io/channel/file/rdwr", test_io_channel_file_rdwr);
     g_test_add_func("/io/channel/file/fd", test_io_channel_fd);
+#ifdef CONFIG_PREADV
+    g_test_add_func("/io/channel/file/pwrite-pread",
+                    test_io_channel_file_pwrite_pread);
+#endif
 #ifndef _WIN32
     g_test_add_func("/io/channel/pipe/sync", test_io_channel_pipe_sync);
     g_test_add_func("/io/channel/pipe/async", test_io_channel_pipe_async);
+#ifdef CONFIG_PREADV
+    g_test_add_func("/io/channel/pipe/pwrite", test_io_channel_pipe_pwrite);
+#endif
 #endif
     return g_test_run();
 }
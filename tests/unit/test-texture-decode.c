@@ -0,0 +1,309 @@
+/*
+ * express-gpu compressed texture decoder test
+ *
+ * Decodes hand-built ETC2, EAC and ASTC blocks whose expected texels follow
+ * directly from the format specifications, then times whole-image decodes.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+
+#include "hw/express-gpu/texture_decode.h"
+
+#define TEST_IMAGE_DIM 1024
+
+static void put_be64(uint8_t *p, uint64_t v)
+{
+    for (int i = 7; i >= 0; i--) {
+        p[i] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++) {
+        p[i] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+/* ETC pixel index bits: MSB at bit x*4+y+16, LSB at bit x*4+y */
+static uint64_t etc_index(int x, int y, int index)
+{
+    int i = x * 4 + y;
+    return ((uint64_t)(index >> 1) << (i + 16)) | ((uint64_t)(index & 1) << i);
+}
+
+static void assert_rgba(const uint8_t *p, int r, int g, int b, int a)
+{
+    g_assert_cmpint(p[0], ==, r);
+    g_assert_cmpint(p[1], ==, g);
+    g_assert_cmpint(p[2], ==, b);
+    g_assert_cmpint(p[3], ==, a);
+}
+
+static void test_etc1_individual(void)
+{
+    uint8_t block[8];
+    uint8_t out[4 * 4 * 4];
+
+    /* R 0xa/0x5, G 0x3/0xc, B 0x0/0xf, codewords 0 and 7, no flip, all indices 0 */
+    put_be64(block, 0xa53c0f0000000000ull | (7ull << 34));
+    etc2_decode_color_block(block, false, out, 16);
+
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            if (x < 2) {
+                assert_rgba(out + y * 16 + x * 4, 170 + 2, 51 + 2, 0 + 2, 255);
+            } else {
+                assert_rgba(out + y * 16 + x * 4, 85 + 47, 204 + 47, 255, 255);
+            }
+        }
+    }
+}
+
+static void test_etc1_differential(void)
+{
+    uint8_t block[8];
+    uint8_t out[4 * 4 * 4];
+
+    /* R 16 delta -1, G 0 delta +3, B 31 delta 0, codeword 1 for both halves, flipped */
+    uint64_t bits = (16ull << 59) | (7ull << 56) | (0ull << 51) | (3ull << 48) | (31ull << 43) |
+                    (1ull << 37) | (1ull << 34) | (1ull << 33) | (1ull << 32);
+    bits |= etc_index(0, 0, 3) | etc_index(3, 3, 1);
+    put_be64(block, bits);
+    etc2_decode_color_block(block, false, out, 16);
+
+    /* 5-bit 16 -> 132, 15 -> 123, 0 -> 0, 3 -> 24, 31 -> 255; modifiers 5/17 */
+    assert_rgba(out, 132 - 17, 0, 255 - 17, 255);
+    assert_rgba(out + 16 + 4, 132 + 5, 5, 255, 255);
+    assert_rgba(out + 2 * 16, 123 + 5, 24 + 5, 255, 255);
+    assert_rgba(out + 3 * 16 + 3 * 4, 123 + 17, 24 + 17, 255, 255);
+}
+
+static void test_etc2_t_mode(void)
+{
+    uint8_t block[8];
+    uint8_t out[4 * 4 * 4];
+
+    /* R 0 delta -4 overflows into T mode: C1 (0, 15, 0), C2 (8, 8, 8), distance 3 */
+    uint64_t bits = (1ull << 58) | (0xfull << 52) | (8ull << 44) | (8ull << 40) | (8ull << 36) | (1ull << 33);
+    bits |= etc_index(1, 0, 1) | etc_index(2, 0, 2) | etc_index(3, 0, 3);
+    put_be64(block, bits);
+    etc2_decode_color_block(block, false, out, 16);
+
+    assert_rgba(out, 0, 255, 0, 255);
+    assert_rgba(out + 4, 139, 139, 139, 255);
+    assert_rgba(out + 8, 136, 136, 136, 255);
+    assert_rgba(out + 12, 133, 133, 133, 255);
+}
+
+static void test_etc2_planar(void)
+{
+    uint8_t block[8];
+    uint8_t out[4 * 4 * 4];
+
+    /* B 0 delta -4 overflows into planar mode: red goes 0 -> 255 along x, everything else 0 */
+    put_be64(block, (1ull << 42) | (0x1full << 34) | (1ull << 33) | (1ull << 32));
+    etc2_decode_color_block(block, false, out, 16);
+
+    static const int ramp[4] = {0, 64, 128, 191};
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            assert_rgba(out + y * 16 + x * 4, ramp[x], 0, 0, 255);
+        }
+    }
+}
+
+static void test_etc2_punchthrough(void)
+{
+    uint8_t block[8];
+    uint8_t out[4 * 4 * 4];
+
+    /* same layout as the differential test but with the opaque bit cleared */
+    uint64_t bits = (16ull << 59) | (7ull << 56) | (3ull << 48) | (31ull << 43) |
+                    (1ull << 37) | (1ull << 34) | (1ull << 32);
+    bits |= etc_index(0, 0, 2) | etc_index(1, 0, 3) | etc_index(2, 0, 1);
+    put_be64(block, bits);
+    etc2_decode_color_block(block, true, out, 16);
+
+    assert_rgba(out, 0, 0, 0, 0);
+    assert_rgba(out + 4, 132 - 17, 0, 255 - 17, 255);
+    assert_rgba(out + 8, 132 + 17, 17, 255, 255);
+    /* index 0 loses its modifier in a transparent block */
+    assert_rgba(out + 12, 132, 0, 255, 255);
+}
+
+static void test_eac(void)
+{
+    uint8_t block[8];
+    uint8_t out[4 * 4 * 4] = {0};
+    uint16_t r11[4 * 4];
+
+    /* alpha base 128, multiplier 2, table 13, pixel 0 index 3 (-10), the rest index 7 (+9) */
+    uint64_t indices = 0;
+    for (int i = 1; i < 16; i++) {
+        indices |= 7ull << (45 - 3 * i);
+    }
+    put_be64(block, (128ull << 56) | (2ull << 52) | (13ull << 48) | (3ull << 45) | indices);
+    eac_decode_alpha_block(block, out, 16);
+    g_assert_cmpint(out[3], ==, 108);
+    g_assert_cmpint(out[16 * 3 + 4 * 3 + 3], ==, 146);
+    g_assert_cmpint(out[0], ==, 0);
+
+    /* R11 with multiplier 0 uses the modifier at 1/8 scale: 128 * 8 + 4 + 14 = 1042 */
+    put_be64(block, (128ull << 56) | (0ull << 52) | (0ull << 48) | (7ull << 45));
+    eac_decode_r11_block(block, false, r11, 4, 1);
+    g_assert_cmpuint(r11[0], ==, (1042 << 5) | (1042 >> 6));
+
+    /* signed base -128 is read as -127 and the result clamps at -1023 */
+    put_be64(block, (0x80ull << 56) | (1ull << 52) | (0ull << 48) | (3ull << 45));
+    eac_decode_r11_block(block, true, r11, 4, 1);
+    g_assert_cmpint((int16_t)r11[0], ==, -32767);
+}
+
+static void test_astc_void_extent(void)
+{
+    uint8_t block[16];
+    uint8_t out[ASTC_MAX_BLOCK_DIM * ASTC_MAX_BLOCK_DIM * 4];
+
+    /* constant color block with all-ones extents, RGBA 0x1234 0x5678 0x9abc 0xffff */
+    put_le64(block, 0xfffffffffffffdfcull);
+    put_le64(block + 8, 0xffff9abc56781234ull);
+
+    g_assert_true(astc_decode_block(block, 6, 5, false, out, 6 * 4));
+    for (int i = 0; i < 6 * 5; i++) {
+        assert_rgba(out + i * 4, 0x12, 0x56, 0x9a, 0xff);
+    }
+
+    /* HDR void extent is an error in the LDR profile */
+    block[1] |= 0x02;
+    g_assert_false(astc_decode_block(block, 6, 5, false, out, 6 * 4));
+    assert_rgba(out, 0xff, 0x00, 0xff, 0xff);
+}
+
+static void test_astc_luminance(void)
+{
+    uint8_t block[16] = {0};
+    uint8_t out[4 * 4 * 4];
+
+    /*
+     * block mode 0x013: 4x2 weight grid of 8 levels (24 bits), one partition,
+     * CEM 0 with two 8-bit luminance endpoints at bit 17
+     */
+    uint64_t low = 0x013 | (0ull << 17) | (255ull << 25);
+    put_le64(block, low);
+    g_assert_true(astc_decode_block(block, 4, 4, false, out, 16));
+    for (int i = 0; i < 16; i++) {
+        assert_rgba(out + i * 4, 0, 0, 0, 255);
+    }
+
+    /* all weights at the top level pick the second endpoint */
+    block[13] = block[14] = block[15] = 0xff;
+    g_assert_true(astc_decode_block(block, 4, 4, false, out, 16));
+    for (int i = 0; i < 16; i++) {
+        assert_rgba(out + i * 4, 255, 255, 255, 255);
+    }
+
+    /* endpoints 0x80 in sRGB keep their value after the 0x80 fill */
+    put_le64(block, 0x013 | (0x80ull << 17) | (0x80ull << 25));
+    g_assert_true(astc_decode_block(block, 4, 4, true, out, 16));
+    assert_rgba(out, 0x80, 0x80, 0x80, 255);
+}
+
+static void test_astc_reserved(void)
+{
+    uint8_t block[16] = {0};
+    uint8_t out[8 * 8 * 4];
+
+    /* block mode 0 is reserved */
+    g_assert_false(astc_decode_block(block, 8, 8, false, out, 8 * 4));
+    for (int i = 0; i < 64; i++) {
+        assert_rgba(out + i * 4, 0xff, 0x00, 0xff, 0xff);
+    }
+
+    /* a 2x8 weight grid is taller than a 4x4 block */
+    put_le64(block, 0x013 | (2ull << 2));
+    g_assert_false(astc_decode_block(block, 4, 4, false, out, 16));
+}
+
+static void test_image_edges(void)
+{
+    Texture_Decode_Format format = {TEXTURE_DECODE_ASTC, 5, 5};
+    uint8_t blocks[16 * 4];
+    uint8_t out[7 * 6 * 4];
+
+    for (int i = 0; i < 4; i++) {
+        put_le64(blocks + i * 16, 0xfffffffffffffdfcull);
+        put_le64(blocks + i * 16 + 8, 0xffff000000000000ull | ((uint64_t)(i * 0x40) << 8));
+    }
+
+    g_assert_cmpuint(texture_decode_image_size(&format, 7, 6), ==, sizeof(blocks));
+    memset(out, 0xee, sizeof(out));
+    texture_decode_rows(&format, blocks, 7, 6, 0, 2, out);
+
+    /* the partial blocks on the right and bottom edges are clipped to the image */
+    for (int y = 0; y < 6; y++) {
+        for (int x = 0; x < 7; x++) {
+            int block = (y / 5) * 2 + x / 5;
+            assert_rgba(out + (y * 7 + x) * 4, block * 0x40, 0, 0, 0xff);
+        }
+    }
+}
+
+static void test_throughput(void)
+{
+    static const Texture_Decode_Format formats[] = {
+        {TEXTURE_DECODE_ETC2_RGBA8, 4, 4},
+        {TEXTURE_DECODE_EAC_RG11, 4, 4},
+        {TEXTURE_DECODE_ASTC, 4, 4},
+        {TEXTURE_DECODE_ASTC, 8, 8},
+    };
+
+    GRand *rand = g_rand_new_with_seed(1);
+    uint8_t *dst = g_malloc(TEST_IMAGE_DIM * TEST_IMAGE_DIM * 4);
+
+    for (int i = 0; i < ARRAY_SIZE(formats); i++) {
+        const Texture_Decode_Format *format = &formats[i];
+        size_t size = texture_decode_image_size(format, TEST_IMAGE_DIM, TEST_IMAGE_DIM);
+        uint8_t *src = g_malloc(size);
+
+        /* random data exercises every mode, including ASTC error blocks */
+        for (size_t j = 0; j < size; j++) {
+            src[j] = g_rand_int(rand);
+        }
+
+        g_test_timer_start();
+        texture_decode_rows(format, src, TEST_IMAGE_DIM, TEST_IMAGE_DIM, 0,
+                            TEST_IMAGE_DIM / format->block_height, dst);
+        double elapsed = g_test_timer_elapsed();
+
+        printf("# kind %d %dx%d: %.1f Mpixel/s\n", format->kind, format->block_width, format->block_height,
+               TEST_IMAGE_DIM * TEST_IMAGE_DIM / 1e6 / MAX(elapsed, 1e-9));
+        g_free(src);
+    }
+
+    g_free(dst);
+    g_rand_free(rand);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/texture-decode/etc1-individual", test_etc1_individual);
+    g_test_add_func("/texture-decode/etc1-differential", test_etc1_differential);
+    g_test_add_func("/texture-decode/etc2-t-mode", test_etc2_t_mode);
+    g_test_add_func("/texture-decode/etc2-planar", test_etc2_planar);
+    g_test_add_func("/texture-decode/etc2-punchthrough", test_etc2_punchthrough);
+    g_test_add_func("/texture-decode/eac", test_eac);
+    g_test_add_func("/texture-decode/astc-void-extent", test_astc_void_extent);
+    g_test_add_func("/texture-decode/astc-luminance", test_astc_luminance);
+    g_test_add_func("/texture-decode/astc-reserved", test_astc_reserved);
+    g_test_add_func("/texture-decode/image-edges", test_image_edges);
+    g_test_add_func("/texture-decode/throughput", test_throughput);
+
+    return g_test_run();
+}